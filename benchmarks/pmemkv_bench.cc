@@ -0,0 +1,523 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmemkv_bench.cc -- db_bench-style benchmark of pmemkv engines.
+ *
+ * Runs the given list of workloads against each of the given engines and
+ * reports throughput and latency percentiles of every workload, e.g.:
+ *
+ *	pmemkv_bench --engine=cmap,stree --db=/mnt/pmem/bench --db_size_in_gb=4 \
+ *		--benchmarks=fillrandom,readrandom --num=1000000 --threads=4
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <libpmemkv.hpp>
+
+using namespace pmem::kv;
+
+struct options {
+	std::vector<std::string> engines = {"cmap"};
+	std::vector<std::string> benchmarks = {"fillseq",    "fillrandom",
+					       "readrandom", "readseq",
+					       "scanrandom", "readwhilewriting",
+					       "deleterandom"};
+	std::string path = "/dev/shm/pmemkv_bench";
+	uint64_t db_size = 1024ULL * 1024ULL * 1024ULL;
+	size_t num = 1000000;
+	size_t reads = 0; /* 0 means num */
+	size_t key_size = 16;
+	size_t value_size = 100;
+	size_t threads = 1;
+	size_t scan_length = 100;
+	uint64_t seed = 0;
+};
+
+/* results of a single thread */
+struct thread_result {
+	size_t ops = 0;
+	size_t found = 0;
+	std::vector<uint64_t> latencies_ns;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+static uint64_t elapsed_ns(clock_type::time_point start)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					     clock_type::now() - start)
+					     .count());
+}
+
+static std::vector<std::string> split(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+
+	return items;
+}
+
+/* engines which keep data in DRAM get a directory for their allocator */
+static bool is_volatile(const std::string &engine)
+{
+	return engine == "vsmap" || engine == "vskiplist" || engine == "vcmap";
+}
+
+class benchmark {
+public:
+	benchmark(const options &opts, const std::string &engine)
+	    : opts(opts), engine(engine), value(opts.value_size, 'v')
+	{
+		for (size_t i = 0; i < value.size(); i++)
+			value[i] = static_cast<char>('a' + i % 26);
+	}
+
+	~benchmark()
+	{
+		close();
+	}
+
+	/* (re)creates the database, previous content is removed */
+	void open_fresh()
+	{
+		close();
+
+		config cfg;
+		if (engine != "blackhole") {
+			if (is_volatile(engine)) {
+				mkdir(opts.path.c_str(), S_IRWXU);
+			} else {
+				std::remove(opts.path.c_str());
+				check(cfg.put_uint64("force_create", 1), "force_create");
+			}
+			check(cfg.put_string("path", opts.path), "path");
+			check(cfg.put_uint64("size", opts.db_size), "size");
+		}
+
+		kv.reset(new db);
+		auto s = kv->open(engine, std::move(cfg));
+		if (s != status::OK)
+			throw std::runtime_error("cannot open " + engine + ": " +
+						 errormsg());
+	}
+
+	void close()
+	{
+		if (!kv)
+			return;
+
+		kv->close();
+		kv.reset();
+		if (!is_volatile(engine) && engine != "blackhole")
+			std::remove(opts.path.c_str());
+	}
+
+	/* returns false if there is no benchmark of the given name */
+	bool run(const std::string &name)
+	{
+		size_t reads = opts.reads ? opts.reads : opts.num;
+		bool with_writer = false;
+		runs++;
+		thread_function work;
+
+		if (name == "fillseq" || name == "deleteseq") {
+			bool fill = name == "fillseq";
+			work = [&, fill](size_t id, thread_result &r) {
+				auto range = partition(opts.num, id);
+				for (size_t i = range.first; i < range.second; i++)
+					timed(r, [&] { fill ? put(i) : remove(i, r); });
+			};
+		} else if (name == "fillrandom" || name == "deleterandom") {
+			bool fill = name == "fillrandom";
+			work = [&, fill](size_t id, thread_result &r) {
+				auto rng = generator(id);
+				for (size_t i = 0; i < opts.num / opts.threads; i++) {
+					uint64_t k = rng();
+					timed(r, [&] { fill ? put(k) : remove(k, r); });
+				}
+			};
+		} else if (name == "readrandom" || name == "readwhilewriting") {
+			with_writer = name == "readwhilewriting";
+			work = [&](size_t id, thread_result &r) {
+				auto rng = generator(id);
+				for (size_t i = 0; i < reads / opts.threads; i++)
+					timed(r, [&] { get(rng(), r); });
+			};
+		} else if (name == "readseq") {
+			/* every thread reads all records, latency is of the whole pass */
+			work = [&](size_t, thread_result &r) {
+				size_t records = 0;
+				auto count = [&](string_view, string_view) {
+					records++;
+					return 0;
+				};
+				timed(r, [&] {
+					check_read(kv->get_all(count), "get_all");
+				});
+				r.ops = r.found = records;
+			};
+		} else if (name == "scanrandom") {
+			size_t scans = std::max<size_t>(reads / opts.scan_length, 1);
+			work = [&, scans](size_t id, thread_result &r) {
+				auto rng = generator(id);
+				for (size_t i = 0; i < scans / opts.threads; i++)
+					timed(r, [&] { scan(rng(), r); });
+			};
+		} else {
+			return false;
+		}
+
+		if (name.compare(0, 4, "fill") == 0 || !kv)
+			open_fresh();
+
+		std::atomic<bool> done(false);
+		std::string error, writer_error;
+		std::thread writer;
+		if (with_writer) {
+			writer = std::thread([&] {
+				auto rng = generator(opts.threads);
+				try {
+					while (!done.load(std::memory_order_relaxed))
+						put(rng());
+				} catch (std::runtime_error &e) {
+					writer_error = e.what();
+				}
+			});
+		}
+
+		std::vector<thread_result> results;
+		try {
+			results = run_threads(opts.threads, work);
+		} catch (std::runtime_error &e) {
+			error = e.what();
+		}
+
+		if (with_writer) {
+			done = true;
+			writer.join();
+			if (error.empty())
+				error = writer_error;
+		}
+
+		if (error.empty())
+			report(name, results);
+		else
+			std::cout << std::left << std::setw(16) << name << ": " << error
+				  << std::endl;
+
+		return true;
+	}
+
+private:
+	typedef std::function<void(size_t, thread_result &)> thread_function;
+
+	/* thrown by workloads which are not supported by the engine */
+	struct not_supported {
+	};
+
+	void check(status s, const std::string &what)
+	{
+		if (s != status::OK)
+			throw std::runtime_error("cannot put '" + what + "' to config");
+	}
+
+	std::string key(uint64_t k) const
+	{
+		std::string digits = std::to_string(k);
+		if (digits.size() >= opts.key_size)
+			return digits.substr(digits.size() - opts.key_size);
+
+		return std::string(opts.key_size - digits.size(), '0') + digits;
+	}
+
+	std::function<uint64_t()> generator(size_t id) const
+	{
+		/* every run gets different keys, reads are not limited to earlier puts */
+		std::mt19937_64 gen(opts.seed + (runs << 32) + id);
+		std::uniform_int_distribution<uint64_t> dist(0, opts.num - 1);
+		return [gen, dist]() mutable { return dist(gen); };
+	}
+
+	std::pair<size_t, size_t> partition(size_t n, size_t id) const
+	{
+		size_t per_thread = n / opts.threads;
+		return {per_thread * id,
+			id + 1 == opts.threads ? n : per_thread * (id + 1)};
+	}
+
+	template <typename Op>
+	static void timed(thread_result &r, Op op)
+	{
+		auto start = clock_type::now();
+		op();
+		r.latencies_ns.push_back(elapsed_ns(start));
+		r.ops++;
+	}
+
+	void put(uint64_t k)
+	{
+		auto s = kv->put(key(k), value);
+		if (s != status::OK)
+			throw std::runtime_error("put failed: " + errormsg());
+	}
+
+	void get(uint64_t k, thread_result &r)
+	{
+		std::string v;
+		auto s = kv->get(key(k), &v);
+		if (s == status::OK)
+			r.found++;
+		else if (s != status::NOT_FOUND)
+			throw std::runtime_error("get failed: " + errormsg());
+	}
+
+	void remove(uint64_t k, thread_result &r)
+	{
+		auto s = kv->remove(key(k));
+		if (s == status::OK)
+			r.found++;
+		else if (s != status::NOT_FOUND)
+			throw std::runtime_error("remove failed: " + errormsg());
+	}
+
+	void scan(uint64_t k, thread_result &r)
+	{
+		size_t left = opts.scan_length;
+		auto s = kv->get_above(key(k), [&](string_view, string_view) {
+			r.found++;
+			return --left == 0 ? 1 : 0;
+		});
+		if (s != status::STOPPED_BY_CB)
+			check_read(s, "scan");
+	}
+
+	static void check_read(status s, const std::string &what)
+	{
+		if (s == status::NOT_SUPPORTED)
+			throw not_supported();
+		if (s != status::OK && s != status::NOT_FOUND)
+			throw std::runtime_error(what + " failed: " + errormsg());
+	}
+
+	std::vector<thread_result> run_threads(size_t n, thread_function f)
+	{
+		std::vector<thread_result> results(n);
+		std::vector<std::thread> threads;
+		std::vector<std::string> errors(n);
+
+		start = clock_type::now();
+		for (size_t id = 0; id < n; id++) {
+			threads.emplace_back([&, id] {
+				try {
+					f(id, results[id]);
+				} catch (not_supported &) {
+					errors[id] = "not supported";
+				} catch (std::exception &e) {
+					errors[id] = e.what();
+				}
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		elapsed = elapsed_ns(start);
+
+		for (auto &e : errors)
+			if (!e.empty())
+				throw std::runtime_error(e);
+
+		return results;
+	}
+
+	static double percentile(const std::vector<uint64_t> &sorted, double p)
+	{
+		if (sorted.empty())
+			return 0;
+		auto last = static_cast<double>(sorted.size() - 1);
+		auto idx = static_cast<size_t>(p * last);
+		return static_cast<double>(sorted[idx]) / 1000.0;
+	}
+
+	void report(const std::string &name, const std::vector<thread_result> &results)
+	{
+		size_t ops = 0, found = 0;
+		std::vector<uint64_t> latencies;
+		for (auto &r : results) {
+			ops += r.ops;
+			found += r.found;
+			latencies.insert(latencies.end(), r.latencies_ns.begin(),
+					 r.latencies_ns.end());
+		}
+		std::sort(latencies.begin(), latencies.end());
+
+		double seconds = static_cast<double>(elapsed) / 1e9;
+		char line[256];
+		snprintf(line, sizeof(line),
+			 "%-16s: %12.0f ops/sec; %10.3f micros/op; found %zu/%zu; "
+			 "latency (micros) p50 %.2f p99 %.2f p99.9 %.2f max %.2f",
+			 name.c_str(), ops ? static_cast<double>(ops) / seconds : 0.0,
+			 ops ? seconds * 1e6 * static_cast<double>(results.size()) /
+					 static_cast<double>(ops)
+			     : 0.0,
+			 found, ops, percentile(latencies, 0.5),
+			 percentile(latencies, 0.99), percentile(latencies, 0.999),
+			 percentile(latencies, 1.0));
+		std::cout << line << std::endl;
+	}
+
+	const options &opts;
+	const std::string engine;
+	std::string value;
+	std::unique_ptr<db> kv;
+	clock_type::time_point start;
+	uint64_t elapsed = 0;
+	uint64_t runs = 0;
+};
+
+static void usage(const char *name)
+{
+	std::cerr
+		<< "Usage: " << name << " [--option=value ...]\n"
+		<< "Options:\n"
+		<< "  --engine=<list>       comma-separated engines (default: cmap)\n"
+		<< "  --benchmarks=<list>   comma-separated workloads, out of:\n"
+		<< "                        fillseq, fillrandom, readrandom, readseq,\n"
+		<< "                        scanrandom, readwhilewriting, deleteseq,\n"
+		<< "                        deleterandom\n"
+		<< "  --db=<path>           pool file (directory for volatile engines)\n"
+		<< "  --db_size_in_gb=<n>   size of the pool (default: 1)\n"
+		<< "  --num=<n>             number of keys (default: 1000000)\n"
+		<< "  --reads=<n>           number of reads (default: num)\n"
+		<< "  --key_size=<n>        key size in bytes (default: 16)\n"
+		<< "  --value_size=<n>      value size in bytes (default: 100)\n"
+		<< "  --threads=<n>         number of threads (default: 1)\n"
+		<< "  --scan_length=<n>     records read by a scan (default: 100)\n"
+		<< "  --seed=<n>            seed of random keys (default: 0)\n";
+}
+
+static bool parse(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		std::string name = arg.substr(2, eq - 2);
+		std::string value = arg.substr(eq + 1);
+		try {
+			if (name == "engine")
+				opts.engines = split(value);
+			else if (name == "benchmarks")
+				opts.benchmarks = split(value);
+			else if (name == "db")
+				opts.path = value;
+			else if (name == "db_size_in_gb")
+				opts.db_size = std::stoull(value) << 30;
+			else if (name == "num")
+				opts.num = std::stoull(value);
+			else if (name == "reads")
+				opts.reads = std::stoull(value);
+			else if (name == "key_size")
+				opts.key_size = std::stoull(value);
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "threads")
+				opts.threads = std::stoull(value);
+			else if (name == "scan_length")
+				opts.scan_length = std::stoull(value);
+			else if (name == "seed")
+				opts.seed = std::stoull(value);
+			else
+				return false;
+		} catch (std::logic_error &) {
+			return false;
+		}
+	}
+
+	return opts.num > 0 && opts.threads > 0 && opts.key_size > 0 &&
+		opts.scan_length > 0;
+}
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	int ret = 0;
+	for (auto &engine : opts.engines) {
+		std::cout << "engine: " << engine << ", keys: " << opts.key_size
+			  << " bytes, values: " << opts.value_size
+			  << " bytes, entries: " << opts.num
+			  << ", threads: " << opts.threads << std::endl;
+
+		try {
+			benchmark bench(opts, engine);
+			for (auto &name : opts.benchmarks) {
+				if (!bench.run(name)) {
+					std::cerr << "unknown benchmark: " << name
+						  << std::endl;
+					return 1;
+				}
+			}
+		} catch (std::exception &e) {
+			std::cerr << engine << ": " << e.what() << std::endl;
+			ret = 1;
+		}
+		std::cout << std::endl;
+	}
+
+	return ret;
+}
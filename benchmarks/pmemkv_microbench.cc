@@ -0,0 +1,407 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmemkv_microbench.cc -- microbenchmarks of internal building blocks of
+ * pmemkv engines, using Google Benchmark.
+ *
+ * Persistent structures are allocated in a pool created at the path given by
+ * the --pool option (pmemkv_microbench.pool in working directory by default),
+ * which is removed afterwards. Other options are the ones of Google Benchmark,
+ * e.g.:
+ *
+ *	pmemkv_microbench --pool=/mnt/pmem/microbench --benchmark_filter=hash
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "engine.h"
+#include "libpmemkv.h"
+#include "polymorphic_string.h"
+
+#ifdef ENGINE_CMAP
+#include "engines/cmap.h"
+#endif
+
+#ifdef ENGINE_STREE
+#include "engines-experimental/stree.h"
+#endif
+
+#ifdef ENGINE_TREE3
+#include "engines-experimental/tree3.h"
+#endif
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+static std::string pool_path = "pmemkv_microbench.pool";
+static const size_t POOL_SIZE = 64 * 1024 * 1024;
+
+/* pool shared by benchmarks of persistent structures, created on first use */
+static pmem::obj::pool_base &get_pool()
+{
+	static pmem::obj::pool_base pop = pmem::obj::pool_base::create(
+		pool_path, "pmemkv_microbench", POOL_SIZE, S_IRUSR | S_IWUSR);
+	return pop;
+}
+
+/* keys of the given size, which differ only at the end */
+static std::vector<std::string> make_keys(size_t size, size_t count)
+{
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < count; i++) {
+		std::string n = std::to_string(i);
+		std::string key(size > n.size() ? size - n.size() : 0, 'k');
+		keys.push_back(key + n);
+	}
+
+	return keys;
+}
+
+static void key_sizes(benchmark::internal::Benchmark *b)
+{
+	for (int size = 8; size <= 512; size *= 4)
+		b->Arg(size);
+}
+
+#ifdef ENGINE_CMAP
+
+template <typename Hasher>
+static void BM_cmap_hash(benchmark::State &state)
+{
+	auto keys = make_keys(static_cast<size_t>(state.range(0)), 64);
+	size_t i = 0;
+	for (auto _ : state) {
+		auto &key = keys[i++ % keys.size()];
+		benchmark::DoNotOptimize(Hasher::hash(key.data(), key.size()));
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+				state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_cmap_hash, pmem::kv::internal::cmap::string_hasher)
+	->Apply(key_sizes);
+BENCHMARK_TEMPLATE(BM_cmap_hash, pmem::kv::internal::cmap::fast_string_hasher)
+	->Apply(key_sizes);
+
+#endif
+
+#ifdef ENGINE_TREE3
+
+static void BM_tree3_pearson_hash(benchmark::State &state)
+{
+	auto keys = make_keys(static_cast<size_t>(state.range(0)), 64);
+	size_t i = 0;
+	for (auto _ : state) {
+		auto &key = keys[i++ % keys.size()];
+		benchmark::DoNotOptimize(
+			pmem::kv::internal::tree3::PearsonHash(key.data(), key.size()));
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+				state.range(0));
+}
+BENCHMARK(BM_tree3_pearson_hash)->Apply(key_sizes);
+
+static void BM_tree3_probe_hashes(benchmark::State &state)
+{
+	uint8_t hashes[LEAF_KEYS];
+	for (int slot = 0; slot < LEAF_KEYS; slot++)
+		hashes[slot] = static_cast<uint8_t>(slot + 1);
+	uint8_t hash = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(
+			pmem::kv::internal::tree3::LeafProbeHashes(hashes, hash++));
+	}
+}
+BENCHMARK(BM_tree3_probe_hashes);
+
+#endif
+
+/* allocates polymorphic_string in the pool, as cmap does on put */
+static void BM_polymorphic_string_construct(benchmark::State &state)
+{
+	using pmem::kv::polymorphic_string;
+	auto &pop = get_pool();
+	std::string data(static_cast<size_t>(state.range(0)), 'x');
+	for (auto _ : state) {
+		pmem::obj::transaction::run(pop, [&] {
+			auto s = pmem::obj::make_persistent<polymorphic_string>(
+				pmem::kv::string_view(data));
+			pmem::obj::delete_persistent<polymorphic_string>(s);
+		});
+	}
+}
+BENCHMARK(BM_polymorphic_string_construct)->Apply(key_sizes);
+
+/* overwrites polymorphic_string in the pool, as cmap does on update */
+static void BM_polymorphic_string_assign(benchmark::State &state)
+{
+	using pmem::kv::polymorphic_string;
+	auto &pop = get_pool();
+	std::string data(static_cast<size_t>(state.range(0)), 'x');
+	pmem::obj::persistent_ptr<polymorphic_string> s;
+	pmem::obj::transaction::run(
+		pop, [&] { s = pmem::obj::make_persistent<polymorphic_string>(); });
+	for (auto _ : state) {
+		pmem::obj::transaction::run(
+			pop, [&] { *s = pmem::kv::string_view(data); });
+	}
+	pmem::obj::transaction::run(
+		pop, [&] { pmem::obj::delete_persistent<polymorphic_string>(s); });
+}
+BENCHMARK(BM_polymorphic_string_assign)->Apply(key_sizes);
+
+/* compares stored key with a looked up one, as cmap does on get */
+static void BM_polymorphic_string_compare(benchmark::State &state)
+{
+	using pmem::kv::polymorphic_string;
+	auto &pop = get_pool();
+	std::string data(static_cast<size_t>(state.range(0)), 'x');
+	pmem::obj::persistent_ptr<polymorphic_string> s;
+	pmem::obj::transaction::run(pop, [&] {
+		s = pmem::obj::make_persistent<polymorphic_string>(
+			pmem::kv::string_view(data));
+	});
+	pmem::kv::string_view key(data);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(*s == key);
+	pmem::obj::transaction::run(
+		pop, [&] { pmem::obj::delete_persistent<polymorphic_string>(s); });
+}
+BENCHMARK(BM_polymorphic_string_compare)->Apply(key_sizes);
+
+#ifdef ENGINE_STREE
+
+typedef pstring<pmem::kv::internal::stree::INLINE_KEY_SIZE> stree_key;
+typedef pstring<pmem::kv::internal::stree::INLINE_VALUE_SIZE> stree_value;
+typedef persistent::internal::leaf_node_t<stree_key, stree_value,
+					  pmem::kv::internal::stree::DEGREE>
+	stree_leaf;
+
+/* inline and out-of-line (external) pstrings are compared the same way */
+static void BM_pstring_compare(benchmark::State &state)
+{
+	auto keys = make_keys(static_cast<size_t>(state.range(0)), 2);
+	stree_key lhs(keys[0]), rhs(keys[1]);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(lhs < rhs);
+		benchmark::DoNotOptimize(lhs == rhs);
+	}
+}
+BENCHMARK(BM_pstring_compare)->Apply(key_sizes);
+
+/* copies into persistent memory, which allocates buffers for long data */
+static void BM_pstring_assign(benchmark::State &state)
+{
+	auto &pop = get_pool();
+	std::string data(static_cast<size_t>(state.range(0)), 'x');
+	pmem::obj::persistent_ptr<stree_key> s;
+	pmem::obj::transaction::run(pop,
+				    [&] { s = pmem::obj::make_persistent<stree_key>(); });
+	for (auto _ : state) {
+		pmem::obj::transaction::run(pop, [&] {
+			pmem::obj::transaction::snapshot(s.get());
+			s->assign(data.data(), data.size());
+		});
+	}
+	pmem::obj::transaction::run(pop, [&] {
+		s->free_storage();
+		pmem::obj::delete_persistent<stree_key>(s);
+	});
+}
+BENCHMARK(BM_pstring_assign)->Apply(key_sizes);
+
+/* leaf filled with all but one entries, keys fit inline */
+static pmem::obj::persistent_ptr<stree_leaf>
+make_leaf(pmem::obj::pool_base &pop, const std::vector<std::string> &keys)
+{
+	pmem::obj::persistent_ptr<stree_leaf> leaf;
+	pmem::obj::transaction::run(
+		pop, [&] { leaf = pmem::obj::make_persistent<stree_leaf>(uint64_t(0)); });
+	for (size_t i = 0; i + 1 < keys.size(); i++)
+		leaf->insert(pop, stree_leaf::value_type(keys[i], "value"));
+
+	return leaf;
+}
+
+static void BM_stree_leaf_find(benchmark::State &state)
+{
+	auto &pop = get_pool();
+	auto keys = make_keys(16, pmem::kv::internal::stree::DEGREE);
+	auto leaf = make_leaf(pop, keys);
+	std::vector<stree_key> lookups(keys.begin(), keys.end());
+	size_t i = 0;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(leaf->find(lookups[i++ % lookups.size()]));
+	pmem::obj::transaction::run(
+		pop, [&] { pmem::obj::delete_persistent<stree_leaf>(leaf); });
+}
+BENCHMARK(BM_stree_leaf_find);
+
+/* the last slot of the leaf is filled and freed again on every iteration */
+static void BM_stree_leaf_insert_erase(benchmark::State &state)
+{
+	auto &pop = get_pool();
+	auto keys = make_keys(16, pmem::kv::internal::stree::DEGREE);
+	auto leaf = make_leaf(pop, keys);
+	std::vector<stree_leaf::value_type> entries;
+	for (size_t i = 0; i < keys.size(); i++)
+		entries.emplace_back(keys[i], "value");
+	size_t i = 0;
+	for (auto _ : state) {
+		auto &entry = entries[i++ % entries.size()];
+		leaf->erase(pop, entry.first);
+		leaf->insert(pop, entry);
+	}
+	pmem::obj::transaction::run(
+		pop, [&] { pmem::obj::delete_persistent<stree_leaf>(leaf); });
+}
+BENCHMARK(BM_stree_leaf_insert_erase);
+
+#endif
+
+/*
+ * cost of the C API layer over a call of the engine: blackhole does nothing,
+ * except for generating given number of synthetic records for reads of ranges
+ */
+static pmemkv_db *open_blackhole(uint64_t records = 0)
+{
+	pmemkv_config *cfg = pmemkv_config_new();
+	pmemkv_db *db = nullptr;
+	if (cfg == nullptr || pmemkv_config_put_uint64(cfg, "records", records) != 0 ||
+	    pmemkv_open("blackhole", cfg, &db) != PMEMKV_STATUS_OK)
+		return nullptr;
+
+	return db;
+}
+
+static void BM_dispatch_engine(benchmark::State &state)
+{
+	pmemkv_db *db = open_blackhole();
+	auto engine = reinterpret_cast<pmem::kv::engine_base *>(db);
+	pmem::kv::string_view key("key");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(engine->exists(key));
+	pmemkv_close(db);
+}
+BENCHMARK(BM_dispatch_engine);
+
+static void BM_dispatch_c_api(benchmark::State &state)
+{
+	pmemkv_db *db = open_blackhole();
+	for (auto _ : state)
+		benchmark::DoNotOptimize(pmemkv_exists(db, "key", 3));
+	pmemkv_close(db);
+}
+BENCHMARK(BM_dispatch_c_api);
+
+/* a miss writes nothing to the buffer, whatever its size */
+static void BM_dispatch_c_api_get_copy(benchmark::State &state)
+{
+	pmemkv_db *db = open_blackhole();
+	std::vector<char> value(static_cast<size_t>(state.range(0)));
+	size_t size;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(pmemkv_get_copy(db, "key", 3, value.data(),
+							 value.size(), &size));
+	pmemkv_close(db);
+}
+BENCHMARK(BM_dispatch_c_api_get_copy)->Arg(128)->Arg(4096)->Arg(64 * 1024);
+
+static int count_record(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	++*static_cast<size_t *>(arg);
+	return 0;
+}
+
+/* per-record cost of a range read: callback calls, without any engine lookups */
+static void BM_dispatch_engine_get_all(benchmark::State &state)
+{
+	pmemkv_db *db = open_blackhole(static_cast<uint64_t>(state.range(0)));
+	auto engine = reinterpret_cast<pmem::kv::engine_base *>(db);
+	size_t records = 0;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(engine->get_all(count_record, &records));
+	state.SetItemsProcessed(static_cast<int64_t>(records));
+	pmemkv_close(db);
+}
+BENCHMARK(BM_dispatch_engine_get_all)->Arg(1024)->Arg(64 * 1024);
+
+static void BM_dispatch_c_api_get_all(benchmark::State &state)
+{
+	pmemkv_db *db = open_blackhole(static_cast<uint64_t>(state.range(0)));
+	size_t records = 0;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(pmemkv_get_all(db, count_record, &records));
+	state.SetItemsProcessed(static_cast<int64_t>(records));
+	pmemkv_close(db);
+}
+BENCHMARK(BM_dispatch_c_api_get_all)->Arg(1024)->Arg(64 * 1024);
+
+/* iteration by keys: each step looks the previous key up again */
+static void BM_dispatch_c_api_get_next(benchmark::State &state)
+{
+	pmemkv_db *db = open_blackhole(static_cast<uint64_t>(state.range(0)));
+	size_t records = 0;
+	for (auto _ : state) {
+		for (auto record = pmemkv_get_begin(db); record.first.size() > 0;
+		     record = pmemkv_get_next(db, record.first))
+			records++;
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(records));
+	pmemkv_close(db);
+}
+BENCHMARK(BM_dispatch_c_api_get_next)->Arg(1024)->Arg(64 * 1024);
+
+int main(int argc, char *argv[])
+{
+	benchmark::Initialize(&argc, argv);
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 7, "--pool=") == 0) {
+			pool_path = arg.substr(7);
+		} else {
+			fprintf(stderr, "unknown option: %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+	remove(pool_path.c_str());
+
+	return 0;
+}
@@ -0,0 +1,532 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmemkv_ycsb.cc -- YCSB workload driver for pmemkv, using its C API.
+ *
+ * Opens the given engine with a JSON config (see libpmemkv_json_config(3)),
+ * loads 'recordcount' records and runs 'operationcount' operations of one of
+ * the core YCSB workloads, e.g.:
+ *
+ *	pmemkv_ycsb --engine=cmap --workload=a --threads=8 \
+ *		--config='{"path":"/mnt/pmem/ycsb","size":8589934592,"force_create":1}'
+ *
+ * Results are printed in the format of YCSB reports.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libpmemkv.h>
+#include <libpmemkv_json_config.h>
+
+enum class op_type { READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE };
+
+static const char *op_names[] = {"READ", "UPDATE", "INSERT", "SCAN",
+				 "READ-MODIFY-WRITE"};
+static const size_t OPS = sizeof(op_names) / sizeof(op_names[0]);
+
+enum class distribution { UNIFORM, ZIPFIAN, LATEST };
+
+/* proportions of operations and request distribution of a workload */
+struct workload {
+	double read;
+	double update;
+	double insert;
+	double scan;
+	double read_modify_write;
+	distribution dist;
+};
+
+/* core workloads of YCSB */
+static bool get_workload(char name, workload &w)
+{
+	switch (name) {
+		case 'a': /* update heavy */
+			w = {0.5, 0.5, 0, 0, 0, distribution::ZIPFIAN};
+			return true;
+		case 'b': /* read mostly */
+			w = {0.95, 0.05, 0, 0, 0, distribution::ZIPFIAN};
+			return true;
+		case 'c': /* read only */
+			w = {1, 0, 0, 0, 0, distribution::ZIPFIAN};
+			return true;
+		case 'd': /* read latest */
+			w = {0.95, 0, 0.05, 0, 0, distribution::LATEST};
+			return true;
+		case 'e': /* short ranges */
+			w = {0, 0, 0.05, 0.95, 0, distribution::ZIPFIAN};
+			return true;
+		case 'f': /* read-modify-write */
+			w = {0.5, 0, 0, 0, 0.5, distribution::ZIPFIAN};
+			return true;
+		default:
+			return false;
+	}
+}
+
+struct options {
+	std::string engine = "cmap";
+	std::string config;
+	char workload = 'a';
+	std::string distribution;
+	bool load = true;
+	bool run = true;
+	uint64_t recordcount = 1000000;
+	uint64_t operationcount = 1000000;
+	size_t value_size = 1000;
+	size_t max_scan_length = 100;
+	size_t threads = 1;
+	uint64_t seed = 0;
+};
+
+/* 64-bit FNV-1a hash, used by YCSB to scatter keys */
+static uint64_t fnv_hash64(uint64_t v)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (int i = 0; i < 8; i++) {
+		hash ^= v & 0xff;
+		hash *= 0x100000001B3ULL;
+		v >>= 8;
+	}
+
+	return hash;
+}
+
+static std::string build_key(uint64_t keynum)
+{
+	return "user" + std::to_string(fnv_hash64(keynum));
+}
+
+/*
+ * Generator of zipfian distributed numbers from [0, items), popular ones are
+ * the lowest. Algorithm from "Quickly Generating Billion-Record Synthetic
+ * Databases", Gray et al., SIGMOD 1994, as implemented by YCSB.
+ */
+class zipfian_generator {
+public:
+	static constexpr double ZIPFIAN_CONSTANT = 0.99;
+
+	explicit zipfian_generator(uint64_t items, double theta = ZIPFIAN_CONSTANT)
+	    : items(items), theta(theta)
+	{
+		zetan = zeta(items, theta);
+		alpha = 1.0 / (1.0 - theta);
+		eta = (1 - std::pow(2.0 / static_cast<double>(items), 1 - theta)) /
+			(1 - zeta(2, theta) / zetan);
+	}
+
+	template <typename Rng>
+	uint64_t next(Rng &rng) const
+	{
+		double u = std::uniform_real_distribution<double>(0, 1)(rng);
+		double uz = u * zetan;
+		if (uz < 1.0)
+			return 0;
+		if (uz < 1.0 + std::pow(0.5, theta))
+			return 1;
+
+		auto v = static_cast<uint64_t>(static_cast<double>(items) *
+					       std::pow(eta * u - eta + 1, alpha));
+		return std::min(v, items - 1);
+	}
+
+private:
+	static double zeta(uint64_t n, double theta)
+	{
+		double sum = 0;
+		for (uint64_t i = 0; i < n; i++)
+			sum += 1 / std::pow(static_cast<double>(i + 1), theta);
+
+		return sum;
+	}
+
+	uint64_t items;
+	double theta;
+	double zetan;
+	double alpha;
+	double eta;
+};
+
+/* latencies of operations of one type, measured by a single thread */
+struct op_stats {
+	std::vector<uint64_t> latencies_us;
+	uint64_t errors = 0;
+};
+
+class driver {
+public:
+	driver(const options &opts, pmemkv_db *db)
+	    : opts(opts),
+	      db(db),
+	      value(opts.value_size, 'x'),
+	      zipfian(std::max<uint64_t>(opts.recordcount, 2)),
+	      inserted(opts.recordcount)
+	{
+		get_workload(opts.workload, w);
+		if (opts.distribution == "uniform")
+			w.dist = distribution::UNIFORM;
+		else if (opts.distribution == "zipfian")
+			w.dist = distribution::ZIPFIAN;
+		else if (opts.distribution == "latest")
+			w.dist = distribution::LATEST;
+	}
+
+	/* inserts records [0, recordcount), every thread a part of them */
+	void load()
+	{
+		execute("load", [&](size_t id, std::mt19937_64 &, op_stats *stats) {
+			uint64_t per_thread = opts.recordcount / opts.threads;
+			uint64_t first = per_thread * id;
+			uint64_t last = id + 1 == opts.threads ? opts.recordcount
+							       : first + per_thread;
+			for (uint64_t k = first; k < last; k++)
+				timed(stats[static_cast<size_t>(op_type::INSERT)],
+				      [&] { return put(k); });
+		});
+	}
+
+	void run()
+	{
+		execute("run", [&](size_t id, std::mt19937_64 &rng, op_stats *stats) {
+			uint64_t n = opts.operationcount / opts.threads;
+			if (id + 1 == opts.threads)
+				n += opts.operationcount % opts.threads;
+			for (uint64_t i = 0; i < n; i++) {
+				op_type op = choose_op(rng);
+				timed(stats[static_cast<size_t>(op)],
+				      [&] { return execute_op(op, rng); });
+			}
+		});
+	}
+
+private:
+	typedef std::function<void(size_t, std::mt19937_64 &, op_stats *)>
+		thread_function;
+
+	static void get_nothing(const char *, size_t, void *)
+	{
+	}
+
+	template <typename Op>
+	static void timed(op_stats &stats, Op op)
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool ok = op();
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		stats.latencies_us.push_back(static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+				.count()));
+		if (!ok)
+			stats.errors++;
+	}
+
+	op_type choose_op(std::mt19937_64 &rng) const
+	{
+		double p = std::uniform_real_distribution<double>(0, 1)(rng);
+		if ((p -= w.read) < 0)
+			return op_type::READ;
+		if ((p -= w.update) < 0)
+			return op_type::UPDATE;
+		if ((p -= w.insert) < 0)
+			return op_type::INSERT;
+		if ((p -= w.scan) < 0)
+			return op_type::SCAN;
+		return op_type::READ_MODIFY_WRITE;
+	}
+
+	/*
+	 * Picks number of an existing record. A record inserted concurrently by
+	 * another thread may not be there yet and its read counts as an error.
+	 */
+	uint64_t next_keynum(std::mt19937_64 &rng) const
+	{
+		uint64_t count = inserted.load(std::memory_order_relaxed);
+		switch (w.dist) {
+			case distribution::UNIFORM:
+				return std::uniform_int_distribution<uint64_t>(
+					0, count - 1)(rng);
+			case distribution::LATEST: {
+				/* recently inserted records are the most popular */
+				uint64_t back = zipfian.next(rng);
+				return back < count ? count - 1 - back : 0;
+			}
+			default:
+				/* popular records are scattered over the key space */
+				return fnv_hash64(zipfian.next(rng)) % count;
+		}
+	}
+
+	bool put(uint64_t keynum)
+	{
+		std::string key = build_key(keynum);
+		return pmemkv_put(db, key.data(), key.size(), value.data(),
+				  value.size()) == PMEMKV_STATUS_OK;
+	}
+
+	bool get(uint64_t keynum)
+	{
+		std::string key = build_key(keynum);
+		return pmemkv_get(db, key.data(), key.size(), get_nothing, nullptr) ==
+			PMEMKV_STATUS_OK;
+	}
+
+	bool execute_op(op_type op, std::mt19937_64 &rng)
+	{
+		switch (op) {
+			case op_type::READ:
+				return get(next_keynum(rng));
+			case op_type::UPDATE:
+				return put(next_keynum(rng));
+			case op_type::INSERT:
+				return put(inserted.fetch_add(1));
+			case op_type::SCAN: {
+				std::string key = build_key(next_keynum(rng));
+				size_t left = std::uniform_int_distribution<size_t>(
+					1, opts.max_scan_length)(rng);
+				auto s = pmemkv_get_above(
+					db, key.data(), key.size(),
+					[](const char *, size_t, const char *, size_t,
+					   void *arg) {
+						auto left = static_cast<size_t *>(arg);
+						return --*left ? 0 : 1;
+					},
+					&left);
+				return s == PMEMKV_STATUS_OK ||
+					s == PMEMKV_STATUS_STOPPED_BY_CB;
+			}
+			default: {
+				uint64_t keynum = next_keynum(rng);
+				return get(keynum) && put(keynum);
+			}
+		}
+	}
+
+	void execute(const char *phase, thread_function f)
+	{
+		std::vector<std::vector<op_stats>> stats(opts.threads,
+							 std::vector<op_stats>(OPS));
+		std::vector<std::thread> threads;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t id = 0; id < opts.threads; id++) {
+			threads.emplace_back([&, id] {
+				std::mt19937_64 rng(opts.seed + id);
+				f(id, rng, stats[id].data());
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start);
+
+		report(phase, static_cast<double>(elapsed.count()) / 1000.0, stats);
+	}
+
+	void report(const char *phase, double elapsed_ms,
+		    const std::vector<std::vector<op_stats>> &stats) const
+	{
+		uint64_t total = 0;
+		for (auto &thread_stats : stats)
+			for (auto &s : thread_stats)
+				total += s.latencies_us.size();
+
+		printf("[OVERALL], Phase, %s\n", phase);
+		printf("[OVERALL], RunTime(ms), %.0f\n", elapsed_ms);
+		printf("[OVERALL], Throughput(ops/sec), %.2f\n",
+		       elapsed_ms > 0 ? static_cast<double>(total) * 1000.0 / elapsed_ms
+				      : 0.0);
+
+		for (size_t op = 0; op < OPS; op++) {
+			std::vector<uint64_t> latencies;
+			uint64_t errors = 0;
+			for (auto &thread_stats : stats) {
+				auto &l = thread_stats[op].latencies_us;
+				latencies.insert(latencies.end(), l.begin(), l.end());
+				errors += thread_stats[op].errors;
+			}
+			if (latencies.empty())
+				continue;
+
+			std::sort(latencies.begin(), latencies.end());
+			uint64_t sum = 0;
+			for (auto l : latencies)
+				sum += l;
+			auto percentile = [&](double p) {
+				auto last = static_cast<double>(latencies.size() - 1);
+				return latencies[static_cast<size_t>(p * last)];
+			};
+
+			const char *name = op_names[op];
+			printf("[%s], Operations, %zu\n", name, latencies.size());
+			printf("[%s], AverageLatency(us), %.2f\n", name,
+			       static_cast<double>(sum) /
+				       static_cast<double>(latencies.size()));
+			printf("[%s], MinLatency(us), %" PRIu64 "\n", name,
+			       latencies.front());
+			printf("[%s], MaxLatency(us), %" PRIu64 "\n", name,
+			       latencies.back());
+			printf("[%s], 95thPercentileLatency(us), %" PRIu64 "\n", name,
+			       percentile(0.95));
+			printf("[%s], 99thPercentileLatency(us), %" PRIu64 "\n", name,
+			       percentile(0.99));
+			printf("[%s], 99.9thPercentileLatency(us), %" PRIu64 "\n", name,
+			       percentile(0.999));
+			printf("[%s], Errors, %" PRIu64 "\n", name, errors);
+		}
+	}
+
+	const options &opts;
+	pmemkv_db *db;
+	workload w;
+	std::string value;
+	zipfian_generator zipfian;
+	/* number of records inserted so far, by load or by INSERT operations */
+	std::atomic<uint64_t> inserted;
+};
+
+static void usage(const char *name)
+{
+	std::cerr
+		<< "Usage: " << name << " --config=<json> [--option=value ...]\n"
+		<< "Options:\n"
+		<< "  --engine=<name>          engine to open (default: cmap)\n"
+		<< "  --config=<json>          config of the engine, in JSON\n"
+		<< "  --workload=<a-f>         YCSB core workload (default: a)\n"
+		<< "  --distribution=<name>    uniform, zipfian or latest, overrides\n"
+		<< "                           distribution of the workload\n"
+		<< "  --phase=<list>           load, run or load,run (default)\n"
+		<< "  --recordcount=<n>        records loaded (default: 1000000)\n"
+		<< "  --operationcount=<n>     operations run (default: 1000000)\n"
+		<< "  --value_size=<n>         value size in bytes (default: 1000)\n"
+		<< "  --max_scan_length=<n>    longest scan (default: 100)\n"
+		<< "  --threads=<n>            number of threads (default: 1)\n"
+		<< "  --seed=<n>               seed of random numbers (default: 0)\n";
+}
+
+static bool parse(int argc, char *argv[], options &opts)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			return false;
+
+		std::string name = arg.substr(2, eq - 2);
+		std::string value = arg.substr(eq + 1);
+		try {
+			if (name == "engine")
+				opts.engine = value;
+			else if (name == "config")
+				opts.config = value;
+			else if (name == "workload" && value.size() == 1)
+				opts.workload = value[0];
+			else if (name == "distribution")
+				opts.distribution = value;
+			else if (name == "phase") {
+				opts.load = value.find("load") != std::string::npos;
+				opts.run = value.find("run") != std::string::npos;
+			} else if (name == "recordcount")
+				opts.recordcount = std::stoull(value);
+			else if (name == "operationcount")
+				opts.operationcount = std::stoull(value);
+			else if (name == "value_size")
+				opts.value_size = std::stoull(value);
+			else if (name == "max_scan_length")
+				opts.max_scan_length = std::stoull(value);
+			else if (name == "threads")
+				opts.threads = std::stoull(value);
+			else if (name == "seed")
+				opts.seed = std::stoull(value);
+			else
+				return false;
+		} catch (std::logic_error &) {
+			return false;
+		}
+	}
+
+	workload w;
+	bool known_distribution = opts.distribution.empty() ||
+		opts.distribution == "uniform" || opts.distribution == "zipfian" ||
+		opts.distribution == "latest";
+	return !opts.config.empty() && get_workload(opts.workload, w) &&
+		known_distribution && opts.recordcount > 0 && opts.threads > 0 &&
+		opts.max_scan_length > 0;
+}
+
+int main(int argc, char *argv[])
+{
+	options opts;
+	if (!parse(argc, argv, opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	pmemkv_config *cfg = pmemkv_config_new();
+	if (cfg == nullptr) {
+		std::cerr << pmemkv_errormsg() << std::endl;
+		return 1;
+	}
+	if (pmemkv_config_from_json(cfg, opts.config.c_str()) != PMEMKV_STATUS_OK) {
+		std::cerr << pmemkv_config_from_json_errormsg() << std::endl;
+		pmemkv_config_delete(cfg);
+		return 1;
+	}
+
+	pmemkv_db *db = nullptr;
+	if (pmemkv_open(opts.engine.c_str(), cfg, &db) != PMEMKV_STATUS_OK) {
+		std::cerr << pmemkv_errormsg() << std::endl;
+		return 1;
+	}
+
+	{
+		driver d(opts, db);
+		if (opts.load)
+			d.load();
+		if (opts.run)
+			d.run();
+	}
+
+	pmemkv_close(db);
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "alloc_classes.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* objects with the compact header are preceded by 16 bytes of it */
+static const size_t HEADER_SIZE = 16;
+static const size_t UNIT_ALIGNMENT = 16;
+
+/* runs of a class span about a chunk of the heap, with at most MAX_UNITS units */
+static const size_t RUN_SIZE = 256 * 1024;
+static const size_t MAX_UNITS = 1024;
+
+/* highest id of allocation classes of libpmemobj */
+static const unsigned MAX_CLASS_ID = 254;
+
+static size_t unit_size_of(size_t size)
+{
+	return (size + HEADER_SIZE + UNIT_ALIGNMENT - 1) / UNIT_ALIGNMENT *
+		UNIT_ALIGNMENT;
+}
+
+static std::mutex pools_mtx;
+static std::map<PMEMobjpool *, std::weak_ptr<alloc_classes>> pools;
+
+alloc_classes::alloc_classes(PMEMobjpool *pop) : pop(pop)
+{
+}
+
+std::shared_ptr<alloc_classes> alloc_classes::of(PMEMobjpool *pop)
+{
+	std::lock_guard<std::mutex> lock(pools_mtx);
+
+	for (auto it = pools.begin(); it != pools.end();) {
+		if (it->second.expired())
+			it = pools.erase(it);
+		else
+			++it;
+	}
+
+	auto &weak = pools[pop];
+	auto classes = weak.lock();
+	if (!classes) {
+		classes = std::make_shared<alloc_classes>(pop);
+		weak = classes;
+	}
+
+	return classes;
+}
+
+uint64_t alloc_classes::flags(PMEMobjpool *pop, std::size_t size)
+{
+	std::shared_ptr<alloc_classes> classes;
+	{
+		std::lock_guard<std::mutex> lock(pools_mtx);
+		auto it = pools.find(pop);
+		if (it != pools.end())
+			classes = it->second.lock();
+	}
+
+	return classes ? classes->flags(size) : 0;
+}
+
+std::vector<std::size_t> alloc_classes::from_config(config &cfg)
+{
+	std::vector<std::size_t> sizes;
+	const char *list;
+	if (!cfg.get_string("alloc_class_sizes", &list))
+		return sizes;
+
+	for (const char *p = list;; p++) {
+		char *end;
+		errno = 0;
+		unsigned long long size = std::strtoull(p, &end, 10);
+		if (end == p || !isdigit(*p) || errno != 0 || size == 0 ||
+		    size > MAX_SIZE || (*end != ',' && *end != '\0'))
+			throw internal::invalid_argument(
+				"Config item \"alloc_class_sizes\" has to be a list of sizes, from 1 to " +
+				std::to_string(MAX_SIZE) + " bytes, separated by commas");
+
+		sizes.push_back(static_cast<std::size_t>(size));
+		p = end;
+		if (*p == '\0')
+			return sizes;
+	}
+}
+
+bool alloc_classes::add(std::size_t size)
+{
+	if (size == 0 || size > MAX_SIZE)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	const size_t unit = unit_size_of(size);
+	auto pos = std::lower_bound(
+		classes.begin(), classes.end(), unit,
+		[](const alloc_class &c, size_t u) { return c.unit_size < u; });
+	if (pos != classes.end() && pos->unit_size == unit)
+		return true;
+
+	pobj_alloc_class_desc desc;
+	for (unsigned id = 1; id <= MAX_CLASS_ID; id++) {
+		std::string name = "heap.alloc_class." + std::to_string(id) + ".desc";
+		if (pmemobj_ctl_get(pop, name.c_str(), &desc) == 0 &&
+		    desc.unit_size == unit && desc.header_type == POBJ_HEADER_COMPACT) {
+			classes.insert(pos, alloc_class{unit, id});
+			return true;
+		}
+	}
+
+	desc.unit_size = unit;
+	desc.alignment = 0;
+	size_t units = std::min(MAX_UNITS, RUN_SIZE / unit);
+	desc.units_per_block = static_cast<unsigned>(std::max<size_t>(1, units));
+	desc.header_type = POBJ_HEADER_COMPACT;
+	desc.class_id = 0;
+	if (pmemobj_ctl_set(pop, "heap.alloc_class.new.desc", &desc) != 0)
+		return false;
+
+	classes.insert(pos, alloc_class{unit, desc.class_id});
+	return true;
+}
+
+uint64_t alloc_classes::flags(std::size_t size) const
+{
+	const size_t needed = size + HEADER_SIZE;
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto it = std::lower_bound(
+		classes.begin(), classes.end(), needed,
+		[](const alloc_class &c, size_t u) { return c.unit_size < u; });
+	if (it == classes.end())
+		return 0;
+	/* an object leaves at most about 1/8 of its unit unused */
+	if (it->unit_size - needed >= it->unit_size / 8 + UNIT_ALIGNMENT)
+		return 0;
+
+	return POBJ_CLASS_ID(it->id);
+}
+
+std::size_t alloc_classes::count() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return classes.size();
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_ALLOC_CLASSES_H
+#define LIBPMEMKV_ALLOC_CLASSES_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "config.h"
+#include <libpmemobj++/allocation_flag.hpp>
+#include <libpmemobj.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Custom allocation classes registered in the heap of a pool, for the sizes of
+ * objects its engines allocate most often: nodes of a fixed layout and records
+ * of sizes hinted by the "alloc_class_sizes" config item. Default classes of
+ * libpmemobj are meant for any size, so an object just above one of them wastes
+ * much of its unit. An object is allocated from a class only if it leaves at most
+ * about 1/8 of the unit unused, others keep using the default classes.
+ *
+ * Classes are not persistent, they are registered whenever the pool is opened.
+ * A class already in the heap (e.g. registered by an engine which used the same
+ * pool given by oid before) is reused. The classes of a pool are shared by all
+ * engines using it, as long as any of them is open.
+ */
+class alloc_classes {
+public:
+	/* limit of the size of objects having their class */
+	static const size_t MAX_SIZE = 128 * 1024;
+
+	explicit alloc_classes(PMEMobjpool *pop);
+
+	/* returns the classes of the pool, registered by engines which use it */
+	static std::shared_ptr<alloc_classes> of(PMEMobjpool *pop);
+
+	/*
+	 * Returns flags of pmemobj_tx_xalloc() for an object of the given size in
+	 * the pool, for code which allocates objects without access to its engine.
+	 */
+	static uint64_t flags(PMEMobjpool *pop, std::size_t size);
+
+	/* parses the "alloc_class_sizes" config item, a comma-separated list */
+	static std::vector<std::size_t> from_config(config &cfg);
+
+	/*
+	 * Registers a class fitting objects of the given size, unless the pool
+	 * already has one. Returns false if libpmemobj refuses the class.
+	 */
+	bool add(std::size_t size);
+
+	/* flags of pmemobj_tx_xalloc() for an object of the given size */
+	uint64_t flags(std::size_t size) const;
+
+	pmem::obj::allocation_flag flag(std::size_t size) const
+	{
+		return pmem::obj::allocation_flag(flags(size));
+	}
+
+	std::size_t count() const;
+
+private:
+	struct alloc_class {
+		std::size_t unit_size;
+		unsigned id;
+	};
+
+	PMEMobjpool *pop;
+	mutable std::mutex mtx;
+	std::vector<alloc_class> classes; /* sorted by unit_size */
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_ALLOC_CLASSES_H */
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "async_queue.h"
+#include "engine.h"
+#include "out.h"
+
+#include <functional>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+constexpr size_t async_queue::MAX_BATCH;
+
+/*
+ * Workers have no caller to pass exceptions to, so they are turned into status
+ * codes (and error messages of the worker thread) here.
+ */
+template <typename Function>
+static status call_guarded(const char *func_name, Function &&f)
+{
+	try {
+		return f();
+	} catch (error &e) {
+		out_err_stream(func_name) << e.what();
+		return static_cast<status>(e.status_code);
+	} catch (std::bad_alloc &e) {
+		out_err_stream(func_name) << e.what();
+		return status::OUT_OF_MEMORY;
+	} catch (std::exception &e) {
+		out_err_stream(func_name) << e.what();
+		return status::UNKNOWN_ERROR;
+	} catch (...) {
+		out_err_stream(func_name) << "Unspecified error";
+		return status::UNKNOWN_ERROR;
+	}
+}
+
+async_queue::async_queue(engine_base &engine, size_t nthreads) : engine(engine)
+{
+	try {
+		for (size_t i = 0; i < nthreads; i++) {
+			workers.emplace_back(new worker);
+			auto &w = *workers.back();
+			w.thread = std::thread(&async_queue::run, this, std::ref(w));
+		}
+	} catch (...) {
+		stop();
+		throw;
+	}
+}
+
+async_queue::~async_queue()
+{
+	stop();
+}
+
+void async_queue::put(string_view key, string_view value,
+		      put_async_callback *callback, void *arg)
+{
+	submit({std::string(key.data(), key.size()),
+		std::string(value.data(), value.size()), callback, nullptr, arg});
+}
+
+void async_queue::get(string_view key, get_async_callback *callback, void *arg)
+{
+	submit({std::string(key.data(), key.size()), std::string(), nullptr, callback,
+		arg});
+}
+
+void async_queue::submit(request &&r)
+{
+	auto &w = *workers[std::hash<std::string>()(r.key) % workers.size()];
+	{
+		std::lock_guard<std::mutex> lock(w.mtx);
+		w.queue.push_back(std::move(r));
+	}
+	w.cv.notify_one();
+}
+
+void async_queue::stop()
+{
+	for (auto &w : workers) {
+		{
+			std::lock_guard<std::mutex> lock(w->mtx);
+			w->stop = true;
+		}
+		w->cv.notify_one();
+	}
+
+	for (auto &w : workers) {
+		if (w->thread.joinable())
+			w->thread.join();
+	}
+}
+
+void async_queue::run(worker &w)
+{
+	std::vector<request> requests;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(w.mtx);
+			w.cv.wait(lock, [&] { return w.stop || !w.queue.empty(); });
+			if (w.queue.empty())
+				return;
+			requests.swap(w.queue);
+		}
+
+		auto it = requests.begin();
+		while (it != requests.end()) {
+			if (it->get_callback) {
+				execute_get(*it);
+				++it;
+				continue;
+			}
+
+			auto last = it;
+			while (last != requests.end() && !last->get_callback &&
+			       static_cast<size_t>(last - it) < MAX_BATCH)
+				++last;
+			execute_puts(it, last);
+			it = last;
+		}
+		requests.clear();
+	}
+}
+
+void async_queue::execute_puts(std::vector<request>::iterator first,
+			       std::vector<request>::iterator last)
+{
+	status s;
+	if (last - first == 1) {
+		s = call_guarded("pmemkv_put_async", [&] {
+			stats::timer timer(engine.op_stats(), stats::op::PUT);
+			return engine.put(first->key, first->value);
+		});
+	} else {
+		s = call_guarded("pmemkv_put_async", [&] {
+			stats::timer timer(engine.op_stats(), stats::op::WRITE);
+			write_batch batch;
+			for (auto it = first; it != last; ++it)
+				batch.put(it->key, it->value);
+			return engine.write(batch);
+		});
+
+		/*
+		 * Status of each put is not known if the batch failed, apply them
+		 * again one by one. Engines applying batches atomically left none
+		 * of them applied, for the others the puts which succeeded are
+		 * repeated in the same order, so the result does not change.
+		 */
+		if (s != status::OK) {
+			for (auto it = first; it != last; ++it) {
+				s = call_guarded("pmemkv_put_async", [&] {
+					stats::timer timer(engine.op_stats(),
+							   stats::op::PUT);
+					return engine.put(it->key, it->value);
+				});
+				if (it->put_callback)
+					it->put_callback(static_cast<int>(s), it->arg);
+			}
+			return;
+		}
+	}
+
+	for (auto it = first; it != last; ++it) {
+		if (it->put_callback)
+			it->put_callback(static_cast<int>(s), it->arg);
+	}
+}
+
+struct get_async_context {
+	get_async_callback *callback;
+	void *arg;
+	bool called;
+};
+
+static void get_async_value(const char *value, size_t valuebytes, void *arg)
+{
+	auto c = static_cast<get_async_context *>(arg);
+	c->called = true;
+	c->callback(static_cast<int>(status::OK), value, valuebytes, c->arg);
+}
+
+void async_queue::execute_get(request &r)
+{
+	get_async_context ctx{r.get_callback, r.arg, false};
+	auto s = call_guarded("pmemkv_get_async", [&] {
+		stats::timer timer(engine.op_stats(), stats::op::GET);
+		return engine.get(r.key, get_async_value, &ctx);
+	});
+
+	if (!ctx.called)
+		r.get_callback(static_cast<int>(s), nullptr, 0, r.arg);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
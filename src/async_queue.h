@@ -0,0 +1,114 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_ASYNC_QUEUE_H
+#define LIBPMEMKV_ASYNC_QUEUE_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+
+class engine_base;
+
+namespace internal
+{
+
+/*
+ * Worker threads executing asynchronous puts and gets of a single database.
+ *
+ * A request is queued to the worker chosen by hash of its key, so requests for
+ * the same key complete in the order they were issued. A worker takes all the
+ * requests queued to it at once and applies runs of consecutive puts (up to
+ * MAX_BATCH of them) with a single engine_base::write(), which lets concurrent
+ * small writes be coalesced (e.g. into a single transaction of tree3).
+ *
+ * Callbacks are called from the workers. Requests still queued when the queue
+ * is destroyed are completed first.
+ */
+class async_queue {
+public:
+	static constexpr size_t MAX_BATCH = 256;
+
+	async_queue(engine_base &engine, size_t nthreads);
+	~async_queue();
+
+	async_queue(const async_queue &) = delete;
+	async_queue &operator=(const async_queue &) = delete;
+
+	void put(string_view key, string_view value, put_async_callback *callback,
+		 void *arg);
+	void get(string_view key, get_async_callback *callback, void *arg);
+
+private:
+	struct request {
+		std::string key;
+		std::string value;
+		/* exactly one of them is set, except for puts without callback */
+		put_async_callback *put_callback;
+		get_async_callback *get_callback;
+		void *arg;
+	};
+
+	struct worker {
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<request> queue;
+		bool stop = false;
+		std::thread thread;
+	};
+
+	void submit(request &&r);
+	void stop();
+	void run(worker &w);
+	void execute_puts(std::vector<request>::iterator first,
+			  std::vector<request>::iterator last);
+	void execute_get(request &r);
+
+	engine_base &engine;
+	std::vector<std::unique_ptr<worker>> workers;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_ASYNC_QUEUE_H */
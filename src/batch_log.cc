@@ -0,0 +1,252 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "batch_log.h"
+#include "exceptions.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+#include <libpmemobj++/pexceptions.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* type number of the log's allocation */
+static const uint64_t BATCH_LOG_TYPE_NUM = 0x626c6f675f763101ULL;
+
+/* operations of the batch, followed by the previous values of its keys */
+struct batch_log::root {
+	/* APPLYING or RESTORING */
+	uint64_t state;
+	uint64_t ops;
+	uint64_t images;
+};
+
+namespace
+{
+
+const uint64_t APPLYING = 1;
+const uint64_t RESTORING = 2;
+
+/* operations are aligned to 8 bytes in the log */
+struct entry_header {
+	uint64_t op;
+	uint64_t key_size;
+	uint64_t value_size;
+
+	uint64_t size() const
+	{
+		return (sizeof(entry_header) + key_size + value_size + 7) & ~uint64_t(7);
+	}
+};
+
+uint64_t entries_size(const write_batch &batch)
+{
+	uint64_t size = 0;
+	for (auto &op : batch.operations())
+		size += entry_header{0, op.key.size(), op.value.size()}.size();
+	return size;
+}
+
+char *copy_in(char *pos, const write_batch &batch)
+{
+	for (auto &op : batch.operations()) {
+		entry_header h{static_cast<uint64_t>(op.type), op.key.size(),
+			       op.value.size()};
+		memcpy(pos, &h, sizeof(h));
+		memcpy(pos + sizeof(h), op.key.data(), op.key.size());
+		memcpy(pos + sizeof(h) + op.key.size(), op.value.data(), op.value.size());
+		pos += h.size();
+	}
+	return pos;
+}
+
+const char *copy_out(const char *pos, uint64_t n, write_batch &batch)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		entry_header h;
+		memcpy(&h, pos, sizeof(h));
+		string_view key(pos + sizeof(h), static_cast<size_t>(h.key_size));
+		if (h.op == static_cast<uint64_t>(write_batch::op_type::PUT))
+			batch.put(key,
+				  string_view(key.data() + key.size(),
+					      static_cast<size_t>(h.value_size)));
+		else
+			batch.remove(key);
+		pos += h.size();
+	}
+	return pos;
+}
+
+} /* anonymous namespace */
+
+batch_log::batch_log(pmem::obj::pool_base &pop, PMEMoid *oid) : pop(pop), oid(oid)
+{
+}
+
+bool batch_log::pending() const
+{
+	return !OID_IS_NULL(*oid);
+}
+
+/*
+ * Previous values are read by get() of the engine, so a restored key of cmap
+ * does not keep its expiry time.
+ */
+status batch_log::write(engine_base &engine, write_batch &batch)
+{
+	std::lock_guard<std::mutex> guard(mtx);
+
+	/* a batch is left in the log only if restoring its keys failed */
+	auto s = complete(engine);
+	if (s != status::OK)
+		return s;
+
+	write_batch before;
+	std::unordered_set<std::string> keys;
+	for (auto &op : batch.operations()) {
+		if (!keys.insert(op.key).second)
+			continue;
+
+		std::string value;
+		s = engine.get(op.key,
+			       [](const char *v, size_t vb, void *arg) {
+				       static_cast<std::string *>(arg)->assign(v, vb);
+			       },
+			       &value);
+		if (s == status::OK)
+			before.put(op.key, value);
+		else if (s == status::NOT_FOUND)
+			before.remove(op.key);
+		else
+			return s;
+	}
+
+	store(batch, before);
+	try {
+		s = engine.engine_base::write(batch);
+	} catch (...) {
+		restore(engine, before);
+		throw;
+	}
+
+	/* the status of the failed operation is returned, even if restoring fails */
+	if (s != status::OK)
+		restore(engine, before);
+	else
+		drop();
+
+	return s;
+}
+
+void batch_log::recover(engine_base &engine)
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	if (complete(engine) != status::OK)
+		throw error("Failed to complete an interrupted write batch");
+}
+
+void batch_log::store(const write_batch &batch, const write_batch &before)
+{
+	uint64_t size = sizeof(root) + entries_size(batch) + entries_size(before);
+	pmem::obj::transaction::run(pop, [&] {
+		pmem::obj::transaction::snapshot(oid);
+		PMEMoid r = pmemobj_tx_alloc(static_cast<size_t>(size),
+					     BATCH_LOG_TYPE_NUM);
+		if (OID_IS_NULL(r))
+			throw pmem::transaction_alloc_error(
+				"Failed to allocate write batch log");
+
+		auto log = static_cast<root *>(pmemobj_direct(r));
+		log->state = APPLYING;
+		log->ops = batch.size();
+		log->images = before.size();
+		copy_in(copy_in(reinterpret_cast<char *>(log + 1), batch), before);
+		*oid = r;
+	});
+}
+
+/* applies the batch left in the log once more, or restores its keys */
+status batch_log::complete(engine_base &engine)
+{
+	if (!pending())
+		return status::OK;
+
+	auto log = static_cast<root *>(pmemobj_direct(*oid));
+	write_batch batch, before;
+	copy_out(copy_out(reinterpret_cast<const char *>(log + 1), log->ops, batch),
+		 log->images, before);
+
+	if (log->state == APPLYING &&
+	    engine.engine_base::write(batch) == status::OK) {
+		drop();
+		return status::OK;
+	}
+
+	return restore(engine, before);
+}
+
+/* the log is dropped only when all keys are restored */
+status batch_log::restore(engine_base &engine, write_batch &before)
+{
+	auto log = static_cast<root *>(pmemobj_direct(*oid));
+	if (log->state != RESTORING) {
+		log->state = RESTORING;
+		pop.persist(&log->state, sizeof(log->state));
+	}
+
+	auto s = engine.engine_base::write(before);
+	if (s == status::OK)
+		drop();
+
+	return s;
+}
+
+void batch_log::drop()
+{
+	pmem::obj::transaction::run(pop, [&] {
+		pmem::obj::transaction::snapshot(oid);
+		pmemobj_tx_free(*oid);
+		*oid = OID_NULL;
+	});
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef LIBPMEMKV_BATCH_LOG_H
+#define LIBPMEMKV_BATCH_LOG_H
+
+#include <mutex>
+
+#include <libpmemobj++/pool.hpp>
+
+#include "engine.h"
+#include "write_batch.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Persistent log of the write batch being applied, for engines whose updates
+ * cannot be nested in a single transaction (cmap). It makes a batch atomic, at
+ * a cost higher than of its operations applied one by one: previous values of
+ * its keys are read and the log is stored and dropped in transactions of its
+ * own. The batch is stored,
+ * together with the values its keys have before it, and only then applied by
+ * puts and removes of the engine, one by one. The log is dropped once all of
+ * them succeed.
+ *
+ * If a put or remove fails, the keys get their previous values back. If the
+ * batch is interrupted by a crash, it is applied once more when the pool is
+ * opened (restoring is repeated instead, if the crash interrupted it); puts and
+ * removes of the batch are applied in order, so applying them again yields the
+ * same result. Batches are applied one at a time; the engine has to keep other
+ * writers off the keys of the batch until write() returns, or restoring could
+ * overwrite their updates. Concurrent readers may see a part of a batch.
+ */
+class batch_log {
+public:
+	/* opens the log, whose oid is stored in *oid, null while there is no batch */
+	batch_log(pmem::obj::pool_base &pop, PMEMoid *oid);
+
+	/*
+	 * Applies batch to engine, all of its operations or none. Returns the status
+	 * of the failed operation, if any.
+	 */
+	status write(engine_base &engine, write_batch &batch);
+
+	/*
+	 * Completes the batch interrupted by a crash, if there is one. Has to be
+	 * called when the engine is opened, before it is used.
+	 */
+	void recover(engine_base &engine);
+
+	/* returns true if a batch was interrupted, so it has to be recovered */
+	bool pending() const;
+
+private:
+	struct root;
+
+	void store(const write_batch &batch, const write_batch &before);
+	status complete(engine_base &engine);
+	status restore(engine_base &engine, write_batch &before);
+	void drop();
+
+	pmem::obj::pool_base pop;
+	PMEMoid *oid;
+	std::mutex mtx;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_BATCH_LOG_H */
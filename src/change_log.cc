@@ -0,0 +1,247 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "change_log.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <libpmemobj++/pexceptions.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* type number of the ring's root allocation */
+static const uint64_t CHANGE_LOG_TYPE_NUM = 0x636c6f675f763101ULL;
+
+struct change_log::root {
+	uint64_t capacity;
+	/* positions of the oldest change and of the end, data is at pos % capacity */
+	uint64_t head;
+	uint64_t tail;
+	/* sequence numbers of the change at head and of the next one */
+	uint64_t first_seq;
+	uint64_t next_seq;
+	PMEMoid data;
+};
+
+/* changes are aligned to 8 bytes in the ring */
+struct change_log::entry_header {
+	uint64_t seq;
+	uint64_t op;
+	uint64_t key_size;
+	uint64_t value_size;
+
+	uint64_t size() const
+	{
+		return (sizeof(entry_header) + key_size + value_size + 7) & ~uint64_t(7);
+	}
+};
+
+change_log::change_log(pmem::obj::pool_base &pop, PMEMoid *oid, uint64_t capacity)
+    : pop(pop)
+{
+	if (exists(oid)) {
+		log = static_cast<root *>(pmemobj_direct(*oid));
+		if (capacity != 0 && capacity != log->capacity)
+			throw invalid_argument(
+				"Config item \"change_log_size\" is " +
+				std::to_string(capacity) +
+				", but the change log was created with " +
+				std::to_string(log->capacity));
+		return;
+	}
+
+	if (capacity < sizeof(entry_header))
+		throw invalid_argument("Config item \"change_log_size\" is too small");
+
+	pmem::obj::transaction::run(pop, [&] {
+		pmem::obj::transaction::snapshot(oid);
+		PMEMoid r = pmemobj_tx_xalloc(sizeof(root), CHANGE_LOG_TYPE_NUM,
+					      POBJ_XALLOC_ZERO);
+		PMEMoid d = pmemobj_tx_alloc(capacity, 0);
+		if (OID_IS_NULL(r) || OID_IS_NULL(d))
+			throw pmem::transaction_alloc_error(
+				"Failed to allocate change log");
+
+		log = static_cast<root *>(pmemobj_direct(r));
+		log->capacity = capacity;
+		log->first_seq = 1;
+		log->next_seq = 1;
+		log->data = d;
+		*oid = r;
+	});
+}
+
+bool change_log::exists(const PMEMoid *oid)
+{
+	return oid != nullptr && !OID_IS_NULL(*oid);
+}
+
+std::mutex &change_log::lock()
+{
+	return mtx;
+}
+
+char *change_log::data() const
+{
+	return static_cast<char *>(pmemobj_direct(log->data));
+}
+
+/*
+ * Writes to the ring at pos. Bytes below free_end are not used by any change,
+ * so an aborted transaction does not have to restore them: they are persisted
+ * right away, instead of being snapshotted.
+ */
+void change_log::copy_in(uint64_t pos, const void *src, size_t size, uint64_t free_end)
+{
+	auto from = static_cast<const char *>(src);
+	while (size > 0) {
+		uint64_t offset = pos % log->capacity;
+		size_t n = static_cast<size_t>(
+			std::min<uint64_t>(size, log->capacity - offset));
+		if (pos < free_end)
+			n = static_cast<size_t>(std::min<uint64_t>(n, free_end - pos));
+		else
+			pmem::obj::transaction::snapshot(data() + offset, n);
+
+		memcpy(data() + offset, from, n);
+		if (pos < free_end)
+			pop.persist(data() + offset, n);
+		pos += n;
+		from += n;
+		size -= n;
+	}
+}
+
+void change_log::copy_out(uint64_t pos, void *dst, size_t size) const
+{
+	auto to = static_cast<char *>(dst);
+	while (size > 0) {
+		uint64_t offset = pos % log->capacity;
+		size_t n = static_cast<size_t>(
+			std::min<uint64_t>(size, log->capacity - offset));
+		memcpy(to, data() + offset, n);
+		pos += n;
+		to += n;
+		size -= n;
+	}
+}
+
+void change_log::append(int op, string_view key, string_view value)
+{
+	entry_header h;
+	h.op = static_cast<uint64_t>(op);
+	h.key_size = key.size();
+	h.value_size = op == PMEMKV_CHANGE_PUT ? value.size() : 0;
+	uint64_t size = h.size();
+	if (size > log->capacity)
+		throw invalid_argument("Change of " + std::to_string(size) +
+				       " bytes does not fit in the change log");
+
+	pmem::obj::transaction::snapshot(log);
+	uint64_t free_end = log->head + log->capacity;
+	while (log->tail + size - log->head > log->capacity) {
+		entry_header oldest;
+		copy_out(log->head, &oldest, sizeof(oldest));
+		log->head += oldest.size();
+		log->first_seq++;
+	}
+
+	h.seq = log->next_seq;
+	copy_in(log->tail, &h, sizeof(h), free_end);
+	copy_in(log->tail + sizeof(h), key.data(), key.size(), free_end);
+	copy_in(log->tail + sizeof(h) + key.size(), value.data(), h.value_size,
+		free_end);
+	log->tail += size;
+	log->next_seq++;
+}
+
+/*
+ * Changes are copied out with the lock held and passed to the callback after
+ * it is released, so writers are not blocked by the callback.
+ */
+status change_log::changes_since(uint64_t seq, change_callback *callback, void *arg)
+{
+	std::vector<char> changes;
+	{
+		std::lock_guard<std::mutex> guard(mtx);
+		if (seq + 1 < log->first_seq)
+			return status::NOT_FOUND;
+
+		uint64_t pos = log->head;
+		for (uint64_t s = log->first_seq; s <= seq && pos < log->tail; s++) {
+			entry_header h;
+			copy_out(pos, &h, sizeof(h));
+			pos += h.size();
+		}
+		changes.resize(static_cast<size_t>(log->tail - pos));
+		copy_out(pos, changes.data(), changes.size());
+	}
+
+	for (size_t pos = 0; pos < changes.size();) {
+		entry_header h;
+		memcpy(&h, changes.data() + pos, sizeof(h));
+		const char *key = changes.data() + pos + sizeof(h);
+		if (callback(h.seq, static_cast<int>(h.op), key,
+			     static_cast<size_t>(h.key_size), key + h.key_size,
+			     static_cast<size_t>(h.value_size), arg) != 0)
+			return status::STOPPED_BY_CB;
+		pos += static_cast<size_t>(h.size());
+	}
+
+	return status::OK;
+}
+
+uint64_t change_log::first_seq()
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	return log->first_seq;
+}
+
+uint64_t change_log::last_seq()
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	return log->next_seq - 1;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_CHANGE_LOG_H
+#define LIBPMEMKV_CHANGE_LOG_H
+
+#include <mutex>
+
+#include <libpmemobj++/pool.hpp>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Persistent ring of the latest changes (puts and removes) of an engine, each
+ * with a sequence number, for incremental replication. The oldest changes are
+ * dropped when a new one does not fit.
+ *
+ * Engines whose updates cannot be nested in a transaction of the log (cmap)
+ * append a change in its own transaction before applying it, with the key of
+ * the change locked until it is applied, so the changes of a key are logged in
+ * the order they are applied. After a crash, the changes kept by the log are
+ * applied once more, which completes the ones logged but not applied yet.
+ */
+class change_log {
+public:
+	/*
+	 * Opens the ring, whose oid is stored in *oid, or creates one of capacity
+	 * bytes, if there is none yet. capacity 0 means that the ring is not
+	 * created, otherwise it has to match the one of the existing ring.
+	 */
+	change_log(pmem::obj::pool_base &pop, PMEMoid *oid, uint64_t capacity);
+
+	/* returns true if there is a ring stored in *oid */
+	static bool exists(const PMEMoid *oid);
+
+	/* held by writers while they append changes */
+	std::mutex &lock();
+
+	/*
+	 * Appends a change to the ring. Has to be called within a transaction,
+	 * with the lock held. The value is ignored for removes.
+	 */
+	void append(int op, string_view key, string_view value);
+
+	/*
+	 * Calls callback for every change with sequence number greater than seq,
+	 * in order of sequence numbers. Returns NOT_FOUND if some of these changes
+	 * were dropped from the ring already.
+	 */
+	status changes_since(uint64_t seq, change_callback *callback, void *arg);
+
+	/* sequence number of the oldest change kept by the ring */
+	uint64_t first_seq();
+
+	/* sequence number of the last change, 0 if there was none */
+	uint64_t last_seq();
+
+private:
+	struct root;
+	struct entry_header;
+
+	void copy_in(uint64_t pos, const void *src, size_t size, uint64_t free_end);
+	void copy_out(uint64_t pos, void *dst, size_t size) const;
+	char *data() const;
+
+	pmem::obj::pool_base pop;
+	root *log;
+	std::mutex mtx;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_CHANGE_LOG_H */
@@ -0,0 +1,317 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "compression.h"
+#include "exceptions.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* tags of stored values */
+static const char TAG_RAW = 0;
+static const char TAG_LZ4 = 1;
+
+/* limits of the LZ4 block format: matches and the literals ending a block */
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;
+static const size_t MATCH_LIMIT = 12;
+static const size_t MAX_OFFSET = 65535;
+static const size_t HASH_LOG = 12;
+
+static uint32_t read32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static size_t hash32(uint32_t v)
+{
+	return static_cast<size_t>((v * 2654435761U) >> (32 - HASH_LOG));
+}
+
+static char *put_length(char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = static_cast<char>(255);
+	*op++ = static_cast<char>(len);
+	return op;
+}
+
+static char *put_sequence(char *op, const char *literals, size_t lit_len,
+			  size_t offset, size_t match_len)
+{
+	char *token = op++;
+	size_t t = lit_len < 15 ? lit_len : 15;
+	if (lit_len >= 15)
+		op = put_length(op, lit_len - 15);
+	memcpy(op, literals, lit_len);
+	op += lit_len;
+
+	/* the last sequence of a block consists of literals only */
+	if (match_len == 0) {
+		*token = static_cast<char>(t << 4);
+		return op;
+	}
+
+	*op++ = static_cast<char>(offset & 0xff);
+	*op++ = static_cast<char>(offset >> 8);
+	size_t m = match_len - MIN_MATCH;
+	*token = static_cast<char>((t << 4) | (m < 15 ? m : 15));
+	if (m >= 15)
+		op = put_length(op, m - 15);
+	return op;
+}
+
+/* the worst case size of a compressed block of n bytes */
+static size_t lz4_bound(size_t n)
+{
+	return n + n / 255 + 16;
+}
+
+/*
+ * Greedy LZ4 compressor, which finds matches with a table of positions of
+ * 4-byte sequences and skips ahead faster in data which does not compress.
+ * dst must have room for lz4_bound(n) bytes.
+ */
+static size_t lz4_compress(const char *src, size_t n, char *dst)
+{
+	char *op = dst;
+	size_t anchor = 0;
+
+	if (n > MATCH_LIMIT) {
+		uint32_t table[1 << HASH_LOG] = {0};
+		size_t ip = 0;
+		size_t limit = n - MATCH_LIMIT;
+		size_t match_end = n - LAST_LITERALS;
+
+		while (ip <= limit) {
+			uint32_t seq = read32(src + ip);
+			size_t h = hash32(seq);
+			size_t ref = table[h];
+			table[h] = static_cast<uint32_t>(ip);
+
+			if (ref >= ip || ip - ref > MAX_OFFSET ||
+			    read32(src + ref) != seq) {
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			size_t len = MIN_MATCH;
+			while (ip + len < match_end && src[ref + len] == src[ip + len])
+				len++;
+
+			op = put_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	op = put_sequence(op, src + anchor, n - anchor, 0, 0);
+	return static_cast<size_t>(op - dst);
+}
+
+static bool get_length(const char *src, size_t n, size_t &ip, size_t &len)
+{
+	unsigned char b;
+	do {
+		if (ip >= n)
+			return false;
+		b = static_cast<unsigned char>(src[ip++]);
+		len += b;
+	} while (b == 255);
+
+	return true;
+}
+
+/* returns false if the block does not decompress to exactly size bytes */
+static bool lz4_decompress(const char *src, size_t n, char *dst, size_t size)
+{
+	size_t ip = 0, op = 0;
+	while (ip < n) {
+		unsigned char token = static_cast<unsigned char>(src[ip++]);
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && !get_length(src, n, ip, lit_len))
+			return false;
+		if (lit_len > n - ip || lit_len > size - op)
+			return false;
+
+		memcpy(dst + op, src + ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (ip == n)
+			return op == size;
+
+		if (n - ip < 2)
+			return false;
+		size_t offset = static_cast<unsigned char>(src[ip]) |
+			(static_cast<size_t>(static_cast<unsigned char>(src[ip + 1]))
+			 << 8);
+		ip += 2;
+
+		size_t match_len = token & 15;
+		if (match_len == 15 && !get_length(src, n, ip, match_len))
+			return false;
+		match_len += MIN_MATCH;
+		if (offset == 0 || offset > op || match_len > size - op)
+			return false;
+
+		/* matches may overlap the bytes they produce */
+		for (size_t i = 0; i < match_len; ++i, ++op)
+			dst[op] = dst[op - offset];
+	}
+
+	return false;
+}
+
+static const size_t MAX_VARINT = 10;
+
+static size_t put_varint(char *dst, uint64_t v)
+{
+	size_t pos = 0;
+	for (; v >= 0x80; v >>= 7)
+		dst[pos++] = static_cast<char>((v & 0x7f) | 0x80);
+	dst[pos++] = static_cast<char>(v);
+	return pos;
+}
+
+static bool get_varint(const char *src, size_t n, size_t &pos, uint64_t &v)
+{
+	v = 0;
+	for (unsigned shift = 0; pos < n && shift < 64; shift += 7) {
+		unsigned char b = static_cast<unsigned char>(src[pos++]);
+		v |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if (b < 0x80)
+			return true;
+	}
+
+	return false;
+}
+
+uint64_t value_codec::from_config(config &cfg)
+{
+	const char *name;
+	if (!cfg.get_string("compression", &name) || strcmp(name, "none") == 0)
+		return NONE;
+	if (strcmp(name, "lz4") == 0)
+		return LZ4;
+
+	throw invalid_argument(
+		"Config item \"compression\" has to be \"none\" or \"lz4\"");
+}
+
+void value_codec::set_kind(uint64_t kind)
+{
+	if (kind != NONE && kind != LZ4)
+		throw invalid_argument("Unknown compression of values: " +
+				       std::to_string(kind));
+
+	_kind = kind;
+}
+
+uint64_t value_codec::kind() const
+{
+	return _kind;
+}
+
+bool value_codec::enabled() const
+{
+	return _kind != NONE;
+}
+
+string_view value_codec::encode(string_view value, std::string &buf)
+{
+	if (!enabled())
+		return value;
+
+	size_t n = value.size();
+	if (n >= MIN_SIZE && n <= UINT32_MAX) {
+		buf.resize(1 + MAX_VARINT + lz4_bound(n));
+		buf[0] = TAG_LZ4;
+		size_t pos = put_varint(&buf[1], n) + 1;
+		pos += lz4_compress(value.data(), n, &buf[pos]);
+		if (pos <= n - n / 8) {
+			_compressed_values.fetch_add(1, std::memory_order_relaxed);
+			_saved_bytes.fetch_add(n - pos, std::memory_order_relaxed);
+			return string_view(buf.data(), pos);
+		}
+	}
+
+	buf.resize(1 + n);
+	buf[0] = TAG_RAW;
+	memcpy(&buf[1], value.data(), n);
+	return string_view(buf.data(), buf.size());
+}
+
+string_view value_codec::decode(string_view stored, std::string &buf) const
+{
+	/* removes recorded by a change log have no value */
+	if (!enabled() || stored.size() == 0)
+		return stored;
+
+	const char *p = stored.data();
+	size_t n = stored.size();
+	if (p[0] == TAG_RAW)
+		return string_view(p + 1, n - 1);
+
+	size_t pos = 1;
+	uint64_t size;
+	/* a byte of LZ4 block never decompresses to more than 255 bytes */
+	if (p[0] == TAG_LZ4 && get_varint(p, n, pos, size) && size / 255 <= n) {
+		buf.resize(static_cast<size_t>(size));
+		if (lz4_decompress(p + pos, n - pos, &buf[0], buf.size()))
+			return string_view(buf.data(), buf.size());
+	}
+
+	throw error("Compressed value is corrupted");
+}
+
+uint64_t value_codec::compressed_values() const
+{
+	return _compressed_values.load(std::memory_order_relaxed);
+}
+
+uint64_t value_codec::saved_bytes() const
+{
+	return _saved_bytes.load(std::memory_order_relaxed);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
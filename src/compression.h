@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_COMPRESSION_H
+#define LIBPMEMKV_COMPRESSION_H
+
+#include <atomic>
+#include <string>
+
+#include "config.h"
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Compression of values stored by an engine, selected by the "compression"
+ * config item. With compression enabled, every stored value starts with a tag
+ * byte. Values shorter than MIN_SIZE bytes, and the ones which do not shrink
+ * by at least 1/8, follow the tag as they are, so reading them costs no more
+ * than without compression. The others are compressed in the LZ4 block format
+ * and prefixed with a varint of their original size.
+ *
+ * Engines encode values before they store them and decode them before they
+ * pass them to the user, so callbacks always get the original bytes.
+ */
+class value_codec {
+public:
+	/* kinds of compression; kept in the pool, so they must not change */
+	static const uint64_t NONE = 0;
+	static const uint64_t LZ4 = 1;
+
+	static const size_t MIN_SIZE = 128;
+
+	value_codec() = default;
+
+	/* reads the "compression" config item, NONE if it is not given */
+	static uint64_t from_config(config &cfg);
+
+	void set_kind(uint64_t kind);
+	uint64_t kind() const;
+	bool enabled() const;
+
+	/*
+	 * Returns bytes to be stored for the value: the value itself, if the
+	 * compression is disabled, or its encoding, which may be kept in buf.
+	 */
+	string_view encode(string_view value, std::string &buf);
+
+	/*
+	 * Returns the value of bytes returned by encode(): the stored bytes
+	 * themselves or a part of them, or the value decompressed into buf.
+	 * Throws if the stored bytes are corrupted.
+	 */
+	string_view decode(string_view stored, std::string &buf) const;
+
+	/* values stored compressed and bytes saved, since the engine was opened */
+	uint64_t compressed_values() const;
+	uint64_t saved_bytes() const;
+
+private:
+	uint64_t _kind = NONE;
+
+	std::atomic<uint64_t> _compressed_values{0};
+	std::atomic<uint64_t> _saved_bytes{0};
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_COMPRESSION_H */
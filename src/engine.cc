@@ -32,12 +32,21 @@
 
 #include "engine.h"
 
+#include <cstring>
+#include <vector>
+
+#include "async_queue.h"
 #include "engines/blackhole.h"
+#include "scan_batch.h"
 
 #ifdef ENGINE_VSMAP
 #include "engines/vsmap.h"
 #endif
 
+#ifdef ENGINE_VSKIPLIST
+#include "engines/vskiplist.h"
+#endif
+
 #ifdef ENGINE_VCMAP
 #include "engines/vcmap.h"
 #endif
@@ -50,6 +59,18 @@
 #include "engines-experimental/caching.h"
 #endif
 
+#ifdef ENGINE_READCACHE
+#include "engines-experimental/readcache.h"
+#endif
+
+#ifdef ENGINE_SHARDED
+#include "engines-experimental/sharded.h"
+#endif
+
+#ifdef ENGINE_INDEXED
+#include "engines-experimental/indexed.h"
+#endif
+
 #ifdef ENGINE_STREE
 #include "engines-experimental/stree.h"
 #endif
@@ -58,12 +79,20 @@
 #include "engines-experimental/tree3.h"
 #endif
 
+#ifdef ENGINE_RADIX
+#include "engines-experimental/radix.h"
+#endif
+
+#ifdef ENGINE_DASH
+#include "engines-experimental/dash.h"
+#endif
+
 namespace pmem
 {
 namespace kv
 {
 
-engine_base::engine_base()
+engine_base::engine_base() : _async_threads(1)
 {
 }
 
@@ -71,6 +100,30 @@ engine_base::~engine_base()
 {
 }
 
+internal::stats &engine_base::op_stats()
+{
+	return _op_stats;
+}
+
+internal::async_queue &engine_base::async_requests()
+{
+	std::call_once(_async_once, [&] {
+		_async.reset(new internal::async_queue(*this, _async_threads));
+	});
+
+	return *_async;
+}
+
+void engine_base::set_async_threads(size_t nthreads)
+{
+	_async_threads = nthreads;
+}
+
+void engine_base::stop_async()
+{
+	_async.reset();
+}
+
 static constexpr const char *available_engines = "blackhole"
 #ifdef ENGINE_CMAP
 						 ", cmap"
@@ -78,6 +131,9 @@ static constexpr const char *available_engines = "blackhole"
 #ifdef ENGINE_VSMAP
 						 ", vsmap"
 #endif
+#ifdef ENGINE_VSKIPLIST
+						 ", vskiplist"
+#endif
 #ifdef ENGINE_VCMAP
 						 ", vcmap"
 #endif
@@ -87,8 +143,23 @@ static constexpr const char *available_engines = "blackhole"
 #ifdef ENGINE_STREE
 						 ", stree"
 #endif
+#ifdef ENGINE_RADIX
+						 ", radix"
+#endif
+#ifdef ENGINE_DASH
+						 ", dash"
+#endif
 #ifdef ENGINE_CACHING
 						 ", caching"
+#endif
+#ifdef ENGINE_READCACHE
+						 ", readcache"
+#endif
+#ifdef ENGINE_SHARDED
+						 ", sharded"
+#endif
+#ifdef ENGINE_INDEXED
+						 ", indexed"
 #endif
 	;
 
@@ -124,6 +195,14 @@ engine_base::create_engine(const std::string &engine,
 	}
 #endif
 
+#ifdef ENGINE_VSKIPLIST
+	if (engine == "vskiplist") {
+		engine_base::check_config_null(engine, cfg);
+		return std::unique_ptr<engine_base>(
+			new pmem::kv::vskiplist(std::move(cfg)));
+	}
+#endif
+
 #ifdef ENGINE_VCMAP
 	if (engine == "vcmap") {
 		engine_base::check_config_null(engine, cfg);
@@ -141,7 +220,22 @@ engine_base::create_engine(const std::string &engine,
 #ifdef ENGINE_STREE
 	if (engine == "stree") {
 		engine_base::check_config_null(engine, cfg);
-		return std::unique_ptr<engine_base>(new pmem::kv::stree(std::move(cfg)));
+		return std::unique_ptr<engine_base>(
+			internal::stree::create_engine(std::move(cfg)));
+	}
+#endif
+
+#ifdef ENGINE_RADIX
+	if (engine == "radix") {
+		engine_base::check_config_null(engine, cfg);
+		return std::unique_ptr<engine_base>(new pmem::kv::radix(std::move(cfg)));
+	}
+#endif
+
+#ifdef ENGINE_DASH
+	if (engine == "dash") {
+		engine_base::check_config_null(engine, cfg);
+		return std::unique_ptr<engine_base>(new pmem::kv::dash(std::move(cfg)));
 	}
 #endif
 
@@ -153,6 +247,30 @@ engine_base::create_engine(const std::string &engine,
 	}
 #endif
 
+#ifdef ENGINE_READCACHE
+	if (engine == "readcache") {
+		engine_base::check_config_null(engine, cfg);
+		return std::unique_ptr<engine_base>(
+			new pmem::kv::readcache(std::move(cfg)));
+	}
+#endif
+
+#ifdef ENGINE_SHARDED
+	if (engine == "sharded") {
+		engine_base::check_config_null(engine, cfg);
+		return std::unique_ptr<engine_base>(
+			new pmem::kv::sharded(std::move(cfg)));
+	}
+#endif
+
+#ifdef ENGINE_INDEXED
+	if (engine == "indexed") {
+		engine_base::check_config_null(engine, cfg);
+		return std::unique_ptr<engine_base>(
+			new pmem::kv::indexed(std::move(cfg)));
+	}
+#endif
+
 	throw internal::wrong_engine_name("Unknown engine name \"" + engine +
 					  "\". Available engines: " + available_engines);
 }
@@ -241,21 +359,415 @@ int engine_base::get_size_new()
 	return -1;
 }
 
+internal::iterator_base *engine_base::new_iterator()
+{
+	throw internal::not_supported("Iterators are not supported by the " + name() +
+				      " engine");
+}
+
+internal::snapshot_base *engine_base::new_snapshot()
+{
+	throw internal::not_supported("Snapshots are not supported by the " + name() +
+				      " engine");
+}
+
 status engine_base::get_between(string_view key1, string_view key2,
 				get_kv_callback *callback, void *arg)
 {
 	return status::NOT_SUPPORTED;
 }
 
+struct prefix_context {
+	string_view prefix;
+	get_kv_callback *callback;
+	void *arg;
+	std::size_t cnt;
+	bool stopped;
+};
+
+static bool has_prefix(const char *k, size_t kb, string_view prefix)
+{
+	return kb >= prefix.size() && memcmp(k, prefix.data(), prefix.size()) == 0;
+}
+
+static int count_prefix_callback(const char *k, size_t kb, const char *, size_t,
+				 void *arg)
+{
+	auto c = static_cast<prefix_context *>(arg);
+	if (!has_prefix(k, kb, c->prefix))
+		return 1;
+
+	c->cnt++;
+	return 0;
+}
+
+static int get_prefix_callback(const char *k, size_t kb, const char *v, size_t vb,
+			       void *arg)
+{
+	auto c = static_cast<prefix_context *>(arg);
+	if (!has_prefix(k, kb, c->prefix))
+		return 1;
+
+	c->stopped = c->callback(k, kb, v, vb, c->arg) != 0;
+	return c->stopped;
+}
+
+/*
+ * default implementation: records of ordered engines are read from the prefix up
+ * to the first key which does not match it
+ */
+status engine_base::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	prefix_context ctx{prefix, nullptr, nullptr, 0, false};
+	auto s = get_equal_above(prefix, count_prefix_callback, &ctx);
+	if (s != status::OK && s != status::STOPPED_BY_CB)
+		return s;
+
+	cnt = ctx.cnt;
+	return status::OK;
+}
+
+status engine_base::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	prefix_context ctx{prefix, callback, arg, 0, false};
+	auto s = get_equal_above(prefix, get_prefix_callback, &ctx);
+	if (s == status::STOPPED_BY_CB && !ctx.stopped)
+		return status::OK;
+
+	return s;
+}
+
+static int scan_ordered_callback(const char *k, size_t kb, const char *v, size_t vb,
+				 void *arg)
+{
+	auto batch = static_cast<internal::scan_batch *>(arg);
+	if (!batch->matches(k, kb))
+		return 1;
+
+	return batch->push(string_view(k, kb), string_view(v, vb)) ? 0 : 1;
+}
+
+static int scan_unordered_callback(const char *k, size_t kb, const char *v, size_t vb,
+				   void *arg)
+{
+	auto batch = static_cast<internal::scan_batch *>(arg);
+	return batch->push(string_view(k, kb), string_view(v, vb)) ? 0 : 1;
+}
+
+/*
+ * default implementation: ordered engines are scanned from the prefix up to the
+ * first key which does not match it, others are scanned whole. Records are
+ * copied, the engine's callbacks may pass temporary data.
+ */
+status engine_base::scan(string_view prefix, size_t limit, size_t batch_size,
+			 scan_callback *callback, void *arg)
+{
+	internal::scan_batch batch(prefix, limit, batch_size, callback, arg, true);
+
+	status s = status::NOT_SUPPORTED;
+	if (prefix.size() > 0)
+		s = get_equal_above(prefix, scan_ordered_callback, &batch);
+	if (s == status::NOT_SUPPORTED)
+		s = get_all(scan_unordered_callback, &batch);
+
+	return batch.finish(s);
+}
+
+status engine_base::get_by_index(string_view index_key, get_kv_callback *callback,
+				 void *arg)
+{
+	return status::NOT_SUPPORTED;
+}
+
+struct parallel_context {
+	get_kv_parallel_callback *callback;
+	void *arg;
+};
+
+static int worker0_callback(const char *k, size_t kb, const char *v, size_t vb,
+				    void *arg)
+{
+	auto c = static_cast<parallel_context *>(arg);
+	return c->callback(0, k, kb, v, vb, c->arg);
+}
+
+/* default implementation: engines which cannot be split run get_all() as worker 0 */
+status engine_base::get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				     void *arg)
+{
+	parallel_context ctx{callback, arg};
+	return get_all(worker0_callback, &ctx);
+}
+
+/* default implementation: engines which cannot be split run get_between() as worker 0 */
+status engine_base::get_between_parallel(string_view key1, string_view key2,
+					 size_t nthreads,
+					 get_kv_parallel_callback *callback, void *arg)
+{
+	parallel_context ctx{callback, arg};
+	return get_between(key1, key2, worker0_callback, &ctx);
+}
+
 status engine_base::exists(string_view key)
 {
 	return status::NOT_SUPPORTED;
 }
 
+struct get_many_context {
+	get_many_v_callback *callback;
+	void *arg;
+	size_t index;
+};
+
+static void get_many_callback(const char *value, size_t valuebytes, void *arg)
+{
+	auto c = static_cast<get_many_context *>(arg);
+	c->callback(c->index, static_cast<int>(status::OK), value, valuebytes, c->arg);
+}
+
+/* default implementation: one get() per key */
+status engine_base::get_many(size_t count, const string_view *keys,
+			     get_many_v_callback *callback, void *arg)
+{
+	get_many_context ctx{callback, arg, 0};
+	status result = status::OK;
+
+	for (size_t i = 0; i < count; ++i) {
+		ctx.index = i;
+		auto s = get(keys[i], get_many_callback, &ctx);
+		if (s == status::NOT_FOUND) {
+			callback(i, static_cast<int>(s), nullptr, 0, arg);
+			result = status::NOT_FOUND;
+		} else if (s != status::OK) {
+			return s;
+		}
+	}
+
+	return result;
+}
+
+/* default implementation: operations are applied one by one, not atomically */
+/*
+ * Pin used by engines which cannot hand out their data directly: it owns a copy
+ * of the value.
+ */
+class copied_value_pin : public internal::value_ref::pin {
+public:
+	void release() final
+	{
+	}
+
+	std::string buffer;
+};
+
+status engine_base::get_ref(string_view key, internal::value_ref &ref)
+{
+	auto &pin = ref.reset_pin<copied_value_pin>();
+	auto s = get(
+		key,
+		[](const char *v, size_t vb, void *arg) {
+			static_cast<std::string *>(arg)->assign(v, vb);
+		},
+		&pin.buffer);
+	if (s != status::OK) {
+		ref.release();
+		return s;
+	}
+
+	ref.set(string_view(pin.buffer.data(), pin.buffer.size()));
+	return status::OK;
+}
+
+/*
+ * default implementation: keys are collected with get_between(), which is not
+ * supported by unordered engines, and removed one by one
+ */
+status engine_base::remove_range(string_view key1, string_view key2)
+{
+	if (key1.compare(key2) >= 0)
+		return status::OK;
+
+	std::vector<std::string> keys;
+	auto s = get_between(
+		key1, key2,
+		[](const char *k, size_t kb, const char *, size_t, void *arg) {
+			static_cast<std::vector<std::string> *>(arg)->emplace_back(k, kb);
+			return 0;
+		},
+		&keys);
+	if (s != status::OK)
+		return s;
+
+	keys.emplace_back(key1.data(), key1.size());
+	for (auto &key : keys) {
+		s = remove(key);
+		if (s != status::OK && s != status::NOT_FOUND)
+			return s;
+	}
+
+	return status::OK;
+}
+
+status engine_base::write(internal::write_batch &batch)
+{
+	for (auto &op : batch.operations()) {
+		status s;
+		if (op.type == internal::write_batch::op_type::PUT)
+			s = put(op.key, op.value);
+		else
+			s = remove(op.key);
+
+		/* removing a key which does not exist is not an error */
+		if (s != status::OK && s != status::NOT_FOUND)
+			return s;
+	}
+
+	return status::OK;
+}
+
+struct get_or_insert_arg {
+	string_view value;
+	get_v_callback *callback;
+	void *arg;
+	bool inserted;
+};
+
+static int get_or_insert_callback(const char *value, size_t valuebytes,
+				  const char **new_value, size_t *new_valuebytes,
+				  void *arg)
+{
+	auto c = static_cast<get_or_insert_arg *>(arg);
+	c->inserted = value == nullptr;
+	if (!c->inserted) {
+		if (c->callback)
+			c->callback(value, valuebytes, c->arg);
+		return 1;
+	}
+
+	*new_value = c->value.data();
+	*new_valuebytes = c->value.size();
+	return 0;
+}
+
+status engine_base::put_with_ttl(string_view key, string_view value, uint64_t ttl_ms)
+{
+	return status::NOT_SUPPORTED;
+}
+
+/* default implementation: an update, which stops if there is a value already */
+status engine_base::get_or_insert(string_view key, string_view value,
+				  get_v_callback *callback, void *arg, bool &inserted)
+{
+	get_or_insert_arg c{value, callback, arg, false};
+	auto s = update(key, get_or_insert_callback, &c);
+	inserted = s == status::OK && c.inserted;
+	if (s == status::STOPPED_BY_CB)
+		return status::OK;
+	if (inserted && callback)
+		callback(value.data(), value.size(), arg);
+
+	return s;
+}
+
+status engine_base::update(string_view key, update_callback *callback, void *arg)
+{
+	return status::NOT_SUPPORTED;
+}
+
+struct merge_arg {
+	int op;
+	string_view operand;
+	std::string value;
+	bool invalid;
+};
+
+static int merge_callback(const char *value, size_t valuebytes, const char **new_value,
+			  size_t *new_valuebytes, void *arg)
+{
+	auto c = static_cast<merge_arg *>(arg);
+
+	if (c->op == PMEMKV_MERGE_APPEND) {
+		c->value.assign(value ? value : "", value ? valuebytes : 0);
+		c->value.append(c->operand.data(), c->operand.size());
+	} else {
+		if (value && valuebytes != sizeof(int64_t)) {
+			c->invalid = true;
+			return 1;
+		}
+
+		/* unsigned addition, so that an overflow wraps around */
+		uint64_t current = 0, increment;
+		if (value)
+			memcpy(&current, value, sizeof(current));
+		memcpy(&increment, c->operand.data(), sizeof(increment));
+		current += increment;
+		c->value.assign(reinterpret_cast<const char *>(&current),
+				sizeof(current));
+	}
+
+	*new_value = c->value.data();
+	*new_valuebytes = c->value.size();
+	return 0;
+}
+
+status engine_base::merge(string_view key, int op, string_view operand)
+{
+	if (op != PMEMKV_MERGE_APPEND && op != PMEMKV_MERGE_INCREMENT)
+		throw internal::invalid_argument("Unknown merge operator");
+	if (op == PMEMKV_MERGE_INCREMENT && operand.size() != sizeof(int64_t))
+		throw internal::invalid_argument(
+			"Operand of increment has to be 8 bytes long");
+
+	merge_arg arg{op, operand, std::string(), false};
+	auto s = update(key, merge_callback, &arg);
+	if (arg.invalid)
+		throw internal::invalid_argument(
+			"Value incremented by merge has to be 8 bytes long");
+
+	return s;
+}
+
+/* default implementation: records are checked for order and put one by one */
+status engine_base::bulk_load(bulk_load_callback *callback, void *arg)
+{
+	const char *k, *v;
+	size_t kb, vb;
+	std::string previous;
+
+	for (bool first = true; callback(&k, &kb, &v, &vb, arg) == 0; first = false) {
+		string_view key(k, kb);
+		if (!first && string_view(previous).compare(key) >= 0)
+			throw internal::invalid_argument(
+				"Records of bulk load are not sorted by key");
+
+		auto s = put(key, string_view(v, vb));
+		if (s != status::OK)
+			return s;
+		previous.assign(k, kb);
+	}
+
+	return status::OK;
+}
+
 status engine_base::defrag(double start_percent, double amount_percent)
 {
 	return status::NOT_SUPPORTED;
 }
 
+/* writes of engines are persistent when they return, nothing is left to flush */
+status engine_base::flush()
+{
+	return status::OK;
+}
+
+status engine_base::changes_since(uint64_t seq, change_callback *callback, void *arg)
+{
+	return status::NOT_SUPPORTED;
+}
+
+void engine_base::metrics(internal::engine_metrics &metrics)
+{
+}
+
 } // namespace kv
 } // namespace pmem
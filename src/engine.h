@@ -35,16 +35,33 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "config.h"
+#include "iterator.h"
 #include "libpmemkv.hpp"
+#include "snapshot.h"
+#include "stats.h"
+#include "value_ref.h"
+#include "write_batch.h"
 
 namespace pmem
 {
 namespace kv
 {
 
+namespace internal
+{
+class async_queue;
+
+/* extractor of index keys from values, kept in the "index_extractor" config item */
+struct index_extractor {
+	pmemkv_index_extractor *extract;
+	void *arg;
+};
+}
+
 const std::string LAYOUT = "pmemkv";
 
 class engine_base {
@@ -65,6 +82,7 @@ public:
 	virtual status count_below(string_view key, std::size_t &cnt);
 	virtual status count_between(string_view key1, string_view key2,
 				     std::size_t &cnt);
+	virtual status count_prefix(string_view prefix, std::size_t &cnt);
 
 	virtual status get_all(get_kv_callback *callback, void *arg);
 	virtual status get_above(string_view key, get_kv_callback *callback, void *arg);
@@ -75,6 +93,20 @@ public:
 	virtual status get_below(string_view key, get_kv_callback *callback, void *arg);
 	virtual status get_between(string_view key1, string_view key2,
 				   get_kv_callback *callback, void *arg);
+	virtual status get_prefix(string_view prefix, get_kv_callback *callback,
+				  void *arg);
+
+	virtual status scan(string_view prefix, size_t limit, size_t batch_size,
+			    scan_callback *callback, void *arg);
+	/* records whose values have the index key, see the indexed engine */
+	virtual status get_by_index(string_view index_key, get_kv_callback *callback,
+				    void *arg);
+	virtual status get_all_parallel(size_t nthreads,
+					get_kv_parallel_callback *callback, void *arg);
+	virtual status get_between_parallel(string_view key1, string_view key2,
+					    size_t nthreads,
+					    get_kv_parallel_callback *callback,
+					    void *arg);
 
 	virtual std::pair<string_view, string_view> upper_bound(string_view key);
 	virtual std::pair<string_view, string_view> lower_bound(string_view key);
@@ -82,16 +114,61 @@ public:
 	virtual std::pair<string_view, string_view> get_next(string_view key);
 	virtual std::pair<string_view, string_view> get_prev(string_view key);
 	virtual int get_size_new();
+	virtual internal::iterator_base *new_iterator();
+	virtual internal::snapshot_base *new_snapshot();
 	virtual status exists(string_view key);
 
 	virtual status get(string_view key, get_v_callback *callback, void *arg) = 0;
+	virtual status get_many(size_t count, const string_view *keys,
+				get_many_v_callback *callback, void *arg);
+	virtual status get_ref(string_view key, internal::value_ref &ref);
 	virtual status put(string_view key, string_view value) = 0;
+	/* put of a record which expires after ttl_ms milliseconds, 0 means never */
+	virtual status put_with_ttl(string_view key, string_view value, uint64_t ttl_ms);
+	/*
+	 * inserts the record if there is none with the key, otherwise calls callback
+	 * (if not null) with the existing value
+	 */
+	virtual status get_or_insert(string_view key, string_view value,
+				     get_v_callback *callback, void *arg, bool &inserted);
+	/* replaces the value with the one computed by callback, atomically */
+	virtual status update(string_view key, update_callback *callback, void *arg);
+	/* update() with one of the built-in merge operators, PMEMKV_MERGE_* */
+	status merge(string_view key, int op, string_view operand);
 	virtual status remove(string_view key) = 0;
+	virtual status remove_range(string_view key1, string_view key2);
+	virtual status write(internal::write_batch &batch);
+	virtual status bulk_load(bulk_load_callback *callback, void *arg);
 	virtual status defrag(double start_percent, double amount_percent);
+	/* writes changes which do not have to be persistent yet, if there are any */
+	virtual status flush();
+	/* changes recorded by engines with a change log, see change_log.h */
+	virtual status changes_since(uint64_t seq, change_callback *callback, void *arg);
+
+	/* latencies of operations called through the C API */
+	internal::stats &op_stats();
+
+	/*
+	 * Workers executing asynchronous requests, started by the first of them.
+	 * stop_async() completes the queued requests and has to be called before
+	 * the engine is destroyed, while it can still execute them.
+	 */
+	internal::async_queue &async_requests();
+	void set_async_threads(size_t nthreads);
+	void stop_async();
+
+	/* adds structural metrics of the engine to be reported by stats */
+	virtual void metrics(internal::engine_metrics &metrics);
 
 private:
 	static void check_config_null(const std::string &engine_name,
 				      std::unique_ptr<internal::config> &cfg);
+
+	internal::stats _op_stats;
+
+	size_t _async_threads;
+	std::once_flag _async_once;
+	std::unique_ptr<internal::async_queue> _async;
 };
 
 } /* namespace kv */
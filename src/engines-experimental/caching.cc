@@ -31,6 +31,10 @@
  */
 
 #include "caching.h"
+#include "../probes.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <lib_acl.hpp>
@@ -39,48 +43,141 @@
 #include <memory>
 #include <unistd.h>
 
-#define ZERO 0
-
 namespace pmem
 {
 namespace kv
 {
 
-static time_t convertTimeToEpoch(const char *theTime, const char *format = "%Y%m%d%H%M%S")
+/* every cached value is prefixed with the time of its put [seconds since epoch] */
+static const size_t TIMESTAMP_SIZE = sizeof(int64_t);
+
+static int64_t currentTime()
 {
-	std::tm tmTime;
-	memset(&tmTime, 0, sizeof(tmTime));
-	strptime(theTime, format, &tmTime);
-	return mktime(&tmTime);
+	return static_cast<int64_t>(time(0));
 }
 
-static std::string getTimeStamp(const time_t epochTime,
-				const char *format = "%Y%m%d%H%M%S")
+static int64_t readTimestamp(const char *value)
 {
-	char timestamp[64] = {0};
-	strftime(timestamp, sizeof(timestamp), format, localtime(&epochTime));
+	int64_t timestamp;
+	memcpy(&timestamp, value, TIMESTAMP_SIZE);
 	return timestamp;
 }
 
-static bool valueFieldConversion(std::string dateValue, int64_t ttl)
+/* TTL equal to 0 means that cached values never expire */
+static bool isExpired(int64_t timestamp, int64_t ttl, int64_t now)
+{
+	return ttl > 0 && timestamp + ttl < now;
+}
+
+static std::size_t getLimit(internal::config &config, const char *key)
+{
+	int64_t limit;
+	if (!config.get_int64(key, &limit))
+		return 0;
+
+	if (limit < 0)
+		throw internal::invalid_argument("Config item \"" + std::string(key) +
+						 "\" cannot be negative");
+
+	return static_cast<std::size_t>(limit);
+}
+
+namespace internal
+{
+namespace caching
+{
+
+clock_policy::clock_policy(std::size_t max_size, std::size_t max_bytes)
+    : max_size(max_size), max_bytes(max_bytes), bytes(0), hand(0)
 {
-	bool timeValidFlag = false;
-	if (ttl > ZERO) {
-		const time_t now = convertTimeToEpoch(dateValue.c_str());
-		struct tm then_tm = *localtime(&now);
-		char ttlTimeStr[80];
+}
 
-		then_tm.tm_sec += ttl;
-		mktime(&then_tm);
-		std::strftime(ttlTimeStr, 80, "%Y%m%d%H%M%S", &then_tm);
+bool clock_policy::enabled() const
+{
+	return max_size > 0 || max_bytes > 0;
+}
 
-		const time_t curTime = time(0);
-		std::string curTimeStr = getTimeStamp(curTime);
+bool clock_policy::over_limit(std::size_t extra_size, std::size_t extra_bytes) const
+{
+	return (max_size > 0 && entries.size() + extra_size > max_size) ||
+		(max_bytes > 0 && bytes + extra_bytes > max_bytes);
+}
 
-		if (ttlTimeStr >= curTimeStr)
-			timeValidFlag = true;
+void clock_policy::touch(const std::string &key, std::size_t key_bytes)
+{
+	auto it = index.find(key);
+	if (it != index.end()) {
+		auto &e = entries[it->second];
+		bytes = bytes - e.bytes + key_bytes;
+		e.bytes = key_bytes;
+		e.referenced = true;
+		return;
 	}
-	return timeValidFlag;
+
+	it = index.emplace(key, entries.size()).first;
+	entries.push_back({&it->first, key_bytes, true});
+	bytes += key_bytes;
+}
+
+std::size_t clock_policy::erase(const std::string &key)
+{
+	auto it = index.find(key);
+	if (it == index.end())
+		return 0;
+
+	auto key_bytes = entries[it->second].bytes;
+	erase_at(it->second);
+
+	return key_bytes;
+}
+
+bool clock_policy::evict(std::string &victim)
+{
+	if (entries.empty())
+		return false;
+
+	/* give a second chance to keys used since the hand passed them */
+	for (;;) {
+		if (hand >= entries.size())
+			hand = 0;
+
+		auto &e = entries[hand];
+		if (!e.referenced)
+			break;
+
+		e.referenced = false;
+		hand++;
+	}
+
+	victim = *entries[hand].key;
+	erase_at(hand);
+
+	return true;
+}
+
+void clock_policy::erase_at(std::size_t pos)
+{
+	bytes -= entries[pos].bytes;
+	/* the key is owned by the erased element, do not erase by key */
+	index.erase(index.find(*entries[pos].key));
+
+	if (pos != entries.size() - 1) {
+		entries[pos] = entries.back();
+		index[*entries[pos].key] = pos;
+	}
+	entries.pop_back();
+}
+
+} /* namespace caching */
+} /* namespace internal */
+
+static int trackCachedKey(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	auto c = ((internal::caching::clock_policy *)arg);
+	if (vb >= TIMESTAMP_SIZE)
+		c->touch(std::string(k, kb), kb + vb - TIMESTAMP_SIZE);
+
+	return 0;
 }
 
 caching::caching(std::unique_ptr<internal::config> cfg)
@@ -99,6 +196,12 @@ caching::caching(std::unique_ptr<internal::config> cfg)
 	if (!config.get_int64("ttl", &ttl))
 		ttl = 0;
 
+	if (!config.get_int64("refresh_ahead", &refreshAhead))
+		refreshAhead = 0;
+	else if (refreshAhead < 0 || (ttl > 0 && refreshAhead >= ttl))
+		throw internal::invalid_argument(
+			"Config item \"refresh_ahead\" has to be in range [0, ttl)");
+
 	if (!config.get_int64("port", &port))
 		throw internal::invalid_argument(
 			"Config does not contain item with key: \"port\"");
@@ -107,6 +210,13 @@ caching::caching(std::unique_ptr<internal::config> cfg)
 		throw internal::invalid_argument(
 			"Config does not contain item with key: \"attempts\"");
 
+	int64_t connections;
+	if (!config.get_int64("remote_connections", &connections))
+		connections = 4;
+	else if (connections < 1)
+		throw internal::invalid_argument(
+			"Config item \"remote_connections\" has to be greater than 0");
+
 	internal::config *subEngineConfig;
 	if (!config.get_object("subengine_config", (void **)&subEngineConfig))
 		throw internal::invalid_argument(
@@ -118,11 +228,48 @@ caching::caching(std::unique_ptr<internal::config> cfg)
 	basePtr = engine_base::create_engine(
 		subEngine, std::unique_ptr<internal::config>(subEngineConfig));
 
+	clock.reset(new internal::caching::clock_policy(getLimit(config, "max_size"),
+							getLimit(config, "max_bytes")));
+	if (clock->enabled()) {
+		/* metadata is volatile, rebuild it from keys already in the cache */
+		basePtr->get_all(trackCachedKey, clock.get());
+
+		while (clock->over_limit(0, 0) && evictOne())
+			;
+	}
+
+	auto max_idle = static_cast<std::size_t>(connections);
+	if (remoteType == "Memcached") {
+		memcachedPool.reset(new internal::caching::connection_pool<memcached_st>(
+			max_idle,
+			[this]() { return connectMemcached(); },
+			[](memcached_st *memc) { memcached_free(memc); }));
+	} else if (remoteType == "Redis") {
+		acl::acl_cpp_init();
+		redisPool.reset(new internal::caching::connection_pool<acl::redis_client>(
+			max_idle,
+			[this]() { return connectRedis(); },
+			[](acl::redis_client *client) { delete client; }));
+	}
+
+	refreshStop = false;
+	if (refreshAhead > 0 && ttl > 0)
+		refreshThread = std::thread(&caching::refreshLoop, this);
+
 	LOG("Started ok");
 }
 
 caching::~caching()
 {
+	if (refreshThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(refreshMtx);
+			refreshStop = true;
+		}
+		refreshCv.notify_one();
+		refreshThread.join();
+	}
+
 	LOG("Stopped ok");
 }
 
@@ -166,26 +313,27 @@ struct GetAllCacheCallbackContext {
 	get_kv_callback *cBack;
 	std::list<std::string> *expiredKeys;
 	int64_t ttl;
+	int64_t now;
 };
 
 status caching::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
+	applyRefreshed();
 	std::list<std::string> removingKeys;
-	GetAllCacheCallbackContext cxt = {arg, callback, &removingKeys, ttl};
+	GetAllCacheCallbackContext cxt = {arg, callback, &removingKeys, ttl,
+					  currentTime()};
 
 	auto cb = [](const char *k, size_t kb, const char *v, size_t vb, void *arg) {
 		const auto c = ((GetAllCacheCallbackContext *)arg);
-		std::string localValue = v;
-		std::string timeStamp = localValue.substr(0, 14);
-		std::string value = localValue.substr(14);
-		// TTL from config is ZERO or if the key is valid
-		if (!c->ttl || valueFieldConversion(timeStamp, c->ttl)) {
-			auto ret = c->cBack(k, kb, value.c_str(), value.length(), c->arg);
+		if (vb >= TIMESTAMP_SIZE &&
+		    !isExpired(readTimestamp(v), c->ttl, c->now)) {
+			auto ret = c->cBack(k, kb, v + TIMESTAMP_SIZE,
+					    vb - TIMESTAMP_SIZE, c->arg);
 			if (ret != 0)
 				return ret;
 		} else {
-			c->expiredKeys->push_back(k);
+			c->expiredKeys->emplace_back(k, kb);
 		}
 
 		return 0;
@@ -197,6 +345,10 @@ status caching::get_all(get_kv_callback *callback, void *arg)
 			return s;
 
 		for (const auto &itr : removingKeys) {
+			if (clock->enabled()) {
+				std::lock_guard<std::mutex> lock(clockMtx);
+				clock->erase(itr);
+			}
 			auto s = basePtr->remove(itr);
 			if (s != status::OK)
 				return s;
@@ -227,67 +379,90 @@ status caching::get(string_view key, get_v_callback *callback, void *arg)
 		return status::NOT_FOUND;
 }
 
+struct CachedValue {
+	bool found;
+	int64_t timestamp;
+	std::string *value;
+};
+
 bool caching::getKey(const std::string &key, std::string &valueField, bool api_flag)
 {
 	auto cb = [](const char *v, size_t vb, void *arg) {
-		const auto c = ((std::string *)arg);
-		c->append(v, vb);
+		const auto c = ((CachedValue *)arg);
+		if (vb < TIMESTAMP_SIZE)
+			return;
+		c->found = true;
+		c->timestamp = readTimestamp(v);
+		c->value->assign(v + TIMESTAMP_SIZE, vb - TIMESTAMP_SIZE);
 	};
-	std::string value;
-	basePtr->get(key, cb, &value);
-	bool timeValidFlag;
-	if (!value.empty()) {
-		std::string timeStamp = value.substr(0, 14);
-		valueField = value.substr(14);
-		timeValidFlag = valueFieldConversion(timeStamp, ttl);
-	}
+	applyRefreshed();
+	CachedValue cached = {false, 0, &valueField};
+	basePtr->get(key, cb, &cached);
+	const int64_t now = currentTime();
 	// No value for a key on local cache or if TTL not equal to zero and TTL is
 	// expired
-	if (value.empty() || (ttl && !timeValidFlag)) {
+	if (!cached.found || isExpired(cached.timestamp, ttl, now)) {
 		// api_flag is true  when request is from Exists API and no need to
 		// connect to remote service api_flag is false when request is from Get
 		// API and connect to remote service
-		if (api_flag ||
-		    (remoteType == "Redis" && !getFromRemoteRedis(key, valueField)) ||
-		    (remoteType == "Memcached" &&
-		     !getFromRemoteMemcached(key, valueField)) ||
-		    (remoteType != "Redis" && remoteType != "Memcached"))
+		if (api_flag || !fetchRemote(key, valueField))
 			return false;
+	} else if (refreshThread.joinable() &&
+		   isExpired(cached.timestamp, ttl - refreshAhead, now)) {
+		scheduleRefresh(key);
 	}
-	put(key, valueField);
+	storeLocal(key, valueField);
 	return true;
 }
 
+memcached_st *caching::connectMemcached()
+{
+	memcached_return rc;
+	memcached_st *memc = memcached_create(NULL);
+	memcached_server_st *servers = memcached_server_list_append(
+		NULL, const_cast<char *>(host.c_str()), static_cast<unsigned>(port), &rc);
+	memcached_server_push(memc, servers);
+	memcached_server_list_free(servers);
+	memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_TCP_KEEPALIVE, 1);
+
+	return memc;
+}
+
+acl::redis_client *caching::connectRedis()
+{
+	std::string hostport = host + ":" + std::to_string(port);
+	acl::string passwd;
+	auto client = new acl::redis_client(hostport.c_str(), 0, 0);
+	client->set_password(passwd);
+
+	return client;
+}
+
 bool caching::getFromRemoteMemcached(const std::string &key, std::string &value)
 {
 	LOG("getFromRemoteMemcached");
 	bool retValue = false;
-	memcached_server_st *servers = NULL;
-	memcached_st *memc;
-	memcached_return rc;
-
-	memc = memcached_create(NULL); // todo reuse connection
-	servers = memcached_server_list_append(servers, const_cast<char *>(host.c_str()),
-					       port, &rc);
-	rc = memcached_server_push(memc, servers);
+	memcached_st *memc = memcachedPool->acquire();
+	memcached_return rc = MEMCACHED_FAILURE;
 
 	// Multiple tries to connect to remote memcached
 	for (int i = 0; i < attempts; ++i) {
-		memcached_stat(memc, NULL, &rc);
-		if (rc == MEMCACHED_SUCCESS) {
-			size_t return_value_length;
-			uint32_t flags;
-			char *memcacheRet =
-				memcached_get(memc, key.c_str(), key.length(),
-					      &return_value_length, &flags, &rc);
-			if (memcacheRet) {
-				value = memcacheRet;
-				retValue = true;
-			}
-			break;
+		size_t return_value_length;
+		uint32_t flags;
+		char *memcacheRet = memcached_get(memc, key.c_str(), key.length(),
+						  &return_value_length, &flags, &rc);
+		if (memcacheRet) {
+			value.assign(memcacheRet, return_value_length);
+			free(memcacheRet);
+			retValue = true;
 		}
+		if (rc == MEMCACHED_SUCCESS || rc == MEMCACHED_NOTFOUND)
+			break;
 		sleep(1); // todo expose as configurable attempt delay
 	}
+
+	memcachedPool->release(memc,
+			       rc == MEMCACHED_SUCCESS || rc == MEMCACHED_NOTFOUND);
 	return retValue;
 }
 
@@ -295,19 +470,16 @@ bool caching::getFromRemoteRedis(const std::string &key, std::string &value)
 {
 	LOG("getFromRemoteRedis");
 	bool retValue = false;
-	std::string hostport = host + ":" + std::to_string(port);
-	acl::string addr(hostport.c_str()), passwd;
-	acl::acl_cpp_init(); // todo reuse connection
-	acl::redis_client client(addr.c_str(), 0, 0);
+	bool connected = false;
+	acl::redis_client *client = redisPool->acquire();
 
 	// Multiple tries to connect to remote redis
 	for (int i = 0; i < attempts; ++i) {
-		if (client.get_stream() && client.get_stream()->opened()) {
-			client.set_password(passwd);
-			acl::redis cmd(&client);
+		if (client->get_stream() && client->get_stream()->opened()) {
+			acl::redis cmd(client);
 			acl::string key1, _value;
 			key1.format("%s", key.c_str());
-			cmd.get(key1, _value);
+			connected = cmd.get(key1, _value);
 			value = _value.c_str();
 			if (value.length() > 0)
 				retValue = true;
@@ -315,23 +487,188 @@ bool caching::getFromRemoteRedis(const std::string &key, std::string &value)
 		}
 		sleep(1); // todo expose as configurable attempt delay
 	}
+
+	redisPool->release(client, connected);
 	return retValue;
 }
 
+bool caching::getFromRemote(const std::string &key, std::string &value)
+{
+	if (remoteType == "Redis")
+		return getFromRemoteRedis(key, value);
+	if (remoteType == "Memcached")
+		return getFromRemoteMemcached(key, value);
+
+	return false;
+}
+
+/*
+ * Fetches the key from the remote server. If another thread is already fetching
+ * the same key, waits for its result instead of sending a second request.
+ */
+bool caching::fetchRemote(const std::string &key, std::string &value)
+{
+	std::unique_lock<std::mutex> lock(fetchMtx);
+	auto it = fetches.find(key);
+	if (it != fetches.end()) {
+		auto fetch = it->second;
+		fetchCv.wait(lock, [&] { return fetch->done; });
+		value = fetch->value;
+		return fetch->found;
+	}
+
+	auto fetch = std::make_shared<remote_fetch>();
+	fetches.emplace(key, fetch);
+	lock.unlock();
+
+	bool found = false;
+	try {
+		PMEMKV_PROBE2(remote__fetch__entry, key.data(), key.size());
+		found = getFromRemote(key, fetch->value);
+		PMEMKV_PROBE1(remote__fetch__return, found);
+	} catch (...) {
+		lock.lock();
+		fetch->done = true;
+		fetches.erase(key);
+		fetchCv.notify_all();
+		throw;
+	}
+
+	lock.lock();
+	fetch->done = true;
+	fetch->found = found;
+	fetches.erase(key);
+	fetchCv.notify_all();
+
+	value = fetch->value;
+	return found;
+}
+
+void caching::scheduleRefresh(const std::string &key)
+{
+	std::lock_guard<std::mutex> lock(refreshMtx);
+	if (refreshPending.insert(key).second) {
+		refreshQueue.push_back(key);
+		refreshCv.notify_one();
+	}
+}
+
+/* drops the result of a scheduled refresh, the key was changed locally */
+void caching::cancelRefresh(const std::string &key)
+{
+	if (!refreshThread.joinable())
+		return;
+
+	std::lock_guard<std::mutex> lock(refreshMtx);
+	refreshPending.erase(key);
+}
+
+void caching::applyRefreshed()
+{
+	if (!refreshThread.joinable())
+		return;
+
+	std::vector<std::pair<std::string, std::string>> values;
+	{
+		std::lock_guard<std::mutex> lock(refreshMtx);
+		values.swap(refreshed);
+		auto last = std::remove_if(
+			values.begin(), values.end(),
+			[&](const std::pair<std::string, std::string> &kv) {
+				return refreshPending.erase(kv.first) == 0;
+			});
+		values.erase(last, values.end());
+	}
+
+	for (const auto &kv : values)
+		storeLocal(kv.first, kv.second);
+}
+
+void caching::refreshLoop()
+{
+	std::unique_lock<std::mutex> lock(refreshMtx);
+	for (;;) {
+		refreshCv.wait(lock,
+			       [&] { return refreshStop || !refreshQueue.empty(); });
+		if (refreshStop)
+			return;
+
+		std::string key = std::move(refreshQueue.front());
+		refreshQueue.pop_front();
+		lock.unlock();
+
+		LOG("refreshing key=" << key);
+		std::string value;
+		bool found = fetchRemote(key, value);
+
+		lock.lock();
+		if (!refreshPending.count(key))
+			continue;
+		if (found)
+			refreshed.emplace_back(std::move(key), std::move(value));
+		else
+			refreshPending.erase(key);
+	}
+}
+
 status caching::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
-	const time_t curSysTime = time(0);
-	const std::string curTime = getTimeStamp(curSysTime);
-	const std::string ValueWithCurTime =
-		curTime + std::string(value.data(), value.size());
-	return basePtr->put(std::string(key.data(), key.size()), ValueWithCurTime);
+	cancelRefresh(std::string(key.data(), key.size()));
+	return storeLocal(key, value);
+}
+
+status caching::storeLocal(string_view key, string_view value)
+{
+	const int64_t curTime = currentTime();
+	std::string valueWithCurTime(TIMESTAMP_SIZE + value.size(), '\0');
+	memcpy(&valueWithCurTime[0], &curTime, TIMESTAMP_SIZE);
+	memcpy(&valueWithCurTime[TIMESTAMP_SIZE], value.data(), value.size());
+	if (!clock->enabled())
+		return basePtr->put(key, valueWithCurTime);
+
+	std::lock_guard<std::mutex> lock(clockMtx);
+	const std::string k(key.data(), key.size());
+	const std::size_t bytes = key.size() + value.size();
+	const std::size_t oldBytes = clock->erase(k);
+	while (clock->over_limit(1, bytes) && evictOne())
+		;
+
+	/* when the sub engine is full, make room in it as well */
+	status s;
+	while ((s = basePtr->put(k, valueWithCurTime)) == status::OUT_OF_MEMORY &&
+	       evictOne())
+		;
+
+	if (s == status::OK)
+		clock->touch(k, bytes);
+	else if (oldBytes > 0)
+		clock->touch(k, oldBytes);
+
+	return s;
+}
+
+/* removes the key chosen by the clock from the sub engine; clockMtx must be held */
+bool caching::evictOne()
+{
+	std::string victim;
+	if (!clock->evict(victim))
+		return false;
+
+	LOG("evicting key=" << victim);
+	basePtr->remove(victim);
+	return true;
 }
 
 status caching::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
+	cancelRefresh(std::string(key.data(), key.size()));
+	if (clock->enabled()) {
+		std::lock_guard<std::mutex> lock(clockMtx);
+		clock->erase(std::string(key.data(), key.size()));
+	}
 	return basePtr->remove(std::string(key.data(), key.size()));
 }
 
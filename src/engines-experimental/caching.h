@@ -34,10 +34,130 @@
 
 #include "../engine.h"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace acl
+{
+class redis_client;
+}
+
+struct memcached_st;
+
 namespace pmem
 {
 namespace kv
 {
+namespace internal
+{
+namespace caching
+{
+
+/*
+ * Keeps up to max_idle open connections to the remote server, so consecutive
+ * cache misses do not have to connect again. Connections are created on demand
+ * and the ones which failed should be released with reusable == false.
+ */
+template <typename Connection>
+class connection_pool {
+public:
+	connection_pool(std::size_t max_idle, std::function<Connection *()> create,
+			std::function<void(Connection *)> destroy)
+	    : max_idle(max_idle), create(create), destroy(destroy)
+	{
+	}
+
+	~connection_pool()
+	{
+		for (auto c : idle)
+			destroy(c);
+	}
+
+	connection_pool(const connection_pool &) = delete;
+	connection_pool &operator=(const connection_pool &) = delete;
+
+	Connection *acquire()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!idle.empty()) {
+				auto c = idle.back();
+				idle.pop_back();
+				return c;
+			}
+		}
+
+		return create();
+	}
+
+	void release(Connection *c, bool reusable)
+	{
+		if (reusable) {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (idle.size() < max_idle) {
+				idle.push_back(c);
+				return;
+			}
+		}
+
+		destroy(c);
+	}
+
+private:
+	std::size_t max_idle;
+	std::function<Connection *()> create;
+	std::function<void(Connection *)> destroy;
+
+	std::mutex mtx;
+	std::vector<Connection *> idle;
+};
+
+/*
+ * CLOCK approximation of LRU over cached keys, used to keep the cache within
+ * max_size entries and max_bytes of keys and values. Kept in DRAM only and
+ * rebuilt from the sub engine on start.
+ */
+class clock_policy {
+public:
+	clock_policy(std::size_t max_size, std::size_t max_bytes);
+
+	bool enabled() const;
+	bool over_limit(std::size_t extra_size, std::size_t extra_bytes) const;
+
+	/* inserts or updates the key and marks it as recently used */
+	void touch(const std::string &key, std::size_t bytes);
+	/* returns size of the removed key in bytes, 0 if it was not tracked */
+	std::size_t erase(const std::string &key);
+	/* removes the next key to evict, returns false if there are no keys */
+	bool evict(std::string &victim);
+
+private:
+	struct entry {
+		/* points to the key of the index element */
+		const std::string *key;
+		std::size_t bytes;
+		bool referenced;
+	};
+
+	void erase_at(std::size_t pos);
+
+	std::size_t max_size;
+	std::size_t max_bytes;
+	std::size_t bytes;
+	std::size_t hand;
+	std::vector<entry> entries;
+	std::unordered_map<std::string, std::size_t> index;
+};
+
+} /* namespace caching */
+} /* namespace internal */
 
 class db;
 
@@ -62,9 +182,20 @@ public:
 
 private:
 	void getString(internal::config &cfg, const char *key, std::string &str);
+	memcached_st *connectMemcached();
+	acl::redis_client *connectRedis();
 	bool getFromRemoteRedis(const std::string &key, std::string &value);
 	bool getFromRemoteMemcached(const std::string &key, std::string &value);
+	bool getFromRemote(const std::string &key, std::string &value);
+	bool fetchRemote(const std::string &key, std::string &value);
 	bool getKey(const std::string &key, std::string &valueField, bool api_flag);
+	status storeLocal(string_view key, string_view value);
+	bool evictOne();
+
+	void scheduleRefresh(const std::string &key);
+	void cancelRefresh(const std::string &key);
+	void applyRefreshed();
+	void refreshLoop();
 
 	std::unique_ptr<engine_base> basePtr;
 
@@ -76,6 +207,38 @@ private:
 	std::string remotePasswd;
 	std::string remoteUrl;
 	int64_t ttl;
+
+	/* guards clock and evictions from the sub engine */
+	std::mutex clockMtx;
+	std::unique_ptr<internal::caching::clock_policy> clock;
+
+	std::unique_ptr<internal::caching::connection_pool<memcached_st>> memcachedPool;
+	std::unique_ptr<internal::caching::connection_pool<acl::redis_client>> redisPool;
+
+	/* remote fetch of a key in progress, shared by all threads missing it */
+	struct remote_fetch {
+		bool done = false;
+		bool found = false;
+		std::string value;
+	};
+
+	std::mutex fetchMtx;
+	std::condition_variable fetchCv;
+	std::map<std::string, std::shared_ptr<remote_fetch>> fetches;
+
+	/*
+	 * Keys read less than refreshAhead seconds before their expiry are fetched
+	 * again by refreshThread. Fetched values are stored in the sub engine by
+	 * the next get, unless the key was put or removed in the meantime.
+	 */
+	int64_t refreshAhead;
+	std::mutex refreshMtx;
+	std::condition_variable refreshCv;
+	std::deque<std::string> refreshQueue;
+	std::set<std::string> refreshPending;
+	std::vector<std::pair<std::string, std::string>> refreshed;
+	bool refreshStop;
+	std::thread refreshThread;
 };
 
 } /* namespace kv */
@@ -0,0 +1,585 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dash.h"
+#include "../engines/cmap.h"
+#include "../exceptions.h"
+#include "../out.h"
+#include "../parallel_scan.h"
+
+#include <cstring>
+
+using pmem::obj::transaction;
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace dash
+{
+
+static const unsigned FULL_BITMAP = (1U << BUCKET_SLOTS) - 1;
+
+/* the hash is part of the pool layout, it must never change */
+static uint64_t hash_of(string_view key)
+{
+	return cmap::fast_string_hasher::hash(key.data(), key.size());
+}
+
+/* the directory is indexed by the highest bits of the hash */
+static uint64_t dir_index(uint64_t hash, uint64_t depth)
+{
+	return depth == 0 ? 0 : hash >> (64 - depth);
+}
+
+/* the bucket and the fingerprint are taken from the lowest bits */
+static size_t bucket_index(uint64_t hash)
+{
+	return static_cast<size_t>(hash & (SEGMENT_BUCKETS - 1));
+}
+
+/* the other bucket a record may be stored in */
+static size_t next_bucket(size_t index)
+{
+	return (index + 1) & (SEGMENT_BUCKETS - 1);
+}
+
+static uint8_t fingerprint(uint64_t hash)
+{
+	return static_cast<uint8_t>(hash >> 8);
+}
+
+/* whether the record goes to the new segment, when a segment of depth is split */
+static bool split_bit(uint64_t hash, uint64_t depth)
+{
+	return (hash >> (63 - depth)) & 1;
+}
+
+static unsigned used_slots(const bucket &b)
+{
+	return static_cast<unsigned>(__builtin_popcount(b.bitmap));
+}
+
+/* returns index of a free slot of a bucket which is not full */
+static size_t free_slot(const bucket &b)
+{
+	unsigned free = ~static_cast<unsigned>(b.bitmap) & FULL_BITMAP;
+	return static_cast<size_t>(__builtin_ctz(free));
+}
+
+template <typename T>
+static T *as(PMEMoid oid)
+{
+	return static_cast<T *>(pmemobj_direct(oid));
+}
+
+/* objects are taken from the allocation classes of the pool, if one fits them */
+static PMEMoid make_record(PMEMobjpool *pop, uint64_t hash, string_view key,
+			   string_view value)
+{
+	const size_t size = sizeof(record) + key.size() + value.size();
+	PMEMoid oid = pmemobj_tx_xalloc(size, 0, alloc_classes::flags(pop, size));
+	if (OID_IS_NULL(oid))
+		throw pmem::transaction_alloc_error("Failed to allocate dash record");
+
+	auto r = as<record>(oid);
+	r->hash = hash;
+	r->key_size = key.size();
+	r->value_size = value.size();
+	char *data = reinterpret_cast<char *>(r + 1);
+	memcpy(data, key.data(), key.size());
+	memcpy(data + key.size(), value.data(), value.size());
+	return oid;
+}
+
+static PMEMoid make_segment(PMEMobjpool *pop, uint64_t local_depth)
+{
+	PMEMoid oid = pmemobj_tx_xalloc(
+		sizeof(segment), 0,
+		POBJ_XALLOC_ZERO | alloc_classes::flags(pop, sizeof(segment)));
+	if (OID_IS_NULL(oid))
+		throw pmem::transaction_alloc_error("Failed to allocate dash segment");
+
+	as<segment>(oid)->local_depth = local_depth;
+	return oid;
+}
+
+static PMEMoid make_directory(uint64_t depth)
+{
+	PMEMoid oid = pmemobj_tx_xalloc(sizeof(PMEMoid) << depth, 0, POBJ_XALLOC_ZERO);
+	if (OID_IS_NULL(oid))
+		throw pmem::transaction_alloc_error("Failed to allocate dash directory");
+
+	return oid;
+}
+
+} /* namespace dash */
+} /* namespace internal */
+
+using internal::dash::bucket;
+using internal::dash::record;
+using internal::dash::segment;
+using internal::dash::segment_ref;
+
+dash::dash(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base(cfg), segment_splits(0), directory_doublings(0)
+{
+	reject_read_only();
+	init_allocator(*cfg, {sizeof(segment)});
+	if (OID_IS_NULL(*root_oid)) {
+		transaction::run(pmpool, [&] {
+			transaction::snapshot(root_oid);
+			*root_oid = pmemobj_tx_xalloc(sizeof(internal::dash::header), 0,
+						      POBJ_XALLOC_ZERO);
+			if (OID_IS_NULL(*root_oid))
+				throw pmem::transaction_alloc_error(
+					"Failed to allocate dash header");
+
+			auto t = internal::dash::as<internal::dash::header>(*root_oid);
+			t->directory = internal::dash::make_directory(0);
+			t->depth = 0;
+			internal::dash::as<PMEMoid>(t->directory)[0] =
+				internal::dash::make_segment(pmpool.handle(), 0);
+		});
+	}
+	table = internal::dash::as<internal::dash::header>(*root_oid);
+	pool_uuid = root_oid->pool_uuid_lo;
+
+	/* all entries pointing to a segment are next to each other */
+	std::unique_ptr<internal::dash::directory> d(
+		new internal::dash::directory(table->depth));
+	auto oids = internal::dash::as<PMEMoid>(table->directory);
+	segment_ref *ref = nullptr;
+	for (uint64_t i = 0; i < (1ULL << table->depth); i++) {
+		if (!ref || ref->oid.off != oids[i].off) {
+			auto seg = internal::dash::as<segment>(oids[i]);
+			segments.emplace_back(new segment_ref(oids[i], seg));
+			ref = segments.back().get();
+		}
+		d->segments[i].store(ref, std::memory_order_relaxed);
+	}
+	dir.store(d.get());
+	directories.push_back(std::move(d));
+
+	LOG("Started ok");
+}
+
+dash::~dash()
+{
+	LOG("Stopped ok");
+}
+
+std::string dash::name()
+{
+	return "dash";
+}
+
+segment_ref *dash::locate(uint64_t hash)
+{
+	auto d = dir.load(std::memory_order_acquire);
+	return d->segments[internal::dash::dir_index(hash, d->depth)].load(
+		std::memory_order_acquire);
+}
+
+record *dash::record_at(uint64_t off)
+{
+	return internal::dash::as<record>(PMEMoid{pool_uuid, off});
+}
+
+/*
+ * Looks the key up in its bucket and in the next one, sets the bucket and the
+ * slot of the record. Has to be called with the segment locked.
+ */
+bool dash::find(segment *seg, uint64_t hash, string_view key, bucket *&b, size_t &slot)
+{
+	size_t index = internal::dash::bucket_index(hash);
+	uint8_t fp = internal::dash::fingerprint(hash);
+	for (size_t probe = 0; probe < 2; probe++) {
+		auto &candidate = seg->buckets[probe ? internal::dash::next_bucket(index)
+						     : index];
+		for (unsigned bits = candidate.bitmap; bits; bits &= bits - 1) {
+			auto s = static_cast<size_t>(__builtin_ctz(bits));
+			if (candidate.fingerprints[s] != fp)
+				continue;
+
+			auto r = record_at(candidate.records[s]);
+			if (r->hash != hash || r->key_size != key.size() ||
+			    (key.size() &&
+			     memcmp(r->key().data(), key.data(), key.size()) != 0))
+				continue;
+
+			b = &candidate;
+			slot = s;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Splits the segment, which has to be locked exclusively, into two segments of
+ * higher local depth, doubling the directory first if the segment's depth
+ * equals the global one. Records keep their buckets and slots, so they stay
+ * where lookups look for them. Other segments are not touched.
+ */
+void dash::split(segment_ref *ref, uint64_t hash)
+{
+	auto seg = ref->seg;
+	uint64_t depth = seg->local_depth;
+	if (depth >= internal::dash::MAX_DEPTH)
+		throw internal::error("Too many keys with colliding hashes",
+				      PMEMKV_STATUS_OUT_OF_MEMORY);
+
+	std::lock_guard<std::mutex> lock(dir_mtx);
+	auto d = dir.load(std::memory_order_relaxed);
+	bool doubled = depth == d->depth;
+	uint64_t new_depth = doubled ? d->depth + 1 : d->depth;
+
+	/* volatile state is allocated first, so it can be updated after the commit */
+	segments.reserve(segments.size() + 1);
+	std::unique_ptr<segment_ref> new_ref(new segment_ref(OID_NULL, nullptr));
+	std::unique_ptr<internal::dash::directory> new_dir;
+	if (doubled) {
+		new_dir.reset(new internal::dash::directory(new_depth));
+		directories.reserve(directories.size() + 1);
+	}
+
+	/* entries of the segment, the upper half of them is given to the new one */
+	uint64_t span = 1ULL << (new_depth - depth);
+	uint64_t first = internal::dash::dir_index(hash, depth) * span + span / 2;
+	uint64_t last = first + span / 2;
+
+	transaction::run(pmpool, [&] {
+		if (doubled) {
+			PMEMoid old_oid = table->directory;
+			PMEMoid new_oid = internal::dash::make_directory(new_depth);
+			auto from = internal::dash::as<PMEMoid>(old_oid);
+			auto to = internal::dash::as<PMEMoid>(new_oid);
+			for (uint64_t i = 0; i < (1ULL << new_depth); i++)
+				to[i] = from[i >> 1];
+
+			transaction::snapshot(table);
+			table->directory = new_oid;
+			table->depth = new_depth;
+			pmemobj_tx_free(old_oid);
+		}
+
+		new_ref->oid = internal::dash::make_segment(pmpool.handle(), depth + 1);
+		new_ref->seg = internal::dash::as<segment>(new_ref->oid);
+		auto new_seg = new_ref->seg;
+
+		transaction::snapshot(seg);
+		seg->local_depth = depth + 1;
+		for (size_t i = 0; i < internal::dash::SEGMENT_BUCKETS; i++) {
+			auto &from = seg->buckets[i];
+			auto &to = new_seg->buckets[i];
+			for (unsigned bits = from.bitmap; bits; bits &= bits - 1) {
+				auto s = static_cast<unsigned>(__builtin_ctz(bits));
+				auto r = record_at(from.records[s]);
+				if (!internal::dash::split_bit(r->hash, depth))
+					continue;
+
+				unsigned bit = 1U << s;
+				to.records[s] = from.records[s];
+				to.fingerprints[s] = from.fingerprints[s];
+				to.bitmap = static_cast<uint16_t>(to.bitmap | bit);
+				from.bitmap = static_cast<uint16_t>(from.bitmap & ~bit);
+				seg->count--;
+				new_seg->count++;
+			}
+		}
+
+		auto oids = internal::dash::as<PMEMoid>(table->directory);
+		if (!doubled)
+			transaction::snapshot(&oids[first],
+					      static_cast<size_t>(last - first));
+		for (uint64_t i = first; i < last; i++)
+			oids[i] = new_ref->oid;
+	});
+
+	auto new_seg = new_ref.get();
+	segments.push_back(std::move(new_ref));
+	if (doubled) {
+		for (uint64_t i = 0; i < (1ULL << new_depth); i++) {
+			auto ref = i >= first && i < last ? new_seg
+							  : d->segments[i >> 1].load();
+			new_dir->segments[i].store(ref, std::memory_order_relaxed);
+		}
+		dir.store(new_dir.get(), std::memory_order_release);
+		directories.push_back(std::move(new_dir));
+		directory_doublings++;
+	} else {
+		for (uint64_t i = first; i < last; i++)
+			d->segments[i].store(new_seg, std::memory_order_release);
+	}
+	segment_splits++;
+}
+
+/* segments are only added, so the ones returned stay valid */
+std::vector<segment_ref *> dash::all_segments()
+{
+	std::lock_guard<std::mutex> lock(dir_mtx);
+	std::vector<segment_ref *> refs;
+	refs.reserve(segments.size());
+	for (auto &ref : segments)
+		refs.push_back(ref.get());
+
+	return refs;
+}
+
+status dash::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+
+	auto refs = all_segments();
+
+	std::size_t result = 0;
+	for (auto ref : refs) {
+		internal::dash::shared_lock lock(ref->mtx);
+		result += ref->seg->count;
+	}
+	cnt = result;
+
+	return status::OK;
+}
+
+template <typename Function>
+status dash::scan(size_t nthreads, Function f)
+{
+	auto refs = all_segments();
+
+	return internal::parallel_for_each(
+		nthreads, refs.begin(), refs.end(), 1,
+		[&](size_t worker, std::vector<segment_ref *>::iterator it) {
+			internal::dash::shared_lock lock((*it)->mtx);
+			for (auto &b : (*it)->seg->buckets) {
+				for (unsigned bits = b.bitmap; bits; bits &= bits - 1) {
+					auto s = __builtin_ctz(bits);
+					if (!f(worker, record_at(b.records[s])))
+						return false;
+				}
+			}
+			return true;
+		});
+}
+
+/*
+ * Visits records of every segment, holding its lock in shared mode. Records
+ * put concurrently, or moved by a concurrent split, may be missed.
+ */
+status dash::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+
+	auto call = [&](size_t, const record *r) {
+		auto k = r->key();
+		auto v = r->value();
+		return callback(k.data(), k.size(), v.data(), v.size(), arg) == 0;
+	};
+	return scan(1, call);
+}
+
+/* segments are handed out to the workers one at a time */
+status dash::get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+			      void *arg)
+{
+	LOG("get_all_parallel nthreads=" << nthreads);
+	check_outside_tx();
+
+	auto call = [&](size_t worker, const record *r) {
+		auto k = r->key();
+		auto v = r->value();
+		return callback(worker, k.data(), k.size(), v.data(), v.size(), arg) == 0;
+	};
+	return scan(nthreads, call);
+}
+
+status dash::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t hash = internal::dash::hash_of(key);
+	while (true) {
+		auto ref = locate(hash);
+		internal::dash::shared_lock lock(ref->mtx);
+		/* the segment was split before it was locked */
+		if (locate(hash) != ref)
+			continue;
+
+		bucket *b;
+		size_t slot;
+		if (!find(ref->seg, hash, key, b, slot))
+			return status::NOT_FOUND;
+
+		return status::OK;
+	}
+}
+
+status dash::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t hash = internal::dash::hash_of(key);
+	while (true) {
+		auto ref = locate(hash);
+		internal::dash::shared_lock lock(ref->mtx);
+		if (locate(hash) != ref)
+			continue;
+
+		bucket *b;
+		size_t slot;
+		if (!find(ref->seg, hash, key, b, slot)) {
+			LOG("  key not found");
+			return status::NOT_FOUND;
+		}
+
+		auto value = record_at(b->records[slot])->value();
+		callback(value.data(), value.size(), arg);
+		return status::OK;
+	}
+}
+
+status dash::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+
+	uint64_t hash = internal::dash::hash_of(key);
+	while (true) {
+		auto ref = locate(hash);
+		std::lock_guard<internal::dash::shared_mutex> lock(ref->mtx);
+		if (locate(hash) != ref)
+			continue;
+
+		auto seg = ref->seg;
+		bucket *b;
+		size_t slot;
+		if (find(seg, hash, key, b, slot)) {
+			transaction::run(pmpool, [&] {
+				PMEMoid old{pool_uuid, b->records[slot]};
+				transaction::snapshot(&b->records[slot]);
+				b->records[slot] =
+					internal::dash::make_record(pmpool.handle(), hash,
+								    key, value)
+						.off;
+				pmemobj_tx_free(old);
+			});
+			return status::OK;
+		}
+
+		/* the less used of the two buckets the key may be in */
+		size_t index = internal::dash::bucket_index(hash);
+		auto home = &seg->buckets[index];
+		auto next = &seg->buckets[internal::dash::next_bucket(index)];
+		b = internal::dash::used_slots(*home) <= internal::dash::used_slots(*next)
+			? home
+			: next;
+		if (internal::dash::used_slots(*b) == internal::dash::BUCKET_SLOTS) {
+			split(ref, hash);
+			continue;
+		}
+
+		slot = internal::dash::free_slot(*b);
+		transaction::run(pmpool, [&] {
+			transaction::snapshot(b);
+			transaction::snapshot(&seg->count);
+			auto oid = internal::dash::make_record(pmpool.handle(), hash,
+							       key, value);
+			b->records[slot] = oid.off;
+			b->fingerprints[slot] = internal::dash::fingerprint(hash);
+			b->bitmap = static_cast<uint16_t>(b->bitmap | (1U << slot));
+			seg->count++;
+		});
+		return status::OK;
+	}
+}
+
+status dash::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	uint64_t hash = internal::dash::hash_of(key);
+	while (true) {
+		auto ref = locate(hash);
+		std::lock_guard<internal::dash::shared_mutex> lock(ref->mtx);
+		if (locate(hash) != ref)
+			continue;
+
+		auto seg = ref->seg;
+		bucket *b;
+		size_t slot;
+		if (!find(seg, hash, key, b, slot))
+			return status::NOT_FOUND;
+
+		transaction::run(pmpool, [&] {
+			transaction::snapshot(&b->bitmap);
+			transaction::snapshot(&seg->count);
+			b->bitmap = static_cast<uint16_t>(b->bitmap & ~(1U << slot));
+			seg->count--;
+			pmemobj_tx_free(PMEMoid{pool_uuid, b->records[slot]});
+		});
+		return status::OK;
+	}
+}
+
+void dash::metrics(internal::engine_metrics &metrics)
+{
+	uint64_t depth = dir.load()->depth;
+	auto refs = all_segments();
+
+	uint64_t records = 0;
+	for (auto ref : refs) {
+		internal::dash::shared_lock lock(ref->mtx);
+		records += ref->seg->count;
+	}
+	double capacity = static_cast<double>(refs.size() *
+					      internal::dash::SEGMENT_BUCKETS *
+					      internal::dash::BUCKET_SLOTS);
+
+	metrics.add("global_depth", depth);
+	metrics.add("segments", static_cast<uint64_t>(refs.size()));
+	metrics.add("load_factor", static_cast<double>(records) / capacity);
+	metrics.add("segment_splits", segment_splits.load());
+	metrics.add("directory_doublings", directory_doublings.load());
+}
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,265 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../pmemobj_engine.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace dash
+{
+
+/* records in a bucket */
+static const size_t BUCKET_SLOTS = 14;
+
+/* buckets in a segment, a power of two */
+static const size_t SEGMENT_BUCKETS = 64;
+
+/*
+ * Highest local depth of a segment. Bits of the hash below it choose the bucket
+ * and the fingerprint, so they must not be used by the directory.
+ */
+static const uint64_t MAX_DEPTH = 48;
+
+/*
+ * Record of the table: hash of the key, sizes of the key and of the value,
+ * followed by the key and the value, in a single allocation. A record is
+ * never modified, a put of an existing key replaces it.
+ */
+struct record {
+	uint64_t hash;
+	uint64_t key_size;
+	uint64_t value_size;
+
+	string_view key() const
+	{
+		return string_view(reinterpret_cast<const char *>(this + 1), key_size);
+	}
+
+	string_view value() const
+	{
+		return string_view(reinterpret_cast<const char *>(this + 1) + key_size,
+				   value_size);
+	}
+};
+
+/*
+ * Bucket of two cache lines: one-byte fingerprints of the records and a bitmap
+ * of used slots, followed by pool offsets of the records. A lookup compares the
+ * key only with the records whose fingerprints match.
+ */
+struct bucket {
+	uint8_t fingerprints[BUCKET_SLOTS];
+	uint16_t bitmap;
+	uint64_t records[BUCKET_SLOTS];
+};
+
+/*
+ * Segment of the table. A record is stored in the bucket chosen by its hash or
+ * in the next one, whichever has more free slots. When both are full, the
+ * segment is split in two, without rehashing the rest of the table.
+ */
+struct segment {
+	uint64_t local_depth;
+	uint64_t count; /* number of records */
+	bucket buckets[SEGMENT_BUCKETS];
+};
+
+/* root object of the engine */
+struct header {
+	/* array of (1 << depth) PMEMoids of segments */
+	PMEMoid directory;
+	uint64_t depth;
+};
+
+/*
+ * Reader-writer lock, usable with std::lock_guard (exclusive mode) and
+ * shared_lock (shared mode). std::shared_mutex requires C++17.
+ */
+class shared_mutex {
+public:
+	shared_mutex()
+	{
+		pthread_rwlock_init(&rwlock, nullptr);
+	}
+
+	~shared_mutex()
+	{
+		pthread_rwlock_destroy(&rwlock);
+	}
+
+	shared_mutex(const shared_mutex &) = delete;
+	shared_mutex &operator=(const shared_mutex &) = delete;
+
+	void lock()
+	{
+		pthread_rwlock_wrlock(&rwlock);
+	}
+
+	void unlock()
+	{
+		pthread_rwlock_unlock(&rwlock);
+	}
+
+	void lock_shared()
+	{
+		pthread_rwlock_rdlock(&rwlock);
+	}
+
+	void unlock_shared()
+	{
+		pthread_rwlock_unlock(&rwlock);
+	}
+
+private:
+	pthread_rwlock_t rwlock;
+};
+
+class shared_lock {
+public:
+	explicit shared_lock(shared_mutex &m) : mtx(m)
+	{
+		mtx.lock_shared();
+	}
+
+	~shared_lock()
+	{
+		mtx.unlock_shared();
+	}
+
+	shared_lock(const shared_lock &) = delete;
+	shared_lock &operator=(const shared_lock &) = delete;
+
+private:
+	shared_mutex &mtx;
+};
+
+/* volatile state of a segment */
+struct segment_ref {
+	segment_ref(PMEMoid oid, segment *seg) : oid(oid), seg(seg)
+	{
+	}
+
+	PMEMoid oid;
+	segment *seg;
+	shared_mutex mtx;
+};
+
+/*
+ * Volatile copy of the directory, read without locks. It is replaced, not
+ * modified, when the directory is doubled, so readers which loaded the previous
+ * one can still use it; they find out it is stale when they lock the segment.
+ */
+struct directory {
+	directory(uint64_t depth)
+	    : depth(depth), segments(new std::atomic<segment_ref *>[1ULL << depth])
+	{
+	}
+
+	uint64_t depth;
+	std::unique_ptr<std::atomic<segment_ref *>[]> segments;
+};
+
+} /* namespace dash */
+} /* namespace internal */
+
+/*
+ * Persistent hash table, based on extendible hashing with segments (CCEH) and
+ * fingerprinted buckets (Dash). A full segment is split on its own, so puts
+ * never wait for the whole table to be rehashed. Every change is made in
+ * a single transaction. Readers and writers lock only the segment of the key.
+ */
+class dash : public pmemobj_engine_base<internal::dash::header> {
+public:
+	dash(std::unique_ptr<internal::config> cfg);
+	~dash();
+
+	dash(const dash &) = delete;
+	dash &operator=(const dash &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				void *arg) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+
+	status remove(string_view key) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
+private:
+	internal::dash::segment_ref *locate(uint64_t hash);
+	internal::dash::record *record_at(uint64_t off);
+	bool find(internal::dash::segment *seg, uint64_t hash, string_view key,
+		  internal::dash::bucket *&b, size_t &slot);
+	void split(internal::dash::segment_ref *ref, uint64_t hash);
+	std::vector<internal::dash::segment_ref *> all_segments();
+
+	template <typename Function>
+	status scan(size_t nthreads, Function f);
+
+	internal::dash::header *table;
+	uint64_t pool_uuid;
+
+	std::atomic<internal::dash::directory *> dir;
+	/* serializes splits, guards the vectors below */
+	std::mutex dir_mtx;
+	/* the current directory and the replaced ones */
+	std::vector<std::unique_ptr<internal::dash::directory>> directories;
+	std::vector<std::unique_ptr<internal::dash::segment_ref>> segments;
+
+	std::atomic<uint64_t> segment_splits;
+	std::atomic<uint64_t> directory_doublings;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,451 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "indexed.h"
+#include "../out.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace indexed
+{
+
+/* first bytes of keys of the sub engine: records, the end of records, index entries */
+static const std::string RECORDS = "r";
+static const std::string RECORDS_END = "s";
+static const std::string INDEX = "x";
+
+static std::string record_key(string_view key)
+{
+	return RECORDS + std::string(key.data(), key.size());
+}
+
+/*
+ * Prefix of index entries of the index key. Zero bytes of the index key are
+ * followed by 0xff and the key is terminated by a zero byte and 0x01, so that
+ * no index key is a prefix of the encoding of another one.
+ */
+static std::string entry_prefix(string_view index_key)
+{
+	std::string prefix = INDEX;
+	for (size_t i = 0; i < index_key.size(); i++) {
+		prefix += index_key.data()[i];
+		if (index_key.data()[i] == '\0')
+			prefix += '\xff';
+	}
+	prefix += '\0';
+	prefix += '\x01';
+
+	return prefix;
+}
+
+static std::string entry_key(string_view index_key, string_view key)
+{
+	return entry_prefix(index_key) + std::string(key.data(), key.size());
+}
+
+struct records_context {
+	get_kv_callback *callback;
+	void *arg;
+	bool stopped;
+};
+
+/* passes records without their prefix, stops at the first key which is not one */
+static int records_callback(const char *k, size_t kb, const char *v, size_t vb,
+			    void *arg)
+{
+	auto c = static_cast<records_context *>(arg);
+	if (kb < RECORDS.size() || k[0] != RECORDS[0])
+		return 1;
+
+	c->stopped = c->callback(k + 1, kb - 1, v, vb, c->arg) != 0;
+	return c->stopped;
+}
+
+/* iteration stopped by records_callback() at the end of records is complete */
+static status records_status(status s, const records_context &ctx)
+{
+	if (s == status::STOPPED_BY_CB && !ctx.stopped)
+		return status::OK;
+
+	return s;
+}
+
+struct entries_context {
+	size_t prefix_size;
+	std::vector<std::string> keys;
+};
+
+/* collects keys of records from their index entries */
+static int entries_callback(const char *k, size_t kb, const char *, size_t, void *arg)
+{
+	auto c = static_cast<entries_context *>(arg);
+	c->keys.emplace_back(k + c->prefix_size, kb - c->prefix_size);
+	return 0;
+}
+
+static void copy_value(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+} /* namespace indexed */
+} /* namespace internal */
+
+indexed::indexed(std::unique_ptr<internal::config> cfg)
+{
+	const char *sub_name;
+	if (!cfg->get_string("subengine", &sub_name))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"subengine\"");
+	std::string sub_engine_name(sub_name);
+
+	internal::index_extractor *e;
+	if (!cfg->get_object("index_extractor", (void **)&e))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"index_extractor\"");
+	extractor = *e;
+
+	internal::config *sub_cfg;
+	if (!cfg->get_object("subengine_config", (void **)&sub_cfg))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"subengine_config\"");
+
+	/* Remove item to pass ownership of it to subengine */
+	cfg->remove("subengine_config");
+
+	sub_engine = engine_base::create_engine(
+		sub_engine_name, std::unique_ptr<internal::config>(sub_cfg));
+
+	LOG("Started ok");
+}
+
+indexed::~indexed()
+{
+	LOG("Stopped ok");
+}
+
+std::string indexed::name()
+{
+	return "indexed";
+}
+
+bool indexed::extract(string_view value, std::string &index_key)
+{
+	const char *ik;
+	size_t ikb;
+	if (extractor.extract(value.data(), value.size(), &ik, &ikb, extractor.arg) != 0)
+		return false;
+
+	index_key.assign(ik, ikb);
+	return true;
+}
+
+status indexed::read(const std::string &key, std::string &value)
+{
+	return sub_engine->get(key, internal::indexed::copy_value, &value);
+}
+
+/* adds to batch the put of a record, which replaces the previous value, if any */
+void indexed::add_put(internal::write_batch &batch, string_view key, string_view value,
+		      const std::string *previous)
+{
+	std::string index_key, previous_key;
+	bool has_key = extract(value, index_key);
+	bool unchanged = false;
+
+	if (previous && extract(*previous, previous_key)) {
+		unchanged = has_key && previous_key == index_key;
+		if (!unchanged)
+			batch.remove(internal::indexed::entry_key(previous_key, key));
+	}
+
+	batch.put(internal::indexed::record_key(key), value);
+	if (has_key && !unchanged)
+		batch.put(internal::indexed::entry_key(index_key, key), "");
+}
+
+/* adds to batch the remove of an existing record with the previous value */
+void indexed::add_remove(internal::write_batch &batch, string_view key,
+			 const std::string &previous)
+{
+	std::string index_key;
+
+	batch.remove(internal::indexed::record_key(key));
+	if (extract(previous, index_key))
+		batch.remove(internal::indexed::entry_key(index_key, key));
+}
+
+status indexed::count_all(std::size_t &cnt)
+{
+	return sub_engine->count_prefix(internal::indexed::RECORDS, cnt);
+}
+
+status indexed::count_above(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_between(internal::indexed::record_key(key),
+					 internal::indexed::RECORDS_END, cnt);
+}
+
+status indexed::count_equal_above(string_view key, std::size_t &cnt)
+{
+	auto s = count_above(key, cnt);
+	if (s != status::OK)
+		return s;
+
+	s = exists(key);
+	if (s == status::OK)
+		cnt++;
+
+	return s == status::NOT_FOUND ? status::OK : s;
+}
+
+status indexed::count_equal_below(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_equal_below(internal::indexed::record_key(key), cnt);
+}
+
+status indexed::count_below(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_below(internal::indexed::record_key(key), cnt);
+}
+
+status indexed::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	return sub_engine->count_between(internal::indexed::record_key(key1),
+					 internal::indexed::record_key(key2), cnt);
+}
+
+status indexed::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	return sub_engine->count_prefix(internal::indexed::record_key(prefix), cnt);
+}
+
+status indexed::get_all(get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_prefix(internal::indexed::RECORDS,
+					internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+status indexed::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_between(internal::indexed::record_key(key),
+					 internal::indexed::RECORDS_END,
+					 internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+status indexed::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_equal_above(internal::indexed::record_key(key),
+					     internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+status indexed::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_equal_below(internal::indexed::record_key(key),
+					     internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+status indexed::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_below(internal::indexed::record_key(key),
+				       internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+status indexed::get_between(string_view key1, string_view key2,
+			    get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_between(internal::indexed::record_key(key1),
+					 internal::indexed::record_key(key2),
+					 internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+status indexed::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	internal::indexed::records_context ctx{callback, arg, false};
+	auto s = sub_engine->get_prefix(internal::indexed::record_key(prefix),
+					internal::indexed::records_callback, &ctx);
+	return internal::indexed::records_status(s, ctx);
+}
+
+/*
+ * Keys of the index entries are collected first, so that the records are read
+ * outside of the iteration of the sub engine. A record changed by a put which
+ * completed meanwhile is passed only if it still has the index key.
+ */
+status indexed::get_by_index(string_view index_key, get_kv_callback *callback,
+			     void *arg)
+{
+	LOG("get_by_index for index key=" << std::string(index_key.data(),
+							 index_key.size()));
+	auto prefix = internal::indexed::entry_prefix(index_key);
+	internal::indexed::entries_context ctx{prefix.size(), {}};
+	auto s = sub_engine->get_prefix(prefix, internal::indexed::entries_callback,
+					&ctx);
+	if (s != status::OK)
+		return s;
+
+	std::string value, current;
+	for (auto &key : ctx.keys) {
+		s = read(internal::indexed::record_key(key), value);
+		if (s == status::NOT_FOUND)
+			continue;
+		if (s != status::OK)
+			return s;
+		if (!extract(value, current) ||
+		    current != std::string(index_key.data(), index_key.size()))
+			continue;
+
+		if (callback(key.data(), key.size(), value.data(), value.size(), arg) !=
+		    0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+status indexed::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	return sub_engine->exists(internal::indexed::record_key(key));
+}
+
+status indexed::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	return sub_engine->get(internal::indexed::record_key(key), callback, arg);
+}
+
+status indexed::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	std::lock_guard<std::mutex> lock(writers);
+
+	std::string previous;
+	auto s = read(internal::indexed::record_key(key), previous);
+	if (s != status::OK && s != status::NOT_FOUND)
+		return s;
+
+	internal::write_batch batch;
+	add_put(batch, key, value, s == status::OK ? &previous : nullptr);
+	return sub_engine->write(batch);
+}
+
+status indexed::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	std::lock_guard<std::mutex> lock(writers);
+
+	std::string previous;
+	auto s = read(internal::indexed::record_key(key), previous);
+	if (s != status::OK)
+		return s;
+
+	internal::write_batch batch;
+	add_remove(batch, key, previous);
+	return sub_engine->write(batch);
+}
+
+/*
+ * The batch is translated into a single batch of the sub engine. Values which
+ * operations replace are read from the sub engine, or taken from the earlier
+ * operations of the batch on the same key.
+ */
+status indexed::write(internal::write_batch &batch)
+{
+	LOG("write batch of " << batch.size() << " operations");
+	std::lock_guard<std::mutex> lock(writers);
+
+	/* values of keys changed by the batch, not present if removed */
+	std::unordered_map<std::string, std::pair<bool, std::string>> changed;
+	internal::write_batch sub_batch;
+
+	for (auto &op : batch.operations()) {
+		auto it = changed.find(op.key);
+		if (it == changed.end()) {
+			std::pair<bool, std::string> previous(false, "");
+			auto s = read(internal::indexed::record_key(op.key),
+				      previous.second);
+			if (s != status::OK && s != status::NOT_FOUND)
+				return s;
+
+			previous.first = s == status::OK;
+			it = changed.emplace(op.key, std::move(previous)).first;
+		}
+
+		auto &previous = it->second;
+		if (op.type == internal::write_batch::op_type::PUT) {
+			add_put(sub_batch, op.key, op.value,
+				previous.first ? &previous.second : nullptr);
+			previous = std::make_pair(true, op.value);
+		} else if (previous.first) {
+			add_remove(sub_batch, op.key, previous.second);
+			previous = std::make_pair(false, std::string());
+		}
+	}
+
+	return sub_engine->write(sub_batch);
+}
+
+status indexed::defrag(double start_percent, double amount_percent)
+{
+	return sub_engine->defrag(start_percent, amount_percent);
+}
+
+void indexed::metrics(internal::engine_metrics &metrics)
+{
+	sub_engine->metrics(metrics);
+}
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../engine.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+
+/*
+ * Secondary index over an ordered sub engine. Every record is kept in the sub
+ * engine under its key prefixed with 'r', and, if the extractor given in the
+ * config finds an index key in its value, along with an empty index entry made
+ * of 'x', the escaped index key and the key of the record. A put or a remove
+ * changes the record and its index entries with a single write() of the sub
+ * engine, which is atomic for engines applying a batch in one transaction
+ * (tree3, radix). Writers are serialized, readers are passed to the sub engine,
+ * which also determines whether they may run concurrently with writers.
+ */
+class indexed : public engine_base {
+public:
+	indexed(std::unique_ptr<internal::config> cfg);
+	~indexed();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
+
+	status get_by_index(string_view index_key, get_kv_callback *callback,
+			    void *arg) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+	status remove(string_view key) final;
+	status write(internal::write_batch &batch) final;
+	status defrag(double start_percent, double amount_percent) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
+private:
+	bool extract(string_view value, std::string &index_key);
+	status read(const std::string &key, std::string &value);
+	void add_put(internal::write_batch &batch, string_view key, string_view value,
+		     const std::string *previous);
+	void add_remove(internal::write_batch &batch, string_view key,
+			const std::string &previous);
+
+	std::unique_ptr<engine_base> sub_engine;
+	internal::index_extractor extractor;
+	std::mutex writers;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
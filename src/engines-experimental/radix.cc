@@ -0,0 +1,1044 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "radix.h"
+#include "../out.h"
+#include "../write_batch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+using pmem::obj::transaction;
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace radix
+{
+
+/* nodes are shrunk when they are left with this many children */
+static const uint16_t NODE16_SHRINK = 3;
+static const uint16_t NODE48_SHRINK = 12;
+static const uint16_t NODE256_SHRINK = 37;
+
+static uint8_t type_of(PMEMoid oid)
+{
+	return *static_cast<const uint8_t *>(pmemobj_direct(oid));
+}
+
+template <typename T>
+static T *as(PMEMoid oid)
+{
+	return static_cast<T *>(pmemobj_direct(oid));
+}
+
+/* lexicographic order of keys, like std::string::compare */
+static int compare(string_view lhs, string_view rhs)
+{
+	size_t size = std::min(lhs.size(), rhs.size());
+	int r = size ? memcmp(lhs.data(), rhs.data(), size) : 0;
+	if (r != 0)
+		return r;
+	return lhs.size() < rhs.size() ? -1 : (lhs.size() > rhs.size() ? 1 : 0);
+}
+
+static bool equal(string_view lhs, string_view rhs)
+{
+	return lhs.size() == rhs.size() &&
+		(lhs.size() == 0 || memcmp(lhs.data(), rhs.data(), lhs.size()) == 0);
+}
+
+static uint8_t byte_at(string_view key, size_t pos)
+{
+	return static_cast<uint8_t>(key.data()[pos]);
+}
+
+/*
+ * Slot of the child with the lowest key byte not less than from, which is set
+ * in byte; null if there is no such child.
+ */
+static PMEMoid *child_from(node *n, unsigned from, uint8_t &byte)
+{
+	switch (n->type) {
+		case NODE4:
+		case NODE16: {
+			uint8_t *keys = n->type == NODE4 ? static_cast<node4 *>(n)->keys
+							 : static_cast<node16 *>(n)->keys;
+			PMEMoid *children = n->type == NODE4
+				? static_cast<node4 *>(n)->children
+				: static_cast<node16 *>(n)->children;
+			for (uint16_t i = 0; i < n->count; i++) {
+				if (keys[i] >= from) {
+					byte = keys[i];
+					return &children[i];
+				}
+			}
+			return nullptr;
+		}
+		case NODE48: {
+			auto n48 = static_cast<node48 *>(n);
+			for (unsigned b = from; b < 256; b++) {
+				if (n48->index[b]) {
+					byte = static_cast<uint8_t>(b);
+					return &n48->children[n48->index[b] - 1];
+				}
+			}
+			return nullptr;
+		}
+		default: {
+			auto n256 = static_cast<node256 *>(n);
+			for (unsigned b = from; b < 256; b++) {
+				if (!OID_IS_NULL(n256->children[b])) {
+					byte = static_cast<uint8_t>(b);
+					return &n256->children[b];
+				}
+			}
+			return nullptr;
+		}
+	}
+}
+
+/* slot of the child for the key byte, null if there is none */
+static PMEMoid *find_child(node *n, uint8_t byte)
+{
+	switch (n->type) {
+		case NODE4: {
+			auto n4 = static_cast<node4 *>(n);
+			for (uint16_t i = 0; i < n->count; i++)
+				if (n4->keys[i] == byte)
+					return &n4->children[i];
+			return nullptr;
+		}
+		case NODE16: {
+			auto n16 = static_cast<node16 *>(n);
+			for (uint16_t i = 0; i < n->count; i++)
+				if (n16->keys[i] == byte)
+					return &n16->children[i];
+			return nullptr;
+		}
+		case NODE48: {
+			auto n48 = static_cast<node48 *>(n);
+			return n48->index[byte] ? &n48->children[n48->index[byte] - 1]
+						: nullptr;
+		}
+		default: {
+			auto n256 = static_cast<node256 *>(n);
+			return OID_IS_NULL(n256->children[byte]) ? nullptr
+								 : &n256->children[byte];
+		}
+	}
+}
+
+/* leaf with the lowest key in the subtree, its key starts with the path to oid */
+static leaf *min_leaf(PMEMoid oid)
+{
+	while (type_of(oid) != LEAF) {
+		auto n = as<node>(oid);
+		uint8_t byte;
+		oid = OID_IS_NULL(n->value) ? *child_from(n, 0, byte) : n->value;
+	}
+	return as<leaf>(oid);
+}
+
+/*
+ * Length of the common part of the compressed path of the node, which starts at
+ * depth, and of the key (at most prefix_size).
+ */
+static size_t prefix_mismatch(PMEMoid oid, string_view key, size_t depth)
+{
+	auto n = as<node>(oid);
+	size_t max = std::min<size_t>(n->prefix_size, key.size() - depth);
+	size_t stored = std::min(max, PREFIX_BYTES);
+	for (size_t i = 0; i < stored; i++)
+		if (n->prefix[i] != byte_at(key, depth + i))
+			return i;
+
+	if (max > PREFIX_BYTES) {
+		string_view path = min_leaf(oid)->key();
+		for (size_t i = PREFIX_BYTES; i < max; i++)
+			if (byte_at(path, depth + i) != byte_at(key, depth + i))
+				return i;
+	}
+	return max;
+}
+
+/* sets size bytes of key, starting at pos, as the compressed path of the node */
+static void set_prefix(node *n, string_view key, size_t pos, size_t size)
+{
+	n->prefix_size = static_cast<uint32_t>(size);
+	memcpy(n->prefix, key.data() + pos, std::min(size, PREFIX_BYTES));
+}
+
+/*
+ * Has to be called within a transaction, like all functions changing the tree.
+ * Objects are taken from the allocation classes of the pool, if one fits them.
+ */
+static PMEMoid make_leaf(PMEMobjpool *pop, string_view key, string_view value)
+{
+	const size_t size = sizeof(leaf) + key.size() + value.size();
+	PMEMoid oid = pmemobj_tx_xalloc(size, LEAF, alloc_classes::flags(pop, size));
+	if (OID_IS_NULL(oid))
+		throw pmem::transaction_alloc_error("Failed to allocate radix leaf");
+
+	auto l = as<leaf>(oid);
+	l->type = LEAF;
+	l->key_size = key.size();
+	l->value_size = value.size();
+	char *data = reinterpret_cast<char *>(l + 1);
+	memcpy(data, key.data(), key.size());
+	memcpy(data + key.size(), value.data(), value.size());
+	return oid;
+}
+
+template <typename Node>
+static PMEMoid make_node(PMEMobjpool *pop, uint8_t type)
+{
+	PMEMoid oid = pmemobj_tx_xalloc(sizeof(Node), type,
+					POBJ_XALLOC_ZERO |
+						alloc_classes::flags(pop, sizeof(Node)));
+	if (OID_IS_NULL(oid))
+		throw pmem::transaction_alloc_error("Failed to allocate radix node");
+
+	as<node>(oid)->type = type;
+	return oid;
+}
+
+/* node of another type, with the same path, value and children as the given one */
+template <typename Node>
+static PMEMoid copy_node(node *n, uint8_t type)
+{
+	PMEMoid oid = make_node<Node>(pmemobj_pool_by_ptr(n), type);
+	auto copy = as<node>(oid);
+	copy->prefix_size = n->prefix_size;
+	memcpy(copy->prefix, n->prefix, PREFIX_BYTES);
+	copy->value = n->value;
+
+	uint8_t byte;
+	for (unsigned from = 0; auto child = child_from(n, from, byte);
+	     from = byte + 1u) {
+		switch (type) {
+			case NODE4: {
+				auto c = static_cast<node4 *>(copy);
+				c->keys[c->count] = byte;
+				c->children[c->count] = *child;
+				break;
+			}
+			case NODE16: {
+				auto c = static_cast<node16 *>(copy);
+				c->keys[c->count] = byte;
+				c->children[c->count] = *child;
+				break;
+			}
+			case NODE48: {
+				auto c = static_cast<node48 *>(copy);
+				c->children[c->count] = *child;
+				c->index[byte] = static_cast<uint8_t>(c->count + 1);
+				break;
+			}
+			default:
+				static_cast<node256 *>(copy)->children[byte] = *child;
+		}
+		copy->count++;
+	}
+	return oid;
+}
+
+/* replaces the node in slot ref with a copy of a different type */
+template <typename Node>
+static void change_type(PMEMoid &ref, uint8_t type)
+{
+	PMEMoid copy = copy_node<Node>(as<node>(ref), type);
+	pmemobj_tx_free(ref);
+	transaction::snapshot(&ref);
+	ref = copy;
+}
+
+/* inserts into sorted keys and children of node4 or node16, which is not full */
+static void insert_sorted(node *n, uint8_t *keys, PMEMoid *children, size_t capacity,
+			  uint8_t byte, PMEMoid child)
+{
+	transaction::snapshot(n);
+	transaction::snapshot(keys, capacity);
+	transaction::snapshot(children, capacity);
+	size_t pos = n->count;
+	while (pos > 0 && keys[pos - 1] > byte) {
+		keys[pos] = keys[pos - 1];
+		children[pos] = children[pos - 1];
+		pos--;
+	}
+	keys[pos] = byte;
+	children[pos] = child;
+	n->count++;
+}
+
+/* adds the child of the node in slot ref, which is grown if it is full */
+static void add_child(PMEMoid &ref, uint8_t byte, PMEMoid child)
+{
+	auto n = as<node>(ref);
+	switch (n->type) {
+		case NODE4: {
+			if (n->count == 4) {
+				change_type<node16>(ref, NODE16);
+				return add_child(ref, byte, child);
+			}
+			auto n4 = static_cast<node4 *>(n);
+			return insert_sorted(n, n4->keys, n4->children, 4, byte, child);
+		}
+		case NODE16: {
+			if (n->count == 16) {
+				change_type<node48>(ref, NODE48);
+				return add_child(ref, byte, child);
+			}
+			auto n16 = static_cast<node16 *>(n);
+			return insert_sorted(n, n16->keys, n16->children, 16, byte,
+					     child);
+		}
+		case NODE48: {
+			if (n->count == 48) {
+				change_type<node256>(ref, NODE256);
+				return add_child(ref, byte, child);
+			}
+			auto n48 = static_cast<node48 *>(n);
+			uint8_t pos = 0;
+			while (!OID_IS_NULL(n48->children[pos]))
+				pos++;
+			transaction::snapshot(n);
+			transaction::snapshot(&n48->index[byte]);
+			transaction::snapshot(&n48->children[pos]);
+			n48->children[pos] = child;
+			n48->index[byte] = static_cast<uint8_t>(pos + 1);
+			n->count++;
+			return;
+		}
+		default: {
+			auto n256 = static_cast<node256 *>(n);
+			transaction::snapshot(n);
+			transaction::snapshot(&n256->children[byte]);
+			n256->children[byte] = child;
+			n->count++;
+		}
+	}
+}
+
+/* removes from sorted keys and children of node4 or node16 */
+static void erase_sorted(node *n, uint8_t *keys, PMEMoid *children, size_t capacity,
+			 uint8_t byte)
+{
+	transaction::snapshot(n);
+	transaction::snapshot(keys, capacity);
+	transaction::snapshot(children, capacity);
+	size_t pos = 0;
+	while (keys[pos] != byte)
+		pos++;
+	for (; pos + 1 < n->count; pos++) {
+		keys[pos] = keys[pos + 1];
+		children[pos] = children[pos + 1];
+	}
+	children[pos] = OID_NULL;
+	n->count--;
+}
+
+/* removes the child of the node in slot ref, which is shrunk if it gets sparse */
+static void remove_child(PMEMoid &ref, uint8_t byte)
+{
+	auto n = as<node>(ref);
+	switch (n->type) {
+		case NODE4: {
+			auto n4 = static_cast<node4 *>(n);
+			return erase_sorted(n, n4->keys, n4->children, 4, byte);
+		}
+		case NODE16: {
+			auto n16 = static_cast<node16 *>(n);
+			erase_sorted(n, n16->keys, n16->children, 16, byte);
+			if (n->count == NODE16_SHRINK)
+				change_type<node4>(ref, NODE4);
+			return;
+		}
+		case NODE48: {
+			auto n48 = static_cast<node48 *>(n);
+			transaction::snapshot(n);
+			transaction::snapshot(&n48->index[byte]);
+			transaction::snapshot(&n48->children[n48->index[byte] - 1]);
+			n48->children[n48->index[byte] - 1] = OID_NULL;
+			n48->index[byte] = 0;
+			n->count--;
+			if (n->count == NODE48_SHRINK)
+				change_type<node16>(ref, NODE16);
+			return;
+		}
+		default: {
+			auto n256 = static_cast<node256 *>(n);
+			transaction::snapshot(n);
+			transaction::snapshot(&n256->children[byte]);
+			n256->children[byte] = OID_NULL;
+			n->count--;
+			if (n->count == NODE256_SHRINK)
+				change_type<node48>(ref, NODE48);
+		}
+	}
+}
+
+/*
+ * Replaces the node in slot ref, whose path starts at depth, with its value if it
+ * has no children, or with its only child if it has no value. The compressed path
+ * of the node and the key byte of the child are prepended to the path of the child.
+ */
+static void compact(PMEMoid &ref, size_t depth)
+{
+	auto n = as<node>(ref);
+	if (n->count > 1 || (n->count == 1 && !OID_IS_NULL(n->value)))
+		return;
+
+	PMEMoid replacement = n->value;
+	if (n->count == 1) {
+		uint8_t byte;
+		replacement = *child_from(n, 0, byte);
+		if (type_of(replacement) != LEAF) {
+			auto child = as<node>(replacement);
+			size_t size = n->prefix_size + 1u + child->prefix_size;
+			transaction::snapshot(child);
+			set_prefix(child, min_leaf(replacement)->key(), depth, size);
+		}
+	}
+	pmemobj_tx_free(ref);
+	transaction::snapshot(&ref);
+	ref = replacement;
+}
+
+/*
+ * Inserts the record into the subtree in slot ref, whose path ends at depth.
+ * Returns false if the key existed and its leaf was replaced.
+ */
+static bool insert(PMEMoid &ref, size_t depth, string_view key, string_view value)
+{
+	PMEMobjpool *pop = pmemobj_pool_by_ptr(&ref);
+	if (OID_IS_NULL(ref)) {
+		transaction::snapshot(&ref);
+		ref = make_leaf(pop, key, value);
+		return true;
+	}
+
+	if (type_of(ref) == LEAF) {
+		string_view existing = as<leaf>(ref)->key();
+		PMEMoid new_leaf = make_leaf(pop, key, value);
+		if (equal(existing, key)) {
+			pmemobj_tx_free(ref);
+			transaction::snapshot(&ref);
+			ref = new_leaf;
+			return false;
+		}
+
+		/* both keys go to a new node, below their common part */
+		size_t end = std::min(existing.size(), key.size());
+		size_t common = depth;
+		while (common < end && byte_at(existing, common) == byte_at(key, common))
+			common++;
+		PMEMoid split = make_node<node4>(pop, NODE4);
+		set_prefix(as<node>(split), key, depth, common - depth);
+		for (auto entry : {std::make_pair(existing, ref),
+				   std::make_pair(key, new_leaf)}) {
+			if (entry.first.size() == common)
+				as<node>(split)->value = entry.second;
+			else
+				add_child(split, byte_at(entry.first, common),
+					  entry.second);
+		}
+		transaction::snapshot(&ref);
+		ref = split;
+		return true;
+	}
+
+	auto n = as<node>(ref);
+	if (n->prefix_size) {
+		size_t common = prefix_mismatch(ref, key, depth);
+		if (common < n->prefix_size) {
+			/* a new node takes the common part of the path */
+			string_view path = min_leaf(ref)->key();
+			PMEMoid split = make_node<node4>(pop, NODE4);
+			set_prefix(as<node>(split), path, depth, common);
+			size_t rest = n->prefix_size - common - 1;
+			transaction::snapshot(n);
+			set_prefix(n, path, depth + common + 1, rest);
+			add_child(split, byte_at(path, depth + common), ref);
+
+			PMEMoid new_leaf = make_leaf(pop, key, value);
+			if (key.size() == depth + common)
+				as<node>(split)->value = new_leaf;
+			else
+				add_child(split, byte_at(key, depth + common), new_leaf);
+			transaction::snapshot(&ref);
+			ref = split;
+			return true;
+		}
+		depth += n->prefix_size;
+	}
+
+	if (depth == key.size())
+		return insert(n->value, depth, key, value);
+
+	PMEMoid *child = find_child(n, byte_at(key, depth));
+	if (child)
+		return insert(*child, depth + 1, key, value);
+
+	add_child(ref, byte_at(key, depth), make_leaf(pop, key, value));
+	return true;
+}
+
+/* leaf of the key, null if there is none */
+static leaf *find(PMEMoid oid, string_view key)
+{
+	size_t depth = 0;
+	while (!OID_IS_NULL(oid)) {
+		if (type_of(oid) == LEAF) {
+			auto l = as<leaf>(oid);
+			return equal(l->key(), key) ? l : nullptr;
+		}
+
+		/* bytes of the path which are not stored are compared in the leaf */
+		auto n = as<node>(oid);
+		if (n->prefix_size) {
+			if (key.size() - depth < n->prefix_size)
+				return nullptr;
+			size_t stored = std::min<size_t>(n->prefix_size, PREFIX_BYTES);
+			if (memcmp(n->prefix, key.data() + depth, stored) != 0)
+				return nullptr;
+			depth += n->prefix_size;
+		}
+
+		if (depth == key.size()) {
+			oid = n->value;
+			continue;
+		}
+		PMEMoid *child = find_child(n, byte_at(key, depth++));
+		if (!child)
+			return nullptr;
+		oid = *child;
+	}
+
+	return nullptr;
+}
+
+/*
+ * Removes the key from the subtree in slot ref, whose path ends at depth.
+ * Returns false if there is no such key.
+ */
+static bool erase(PMEMoid &ref, size_t depth, string_view key)
+{
+	if (type_of(ref) == LEAF) {
+		if (!equal(as<leaf>(ref)->key(), key))
+			return false;
+		pmemobj_tx_free(ref);
+		transaction::snapshot(&ref);
+		ref = OID_NULL;
+		return true;
+	}
+
+	auto n = as<node>(ref);
+	size_t end = depth + n->prefix_size;
+	if (key.size() < end)
+		return false;
+
+	if (end == key.size()) {
+		if (OID_IS_NULL(n->value) || !erase(n->value, end, key))
+			return false;
+	} else {
+		PMEMoid *child = find_child(n, byte_at(key, end));
+		if (!child || !erase(*child, end + 1, key))
+			return false;
+		if (OID_IS_NULL(*child))
+			remove_child(ref, byte_at(key, end));
+	}
+
+	compact(ref, depth);
+	return true;
+}
+
+/*
+ * Calls f for leaves of the subtree at oid, whose path ends at depth, within
+ * the bounds (null if unbounded), in the order of keys. Subtrees entirely out
+ * of the bounds are skipped, so only the paths to the bounds are compared.
+ * Returns false if f stopped the walk.
+ */
+template <typename F>
+static bool walk(PMEMoid oid, size_t depth, const bound *lo, const bound *hi, F &f)
+{
+	if (type_of(oid) == LEAF) {
+		auto l = as<leaf>(oid);
+		if (lo) {
+			int c = compare(l->key(), lo->key);
+			if (c < 0 || (c == 0 && !lo->inclusive))
+				return true;
+		}
+		if (hi) {
+			int c = compare(l->key(), hi->key);
+			if (c > 0 || (c == 0 && !hi->inclusive))
+				return true;
+		}
+		return f(l);
+	}
+
+	/* keys of the subtree start with the path, bounds may continue past it */
+	auto n = as<node>(oid);
+	size_t end = depth + n->prefix_size;
+	bool lo_past = false, hi_past = false;
+	if (lo || hi) {
+		string_view path(min_leaf(oid)->key().data(), end);
+		if (lo) {
+			int c = compare(path, string_view(lo->key.data(),
+							  std::min(end, lo->key.size())));
+			if (c < 0)
+				return true;
+			if (c > 0 || lo->key.size() < end)
+				lo = nullptr;
+			else
+				lo_past = lo->key.size() > end;
+		}
+		if (hi) {
+			int c = compare(path, string_view(hi->key.data(),
+							  std::min(end, hi->key.size())));
+			if (c > 0 || (c == 0 && hi->key.size() < end))
+				return true;
+			if (c < 0)
+				hi = nullptr;
+			else
+				hi_past = hi->key.size() > end;
+		}
+	}
+
+	/* the key ending at this node precedes the keys of its children */
+	if (!OID_IS_NULL(n->value)) {
+		bool in = !lo || (!lo_past && lo->inclusive);
+		if (hi && !hi_past)
+			in = in && hi->inclusive;
+		if (in && !f(as<leaf>(n->value)))
+			return false;
+	}
+	if (hi && !hi_past)
+		return true;
+	if (lo && !lo_past)
+		lo = nullptr;
+
+	unsigned from = lo ? byte_at(lo->key, end) : 0;
+	uint8_t byte;
+	for (; auto child = child_from(n, from, byte); from = byte + 1u) {
+		const bound *child_lo =
+			lo && byte == byte_at(lo->key, end) ? lo : nullptr;
+		const bound *child_hi = nullptr;
+		if (hi) {
+			if (byte > byte_at(hi->key, end))
+				break;
+			if (byte == byte_at(hi->key, end))
+				child_hi = hi;
+		}
+		if (!walk(*child, end + 1, child_lo, child_hi, f))
+			return false;
+	}
+
+	return true;
+}
+
+struct tree_metrics {
+	uint64_t nodes[NODE256 + 1] = {};
+	uint64_t depth = 0;
+};
+
+static void collect_metrics(PMEMoid oid, uint64_t depth, tree_metrics &m)
+{
+	if (type_of(oid) == LEAF) {
+		m.depth = std::max(m.depth, depth);
+		return;
+	}
+
+	auto n = as<node>(oid);
+	m.nodes[n->type]++;
+	if (!OID_IS_NULL(n->value))
+		collect_metrics(n->value, depth + 1, m);
+	uint8_t byte;
+	for (unsigned from = 0; auto child = child_from(n, from, byte);
+	     from = byte + 1u)
+		collect_metrics(*child, depth + 1, m);
+}
+
+} /* namespace radix */
+} /* namespace internal */
+
+using internal::radix::bound;
+
+radix::radix(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg)
+{
+	reject_read_only();
+	init_allocator(*cfg, {sizeof(internal::radix::node4),
+			      sizeof(internal::radix::node16),
+			      sizeof(internal::radix::node48),
+			      sizeof(internal::radix::node256)});
+	if (OID_IS_NULL(*root_oid)) {
+		transaction::run(pmpool, [&] {
+			transaction::snapshot(root_oid);
+			*root_oid = pmemobj_tx_xalloc(sizeof(internal::radix::header), 0,
+						      POBJ_XALLOC_ZERO);
+			if (OID_IS_NULL(*root_oid))
+				throw pmem::transaction_alloc_error(
+					"Failed to allocate radix header");
+		});
+	}
+	tree = static_cast<internal::radix::header *>(pmemobj_direct(*root_oid));
+
+	LOG("Started ok");
+}
+
+radix::~radix()
+{
+	LOG("Stopped ok");
+}
+
+std::string radix::name()
+{
+	return "radix";
+}
+
+std::size_t radix::count_range(const bound *lo, const bound *hi)
+{
+	std::size_t cnt = 0;
+	auto count = [&](internal::radix::leaf *) {
+		cnt++;
+		return true;
+	};
+	if (!OID_IS_NULL(tree->root))
+		internal::radix::walk(tree->root, 0, lo, hi, count);
+
+	return cnt;
+}
+
+status radix::get_range(const bound *lo, const bound *hi, get_kv_callback *callback,
+			void *arg)
+{
+	auto call = [&](internal::radix::leaf *l) {
+		auto k = l->key();
+		auto v = l->value();
+		return callback(k.data(), k.size(), v.data(), v.size(), arg) == 0;
+	};
+	if (!OID_IS_NULL(tree->root) &&
+	    !internal::radix::walk(tree->root, 0, lo, hi, call))
+		return status::STOPPED_BY_CB;
+
+	return status::OK;
+}
+
+/*
+ * Sets 'successor' to the lowest key greater than all keys starting with the
+ * prefix. Returns false if there is no such key (the prefix is empty or
+ * consists of 0xff bytes only).
+ */
+static bool prefix_successor(string_view prefix, std::string &successor)
+{
+	successor.assign(prefix.data(), prefix.size());
+	while (!successor.empty() && static_cast<unsigned char>(successor.back()) == 0xff)
+		successor.pop_back();
+	if (successor.empty())
+		return false;
+
+	successor.back() =
+		static_cast<char>(static_cast<unsigned char>(successor.back()) + 1);
+	return true;
+}
+
+status radix::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	check_outside_tx();
+	cnt = tree->size;
+
+	return status::OK;
+}
+
+status radix::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound lo{key, false};
+	cnt = count_range(&lo, nullptr);
+
+	return status::OK;
+}
+
+status radix::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound lo{key, true};
+	cnt = count_range(&lo, nullptr);
+
+	return status::OK;
+}
+
+status radix::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound hi{key, true};
+	cnt = count_range(nullptr, &hi);
+
+	return status::OK;
+}
+
+status radix::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound hi{key, false};
+	cnt = count_range(nullptr, &hi);
+
+	return status::OK;
+}
+
+status radix::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+	cnt = 0;
+	if (internal::radix::compare(key1, key2) < 0) {
+		bound lo{key1, false}, hi{key2, false};
+		cnt = count_range(&lo, &hi);
+	}
+
+	return status::OK;
+}
+
+status radix::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	LOG("count_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	std::string successor;
+	bool bounded = prefix_successor(prefix, successor);
+	bound lo{prefix, true}, hi{successor, false};
+	cnt = count_range(&lo, bounded ? &hi : nullptr);
+
+	return status::OK;
+}
+
+status radix::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	check_outside_tx();
+
+	return get_range(nullptr, nullptr, callback, arg);
+}
+
+status radix::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound lo{key, false};
+
+	return get_range(&lo, nullptr, callback, arg);
+}
+
+status radix::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound lo{key, true};
+
+	return get_range(&lo, nullptr, callback, arg);
+}
+
+status radix::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound hi{key, true};
+
+	return get_range(nullptr, &hi, callback, arg);
+}
+
+status radix::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	bound hi{key, false};
+
+	return get_range(nullptr, &hi, callback, arg);
+}
+
+status radix::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			  void *arg)
+{
+	LOG("get_between for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+	if (internal::radix::compare(key1, key2) >= 0)
+		return status::OK;
+
+	bound lo{key1, false}, hi{key2, false};
+	return get_range(&lo, &hi, callback, arg);
+}
+
+status radix::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	std::string successor;
+	bool bounded = prefix_successor(prefix, successor);
+	bound lo{prefix, true}, hi{successor, false};
+
+	return get_range(&lo, bounded ? &hi : nullptr, callback, arg);
+}
+
+status radix::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	return internal::radix::find(tree->root, key) ? status::OK : status::NOT_FOUND;
+}
+
+status radix::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	auto l = internal::radix::find(tree->root, key);
+	if (!l) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	auto value = l->value();
+	callback(value.data(), value.size(), arg);
+	return status::OK;
+}
+
+/* has to be called within a transaction */
+void radix::do_put(string_view key, string_view value)
+{
+	if (internal::radix::insert(tree->root, 0, key, value)) {
+		transaction::snapshot(&tree->size);
+		tree->size++;
+	}
+}
+
+/* has to be called within a transaction */
+bool radix::do_remove(string_view key)
+{
+	if (OID_IS_NULL(tree->root) || !internal::radix::erase(tree->root, 0, key))
+		return false;
+
+	transaction::snapshot(&tree->size);
+	tree->size--;
+	return true;
+}
+
+status radix::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+	transaction::run(pmpool, [&] { do_put(key, value); });
+
+	return status::OK;
+}
+
+status radix::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	/* a missing key does not start a transaction */
+	if (!internal::radix::find(tree->root, key))
+		return status::NOT_FOUND;
+	transaction::run(pmpool, [&] { do_remove(key); });
+
+	return status::OK;
+}
+
+status radix::remove_range(string_view key1, string_view key2)
+{
+	LOG("remove_range for key1=" << key1.data() << ", key2=" << key2.data());
+	check_outside_tx();
+	if (internal::radix::compare(key1, key2) >= 0)
+		return status::OK;
+
+	/* leaves are not moved by removes of other keys, so their keys stay valid */
+	std::vector<string_view> keys;
+	auto collect = [&](internal::radix::leaf *l) {
+		keys.push_back(l->key());
+		return true;
+	};
+	bound lo{key1, true}, hi{key2, false};
+	if (!OID_IS_NULL(tree->root))
+		internal::radix::walk(tree->root, 0, &lo, &hi, collect);
+	if (keys.empty())
+		return status::OK;
+
+	transaction::run(pmpool, [&] {
+		for (auto &key : keys)
+			do_remove(key);
+	});
+
+	return status::OK;
+}
+
+status radix::write(internal::write_batch &batch)
+{
+	LOG("write batch of " << batch.size() << " operations");
+	check_outside_tx();
+
+	transaction::run(pmpool, [&] {
+		for (auto &op : batch.operations()) {
+			if (op.type == internal::write_batch::op_type::PUT)
+				do_put(op.key, op.value);
+			else
+				do_remove(op.key);
+		}
+	});
+
+	return status::OK;
+}
+
+void radix::metrics(internal::engine_metrics &metrics)
+{
+	internal::radix::tree_metrics m;
+	if (!OID_IS_NULL(tree->root))
+		internal::radix::collect_metrics(tree->root, 0, m);
+
+	metrics.add("node4", m.nodes[internal::radix::NODE4]);
+	metrics.add("node16", m.nodes[internal::radix::NODE16]);
+	metrics.add("node48", m.nodes[internal::radix::NODE48]);
+	metrics.add("node256", m.nodes[internal::radix::NODE256]);
+	metrics.add("depth", m.depth);
+}
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../pmemobj_engine.h"
+
+#include <cstdint>
+#include <libpmemobj++/transaction.hpp>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace radix
+{
+
+/*
+ * Kinds of persistent objects of the tree, kept in their first byte. Children of
+ * inner nodes are PMEMoids, which may point to a leaf or to an inner node.
+ */
+enum kind : uint8_t { LEAF = 1, NODE4 = 2, NODE16 = 3, NODE48 = 4, NODE256 = 5 };
+
+/* bytes of the compressed path stored in an inner node */
+static const size_t PREFIX_BYTES = 8;
+
+/*
+ * Record of the tree: sizes of the key and of the value, followed by the key and
+ * the value, in a single allocation. A leaf is never modified, a put of an
+ * existing key replaces it.
+ */
+struct leaf {
+	uint8_t type;
+	uint64_t key_size;
+	uint64_t value_size;
+
+	string_view key() const
+	{
+		return string_view(reinterpret_cast<const char *>(this + 1), key_size);
+	}
+
+	string_view value() const
+	{
+		return string_view(reinterpret_cast<const char *>(this + 1) + key_size,
+				   value_size);
+	}
+};
+
+/*
+ * Header of inner nodes. All keys below a node share the bytes of the path to
+ * it, followed by prefix_size bytes of its compressed path, of which only the
+ * first PREFIX_BYTES are kept in the node. Lookups skip the rest and compare the
+ * whole key with the leaf they reach, writers read it from any leaf below the
+ * node. A key which ends at the node is kept in value, outside of the children.
+ */
+struct node {
+	uint8_t type;
+	uint8_t unused;
+	uint16_t count; /* number of children */
+	uint32_t prefix_size;
+	uint8_t prefix[PREFIX_BYTES];
+	PMEMoid value;
+};
+
+/* up to 4 children, with key bytes kept sorted */
+struct node4 : node {
+	uint8_t keys[4];
+	PMEMoid children[4];
+};
+
+/* up to 16 children, with key bytes kept sorted */
+struct node16 : node {
+	uint8_t keys[16];
+	PMEMoid children[16];
+};
+
+/* up to 48 children, index holds (1 + position of the child) for each key byte */
+struct node48 : node {
+	uint8_t index[256];
+	PMEMoid children[48];
+};
+
+/* a child for each key byte */
+struct node256 : node {
+	PMEMoid children[256];
+};
+
+/* root object of the engine */
+struct header {
+	PMEMoid root;
+	uint64_t size;
+};
+
+/* a bound of a range of keys, inclusive or not */
+struct bound {
+	string_view key;
+	bool inclusive;
+};
+
+} /* namespace radix */
+} /* namespace internal */
+
+/*
+ * Persistent adaptive radix tree: inner nodes of four sizes, chosen by the number
+ * of their children, with compressed paths. All nodes and leaves are persistent,
+ * every change is made in a single transaction.
+ */
+class radix : public pmemobj_engine_base<internal::radix::header> {
+public:
+	radix(std::unique_ptr<internal::config> cfg);
+	~radix();
+
+	radix(const radix &) = delete;
+	radix &operator=(const radix &) = delete;
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+
+	status remove(string_view key) final;
+	status remove_range(string_view key1, string_view key2) final;
+
+	status write(internal::write_batch &batch) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
+private:
+	std::size_t count_range(const internal::radix::bound *lo,
+				const internal::radix::bound *hi);
+	status get_range(const internal::radix::bound *lo,
+			 const internal::radix::bound *hi, get_kv_callback *callback,
+			 void *arg);
+
+	void do_put(string_view key, string_view value);
+	bool do_remove(string_view key);
+
+	internal::radix::header *tree;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
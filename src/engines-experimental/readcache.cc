@@ -0,0 +1,596 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "readcache.h"
+#include "../out.h"
+
+#include <functional>
+#include <iostream>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace readcache
+{
+
+const uint64_t DEFAULT_MAX_BYTES = 64ull << 20;
+const uint64_t DEFAULT_SHARDS = 64;
+
+shard::shard(std::size_t max_bytes)
+    : max_bytes(max_bytes), bytes(0), hand(0), version(0), hits(0), misses(0)
+{
+}
+
+shard::value_ptr shard::lookup(const std::string &key, uint64_t &version)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto it = index.find(key);
+	if (it == index.end()) {
+		misses++;
+		version = this->version;
+		return nullptr;
+	}
+
+	hits++;
+	auto &e = entries[it->second];
+	e.referenced = true;
+	return e.value;
+}
+
+void shard::insert(const std::string &key, string_view value, uint64_t version)
+{
+	auto entry_bytes = key.size() + value.size();
+	if (entry_bytes > max_bytes)
+		return;
+
+	/* copy the value before taking the lock */
+	value_ptr copy = std::make_shared<const std::string>(value.data(), value.size());
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	/* the key was changed, or another thread cached it, since the lookup */
+	if (version != this->version || index.find(key) != index.end())
+		return;
+
+	while (bytes + entry_bytes > max_bytes)
+		evict();
+
+	auto it = index.emplace(key, entries.size()).first;
+	entries.push_back({&it->first, std::move(copy), false});
+	bytes += entry_bytes;
+}
+
+void shard::invalidate(const std::string &key)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	version++;
+	auto it = index.find(key);
+	if (it != index.end())
+		erase_at(it->second);
+}
+
+void shard::clear()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	version++;
+	entries.clear();
+	index.clear();
+	bytes = 0;
+	hand = 0;
+}
+
+void shard::metrics(uint64_t &entries, uint64_t &bytes, uint64_t &hits,
+		    uint64_t &misses)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	entries += this->entries.size();
+	bytes += this->bytes;
+	hits += this->hits;
+	misses += this->misses;
+}
+
+void shard::evict()
+{
+	/* give a second chance to keys used since the hand passed them */
+	for (;;) {
+		if (hand >= entries.size())
+			hand = 0;
+
+		auto &e = entries[hand];
+		if (!e.referenced)
+			break;
+
+		e.referenced = false;
+		hand++;
+	}
+
+	erase_at(hand);
+}
+
+void shard::erase_at(std::size_t pos)
+{
+	bytes -= entries[pos].key->size() + entries[pos].value->size();
+	/* the key is owned by the erased element, do not erase by key */
+	index.erase(index.find(*entries[pos].key));
+
+	if (pos != entries.size() - 1) {
+		entries[pos] = std::move(entries.back());
+		index[*entries[pos].key] = pos;
+	}
+	entries.pop_back();
+}
+
+/* keeps the cached value alive for as long as it is referenced */
+class cached_value_pin : public value_ref::pin {
+public:
+	void release() final
+	{
+		value.reset();
+	}
+
+	shard::value_ptr value;
+};
+
+} /* namespace readcache */
+} /* namespace internal */
+
+readcache::readcache(std::unique_ptr<internal::config> cfg)
+{
+	const char *sub_name;
+	if (!cfg->get_string("subengine", &sub_name))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"subengine\"");
+	std::string sub_engine_name(sub_name);
+
+	uint64_t max_bytes = internal::readcache::DEFAULT_MAX_BYTES;
+	cfg->get_uint64("max_bytes", &max_bytes);
+
+	uint64_t nshards = internal::readcache::DEFAULT_SHARDS;
+	cfg->get_uint64("shards", &nshards);
+	if (nshards == 0)
+		throw internal::invalid_argument(
+			"Config item \"shards\" has to be greater than 0");
+
+	internal::config *sub_cfg;
+	if (!cfg->get_object("subengine_config", (void **)&sub_cfg))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"subengine_config\"");
+
+	/* Remove item to pass ownership of it to subengine */
+	cfg->remove("subengine_config");
+
+	sub_engine = engine_base::create_engine(
+		sub_engine_name, std::unique_ptr<internal::config>(sub_cfg));
+
+	auto shard_bytes = static_cast<std::size_t>(max_bytes / nshards);
+	shards.reserve(static_cast<std::size_t>(nshards));
+	for (uint64_t i = 0; i < nshards; i++)
+		shards.emplace_back(new internal::readcache::shard(shard_bytes));
+
+	LOG("Started ok");
+}
+
+readcache::~readcache()
+{
+	LOG("Stopped ok");
+}
+
+std::string readcache::name()
+{
+	return "readcache";
+}
+
+internal::readcache::shard &readcache::shard_for(const std::string &key)
+{
+	return *shards[std::hash<std::string>()(key) % shards.size()];
+}
+
+void readcache::invalidate(string_view key)
+{
+	std::string k(key.data(), key.size());
+	shard_for(k).invalidate(k);
+}
+
+void readcache::invalidate_all()
+{
+	for (auto &s : shards)
+		s->clear();
+}
+
+status readcache::count_all(std::size_t &cnt)
+{
+	return sub_engine->count_all(cnt);
+}
+
+status readcache::count_above(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_above(key, cnt);
+}
+
+status readcache::count_equal_above(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_equal_above(key, cnt);
+}
+
+status readcache::count_equal_below(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_equal_below(key, cnt);
+}
+
+status readcache::count_below(string_view key, std::size_t &cnt)
+{
+	return sub_engine->count_below(key, cnt);
+}
+
+status readcache::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	return sub_engine->count_between(key1, key2, cnt);
+}
+
+status readcache::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	return sub_engine->count_prefix(prefix, cnt);
+}
+
+status readcache::get_all(get_kv_callback *callback, void *arg)
+{
+	return sub_engine->get_all(callback, arg);
+}
+
+status readcache::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	return sub_engine->get_above(key, callback, arg);
+}
+
+status readcache::get_equal_above(string_view key, get_kv_callback *callback,
+				  void *arg)
+{
+	return sub_engine->get_equal_above(key, callback, arg);
+}
+
+status readcache::get_equal_below(string_view key, get_kv_callback *callback,
+				  void *arg)
+{
+	return sub_engine->get_equal_below(key, callback, arg);
+}
+
+status readcache::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	return sub_engine->get_below(key, callback, arg);
+}
+
+status readcache::get_between(string_view key1, string_view key2,
+			      get_kv_callback *callback, void *arg)
+{
+	return sub_engine->get_between(key1, key2, callback, arg);
+}
+
+status readcache::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	return sub_engine->get_prefix(prefix, callback, arg);
+}
+
+status readcache::scan(string_view prefix, size_t limit, size_t batch_size,
+		       scan_callback *callback, void *arg)
+{
+	return sub_engine->scan(prefix, limit, batch_size, callback, arg);
+}
+
+status readcache::get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				   void *arg)
+{
+	return sub_engine->get_all_parallel(nthreads, callback, arg);
+}
+
+status readcache::get_between_parallel(string_view key1, string_view key2,
+				       size_t nthreads,
+				       get_kv_parallel_callback *callback, void *arg)
+{
+	return sub_engine->get_between_parallel(key1, key2, nthreads, callback, arg);
+}
+
+std::pair<string_view, string_view> readcache::upper_bound(string_view key)
+{
+	return sub_engine->upper_bound(key);
+}
+
+std::pair<string_view, string_view> readcache::lower_bound(string_view key)
+{
+	return sub_engine->lower_bound(key);
+}
+
+std::pair<string_view, string_view> readcache::get_begin()
+{
+	return sub_engine->get_begin();
+}
+
+std::pair<string_view, string_view> readcache::get_next(string_view key)
+{
+	return sub_engine->get_next(key);
+}
+
+std::pair<string_view, string_view> readcache::get_prev(string_view key)
+{
+	return sub_engine->get_prev(key);
+}
+
+int readcache::get_size_new()
+{
+	return sub_engine->get_size_new();
+}
+
+internal::iterator_base *readcache::new_iterator()
+{
+	return sub_engine->new_iterator();
+}
+
+/* reads of a snapshot bypass the cache */
+internal::snapshot_base *readcache::new_snapshot()
+{
+	return sub_engine->new_snapshot();
+}
+
+status readcache::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	std::string k(key.data(), key.size());
+	uint64_t version;
+	if (shard_for(k).lookup(k, version))
+		return status::OK;
+
+	return sub_engine->exists(key);
+}
+
+/* value read from the sub engine, which is cached before passing it on */
+struct fill_context {
+	internal::readcache::shard *shard;
+	const std::string *key;
+	uint64_t version;
+	get_v_callback *callback;
+	void *arg;
+};
+
+static void fill_callback(const char *value, size_t valuebytes, void *arg)
+{
+	auto c = static_cast<fill_context *>(arg);
+	c->shard->insert(*c->key, string_view(value, valuebytes), c->version);
+	c->callback(value, valuebytes, c->arg);
+}
+
+status readcache::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	std::string k(key.data(), key.size());
+	auto &s = shard_for(k);
+	uint64_t version;
+	auto value = s.lookup(k, version);
+	if (value) {
+		callback(value->data(), value->size(), arg);
+		return status::OK;
+	}
+
+	fill_context ctx{&s, &k, version, callback, arg};
+	return sub_engine->get(key, fill_callback, &ctx);
+}
+
+struct fill_many_context {
+	struct miss {
+		size_t index;
+		std::string key;
+		internal::readcache::shard *shard;
+		uint64_t version;
+	};
+
+	std::vector<miss> misses;
+	get_many_v_callback *callback;
+	void *arg;
+};
+
+static void fill_many_callback(size_t index, int s, const char *value,
+			       size_t valuebytes, void *arg)
+{
+	auto c = static_cast<fill_many_context *>(arg);
+	auto &m = c->misses[index];
+	if (s == static_cast<int>(status::OK))
+		m.shard->insert(m.key, string_view(value, valuebytes), m.version);
+	c->callback(m.index, s, value, valuebytes, c->arg);
+}
+
+/* keys missed in the cache are read with a single get_many of the sub engine */
+status readcache::get_many(size_t count, const string_view *keys,
+			   get_many_v_callback *callback, void *arg)
+{
+	LOG("get_many count=" << count);
+	fill_many_context ctx;
+	ctx.callback = callback;
+	ctx.arg = arg;
+	std::vector<string_view> missed;
+
+	for (size_t i = 0; i < count; ++i) {
+		std::string k(keys[i].data(), keys[i].size());
+		auto &s = shard_for(k);
+		uint64_t version;
+		auto value = s.lookup(k, version);
+		if (value) {
+			callback(i, static_cast<int>(status::OK), value->data(),
+				 value->size(), arg);
+			continue;
+		}
+
+		ctx.misses.push_back({i, std::move(k), &s, version});
+		missed.push_back(keys[i]);
+	}
+
+	if (missed.empty())
+		return status::OK;
+
+	return sub_engine->get_many(missed.size(), missed.data(), fill_many_callback,
+				    &ctx);
+}
+
+status readcache::get_ref(string_view key, internal::value_ref &ref)
+{
+	LOG("get_ref key=" << std::string(key.data(), key.size()));
+	std::string k(key.data(), key.size());
+	auto &s = shard_for(k);
+	uint64_t version;
+	auto value = s.lookup(k, version);
+	if (value) {
+		auto &pin = ref.reset_pin<internal::readcache::cached_value_pin>();
+		pin.value = std::move(value);
+		ref.set(string_view(pin.value->data(), pin.value->size()));
+		return status::OK;
+	}
+
+	auto st = sub_engine->get_ref(key, ref);
+	if (st == status::OK)
+		s.insert(k, ref.value(), version);
+
+	return st;
+}
+
+status readcache::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	auto s = sub_engine->put(key, value);
+	invalidate(key);
+
+	return s;
+}
+
+status readcache::get_or_insert(string_view key, string_view value,
+				get_v_callback *callback, void *arg, bool &inserted)
+{
+	LOG("get_or_insert key=" << std::string(key.data(), key.size()));
+	auto s = sub_engine->get_or_insert(key, value, callback, arg, inserted);
+	invalidate(key);
+
+	return s;
+}
+
+status readcache::update(string_view key, update_callback *callback, void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	auto s = sub_engine->update(key, callback, arg);
+	invalidate(key);
+
+	return s;
+}
+
+status readcache::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	auto s = sub_engine->remove(key);
+	invalidate(key);
+
+	return s;
+}
+
+status readcache::remove_range(string_view key1, string_view key2)
+{
+	LOG("remove_range");
+	auto s = sub_engine->remove_range(key1, key2);
+	invalidate_all();
+
+	return s;
+}
+
+status readcache::write(internal::write_batch &batch)
+{
+	LOG("write batch of " << batch.size() << " operations");
+	/* a batch may be applied partially, if writing it failed */
+	auto invalidate_batch = [&] {
+		for (auto &op : batch.operations())
+			invalidate(op.key);
+	};
+
+	status s;
+	try {
+		s = sub_engine->write(batch);
+	} catch (...) {
+		invalidate_batch();
+		throw;
+	}
+	invalidate_batch();
+
+	return s;
+}
+
+status readcache::bulk_load(bulk_load_callback *callback, void *arg)
+{
+	LOG("bulk_load");
+	status s;
+	try {
+		s = sub_engine->bulk_load(callback, arg);
+	} catch (...) {
+		invalidate_all();
+		throw;
+	}
+	invalidate_all();
+
+	return s;
+}
+
+status readcache::defrag(double start_percent, double amount_percent)
+{
+	return sub_engine->defrag(start_percent, amount_percent);
+}
+
+status readcache::changes_since(uint64_t seq, change_callback *callback, void *arg)
+{
+	return sub_engine->changes_since(seq, callback, arg);
+}
+
+void readcache::metrics(internal::engine_metrics &metrics)
+{
+	sub_engine->metrics(metrics);
+
+	uint64_t entries = 0, bytes = 0, hits = 0, misses = 0;
+	for (auto &s : shards)
+		s->metrics(entries, bytes, hits, misses);
+
+	metrics.add("cache_entries", entries);
+	metrics.add("cache_bytes", bytes);
+	metrics.add("cache_hits", hits);
+	metrics.add("cache_misses", misses);
+}
+
+} /* namespace kv */
+} /* namespace pmem */
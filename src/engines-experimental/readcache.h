@@ -0,0 +1,185 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../engine.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace readcache
+{
+
+/*
+ * Part of the cache with its own lock, which holds copies of values of keys
+ * hashed to it. Keys are evicted with CLOCK approximation of LRU, so that the
+ * sizes of cached keys and values do not exceed max_bytes.
+ *
+ * Every invalidation bumps the version of the shard. A value read from the sub
+ * engine is inserted only if the version did not change since the lookup which
+ * missed it, so a value overwritten in the meantime is never cached.
+ */
+class shard {
+public:
+	typedef std::shared_ptr<const std::string> value_ptr;
+
+	shard(std::size_t max_bytes);
+
+	shard(const shard &) = delete;
+	shard &operator=(const shard &) = delete;
+
+	/*
+	 * Returns the cached value and marks the key as recently used. On a miss
+	 * returns nullptr and sets version to be passed to insert().
+	 */
+	value_ptr lookup(const std::string &key, uint64_t &version);
+	void insert(const std::string &key, string_view value, uint64_t version);
+	void invalidate(const std::string &key);
+	void clear();
+
+	void metrics(uint64_t &entries, uint64_t &bytes, uint64_t &hits,
+		     uint64_t &misses);
+
+private:
+	struct entry {
+		/* points to the key of the index element */
+		const std::string *key;
+		value_ptr value;
+		bool referenced;
+	};
+
+	void evict();
+	void erase_at(std::size_t pos);
+
+	std::mutex mtx;
+	std::size_t max_bytes;
+	std::size_t bytes;
+	std::size_t hand;
+	uint64_t version;
+	uint64_t hits;
+	uint64_t misses;
+	std::vector<entry> entries;
+	std::unordered_map<std::string, std::size_t> index;
+};
+
+} /* namespace readcache */
+} /* namespace internal */
+
+/*
+ * Read-through DRAM cache in front of another engine. Gets fill the cache from
+ * the sub engine, puts and removes write to the sub engine and invalidate the
+ * cached keys. All other operations are passed to the sub engine unchanged,
+ * which also determines which of them are thread-safe.
+ */
+class readcache : public engine_base {
+public:
+	readcache(std::unique_ptr<internal::config> cfg);
+	~readcache();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
+
+	status scan(string_view prefix, size_t limit, size_t batch_size,
+		    scan_callback *callback, void *arg) final;
+	status get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2, size_t nthreads,
+				    get_kv_parallel_callback *callback, void *arg) final;
+
+	std::pair<string_view, string_view> upper_bound(string_view key) final;
+	std::pair<string_view, string_view> lower_bound(string_view key) final;
+	std::pair<string_view, string_view> get_begin() final;
+	std::pair<string_view, string_view> get_next(string_view key) final;
+	std::pair<string_view, string_view> get_prev(string_view key) final;
+	int get_size_new() final;
+	internal::iterator_base *new_iterator() final;
+	internal::snapshot_base *new_snapshot() final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_many(size_t count, const string_view *keys,
+			get_many_v_callback *callback, void *arg) final;
+	status get_ref(string_view key, internal::value_ref &ref) final;
+
+	status put(string_view key, string_view value) final;
+	status get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			     void *arg, bool &inserted) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+	status remove(string_view key) final;
+	status remove_range(string_view key1, string_view key2) final;
+	status write(internal::write_batch &batch) final;
+	status bulk_load(bulk_load_callback *callback, void *arg) final;
+	status defrag(double start_percent, double amount_percent) final;
+	status changes_since(uint64_t seq, change_callback *callback, void *arg) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
+private:
+	internal::readcache::shard &shard_for(const std::string &key);
+	void invalidate(string_view key);
+	void invalidate_all();
+
+	std::unique_ptr<engine_base> sub_engine;
+	std::vector<std::unique_ptr<internal::readcache::shard>> shards;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,574 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "sharded.h"
+#include "../exceptions.h"
+#include "../out.h"
+#include "../write_batch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace sharded
+{
+
+/* reads CPUs of the NUMA node from sysfs, e.g. "0-3,8-11" */
+static cpu_set_t node_cpus(int node)
+{
+	std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+			   "/cpulist");
+	std::string list;
+	if (node < 0 || !std::getline(file, list))
+		throw internal::invalid_argument("Cannot read CPUs of NUMA node " +
+						 std::to_string(node));
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (auto &range : split_list(list)) {
+		auto dash = range.find('-');
+		int first = std::stoi(range.substr(0, dash));
+		int last = dash == std::string::npos ? first
+						     : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(static_cast<size_t>(cpu), &cpus);
+	}
+	if (CPU_COUNT(&cpus) == 0)
+		throw internal::invalid_argument("NUMA node " + std::to_string(node) +
+						 " has no CPUs");
+
+	return cpus;
+}
+
+worker::worker(int node) : busy(false), stopped(false)
+{
+	cpu_set_t cpus = node_cpus(node);
+	thread = std::thread([this, cpus] { run(cpus); });
+}
+
+worker::~worker()
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		stopped = true;
+	}
+	cv.notify_all();
+	thread.join();
+}
+
+void worker::post(std::function<void()> t)
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		task = std::move(t);
+		busy = true;
+	}
+	cv.notify_all();
+}
+
+void worker::wait()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&] { return !busy; });
+	if (error) {
+		auto e = error;
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+void worker::run(cpu_set_t cpus)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+		error = std::make_exception_ptr(internal::error(
+			"Binding a worker thread to its NUMA node failed"));
+
+	while (true) {
+		cv.wait(lock, [&] { return busy || stopped; });
+		if (!busy)
+			return;
+
+		auto t = std::move(task);
+		lock.unlock();
+		std::exception_ptr e;
+		try {
+			t();
+		} catch (...) {
+			e = std::current_exception();
+		}
+		lock.lock();
+		if (e && !error)
+			error = e;
+		busy = false;
+		cv.notify_all();
+	}
+}
+
+std::vector<std::string> split_list(const std::string &list)
+{
+	std::vector<std::string> items;
+	size_t begin = 0;
+	while (begin <= list.size()) {
+		size_t end = std::min(list.find(',', begin), list.size());
+		if (end > begin)
+			items.push_back(list.substr(begin, end - begin));
+		begin = end + 1;
+	}
+
+	return items;
+}
+
+uint64_t key_hash(string_view key)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < key.size(); i++) {
+		hash ^= static_cast<uint8_t>(key.data()[i]);
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+} /* namespace sharded */
+} /* namespace internal */
+
+sharded::sharded(std::unique_ptr<internal::config> cfg)
+{
+	const char *sub_name;
+	if (!cfg->get_string("subengine", &sub_name))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"subengine\"");
+	std::string sub_engine_name(sub_name);
+
+	const char *paths_str;
+	if (!cfg->get_string("paths", &paths_str))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"paths\"");
+	auto paths = internal::sharded::split_list(paths_str);
+	if (paths.empty())
+		throw internal::invalid_argument("Config item \"paths\" is empty");
+
+	const char *nodes_str;
+	if (cfg->get_string("numa_nodes", &nodes_str)) {
+		auto nodes = internal::sharded::split_list(nodes_str);
+		if (nodes.size() != paths.size())
+			throw internal::invalid_argument(
+				"Config item \"numa_nodes\" has to list one node "
+				"per path");
+		for (auto &node : nodes) {
+			int n;
+			try {
+				n = std::stoi(node);
+			} catch (std::exception &) {
+				throw internal::invalid_argument("Invalid NUMA node: " +
+								 node);
+			}
+			workers.emplace_back(new internal::sharded::worker(n));
+		}
+	}
+
+	const char *boundaries_str;
+	if (cfg->get_string("boundaries", &boundaries_str)) {
+		boundaries = internal::sharded::split_list(boundaries_str);
+		if (boundaries.size() + 1 != paths.size())
+			throw internal::invalid_argument(
+				"Config item \"boundaries\" has to list one key less "
+				"than \"paths\"");
+		for (size_t i = 1; i < boundaries.size(); i++)
+			if (!(boundaries[i - 1] < boundaries[i]))
+				throw internal::invalid_argument(
+					"Config item \"boundaries\" has to be sorted");
+	}
+
+	/* items passed to every sub engine, along with its path */
+	uint64_t size = 0, force_create = 0, growth_granularity = 0;
+	bool has_size = cfg->get_uint64("size", &size);
+	bool has_force_create = cfg->get_uint64("force_create", &force_create);
+	bool has_growth_granularity =
+		cfg->get_uint64("growth_granularity", &growth_granularity);
+
+	shards.resize(paths.size());
+	auto open = [&](size_t i) {
+		std::unique_ptr<internal::config> sub_cfg(new internal::config);
+		sub_cfg->put_string("path", paths[i].c_str());
+		if (has_size)
+			sub_cfg->put_uint64("size", size);
+		if (has_force_create)
+			sub_cfg->put_uint64("force_create", force_create);
+		if (has_growth_granularity)
+			sub_cfg->put_uint64("growth_granularity", growth_granularity);
+		shards[i] = engine_base::create_engine(sub_engine_name,
+						       std::move(sub_cfg));
+	};
+
+	if (workers.empty()) {
+		for (size_t i = 0; i < shards.size(); i++)
+			open(i);
+	} else {
+		/* pools are opened (and recovered) in parallel, each on its node */
+		for (size_t i = 0; i < shards.size(); i++)
+			workers[i]->post([&open, i] { open(i); });
+		std::exception_ptr error;
+		for (auto &w : workers) {
+			try {
+				w->wait();
+			} catch (...) {
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	LOG("Started ok");
+}
+
+sharded::~sharded()
+{
+	/* close pools on their nodes */
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i]->post([this, i] { shards[i].reset(); });
+	for (auto &w : workers) {
+		try {
+			w->wait();
+		} catch (std::exception &e) {
+			ERR() << e.what();
+		}
+	}
+
+	LOG("Stopped ok");
+}
+
+std::string sharded::name()
+{
+	return "sharded";
+}
+
+size_t sharded::shard_of(string_view key)
+{
+	if (!boundaries.empty()) {
+		auto it = std::upper_bound(boundaries.begin(), boundaries.end(), key,
+					   [](string_view k, const std::string &b) {
+						   return k.compare(b) < 0;
+					   });
+		return static_cast<size_t>(it - boundaries.begin());
+	}
+
+	return static_cast<size_t>(internal::sharded::key_hash(key) % shards.size());
+}
+
+/*
+ * Calls f for every shard, in parallel on the workers if the engine was opened
+ * with "numa_nodes". Returns the first status, in order of shards, which is
+ * not OK.
+ */
+status sharded::for_each_shard(std::function<status(size_t, engine_base &)> f)
+{
+	std::vector<status> results(shards.size(), status::OK);
+	if (workers.empty()) {
+		for (size_t i = 0; i < shards.size(); i++)
+			results[i] = f(i, *shards[i]);
+	} else {
+		for (size_t i = 0; i < shards.size(); i++)
+			workers[i]->post([&, i] { results[i] = f(i, *shards[i]); });
+		std::exception_ptr error;
+		for (auto &w : workers) {
+			try {
+				w->wait();
+			} catch (...) {
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	for (auto s : results)
+		if (s != status::OK)
+			return s;
+
+	return status::OK;
+}
+
+status sharded::sum_counts(std::function<status(engine_base &, std::size_t &)> f,
+			   std::size_t &cnt)
+{
+	std::vector<std::size_t> counts(shards.size(), 0);
+	auto s = for_each_shard(
+		[&](size_t i, engine_base &shard) { return f(shard, counts[i]); });
+	if (s != status::OK)
+		return s;
+
+	cnt = 0;
+	for (auto c : counts)
+		cnt += c;
+
+	return status::OK;
+}
+
+status sharded::count_all(std::size_t &cnt)
+{
+	LOG("count_all");
+	return sum_counts([](engine_base &shard,
+			     std::size_t &c) { return shard.count_all(c); },
+			  cnt);
+}
+
+status sharded::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above");
+	return sum_counts([&](engine_base &shard,
+			      std::size_t &c) { return shard.count_above(key, c); },
+			  cnt);
+}
+
+status sharded::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above");
+	return sum_counts([&](engine_base &shard, std::size_t &c) {
+		return shard.count_equal_above(key, c);
+	}, cnt);
+}
+
+status sharded::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below");
+	return sum_counts([&](engine_base &shard, std::size_t &c) {
+		return shard.count_equal_below(key, c);
+	}, cnt);
+}
+
+status sharded::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below");
+	return sum_counts([&](engine_base &shard,
+			      std::size_t &c) { return shard.count_below(key, c); },
+			  cnt);
+}
+
+status sharded::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between");
+	return sum_counts([&](engine_base &shard, std::size_t &c) {
+		return shard.count_between(key1, key2, c);
+	}, cnt);
+}
+
+/*
+ * Calls f for shards from first to last, from the calling thread, so records of
+ * range partitioned shards are passed in order of keys.
+ */
+status sharded::get_range(size_t first, size_t last,
+			  std::function<status(engine_base &)> f)
+{
+	for (size_t i = first; i <= last && i < shards.size(); i++) {
+		auto s = f(*shards[i]);
+		if (s != status::OK)
+			return s;
+	}
+
+	return status::OK;
+}
+
+status sharded::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	return get_range(0, shards.size() - 1, [&](engine_base &shard) {
+		return shard.get_all(callback, arg);
+	});
+}
+
+status sharded::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	if (boundaries.empty())
+		return engine_base::get_above(key, callback, arg);
+
+	return get_range(shard_of(key), shards.size() - 1, [&](engine_base &shard) {
+		return shard.get_above(key, callback, arg);
+	});
+}
+
+status sharded::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	if (boundaries.empty())
+		return engine_base::get_equal_above(key, callback, arg);
+
+	return get_range(shard_of(key), shards.size() - 1, [&](engine_base &shard) {
+		return shard.get_equal_above(key, callback, arg);
+	});
+}
+
+status sharded::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	if (boundaries.empty())
+		return engine_base::get_equal_below(key, callback, arg);
+
+	return get_range(0, shard_of(key), [&](engine_base &shard) {
+		return shard.get_equal_below(key, callback, arg);
+	});
+}
+
+status sharded::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	if (boundaries.empty())
+		return engine_base::get_below(key, callback, arg);
+
+	return get_range(0, shard_of(key), [&](engine_base &shard) {
+		return shard.get_below(key, callback, arg);
+	});
+}
+
+status sharded::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			    void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size())
+				     << ", key2="
+				     << std::string(key2.data(), key2.size()));
+	if (boundaries.empty())
+		return engine_base::get_between(key1, key2, callback, arg);
+	if (key1.compare(key2) >= 0)
+		return status::OK;
+
+	return get_range(shard_of(key1), shard_of(key2), [&](engine_base &shard) {
+		return shard.get_between(key1, key2, callback, arg);
+	});
+}
+
+status sharded::exists(string_view key)
+{
+	return shards[shard_of(key)]->exists(key);
+}
+
+status sharded::get(string_view key, get_v_callback *callback, void *arg)
+{
+	return shards[shard_of(key)]->get(key, callback, arg);
+}
+
+status sharded::get_ref(string_view key, internal::value_ref &ref)
+{
+	return shards[shard_of(key)]->get_ref(key, ref);
+}
+
+status sharded::put(string_view key, string_view value)
+{
+	return shards[shard_of(key)]->put(key, value);
+}
+
+status sharded::put_with_ttl(string_view key, string_view value, uint64_t ttl_ms)
+{
+	return shards[shard_of(key)]->put_with_ttl(key, value, ttl_ms);
+}
+
+status sharded::get_or_insert(string_view key, string_view value,
+			      get_v_callback *callback, void *arg, bool &inserted)
+{
+	return shards[shard_of(key)]->get_or_insert(key, value, callback, arg, inserted);
+}
+
+status sharded::update(string_view key, update_callback *callback, void *arg)
+{
+	return shards[shard_of(key)]->update(key, callback, arg);
+}
+
+status sharded::remove(string_view key)
+{
+	return shards[shard_of(key)]->remove(key);
+}
+
+status sharded::remove_range(string_view key1, string_view key2)
+{
+	LOG("remove_range");
+	return for_each_shard([&](size_t, engine_base &shard) {
+		return shard.remove_range(key1, key2);
+	});
+}
+
+/*
+ * The batch is split into parts for the shards, each written by one call to
+ * its sub engine, so it is atomic within a shard only.
+ */
+status sharded::write(internal::write_batch &batch)
+{
+	LOG("write batch of " << batch.size() << " operations");
+	std::vector<internal::write_batch> parts(shards.size());
+	for (auto &op : batch.operations()) {
+		auto &part = parts[shard_of(op.key)];
+		if (op.type == internal::write_batch::op_type::PUT)
+			part.put(op.key, op.value);
+		else
+			part.remove(op.key);
+	}
+
+	return for_each_shard([&](size_t i, engine_base &shard) {
+		return parts[i].size() ? shard.write(parts[i]) : status::OK;
+	});
+}
+
+status sharded::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag");
+	return for_each_shard([&](size_t, engine_base &shard) {
+		return shard.defrag(start_percent, amount_percent);
+	});
+}
+
+status sharded::flush()
+{
+	return for_each_shard([](size_t, engine_base &shard) { return shard.flush(); });
+}
+
+void sharded::metrics(internal::engine_metrics &metrics)
+{
+	metrics.add("shards", static_cast<uint64_t>(shards.size()));
+	for (size_t i = 0; i < shards.size(); i++) {
+		internal::engine_metrics shard_metrics;
+		shards[i]->metrics(shard_metrics);
+		metrics.add("shard" + std::to_string(i) + "_", shard_metrics);
+	}
+}
+
+} /* namespace kv */
+} /* namespace pmem */
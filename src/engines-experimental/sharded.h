@@ -0,0 +1,159 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "../engine.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace sharded
+{
+
+/*
+ * Thread bound to the CPUs of one NUMA node, which runs tasks posted to it one
+ * at a time. Sub engines are opened and operations spanning all shards are run
+ * by their workers, so each pool is accessed from its own socket.
+ */
+class worker {
+public:
+	worker(int node);
+	~worker();
+
+	worker(const worker &) = delete;
+	worker &operator=(const worker &) = delete;
+
+	/* runs the task in the worker thread, wait() has to be called before next post */
+	void post(std::function<void()> task);
+	/* waits until the posted task is done, rethrows its exception */
+	void wait();
+
+private:
+	void run(cpu_set_t cpus);
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::function<void()> task;
+	std::exception_ptr error;
+	bool busy;
+	bool stopped;
+	std::thread thread;
+};
+
+/* splits comma separated list, as given in "paths" and "numa_nodes" config items */
+std::vector<std::string> split_list(const std::string &list);
+
+/* 64-bit FNV-1a hash, stable between runs, used to pick the shard of a key */
+uint64_t key_hash(string_view key);
+
+} /* namespace sharded */
+} /* namespace internal */
+
+/*
+ * Engine made of several instances of another engine, one per pool. Keys are
+ * hashed to shards, or assigned to them by ranges between "boundaries", so
+ * single-key operations are passed to one sub engine and operations on all
+ * records are combined from all of them. The list of pools (and boundaries) has
+ * to be the same, in the same order, whenever the engine is opened.
+ */
+class sharded : public engine_base {
+public:
+	sharded(std::unique_ptr<internal::config> cfg);
+	~sharded();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_ref(string_view key, internal::value_ref &ref) final;
+
+	status put(string_view key, string_view value) final;
+	status put_with_ttl(string_view key, string_view value, uint64_t ttl_ms) final;
+	status get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			     void *arg, bool &inserted) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+	status remove(string_view key) final;
+	status remove_range(string_view key1, string_view key2) final;
+	status write(internal::write_batch &batch) final;
+	status defrag(double start_percent, double amount_percent) final;
+	status flush() final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
+private:
+	size_t shard_of(string_view key);
+	status for_each_shard(std::function<status(size_t, engine_base &)> f);
+	status sum_counts(std::function<status(engine_base &, std::size_t &)> f,
+			  std::size_t &cnt);
+	status get_range(size_t first, size_t last,
+			 std::function<status(engine_base &)> f);
+
+	std::vector<std::unique_ptr<internal::sharded::worker>> workers;
+	std::vector<std::unique_ptr<engine_base>> shards;
+	/* lowest keys of all shards but the first, empty if keys are hashed */
+	std::vector<std::string> boundaries;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -30,8 +30,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <unistd.h>
+#include <vector>
 
 #include <libpmemobj++/make_persistent_atomic.hpp>
 #include <libpmemobj++/transaction.hpp>
@@ -48,45 +53,69 @@ namespace pmem
 namespace kv
 {
 
-stree::stree(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+basic_stree<degree, inline_key, inline_value>::basic_stree(const pmemobj_pool_ref &ref,
+							   internal::config &cfg,
+							   bool dram_index,
+							   uint64_t bloom_bits,
+							   uint64_t compression)
+    : pmemobj_engine_base(ref)
 {
+	init_compression(compression, OID_IS_NULL(*root_oid));
+	init_allocator(cfg,
+		       {btree_type::leaf_node_size(), btree_type::inner_node_size()});
 	Recover();
+	/* the filter is enabled at once, so writers add keys while it is built */
+	if (bloom_bits)
+		my_btree_cc.filter().reset(static_cast<size_t>(my_btree->size()),
+					   static_cast<size_t>(bloom_bits));
+	if (dram_index || bloom_bits)
+		index_builder = std::thread([this, dram_index] {
+			if (dram_index)
+				build_index_in_background();
+			if (my_btree_cc.filter().enabled())
+				build_filter_in_background();
+		});
 	LOG("Started ok");
 }
 
-stree::~stree()
+template <size_t degree, size_t inline_key, size_t inline_value>
+basic_stree<degree, inline_key, inline_value>::~basic_stree()
 {
+	if (index_builder.joinable())
+		index_builder.join();
+	if (!read_only)
+		my_btree->persist_counts();
 	LOG("Stopped ok");
 }
 
-std::string stree::name()
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::string basic_stree<degree, inline_key, inline_value>::name()
 {
 	return "stree";
 }
 
-status stree::count_all(std::size_t &cnt)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
 
-	auto result = std::distance(my_btree->begin(), my_btree->end());
-	assert(result >= 0);
-
-	cnt = static_cast<std::size_t>(result);
+	cnt = static_cast<std::size_t>(my_btree->size());
 
 	return status::OK;
 }
 
 // above key, key exclusive
-status stree::count_above(string_view key, std::size_t &cnt)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_above(string_view key,
+								  std::size_t &cnt)
 {
 	LOG("count_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->upper_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
-	auto result = std::distance(it, my_btree->end());
-	assert(result >= 0);
+	uint64_t result = my_btree->size() -
+		my_btree->count_less_equal(key_type(key.data(), key.size()));
 
 	cnt = static_cast<std::size_t>(result);
 
@@ -94,15 +123,15 @@ status stree::count_above(string_view key, std::size_t &cnt)
 }
 
 // above or equal to key, key inclusive
-status stree::count_equal_above(string_view key, std::size_t &cnt)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_equal_above(string_view key,
+									std::size_t &cnt)
 {
 	LOG("count_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->lower_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
-	auto result = std::distance(it, my_btree->end());
-	assert(result >= 0);
+	uint64_t result = my_btree->size() -
+		my_btree->count_less(key_type(key.data(), key.size()));
 
 	cnt = static_cast<std::size_t>(result);
 
@@ -110,135 +139,215 @@ status stree::count_equal_above(string_view key, std::size_t &cnt)
 }
 
 // below key, key exclusive
-status stree::count_below(string_view key, std::size_t &cnt)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_below(string_view key,
+								  std::size_t &cnt)
 {
 	LOG("count_below key<" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->lower_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
-	auto result = std::distance(my_btree->begin(), it);
-	assert(result >= 0);
-
-	cnt = static_cast<std::size_t>(result);
+	cnt = static_cast<std::size_t>(my_btree->count_less(
+		key_type(key.data(), key.size())));
 
 	return status::OK;
 }
 
 // below or equal to key, key inclusive
-status stree::count_equal_below(string_view key, std::size_t &cnt)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_equal_below(string_view key,
+									std::size_t &cnt)
 {
 	LOG("count_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->upper_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
-	auto result = std::distance(my_btree->begin(), it);
-	assert(result >= 0);
-
-	cnt = static_cast<std::size_t>(result);
+	cnt = static_cast<std::size_t>(my_btree->count_less_equal(
+		key_type(key.data(), key.size())));
 
 	return status::OK;
 }
 
-status stree::count_between(string_view key1, string_view key2, std::size_t &cnt)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_between(string_view key1,
+								    string_view key2,
+								    std::size_t &cnt)
 {
 	LOG("count_between key range=[" << std::string(key1.data(), key1.size()) << ","
 					<< std::string(key2.data(), key2.size()) << ")");
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it1 = my_btree->upper_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key1.data(), key1.size()));
-	internal::stree::btree_type::iterator it2 = my_btree->lower_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key2.data(), key2.size()));
-	auto result = std::distance(it1, it2);
-	assert(result >= 0);
+	uint64_t above_key1 =
+		my_btree->count_less_equal(key_type(key1.data(), key1.size()));
+	uint64_t below_key2 = my_btree->count_less(key_type(key2.data(), key2.size()));
 
-	cnt = static_cast<std::size_t>(result);
+	cnt = below_key2 > above_key1
+		? static_cast<std::size_t>(below_key2 - above_key1)
+		: 0;
+
+	return status::OK;
+}
+
+/*
+ * Sets 'successor' to the lowest key greater than all keys starting with the
+ * prefix, in the order of keys of the tree (comparing chars). Returns false if
+ * there is no such key.
+ */
+static bool prefix_successor(string_view prefix, std::string &successor)
+{
+	const char max = std::numeric_limits<char>::max();
+	successor.assign(prefix.data(), prefix.size());
+	while (!successor.empty() && successor.back() == max)
+		successor.pop_back();
+	if (successor.empty())
+		return false;
+
+	successor.back()++;
+	return true;
+}
+
+// [prefix, successor of prefix), counted without visiting the records
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::count_prefix(string_view prefix,
+								   std::size_t &cnt)
+{
+	LOG("count_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+
+	std::string successor;
+	uint64_t below_successor = prefix_successor(prefix, successor)
+		? my_btree->count_less(key_type(successor.data(), successor.size()))
+		: my_btree->size();
+	uint64_t below_prefix =
+		my_btree->count_less(key_type(prefix.data(), prefix.size()));
+
+	cnt = static_cast<std::size_t>(below_successor - below_prefix);
 
 	return status::OK;
 }
 
-std::pair<string_view, string_view> stree::upper_bound(string_view key)
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::pair<string_view, string_view>
+basic_stree<degree, inline_key, inline_value>::upper_bound(string_view key)
 {
 	LOG("upper_bound");
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->upper_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
+	typename btree_type::iterator it = my_btree->upper_bound(
+		key_type(key.data(), key.size()));
 	if (it == my_btree->end()) {
 		return std::make_pair("", "");
 	}
-	return std::make_pair(string_view(it->first.c_str(), it->first.size()), 
-	                      string_view(it->second.c_str(), it->second.size()));
+	return record_of(it);
 }
 
-std::pair<string_view, string_view> stree::lower_bound(string_view key)
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::pair<string_view, string_view>
+basic_stree<degree, inline_key, inline_value>::lower_bound(string_view key)
 {
 	LOG("lower_bound");
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->lower_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
+	typename btree_type::iterator it = my_btree->lower_bound(
+		key_type(key.data(), key.size()));
 	if (it == my_btree->end()) {
 		return std::make_pair("", "");
 	}
-	return std::make_pair(string_view(it->first.c_str(), it->first.size()), 
-	                      string_view(it->second.c_str(), it->second.size()));
+	return record_of(it);
 }
 
-std::pair<string_view, string_view> stree::get_begin()
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::pair<string_view, string_view>
+basic_stree<degree, inline_key, inline_value>::get_begin()
 {
 	LOG("begin");
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->begin();
+	typename btree_type::iterator it = my_btree->begin();
 	if (it == my_btree->end()) {
 		return std::make_pair("", "");
 	}
-	return std::make_pair(string_view(it->first.c_str(), it->first.size()), 
-	                      string_view(it->second.c_str(), it->second.size()));
+	return record_of(it);
 }
 
-std::pair<string_view, string_view> stree::get_next(string_view key)
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::pair<string_view, string_view>
+basic_stree<degree, inline_key, inline_value>::get_next(string_view key)
 {
 	LOG("get_next");
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->find(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
+	typename btree_type::iterator it = my_btree->find(
+		key_type(key.data(), key.size()));
 	if (it == my_btree->end()) {
 		return std::make_pair("", "");
 	}
 	it++;
-	return std::make_pair(string_view(it->first.c_str(), it->first.size()), 
-	                      string_view(it->second.c_str(), it->second.size()));
+	if (it == my_btree->end()) {
+		return std::make_pair("", "");
+	}
+	return record_of(it);
 }
 
-std::pair<string_view, string_view> stree::get_prev(string_view key)
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::pair<string_view, string_view>
+basic_stree<degree, inline_key, inline_value>::get_prev(string_view key)
 {
 	LOG("get_prev");
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->find(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
+	typename btree_type::iterator it = my_btree->find(
+		key_type(key.data(), key.size()));
 	if (it == my_btree->begin() || it == my_btree->end()) {
 		return std::make_pair("", "");
 	}
 	it--;
-	return std::make_pair(string_view(it->first.c_str(), it->first.size()), 
-	                      string_view(it->second.c_str(), it->second.size()));
+	return record_of(it);
 }
 
-int stree::get_size_new()
+/*
+ * Records returned by the functions above point to the tree. Values stored
+ * compressed are decompressed into a buffer of the calling thread instead,
+ * which is valid until its next call.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+std::pair<string_view, string_view>
+basic_stree<degree, inline_key, inline_value>::record_of(typename btree_type::iterator it)
+{
+	static thread_local std::string buffer;
+	return std::make_pair(string_view(it->first.data(), it->first.size()),
+			      value_of(it->second, buffer));
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+int basic_stree<degree, inline_key, inline_value>::get_size_new()
 {
 	LOG("get_size");
 	check_outside_tx();
-	return std::distance(my_btree->begin(), my_btree->end());
+	return static_cast<int>(my_btree->size());
 }
 
-status stree::get_all(get_kv_callback *callback, void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+internal::iterator_base *basic_stree<degree, inline_key, inline_value>::new_iterator()
+{
+	LOG("new_iterator");
+	check_outside_tx();
+	return new internal::stree::iterator<btree_type>(my_btree, &codec);
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+internal::snapshot_base *basic_stree<degree, inline_key, inline_value>::new_snapshot()
+{
+	LOG("new_snapshot");
+	check_outside_tx();
+	return new internal::stree::snapshot<btree_type>(my_btree, &my_btree_cc,
+							  &snapshots, &codec);
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_all(get_kv_callback *callback,
+							      void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
+	std::string buffer;
 	for (auto &iterator : *my_btree) {
-		auto ret = callback(iterator.first.c_str(), iterator.first.size(),
-				    iterator.second.c_str(), iterator.second.size(), arg);
+		auto value = value_of(iterator.second, buffer);
+		auto ret = callback(iterator.first.data(), iterator.first.size(),
+				    value.data(), value.size(), arg);
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
 	}
@@ -247,15 +356,20 @@ status stree::get_all(get_kv_callback *callback, void *arg)
 }
 
 // (key, end), above key
-status stree::get_above(string_view key, get_kv_callback *callback, void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_above(string_view key,
+								get_kv_callback *callback,
+								void *arg)
 {
 	LOG("get_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->upper_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
+	std::string buffer;
+	typename btree_type::iterator it = my_btree->upper_bound(
+		key_type(key.data(), key.size()));
 	while (it != my_btree->end()) {
-		auto ret = callback((*it).first.c_str(), (*it).first.size(),
-				    (*it).second.c_str(), (*it).second.size(), arg);
+		auto value = value_of((*it).second, buffer);
+		auto ret = callback((*it).first.data(), (*it).first.size(),
+				    value.data(), value.size(), arg);
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
 		it++;
@@ -265,15 +379,21 @@ status stree::get_above(string_view key, get_kv_callback *callback, void *arg)
 }
 
 // [key, end), above or equal to key
-status stree::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status
+basic_stree<degree, inline_key, inline_value>::get_equal_above(string_view key,
+							       get_kv_callback *callback,
+							       void *arg)
 {
 	LOG("get_equal_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->lower_bound(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
+	std::string buffer;
+	typename btree_type::iterator it = my_btree->lower_bound(
+		key_type(key.data(), key.size()));
 	while (it != my_btree->end()) {
-		auto ret = callback((*it).first.c_str(), (*it).first.size(),
-				    (*it).second.c_str(), (*it).second.size(), arg);
+		auto value = value_of((*it).second, buffer);
+		auto ret = callback((*it).first.data(), (*it).first.size(),
+				    value.data(), value.size(), arg);
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
 		it++;
@@ -283,15 +403,21 @@ status stree::get_equal_above(string_view key, get_kv_callback *callback, void *
 }
 
 // [start, key], below or equal to key
-status stree::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status
+basic_stree<degree, inline_key, inline_value>::get_equal_below(string_view key,
+							       get_kv_callback *callback,
+							       void *arg)
 {
 	LOG("get_equal_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->begin();
-	auto pskey = pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size());
+	std::string buffer;
+	typename btree_type::iterator it = my_btree->begin();
+	auto pskey = key_type(key.data(), key.size());
 	while (it != my_btree->end() && !((*it).first > pskey)) {
-		auto ret = callback((*it).first.c_str(), (*it).first.size(),
-				    (*it).second.c_str(), (*it).second.size(), arg);
+		auto value = value_of((*it).second, buffer);
+		auto ret = callback((*it).first.data(), (*it).first.size(),
+				    value.data(), value.size(), arg);
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
 		it++;
@@ -301,15 +427,20 @@ status stree::get_equal_below(string_view key, get_kv_callback *callback, void *
 }
 
 // [start, key), less than key, key exclusive
-status stree::get_below(string_view key, get_kv_callback *callback, void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_below(string_view key,
+								get_kv_callback *callback,
+								void *arg)
 {
 	LOG("get_below key<" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	auto pskey = pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size());
-	internal::stree::btree_type::iterator it = my_btree->begin();
+	std::string buffer;
+	auto pskey = key_type(key.data(), key.size());
+	typename btree_type::iterator it = my_btree->begin();
 	while (it != my_btree->end() && (*it).first < pskey) {
-		auto ret = callback((*it).first.c_str(), (*it).first.size(),
-				    (*it).second.c_str(), (*it).second.size(), arg);
+		auto value = value_of((*it).second, buffer);
+		auto ret = callback((*it).first.data(), (*it).first.size(),
+				    value.data(), value.size(), arg);
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
 		it++;
@@ -319,18 +450,24 @@ status stree::get_below(string_view key, get_kv_callback *callback, void *arg)
 }
 
 // get between (key1, key2), key1 exclusive, key2 exclusive
-status stree::get_between(string_view key1, string_view key2, get_kv_callback *callback,
-			  void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status
+basic_stree<degree, inline_key, inline_value>::get_between(string_view key1,
+							   string_view key2,
+							   get_kv_callback *callback,
+							   void *arg)
 {
 	LOG("get_between key range=[" << std::string(key1.data(), key1.size()) << ","
 				      << std::string(key2.data(), key2.size()) << ")");
 	check_outside_tx();
-	auto pskey1 = pstring<internal::stree::MAX_KEY_SIZE>(key1.data(), key1.size());
-	auto pskey2 = pstring<internal::stree::MAX_KEY_SIZE>(key2.data(), key2.size());
-	internal::stree::btree_type::iterator it = my_btree->upper_bound(pskey1);
+	auto pskey1 = key_type(key1.data(), key1.size());
+	auto pskey2 = key_type(key2.data(), key2.size());
+	std::string buffer;
+	typename btree_type::iterator it = my_btree->upper_bound(pskey1);
 	while (it != my_btree->end() && (*it).first < pskey2) {
-		auto ret = callback((*it).first.c_str(), (*it).first.size(),
-				    (*it).second.c_str(), (*it).second.size(), arg);
+		auto value = value_of((*it).second, buffer);
+		auto ret = callback((*it).first.data(), (*it).first.size(),
+				    value.data(), value.size(), arg);
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
 		it++;
@@ -339,76 +476,1079 @@ status stree::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
-status stree::exists(string_view key)
+/*
+ * (key1, key2) is split at separators of inner nodes into PARALLEL_SPLIT
+ * sub-ranges per worker, of similar counts of elements. Workers take the
+ * sub-ranges one by one and walk their leaves as get_between() does.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_between_parallel(
+	string_view key1, string_view key2, size_t nthreads,
+	get_kv_parallel_callback *callback, void *arg)
+{
+	LOG("get_between_parallel key range=["
+	    << std::string(key1.data(), key1.size()) << ","
+	    << std::string(key2.data(), key2.size()) << ") nthreads=" << nthreads);
+	check_outside_tx();
+	auto pskey1 = key_type(key1.data(), key1.size());
+	auto pskey2 = key_type(key2.data(), key2.size());
+
+	/* sub-range i is (bounds[i], bounds[i + 1]], the last one ends before key2 */
+	std::vector<key_type> bounds(1, pskey1);
+	auto separators = my_btree->split_range(
+		pskey1, pskey2, nthreads * internal::stree::PARALLEL_SPLIT);
+	bounds.insert(bounds.end(), separators.begin(), separators.end());
+
+	std::atomic<bool> stopped(false);
+	std::vector<std::string> buffers(nthreads);
+	auto scan_part = [&](size_t worker,
+			     typename std::vector<key_type>::const_iterator b) {
+		bool last = b + 1 == bounds.cend();
+		typename btree_type::iterator it = my_btree->upper_bound(*b);
+		while (it != my_btree->end() &&
+		       (last ? (*it).first < pskey2 : !((*it).first > *(b + 1)))) {
+			if (stopped.load(std::memory_order_relaxed))
+				return false;
+
+			auto &k = (*it).first;
+			auto v = value_of((*it).second, buffers[worker]);
+			auto ret = callback(worker, k.data(), k.size(), v.data(),
+					    v.size(), arg);
+			if (ret != 0) {
+				stopped.store(true);
+				return false;
+			}
+			it++;
+		}
+
+		return true;
+	};
+
+	return internal::parallel_for_each(nthreads, bounds.cbegin(), bounds.cend(), 1,
+					   scan_part);
+}
+
+// [prefix, first key not starting with prefix)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_prefix(string_view prefix,
+								 get_kv_callback *callback,
+								 void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	std::string buffer;
+	typename btree_type::iterator it =
+		my_btree->lower_bound(key_type(prefix.data(), prefix.size()));
+	while (it != my_btree->end()) {
+		auto &key = (*it).first;
+		if (key.size() < prefix.size() ||
+		    memcmp(key.data(), prefix.data(), prefix.size()) != 0)
+			break;
+		auto value = value_of((*it).second, buffer);
+		auto ret = callback(key.data(), key.size(), value.data(), value.size(),
+				    arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+		it++;
+	}
+
+	return status::OK;
+}
+
+// [prefix, first key not starting with prefix)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::scan(string_view prefix,
+							   size_t limit,
+							   size_t batch_size,
+							   scan_callback *callback,
+							   void *arg)
+{
+	LOG("scan prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	/* records are passed in place, as by get_all(), unless they are decompressed */
+	internal::scan_batch batch(prefix, limit, batch_size, callback, arg,
+				   codec.enabled());
+	std::string buffer;
+	typename btree_type::iterator it =
+		my_btree->lower_bound(key_type(prefix.data(), prefix.size()));
+	status s = status::OK;
+	while (it != my_btree->end()) {
+		string_view key((*it).first.data(), (*it).first.size());
+		if (!batch.matches(key))
+			break;
+		if (!batch.push(key, value_of((*it).second, buffer))) {
+			s = status::STOPPED_BY_CB;
+			break;
+		}
+		it++;
+	}
+
+	return batch.finish(s);
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->find(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
-	if (it == my_btree->end()) {
+	if (!my_btree->concurrent_find(
+		    my_btree_cc, key_type(key.data(), key.size()),
+		    [](const typename btree_type::mapped_type &) {})) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
 	}
 	return status::OK;
 }
 
-status stree::get(string_view key, get_v_callback *callback, void *arg)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get(string_view key,
+							  get_v_callback *callback,
+							  void *arg)
 {
 	LOG("get using callback for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	internal::stree::btree_type::iterator it = my_btree->find(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()));
-	if (it == my_btree->end()) {
+	/* the value is copied, as the leaf may be modified once it is found */
+	std::string value;
+	if (!my_btree->concurrent_find(
+		    my_btree_cc, key_type(key.data(), key.size()),
+		    [&](const typename btree_type::mapped_type &v) {
+			    value.assign(v.data(), v.size());
+		    })) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	std::string buffer;
+	auto v = codec.decode(value, buffer);
+	callback(v.data(), v.size(), arg);
+	return status::OK;
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status
+basic_stree<degree, inline_key, inline_value>::get_many(size_t count,
+							const string_view *keys,
+							get_many_v_callback *callback,
+							void *arg)
+{
+	LOG("get_many count=" << count);
+	check_outside_tx();
+
+	/* look the keys up in sorted order, so neighbours share a descent */
+	std::vector<key_type> pkeys;
+	pkeys.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		pkeys.emplace_back(keys[i].data(), keys[i].size());
+
+	std::vector<size_t> order(count);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(),
+		  [&](size_t a, size_t b) { return pkeys[a] < pkeys[b]; });
+
+	std::vector<key_type> sorted_keys;
+	sorted_keys.reserve(count);
+	for (size_t idx : order)
+		sorted_keys.push_back(pkeys[idx]);
+
+	status result = status::OK;
+	std::string value, buffer;
+	my_btree->concurrent_find_sorted(
+		my_btree_cc, sorted_keys.begin(), sorted_keys.end(),
+		[&](const typename btree_type::mapped_type &v) {
+			value.assign(v.data(), v.size());
+		},
+		[&](size_t pos, bool found) {
+			if (!found) {
+				callback(order[pos], static_cast<int>(status::NOT_FOUND),
+					 nullptr, 0, arg);
+				result = status::NOT_FOUND;
+			} else {
+				auto v = codec.decode(value, buffer);
+				callback(order[pos], static_cast<int>(status::OK),
+					 v.data(), v.size(), arg);
+			}
+		});
+
+	return result;
+}
+
+namespace internal
+{
+namespace stree
+{
+
+/* keeps the element's leaf locked while its value is referenced */
+template <typename BTree>
+class value_pin : public value_ref::pin {
+public:
+	~value_pin()
+	{
+		release();
+	}
+
+	void release() final
+	{
+		if (lock) {
+			tree->concurrent_unpin(*cc, lock);
+			lock = nullptr;
+		}
+	}
+
+	BTree *tree = nullptr;
+	persistent::concurrency_control *cc = nullptr;
+	persistent::version_lock *lock = nullptr;
+	/* the referenced value, if it is stored compressed */
+	std::string buffer;
+};
+
+} /* namespace stree */
+} /* namespace internal */
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_ref(string_view key,
+							      internal::value_ref &ref)
+{
+	LOG("get_ref for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	auto &pin = ref.reset_pin<internal::stree::value_pin<btree_type>>();
+	pin.tree = my_btree;
+	pin.cc = &my_btree_cc;
+	auto entry = my_btree->concurrent_pin(
+		my_btree_cc, key_type(key.data(), key.size()), &pin.lock);
+	if (entry == nullptr) {
 		LOG("  key not found");
+		ref.release();
 		return status::NOT_FOUND;
 	}
 
-	callback(it->second.c_str(), it->second.size(), arg);
+	ref.set(value_of(entry->second, pin.buffer));
 	return status::OK;
 }
 
-status stree::put(string_view key, string_view value)
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::put(string_view key,
+							  string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
+	check_writable();
+
+	std::string buffer;
+	value = codec.encode(value, buffer);
+
+	persistent::tree_latch::shared_guard writing(snapshots.latch);
+	preserve(key);
+	my_btree->concurrent_insert(
+		my_btree_cc,
+		std::make_pair(key_type(key.data(), key.size()),
+			       pstring<inline_value>(value.data(), value.size())),
+		[&](typename btree_type::value_type &entry) {
+			// key already exists, so update
+			transaction::run(pmpool, [&] {
+				conditional_add_to_tx(&(entry.second));
+				entry.second.assign(value.data(), value.size());
+			});
+		});
+	return status::OK;
+}
+
+/* the existing value is passed to callback while its leaf is locked */
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::get_or_insert(
+	string_view key, string_view value, get_v_callback *callback, void *arg,
+	bool &inserted)
+{
+	LOG("get_or_insert key=" << std::string(key.data(), key.size())
+				 << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+	check_writable();
+
+	std::string buffer, current;
+	auto stored = codec.encode(value, buffer);
+
+	persistent::tree_latch::shared_guard writing(snapshots.latch);
+	preserve(key);
+	inserted = my_btree->concurrent_insert(
+		my_btree_cc,
+		std::make_pair(key_type(key.data(), key.size()),
+			       pstring<inline_value>(stored.data(), stored.size())),
+		[&](typename btree_type::value_type &entry) {
+			if (callback) {
+				auto existing = value_of(entry.second, current);
+				callback(existing.data(), existing.size(), arg);
+			}
+		});
+	if (inserted && callback)
+		callback(value.data(), value.size(), arg);
 
-	auto result = my_btree->insert(std::make_pair(
-		pstring<internal::stree::MAX_KEY_SIZE>(key.data(), key.size()),
-		pstring<internal::stree::MAX_VALUE_SIZE>(value.data(), value.size())));
-	if (!result.second) { // key already exists, so update
-		typename internal::stree::btree_type::value_type &entry = *result.first;
-		transaction::manual tx(pmpool);
-		conditional_add_to_tx(&(entry.second));
-		entry.second = std::string(value.data(), value.size());
-		transaction::commit();
-	}
 	return status::OK;
 }
 
-status stree::remove(string_view key)
+/*
+ * An existing record is updated while its leaf is locked, a missing one is
+ * inserted with the value computed for no record. If a concurrent put inserts it
+ * in the meantime, the new value is computed once more, under the leaf lock taken
+ * by concurrent_insert().
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::update(string_view key,
+							     update_callback *callback,
+							     void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	check_writable();
+
+	std::string current, encoded;
+	bool stopped = false;
+	/* computes the new value, returns false if the callback stops the update */
+	auto compute = [&](const pstring<inline_value> *value, string_view &stored) {
+		string_view v;
+		if (value)
+			v = value_of(*value, current);
+
+		const char *new_value;
+		size_t new_valuebytes;
+		if (callback(value ? v.data() : nullptr, v.size(), &new_value,
+			     &new_valuebytes, arg) != 0)
+			return false;
+
+		stored = codec.encode(string_view(new_value, new_valuebytes), encoded);
+		return true;
+	};
+	/* the record is locked by the caller, as in the update of a put */
+	auto assign = [&](const typename btree_type::value_type &entry) {
+		string_view stored;
+		if (!compute(&entry.second, stored)) {
+			stopped = true;
+			return;
+		}
+
+		auto &value = const_cast<pstring<inline_value> &>(entry.second);
+		transaction::run(pmpool, [&] {
+			conditional_add_to_tx(&value);
+			value.assign(stored.data(), stored.size());
+		});
+	};
+
+	persistent::tree_latch::shared_guard writing(snapshots.latch);
+	preserve(key);
+	key_type k(key.data(), key.size());
+	{
+		internal::stree::value_pin<btree_type> pin;
+		pin.tree = my_btree;
+		pin.cc = &my_btree_cc;
+		auto entry = my_btree->concurrent_pin(my_btree_cc, k, &pin.lock);
+		if (entry != nullptr) {
+			assign(*entry);
+			return stopped ? status::STOPPED_BY_CB : status::OK;
+		}
+	}
+
+	string_view stored;
+	if (!compute(nullptr, stored))
+		return status::STOPPED_BY_CB;
+
+	my_btree->concurrent_insert(
+		my_btree_cc,
+		std::make_pair(k, pstring<inline_value>(stored.data(), stored.size())),
+		[&](typename btree_type::value_type &entry) { assign(entry); });
+	return stopped ? status::STOPPED_BY_CB : status::OK;
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	check_writable();
 
-	auto result = my_btree->erase(std::string(key.data(), key.size()));
+	persistent::tree_latch::shared_guard writing(snapshots.latch);
+	preserve(key);
+	auto result =
+		my_btree->concurrent_erase(my_btree_cc, key_type(key.data(), key.size()));
 	return (result == 1) ? status::OK : status::NOT_FOUND;
 }
 
-void stree::Recover()
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::remove_range(string_view key1,
+								   string_view key2)
+{
+	LOG("remove_range key1=" << std::string(key1.data(), key1.size())
+				 << ", key2=" << std::string(key2.data(), key2.size()));
+	check_outside_tx();
+	check_writable();
+
+	persistent::tree_latch::shared_guard writing(snapshots.latch);
+	std::lock_guard<persistent::tree_latch> exclusive(my_btree_cc.latch());
+	key_type k1(key1.data(), key1.size()), k2(key2.data(), key2.size());
+	if (!snapshots.snapshots.empty()) {
+		for (auto it = my_btree->lower_bound(k1);
+		     it != my_btree->end() && (*it).first < k2; ++it) {
+			string_view key((*it).first.data(), (*it).first.size());
+			string_view value((*it).second.data(), (*it).second.size());
+			for (auto records : snapshots.snapshots)
+				records->preserve(key, true, value);
+		}
+	}
+	my_btree->erase_range(k1, k2);
+	rebuild_index();
+	return status::OK;
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::bulk_load(
+	bulk_load_callback *callback, void *arg)
+{
+	LOG("bulk_load");
+	check_outside_tx();
+	check_writable();
+
+	/* an empty tree is built from leaves up, otherwise records are put */
+	bool loaded;
+	{
+		persistent::tree_latch::shared_guard writing(snapshots.latch);
+		std::lock_guard<persistent::tree_latch> exclusive(my_btree_cc.latch());
+		std::string previous, buffer;
+		bool first = true;
+		auto next = [&](typename btree_type::value_type &entry) {
+			const char *k, *v;
+			size_t kb, vb;
+			if (callback(&k, &kb, &v, &vb, arg) != 0)
+				return false;
+
+			string_view key(k, kb);
+			if (!first && string_view(previous).compare(key) >= 0)
+				throw internal::invalid_argument(
+					"Records of bulk load are not sorted by key");
+			first = false;
+			previous.assign(k, kb);
+
+			/* the entry is copied to the leaf before the next one is read */
+			auto value = codec.encode(string_view(v, vb), buffer);
+			entry.first = key_type(k, kb);
+			entry.second = pstring<inline_value>(value.data(), value.size());
+			return true;
+		};
+
+		try {
+			/* snapshots do not preserve records loaded from leaves up */
+			loaded = snapshots.snapshots.empty() && my_btree->bulk_load(next);
+		} catch (...) {
+			/* records loaded before the failure are in the tree */
+			rebuild_index();
+			rebuild_filter();
+			throw;
+		}
+		rebuild_index();
+		rebuild_filter();
+	}
+
+	return loaded ? status::OK : engine_base::bulk_load(callback, arg);
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+status basic_stree<degree, inline_key, inline_value>::defrag(double start_percent,
+							     double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+	check_writable();
+
+	/* leaves are locked by their addresses, which are changed by defrag */
+	std::lock_guard<persistent::tree_latch> exclusive(my_btree_cc.latch());
+	try {
+		my_btree->defrag(start_percent, amount_percent);
+	} catch (std::range_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::INVALID_ARGUMENT;
+	} catch (pmem::defrag_error &e) {
+		/* some leaves may have been relocated before the failure */
+		rebuild_index();
+		out_err_stream("defrag") << e.what();
+		return status::DEFRAG_ERROR;
+	}
+	rebuild_index();
+
+	return status::OK;
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::metrics(
+	internal::engine_metrics &metrics)
+{
+	auto &splits = my_btree_cc.splits();
+	metrics.add("leaf_splits", splits.leaves.load(std::memory_order_relaxed));
+	metrics.add("inner_node_splits",
+		    splits.inner_nodes.load(std::memory_order_relaxed));
+	metrics.add("leaf_merges", splits.leaf_merges.load(std::memory_order_relaxed));
+	metrics.add("leaf_rebalances",
+		    splits.leaf_rebalances.load(std::memory_order_relaxed));
+	if (codec.enabled()) {
+		metrics.add("compressed_values", codec.compressed_values());
+		metrics.add("compression_saved_bytes", codec.saved_bytes());
+	}
+
+	/* all nodes are visited, so writers have to wait */
+	std::lock_guard<persistent::tree_latch> exclusive(my_btree_cc.latch());
+	if (index_builder.joinable())
+		metrics.add("dram_index_ready",
+			    static_cast<uint64_t>(index_ready.load()));
+	if (my_btree_cc.index().enabled())
+		metrics.add("dram_index_leaves", my_btree_cc.index().size());
+	auto &filter = my_btree_cc.filter();
+	if (filter.enabled()) {
+		metrics.add("bloom_filter_ready", static_cast<uint64_t>(filter.ready()));
+		metrics.add("bloom_filter_bits", filter.bits());
+		metrics.add("bloom_filter_keys", filter.added());
+	}
+	auto shape = my_btree->shape();
+	auto capacity = shape.leaves * btree_type::leaf_capacity();
+
+	metrics.add("depth", shape.depth);
+	metrics.add("leaves", shape.leaves);
+	metrics.add("inner_nodes", shape.inner_nodes);
+	metrics.add("leaf_fill_factor",
+		    capacity ? static_cast<double>(shape.entries) /
+				    static_cast<double>(capacity)
+			     : 0.0);
+}
+
+/*
+ * Rebuilds the DRAM index, if it is enabled, after the tree was modified by
+ * other than concurrent_* methods. The caller holds the tree latch exclusively.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::rebuild_index()
+{
+	if (my_btree_cc.index().enabled())
+		my_btree->build_index(my_btree_cc);
+}
+
+/*
+ * Rebuilds the filter of keys, if it is enabled, after records were inserted by
+ * other than concurrent_* methods. The caller holds the tree latch exclusively.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::rebuild_filter()
+{
+	if (my_btree_cc.filter().enabled())
+		my_btree->build_filter(my_btree_cc);
+}
+
+/*
+ * Builds the DRAM index while the engine already serves requests. Until the index
+ * is enabled, lookups descend the tree from its root. The index is built under
+ * the shared latch, together with readers, and it is published under the
+ * exclusive one, unless the tree was modified meanwhile - then it is rebuilt.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::build_index_in_background()
+{
+	persistent::leaf_index index;
+	uint64_t version;
+	{
+		persistent::tree_latch::shared_guard shared(my_btree_cc.latch());
+		version = my_btree_cc.latch().exclusive_count();
+		my_btree->build_index(index);
+	}
+
+	std::lock_guard<persistent::tree_latch> exclusive(my_btree_cc.latch());
+	if (my_btree_cc.latch().exclusive_count() == version + 1)
+		my_btree_cc.index() = std::move(index);
+	else
+		my_btree->build_index(my_btree_cc);
+	index_ready.store(true);
+}
+
+/*
+ * Adds keys of the tree to the filter enabled by the constructor. Until it is
+ * ready, lookups do not consult it. Keys are read under the shared latch, so
+ * leaves are not split meanwhile, and the keys put concurrently are added to the
+ * filter by writers.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::build_filter_in_background()
+{
+	persistent::tree_latch::shared_guard shared(my_btree_cc.latch());
+	my_btree->fill_filter(my_btree_cc);
+}
+
+/*
+ * Preserves the current record of the key in all snapshots, before the key is
+ * modified. Has to be called with the snapshot latch held in shared mode.
+ */
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::preserve(string_view key)
+{
+	if (snapshots.snapshots.empty())
+		return;
+
+	std::string value;
+	bool existed = my_btree->concurrent_find(
+		my_btree_cc, key_type(key.data(), key.size()),
+		[&](const typename btree_type::mapped_type &v) {
+			value.assign(v.data(), v.size());
+		});
+	for (auto records : snapshots.snapshots)
+		records->preserve(key, existed, value);
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+void basic_stree<degree, inline_key, inline_value>::Recover()
 {
 	if (!OID_IS_NULL(*root_oid)) {
-		my_btree = (internal::stree::btree_type *)pmemobj_direct(*root_oid);
-		my_btree->garbage_collection();
+		auto hdr = (internal::stree::header *)pmemobj_direct(*root_oid);
+		my_btree = (btree_type *)pmemobj_direct(hdr->tree);
+		if (!read_only)
+			my_btree->garbage_collection();
+	} else if (read_only) {
+		throw internal::invalid_argument(
+			"Cannot open an empty pool in read-only mode");
 	} else {
 		pmem::obj::transaction::manual tx(pmpool);
 		pmem::obj::transaction::snapshot(root_oid);
-		*root_oid =
-			pmem::obj::make_persistent<internal::stree::btree_type>().raw();
+		auto hdr = pmem::obj::make_persistent<internal::stree::header>();
+		hdr->degree = degree;
+		hdr->inline_key_size = inline_key;
+		hdr->inline_value_size = inline_value;
+		hdr->tree = pmem::obj::make_persistent<btree_type>().raw();
+		*root_oid = hdr.raw();
 		pmem::obj::transaction::commit();
-		my_btree = (internal::stree::btree_type *)pmemobj_direct(*root_oid);
+		my_btree = (btree_type *)pmemobj_direct(hdr->tree);
+	}
+}
+
+namespace internal
+{
+namespace stree
+{
+
+template <typename BTree>
+iterator<BTree>::iterator(BTree *tree, const value_codec *codec)
+    : tree(tree), codec(codec), it(tree->end()), end_it(it)
+{
+}
+
+template <typename BTree>
+status iterator<BTree>::seek(string_view key)
+{
+	end_it = tree->end();
+
+	return position(tree->find(key_type(key.data(), key.size())));
+}
+
+template <typename BTree>
+status iterator<BTree>::seek_lower(string_view key)
+{
+	end_it = tree->end();
+
+	return step_back(tree->lower_bound(key_type(key.data(), key.size())));
+}
+
+template <typename BTree>
+status iterator<BTree>::seek_lower_eq(string_view key)
+{
+	end_it = tree->end();
+
+	key_type k(key.data(), key.size());
+	auto pos = tree->lower_bound(k);
+	if (pos != end_it && pos->first == k)
+		return position(pos);
+
+	return step_back(pos);
+}
+
+template <typename BTree>
+status iterator<BTree>::seek_higher(string_view key)
+{
+	end_it = tree->end();
+
+	key_type k(key.data(), key.size());
+	auto pos = tree->lower_bound(k);
+	if (pos != end_it && pos->first == k)
+		++pos;
+
+	return position(pos);
+}
+
+template <typename BTree>
+status iterator<BTree>::seek_higher_eq(string_view key)
+{
+	end_it = tree->end();
+
+	return position(tree->lower_bound(key_type(key.data(), key.size())));
+}
+
+template <typename BTree>
+status iterator<BTree>::seek_to_first()
+{
+	end_it = tree->end();
+
+	return position(tree->begin());
+}
+
+template <typename BTree>
+status iterator<BTree>::seek_to_last()
+{
+	end_it = tree->end();
+
+	return step_back(end_it);
+}
+
+template <typename BTree>
+status iterator<BTree>::is_next()
+{
+	if (it == end_it)
+		return status::NOT_FOUND;
+
+	auto tmp = it;
+	++tmp;
+
+	return tmp != end_it ? status::OK : status::NOT_FOUND;
+}
+
+template <typename BTree>
+status iterator<BTree>::next()
+{
+	if (it == end_it)
+		return status::NOT_FOUND;
+
+	++it;
+
+	return it != end_it ? status::OK : status::NOT_FOUND;
+}
+
+template <typename BTree>
+status iterator<BTree>::prev()
+{
+	if (it == end_it)
+		return status::NOT_FOUND;
+
+	return step_back(it);
+}
+
+template <typename BTree>
+status iterator<BTree>::key(string_view &key)
+{
+	if (it == end_it)
+		return status::NOT_FOUND;
+
+	key = string_view(it->first.data(), it->first.size());
+
+	return status::OK;
+}
+
+template <typename BTree>
+status iterator<BTree>::value(string_view &value)
+{
+	if (it == end_it)
+		return status::NOT_FOUND;
+
+	value = codec->decode(string_view(it->second.data(), it->second.size()), buffer);
+
+	return status::OK;
+}
+
+template <typename BTree>
+status iterator<BTree>::position(tree_iterator pos)
+{
+	it = pos;
+
+	return it != end_it ? status::OK : status::NOT_FOUND;
+}
+
+/*
+ * Positions the iterator on the element preceding pos (which may be end()).
+ * Decrementing the first element leaves an iterator unchanged.
+ */
+template <typename BTree>
+status iterator<BTree>::step_back(tree_iterator pos)
+{
+	/* the tree has no leaves yet */
+	if (end_it == tree_iterator(nullptr))
+		return position(end_it);
+
+	auto tmp = pos;
+	--pos;
+	if (pos == tmp)
+		return position(end_it);
+
+	return position(pos);
+}
+
+void snapshot_records::preserve(string_view key, bool existed, string_view value)
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	records.emplace(std::string(key.data(), key.size()),
+			std::make_pair(existed, std::string(value.data(), value.size())));
+}
+
+bool snapshot_records::find(string_view key, bool &existed, std::string &value)
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	auto it = records.find(std::string(key.data(), key.size()));
+	if (it == records.end())
+		return false;
+
+	existed = it->second.first;
+	value = it->second.second;
+	return true;
+}
+
+void snapshot_records::existing(const std::string &lo, bool lo_inclusive,
+				const std::string &hi, bool hi_inclusive, bool bounded,
+				std::map<std::string, std::string> &out)
+{
+	std::lock_guard<std::mutex> guard(mtx);
+	for (auto it = records.lower_bound(lo); it != records.end(); ++it) {
+		if (!lo_inclusive && it->first == lo)
+			continue;
+		if (bounded && (hi < it->first || (!hi_inclusive && it->first == hi)))
+			break;
+		if (it->second.first)
+			out[it->first] = it->second.second;
 	}
 }
 
+template <typename BTree>
+snapshot<BTree>::snapshot(BTree *tree, persistent::concurrency_control *cc,
+			  snapshot_registry *registry, const value_codec *codec)
+    : tree(tree), cc(cc), registry(registry), codec(codec)
+{
+	std::lock_guard<persistent::tree_latch> exclusive(registry->latch);
+	registry->snapshots.push_back(&records);
+}
+
+template <typename BTree>
+snapshot<BTree>::~snapshot()
+{
+	std::lock_guard<persistent::tree_latch> exclusive(registry->latch);
+	auto &snapshots = registry->snapshots;
+	snapshots.erase(std::find(snapshots.begin(), snapshots.end(), &records));
+}
+
+/*
+ * Replaces the value read from the tree by the preserved one, if the key was
+ * modified since the snapshot was taken. Returns false if the key did not
+ * exist then.
+ */
+template <typename BTree>
+bool snapshot<BTree>::overlay(const std::string &key, std::string &value)
+{
+	bool existed;
+	std::string preserved;
+	if (!records.find(key, existed, preserved))
+		return true;
+
+	value = std::move(preserved);
+	return existed;
+}
+
+template <typename BTree>
+status snapshot<BTree>::get(string_view key, get_v_callback *callback, void *arg)
+{
+	std::string k(key.data(), key.size());
+	std::string value;
+	bool found = tree->concurrent_find(
+		*cc, key_type(k.data(), k.size()),
+		[&](const typename BTree::mapped_type &v) {
+			value.assign(v.data(), v.size());
+		});
+
+	/* a record preserved after the tree was read has the value read */
+	bool existed;
+	std::string preserved;
+	if (records.find(k, existed, preserved)) {
+		found = existed;
+		value = std::move(preserved);
+	}
+	if (!found)
+		return status::NOT_FOUND;
+
+	std::string buffer;
+	auto v = codec->decode(value, buffer);
+	callback(v.data(), v.size(), arg);
+	return status::OK;
+}
+
+template <typename BTree>
+status snapshot<BTree>::get_all(get_kv_callback *callback, void *arg)
+{
+	return read(string_view(), true, string_view(), false, callback, arg);
+}
+
+template <typename BTree>
+status snapshot<BTree>::get_between(string_view key1, string_view key2,
+				    get_kv_callback *callback, void *arg)
+{
+	if (key1.compare(key2) >= 0)
+		return status::OK;
+
+	return read(key1, false, key2, true, callback, arg);
+}
+
+/*
+ * Reads records with keys from lo (included if inclusive is set) to hi
+ * (excluded, not checked if bounded is false), a leaf at a time. Records read
+ * from a leaf are merged with the preserved ones, whose keys are not greater
+ * than the last one read, so records inserted or removed after the snapshot
+ * was taken are hidden or restored.
+ */
+template <typename BTree>
+status snapshot<BTree>::read(string_view lo, bool inclusive, string_view hi,
+			     bool bounded, get_kv_callback *callback, void *arg)
+{
+	std::string cursor(lo.data(), lo.size());
+	std::string end(hi.data(), hi.size());
+	std::vector<std::pair<std::string, std::string>> leaf;
+	std::map<std::string, std::string> batch;
+	std::string buffer;
+
+	for (;;) {
+		leaf.clear();
+		bool more = tree->concurrent_scan_leaf(
+			*cc, key_type(cursor.data(), cursor.size()), inclusive,
+			[&](const typename BTree::value_type &entry) {
+				leaf.emplace_back(std::string(entry.first.data(),
+							      entry.first.size()),
+						  std::string(entry.second.data(),
+							      entry.second.size()));
+			});
+
+		/* the batch covers keys up to the last one read, or to the end */
+		bool last = !more || (bounded && !(leaf.back().first < end));
+		const std::string &batch_end = last ? end : leaf.back().first;
+
+		batch.clear();
+		for (auto &record : leaf) {
+			if (bounded && !(record.first < end))
+				break;
+			if (overlay(record.first, record.second))
+				batch[record.first] = std::move(record.second);
+		}
+		records.existing(cursor, inclusive, batch_end, !last, bounded || !last,
+				 batch);
+
+		for (auto &record : batch) {
+			auto value = codec->decode(record.second, buffer);
+			if (callback(record.first.data(), record.first.size(),
+				     value.data(), value.size(), arg) != 0)
+				return status::STOPPED_BY_CB;
+		}
+
+		if (last)
+			return status::OK;
+
+		cursor = leaf.back().first;
+		inclusive = false;
+	}
+}
+
+template <size_t degree, size_t inline_key, size_t inline_value>
+static engine_base *create(const pmemobj_pool_ref &ref, internal::config &cfg,
+			   bool dram_index, uint64_t bloom_bits, uint64_t compression)
+{
+	return new basic_stree<degree, inline_key, inline_value>(
+		ref, cfg, dram_index, bloom_bits, compression);
+}
+
+struct layout {
+	uint64_t degree;
+	uint64_t inline_key_size;
+	uint64_t inline_value_size;
+	engine_base *(*create)(const pmemobj_pool_ref &ref, internal::config &cfg,
+			       bool dram_index, uint64_t bloom_bits,
+			       uint64_t compression);
+};
+
+/* layouts the tree is compiled for */
+static const layout layouts[] = {
+	{32, INLINE_KEY_SIZE, INLINE_VALUE_SIZE,
+	 create<32, INLINE_KEY_SIZE, INLINE_VALUE_SIZE>},
+	{64, INLINE_KEY_SIZE, INLINE_VALUE_SIZE,
+	 create<64, INLINE_KEY_SIZE, INLINE_VALUE_SIZE>},
+	{128, INLINE_KEY_SIZE, INLINE_VALUE_SIZE,
+	 create<128, INLINE_KEY_SIZE, INLINE_VALUE_SIZE>},
+	{32, 55, 119, create<32, 55, 119>},
+	{64, 55, 119, create<64, 55, 119>},
+	{128, 55, 119, create<128, 55, 119>},
+};
+
+/*
+ * Reads the layout parameter from the config. If it is also recorded in the
+ * existing tree, both values have to be the same.
+ */
+static uint64_t layout_param(internal::config &cfg, const char *key, uint64_t value,
+			     const header *hdr, uint64_t recorded)
+{
+	uint64_t configured;
+	if (!cfg.get_uint64(key, &configured))
+		return hdr ? recorded : value;
+
+	if (hdr && configured != recorded)
+		throw internal::invalid_argument(
+			std::string("Config item \"") + key + "\" is " +
+			std::to_string(configured) + ", but the tree was created with " +
+			std::to_string(recorded));
+
+	return configured;
+}
+
+engine_base *create_engine(std::unique_ptr<internal::config> cfg)
+{
+	pmemobj_pool_ref ref = pmemobj_engine_base<header>::open_pool(cfg);
+
+	const layout *found = nullptr;
+	uint64_t dram_index = 0;
+	uint64_t bloom_bits = 0;
+	uint64_t compression;
+	try {
+		cfg->get_uint64("dram_index", &dram_index);
+		cfg->get_uint64("bloom_bits_per_key", &bloom_bits);
+		if (bloom_bits > 64)
+			throw internal::invalid_argument(
+				"Config item \"bloom_bits_per_key\" has to be at most 64");
+		compression = internal::value_codec::from_config(*cfg);
+
+		const header *hdr = OID_IS_NULL(*ref.oid)
+			? nullptr
+			: static_cast<const header *>(pmemobj_direct(*ref.oid));
+
+		uint64_t degree = layout_param(*cfg, "degree", DEGREE, hdr,
+					       hdr ? hdr->degree : 0);
+		uint64_t key_size = layout_param(*cfg, "inline_key_size", INLINE_KEY_SIZE,
+						 hdr, hdr ? hdr->inline_key_size : 0);
+		uint64_t value_size =
+			layout_param(*cfg, "inline_value_size", INLINE_VALUE_SIZE, hdr,
+				     hdr ? hdr->inline_value_size : 0);
+
+		for (const layout &l : layouts) {
+			if (l.degree == degree && l.inline_key_size == key_size &&
+			    l.inline_value_size == value_size)
+				found = &l;
+		}
+
+		if (!found)
+			throw internal::invalid_argument(
+				"Unsupported layout: degree " + std::to_string(degree) +
+				", inline_key_size " + std::to_string(key_size) +
+				", inline_value_size " + std::to_string(value_size));
+	} catch (...) {
+		if (ref.by_path)
+			ref.pop.close();
+		throw;
+	}
+
+	/* the engine closes the pool if its constructor throws */
+	return found->create(ref, *cfg, dram_index != 0, bloom_bits, compression);
+}
+
+} /* namespace stree */
+} /* namespace internal */
+
 } // namespace kv
 } // namespace pmem
@@ -32,10 +32,21 @@
 
 #pragma once
 
+#include "../compression.h"
+#include "../iterator.h"
+#include "../parallel_scan.h"
 #include "../pmemobj_engine.h"
+#include "../scan_batch.h"
 #include "stree/persistent_b_tree.h"
 #include "stree/pstring.h"
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 using pmem::obj::persistent_ptr;
 using pmem::obj::pool;
 
@@ -48,20 +59,156 @@ namespace internal
 namespace stree
 {
 
+/* default layout of the tree, used if the config does not specify one */
 const size_t DEGREE = 64;
-const size_t MAX_KEY_SIZE = 20;
-const size_t MAX_VALUE_SIZE = 200;
+/* longer keys and values are stored out of the leaf */
+const size_t INLINE_KEY_SIZE = 23;
+const size_t INLINE_VALUE_SIZE = 55;
+/* sub-ranges per worker of get_between_parallel(), so faster workers take more */
+const size_t PARALLEL_SPLIT = 4;
+
+/*
+ * Root object of the engine. The tree is instantiated for a number of
+ * layouts, the one used is recorded here when the tree is created.
+ */
+struct header {
+	uint64_t degree;
+	uint64_t inline_key_size;
+	uint64_t inline_value_size;
+	PMEMoid tree;
+};
+
+/*
+ * Cursor over the tree. It keeps a b_tree_iterator, so next() and prev()
+ * follow the leaf links instead of searching the tree from the root.
+ */
+template <typename BTree>
+class iterator : public internal::iterator_base {
+public:
+	iterator(BTree *tree, const value_codec *codec);
+
+	status seek(string_view key) final;
+	status seek_lower(string_view key) final;
+	status seek_lower_eq(string_view key) final;
+	status seek_higher(string_view key) final;
+	status seek_higher_eq(string_view key) final;
+
+	status seek_to_first() final;
+	status seek_to_last() final;
+
+	status is_next() final;
+	status next() final;
+	status prev() final;
+
+	status key(string_view &key) final;
+	status value(string_view &value) final;
+
+private:
+	typedef typename BTree::key_type key_type;
+	typedef typename BTree::iterator tree_iterator;
 
-typedef persistent::b_tree<pstring<MAX_KEY_SIZE>, pstring<MAX_VALUE_SIZE>, DEGREE>
-	btree_type;
+	status position(tree_iterator pos);
+	status step_back(tree_iterator pos);
+
+	BTree *tree;
+	const value_codec *codec;
+	tree_iterator it;
+	/* end() is looked up on every seek, stepping only compares against it */
+	tree_iterator end_it;
+	/* the current value, if it is stored compressed */
+	std::string buffer;
+};
+
+/*
+ * Records of a snapshot, whose keys were modified since the snapshot was taken,
+ * as they were then: whether the key existed and its value. Writers preserve
+ * a key before they modify it for the first time, reads of the snapshot check
+ * it after they read the tree.
+ */
+class snapshot_records {
+public:
+	/* does nothing if the key is already preserved */
+	void preserve(string_view key, bool existed, string_view value);
+
+	/* returns false if the key was not modified since the snapshot was taken */
+	bool find(string_view key, bool &existed, std::string &value);
+
+	/*
+	 * Copies preserved records, which existed, with keys between lo and hi to
+	 * out, in order. The bounds are included if the flags are set, hi is not
+	 * checked if bounded is false.
+	 */
+	void existing(const std::string &lo, bool lo_inclusive, const std::string &hi,
+		      bool hi_inclusive, bool bounded,
+		      std::map<std::string, std::string> &out);
+
+private:
+	std::mutex mtx;
+	/* key -> (existed, value) */
+	std::map<std::string, std::pair<bool, std::string>> records;
+};
+
+/*
+ * Snapshots of an engine. Writers hold the latch in shared mode while they
+ * preserve and modify a key, snapshots are added and removed under the
+ * exclusive one, so every modification either precedes a snapshot or is
+ * preserved by it.
+ */
+struct snapshot_registry {
+	persistent::tree_latch latch;
+	std::vector<snapshot_records *> snapshots;
+};
+
+/*
+ * Read view of the tree at the time it was created. Records are read from the
+ * tree, leaf by leaf, and replaced by the preserved ones if their keys were
+ * modified since then.
+ */
+template <typename BTree>
+class snapshot : public internal::snapshot_base {
+public:
+	snapshot(BTree *tree, persistent::concurrency_control *cc,
+		 snapshot_registry *registry, const value_codec *codec);
+	~snapshot();
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+private:
+	typedef typename BTree::key_type key_type;
+
+	status read(string_view lo, bool inclusive, string_view hi, bool bounded,
+		    get_kv_callback *callback, void *arg);
+	bool overlay(const std::string &key, std::string &value);
+
+	BTree *tree;
+	persistent::concurrency_control *cc;
+	snapshot_registry *registry;
+	const value_codec *codec;
+	snapshot_records records;
+};
+
+/*
+ * Creates the engine for the layout recorded in the pool, or for the one given
+ * in the config (degree, inline_key_size and inline_value_size), if the tree
+ * does not exist yet.
+ */
+engine_base *create_engine(std::unique_ptr<internal::config> cfg);
 
 } /* namespace stree */
 } /* namespace internal */
 
-class stree : public pmemobj_engine_base<internal::stree::btree_type> {
+template <size_t degree, size_t inline_key, size_t inline_value>
+class basic_stree : public pmemobj_engine_base<internal::stree::header> {
 public:
-	stree(std::unique_ptr<internal::config> cfg);
-	~stree();
+	typedef persistent::b_tree<pstring<inline_key>, pstring<inline_value>, degree>
+		btree_type;
+
+	basic_stree(const pmemobj_pool_ref &ref, internal::config &cfg, bool dram_index,
+		    uint64_t bloom_bits, uint64_t compression);
+	~basic_stree();
 
 	std::string name() final;
 
@@ -71,6 +218,7 @@ public:
 	status count_equal_below(string_view key, std::size_t &cnt) final;
 	status count_below(string_view key, std::size_t &cnt) final;
 	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
 	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
@@ -81,25 +229,77 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2, size_t nthreads,
+				    get_kv_parallel_callback *callback, void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
+	status scan(string_view prefix, size_t limit, size_t batch_size,
+		    scan_callback *callback, void *arg) final;
 	std::pair<string_view, string_view> upper_bound(string_view key) final;
 	std::pair<string_view, string_view> lower_bound(string_view key) final;
 	std::pair<string_view, string_view> get_begin() final;
 	std::pair<string_view, string_view> get_next(string_view key) final;
 	std::pair<string_view, string_view> get_prev(string_view key) final;
 	int get_size_new() final;
+	internal::iterator_base *new_iterator() final;
+	internal::snapshot_base *new_snapshot() final;
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
 
+	status get_many(size_t count, const string_view *keys,
+			get_many_v_callback *callback, void *arg) final;
+
+	status get_ref(string_view key, internal::value_ref &ref) final;
+
 	status put(string_view key, string_view value) final;
 
+	status get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			     void *arg, bool &inserted) final;
+
+	status update(string_view key, update_callback *callback, void *arg) final;
+
 	status remove(string_view key) final;
+	status remove_range(string_view key1, string_view key2) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+
+	status bulk_load(bulk_load_callback *callback, void *arg) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
 
 private:
-	stree(const stree &);
-	void operator=(const stree &);
+	typedef pstring<inline_key> key_type;
+
+	basic_stree(const basic_stree &);
+	void operator=(const basic_stree &);
 	void Recover();
-	internal::stree::btree_type *my_btree;
+	void rebuild_index();
+	void rebuild_filter();
+	void build_index_in_background();
+	void build_filter_in_background();
+	void preserve(string_view key);
+
+	/* the value of a record as it was put, decompressed into buffer if needed */
+	string_view value_of(const pstring<inline_value> &value,
+			     std::string &buffer) const
+	{
+		return codec.decode(string_view(value.data(), value.size()), buffer);
+	}
+
+	std::pair<string_view, string_view> record_of(typename btree_type::iterator it);
+
+	btree_type *my_btree;
+	/*
+	 * synchronizes get, exists, get_many, get_ref, put, get_or_insert, update,
+	 * remove, remove_range, bulk_load, defrag and metrics; holds the DRAM index of
+	 * leaves, if the engine was opened with "dram_index", and the filter of keys,
+	 * if it was opened with "bloom_bits_per_key"
+	 */
+	persistent::concurrency_control my_btree_cc;
+	/* builds the DRAM index and the filter of keys after the engine is opened */
+	std::thread index_builder;
+	std::atomic<bool> index_ready{false};
+	internal::stree::snapshot_registry snapshots;
 };
 
 } /* namespace kv */
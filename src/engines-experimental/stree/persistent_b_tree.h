@@ -34,24 +34,527 @@
 #define PERSISTENT_B_TREE
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <cassert>
 
+#include "../../alloc_classes.h"
+#include "../../probes.h"
+#include <libpmemobj++/allocation_flag.hpp>
 #include <libpmemobj++/make_persistent.hpp>
 #include <libpmemobj++/make_persistent_array_atomic.hpp>
 #include <libpmemobj++/make_persistent_atomic.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pexceptions.hpp>
 #include <libpmemobj++/pool.hpp>
 #include <libpmemobj++/transaction.hpp>
 
 namespace persistent
 {
 
+/**
+ * Volatile version lock. Writers lock it exclusively, which makes the version odd,
+ * and unlocking makes it even again. Readers do not write to it: they remember the
+ * version, read the protected data and check whether the version is still the same.
+ */
+class version_lock {
+public:
+	/**
+	 * Waits until the lock is not held and returns the current version.
+	 */
+	uint64_t read_begin() const
+	{
+		uint64_t v;
+		while ((v = version.load(std::memory_order_acquire)) & 1)
+			std::this_thread::yield();
+		return v;
+	}
+
+	/**
+	 * Returns true if nothing was written since read_begin() returned v.
+	 */
+	bool read_validate(uint64_t v) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return version.load(std::memory_order_relaxed) == v;
+	}
+
+	void lock()
+	{
+		for (;;) {
+			uint64_t v = read_begin();
+			if (version.compare_exchange_weak(v, v + 1,
+							  std::memory_order_acquire))
+				return;
+		}
+	}
+
+	void unlock()
+	{
+		version.fetch_add(1, std::memory_order_release);
+	}
+
+private:
+	std::atomic<uint64_t> version{0};
+};
+
+/**
+ * Volatile reader-writer lock guarding the structure of the tree. Readers are
+ * counted in per-thread slots, so that taking it in shared mode does not make
+ * threads contend on a single cache line. Exclusive mode is meant for rare
+ * operations (e.g. splits).
+ */
+class tree_latch {
+public:
+	class shared_guard {
+	public:
+		shared_guard(tree_latch &l) : latch(l)
+		{
+			latch.lock_shared();
+		}
+
+		~shared_guard()
+		{
+			latch.unlock_shared();
+		}
+
+	private:
+		tree_latch &latch;
+	};
+
+	void lock_shared()
+	{
+		auto &readers = slots[slot()].readers;
+		for (;;) {
+			readers.fetch_add(1);
+			if (!writer.load())
+				return;
+			readers.fetch_sub(1, std::memory_order_release);
+			while (writer.load(std::memory_order_acquire))
+				std::this_thread::yield();
+		}
+	}
+
+	void unlock_shared()
+	{
+		slots[slot()].readers.fetch_sub(1, std::memory_order_release);
+	}
+
+	void lock()
+	{
+		writer_mutex.lock();
+		exclusive.fetch_add(1, std::memory_order_relaxed);
+		writer.store(true);
+		for (auto &s : slots) {
+			while (s.readers.load(std::memory_order_acquire) != 0)
+				std::this_thread::yield();
+		}
+	}
+
+	void unlock()
+	{
+		writer.store(false, std::memory_order_release);
+		writer_mutex.unlock();
+	}
+
+	/**
+	 * Returns how many times the latch was locked exclusively. It does not
+	 * change while the latch is held, in any mode.
+	 */
+	uint64_t exclusive_count() const
+	{
+		return exclusive.load(std::memory_order_relaxed);
+	}
+
+private:
+	static const size_t slots_number = 64;
+
+	struct slot_t {
+		std::atomic<uint64_t> readers{0};
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+	};
+
+	static size_t slot()
+	{
+		static std::atomic<size_t> next_slot{0};
+		static thread_local size_t thread_slot = next_slot++ % slots_number;
+		return thread_slot;
+	}
+
+	slot_t slots[slots_number];
+	std::atomic<bool> writer{false};
+	std::atomic<uint64_t> exclusive{0};
+	std::mutex writer_mutex;
+};
+
+/**
+ * Volatile counters of nodes split by insertions and of leaves merged or
+ * rebalanced by removals since the tree was opened.
+ */
+struct split_stats {
+	std::atomic<uint64_t> leaves{0};
+	std::atomic<uint64_t> inner_nodes{0};
+	std::atomic<uint64_t> leaf_merges{0};
+	std::atomic<uint64_t> leaf_rebalances{0};
+};
+
+/**
+ * Volatile index of leaves, which routes lookups without reading inner nodes
+ * of the tree from persistent memory. Each leaf is stored under its upper
+ * separator: the leaf of a key is the one of the least separator not less
+ * than the key, or the last leaf if there is no such separator. These are
+ * the separators of all the inner nodes in the order of keys, so keys are
+ * routed to the same leaves as by a descent from the root.
+ *
+ * The index is modified only under the exclusive tree latch and read under
+ * the shared one. Separators are copied, an index takes roughly 100 bytes
+ * of DRAM per leaf.
+ */
+class leaf_index {
+	/* copied separator, or a key looked up (which refers to the caller's data) */
+	struct index_key {
+		index_key(const char *data, size_t size) : data(data), size(size)
+		{
+		}
+
+		index_key(std::string separator)
+		    : copy(std::move(separator)), data(copy.data()), size(copy.size())
+		{
+		}
+
+		index_key(const index_key &) = delete;
+		index_key &operator=(const index_key &) = delete;
+
+		std::string copy;
+		const char *data;
+		size_t size;
+	};
+
+	struct key_less {
+		bool operator()(const index_key &lhs, const index_key &rhs) const
+		{
+			return less(lhs.data, lhs.size, rhs.data, rhs.size);
+		}
+	};
+
+	typedef std::map<index_key, const void *, key_less> map_type;
+
+public:
+	/**
+	 * Leaf of a key and its upper separator, which is valid until the index is
+	 * modified. bounded is false for the last leaf.
+	 */
+	struct route {
+		const void *leaf;
+		const char *upper;
+		size_t upper_size;
+		bool bounded;
+	};
+
+	/* keys are compared as keys of the tree, char by char */
+	static bool less(const char *lhs, size_t lhs_size, const char *rhs,
+			 size_t rhs_size)
+	{
+		return std::lexicographical_compare(lhs, lhs + lhs_size, rhs,
+						    rhs + rhs_size);
+	}
+
+	bool enabled() const
+	{
+		return _enabled;
+	}
+
+	void enable()
+	{
+		_enabled = true;
+	}
+
+	/**
+	 * Returns true if no leaf is indexed, which is the case for an empty tree.
+	 */
+	bool empty() const
+	{
+		return last == nullptr;
+	}
+
+	size_t size() const
+	{
+		return last == nullptr ? 0 : leaves.size() + 1;
+	}
+
+	void clear()
+	{
+		leaves.clear();
+		last = nullptr;
+	}
+
+	/**
+	 * Adds the leaf, whose keys are greater than all indexed so far. The last
+	 * leaf of the tree is added with bounded set to false.
+	 */
+	void append(const void *leaf, const char *upper, size_t upper_size,
+		    bool bounded)
+	{
+		assert(last == nullptr);
+		if (bounded)
+			leaves.emplace_hint(leaves.end(), std::string(upper, upper_size),
+					    leaf);
+		else
+			last = leaf;
+	}
+
+	route find(const char *key, size_t size) const
+	{
+		auto it = leaves.lower_bound(index_key(key, size));
+		if (it == leaves.end())
+			return route{last, nullptr, 0, false};
+
+		return route{it->second, it->first.data, it->first.size, true};
+	}
+
+	/**
+	 * Replaces the leaf of the key, which was split at the separator into
+	 * left and right ones.
+	 */
+	void split(const char *key, size_t size, const char *separator,
+		   size_t separator_size, const void *left, const void *right)
+	{
+		auto it = leaves.lower_bound(index_key(key, size));
+		if (it == leaves.end())
+			last = right;
+		else
+			it->second = right;
+
+		leaves.emplace_hint(it, std::string(separator, separator_size), left);
+	}
+
+	/**
+	 * Replaces the leaves separated by the separator with the merged one.
+	 */
+	void merge(const char *separator, size_t separator_size, const void *leaf)
+	{
+		auto it = leaves.find(index_key(separator, separator_size));
+		assert(it != leaves.end());
+		auto next = leaves.erase(it);
+		if (next == leaves.end())
+			last = leaf;
+		else
+			next->second = leaf;
+	}
+
+	/**
+	 * Replaces the leaves separated by the old separator with left and right
+	 * ones, separated by the new separator.
+	 */
+	void rebalance(const char *old_separator, size_t old_separator_size,
+		       const char *separator, size_t separator_size, const void *left,
+		       const void *right)
+	{
+		merge(old_separator, old_separator_size, right);
+		leaves.emplace(std::string(separator, separator_size), left);
+	}
+
+private:
+	bool _enabled = false;
+	map_type leaves;
+	const void *last = nullptr;
+};
+
+/**
+ * Volatile Bloom filter of keys of the tree, which lets lookups of missing keys
+ * return without descending the tree. A key is added before it is inserted and
+ * bits are never cleared, so a key which is not in the filter is not in the
+ * tree; removed keys are only false positives until the filter is rebuilt.
+ *
+ * The filter is reset only under the exclusive tree latch, keys are added and
+ * looked up under the shared one. Until the filter is ready, i.e. all keys of
+ * the tree are added, every key may be contained.
+ */
+class key_filter {
+public:
+	/* filters are sized for twice as many keys as the tree has, at least */
+	static const size_t min_keys = 1024;
+
+	bool enabled() const
+	{
+		return _bits_per_key != 0;
+	}
+
+	size_t bits_per_key() const
+	{
+		return _bits_per_key;
+	}
+
+	bool ready() const
+	{
+		return _ready.load(std::memory_order_acquire);
+	}
+
+	void set_ready()
+	{
+		_ready.store(true, std::memory_order_release);
+	}
+
+	/**
+	 * Enables the filter and clears it, so that it fits twice as many keys as
+	 * given with the configured number of bits per key. It is not ready until
+	 * set_ready() is called.
+	 */
+	void reset(size_t keys, size_t per_key)
+	{
+		_bits_per_key = per_key;
+		_ready.store(false, std::memory_order_relaxed);
+		_added.store(0, std::memory_order_relaxed);
+		_capacity = std::max<size_t>(2 * keys, size_t(min_keys));
+
+		size_t words = 1;
+		while (words * 64 < _capacity * per_key)
+			words *= 2;
+		filter.reset(new std::atomic<uint64_t>[words]);
+		for (size_t i = 0; i < words; ++i)
+			filter[i].store(0, std::memory_order_relaxed);
+		mask = words * 64 - 1;
+
+		/* the number of hashes minimizing false positives is ln 2 per bit */
+		hashes = std::min<size_t>(std::max<size_t>(per_key * 69 / 100, 1), 16);
+	}
+
+	void add(const char *key, size_t size)
+	{
+		if (!enabled())
+			return;
+
+		uint64_t h1, h2;
+		hash(key, size, h1, h2);
+		for (size_t i = 0; i < hashes; ++i, h1 += h2)
+			filter[(h1 & mask) >> 6].fetch_or(uint64_t(1) << (h1 & 63),
+							  std::memory_order_relaxed);
+		_added.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Returns false only if the key is certainly not in the tree.
+	 */
+	bool may_contain(const char *key, size_t size) const
+	{
+		if (!ready())
+			return true;
+
+		uint64_t h1, h2;
+		hash(key, size, h1, h2);
+		for (size_t i = 0; i < hashes; ++i, h1 += h2) {
+			uint64_t word =
+				filter[(h1 & mask) >> 6].load(std::memory_order_relaxed);
+			if (!(word & (uint64_t(1) << (h1 & 63))))
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Returns true if more keys were added than the filter was sized for, so
+	 * it should be rebuilt to keep the rate of false positives.
+	 */
+	bool overfull() const
+	{
+		return _added.load(std::memory_order_relaxed) > _capacity;
+	}
+
+	size_t bits() const
+	{
+		return enabled() ? mask + 1 : 0;
+	}
+
+	size_t added() const
+	{
+		return _added.load(std::memory_order_relaxed);
+	}
+
+private:
+	/* two halves of a mixed FNV-1a hash, for double hashing */
+	static void hash(const char *key, size_t size, uint64_t &h1, uint64_t &h2)
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < size; ++i) {
+			h ^= static_cast<unsigned char>(key[i]);
+			h *= 1099511628211ULL;
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h1 = h;
+		h2 = (h >> 32) | (h << 32) | 1;
+	}
+
+	size_t _bits_per_key = 0;
+	size_t hashes = 0;
+	size_t _capacity = 0;
+	uint64_t mask = 0;
+	std::unique_ptr<std::atomic<uint64_t>[]> filter;
+	std::atomic<size_t> _added{0};
+	std::atomic<bool> _ready{false};
+};
+
+/**
+ * Volatile state used by the concurrent_* methods of the tree: the latch for
+ * the structure of the tree, version locks of leaves, counters of splits, the
+ * optional DRAM index of leaves and the optional filter of keys. Leaves are
+ * mapped to a fixed number of locks by their address.
+ */
+class concurrency_control {
+public:
+	tree_latch &latch()
+	{
+		return _latch;
+	}
+
+	split_stats &splits()
+	{
+		return _splits;
+	}
+
+	leaf_index &index()
+	{
+		return _index;
+	}
+
+	key_filter &filter()
+	{
+		return _filter;
+	}
+
+	version_lock &leaf_lock(const void *leaf)
+	{
+		uint64_t h = reinterpret_cast<uintptr_t>(leaf) * 0x9E3779B97F4A7C15ULL;
+		return locks[h >> (64 - leaf_locks_bits)].lock;
+	}
+
+private:
+	static const size_t leaf_locks_bits = 10;
+
+	struct lock_t {
+		version_lock lock;
+		char padding[64 - sizeof(version_lock)];
+	};
+
+	tree_latch _latch;
+	lock_t locks[size_t(1) << leaf_locks_bits];
+	split_stats _splits;
+	leaf_index _index;
+	key_filter _filter;
+};
+
 namespace internal
 {
 using namespace pmem::obj;
@@ -208,6 +711,8 @@ private:
 
 template <typename TKey, typename TValue, uint64_t number_entrys_slots>
 class leaf_node_t : public node_t {
+	static const size_t live_words = (number_entrys_slots + 63) / 64;
+
 	/**
 	 * Array of indexes.
 	 */
@@ -217,10 +722,22 @@ class leaf_node_t : public node_t {
 			for (uint64_t i = 0; i < number_entrys_slots; ++i) {
 				idxs[i] = i;
 			}
+			std::fill(live, live + live_words, uint64_t(0));
+		}
+
+		void set_live(uint64_t idx, bool is_live)
+		{
+			const uint64_t bit = uint64_t(1) << (idx % 64);
+			if (is_live)
+				live[idx / 64] |= bit;
+			else
+				live[idx / 64] &= ~bit;
 		}
 
 		uint64_t idxs[number_entrys_slots];
 		size_t _size;
+		/* bitmap of slots of entries, which are referred to by idxs */
+		uint64_t live[live_words];
 	};
 
 public:
@@ -246,9 +763,12 @@ public:
 	leaf_node_t(uint64_t e, const_reference entry)
 	    : node_t(), epoch(e), consistent_id(0), p_consistent_id(0)
 	{
+		assert(!entry.first.is_external() && !entry.second.is_external());
 		entries[0] = entry;
+		fingerprints[0] = fingerprint(entry.first);
 		consistent()->idxs[0] = 0;
 		consistent()->_size = 1;
+		consistent()->set_live(0, true);
 		assert(std::is_sorted(begin(), end(),
 				      [](const_reference a, const_reference b) {
 					      return a.first < b.first;
@@ -307,36 +827,35 @@ public:
 		return insert(pop, entry, this->begin(), this->end());
 	}
 
+	/**
+	 * Append the entry, greater than all stored ones, to a node which is not
+	 * reachable from the tree yet. Nothing is persisted.
+	 */
+	reference append(const_reference entry)
+	{
+		leaf_entries_t *c = consistent();
+		size_t pos = c->_size;
+		assert(pos < number_entrys_slots);
+		assert(pos == 0 || back().first < entry.first);
+		assert(c->idxs[pos] == pos);
+		assert(!entry.first.is_external() && !entry.second.is_external());
+
+		entries[pos] = entry;
+		fingerprints[pos] = fingerprint(entry.first);
+		c->set_live(pos, true);
+		c->_size = pos + 1;
+
+		return entries[pos];
+	}
+
 	iterator find(const key_type &key)
 	{
-		assert(std::is_sorted(begin(), end(),
-				      [](const_reference a, const_reference b) {
-					      return a.first < b.first;
-				      }));
-		iterator it = std::lower_bound(
-			begin(), end(), key, [](const_reference entry, const TKey &key) {
-				return entry.first < key;
-			});
-		if (it == end() || it->first == key)
-			return it;
-		else
-			return end();
+		return iterator(this, find_position(key));
 	}
 
 	const_iterator find(const key_type &key) const
 	{
-		assert(std::is_sorted(begin(), end(),
-				      [](const_reference a, const_reference b) {
-					      return a.first < b.first;
-				      }));
-		const_iterator it = std::lower_bound(
-			begin(), end(), key, [](const_reference entry, const TKey &key) {
-				return entry.first < key;
-			});
-		if (it == end() || it->first == key)
-			return it;
-		else
-			return end();
+		return const_iterator(this, find_position(key));
 	}
 
 	iterator lower_bound(const key_type &key)
@@ -416,6 +935,52 @@ public:
 		return size_t(1);
 	}
 
+	/**
+	 * Remove entries with keys in the range of [lo, hi), calling f for each of
+	 * them. Erased slots are left intact, until they are reused. Has to be
+	 * called within a transaction.
+	 */
+	template <typename Function>
+	void erase_range(pool_base &pop, const key_type &lo, const key_type &hi,
+			 Function f)
+	{
+		auto less = [](const_reference entry, const key_type &key) {
+			return entry.first < key;
+		};
+		iterator first = std::lower_bound(begin(), end(), lo, less);
+		iterator last = std::lower_bound(first, end(), hi, less);
+		if (first == last)
+			return;
+
+		size_t size = this->size();
+		size_t from = static_cast<size_t>(std::distance(begin(), first));
+		size_t to = static_cast<size_t>(std::distance(begin(), last));
+		leaf_entries_t *tmp = working_copy();
+		auto in = consistent()->idxs;
+		/* erased slots are the first ones to be reused */
+		auto out = std::copy(in, in + from, tmp->idxs);
+		out = std::copy(in + to, in + size, out);
+		out = std::copy(in + from, in + to, out);
+		std::copy(in + size, in + number_entrys_slots, out);
+		tmp->_size = size - (to - from);
+		std::copy(consistent()->live, consistent()->live + live_words, tmp->live);
+		for (size_t pos = from; pos < to; ++pos) {
+			tmp->set_live(in[pos], false);
+			f(entries[in[pos]]);
+		}
+
+		pop.persist(tmp, sizeof(leaf_entries_t));
+		switch_consistent(pop);
+
+		/*
+		 * Other modifications only rewrite idxs of entries in use, so free
+		 * slots of both copies have to match.
+		 */
+		leaf_entries_t *stale = working_copy();
+		transaction::snapshot(stale);
+		*stale = *consistent();
+	}
+
 	/**
 	 * Return begin iterator on an array of correct indices.
 	 */
@@ -514,12 +1079,81 @@ public:
 		this->prev = p;
 	}
 
-	void check_consistency(uint64_t global_epoch)
+	/**
+	 * Pointers to the neighbours, which are updated by defragmentation when
+	 * the neighbours are relocated.
+	 */
+	PMEMoid *next_oid()
+	{
+		return this->next.raw_ptr();
+	}
+
+	PMEMoid *prev_oid()
+	{
+		return this->prev.raw_ptr();
+	}
+
+	void check_consistency(uint64_t global_epoch)
 	{
 		if (global_epoch != epoch) {
 			consistent_id = p_consistent_id;
-			epoch = global_epoch;
+			__atomic_store_n(&epoch, global_epoch, __ATOMIC_RELEASE);
+		}
+	}
+
+	bool consistent_with(uint64_t global_epoch) const
+	{
+		return __atomic_load_n(&epoch, __ATOMIC_ACQUIRE) == global_epoch;
+	}
+
+	enum class optimistic_result { FOUND, NOT_FOUND, RETRY };
+
+	/**
+	 * Looks the key up while the leaf may be modified by another thread, so it
+	 * does not check any invariants and never reads outside of the leaf. A key
+	 * is copied and the copy compared only after validate() confirms that it
+	 * was not torn by a concurrent write, otherwise the lookup gives up (returns
+	 * RETRY). The result is valid only if the caller verifies that no write
+	 * happened concurrently. If the key is found, copy() is called for its value.
+	 */
+	template <typename Validate, typename Copy>
+	optimistic_result optimistic_find(const key_type &key, Validate validate,
+					  Copy copy) const
+	{
+		const uint32_t id = __atomic_load_n(&consistent_id, __ATOMIC_ACQUIRE);
+		const leaf_entries_t *c = v + (id & 1);
+
+		optimistic_result result = optimistic_result::NOT_FOUND;
+		find_slot(c, key, [&](size_t slot) {
+			const value_type &entry = entries[slot];
+			const key_type stored = entry.first;
+			if (!validate()) {
+				result = optimistic_result::RETRY;
+				return true;
+			}
+			if (!(stored == key))
+				return false;
+
+			copy(entry.second);
+			result = optimistic_result::FOUND;
+			return true;
+		});
+
+		return result;
+	}
+
+	/**
+	 * Fingerprint of a key: a byte of its FNV-1a hash. Keys with different
+	 * fingerprints are not equal, so they do not have to be compared.
+	 */
+	static uint8_t fingerprint(const key_type &key)
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (char c : key) {
+			h ^= static_cast<unsigned char>(c);
+			h *= 1099511628211ULL;
 		}
+		return static_cast<uint8_t>(h ^ (h >> 32));
 	}
 
 private:
@@ -529,6 +1163,8 @@ private:
 	persistent_ptr<leaf_node_t> next;
 	char padding[64];
 	value_type entries[number_entrys_slots];
+	/* fingerprints of keys of entries, by slot */
+	uint8_t fingerprints[number_entrys_slots];
 	leaf_entries_t v[2];
 	char padding1[64];
 	uint32_t p_consistent_id;
@@ -545,6 +1181,56 @@ private:
 		return v + consistent_id;
 	}
 
+	/**
+	 * Calls f for slots of entries in c, whose fingerprints are the same as the
+	 * key's one, until it returns true. Does not read anything outside of the
+	 * leaf, even if c is concurrently modified.
+	 */
+	template <typename Function>
+	void find_slot(const leaf_entries_t *c, const key_type &key, Function f) const
+	{
+		const uint8_t fp = fingerprint(key);
+		for (size_t w = 0; w < live_words; ++w) {
+			const size_t first = w * 64;
+			const size_t last = std::min(first + 64, number_entrys_slots);
+			uint64_t mask = 0;
+			for (size_t slot = first; slot < last; ++slot)
+				mask |= uint64_t(fingerprints[slot] == fp)
+					<< (slot - first);
+
+			for (mask &= c->live[w]; mask; mask &= mask - 1) {
+				size_t slot = first +
+					static_cast<size_t>(__builtin_ctzll(mask));
+				if (f(slot))
+					return;
+			}
+		}
+	}
+
+	/**
+	 * Return position of the key, or size() if it is not in the leaf.
+	 */
+	size_t find_position(const key_type &key) const
+	{
+		assert(std::is_sorted(begin(), end(),
+				      [](const_reference a, const_reference b) {
+					      return a.first < b.first;
+				      }));
+		const leaf_entries_t *c = consistent();
+		size_t position = c->_size;
+		find_slot(c, key, [&](size_t slot) {
+			if (!(entries[slot].first == key))
+				return false;
+
+			position = static_cast<size_t>(
+				std::find(c->idxs, c->idxs + c->_size, slot) - c->idxs);
+			return true;
+		});
+
+		assert(position == c->_size || (*this)[position].first == key);
+		return position;
+	}
+
 	leaf_entries_t *working_copy()
 	{
 		assert(consistent_id < 2);
@@ -554,6 +1240,9 @@ private:
 
 	void switch_consistent(pool_base &pop)
 	{
+		/* leaves with out-of-line data are modified within a transaction */
+		pmem::detail::conditional_add_to_tx(&consistent_id);
+		pmem::detail::conditional_add_to_tx(&p_consistent_id);
 		p_consistent_id = consistent_id = 1 - consistent_id;
 		// TODO: need to check if it make sense to use non-temporal store
 		pop.persist(&p_consistent_id, sizeof(p_consistent_id));
@@ -566,6 +1255,7 @@ private:
 					 iterator begin, iterator end)
 	{
 		assert(!full());
+		assert(!entry.first.is_external() && !entry.second.is_external());
 
 		iterator hint =
 			std::lower_bound(begin, end, entry.first,
@@ -583,7 +1273,9 @@ private:
 			[insert_pos](uint64_t idx) { return insert_pos == idx; }));
 		// insert an entry to the end
 		entries[insert_pos] = entry;
+		fingerprints[insert_pos] = fingerprint(entry.first);
 		pop.flush(&(entries[insert_pos]), sizeof(entries[insert_pos]));
+		pop.flush(&(fingerprints[insert_pos]), sizeof(fingerprints[insert_pos]));
 		// update tmp idxs
 		size_t position = insert_idx(pop, insert_pos, hint);
 		// update consistent
@@ -609,12 +1301,17 @@ private:
 		leaf_entries_t *tmp = working_copy();
 		auto in_begin = consistent()->idxs;
 		auto in_end = in_begin + size;
+		assert(*in_end == new_entry_idx);
 		auto partition_point = in_begin + std::distance(this->begin(), hint);
 		auto out_begin = tmp->idxs;
 		auto insert_pos = std::copy(in_begin, partition_point, out_begin);
 		*insert_pos = new_entry_idx;
-		std::copy(partition_point, in_end, insert_pos + 1);
+		/* free slots are copied too, the next insert takes the first one */
+		std::copy(in_end + 1, in_begin + number_entrys_slots,
+			  std::copy(partition_point, in_end, insert_pos + 1));
 		tmp->_size = size + 1;
+		std::copy(consistent()->live, consistent()->live + live_words, tmp->live);
+		tmp->set_live(new_entry_idx, true);
 #if 0
             pop.flush( tmp->idxs, sizeof(tmp->idxs[0])*tmp->_size );
             pop.persist( &(tmp->_size), sizeof(tmp->_size) );
@@ -638,11 +1335,26 @@ private:
 		out = std::copy(in_begin, partition_point, out);
 		out = std::copy(partition_point + 1, in_end, out);
 		*out = *partition_point;
+		std::copy(in_end, in_begin + number_entrys_slots, out + 1);
 		tmp->_size = size - 1;
+		std::copy(consistent()->live, consistent()->live + live_words, tmp->live);
+		tmp->set_live(*partition_point, false);
 
 		pop.persist(tmp, sizeof(leaf_entries_t));
 	}
 
+	/**
+	 * Set fingerprints of entries copied to a new node, which are stored in
+	 * the first size() slots.
+	 */
+	void init_fingerprints()
+	{
+		for (size_t slot = 0; slot < size(); ++slot) {
+			fingerprints[slot] = fingerprint(entries[slot].first);
+			consistent()->set_live(slot, true);
+		}
+	}
+
 	/**
 	 * Copy entries from another node in the range of [first, last) and insert new
 	 * entry.
@@ -652,6 +1364,7 @@ private:
 		assert(std::distance(first, last) >= 0);
 		assert(static_cast<std::size_t>(std::distance(first, last)) <
 		       number_entrys_slots);
+		assert(!entry.first.is_external() && !entry.second.is_external());
 
 		auto d_last = std::merge(first, last, &entry, &entry + 1, entries,
 					 [](const_reference a, const_reference b) {
@@ -664,6 +1377,7 @@ private:
 
 		std::iota(consistent()->idxs, consistent()->idxs + consistent()->_size,
 			  0);
+		init_fingerprints();
 	}
 
 	/**
@@ -683,6 +1397,7 @@ private:
 
 		std::iota(consistent()->idxs, consistent()->idxs + consistent()->_size,
 			  0);
+		init_fingerprints();
 	}
 
 	/**
@@ -722,6 +1437,8 @@ private:
 	struct inner_entries_t {
 		value_type entries[number_entrys_slots];
 		persistent_ptr<node_t> children[number_children_slots];
+		/* number of elements stored in the subtree of each child */
+		uint64_t counts[number_children_slots];
 		size_t _size = 0;
 	};
 
@@ -758,14 +1475,35 @@ public:
 
 	inner_node_t(size_t level, const value_type &key,
 		     const persistent_ptr<node_t> &child_0,
-		     const persistent_ptr<node_t> &child_1)
+		     const persistent_ptr<node_t> &child_1, uint64_t count_0,
+		     uint64_t count_1)
 	    : node_t(level), consistent_id(0)
 	{
+		assert(!key.is_external());
 		inner_entries_t *consist = consistent();
 		consist->entries[0] = key;
 		consist->_size++;
 		consist->children[0] = child_0;
 		consist->children[1] = child_1;
+		consist->counts[0] = count_0;
+		consist->counts[1] = count_1;
+		assert(std::is_sorted(begin(), end()));
+	}
+
+	/**
+	 * Create a node of size keys and size + 1 children with their counts.
+	 */
+	inner_node_t(size_t level, const value_type *keys,
+		     const persistent_ptr<node_t> *children, const uint64_t *counts,
+		     size_t size)
+	    : node_t(level), consistent_id(0)
+	{
+		assert(size < number_children_slots);
+		inner_entries_t *consist = consistent();
+		std::copy(keys, keys + size, consist->entries);
+		std::copy(children, children + size + 1, consist->children);
+		std::copy(counts, counts + size + 1, consist->counts);
+		consist->_size = size;
 		assert(std::is_sorted(begin(), end()));
 	}
 
@@ -784,6 +1522,13 @@ public:
 		auto in_cend = std::next(
 			in_cbegin, static_cast<difference_type>(consistent()->_size + 1));
 		std::copy(in_cbegin, in_cend, consistent()->children);
+
+		auto in_counts_begin = std::next(src->consistent()->counts,
+						 std::distance(src->begin(), first));
+		auto in_counts_end = std::next(
+			in_counts_begin,
+			static_cast<difference_type>(consistent()->_size + 1));
+		std::copy(in_counts_begin, in_counts_end, consistent()->counts);
 		assert(std::is_sorted(begin(), end()));
 	}
 
@@ -793,9 +1538,11 @@ public:
 	void update_splitted_child(pool_base &pop, const_reference entry,
 				   persistent_ptr<node_t> &lnode,
 				   persistent_ptr<node_t> &rnode,
-				   const persistent_ptr<node_t> &splitted_node)
+				   const persistent_ptr<node_t> &splitted_node,
+				   uint64_t lcount, uint64_t rcount)
 	{
 		assert(!full());
+		assert(!entry.is_external());
 		iterator partition_point =
 			std::lower_bound(this->begin(), this->end(), entry);
 
@@ -847,6 +1594,23 @@ public:
 			  sizeof(working_copy()->children[0]) *
 				  static_cast<std::size_t>(result_children));
 
+		// Update counts of children
+		auto in_counts_begin = consistent()->counts;
+		auto in_counts_splitted = std::next(
+			in_counts_begin, std::distance(this->begin(), partition_point));
+		auto in_counts_end = std::next(
+			in_counts_begin,
+			static_cast<difference_type>(consistent()->_size + 1));
+		auto out_counts_insert_pos = std::copy(in_counts_begin, in_counts_splitted,
+						       working_copy()->counts);
+		*out_counts_insert_pos++ = lcount;
+		*out_counts_insert_pos++ = rcount;
+		std::copy(++in_counts_splitted, in_counts_end, out_counts_insert_pos);
+
+		pop.flush(working_copy()->counts,
+			  sizeof(working_copy()->counts[0]) *
+				  static_cast<std::size_t>(result_children));
+
 		switch_consistent(pop);
 		assert(std::is_sorted(this->begin(), this->end()));
 	}
@@ -857,6 +1621,172 @@ public:
 		return get_left_child(it);
 	}
 
+	/**
+	 * Return position of the child, in which the given key should be stored.
+	 */
+	size_t child_position(const_reference key) const
+	{
+		auto result = std::distance(
+			this->begin(), std::lower_bound(this->begin(), this->end(), key));
+		assert(result >= 0);
+
+		return static_cast<std::size_t>(result);
+	}
+
+	/**
+	 * Return number of elements stored in the subtree of the child at child_pos.
+	 */
+	uint64_t child_count(size_t child_pos) const
+	{
+		assert(child_pos <= this->size());
+		return this->consistent()->counts[child_pos];
+	}
+
+	/**
+	 * Return number of elements stored in subtrees of children preceding the one
+	 * at child_pos.
+	 */
+	uint64_t count_before(size_t child_pos) const
+	{
+		assert(child_pos <= this->size());
+		const uint64_t *counts = this->consistent()->counts;
+		return std::accumulate(counts, counts + child_pos, uint64_t(0));
+	}
+
+	/**
+	 * Return number of elements stored in the subtree of this node.
+	 */
+	uint64_t total_count() const
+	{
+		const uint64_t *counts = this->consistent()->counts;
+		return std::accumulate(counts, counts + this->size() + 1, uint64_t(0));
+	}
+
+	/**
+	 * Set number of elements stored in the subtree of the child at child_pos.
+	 * The change is not flushed, see b_tree_base::persist_counts().
+	 */
+	void set_child_count(size_t child_pos, uint64_t count)
+	{
+		assert(child_pos <= this->size());
+		uint64_t *counts = this->consistent()->counts;
+		counts[child_pos] = count;
+	}
+
+	/**
+	 * Atomically add delta to number of elements stored in the subtree of the
+	 * child at child_pos. The change is not flushed, see
+	 * b_tree_base::persist_counts().
+	 */
+	void add_child_count(size_t child_pos, int64_t delta)
+	{
+		assert(child_pos <= this->size());
+		uint64_t *counts = this->consistent()->counts;
+		__atomic_fetch_add(&counts[child_pos], static_cast<uint64_t>(delta),
+				   __ATOMIC_RELAXED);
+	}
+
+	/**
+	 * Flush counts of all children, the caller is responsible for draining.
+	 */
+	void flush_counts(pool_base &pop) const
+	{
+		const uint64_t *counts = this->consistent()->counts;
+		pop.flush(counts, (this->size() + 1) * sizeof(counts[0]));
+	}
+
+	/**
+	 * Set number of elements stored in the subtree of the child at child_pos.
+	 * Has to be called within a transaction.
+	 */
+	void set_child_count_tx(size_t child_pos, uint64_t count)
+	{
+		assert(child_pos <= this->size());
+		uint64_t *counts = this->consistent()->counts;
+		transaction::snapshot(&counts[child_pos]);
+		counts[child_pos] = count;
+	}
+
+	/**
+	 * Remove keys and children at positions in the range of [first, last), so
+	 * the child at first - 1 is followed by the one at last. Has to be called
+	 * within a transaction.
+	 */
+	void erase(pool_base &pop, size_t first, size_t last)
+	{
+		assert(first > 0 && first <= last && last <= this->size());
+		const inner_entries_t *in = consistent();
+		inner_entries_t *out = working_copy();
+		size_t size = in->_size;
+
+		std::copy(in->entries + last, in->entries + size,
+			  std::copy(in->entries, in->entries + first, out->entries));
+		std::copy(in->children + last, in->children + size + 1,
+			  std::copy(in->children, in->children + first, out->children));
+		std::copy(in->counts + last, in->counts + size + 1,
+			  std::copy(in->counts, in->counts + first, out->counts));
+		out->_size = size - (last - first);
+		pop.persist(out, sizeof(inner_entries_t));
+
+		transaction::snapshot(&consistent_id);
+		consistent_id = 1 - consistent_id;
+	}
+
+	/**
+	 * Replace children at pos and pos + 1, separated by the key at pos, with
+	 * a single node, which holds count elements. The key at pos is removed. Has
+	 * to be called within a transaction.
+	 */
+	void merge_children(pool_base &pop, size_t pos,
+			    const persistent_ptr<node_t> &node, uint64_t count)
+	{
+		assert(pos < this->size());
+		const inner_entries_t *in = consistent();
+		inner_entries_t *out = working_copy();
+		size_t size = in->_size;
+
+		std::copy(in->entries + pos + 1, in->entries + size,
+			  std::copy(in->entries, in->entries + pos, out->entries));
+		std::copy(in->children, in->children + pos, out->children);
+		std::copy(in->children + pos + 2, in->children + size + 1,
+			  out->children + pos + 1);
+		std::copy(in->counts, in->counts + pos, out->counts);
+		std::copy(in->counts + pos + 2, in->counts + size + 1,
+			  out->counts + pos + 1);
+		out->children[pos] = node;
+		out->counts[pos] = count;
+		out->_size = size - 1;
+		pop.persist(out, sizeof(inner_entries_t));
+
+		transaction::snapshot(&consistent_id);
+		consistent_id = 1 - consistent_id;
+	}
+
+	/**
+	 * Replace children at pos and pos + 1 with the given ones and the key
+	 * separating them with entry. Has to be called within a transaction.
+	 */
+	void replace_children(pool_base &pop, size_t pos, const_reference entry,
+			      const persistent_ptr<node_t> &lnode,
+			      const persistent_ptr<node_t> &rnode, uint64_t lcount,
+			      uint64_t rcount)
+	{
+		assert(pos < this->size());
+		assert(!entry.is_external());
+		inner_entries_t *out = working_copy();
+		*out = *consistent();
+		out->entries[pos] = entry;
+		out->children[pos] = lnode;
+		out->children[pos + 1] = rnode;
+		out->counts[pos] = lcount;
+		out->counts[pos + 1] = rcount;
+		pop.persist(out, sizeof(inner_entries_t));
+
+		transaction::snapshot(&consistent_id);
+		consistent_id = 1 - consistent_id;
+		assert(std::is_sorted(this->begin(), this->end()));
+	}
+
 	const persistent_ptr<node_t> &get_left_child(const_iterator it) const
 	{
 		auto result = std::distance(this->begin(), it);
@@ -877,6 +1807,26 @@ public:
 		return this->size() == number_entrys_slots;
 	}
 
+	/**
+	 * Pointer to the child at child_pos, which is updated by defragmentation
+	 * when the child is relocated.
+	 */
+	PMEMoid *child_oid(size_t child_pos)
+	{
+		assert(child_pos <= this->size());
+		return consistent()->children[child_pos].raw_ptr();
+	}
+
+	/**
+	 * Pointer to out-of-line buffer of the key at pos (or nullptr), which is
+	 * updated by defragmentation when the buffer is relocated.
+	 */
+	PMEMoid *key_oid(size_t pos)
+	{
+		assert(pos < this->size());
+		return consistent()->entries[pos].blob_oid();
+	}
+
 	/**
 	 * Return begin iterator on an array of keys.
 	 */
@@ -966,13 +1916,16 @@ public:
 	{
 	}
 
-	b_tree_iterator(leaf_node_ptr node) : current_node(node), leaf_it(node->begin())
+	b_tree_iterator(leaf_node_ptr node)
+	    : current_node(node), leaf_it(node ? node->begin() : leaf_iterator())
 	{
+		skip_empty_leaves();
 	}
 
 	b_tree_iterator(leaf_node_ptr node, leaf_iterator _leaf_it)
 	    : current_node(node), leaf_it(_leaf_it)
 	{
+		skip_empty_leaves();
 	}
 
 	b_tree_iterator(const b_tree_iterator &other)
@@ -997,13 +1950,7 @@ public:
 	b_tree_iterator &operator++()
 	{
 		++leaf_it;
-		if (leaf_it == current_node->end()) {
-			leaf_node_ptr tmp = current_node->get_next().get();
-			if (tmp) {
-				current_node = tmp;
-				leaf_it = current_node->begin();
-			}
-		}
+		skip_empty_leaves();
 		return *this;
 	}
 
@@ -1017,7 +1964,10 @@ public:
 	b_tree_iterator &operator--()
 	{
 		if (leaf_it == current_node->begin()) {
+			/* a leaf without a sibling is not merged, so it may be empty */
 			leaf_node_ptr tmp = current_node->get_prev().get();
+			while (tmp && tmp->size() == 0)
+				tmp = tmp->get_prev().get();
 			if (tmp) {
 				current_node = tmp;
 				leaf_it = current_node->end();
@@ -1057,6 +2007,26 @@ public:
 	}
 
 private:
+	/*
+	 * Moves an iterator standing at the end of a leaf to the first element of
+	 * the next non-empty leaf. Only underfull leaves with a sibling are merged
+	 * on erase, so some of them may be empty. Stops at the end of the rightmost
+	 * leaf, i.e. at end().
+	 */
+	void skip_empty_leaves()
+	{
+		if (current_node == nullptr)
+			return;
+
+		while (leaf_it == current_node->end()) {
+			leaf_node_ptr tmp = current_node->get_next().get();
+			if (!tmp)
+				break;
+			current_node = tmp;
+			leaf_it = current_node->begin();
+		}
+	}
+
 	leaf_node_ptr current_node;
 	leaf_iterator leaf_it;
 }; // class b_tree_iterator
@@ -1071,6 +2041,12 @@ class b_tree_base {
 	typedef persistent_ptr<leaf_node_type> leaf_node_persistent_ptr;
 	typedef persistent_ptr<inner_node_type> inner_node_persistent_ptr;
 
+	/* part of capacity of nodes filled by bulk_load(), the rest is for inserts */
+	const static size_t bulk_fill_percent = 75;
+
+	/* leaves filled below this part of capacity are merged by erase() */
+	const static size_t merge_fill_percent = 25;
+
 public:
 	typedef b_tree_base<TKey, TValue, degree> self_type;
 	typedef typename leaf_node_type::value_type value_type;
@@ -1113,10 +2089,32 @@ private:
 
 	persistent_ptr<node_t> right_child;
 
+	/**
+	 * Not zero while subtree counts of inner nodes may differ from their
+	 * persistent copies: it is set by the first operation changing counts after
+	 * the tree is opened, and cleared when they are persisted on close. If
+	 * it is not zero after a crash, counts are rebuilt during recovery.
+	 */
+	uint64_t counts_dirty;
+
+	/**
+	 * Entry being inserted by insert(), whose out-of-line data is already
+	 * allocated. If it is set after a crash, the data is freed during recovery,
+	 * unless the entry made it to the tree.
+	 */
+	value_type pending_entry;
+
+	/**
+	 * First leaf built by bulk_load(), until inner nodes are built on top of the
+	 * loaded leaves. If it is set after a crash, they are built during recovery.
+	 */
+	leaf_node_persistent_ptr bulk_head;
+
 	void create_new_root(pool_base &, const key_type &, node_persistent_ptr &,
 			     node_persistent_ptr &);
 
-	std::pair<iterator, bool> insert_descend(pool_base &, const_reference);
+	std::pair<iterator, bool> insert_descend(pool_base &, const_reference,
+						 split_stats *);
 
 	typename inner_node_type::const_iterator split_half(pool_base &pop,
 							    persistent_ptr<node_t> &node,
@@ -1149,7 +2147,9 @@ private:
 		assert(partition_point != cast_inner(split_node)->end());
 		if (parent_node) {
 			parent_node->update_splitted_child(pop, *partition_point, left,
-							   right, split_node);
+							   right, split_node,
+							   subtree_count(left),
+							   subtree_count(right));
 		} else { // Root node is split
 			assert(root == split_node);
 			create_new_root(pop, *partition_point, left, right);
@@ -1161,6 +2161,33 @@ private:
 				 const_reference, persistent_ptr<node_t> &,
 				 persistent_ptr<node_t> &);
 
+	/**
+	 * Return the separator of two adjacent leaves: a key not less than the last
+	 * key of lnode and less than the first key of rnode. If the last key of lnode
+	 * is stored out of line, the shortest prefix of the first key of rnode, which
+	 * meets these conditions, is used instead, as long as it fits in place. This
+	 * way inner nodes can be searched without following pointers.
+	 */
+	static key_type separator(const leaf_node_type *lnode,
+				  const leaf_node_type *rnode)
+	{
+		const key_type &last = lnode->back().first;
+		if (last.is_inline() || rnode->size() == 0)
+			return last;
+
+		const key_type &first = rnode->begin()->first;
+		size_t n = std::min(last.size(), first.size());
+		size_t common = static_cast<size_t>(
+			std::mismatch(last.begin(), last.begin() + n, first.begin())
+				.first -
+			last.begin());
+		if (common + 1 >= first.size())
+			return last;
+
+		key_type prefix(first.data(), common + 1);
+		return prefix.is_inline() ? prefix : last;
+	}
+
 	static bool is_left_node(const leaf_node_type *src_node,
 				 const leaf_node_type *lnode)
 	{
@@ -1218,14 +2245,16 @@ private:
 					correct_leaf_node_links(pop, split_node,
 								left_child, right_child);
 
+					key_type sep = separator(lnode, rnode);
 					if (parent_node) {
 						parent_node->update_splitted_child(
-							pop, lnode->back().first,
-							left_child, right_child,
-							split_node);
+							pop, sep, left_child, right_child,
+							split_node,
+							subtree_count(left_child),
+							subtree_count(right_child));
 					} else {
-						create_new_root(pop, lnode->back().first,
-								left_child, right_child);
+						create_new_root(pop, sep, left_child,
+								right_child);
 					}
 				} else { // Only left child was allocated during split
 					 // before crash
@@ -1288,116 +2317,843 @@ private:
 		pop.persist(lhs);
 	}
 
-	leaf_node_type *find_leaf_node(const key_type &key) const
+	typedef std::vector<inner_node_persistent_ptr> path_type;
+
+	/**
+	 * Return the leaf in which the given key should be stored, without checking
+	 * its consistency. Inner nodes on the way are appended to path (if not null).
+	 * If upper is not null, it is set to the least separator greater than or
+	 * equal to the key (or nullptr if there is none): all keys between the given
+	 * one and *upper are stored in the same leaf. Similarly lower is set to the
+	 * greatest separator less than the key, if it is not null.
+	 */
+	leaf_node_persistent_ptr descend(const key_type &key, path_type *path,
+					 const key_type **upper = nullptr,
+					 const key_type **lower = nullptr) const
 	{
-		if (root == nullptr)
-			return nullptr;
+		assert(root != nullptr);
+		if (upper)
+			*upper = nullptr;
+		if (lower)
+			*lower = nullptr;
 
 		node_persistent_ptr node = root;
 		while (!node->leaf()) {
-			node = cast_inner(node)->get_child(key);
+			inner_node_type *inner = cast_inner(node.get());
+			if (path)
+				path->push_back(cast_inner(node));
+
+			size_t pos = inner->child_position(key);
+			auto it = inner->begin() + pos;
+			if (upper && it != inner->end())
+				*upper = &*it;
+			if (lower && pos > 0)
+				*lower = &*(inner->begin() + (pos - 1));
+			node = inner->get_left_child(it);
 		}
-		leaf_node_type *leaf = cast_leaf(node).get();
-		leaf->check_consistency(epoch);
-		return leaf;
+		return cast_leaf(node);
 	}
 
-	// TODO: merge with previous method
-	typedef std::vector<inner_node_persistent_ptr> path_type;
-	leaf_node_persistent_ptr find_leaf_to_insert(const key_type &key,
-						     path_type &path) const
+	/**
+	 * Return the leaf in which the given key should be stored and its upper
+	 * separator, looked up in the DRAM index of cc if it is enabled, or by a
+	 * descent from the root otherwise. The caller has to hold the tree latch.
+	 */
+	leaf_index::route route(concurrency_control &cc, const key_type &key) const
 	{
 		assert(root != nullptr);
-		node_persistent_ptr node = root;
-		while (!node->leaf()) {
-			path.push_back(cast_inner(node));
+		if (cc.index().enabled())
+			return cc.index().find(key.data(), key.size());
 
-			node = cast_inner(node)->get_child(key);
-		}
-		leaf_node_persistent_ptr leaf = cast_leaf(node);
-		leaf->check_consistency(epoch);
-		return leaf;
+		const key_type *upper;
+		const void *leaf = descend(key, nullptr, &upper).get();
+		if (upper == nullptr)
+			return leaf_index::route{leaf, nullptr, 0, false};
+
+		return leaf_index::route{leaf, upper->data(), upper->size(), true};
 	}
 
-	typename path_type::const_iterator find_full_node(const path_type &path)
+	static leaf_node_type *route_leaf(const leaf_index::route &r)
 	{
-		auto i = path.end() - 1;
-		for (; i > path.begin(); --i) {
-			if (!(*i)->full())
-				return i;
-		}
-		return i;
+		return static_cast<leaf_node_type *>(const_cast<void *>(r.leaf));
 	}
 
-	leaf_node_type *leftmost_leaf() const
+	/**
+	 * Add leaves of the subtree to the index, in the order of keys. The last
+	 * leaf is left in *pending, its upper separator is the one following the
+	 * subtree.
+	 */
+	void index_subtree(leaf_index &index, const node_persistent_ptr &node,
+			   const leaf_node_type **pending) const
 	{
-		if (root == nullptr)
-			return nullptr;
+		if (node->leaf()) {
+			*pending = cast_leaf(node.get());
+			return;
+		}
 
-		node_persistent_ptr node = root;
-		while (!node->leaf()) {
-			inner_node_type *inner_node = cast_inner(node).get();
-			node = inner_node->get_left_child(inner_node->begin());
+		inner_node_type *inner = cast_inner(node.get());
+		for (size_t pos = 0; pos <= inner->size(); ++pos) {
+			auto it = inner->begin() + pos;
+			index_subtree(index, inner->get_left_child(it), pending);
+			if (pos < inner->size())
+				index.append(*pending, it->data(), it->size(), true);
 		}
-		leaf_node_type *leaf = cast_leaf(node).get();
-		leaf->check_consistency(epoch);
-		return leaf;
 	}
 
-	leaf_node_type *rightmost_leaf() const
+	/**
+	 * Update the index after the leaf of the key was split, which has to be
+	 * known from the split counters. Only the new leaves are looked up by
+	 * a descent. Has to be called under the exclusive tree latch.
+	 */
+	void index_leaf_split(leaf_index &index, const key_type &key) const
+	{
+		const key_type *upper, *lower;
+		leaf_node_type *leaf = descend(key, nullptr, &upper, &lower).get();
+		leaf_index::route old = index.find(key.data(), key.size());
+
+		/* the leaf of the key kept the upper separator of the split one */
+		bool right = upper == nullptr
+			? !old.bounded
+			: old.bounded && !leaf_index::less(upper->data(), upper->size(),
+							   old.upper, old.upper_size) &&
+				!leaf_index::less(old.upper, old.upper_size,
+						  upper->data(), upper->size());
+		if (right) {
+			assert(lower != nullptr);
+			index.split(key.data(), key.size(), lower->data(), lower->size(),
+				    leaf->get_prev().get(), leaf);
+		} else {
+			index.split(key.data(), key.size(), upper->data(), upper->size(),
+				    leaf, leaf->get_next().get());
+		}
+	}
+
+	leaf_node_type *find_leaf_node(const key_type &key) const
 	{
 		if (root == nullptr)
 			return nullptr;
 
-		node_persistent_ptr node = root;
-		while (!node->leaf()) {
-			inner_node_type *inner_node = cast_inner(node).get();
-			node = inner_node->get_left_child(inner_node->end());
-		}
-		leaf_node_type *leaf = cast_leaf(node).get();
+		leaf_node_type *leaf = descend(key, nullptr).get();
 		leaf->check_consistency(epoch);
 		return leaf;
 	}
 
-	static persistent_ptr<inner_node_type> &cast_inner(persistent_ptr<node_t> &node)
+	leaf_node_persistent_ptr find_leaf_to_insert(const key_type &key,
+						     path_type &path) const
 	{
-		return reinterpret_cast<persistent_ptr<inner_node_type> &>(node);
+		leaf_node_persistent_ptr leaf = descend(key, &path);
+		leaf->check_consistency(epoch);
+		return leaf;
 	}
 
-	static inner_node_type *cast_inner(node_t *node)
+	/**
+	 * Look the key up in a leaf, which may be concurrently modified by other
+	 * threads holding its lock. The caller must hold the tree latch. See
+	 * concurrent_find() for description of copy.
+	 */
+	template <typename Copy>
+	bool concurrent_find_in_leaf(concurrency_control &cc, leaf_node_type *leaf,
+				     const key_type &key, Copy copy) const
 	{
-		return static_cast<inner_node_type *>(node);
-	}
+		typedef typename leaf_node_type::optimistic_result result_type;
 
-	static persistent_ptr<leaf_node_type> &cast_leaf(persistent_ptr<node_t> &node)
-	{
-		return reinterpret_cast<persistent_ptr<leaf_node_type> &>(node);
+		version_lock &lock = cc.leaf_lock(leaf);
+		if (!leaf->consistent_with(epoch)) {
+			std::lock_guard<version_lock> guard(lock);
+			leaf->check_consistency(epoch);
+		}
+
+		for (;;) {
+			uint64_t version = lock.read_begin();
+			auto validate = [&]() { return lock.read_validate(version); };
+			result_type result = leaf->optimistic_find(key, validate, copy);
+			if (result != result_type::RETRY && validate())
+				return result == result_type::FOUND;
+		}
 	}
 
-	static leaf_node_type *cast_leaf(node_t *node)
+	static bool is_external(const_reference entry)
 	{
-		return static_cast<leaf_node_type *>(node);
+		return entry.first.is_external() || entry.second.is_external();
 	}
 
-	template <typename... Args>
-	inline persistent_ptr<inner_node_type>
-	allocate_inner(pool_base &pop, persistent_ptr<node_t> &node, Args &&... args)
+	/**
+	 * Copy data, to which the entry refers, to persistent memory. Has to be
+	 * called within a transaction.
+	 */
+	static void store_external(value_type &entry)
 	{
-		make_persistent_atomic<inner_node_type>(pop, cast_inner(node), args...);
-		return cast_inner(node);
+		if (entry.first.is_external())
+			entry.first.assign(entry.first.data(), entry.first.size());
+		if (entry.second.is_external())
+			entry.second.assign(entry.second.data(), entry.second.size());
 	}
 
-	template <typename... Args>
-	inline persistent_ptr<leaf_node_type>
-	allocate_leaf(pool_base &pop, persistent_ptr<node_t> &node, Args &&... args)
+	/**
+	 * Returns true if lhs is stored in the same way as rhs, i.e. both are stored
+	 * in place or both share out-of-line buffer.
+	 */
+	template <typename T>
+	static bool same_storage(const T &lhs, const T &rhs)
 	{
-		make_persistent_atomic<leaf_node_type>(pop, cast_leaf(node), epoch,
-						       args...);
-		return cast_leaf(node);
+		return lhs.is_inline() ? rhs.is_inline() : lhs.shares_storage(rhs);
 	}
 
-	inline void deallocate(persistent_ptr<node_t> &node)
-	{
+	/**
+	 * Remove the key from the leaf, freeing its out-of-line data. Key data is
+	 * not freed if it is also used as a separator in an inner node on the path.
+	 */
+	size_t erase_from_leaf(pool_base &pop, const path_type &path, leaf_node_type *leaf,
+			       const key_type &key)
+	{
+		auto leaf_it = leaf->find(key);
+		if (leaf_it == leaf->end())
+			return size_t(0);
+
+		mark_counts_dirty(pop);
+		size_t result;
+		value_type &entry = *leaf_it;
+		if (entry.first.is_inline() && entry.second.is_inline()) {
+			result = leaf->erase(pop, key);
+		} else {
+			bool is_separator = std::any_of(
+				path.begin(), path.end(),
+				[&](const inner_node_persistent_ptr &inner) {
+					auto it = std::lower_bound(inner->begin(),
+								   inner->end(), key);
+					return it != inner->end() &&
+						it->shares_storage(entry.first);
+				});
+			/* the erased slot is left intact, until it is reused */
+			transaction::run(pop, [&] {
+				result = leaf->erase(pop, key);
+				if (!is_separator)
+					entry.first.free_storage();
+				entry.second.free_storage();
+			});
+		}
+		update_path_counts(path, key, -1);
+
+		return result;
+	}
+
+	/**
+	 * Returns true if the leaf, which is not the root, should be merged with
+	 * a sibling.
+	 */
+	static bool underfull(const leaf_node_type *leaf)
+	{
+		return leaf->size() * 100 < number_entrys_slots * merge_fill_percent;
+	}
+
+	/**
+	 * Merge the child of the parent, in which the key is stored, with its
+	 * sibling, if the child is an inner node filled below merge_fill_percent and
+	 * both fit in a node filled up to bulk_fill_percent. The separator of both
+	 * is moved down to the merged node. Has to be called within a transaction.
+	 * Returns true if the nodes were merged.
+	 */
+	bool merge_inner(pool_base &pop, inner_node_type *parent, const key_type &key)
+	{
+		size_t pos = parent->child_position(key);
+		inner_node_type *child =
+			cast_inner(parent->get_left_child(parent->begin() + pos).get());
+		if (parent->size() == 0 ||
+		    child->size() * 100 >= number_entrys_slots * merge_fill_percent)
+			return false;
+
+		if (pos == parent->size())
+			--pos;
+		inner_node_persistent_ptr lnode = cast_inner(
+			parent->get_left_child(parent->begin() + pos).get());
+		inner_node_persistent_ptr rnode = cast_inner(
+			parent->get_left_child(parent->begin() + pos + 1).get());
+		const size_t size = lnode->size() + 1 + rnode->size();
+		if (size * 100 > number_entrys_slots * bulk_fill_percent)
+			return false;
+
+		std::vector<key_type> keys;
+		std::vector<node_persistent_ptr> children;
+		std::vector<uint64_t> counts;
+		for (inner_node_type *src : {lnode.get(), rnode.get()}) {
+			if (src == rnode.get())
+				keys.push_back((*parent)[pos]);
+			keys.insert(keys.end(), src->begin(), src->end());
+			for (size_t i = 0; i <= src->size(); ++i) {
+				children.push_back(src->get_left_child(src->begin() + i));
+				counts.push_back(src->child_count(i));
+			}
+		}
+
+		auto merged = make_persistent<inner_node_type>(
+			inner_flag(), lnode->level(), keys.data(), children.data(),
+			counts.data(), size);
+		parent->merge_children(pop, pos, merged, merged->total_count());
+		deallocate_inner(lnode);
+		deallocate_inner(rnode);
+
+		return true;
+	}
+
+	/**
+	 * Merge underfull inner nodes on the path to the key, bottom-up, and replace
+	 * an inner root with a single child by the child. Has to be called within
+	 * a transaction. Returns true if the tree was modified.
+	 */
+	bool merge_path(pool_base &pop, const path_type &path, const key_type &key)
+	{
+		bool modified = false;
+		for (size_t level = path.size() - 1; level > 0; --level) {
+			if (!merge_inner(pop, path[level - 1].get(), key))
+				break;
+			modified = true;
+		}
+
+		while (!root->leaf() && cast_inner(root.get())->size() == 0) {
+			inner_node_persistent_ptr old_root = cast_inner(root);
+			transaction::snapshot(&root);
+			root = old_root->get_left_child(old_root->begin());
+			deallocate_inner(old_root);
+			modified = true;
+		}
+
+		return modified;
+	}
+
+	/**
+	 * Merge the leaf of the key, if it is underfull, with its sibling under the
+	 * same parent, if both fit in a leaf filled up to bulk_fill_percent.
+	 * Otherwise elements of both are spread evenly over two leaves. Elements are
+	 * copied to new leaves (sharing out-of-line data) and the old ones are
+	 * freed, while the parent switches to them with a new separator, in
+	 * a single transaction, so there is nothing to repair after a crash. After
+	 * a merge, underfull inner nodes on the path are merged as well and an inner
+	 * root left with a single child is replaced by it. The index is
+	 * updated if it is enabled. Returns true if the tree was modified.
+	 */
+	bool rebalance_leaf(pool_base &pop, const key_type &key, leaf_index *index,
+			    split_stats *stats)
+	{
+		if (root == nullptr)
+			return false;
+
+		path_type path;
+		leaf_node_type *leaf = find_leaf_to_insert(key, path).get();
+		if (path.empty() || !underfull(leaf))
+			return false;
+
+		/* the only child of its parent, which may be merged with a sibling */
+		bool modified = false;
+		if (path.back()->size() == 0) {
+			transaction::run(pop,
+					 [&] { modified = merge_path(pop, path, key); });
+			return modified;
+		}
+
+		inner_node_type *parent = path.back().get();
+		size_t pos = parent->child_position(key);
+		if (pos == parent->size())
+			--pos;
+		leaf_node_type *lleaf =
+			cast_leaf(parent->get_left_child(parent->begin() + pos).get());
+		leaf_node_type *rleaf = cast_leaf(
+			parent->get_left_child(parent->begin() + pos + 1).get());
+		lleaf->check_consistency(epoch);
+		rleaf->check_consistency(epoch);
+
+		const size_t total = lleaf->size() + rleaf->size();
+		const bool merge =
+			total * 100 <= number_entrys_slots * bulk_fill_percent;
+		key_type old_sep = (*parent)[pos];
+		const std::string old_index_key(old_sep.data(), old_sep.size());
+
+		leaf_node_persistent_ptr lnode, rnode;
+		transaction::run(pop, [&] {
+			/* the right leaf is left empty for a merge */
+			const size_t lsize = merge ? total : total / 2;
+			lnode = make_persistent<leaf_node_type>(leaf_flag(), epoch);
+			rnode = merge ? nullptr
+				      : make_persistent<leaf_node_type>(leaf_flag(),
+									epoch);
+			bool shared = false;
+			for (leaf_node_type *src : {lleaf, rleaf}) {
+				for (const_reference entry : *src) {
+					auto &dst = lnode->size() < lsize ? lnode : rnode;
+					dst->append(entry);
+					shared = shared ||
+						entry.first.shares_storage(old_sep);
+				}
+			}
+
+			leaf_node_persistent_ptr last = merge ? lnode : rnode;
+			lnode->set_prev(lleaf->get_prev());
+			last->set_next(rleaf->get_next());
+			if (!merge) {
+				lnode->set_next(rnode);
+				rnode->set_prev(lnode);
+			}
+			if (lleaf->get_prev() != nullptr) {
+				transaction::snapshot(&lleaf->get_prev()->get_next());
+				lleaf->get_prev()->set_next(lnode);
+			}
+			if (rleaf->get_next() != nullptr) {
+				transaction::snapshot(&rleaf->get_next()->get_prev());
+				rleaf->get_next()->set_prev(last);
+			}
+
+			if (merge)
+				parent->merge_children(pop, pos, lnode, total);
+			else
+				parent->replace_children(
+					pop, pos, separator(lnode.get(), rnode.get()),
+					lnode, rnode, lnode->size(), rnode->size());
+			/* the separator may outlive the element it was taken from */
+			if (!shared)
+				old_sep.free_storage();
+
+			leaf_node_persistent_ptr lold(lleaf), rold(rleaf);
+			deallocate_leaf(lold);
+			deallocate_leaf(rold);
+
+			if (merge)
+				merge_path(pop, path, key);
+		});
+
+		if (index && index->enabled()) {
+			if (merge) {
+				index->merge(old_index_key.data(), old_index_key.size(),
+					     lnode.get());
+			} else {
+				const key_type &sep = (*parent)[pos];
+				index->rebalance(old_index_key.data(),
+						 old_index_key.size(), sep.data(),
+						 sep.size(), lnode.get(), rnode.get());
+			}
+		}
+		if (stats)
+			(merge ? stats->leaf_merges : stats->leaf_rebalances)
+				.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	/**
+	 * Elements and nodes removed by erase_range(), which are freed once the
+	 * tree no longer refers to them, separators in the range of erased keys
+	 * which are still used and out-of-line separators removed with the nodes.
+	 */
+	struct erased_range_t {
+		std::vector<value_type *> entries;
+		std::vector<node_persistent_ptr> nodes;
+		std::vector<const key_type *> separators;
+		std::vector<key_type> dropped;
+	};
+
+	/**
+	 * Return the leftmost (if leftmost is set) or the rightmost leaf of the
+	 * subtree.
+	 */
+	static leaf_node_type *edge_leaf(const node_persistent_ptr &subtree,
+					 bool leftmost)
+	{
+		node_t *node = subtree.get();
+		while (!node->leaf()) {
+			inner_node_type *inner = cast_inner(node);
+			auto it = leftmost ? inner->begin() : inner->end();
+			node = inner->get_left_child(it).get();
+		}
+		return cast_leaf(node);
+	}
+
+	/**
+	 * Collect out-of-line separators of the inner node at positions in the range
+	 * of [first, last), which are about to be removed.
+	 */
+	static void drop_separators(inner_node_type *inner, size_t first, size_t last,
+				    erased_range_t &erased)
+	{
+		for (size_t pos = first; pos < last; ++pos) {
+			const key_type &sep = (*inner)[pos];
+			if (!sep.is_inline())
+				erased.dropped.push_back(sep);
+		}
+	}
+
+	/**
+	 * Collect all elements and nodes of the subtree.
+	 */
+	void drop_subtree(const node_persistent_ptr &node, erased_range_t &erased)
+	{
+		if (node->leaf()) {
+			leaf_node_type *leaf = cast_leaf(node.get());
+			leaf->check_consistency(epoch);
+			for (auto it = leaf->begin(); it != leaf->end(); ++it)
+				erased.entries.push_back(&*it);
+		} else {
+			inner_node_type *inner = cast_inner(node.get());
+			drop_separators(inner, 0, inner->size(), erased);
+			for (size_t pos = 0; pos <= inner->size(); ++pos)
+				drop_subtree(inner->get_left_child(inner->begin() + pos),
+					     erased);
+		}
+		erased.nodes.push_back(node);
+	}
+
+	/**
+	 * Remove elements with keys in the range of [lo, hi) from the subtree of the
+	 * node. Subtrees of inner nodes which are entirely in the range are dropped
+	 * as a whole. Returns number of elements left in the subtree. Has to be
+	 * called within a transaction.
+	 */
+	uint64_t erase_range(pool_base &pop, const node_persistent_ptr &node,
+			     const key_type &lo, const key_type &hi,
+			     erased_range_t &erased)
+	{
+		if (node->leaf()) {
+			leaf_node_type *leaf = cast_leaf(node.get());
+			leaf->check_consistency(epoch);
+			leaf->erase_range(pop, lo, hi, [&](value_type &entry) {
+				erased.entries.push_back(&entry);
+			});
+			return leaf->size();
+		}
+
+		inner_node_type *inner = cast_inner(node.get());
+		size_t first = inner->child_position(lo);
+		size_t last = inner->child_position(hi);
+		node_persistent_ptr left = inner->get_left_child(inner->begin() + first);
+		node_persistent_ptr right = inner->get_left_child(inner->begin() + last);
+		if (last > first + 1) {
+			for (size_t pos = first + 1; pos < last; ++pos)
+				drop_subtree(inner->get_left_child(inner->begin() + pos),
+					     erased);
+			drop_separators(inner, first + 1, last, erased);
+			inner->erase(pop, first + 1, last);
+
+			leaf_node_type *lleaf = edge_leaf(left, false);
+			leaf_node_type *rleaf = edge_leaf(right, true);
+			transaction::snapshot(&lleaf->get_next());
+			lleaf->set_next(rleaf);
+			transaction::snapshot(&rleaf->get_prev());
+			rleaf->set_prev(lleaf);
+		}
+
+		for (auto it = std::lower_bound(inner->begin(), inner->end(), lo);
+		     it != inner->end() && *it < hi; ++it) {
+			if (!it->is_inline())
+				erased.separators.push_back(&*it);
+		}
+
+		uint64_t count = erase_range(pop, left, lo, hi, erased);
+		inner->set_child_count_tx(first, count);
+		if (last > first) {
+			count = erase_range(pop, right, lo, hi, erased);
+			inner->set_child_count_tx(first + 1, count);
+		}
+
+		return inner->total_count();
+	}
+
+	/**
+	 * Collect pointers to leaves from their parents, in the order of keys, and
+	 * all inner nodes.
+	 */
+	void collect_leaf_oids(inner_node_type *inner, std::vector<PMEMoid *> &leaves,
+			       std::vector<inner_node_type *> &inners)
+	{
+		inners.push_back(inner);
+		for (size_t pos = 0; pos <= inner->size(); ++pos) {
+			auto &child = inner->get_left_child(inner->begin() + pos);
+			if (child->leaf())
+				leaves.push_back(inner->child_oid(pos));
+			else
+				collect_leaf_oids(cast_inner(child.get()), leaves,
+						  inners);
+		}
+	}
+
+	typename path_type::const_iterator find_full_node(const path_type &path)
+	{
+		auto i = path.end() - 1;
+		for (; i > path.begin(); --i) {
+			if (!(*i)->full())
+				return i;
+		}
+		return i;
+	}
+
+	/* values of counts_dirty, other than 0 */
+	static const uint64_t COUNTS_MARKING = 1;
+	static const uint64_t COUNTS_DIRTY = 2;
+
+	/**
+	 * Has to be called before counts are changed. Only the first call after
+	 * the tree is opened persists counts_dirty, the others wait until it does.
+	 */
+	void mark_counts_dirty(pool_base &pop)
+	{
+		uint64_t state = __atomic_load_n(&counts_dirty, __ATOMIC_ACQUIRE);
+		if (state == COUNTS_DIRTY)
+			return;
+
+		uint64_t clean = 0;
+		if (__atomic_compare_exchange_n(&counts_dirty, &clean, COUNTS_MARKING,
+						false, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			pop.persist(&counts_dirty, sizeof(counts_dirty));
+			__atomic_store_n(&counts_dirty, COUNTS_DIRTY, __ATOMIC_RELEASE);
+			return;
+		}
+
+		while (__atomic_load_n(&counts_dirty, __ATOMIC_ACQUIRE) != COUNTS_DIRTY)
+			std::this_thread::yield();
+	}
+
+	/**
+	 * Persist counts of the subtree of the given inner node. Children of a node
+	 * are all leaves or all inner nodes.
+	 */
+	void flush_counts(pool_base &pop, inner_node_type *inner)
+	{
+		inner->flush_counts(pop);
+		if (inner->get_left_child(inner->begin())->leaf())
+			return;
+
+		for (size_t pos = 0; pos <= inner->size(); ++pos) {
+			auto child = inner->get_left_child(inner->begin() + pos);
+			flush_counts(pop, cast_inner(child.get()));
+		}
+	}
+
+	/**
+	 * Return number of elements stored in the subtree of the given node.
+	 */
+	uint64_t subtree_count(const node_persistent_ptr &node) const
+	{
+		if (node->leaf()) {
+			leaf_node_type *leaf = cast_leaf(node.get());
+			leaf->check_consistency(epoch);
+			return leaf->size();
+		}
+
+		return cast_inner(node.get())->total_count();
+	}
+
+	/**
+	 * Add delta to counts of all children on the path to the given key.
+	 */
+	void update_path_counts(const path_type &path, const key_type &key, int64_t delta)
+	{
+		for (auto &inner : path)
+			inner->add_child_count(inner->child_position(key), delta);
+	}
+
+	/**
+	 * Recompute counts of all children on the path to the given key, bottom-up.
+	 */
+	void recount_path(const key_type &key)
+	{
+		path_type path;
+		find_leaf_to_insert(key, path);
+
+		for (auto it = path.rbegin(); it != path.rend(); ++it) {
+			inner_node_type *inner = it->get();
+			size_t pos = inner->child_position(key);
+			auto child = inner->get_left_child(inner->begin() + pos);
+			inner->set_child_count(pos, subtree_count(child));
+		}
+	}
+
+	/**
+	 * Recompute counts of the whole subtree of the given node.
+	 */
+	uint64_t rebuild_counts(const node_persistent_ptr &node)
+	{
+		if (node->leaf())
+			return subtree_count(node);
+
+		inner_node_type *inner = cast_inner(node.get());
+		uint64_t total = 0;
+		for (size_t pos = 0; pos <= inner->size(); ++pos) {
+			auto child = inner->get_left_child(inner->begin() + pos);
+			uint64_t cnt = rebuild_counts(child);
+			inner->set_child_count(pos, cnt);
+			total += cnt;
+		}
+
+		return total;
+	}
+
+	/**
+	 * Return number of elements less than (or equal to, if inclusive is set)
+	 * the given key.
+	 */
+	uint64_t count_less(const key_type &key, bool inclusive) const
+	{
+		if (root == nullptr)
+			return 0;
+
+		uint64_t result = 0;
+		node_persistent_ptr node = root;
+		while (!node->leaf()) {
+			inner_node_type *inner = cast_inner(node.get());
+			size_t pos = inner->child_position(key);
+			result += inner->count_before(pos);
+			node = inner->get_left_child(inner->begin() + pos);
+		}
+
+		leaf_node_type *leaf = cast_leaf(node.get());
+		leaf->check_consistency(epoch);
+		auto leaf_it = inclusive ? leaf->upper_bound(key) : leaf->lower_bound(key);
+		auto in_leaf = std::distance(leaf->begin(), leaf_it);
+		assert(in_leaf >= 0);
+
+		return result + static_cast<uint64_t>(in_leaf);
+	}
+
+	/**
+	 * Reset pending_entry, so that its storage kind words never get torn: value
+	 * first, then key.
+	 */
+	/**
+	 * Build inner nodes on top of leaves linked from bulk_head, each filled up
+	 * to bulk_fill_percent of its capacity, and make them the tree, in a single
+	 * transaction.
+	 */
+	void build_bulk_inner_nodes(pool_base &pop)
+	{
+		assert(root == nullptr);
+		const size_t fill = std::max<size_t>(
+			3, number_children_slots * bulk_fill_percent / 100);
+
+		std::vector<node_persistent_ptr> children;
+		std::vector<uint64_t> counts;
+		/* seps[i] separates subtrees of children[i] and children[i + 1] */
+		std::vector<key_type> seps;
+		for (auto leaf = bulk_head; leaf != nullptr; leaf = leaf->get_next()) {
+			if (!children.empty())
+				seps.push_back(separator(
+					cast_leaf(children.back().get()), leaf.get()));
+			children.emplace_back(leaf);
+			counts.push_back(leaf->size());
+		}
+
+		transaction::run(pop, [&] {
+			for (uint64_t level = 1; children.size() > 1; ++level) {
+				/* spread children evenly, each node gets at least two */
+				const size_t count = children.size();
+				const size_t nodes = (count + fill - 1) / fill;
+				std::vector<node_persistent_ptr> upper;
+				std::vector<uint64_t> upper_counts;
+				std::vector<key_type> upper_seps;
+				for (size_t n = 0, first = 0; n < nodes; ++n) {
+					const size_t last = count * (n + 1) / nodes;
+					assert(last - first >= 2);
+					auto inner = make_persistent<inner_node_type>(
+						inner_flag(), level, &seps[first],
+						&children[first], &counts[first],
+						last - first - 1);
+					upper.emplace_back(inner);
+					upper_counts.push_back(inner->total_count());
+					if (last < count)
+						upper_seps.push_back(seps[last - 1]);
+					first = last;
+				}
+				children.swap(upper);
+				counts.swap(upper_counts);
+				seps.swap(upper_seps);
+			}
+
+			transaction::snapshot(&root);
+			transaction::snapshot(&bulk_head);
+			if (!children.empty())
+				root = children.front();
+			bulk_head = nullptr;
+		});
+	}
+
+	void clear_pending_entry(pool_base &pop)
+	{
+		pending_entry.second = mapped_type();
+		pop.persist(&pending_entry.second, sizeof(pending_entry.second));
+		pending_entry.first = key_type();
+		pop.persist(&pending_entry.first, sizeof(pending_entry.first));
+	}
+
+	leaf_node_type *leftmost_leaf() const
+	{
+		if (root == nullptr)
+			return nullptr;
+
+		node_persistent_ptr node = root;
+		while (!node->leaf()) {
+			inner_node_type *inner_node = cast_inner(node).get();
+			node = inner_node->get_left_child(inner_node->begin());
+		}
+		leaf_node_type *leaf = cast_leaf(node).get();
+		leaf->check_consistency(epoch);
+		return leaf;
+	}
+
+	leaf_node_type *rightmost_leaf() const
+	{
+		if (root == nullptr)
+			return nullptr;
+
+		node_persistent_ptr node = root;
+		while (!node->leaf()) {
+			inner_node_type *inner_node = cast_inner(node).get();
+			node = inner_node->get_left_child(inner_node->end());
+		}
+		leaf_node_type *leaf = cast_leaf(node).get();
+		leaf->check_consistency(epoch);
+		return leaf;
+	}
+
+	static persistent_ptr<inner_node_type> &cast_inner(persistent_ptr<node_t> &node)
+	{
+		return reinterpret_cast<persistent_ptr<inner_node_type> &>(node);
+	}
+
+	static inner_node_type *cast_inner(node_t *node)
+	{
+		return static_cast<inner_node_type *>(node);
+	}
+
+	static persistent_ptr<leaf_node_type> &cast_leaf(persistent_ptr<node_t> &node)
+	{
+		return reinterpret_cast<persistent_ptr<leaf_node_type> &>(node);
+	}
+
+	static leaf_node_type *cast_leaf(node_t *node)
+	{
+		return static_cast<leaf_node_type *>(node);
+	}
+
+	template <typename... Args>
+	inline persistent_ptr<inner_node_type>
+	allocate_inner(pool_base &pop, persistent_ptr<node_t> &node, Args &&... args)
+	{
+		pmem::obj::allocation_flag_atomic flag(
+			node_alloc_flags<inner_node_type>());
+		make_persistent_atomic<inner_node_type>(pop, cast_inner(node), flag,
+							args...);
+		return cast_inner(node);
+	}
+
+	template <typename... Args>
+	inline persistent_ptr<leaf_node_type>
+	allocate_leaf(pool_base &pop, persistent_ptr<node_t> &node, Args &&... args)
+	{
+		pmem::obj::allocation_flag_atomic flag(
+			node_alloc_flags<leaf_node_type>());
+		make_persistent_atomic<leaf_node_type>(pop, cast_leaf(node), flag, epoch,
+						       args...);
+		return cast_leaf(node);
+	}
+
+	inline void deallocate(persistent_ptr<node_t> &node)
+	{
 		if (node == nullptr)
 			return;
 
@@ -1433,12 +3189,46 @@ private:
 		return pool_base(get_objpool());
 	}
 
+	/* flags allocating a node from its class, if the engine registered one */
+	template <typename Node>
+	uint64_t node_alloc_flags()
+	{
+		return pmem::kv::internal::alloc_classes::flags(get_objpool(),
+								sizeof(Node));
+	}
+
+	pmem::obj::allocation_flag leaf_flag()
+	{
+		return pmem::obj::allocation_flag(node_alloc_flags<leaf_node_type>());
+	}
+
+	pmem::obj::allocation_flag inner_flag()
+	{
+		return pmem::obj::allocation_flag(node_alloc_flags<inner_node_type>());
+	}
+
 public:
-	b_tree_base() : epoch(0)
+	b_tree_base() : epoch(0), counts_dirty(0), pending_entry()
+	{
+	}
+
+	/* sizes of nodes, for the allocation classes of the pool */
+	static constexpr size_t leaf_node_size()
 	{
+		return sizeof(leaf_node_type);
 	}
 
-	std::pair<iterator, bool> insert(const_reference entry)
+	static constexpr size_t inner_node_size()
+	{
+		return sizeof(inner_node_type);
+	}
+
+	/**
+	 * Inserts the entry, if its key is not present yet. Nodes split on the way
+	 * are counted in *splits*, if it is set.
+	 */
+	std::pair<iterator, bool> insert(const_reference entry,
+					 split_stats *splits = nullptr)
 	{
 		auto pop = get_pool_base();
 
@@ -1447,11 +3237,85 @@ public:
 		}
 		assert(root != nullptr);
 
-		std::pair<iterator, bool> ret = insert_descend(pop, entry);
+		if (!is_external(entry))
+			return insert_descend(pop, entry, splits);
+
+		/* out-of-line data is allocated only if the key is not present */
+		iterator it = find(entry.first);
+		if (it != end())
+			return std::pair<iterator, bool>(it, false);
+
+		transaction::run(pop, [&] {
+			transaction::snapshot(&pending_entry);
+			pending_entry = entry;
+			store_external(pending_entry);
+		});
+
+		std::pair<iterator, bool> ret =
+			insert_descend(pop, pending_entry, splits);
+		assert(ret.second);
+		clear_pending_entry(pop);
 
 		return ret;
 	}
 
+	/**
+	 * Build the tree of entries set by next(entry), until it returns false. The
+	 * entries have to be sorted by key and their out-of-line data has to stay
+	 * valid until the following call of next(). Leaves are filled up to
+	 * bulk_fill_percent of their capacity and linked one by one, each in a
+	 * transaction, then inner nodes are built on top of them. If next() throws,
+	 * the tree consists of entries loaded before.
+	 *
+	 * Returns false, without calling next(), if the tree is not empty.
+	 */
+	template <typename Next>
+	bool bulk_load(Next next)
+	{
+		if (root != nullptr)
+			return false;
+
+		assert(bulk_head == nullptr);
+		auto pop = get_pool_base();
+		const size_t leaf_fill = std::max<size_t>(
+			1, number_entrys_slots * bulk_fill_percent / 100);
+
+		try {
+			value_type entry;
+			leaf_node_persistent_ptr leaf, last;
+			bool more = next(entry);
+			while (more) {
+				transaction::run(pop, [&] {
+					leaf = make_persistent<leaf_node_type>(
+						leaf_flag(), epoch);
+					do {
+						store_external(entry);
+						leaf->append(entry);
+					} while (leaf->size() < leaf_fill &&
+						 (more = next(entry)));
+
+					if (last != nullptr) {
+						leaf->set_prev(last);
+						transaction::snapshot(&last->get_next());
+						last->set_next(leaf);
+					} else {
+						transaction::snapshot(&bulk_head);
+						bulk_head = leaf;
+					}
+				});
+				last = leaf;
+				if (more)
+					more = next(entry);
+			}
+		} catch (...) {
+			build_bulk_inner_nodes(pop);
+			throw;
+		}
+		build_bulk_inner_nodes(pop);
+
+		return true;
+	}
+
 	iterator find(const key_type &key)
 	{
 		leaf_node_type *leaf = find_leaf_node(key);
@@ -1494,8 +3358,6 @@ public:
 			return end();
 
 		typename leaf_node_type::iterator leaf_it = leaf->lower_bound(key);
-		if (leaf->end() == leaf_it)
-			return end();
 
 		return iterator(leaf, leaf_it);
 	}
@@ -1516,8 +3378,6 @@ public:
 			return end();
 
 		typename leaf_node_type::const_iterator leaf_it = leaf->lower_bound(key);
-		if (leaf->end() == leaf_it)
-			return end();
 
 		return const_iterator(leaf, leaf_it);
 	}
@@ -1538,8 +3398,6 @@ public:
 			return end();
 
 		typename leaf_node_type::iterator leaf_it = leaf->upper_bound(key);
-		if (leaf->end() == leaf_it)
-			return end();
 
 		return iterator(leaf, leaf_it);
 	}
@@ -1560,23 +3418,607 @@ public:
 			return end();
 
 		typename leaf_node_type::const_iterator leaf_it = leaf->upper_bound(key);
-		if (leaf->end() == leaf_it)
-			return end();
 
 		return const_iterator(leaf, leaf_it);
 	}
 
+	/**
+	 * Looks the element with the given key up and calls copy() for its value.
+	 * Returns false if there is no such element.
+	 *
+	 * The concurrent_* methods can be called from many threads at the same time.
+	 * Lookups are optimistic: they do not write to shared memory and retry if a
+	 * leaf was modified while it was read. Because of that, copy() may be called
+	 * more than once and may see values being modified: it should only copy the
+	 * value, the copy made by the last call is the valid one.
+	 */
+	template <typename Copy>
+	bool concurrent_find(concurrency_control &cc, const key_type &key,
+			     Copy copy) const
+	{
+		tree_latch::shared_guard shared(cc.latch());
+		if (root == nullptr || !cc.filter().may_contain(key.data(), key.size()))
+			return false;
+
+		return concurrent_find_in_leaf(cc, route_leaf(route(cc, key)), key, copy);
+	}
+
+	/**
+	 * Looks up all keys from the sorted range [first, last). Consecutive keys which
+	 * are stored in the same leaf share a single descent from the root.
+	 *
+	 * @param[in] copy function called for values of found keys, as described in
+	 * concurrent_find()
+	 * @param[in] f function called for every key with its offset in the range and
+	 * a flag whether it was found (its value is the one copied last)
+	 */
+	template <typename InputIt, typename Copy, typename Function>
+	void concurrent_find_sorted(concurrency_control &cc, InputIt first, InputIt last,
+				    Copy copy, Function f) const
+	{
+		assert(std::is_sorted(first, last));
+
+		tree_latch::shared_guard shared(cc.latch());
+		leaf_node_type *leaf = nullptr;
+		leaf_index::route r{nullptr, nullptr, 0, false};
+		for (size_t pos = 0; first != last; ++first, ++pos) {
+			const key_type &key = *first;
+			if (root == nullptr ||
+			    !cc.filter().may_contain(key.data(), key.size())) {
+				f(pos, false);
+				continue;
+			}
+
+			/*
+			 * All keys not greater than the upper separator of the current
+			 * leaf (and not less than the previous key) are routed to it.
+			 */
+			if (leaf == nullptr ||
+			    (r.bounded &&
+			     leaf_index::less(r.upper, r.upper_size, key.data(),
+					      key.size()))) {
+				r = route(cc, key);
+				leaf = route_leaf(r);
+			}
+
+			f(pos, concurrent_find_in_leaf(cc, leaf, key, copy));
+		}
+	}
+
+	/**
+	 * Calls copy() for the elements greater than the key (or not less, if
+	 * inclusive is set), in order, from the first leaf which has any of them.
+	 * Returns false if there are no such elements. A range is read by calling
+	 * it again with the last copied key. The leaf is locked while it is read,
+	 * so copy() sees a consistent state of it and should only copy the element.
+	 */
+	template <typename Copy>
+	bool concurrent_scan_leaf(concurrency_control &cc, const key_type &key,
+				  bool inclusive, Copy copy) const
+	{
+		tree_latch::shared_guard shared(cc.latch());
+		if (root == nullptr)
+			return false;
+
+		for (leaf_node_type *leaf = route_leaf(route(cc, key)); leaf != nullptr;
+		     leaf = leaf->get_next().get()) {
+			std::lock_guard<version_lock> guard(cc.leaf_lock(leaf));
+			leaf->check_consistency(epoch);
+
+			bool found = false;
+			for (const_reference entry : *leaf) {
+				bool after = key < entry.first ||
+					(inclusive && !(entry.first < key));
+				if (after) {
+					copy(entry);
+					found = true;
+				}
+			}
+			if (found)
+				return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 * Inserts the entry, if there is no element with the same key. Otherwise,
+	 * calls update with the existing element, while holding the lock of its leaf.
+	 * Returns true if the entry was inserted.
+	 *
+	 * Threads inserting to different leaves do not block each other, splitting
+	 * a leaf requires exclusive access to the tree.
+	 */
+	template <typename Function>
+	bool concurrent_insert(concurrency_control &cc, const_reference entry,
+			       Function update)
+	{
+		auto pop = get_pool_base();
+		{
+			tree_latch::shared_guard shared(cc.latch());
+			/* lookups of the key may find it once it is inserted */
+			cc.filter().add(entry.first.data(), entry.first.size());
+			if (root != nullptr) {
+				path_type path;
+				leaf_node_type *leaf = descend(entry.first, &path).get();
+				std::lock_guard<version_lock> guard(cc.leaf_lock(leaf));
+				leaf->check_consistency(epoch);
+
+				auto leaf_it = leaf->find(entry.first);
+				if (leaf_it != leaf->end()) {
+					update(*leaf_it);
+					return false;
+				}
+
+				if (!leaf->full()) {
+					mark_counts_dirty(pop);
+					if (is_external(entry)) {
+						transaction::run(pop, [&] {
+							value_type stored = entry;
+							store_external(stored);
+							leaf->insert(pop, stored);
+						});
+					} else {
+						leaf->insert(pop, entry);
+					}
+					update_path_counts(path, entry.first, 1);
+					return true;
+				}
+			}
+		}
+
+		std::lock_guard<tree_latch> exclusive(cc.latch());
+		/* the filter may have been rebuilt since the key was added */
+		cc.filter().add(entry.first.data(), entry.first.size());
+		uint64_t leaf_splits = cc.splits().leaves.load();
+		auto ret = insert(entry, &cc.splits());
+		if (!ret.second)
+			update(*ret.first);
+
+		leaf_index &index = cc.index();
+		if (index.enabled()) {
+			if (index.empty())
+				build_index(cc);
+			else if (cc.splits().leaves.load() != leaf_splits)
+				index_leaf_split(index, entry.first);
+		}
+		if (cc.filter().enabled() && cc.filter().overfull())
+			build_filter(cc);
+
+		return ret.second;
+	}
+
+	/**
+	 * Finds the element with the given key and keeps it in place: the tree latch
+	 * is held in shared mode and the element's leaf is locked. If the element is
+	 * found, the caller has to release both with concurrent_unpin(), from the
+	 * same thread and without calling other concurrent_* methods meanwhile.
+	 * Otherwise nothing is held and nullptr is returned.
+	 */
+	const_pointer concurrent_pin(concurrency_control &cc, const key_type &key,
+				     version_lock **lock)
+	{
+		cc.latch().lock_shared();
+		if (root != nullptr && cc.filter().may_contain(key.data(), key.size())) {
+			leaf_node_type *leaf = route_leaf(route(cc, key));
+			version_lock &leaf_lock = cc.leaf_lock(leaf);
+			leaf_lock.lock();
+			leaf->check_consistency(epoch);
+
+			auto it = leaf->find(key);
+			if (it != leaf->end()) {
+				*lock = &leaf_lock;
+				return &*it;
+			}
+			leaf_lock.unlock();
+		}
+		cc.latch().unlock_shared();
+
+		return nullptr;
+	}
+
+	void concurrent_unpin(concurrency_control &cc, version_lock *lock)
+	{
+		lock->unlock();
+		cc.latch().unlock_shared();
+	}
+
+	/**
+	 * Removes the element with the given key. Can be called concurrently with
+	 * other concurrent_* methods. An underfull leaf is merged with its sibling
+	 * (see rebalance_leaf()) under the exclusive tree latch.
+	 */
+	size_t concurrent_erase(concurrency_control &cc, const key_type &key)
+	{
+		auto pop = get_pool_base();
+		{
+			tree_latch::shared_guard shared(cc.latch());
+			if (root == nullptr ||
+			    !cc.filter().may_contain(key.data(), key.size()))
+				return size_t(0);
+
+			path_type path;
+			leaf_node_type *leaf = descend(key, &path).get();
+			std::lock_guard<version_lock> guard(cc.leaf_lock(leaf));
+			leaf->check_consistency(epoch);
+
+			if (erase_from_leaf(pop, path, leaf, key) == 0)
+				return size_t(0);
+			if (path.empty() || !underfull(leaf))
+				return size_t(1);
+		}
+
+		/* the leaf is looked up again, it may have been merged meanwhile */
+		std::lock_guard<tree_latch> exclusive(cc.latch());
+		rebalance_leaf(pop, key, &cc.index(), &cc.splits());
+		return size_t(1);
+	}
+
 	size_t erase(const key_type &key)
 	{
-		leaf_node_type *leaf = find_leaf_node(key);
-		if (leaf == nullptr)
+		if (root == nullptr)
 			return size_t(0);
+
+		path_type path;
+		leaf_node_type *leaf = find_leaf_to_insert(key, path).get();
+
+		auto pop = get_pool_base();
+		size_t result = erase_from_leaf(pop, path, leaf, key);
+		if (result)
+			rebalance_leaf(pop, key, nullptr, nullptr);
+		return result;
+	}
+
+	/**
+	 * Removes elements with keys in the range of [lo, hi), in a single
+	 * transaction. Leaves between the ones containing lo and hi are freed, not
+	 * emptied one by one. Returns number of removed elements.
+	 */
+	uint64_t erase_range(const key_type &lo, const key_type &hi)
+	{
+		if (root == nullptr || !(lo < hi))
+			return 0;
+
+		auto pop = get_pool_base();
+		erased_range_t erased;
+		transaction::run(pop, [&] {
+			erase_range(pop, root, lo, hi, erased);
+
+			/*
+			 * A dropped separator shares its buffer with an erased key,
+			 * which frees it below, unless that key was erased before.
+			 */
+			if (!erased.dropped.empty()) {
+				std::unordered_set<uint64_t> keys;
+				for (value_type *entry : erased.entries) {
+					if (PMEMoid *oid = entry->first.blob_oid())
+						keys.insert(oid->off);
+				}
+				for (key_type &sep : erased.dropped) {
+					if (!keys.count(sep.blob_oid()->off))
+						sep.free_storage();
+				}
+			}
+
+			for (value_type *entry : erased.entries) {
+				auto shares = [&](const key_type *sep) {
+					return sep->shares_storage(entry->first);
+				};
+				bool is_separator =
+					std::any_of(erased.separators.begin(),
+						    erased.separators.end(), shares);
+				if (!is_separator)
+					entry->first.free_storage();
+				entry->second.free_storage();
+			}
+
+			for (auto &node : erased.nodes) {
+				if (node->leaf())
+					deallocate_leaf(cast_leaf(node));
+				else
+					deallocate_inner(cast_inner(node));
+			}
+		});
+
+		/* only the leaves at both ends of the range are left underfull */
+		rebalance_leaf(pop, lo, nullptr, nullptr);
+		rebalance_leaf(pop, hi, nullptr, nullptr);
+
+		return erased.entries.size();
+	}
+
+	/**
+	 * Relocates leaves in the range of [start_percent, start_percent +
+	 * amount_percent) of all leaves, in the order of keys, together with
+	 * out-of-line data of their elements, to reduce fragmentation of the pool.
+	 * All pointers to relocated objects are updated. The caller has to hold the
+	 * tree latch exclusively. Throws std::range_error if the range is incorrect
+	 * and pmem::defrag_error if the defragmentation fails.
+	 */
+	pobj_defrag_result defrag(double start_percent, double amount_percent)
+	{
+		if (start_percent < 0 || start_percent >= 100 || amount_percent <= 0 ||
+		    amount_percent > 100 || start_percent + amount_percent > 100)
+			throw std::range_error("incorrect range");
+
+		pobj_defrag_result result = {0, 0};
+		if (root == nullptr)
+			return result;
+
+		std::vector<PMEMoid *> leaves;
+		std::vector<inner_node_type *> inners;
+		if (root->leaf())
+			leaves.push_back(root.raw_ptr());
+		else
+			collect_leaf_oids(cast_inner(root.get()), leaves, inners);
+
+		auto first = static_cast<size_t>(
+			static_cast<double>(leaves.size()) * start_percent / 100);
+		auto last = static_cast<size_t>(static_cast<double>(leaves.size()) *
+						(start_percent + amount_percent) / 100);
+
+		/* every pointer to a relocated object has to be passed */
+		std::vector<PMEMoid *> oids;
+		std::unordered_set<uint64_t> keys;
+		for (size_t i = first; i < last; ++i) {
+			auto leaf = static_cast<leaf_node_type *>(
+				pmemobj_direct(*leaves[i]));
+			leaf->check_consistency(epoch);
+			oids.push_back(leaves[i]);
+			if (leaf->get_prev() != nullptr)
+				oids.push_back(leaf->get_prev()->next_oid());
+			if (leaf->get_next() != nullptr)
+				oids.push_back(leaf->get_next()->prev_oid());
+
+			for (auto it = leaf->begin(); it != leaf->end(); ++it) {
+				if (PMEMoid *oid = (*it).first.blob_oid()) {
+					oids.push_back(oid);
+					keys.insert(oid->off);
+				}
+				if (PMEMoid *oid = (*it).second.blob_oid())
+					oids.push_back(oid);
+			}
+		}
+
+		/* separators share buffers of keys */
+		for (inner_node_type *inner : inners) {
+			for (size_t pos = 0; pos < inner->size(); ++pos) {
+				PMEMoid *oid = inner->key_oid(pos);
+				if (oid && keys.count(oid->off))
+					oids.push_back(oid);
+			}
+		}
+
 		auto pop = get_pool_base();
-		return leaf->erase(pop, key);
+		if (pmemobj_defrag(pop.handle(), oids.data(), oids.size(), &result) != 0)
+			throw pmem::defrag_error("Defragmentation of stree failed");
+
+		return result;
+	}
+
+	/**
+	 * Returns number of elements stored in the tree.
+	 */
+	uint64_t size() const
+	{
+		if (root == nullptr)
+			return 0;
+
+		return subtree_count(root);
+	}
+
+	/**
+	 * Numbers of levels and nodes of the tree.
+	 */
+	struct shape_t {
+		uint64_t depth = 0;
+		uint64_t leaves = 0;
+		uint64_t inner_nodes = 0;
+		uint64_t entries = 0;
+	};
+
+	/**
+	 * Returns the shape of the tree, visiting all its nodes. Writers must not
+	 * modify the tree concurrently.
+	 */
+	shape_t shape()
+	{
+		shape_t result;
+		if (root == nullptr)
+			return result;
+
+		result.depth = root->level() + 1;
+		std::vector<node_t *> nodes(1, root.get());
+		while (!nodes.empty()) {
+			node_t *node = nodes.back();
+			nodes.pop_back();
+			if (node->leaf()) {
+				leaf_node_type *leaf = cast_leaf(node);
+				leaf->check_consistency(epoch);
+				result.leaves++;
+				result.entries += leaf->size();
+				continue;
+			}
+
+			inner_node_type *inner = cast_inner(node);
+			result.inner_nodes++;
+			for (size_t pos = 0; pos <= inner->size(); ++pos) {
+				auto it = inner->begin() + pos;
+				nodes.push_back(inner->get_left_child(it).get());
+			}
+		}
+
+		return result;
+	}
+
+	/**
+	 * Returns number of elements a leaf can hold.
+	 */
+	static constexpr size_t leaf_capacity()
+	{
+		return number_entrys_slots;
+	}
+
+	/**
+	 * Returns number of elements which are less than the given key.
+	 */
+	uint64_t count_less(const key_type &key) const
+	{
+		return count_less(key, false);
+	}
+
+	/**
+	 * Returns number of elements which are less than or equal to the given key.
+	 */
+	uint64_t count_less_equal(const key_type &key) const
+	{
+		return count_less(key, true);
+	}
+
+	/**
+	 * Enables the DRAM index of cc, if it is not enabled yet, and builds it
+	 * from inner nodes of the tree. It is kept up to date by the concurrent_*
+	 * methods, after other methods which modify the tree (e.g. erase_range(),
+	 * bulk_load() or defrag()) it has to be rebuilt. The caller has to hold the
+	 * tree latch exclusively.
+	 */
+	void build_index(concurrency_control &cc) const
+	{
+		build_index(cc.index());
+	}
+
+	/**
+	 * Clears the filter of cc, sized for the current number of elements, and
+	 * adds keys of all elements to it. It is kept up to date by the concurrent_*
+	 * methods, after other methods which insert elements (e.g. bulk_load()) it has
+	 * to be rebuilt. The caller has to hold the tree latch exclusively.
+	 */
+	void build_filter(concurrency_control &cc, size_t per_key) const
+	{
+		cc.filter().reset(static_cast<size_t>(size()), per_key);
+		fill_filter(cc);
+	}
+
+	/**
+	 * Rebuilds the enabled filter of cc, with the same number of bits per key.
+	 */
+	void build_filter(concurrency_control &cc) const
+	{
+		build_filter(cc, cc.filter().bits_per_key());
+	}
+
+	/**
+	 * Adds keys of all elements to the filter of cc, which was reset, and makes
+	 * it ready. Leaves are read under their locks, so the caller may hold the
+	 * tree latch in shared mode: keys inserted meanwhile are added by writers.
+	 */
+	void fill_filter(concurrency_control &cc) const
+	{
+		key_filter &filter = cc.filter();
+		if (root != nullptr) {
+			leaf_node_type *leaf = edge_leaf(root, true);
+			for (; leaf != nullptr; leaf = leaf->get_next().get()) {
+				std::lock_guard<version_lock> guard(cc.leaf_lock(leaf));
+				leaf->check_consistency(epoch);
+				for (const_reference e : *leaf)
+					filter.add(e.first.data(), e.first.size());
+			}
+		}
+		filter.set_ready();
+	}
+
+	/**
+	 * Builds the enabled index in a separate object, which only reads the tree,
+	 * so the caller may hold the tree latch in shared mode.
+	 */
+	void build_index(leaf_index &index) const
+	{
+		index.enable();
+		index.clear();
+		if (root == nullptr)
+			return;
+
+		const leaf_node_type *last = nullptr;
+		index_subtree(index, root, &last);
+		index.append(last, nullptr, 0, false);
+	}
+
+	/**
+	 * Returns up to parts - 1 separator keys of inner nodes, in increasing
+	 * order, which split elements of (lo, hi) into ranges of similar sizes:
+	 * the first range is (lo, s0], the last one is (sN, hi). Separators are
+	 * taken from the highest level of the tree which has enough of them in
+	 * (lo, hi) and chosen by counts of elements below them, so no leaf is
+	 * read. Returned keys point to the tree, writers must not modify it while
+	 * they are used.
+	 */
+	std::vector<key_type> split_range(const key_type &lo, const key_type &hi,
+					  size_t parts) const
+	{
+		std::vector<key_type> result;
+		if (root == nullptr || parts < 2 || !(lo < hi))
+			return result;
+
+		std::vector<key_type> candidates;
+		std::vector<node_t *> level(1, root.get());
+		while (!level.front()->leaf() && candidates.size() + 1 < parts) {
+			std::vector<node_t *> next;
+			candidates.clear();
+			for (auto node : level) {
+				inner_node_type *inner = cast_inner(node);
+				for (size_t pos = 0; pos <= inner->size(); ++pos) {
+					auto it = inner->begin() + pos;
+					auto prev = inner->begin() + (pos ? pos - 1 : 0);
+					if ((pos == inner->size() || lo < *it) &&
+					    (pos == 0 || *prev < hi))
+						next.push_back(
+							inner->get_left_child(it).get());
+					if (pos < inner->size() && lo < *it && *it < hi)
+						candidates.push_back(*it);
+				}
+			}
+			level.swap(next);
+		}
+
+		/* pick the candidates closest to equal shares of the range */
+		uint64_t first = count_less_equal(lo);
+		uint64_t total = count_less(hi) - first;
+		size_t part = 1;
+		for (auto &key : candidates) {
+			if (part == parts)
+				break;
+
+			uint64_t below = count_less_equal(key) - first;
+			if (below * parts >= total * part) {
+				result.push_back(key);
+				while (part < parts && below * parts >= total * part)
+					++part;
+			}
+		}
+
+		return result;
 	}
 
 	void garbage_collection();
 
+	/**
+	 * Persists subtree counts of inner nodes and marks them clean, so they are
+	 * not rebuilt when the tree is opened again. Has to be called when the tree
+	 * is closed, with no other operation in progress.
+	 */
+	void persist_counts()
+	{
+		if (counts_dirty == 0)
+			return;
+
+		pool_base pop = get_pool_base();
+		if (root != nullptr && !root->leaf())
+			flush_counts(pop, cast_inner(root.get()));
+		pop.drain();
+		counts_dirty = 0;
+		pop.persist(&counts_dirty, sizeof(counts_dirty));
+	}
+
 	iterator begin()
 	{
 		return iterator(leftmost_leaf());
@@ -1630,6 +4072,9 @@ void b_tree_base<TKey, TValue, degree>::garbage_collection()
 	++epoch;
 	// pop.persist( &epoch, sizeof(epoch) );
 
+	if (bulk_head != nullptr)
+		build_bulk_inner_nodes(pop);
+
 	if (split_node != nullptr) {
 		if (split_node->leaf()) {
 			repair_leaf_split(pop);
@@ -1637,6 +4082,26 @@ void b_tree_base<TKey, TValue, degree>::garbage_collection()
 			repair_inner_split(pop);
 		}
 	}
+
+	/* counts are persisted on close, they stay dirty until then */
+	if (counts_dirty) {
+		rebuild_counts(root);
+		counts_dirty = COUNTS_DIRTY;
+	}
+
+	if (!pending_entry.first.is_inline() || !pending_entry.second.is_inline()) {
+		iterator it = find(pending_entry.first);
+		bool inserted = it != end() &&
+			same_storage(pending_entry.first, it->first) &&
+			same_storage(pending_entry.second, it->second);
+		if (!inserted) {
+			transaction::run(pop, [&] {
+				pending_entry.first.free_storage();
+				pending_entry.second.free_storage();
+			});
+		}
+		clear_pending_entry(pop);
+	}
 }
 
 template <typename TKey, typename TValue, size_t degree>
@@ -1648,6 +4113,7 @@ b_tree_base<TKey, TValue, degree>::split_leaf_node(pool_base &pop,
 						   persistent_ptr<node_t> &left,
 						   persistent_ptr<node_t> &right)
 {
+	PMEMKV_PROBE(leaf__split__entry);
 	const leaf_node_type *split_leaf = cast_leaf(src_node).get();
 	assert(split_leaf->full());
 	assignment(pop, split_node, src_node);
@@ -1679,11 +4145,13 @@ b_tree_base<TKey, TValue, degree>::split_leaf_node(pool_base &pop,
 
 	correct_leaf_node_links(pop, src_node, left, right);
 
+	key_type sep = separator(lnode, cast_leaf(right).get());
 	if (parent_node) {
-		parent_node->update_splitted_child(pop, lnode->back().first, left, right,
-						   split_node);
+		parent_node->update_splitted_child(pop, sep, left, right, split_node,
+						   subtree_count(left),
+						   subtree_count(right));
 	} else {
-		create_new_root(pop, lnode->back().first, left, right);
+		create_new_root(pop, sep, left, right);
 	}
 
 	deallocate(split_node);
@@ -1692,6 +4160,7 @@ b_tree_base<TKey, TValue, degree>::split_leaf_node(pool_base &pop,
 	assert(leaf_it != insert_node->end());
 	assert(leaf_it->first == entry.first);
 	assert(leaf_it->second == entry.second);
+	PMEMKV_PROBE(leaf__split__return);
 	return iterator(insert_node, leaf_it);
 }
 
@@ -1725,13 +4194,20 @@ void b_tree_base<TKey, TValue, degree>::create_new_root(pool_base &pop,
 	assert(r_child != nullptr);
 	assert(split_node == root);
 
-	allocate_inner(pop, root, root->level() + 1, key, l_child, r_child);
+	allocate_inner(pop, root, root->level() + 1, key, l_child, r_child,
+		       subtree_count(l_child), subtree_count(r_child));
 }
 
 template <typename TKey, typename TValue, size_t degree>
 std::pair<typename b_tree_base<TKey, TValue, degree>::iterator, bool>
-b_tree_base<TKey, TValue, degree>::insert_descend(pool_base &pop, const_reference entry)
+b_tree_base<TKey, TValue, degree>::insert_descend(pool_base &pop, const_reference entry,
+						  split_stats *splits)
 {
+	auto count_split = [splits](std::atomic<uint64_t> split_stats::*counter) {
+		if (splits)
+			(splits->*counter).fetch_add(1, std::memory_order_relaxed);
+	};
+
 	path_type path;
 	const key_type &key = entry.first;
 
@@ -1739,18 +4215,21 @@ b_tree_base<TKey, TValue, degree>::insert_descend(pool_base &pop, const_referenc
 	leaf_node_type *leaf = cast_leaf(node).get();
 	inner_node_type *parent_node = nullptr;
 
-	if (leaf->full()) {
-		typename leaf_node_type::iterator leaf_it = leaf->find(key);
-		if (leaf_it != leaf->end()) { // Entry with the same key found
-			return std::pair<iterator, bool>(iterator(leaf, leaf_it), false);
-		}
+	typename leaf_node_type::iterator leaf_it = leaf->find(key);
+	if (leaf_it != leaf->end()) { // Entry with the same key found
+		return std::pair<iterator, bool>(iterator(leaf, leaf_it), false);
+	}
+
+	mark_counts_dirty(pop);
 
+	if (leaf->full()) {
 		/**
 		 * If root is leaf.
 		 */
 		if (path.empty()) {
 			iterator it = split_leaf_node(pop, nullptr, node, entry,
 						      left_child, right_child);
+			count_split(&split_stats::leaves);
 			return std::pair<iterator, bool>(it, true);
 		}
 
@@ -1763,6 +4242,7 @@ b_tree_base<TKey, TValue, degree>::insert_descend(pool_base &pop, const_referenc
 		if ((*i)->full()) {
 			parent_node = nullptr;
 			split_inner_node(pop, *i, parent_node, left_child, right_child);
+			count_split(&split_stats::inner_nodes);
 			parent_node = cast_inner(cast_inner(root)->get_child(key).get());
 		} else {
 			parent_node = (*i).get();
@@ -1771,18 +4251,21 @@ b_tree_base<TKey, TValue, degree>::insert_descend(pool_base &pop, const_referenc
 
 		for (; i != path.end(); ++i) {
 			split_inner_node(pop, *i, parent_node, left_child, right_child);
+			count_split(&split_stats::inner_nodes);
 
 			parent_node = cast_inner(parent_node->get_child(key).get());
 		}
 
 		iterator it = split_leaf_node(pop, parent_node, node, entry, left_child,
 					      right_child);
+		count_split(&split_stats::leaves);
+		recount_path(key);
 		return std::pair<iterator, bool>(it, true);
 	}
 
 	std::pair<typename leaf_node_type::iterator, bool> ret = leaf->insert(pop, entry);
+	update_path_counts(path, key, 1);
 	return std::pair<iterator, bool>(iterator(leaf, ret.first), ret.second);
-	;
 }
 
 } // namespace internal
@@ -1,5 +1,5 @@
 /*
- * Copyright 2017-2019, Intel Corporation
+ * Copyright 2017-2020, Intel Corporation
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions
@@ -33,17 +33,45 @@
 #ifndef PERSISTENT_PSTRING_H
 #define PERSISTENT_PSTRING_H
 
-#include <stdexcept>
+#include <algorithm>
+#include <ostream>
 #include <string.h>
+#include <string>
 
-template <size_t CAPACITY>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+
+/**
+ * String of any length, which stores up to INLINE_CAPACITY bytes in place and
+ * longer ones in a separately allocated persistent buffer.
+ *
+ * Copying a pstring is shallow: copies share the out-of-line buffer, which is
+ * never freed implicitly. A pstring constructed from user data, longer than
+ * INLINE_CAPACITY, only refers to that data (is_external()), so it is valid only
+ * as long as the data, and must not be stored in persistent memory before
+ * assign() copies the data into a persistent buffer. Nodes of the b-tree assert
+ * that such pstrings are never stored in them.
+ */
+template <size_t INLINE_CAPACITY>
 class pstring {
-	static const size_t BUFFER_SIZE = CAPACITY + 1;
+	static const size_t BUFFER_SIZE = INLINE_CAPACITY + 1;
+
+	/* storage kind is kept in the highest bits of the size */
+	static const uint64_t INLINE = 0;
+	static const uint64_t BLOB = 1;
+	static const uint64_t EXTERNAL = 2;
+	static const uint64_t KIND_SHIFT = 62;
+	static const uint64_t SIZE_MASK = (uint64_t(1) << KIND_SHIFT) - 1;
 
 public:
-	pstring(const std::string &s = "\0")
+	pstring() : _size(0)
 	{
-		init(s.c_str(), s.size());
+		u.str[0] = '\0';
+	}
+
+	pstring(const std::string &s)
+	{
+		init(s.data(), s.size());
 	}
 
 	pstring(const char *data, size_t size)
@@ -51,65 +79,128 @@ public:
 		init(data, size);
 	}
 
-	pstring(const pstring &other)
+	const char *data() const
+	{
+		switch (kind()) {
+			case BLOB:
+				return static_cast<const char *>(pmemobj_direct(u.blob));
+			case EXTERNAL:
+				return u.external;
+			default:
+				return u.str;
+		}
+	}
+
+	size_t size() const
 	{
-		init(other.c_str(), other.size());
+		return static_cast<size_t>(_size & SIZE_MASK);
 	}
 
-	pstring &operator=(const pstring &other)
+	/**
+	 * Returns true if the data is stored in place, so it can be read without
+	 * following any pointer.
+	 */
+	bool is_inline() const
 	{
-		init(other.c_str(), other.size());
-		return *this;
+		return kind() == INLINE;
 	}
 
-	pstring &operator=(const std::string &s)
+	/**
+	 * Returns true if this pstring refers to user data, which has to be copied
+	 * by assign() before the pstring is stored in persistent memory.
+	 */
+	bool is_external() const
 	{
-		init(s.c_str(), s.size());
-		return *this;
+		return kind() == EXTERNAL;
 	}
 
-	const char *c_str() const
+	/**
+	 * Returns the pointer to out-of-line buffer, so that defragmentation can
+	 * relocate it, or nullptr if there is no such buffer.
+	 */
+	PMEMoid *blob_oid()
 	{
-		return str;
+		return kind() == BLOB ? &u.blob : nullptr;
 	}
 
-	size_t size() const
+	/**
+	 * Returns true if both pstrings are stored out of line in the same buffer.
+	 */
+	bool shares_storage(const pstring &other) const
 	{
-		return _size;
+		return kind() == BLOB && other.kind() == BLOB &&
+			u.blob.off == other.u.blob.off &&
+			u.blob.pool_uuid_lo == other.u.blob.pool_uuid_lo;
 	}
 
-	char *begin()
+	/**
+	 * Replaces the content with a copy of the given data and frees previous
+	 * out-of-line buffer. Has to be called within a transaction, the caller
+	 * is responsible for adding this object to it.
+	 */
+	void assign(const char *data, size_t size)
 	{
-		return str;
+		free_storage();
+		if (size <= INLINE_CAPACITY) {
+			init(data, size);
+			return;
+		}
+
+		auto blob = pmem::obj::make_persistent<char[]>(size + 1);
+		memcpy(blob.get(), data, size);
+		blob.get()[size] = '\0';
+		u.blob = blob.raw();
+		_size = (BLOB << KIND_SHIFT) | size;
 	}
 
-	char *end()
+	/**
+	 * Frees out-of-line buffer, if there is one. Has to be called within
+	 * a transaction. The content of this object is not changed.
+	 */
+	void free_storage()
 	{
-		return str + _size;
+		if (kind() != BLOB)
+			return;
+
+		pmem::obj::delete_persistent<char[]>(
+			pmem::obj::persistent_ptr<char[]>(u.blob), size() + 1);
 	}
 
 	const char *begin() const
 	{
-		return str;
+		return data();
 	}
 
 	const char *end() const
 	{
-		return str + _size;
+		return data() + size();
 	}
 
 private:
+	uint64_t kind() const
+	{
+		return _size >> KIND_SHIFT;
+	}
+
 	void init(const char *src, size_t size)
 	{
-		if (size > CAPACITY)
-			throw std::length_error("size exceed pstring capacity");
-		memcpy(str, src, size);
-		str[size] = '\0';
+		if (size > INLINE_CAPACITY) {
+			u.external = src;
+			_size = (EXTERNAL << KIND_SHIFT) | size;
+			return;
+		}
+
+		memcpy(u.str, src, size);
+		u.str[size] = '\0';
 		_size = size;
 	}
 
-	char str[BUFFER_SIZE];
-	size_t _size;
+	uint64_t _size;
+	union {
+		char str[BUFFER_SIZE];
+		PMEMoid blob;
+		const char *external;
+	} u;
 };
 
 template <size_t size>
@@ -136,7 +227,7 @@ inline bool operator==(const pstring<size> &lhs, const pstring<size> &rhs)
 template <size_t size>
 std::ostream &operator<<(std::ostream &os, const pstring<size> &obj)
 {
-	return os << obj.c_str();
+	return os.write(obj.data(), static_cast<std::streamsize>(obj.size()));
 }
 
 #endif // PERSISTENT_PSTRING_H
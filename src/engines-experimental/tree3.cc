@@ -32,14 +32,22 @@
 
 #include "tree3.h"
 #include "../out.h"
+#include "../probes.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <exception>
 #include <iostream>
-#include <list>
+#include <thread>
+#include <unordered_map>
 #include <unistd.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TREE3_SIMD_PROBE
+#endif
+
 namespace pmem
 {
 namespace kv
@@ -47,12 +55,47 @@ namespace kv
 
 tree3::tree3(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg)
 {
+	uint64_t threads;
+	if (cfg->get_uint64("recovery_threads", &threads)) {
+		if (threads == 0)
+			throw internal::invalid_argument(
+				"Config item \"recovery_threads\" has to be greater than 0");
+		recovery_threads = threads;
+	}
+
+	uint64_t keys;
+	if (cfg->get_uint64("inner_keys", &keys)) {
+		if (keys < 2 || keys > INNER_KEYS_MAX)
+			throw internal::invalid_argument(
+				"Config item \"inner_keys\" has to be between 2 and " +
+				std::to_string(INNER_KEYS_MAX));
+		inner_keys = keys;
+	}
+
+	uint64_t image;
+	if (cfg->get_uint64("recovery_image", &image))
+		save_image = image != 0;
+
+	init_allocator(*cfg, {sizeof(internal::tree3::KVLeaf)});
 	Recover();
+
+	// saved image gets stale with the first change, it is saved again on close
+	if (!read_only) {
+		FreeImage();
+		mark_opened();
+	}
 	LOG("Started ok");
 }
 
 tree3::~tree3()
 {
+	if (save_image && !read_only) {
+		try {
+			SaveImage();
+		} catch (std::exception &e) {
+			LOG("   saving image failed: " << e.what());
+		}
+	}
 	LOG("Stopped ok");
 }
 
@@ -61,6 +104,155 @@ std::string tree3::name()
 	return "tree3";
 }
 
+// ===============================================================================================
+// KEY ORDER
+// ===============================================================================================
+
+using internal::tree3::KVPosition;
+
+static const KVPosition END_POSITION = {nullptr, 0};
+
+// lexicographical comparison of keys, consistent with std::string::compare
+static int CompareKeys(string_view lhs, string_view rhs)
+{
+	const int result = memcmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+	if (result != 0)
+		return result;
+	return lhs.size() < rhs.size() ? -1 : (lhs.size() > rhs.size() ? 1 : 0);
+}
+
+static internal::tree3::KVLeafNode *FindLeaf(internal::tree3::KVNode *node,
+					     string_view key)
+{
+	if (node == nullptr)
+		return nullptr;
+	while (!node->is_leaf) {
+		auto inner = (internal::tree3::KVInnerNode *)node;
+#ifndef NDEBUG
+		inner->assert_invariants();
+#endif
+		node = inner->children[inner->lower_bound(key)].get();
+	}
+	return (internal::tree3::KVLeafNode *)node;
+}
+
+// leftmost (or rightmost) leaf of the tree, null if the tree is empty
+static internal::tree3::KVLeafNode *EdgeLeaf(internal::tree3::KVNode *node, bool last)
+{
+	if (node == nullptr)
+		return nullptr;
+	while (!node->is_leaf) {
+		auto inner = (internal::tree3::KVInnerNode *)node;
+		node = inner->children[last ? inner->keycount : 0].get();
+	}
+	return (internal::tree3::KVLeafNode *)node;
+}
+
+// normalizes position at or past the end of a leaf to the next record
+static KVPosition Forward(internal::tree3::KVLeafNode *leaf, size_t idx)
+{
+	while (leaf && idx >= leaf->sort()) {
+		leaf = leaf->next;
+		idx = 0;
+	}
+	return leaf ? KVPosition{leaf, idx} : END_POSITION;
+}
+
+// position of the record preceding the given one, which may be past the end of a leaf
+static KVPosition Backward(internal::tree3::KVLeafNode *leaf, size_t idx)
+{
+	while (leaf && idx == 0) {
+		leaf = leaf->prev;
+		idx = leaf ? leaf->sort() : 0;
+	}
+	return leaf ? KVPosition{leaf, idx - 1} : END_POSITION;
+}
+
+static KVPosition First(internal::tree3::KVNode *top)
+{
+	return Forward(EdgeLeaf(top, false), 0);
+}
+
+static KVPosition Last(internal::tree3::KVNode *top)
+{
+	auto leaf = EdgeLeaf(top, true);
+	return Backward(leaf, leaf ? leaf->sort() : 0);
+}
+
+static KVPosition Next(KVPosition pos)
+{
+	return Forward(pos.leaf, pos.idx + 1);
+}
+
+// record preceding the position, the last one if the position is past the end
+static KVPosition Before(internal::tree3::KVNode *top, KVPosition pos)
+{
+	return pos.leaf ? Backward(pos.leaf, pos.idx) : Last(top);
+}
+
+// first record with key not less than (or, if upper, greater than) the given one
+static KVPosition Bound(internal::tree3::KVNode *top, string_view key, bool upper)
+{
+	auto leaf = FindLeaf(top, key);
+	if (!leaf)
+		return END_POSITION;
+
+	auto first = leaf->order;
+	auto last = leaf->order + leaf->sort();
+	auto key_less = [&](string_view k, uint8_t slot) {
+		return CompareKeys(k, leaf->keys[slot]) < 0;
+	};
+	auto slot_less = [&](uint8_t slot, string_view k) {
+		return CompareKeys(leaf->keys[slot], k) < 0;
+	};
+	auto pos = upper ? std::upper_bound(first, last, key, key_less)
+			 : std::lower_bound(first, last, key, slot_less);
+	return Forward(leaf, (size_t)(pos - first));
+}
+
+static string_view KeyAt(KVPosition pos)
+{
+	return pos.leaf->keys[pos.leaf->order[pos.idx]];
+}
+
+static string_view ValueAt(KVPosition pos)
+{
+	const auto &kvslot = pos.leaf->leaf->slots[pos.leaf->order[pos.idx]].get_ro();
+	return string_view(kvslot.val(), kvslot.valsize());
+}
+
+// count of records in [from, to), the leaves in between are counted without sorting
+static size_t CountRange(KVPosition from, KVPosition to)
+{
+	if (from == to)
+		return 0;
+	size_t cnt = 0;
+	for (auto leaf = from.leaf; leaf != to.leaf; leaf = leaf->next)
+		cnt += leaf->size();
+	return cnt + to.idx - from.idx;
+}
+
+// passes records in [from, to) to the callback
+static status GetRange(KVPosition from, KVPosition to, get_kv_callback *callback,
+		       void *arg)
+{
+	for (auto pos = from; pos != to; pos = Next(pos)) {
+		auto k = KeyAt(pos);
+		auto v = ValueAt(pos);
+		if (callback(k.data(), k.size(), v.data(), v.size(), arg) != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+static std::pair<string_view, string_view> RecordAt(KVPosition pos)
+{
+	if (!pos.leaf)
+		return std::make_pair("", "");
+	return std::make_pair(KeyAt(pos), ValueAt(pos));
+}
+
 // ===============================================================================================
 // KEY/VALUE METHODS
 // ===============================================================================================
@@ -73,7 +265,7 @@ status tree3::count_all(std::size_t &cnt)
 	auto leaf = (pmem::kv::internal::tree3::KVLeaf *)pmemobj_direct(*root_oid);
 	while (leaf) {
 		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = leaf->slots[slot].get_ro();
+			const auto &kvslot = leaf->slots[slot].get_ro();
 			if (kvslot.empty() || kvslot.hash() == 0)
 				continue;
 			result++;
@@ -86,6 +278,65 @@ status tree3::count_all(std::size_t &cnt)
 	return status::OK;
 }
 
+// above key, key exclusive
+status tree3::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above key>" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	cnt = CountRange(Bound(tree_top.get(), key, true), END_POSITION);
+
+	return status::OK;
+}
+
+// above or equal to key, key inclusive
+status tree3::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above key>=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	cnt = CountRange(Bound(tree_top.get(), key, false), END_POSITION);
+
+	return status::OK;
+}
+
+// below or equal to key, key inclusive
+status tree3::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below key<=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	cnt = CountRange(First(tree_top.get()), Bound(tree_top.get(), key, true));
+
+	return status::OK;
+}
+
+// below key, key exclusive
+status tree3::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below key<" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	cnt = CountRange(First(tree_top.get()), Bound(tree_top.get(), key, false));
+
+	return status::OK;
+}
+
+// (key1, key2), key1 exclusive, key2 exclusive
+status tree3::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between key range=[" << std::string(key1.data(), key1.size()) << ","
+					<< std::string(key2.data(), key2.size()) << ")");
+	check_outside_tx();
+
+	cnt = 0;
+	if (CompareKeys(key1, key2) < 0)
+		cnt = CountRange(Bound(tree_top.get(), key1, true),
+				 Bound(tree_top.get(), key2, false));
+
+	return status::OK;
+}
+
 status tree3::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
@@ -93,7 +344,7 @@ status tree3::get_all(get_kv_callback *callback, void *arg)
 	auto leaf = (pmem::kv::internal::tree3::KVLeaf *)pmemobj_direct(*root_oid);
 	while (leaf) {
 		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = leaf->slots[slot].get_ro();
+			const auto &kvslot = leaf->slots[slot].get_ro();
 			if (kvslot.empty() || kvslot.hash() == 0)
 				continue;
 			auto ret = callback(kvslot.key(), kvslot.get_ks(), kvslot.val(),
@@ -107,20 +358,136 @@ status tree3::get_all(get_kv_callback *callback, void *arg)
 	return status::OK;
 }
 
+// (key, end), above key
+status tree3::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above start key>" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	return GetRange(Bound(tree_top.get(), key, true), END_POSITION, callback, arg);
+}
+
+// [key, end), above or equal to key
+status tree3::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_above start key>=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	return GetRange(Bound(tree_top.get(), key, false), END_POSITION, callback, arg);
+}
+
+// [start, key], below or equal to key
+status tree3::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_equal_below key<=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	return GetRange(First(tree_top.get()), Bound(tree_top.get(), key, true),
+			callback, arg);
+}
+
+// [start, key), less than key, key exclusive
+status tree3::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below key<" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	return GetRange(First(tree_top.get()), Bound(tree_top.get(), key, false),
+			callback, arg);
+}
+
+// get between (key1, key2), key1 exclusive, key2 exclusive
+status tree3::get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			  void *arg)
+{
+	LOG("get_between key range=[" << std::string(key1.data(), key1.size()) << ","
+				      << std::string(key2.data(), key2.size()) << ")");
+	check_outside_tx();
+
+	if (CompareKeys(key1, key2) >= 0)
+		return status::OK;
+
+	return GetRange(Bound(tree_top.get(), key1, true),
+			Bound(tree_top.get(), key2, false), callback, arg);
+}
+
+std::pair<string_view, string_view> tree3::upper_bound(string_view key)
+{
+	LOG("upper_bound");
+	check_outside_tx();
+
+	return RecordAt(Bound(tree_top.get(), key, true));
+}
+
+std::pair<string_view, string_view> tree3::lower_bound(string_view key)
+{
+	LOG("lower_bound");
+	check_outside_tx();
+
+	return RecordAt(Bound(tree_top.get(), key, false));
+}
+
+std::pair<string_view, string_view> tree3::get_begin()
+{
+	LOG("begin");
+	check_outside_tx();
+
+	return RecordAt(First(tree_top.get()));
+}
+
+std::pair<string_view, string_view> tree3::get_next(string_view key)
+{
+	LOG("get_next");
+	check_outside_tx();
+
+	auto pos = Bound(tree_top.get(), key, false);
+	if (!pos.leaf || CompareKeys(KeyAt(pos), key) != 0)
+		return RecordAt(END_POSITION);
+
+	return RecordAt(Next(pos));
+}
+
+std::pair<string_view, string_view> tree3::get_prev(string_view key)
+{
+	LOG("get_prev");
+	check_outside_tx();
+
+	auto pos = Bound(tree_top.get(), key, false);
+	if (!pos.leaf || CompareKeys(KeyAt(pos), key) != 0)
+		return RecordAt(END_POSITION);
+
+	return RecordAt(Backward(pos.leaf, pos.idx));
+}
+
+int tree3::get_size_new()
+{
+	LOG("get_size");
+	check_outside_tx();
+
+	return static_cast<int>(CountRange(First(tree_top.get()), END_POSITION));
+}
+
+internal::iterator_base *tree3::new_iterator()
+{
+	LOG("new_iterator");
+	check_outside_tx();
+
+	return new internal::tree3::iterator(tree_top);
+}
+
 status tree3::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearch(key);
 	if (leafnode) {
-		const uint8_t hash = PearsonHash(key.data(), key.size());
-		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->hashes[slot] == hash) {
-				if (leafnode->keys[slot].compare(
-					    std::string(key.data(), key.size())) == 0)
-					return status::OK;
-			}
+		const uint8_t hash = internal::tree3::PearsonHash(key.data(), key.size());
+		for (auto mask = internal::tree3::LeafProbeHashes(leafnode->hashes, hash);
+		     mask; mask &= mask - 1) {
+			const int slot = __builtin_ctzll(mask);
+			if (leafnode->keys[slot].compare(0, std::string::npos, key.data(),
+							 key.size()) == 0)
+				return status::OK;
 		}
 	}
 	LOG("   could not find key");
@@ -131,22 +498,20 @@ status tree3::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get using callback for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearch(key);
 	if (leafnode) {
-		const uint8_t hash = PearsonHash(key.data(), key.size());
-		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->hashes[slot] == hash) {
-				LOG("   found hash match, slot=" << slot);
-				if (leafnode->keys[slot].compare(
-					    std::string(key.data(), key.size())) == 0) {
-					auto kv = leafnode->leaf->slots[slot].get_ro();
-					LOG("   found value, slot="
-					    << slot
-					    << ", size=" << std::to_string(kv.valsize()));
-					callback(kv.val(), kv.valsize(), arg);
-					return status::OK;
-				}
+		const uint8_t hash = internal::tree3::PearsonHash(key.data(), key.size());
+		for (auto mask = internal::tree3::LeafProbeHashes(leafnode->hashes, hash);
+		     mask; mask &= mask - 1) {
+			const int slot = __builtin_ctzll(mask);
+			LOG("   found hash match, slot=" << slot);
+			if (leafnode->keys[slot].compare(0, std::string::npos, key.data(),
+							 key.size()) == 0) {
+				const auto &kv = leafnode->leaf->slots[slot].get_ro();
+				LOG("   found value, slot="
+				    << slot << ", size=" << std::to_string(kv.valsize()));
+				callback(kv.val(), kv.valsize(), arg);
+				return status::OK;
 			}
 		}
 	}
@@ -154,15 +519,254 @@ status tree3::get(string_view key, get_v_callback *callback, void *arg)
 	return status::NOT_FOUND;
 }
 
+status tree3::get_ref(string_view key, internal::value_ref &ref)
+{
+	LOG("get_ref for key=" << std::string(key.data(), key.size()));
+	ref.release();
+	/* the engine is not thread-safe, so the value needs no pin */
+	return get(
+		key,
+		[](const char *v, size_t vb, void *arg) {
+			static_cast<internal::value_ref *>(arg)->set(string_view(v, vb));
+		},
+		&ref);
+}
+
 status tree3::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
+	check_writable();
+
+	DoPut(key, value);
+	return status::OK;
+}
+
+/* the engine is not thread-safe, so nothing can come between get and put */
+status tree3::update(string_view key, update_callback *callback, void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	check_writable();
+
+	std::pair<const char *, size_t> value(nullptr, 0);
+	get(
+		key,
+		[](const char *v, size_t vb, void *arg) {
+			*static_cast<std::pair<const char *, size_t> *>(arg) =
+				std::make_pair(v, vb);
+		},
+		&value);
+
+	const char *new_value;
+	size_t new_valuebytes;
+	if (callback(value.first, value.second, &new_value, &new_valuebytes, arg) != 0)
+		return status::STOPPED_BY_CB;
+
+	DoPut(key, string_view(new_value, new_valuebytes));
+	return status::OK;
+}
+
+status tree3::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	check_writable();
+
+	return DoRemove(key);
+}
+
+status tree3::write(internal::write_batch &batch)
+{
+	LOG("write batch of " << batch.size() << " operations");
+	check_outside_tx();
+	check_writable();
+
+	try {
+		transaction::run(pmpool, [&] {
+			for (auto &op : batch.operations()) {
+				if (op.type == internal::write_batch::op_type::PUT)
+					DoPut(op.key, op.value);
+				else
+					DoRemove(op.key);
+			}
+		});
+	} catch (...) {
+		// persistent leaves were rolled back, rebuild volatile nodes from them
+		LOG("   batch aborted, recovering volatile nodes");
+		leaves_prealloc.clear();
+		Recover();
+		throw;
+	}
+
+	return status::OK;
+}
+
+status tree3::bulk_load(bulk_load_callback *callback, void *arg)
+{
+	LOG("bulk_load");
+	check_outside_tx();
+	check_writable();
+
+	if (tree_top)
+		return engine_base::bulk_load(callback, arg);
+
+	// fill leaves in key order, then build inner nodes on top of them
+	vector<internal::tree3::KVRecoveredNode> leaves;
+	const std::string *previous = nullptr;
+	const char *k, *v;
+	size_t kb, vb;
+	auto next = [&] {
+		if (callback(&k, &kb, &v, &vb, arg) != 0)
+			return false;
+		if (previous && previous->compare(0, std::string::npos, k, kb) >= 0)
+			throw internal::invalid_argument(
+				"Records of bulk load are not sorted by key");
+		return true;
+	};
+
+	try {
+		bool more = next();
+		while (more) {
+			unique_ptr<internal::tree3::KVLeafNode> new_node(
+				new internal::tree3::KVLeafNode());
+			new_node->is_leaf = true;
+			int slot = 0;
+			transaction::run(pmpool, [&] {
+				using internal::tree3::KVLeaf;
+				if (!leaves_prealloc.empty()) {
+					new_node->leaf = leaves_prealloc.back();
+					leaves_prealloc.pop_back();
+				} else {
+					auto old_head = persistent_ptr<KVLeaf>(*root_oid);
+					auto new_leaf = make_persistent<KVLeaf>(
+						alloc->flag(sizeof(KVLeaf)));
+					transaction::snapshot(root_oid);
+					*root_oid = new_leaf.raw();
+					new_leaf->next = old_head;
+					new_node->leaf = new_leaf;
+				}
+				do {
+					const auto hash =
+						internal::tree3::PearsonHash(k, kb);
+					LeafFillSpecificSlot(new_node.get(), hash,
+							     string_view(k, kb),
+							     string_view(v, vb), slot);
+					previous = &new_node->keys[slot++];
+				} while (slot < LEAF_KEYS_BULK_LOAD && (more = next()));
+			});
+			leaves.push_back({move(new_node), *previous});
+			if (more)
+				more = next();
+		}
+	} catch (...) {
+		RecoverInnerNodes(leaves);
+		throw;
+	}
+	RecoverInnerNodes(leaves);
+
+	return status::OK;
+}
+
+typedef std::unordered_map<uint64_t, persistent_ptr<internal::tree3::KVLeaf> *>
+	leaf_pointers_t;
+
+// volatile pointers to persistent leaves, by their current offsets
+static void CollectLeafPointers(internal::tree3::KVNode *node, leaf_pointers_t &ptrs)
+{
+	if (node->is_leaf) {
+		auto leafnode = static_cast<internal::tree3::KVLeafNode *>(node);
+		ptrs[leafnode->leaf.raw().off] = &leafnode->leaf;
+		return;
+	}
+	auto inner = static_cast<internal::tree3::KVInnerNode *>(node);
+	for (uint8_t i = 0; i <= inner->keycount; i++)
+		CollectLeafPointers(inner->children[i].get(), ptrs);
+}
+
+status tree3::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+	check_writable();
+
+	if (start_percent < 0 || start_percent >= 100 || amount_percent <= 0 ||
+	    amount_percent > 100 || start_percent + amount_percent > 100) {
+		out_err_stream("defrag") << "incorrect range";
+		return status::INVALID_ARGUMENT;
+	}
+
+	// links to persistent leaves, in the order of the list
+	vector<PMEMoid *> links;
+	for (PMEMoid *link = root_oid; !OID_IS_NULL(*link);) {
+		links.push_back(link);
+		auto leaf = (internal::tree3::KVLeaf *)pmemobj_direct(*link);
+		link = leaf->next.raw_ptr();
+	}
+	auto count = (double)links.size();
+	auto first = (size_t)(count * start_percent / 100);
+	auto last = (size_t)(count * (start_percent + amount_percent) / 100);
+	if (first == last)
+		return status::OK;
+
+	// every pointer to a relocated leaf or key/value buffer has to be passed
+	vector<PMEMoid *> oids;
+	for (size_t i = first; i < last; i++) {
+		oids.push_back(links[i]);
+		auto leaf = (internal::tree3::KVLeaf *)pmemobj_direct(*links[i]);
+		for (int slot = LEAF_KEYS; slot--;) {
+			// slots with key and value stored in place have no buffer
+			auto oid = leaf->slots[slot].get_rw().kv_oid();
+			if (oid)
+				oids.push_back(oid);
+		}
+	}
+
+	leaf_pointers_t ptrs;
+	if (tree_top)
+		CollectLeafPointers(tree_top.get(), ptrs);
+	for (auto &leaf : leaves_prealloc)
+		ptrs[leaf.raw().off] = &leaf;
+	vector<persistent_ptr<internal::tree3::KVLeaf> *> volatile_ptrs;
+	for (size_t i = first; i < last; i++)
+		volatile_ptrs.push_back(ptrs.at(links[i]->off));
+
+	pobj_defrag_result result;
+	if (pmemobj_defrag(pmpool.handle(), oids.data(), oids.size(), &result) != 0) {
+		out_err_stream("defrag") << "Defragmentation of tree3 failed";
+		return status::DEFRAG_ERROR;
+	}
+
+	// links preceding the first relocated leaf are not moved, follow them
+	PMEMoid *link = links[first];
+	for (auto ptr : volatile_ptrs) {
+		*ptr = persistent_ptr<internal::tree3::KVLeaf>(*link);
+		link = (*ptr)->next.raw_ptr();
+	}
 
-	const auto hash = PearsonHash(key.data(), key.size());
-	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	return status::OK;
+}
+
+void tree3::metrics(internal::engine_metrics &metrics)
+{
+	uint64_t inner_depth = 0;
+	for (auto node = tree_top.get(); node && !node->is_leaf; inner_depth++)
+		node = ((internal::tree3::KVInnerNode *)node)->children[0].get();
+
+	metrics.add("leaf_splits", leaf_splits);
+	metrics.add("inner_node_splits", inner_splits);
+	metrics.add("leaf_merges", leaf_merges);
+	metrics.add("inner_depth", inner_depth);
+	metrics.add("preallocated_leaves", static_cast<uint64_t>(leaves_prealloc.size()));
+	metrics.add("image_recovered", static_cast<uint64_t>(image_recovered));
+}
+
+void tree3::DoPut(string_view key, string_view value)
+{
+	const auto hash = internal::tree3::PearsonHash(key.data(), key.size());
+	auto leafnode = LeafSearch(key);
 	if (!leafnode) {
 		LOG("   adding head leaf");
 		unique_ptr<internal::tree3::KVLeafNode> new_node(
@@ -175,55 +779,46 @@ status tree3::put(string_view key, string_view value)
 			} else {
 				auto old_head = persistent_ptr<internal::tree3::KVLeaf>(
 					*root_oid);
-				auto new_leaf =
-					make_persistent<internal::tree3::KVLeaf>();
+				auto new_leaf = make_persistent<internal::tree3::KVLeaf>(
+					alloc->flag(sizeof(internal::tree3::KVLeaf)));
 				transaction::snapshot(root_oid);
 				*root_oid = new_leaf.raw();
 				new_leaf->next = old_head;
 				new_node->leaf = new_leaf;
 			}
-			LeafFillSpecificSlot(new_node.get(), hash,
-					     std::string(key.data(), key.size()),
-					     std::string(value.data(), value.size()), 0);
+			LeafFillSpecificSlot(new_node.get(), hash, key, value, 0);
 		});
 		tree_top = move(new_node);
-	} else if (LeafFillSlotForKey(leafnode, hash, std::string(key.data(), key.size()),
-				      std::string(value.data(), value.size()))) {
+	} else if (LeafFillSlotForKey(leafnode, hash, key, value)) {
 		// nothing else to do
 	} else {
-		// XXX - do not create temporary string
-		LeafSplitFull(leafnode, hash, std::string(key.data(), key.size()),
-			      std::string(value.data(), value.size()));
+		LeafSplitFull(leafnode, hash, key, value);
 	}
-	return status::OK;
 }
 
-status tree3::remove(string_view key)
+status tree3::DoRemove(string_view key)
 {
-	LOG("remove key=" << std::string(key.data(), key.size()));
-	check_outside_tx();
-
-	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearch(key);
 	if (!leafnode) {
 		LOG("   head not present");
 		return status::NOT_FOUND;
 	}
 
-	const auto hash = PearsonHash(key.data(), key.size());
-	for (int slot = LEAF_KEYS; slot--;) {
-		if (leafnode->hashes[slot] == hash) {
-			if (leafnode->keys[slot].compare(
-				    std::string(key.data(), key.size())) == 0) {
-				LOG("   freeing slot=" << slot);
-				leafnode->hashes[slot] = 0;
-				leafnode->keys[slot].clear();
-				auto leaf = leafnode->leaf;
-				transaction::run(pmpool, [&] {
-					leaf->slots[slot].get_rw().clear();
-				});
-				return status::OK; // no duplicate keys allowed
-			}
+	const auto hash = internal::tree3::PearsonHash(key.data(), key.size());
+	for (auto mask = internal::tree3::LeafProbeHashes(leafnode->hashes, hash); mask;
+	     mask &= mask - 1) {
+		const int slot = __builtin_ctzll(mask);
+		if (leafnode->keys[slot].compare(0, std::string::npos, key.data(),
+						 key.size()) == 0) {
+			LOG("   freeing slot=" << slot);
+			leafnode->hashes[slot] = 0;
+			leafnode->keys[slot].clear();
+			leafnode->unsort();
+			auto leaf = leafnode->leaf;
+			transaction::run(pmpool,
+					 [&] { leaf->slots[slot].get_rw().clear(); });
+			LeafCoalesce(leafnode);
+			return status::OK; // no duplicate keys allowed
 		}
 	}
 	return status::NOT_FOUND;
@@ -233,60 +828,43 @@ status tree3::remove(string_view key)
 // PROTECTED LEAF METHODS
 // ===============================================================================================
 
-internal::tree3::KVLeafNode *tree3::LeafSearch(const std::string &key)
+internal::tree3::KVLeafNode *tree3::LeafSearch(string_view key)
 {
-	internal::tree3::KVNode *node = tree_top.get();
-	if (node == nullptr)
-		return nullptr;
-	bool matched;
-	while (!node->is_leaf) {
-		matched = false;
-		auto inner = (internal::tree3::KVInnerNode *)node;
-#ifndef NDEBUG
-		inner->assert_invariants();
-#endif
-		const uint8_t keycount = inner->keycount;
-		for (uint8_t idx = 0; idx < keycount; idx++) {
-			node = inner->children[idx].get();
-			if (key.compare(inner->keys[idx]) <= 0) {
-				matched = true;
-				break;
-			}
-		}
-		if (!matched)
-			node = inner->children[keycount].get();
-	}
-	return (internal::tree3::KVLeafNode *)node;
+	return FindLeaf(tree_top.get(), key);
 }
 
 void tree3::LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			      const std::string &key, const std::string &value)
+			      string_view key, string_view value)
 {
-	for (int slot = LEAF_KEYS; slot--;) {
-		if (leafnode->hashes[slot] == 0) {
-			LeafFillSpecificSlot(leafnode, hash, key, value, slot);
-			return;
-		}
+	// use the highest empty slot
+	auto mask = internal::tree3::LeafProbeHashes(leafnode->hashes, 0);
+	if (mask) {
+		const int slot = 63 - __builtin_clzll(mask);
+		LeafFillSpecificSlot(leafnode, hash, key, value, slot);
 	}
 }
 
 bool tree3::LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			       const std::string &key, const std::string &value)
+			       string_view key, string_view value)
 {
 	// scan for empty/matching slots
 	int last_empty_slot = -1;
 	int key_match_slot = -1;
-	for (int slot = LEAF_KEYS; slot--;) {
-		auto slot_hash = leafnode->hashes[slot];
-		if (slot_hash == 0) {
-			last_empty_slot = slot;
-		} else if (slot_hash == hash) {
-			if (leafnode->keys[slot].compare(key) == 0) {
-				key_match_slot = slot;
-				break; // no duplicate keys allowed
-			}
+	for (auto mask = internal::tree3::LeafProbeHashes(leafnode->hashes, hash); mask;
+	     mask &= mask - 1) {
+		const int slot = __builtin_ctzll(mask);
+		if (leafnode->keys[slot].compare(0, std::string::npos, key.data(),
+						 key.size()) == 0) {
+			key_match_slot = slot;
+			break; // no duplicate keys allowed
 		}
 	}
+	if (key_match_slot < 0) {
+		// use the lowest empty slot
+		auto empty_mask = internal::tree3::LeafProbeHashes(leafnode->hashes, 0);
+		if (empty_mask)
+			last_empty_slot = __builtin_ctzll(empty_mask);
+	}
 
 	// update suitable slot if found
 	int slot = key_match_slot >= 0 ? key_match_slot : last_empty_slot;
@@ -300,26 +878,31 @@ bool tree3::LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, const uint
 }
 
 void tree3::LeafFillSpecificSlot(internal::tree3::KVLeafNode *leafnode,
-				 const uint8_t hash, const std::string &key,
-				 const std::string &value, const int slot)
+				 const uint8_t hash, string_view key, string_view value,
+				 const int slot)
 {
 	leafnode->leaf->slots[slot].get_rw().set(hash, key, value);
+	if (leafnode->hashes[slot] == 0)
+		leafnode->unsort(); // new key, not an update
 	leafnode->hashes[slot] = hash;
-	leafnode->keys[slot] = key;
+	leafnode->keys[slot].assign(key.data(), key.size());
 }
 
 void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			  const std::string &key, const std::string &value)
+			  string_view key, string_view value)
 {
-	std::string keys[LEAF_KEYS + 1];
+	PMEMKV_PROBE(leaf__split__entry);
+	string_view keys[LEAF_KEYS + 1];
 	keys[LEAF_KEYS] = key;
 	for (int slot = LEAF_KEYS; slot--;)
 		keys[slot] = leafnode->keys[slot];
 	std::sort(std::begin(keys), std::end(keys),
-		  [](const std::string &lhs, const std::string &rhs) {
-			  return lhs.compare(rhs) < 0;
+		  [](string_view lhs, string_view rhs) {
+			  return CompareKeys(lhs, rhs) < 0;
 		  });
-	std::string split_key = keys[LEAF_KEYS_MIDPOINT];
+	// copy, as the keys of the leaf are moved below
+	std::string split_key(keys[LEAF_KEYS_MIDPOINT].data(),
+			      keys[LEAF_KEYS_MIDPOINT].size());
 	LOG("   splitting leaf at key=" << split_key);
 
 	// split leaf into two leaves, moving slots that sort above split key to new leaf
@@ -336,7 +919,8 @@ void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t h
 		} else {
 			auto old_head =
 				persistent_ptr<internal::tree3::KVLeaf>(*root_oid);
-			new_leaf = make_persistent<internal::tree3::KVLeaf>();
+			new_leaf = make_persistent<internal::tree3::KVLeaf>(
+				alloc->flag(sizeof(internal::tree3::KVLeaf)));
 			transaction::snapshot(root_oid);
 			*root_oid = new_leaf.raw();
 			new_leaf->next = old_head;
@@ -351,25 +935,115 @@ void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t h
 				leafnode->keys[slot].clear();
 			}
 		}
-		auto target = key.compare(split_key) > 0 ? new_leafnode.get() : leafnode;
+		leafnode->unsort();
+		auto target = CompareKeys(key, split_key) > 0 ? new_leafnode.get()
+							      : leafnode;
 		LeafFillEmptySlot(target, hash, key, value);
 	});
 
+	// new leaf holds the upper half of keys, so it follows the split one
+	new_leafnode->prev = leafnode;
+	new_leafnode->next = leafnode->next;
+	if (leafnode->next)
+		leafnode->next->prev = new_leafnode.get();
+	leafnode->next = new_leafnode.get();
+
 	// recursively update volatile parents outside persistent transaction
-	InnerUpdateAfterSplit(leafnode, move(new_leafnode), &split_key);
+	leaf_splits++;
+	InnerUpdateAfterSplit(leafnode, move(new_leafnode), split_key);
+	PMEMKV_PROBE(leaf__split__return);
+}
+
+void tree3::LeafCoalesce(internal::tree3::KVLeafNode *leafnode)
+{
+	internal::tree3::KVInnerNode *inner = leafnode->parent;
+	const size_t count = leafnode->size();
+	if (!inner || count > LEAF_KEYS_COALESCE)
+		return;
+
+	// only siblings are coalesced, so the keys of the inner node stay in order
+	size_t idx = 0;
+	while (inner->children[idx].get() != leafnode)
+		idx++;
+	if (inner->keycount == 0)
+		return;
+	const bool into_prev = idx > 0;
+	const size_t sibling_idx = into_prev ? idx - 1 : idx + 1;
+	// collapsing an inner node moves its child up, so the sibling may be inner
+	if (!inner->children[sibling_idx]->is_leaf)
+		return;
+	auto sibling = (internal::tree3::KVLeafNode *)inner->children[sibling_idx].get();
+	if (sibling->size() + count > LEAF_KEYS_BULK_LOAD)
+		return;
+	LOG("   coalescing leaf of " << count << " keys");
+
+	// move occupied slots to empty slots of the sibling, the emptied leaf is kept
+	// in the list of persistent leaves, so recovery adds it to leaves_prealloc too
+	transaction::run(pmpool, [&] {
+		auto empty_mask = internal::tree3::LeafProbeHashes(sibling->hashes, 0);
+		for (int slot = LEAF_KEYS; slot--;) {
+			if (leafnode->hashes[slot] == 0)
+				continue;
+			const int target = __builtin_ctzll(empty_mask);
+			empty_mask &= empty_mask - 1;
+			sibling->leaf->slots[target].swap(leafnode->leaf->slots[slot]);
+			sibling->hashes[target] = leafnode->hashes[slot];
+			sibling->keys[target] = move(leafnode->keys[slot]);
+			leafnode->hashes[slot] = 0;
+			leafnode->keys[slot].clear();
+		}
+	});
+	sibling->unsort();
+	leaves_prealloc.push_back(leafnode->leaf);
+
+	if (leafnode->prev)
+		leafnode->prev->next = leafnode->next;
+	if (leafnode->next)
+		leafnode->next->prev = leafnode->prev;
+
+	// remove the leaf with the key separating it from the sibling
+	const size_t keycount = inner->keycount;
+	for (size_t i = into_prev ? idx - 1 : idx; i + 1 < keycount; i++)
+		inner->move_key(i, *inner, i + 1);
+	inner->keys[keycount - 1].clear();
+	for (size_t i = idx; i < keycount; i++)
+		inner->children[i] = move(inner->children[i + 1]);
+	inner->children[keycount].reset();
+	inner->keycount = (uint8_t)(keycount - 1);
+	leaf_merges++;
+#ifndef NDEBUG
+	inner->assert_invariants();
+#endif
+
+	// an inner node left with a single child is replaced by the child
+	if (inner->keycount == 0) {
+		auto child = move(inner->children[0]);
+		child->parent = inner->parent;
+		if (!inner->parent) {
+			assert(inner == tree_top.get());
+			tree_top = move(child);
+			return;
+		}
+		auto parent = inner->parent;
+		size_t pos = 0;
+		while (parent->children[pos].get() != inner)
+			pos++;
+		parent->children[pos] = move(child); // deletes the inner node
+	}
 }
 
 void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 				  unique_ptr<internal::tree3::KVNode> new_node,
-				  std::string *split_key)
+				  string_view split_key)
 {
 	if (!node->parent) {
 		assert(node == tree_top.get());
-		LOG("   creating new top node for split_key=" << *split_key);
+		LOG("   creating new top node for split_key="
+		    << std::string(split_key.data(), split_key.size()));
 		unique_ptr<internal::tree3::KVInnerNode> top(
 			new internal::tree3::KVInnerNode());
 		top->keycount = 1;
-		top->keys[0] = *split_key;
+		top->set_key(0, std::string(split_key.data(), split_key.size()));
 		node->parent = top.get();
 		new_node->parent = top.get();
 		top->children[0] = move(tree_top);
@@ -381,23 +1055,22 @@ void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 		return;		      // end recursion
 	}
 
-	LOG("   updating parents for split_key=" << *split_key);
+	LOG("   updating parents for split_key="
+	    << std::string(split_key.data(), split_key.size()));
 	internal::tree3::KVInnerNode *inner = node->parent;
 	{ // insert split_key and new_node into inner node in sorted order
-		const uint8_t keycount = inner->keycount;
-		int idx = 0; // position where split_key should be inserted
-		while (idx < keycount && inner->keys[idx].compare(*split_key) <= 0)
-			idx++;
-		for (int i = keycount - 1; i >= idx; i--)
-			inner->keys[i + 1] = move(inner->keys[i]);
-		for (int i = keycount; i > idx; i--)
+		const size_t keycount = inner->keycount;
+		const size_t idx = inner->upper_bound(split_key);
+		for (size_t i = keycount; i > idx; i--)
+			inner->move_key(i, *inner, i - 1);
+		for (size_t i = keycount; i > idx; i--)
 			inner->children[i + 1] = move(inner->children[i]);
-		inner->keys[idx] = *split_key;
+		inner->set_key(idx, std::string(split_key.data(), split_key.size()));
 		inner->children[idx + 1] = move(new_node);
 		inner->keycount = (uint8_t)(keycount + 1);
 	}
-	const uint8_t keycount = inner->keycount;
-	if (keycount <= INNER_KEYS) {
+	const size_t keycount = inner->keycount;
+	if (keycount <= inner_keys) {
 #ifndef NDEBUG
 		inner->assert_invariants();
 #endif
@@ -405,22 +1078,21 @@ void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 	}
 
 	// split inner node at the midpoint, update parents as needed
+	const size_t midpoint = keycount / 2; // key moved up to the parent
 	unique_ptr<internal::tree3::KVInnerNode> ni(
-		new internal::tree3::KVInnerNode());	    // create new inner node
-	ni->parent = inner->parent;			    // set parent reference
-	for (int i = INNER_KEYS_UPPER; i < keycount; i++) { // move all upper keys
-		ni->keys[i - INNER_KEYS_UPPER] = move(inner->keys[i]); // move key string
-	}
-	for (int i = INNER_KEYS_UPPER; i < keycount + 1; i++) { // move all upper children
-		ni->children[i - INNER_KEYS_UPPER] =
+		new internal::tree3::KVInnerNode());		// create new inner node
+	ni->parent = inner->parent;				// set parent reference
+	for (size_t i = midpoint + 1; i < keycount; i++)	// move all upper keys
+		ni->move_key(i - midpoint - 1, *inner, i);
+	for (size_t i = midpoint + 1; i < keycount + 1; i++) { // move all upper children
+		ni->children[i - midpoint - 1] =
 			move(inner->children[i]); // move child reference
-		ni->children[i - INNER_KEYS_UPPER]->parent =
+		ni->children[i - midpoint - 1]->parent =
 			ni.get(); // set parent reference
 	}
-	ni->keycount = INNER_KEYS_MIDPOINT; // always half the keys
-	std::string new_split_key =
-		inner->keys[INNER_KEYS_MIDPOINT]; // save for recursion
-	inner->keycount = INNER_KEYS_MIDPOINT;	  // half of keys remain
+	ni->keycount = (uint8_t)(keycount - midpoint - 1);
+	std::string new_split_key = move(inner->keys[midpoint]); // save for recursion
+	inner->keycount = (uint8_t)midpoint;			  // half of keys remain
 
 	// perform deep check on modified inner nodes
 #ifndef NDEBUG
@@ -428,87 +1100,253 @@ void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 	ni->assert_invariants();    // check new node
 #endif
 
-	InnerUpdateAfterSplit(inner, move(ni), &new_split_key); // recursive update
+	inner_splits++;
+	InnerUpdateAfterSplit(inner, move(ni), new_split_key); // recursive update
 }
 
 // ===============================================================================================
 // PROTECTED LIFECYCLE METHODS
 // ===============================================================================================
 
-void tree3::Recover()
+// runs f(0) ... f(tasks - 1), each on a separate thread (first one on the calling
+// thread), and rethrows the first exception thrown by any of them
+template <typename F>
+static void RunParallel(size_t tasks, F f)
 {
-	LOG("Recovering");
-
-	// traverse persistent leaves to build list of leaves to recover
-	std::list<internal::tree3::KVRecoveredLeaf> leaves;
-
-	auto root_leaf = persistent_ptr<internal::tree3::KVLeaf>(*root_oid);
+	std::vector<std::exception_ptr> errors(tasks);
+	std::vector<std::thread> workers;
+	workers.reserve(tasks);
+	auto run = [&](size_t task) {
+		try {
+			f(task);
+		} catch (...) {
+			errors[task] = std::current_exception();
+		}
+	};
+	for (size_t task = 1; task < tasks; task++)
+		workers.emplace_back(run, task);
+	run(0);
+	for (auto &worker : workers)
+		worker.join();
+	for (auto &error : errors)
+		if (error)
+			std::rethrow_exception(error);
+}
 
-	while (root_leaf) {
-		unique_ptr<internal::tree3::KVLeafNode> leafnode(
-			new internal::tree3::KVLeafNode());
-		leafnode->leaf = root_leaf;
-		leafnode->is_leaf = true;
+// start of the part of [0, count) which is processed by given task
+static size_t PartitionBegin(size_t count, size_t tasks, size_t task)
+{
+	return count * task / tasks;
+}
 
-		// find highest sorting key in leaf, while recovering all hashes
-		bool empty_leaf = true;
-		std::string max_key;
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = root_leaf->slots[slot].get_ro();
-			if (kvslot.empty())
-				continue;
-			leafnode->hashes[slot] = kvslot.hash();
-			if (leafnode->hashes[slot] == 0)
-				continue;
-			const char *key = kvslot.key();
-			if (empty_leaf) {
-				max_key = std::string(kvslot.key(), kvslot.get_ks());
-				empty_leaf = false;
-			} else if (max_key.compare(0, std::string::npos, kvslot.key(),
-						   kvslot.get_ks()) < 0) {
-				max_key = std::string(kvslot.key(), kvslot.get_ks());
-			}
-			leafnode->keys[slot] = std::string(key, kvslot.get_ks());
-		}
+static internal::tree3::KVRecoveredNode
+RecoverLeaf(const persistent_ptr<internal::tree3::KVLeaf> &leaf)
+{
+	unique_ptr<internal::tree3::KVLeafNode> leafnode(new internal::tree3::KVLeafNode());
+	leafnode->leaf = leaf;
+	leafnode->is_leaf = true;
 
-		// use highest sorting key to decide how to recover the leaf
+	// find highest sorting key in leaf, while recovering all hashes
+	bool empty_leaf = true;
+	std::string max_key;
+	for (int slot = LEAF_KEYS; slot--;) {
+		const auto &kvslot = leaf->slots[slot].get_ro();
+		if (kvslot.empty())
+			continue;
+		leafnode->hashes[slot] = kvslot.hash();
+		if (leafnode->hashes[slot] == 0)
+			continue;
+		const char *key = kvslot.key();
 		if (empty_leaf) {
-			leaves_prealloc.push_back(root_leaf);
-		} else {
-			leaves.push_back({move(leafnode), max_key});
+			max_key = std::string(kvslot.key(), kvslot.get_ks());
+			empty_leaf = false;
+		} else if (max_key.compare(0, std::string::npos, kvslot.key(),
+					   kvslot.get_ks()) < 0) {
+			max_key = std::string(kvslot.key(), kvslot.get_ks());
 		}
+		leafnode->keys[slot] = std::string(key, kvslot.get_ks());
+	}
+
+	// empty leaves are returned without a node, to be reused by later puts
+	if (empty_leaf)
+		return {nullptr, std::string()};
+	return {move(leafnode), move(max_key)};
+}
 
+// sorts recovered leaves in ascending key order: sorts parts in parallel, then
+// merges adjacent pairs of sorted parts until one is left
+static void SortLeaves(vector<internal::tree3::KVRecoveredNode> &leaves, size_t tasks)
+{
+	auto compare = [](const internal::tree3::KVRecoveredNode &lhs,
+			  const internal::tree3::KVRecoveredNode &rhs) {
+		return (lhs.max_key.compare(rhs.max_key) < 0);
+	};
+	const size_t parts = std::max<size_t>(1, std::min(tasks, leaves.size()));
+	vector<size_t> bounds;
+	for (size_t part = 0; part <= parts; part++)
+		bounds.push_back(PartitionBegin(leaves.size(), parts, part));
+	auto first = leaves.data();
+	RunParallel(parts, [&](size_t part) {
+		std::sort(first + bounds[part], first + bounds[part + 1], compare);
+	});
+	while (bounds.size() > 2) {
+		RunParallel((bounds.size() - 1) / 2, [&](size_t pair) {
+			std::inplace_merge(first + bounds[2 * pair],
+					   first + bounds[2 * pair + 1],
+					   first + bounds[2 * pair + 2], compare);
+		});
+		vector<size_t> merged;
+		for (size_t i = 0; i < bounds.size(); i += 2)
+			merged.push_back(bounds[i]);
+		if (merged.back() != bounds.back())
+			merged.push_back(bounds.back());
+		bounds = move(merged);
+	}
+}
+
+void tree3::Recover()
+{
+	LOG("Recovering");
+
+	// traverse persistent leaves to build list of leaves to recover, unless
+	// they are given in key order by an image saved on clean close
+	vector<persistent_ptr<internal::tree3::KVLeaf>> persistent_leaves;
+	image_recovered = LoadImage(persistent_leaves);
+	auto root_leaf = persistent_ptr<internal::tree3::KVLeaf>(
+		image_recovered ? OID_NULL : *root_oid);
+	while (root_leaf) {
+		persistent_leaves.push_back(root_leaf);
 		root_leaf = root_leaf->next.get(); // advance to next linked leaf
 	}
 
-	// sort recovered leaves in ascending key order
-	leaves.sort([](const internal::tree3::KVRecoveredLeaf &lhs,
-		       const internal::tree3::KVRecoveredLeaf &rhs) {
-		return (lhs.max_key.compare(rhs.max_key) < 0);
+	const size_t count = persistent_leaves.size();
+	const size_t tasks = std::max<size_t>(1, std::min(recovery_threads, count));
+	LOG("   recovering " << count << " leaves using " << tasks << " threads");
+
+	// rebuild volatile leaf nodes, each thread handles a part of the list
+	vector<internal::tree3::KVRecoveredNode> recovered(count);
+	RunParallel(tasks, [&](size_t task) {
+		const size_t end = PartitionBegin(count, tasks, task + 1);
+		for (size_t i = PartitionBegin(count, tasks, task); i < end; i++)
+			recovered[i] = RecoverLeaf(persistent_leaves[i]);
 	});
 
-	// reconstruct top/inner nodes using adjacent pairs of recovered leaves
+	vector<internal::tree3::KVRecoveredNode> leaves;
+	leaves.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		if (recovered[i].node)
+			leaves.push_back(move(recovered[i]));
+		else
+			leaves_prealloc.push_back(persistent_leaves[i]);
+	}
+
+	// leaves of an image are already in ascending key order
+	if (!image_recovered)
+		SortLeaves(leaves, tasks);
+
+	// reconstruct top/inner nodes level by level, starting from the leaves
 	tree_top.reset(nullptr);
+	RecoverInnerNodes(leaves);
+
+	LOG("Recovered ok");
+}
+
+// The image is a single allocation: count of leaves, followed by their oids, with
+// leaves in use in ascending key order, then the preallocated ones. It is valid
+// only if the engine was closed cleanly, since the first change makes it stale.
+bool tree3::LoadImage(vector<persistent_ptr<internal::tree3::KVLeaf>> &leaves)
+{
+	if (!image_oid || OID_IS_NULL(*image_oid) || !previous_shutdown_clean)
+		return false;
+
+	auto count = (const uint64_t *)pmemobj_direct(*image_oid);
+	auto oids = (const PMEMoid *)(count + 1);
+	leaves.reserve(*count);
+	for (uint64_t i = 0; i < *count; i++)
+		leaves.emplace_back(oids[i]);
+	LOG("   loaded " << *count << " leaves from image");
+	return true;
+}
+
+void tree3::SaveImage()
+{
+	if (!image_oid)
+		return;
+
+	vector<PMEMoid> oids;
+	for (auto leafnode = EdgeLeaf(tree_top.get(), false); leafnode;
+	     leafnode = leafnode->next)
+		oids.push_back(leafnode->leaf.raw());
+	for (auto &leaf : leaves_prealloc)
+		oids.push_back(leaf.raw());
+
+	transaction::run(pmpool, [&] {
+		transaction::snapshot(image_oid);
+		if (!OID_IS_NULL(*image_oid))
+			pmemobj_tx_free(*image_oid);
+		*image_oid = pmemobj_tx_alloc(
+			sizeof(uint64_t) + oids.size() * sizeof(PMEMoid), 0);
+		auto count = (uint64_t *)pmemobj_direct(*image_oid);
+		*count = oids.size();
+		if (!oids.empty())
+			memcpy(count + 1, oids.data(), oids.size() * sizeof(PMEMoid));
+	});
+	LOG("   saved " << oids.size() << " leaves to image");
+}
 
-	if (!leaves.empty()) {
-		tree_top = move(leaves.front().leafnode);
-		auto max_key = leaves.front().max_key;
-		leaves.pop_front();
-
-		auto prevnode = tree_top.get();
-		while (!leaves.empty()) {
-			std::string split_key = std::string(max_key);
-			auto nextnode = leaves.front().leafnode.get();
-			nextnode->parent = prevnode->parent;
-			InnerUpdateAfterSplit(prevnode, move(leaves.front().leafnode),
-					      &split_key);
-			max_key = leaves.front().max_key;
-			leaves.pop_front();
-			prevnode = nextnode;
+void tree3::FreeImage()
+{
+	if (!image_oid || OID_IS_NULL(*image_oid))
+		return;
+
+	transaction::run(pmpool, [&] {
+		transaction::snapshot(image_oid);
+		pmemobj_tx_free(*image_oid);
+		*image_oid = OID_NULL;
+	});
+}
+
+void tree3::RecoverInnerNodes(vector<internal::tree3::KVRecoveredNode> &level)
+{
+	// link leaves, given in ascending key order
+	for (size_t i = 1; i < level.size(); i++) {
+		auto prev = (internal::tree3::KVLeafNode *)level[i - 1].node.get();
+		auto next = (internal::tree3::KVLeafNode *)level[i].node.get();
+		prev->next = next;
+		next->prev = prev;
+	}
+
+	while (level.size() > 1) {
+		// spread nodes evenly, so that each inner node has at least two children
+		const size_t count = level.size();
+		const size_t inner_count = (count + inner_keys) / (inner_keys + 1);
+		vector<internal::tree3::KVRecoveredNode> upper(inner_count);
+		size_t child = 0;
+		for (size_t n = 0; n < inner_count; n++) {
+			const size_t end = PartitionBegin(count, inner_count, n + 1);
+			unique_ptr<internal::tree3::KVInnerNode> inner(
+				new internal::tree3::KVInnerNode());
+			inner->keycount = (uint8_t)(end - child - 1);
+			for (size_t idx = 0; child < end; idx++, child++) {
+				level[child].node->parent = inner.get();
+				inner->children[idx] = move(level[child].node);
+				if (child + 1 < end)
+					inner->set_key(idx, move(level[child].max_key));
+				else
+					upper[n].max_key = move(level[child].max_key);
+			}
+#ifndef NDEBUG
+			inner->assert_invariants();
+#endif
+			upper[n].node = move(inner);
 		}
+		level = move(upper);
 	}
 
-	LOG("Recovered ok");
+	if (!level.empty()) {
+		tree_top = move(level.front().node);
+		tree_top->parent = nullptr;
+	}
 }
 
 // ===============================================================================================
@@ -534,8 +1372,74 @@ const uint8_t PEARSON_LOOKUP_TABLE[256] = {
 	96,  235, 136, 208, 162, 129, 190, 132, 156, 38,  47,  1,   7,	 254, 24,  4,
 	216, 131, 89,  21,  28,	 133, 37,  153, 149, 80,  170, 68,  6,	 169, 234, 151};
 
+// ===============================================================================================
+// LEAF HASH PROBE
+// ===============================================================================================
+
+static uint64_t LeafProbeHashesScalar(const uint8_t (&hashes)[LEAF_KEYS], uint8_t hash)
+{
+	uint64_t mask = 0;
+	for (int slot = 0; slot < LEAF_KEYS; slot++) {
+		if (hashes[slot] == hash)
+			mask |= (uint64_t)1 << slot;
+	}
+	return mask;
+}
+
+#ifdef TREE3_SIMD_PROBE
+
+static_assert(LEAF_KEYS == 48, "SIMD probe kernels assume 48 slots per leaf");
+
+static uint64_t LeafProbeHashesSSE2(const uint8_t (&hashes)[LEAF_KEYS], uint8_t hash)
+{
+	const __m128i needle = _mm_set1_epi8((char)hash);
+	uint64_t mask = 0;
+	for (int i = 0; i < LEAF_KEYS / 16; i++) {
+		const __m128i chunk = _mm_loadu_si128((const __m128i *)(hashes + 16 * i));
+		const uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		mask |= (uint64_t)m << (16 * i);
+	}
+	return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+LeafProbeHashesAVX2(const uint8_t (&hashes)[LEAF_KEYS], uint8_t hash)
+{
+	const __m256i needle = _mm256_set1_epi8((char)hash);
+	const __m256i low = _mm256_loadu_si256((const __m256i *)hashes);
+	const __m128i high = _mm_loadu_si128((const __m128i *)(hashes + 32));
+	const uint32_t low_mask =
+		(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, needle));
+	const uint32_t high_mask = (uint32_t)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(high, _mm256_castsi256_si128(needle)));
+	return (uint64_t)low_mask | ((uint64_t)high_mask << 32);
+}
+
+#endif
+
+typedef uint64_t (*LeafProbeHashesFn)(const uint8_t (&)[LEAF_KEYS], uint8_t);
+
+static LeafProbeHashesFn LeafProbeHashesSelect()
+{
+#ifdef TREE3_SIMD_PROBE
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return LeafProbeHashesAVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return LeafProbeHashesSSE2;
+#endif
+	return LeafProbeHashesScalar;
+}
+
+uint64_t internal::tree3::LeafProbeHashes(const uint8_t (&hashes)[LEAF_KEYS],
+					  uint8_t hash)
+{
+	static const LeafProbeHashesFn probe = LeafProbeHashesSelect();
+	return probe(hashes, hash);
+}
+
 // Modified Pearson hashing algorithm from RFC 3074
-uint8_t tree3::PearsonHash(const char *data, const size_t size)
+uint8_t internal::tree3::PearsonHash(const char *data, const size_t size)
 {
 	auto hash = (uint8_t)size;
 	for (size_t i = size; i > 0;) {
@@ -550,54 +1454,228 @@ uint8_t tree3::PearsonHash(const char *data, const size_t size)
 // SLOT CLASS METHODS
 // ===============================================================================================
 
-bool internal::tree3::KVSlot::empty()
+void internal::tree3::KVSlot::free_buffer()
 {
-	if (kv)
-		return false;
-	else
-		return true;
+	if (empty() || is_inline())
+		return;
+
+	size_t size = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t) + get_ks() +
+		get_vs() + 2;
+	delete_persistent<char[]>(persistent_ptr<char[]>(kv), size);
 }
 
 void internal::tree3::KVSlot::clear()
 {
-	if (kv) {
-		char *p = kv.get();
-		set_ph_direct(p, 0);
-		set_ks_direct(p, 0);
-		set_vs_direct(p, 0);
-		delete_persistent<char[]>(kv,
-					  sizeof(uint8_t) + sizeof(uint32_t) +
-						  sizeof(uint32_t) + get_ks_direct(p) +
-						  get_vs_direct(p) + 2);
-		kv = nullptr;
-	}
+	free_buffer();
+	kv = OID_NULL;
 }
 
-void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
-				  const std::string &value)
+void internal::tree3::KVSlot::set(const uint8_t hash, string_view key,
+				  string_view value)
 {
-	if (kv) {
-		char *p = kv.get();
-		delete_persistent<char[]>(kv,
-					  sizeof(uint8_t) + sizeof(uint32_t) +
-						  sizeof(uint32_t) + get_ks_direct(p) +
-						  get_vs_direct(p) + 2);
-	}
+	free_buffer();
 	size_t ksize;
 	size_t vsize;
 	ksize = key.size();
 	vsize = value.size();
+	if (ksize + vsize <= INLINE_CAPACITY) {
+		char *p = reinterpret_cast<char *>(&kv);
+		p[0] = static_cast<char>(hash);
+		p[1] = static_cast<char>(vsize);
+		memcpy(p + 2, key.data(), ksize);
+		memcpy(p + 2 + ksize, value.data(), vsize);
+		memset(p + 2 + ksize + vsize, 0, INLINE_CAPACITY - ksize - vsize);
+		p[sizeof(PMEMoid) - 1] = static_cast<char>(INLINE | ksize);
+		return;
+	}
+
 	size_t size =
 		ksize + vsize + 2 + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint8_t);
-	kv = make_persistent<char[]>(size);
-	char *p = kv.get();
-	set_ph_direct(p, hash);
-	set_ks_direct(p, (uint32_t)ksize);
-	set_vs_direct(p, (uint32_t)vsize);
+	auto buf = make_persistent<char[]>(
+		size,
+		pmem::obj::allocation_flag(
+			alloc_classes::flags(pmemobj_pool_by_ptr(this), size)));
+	char *p = buf.get();
+	*((uint32_t *)(p)) = (uint32_t)ksize;
+	*((uint32_t *)(p + sizeof(uint32_t))) = (uint32_t)vsize;
+	*((uint8_t *)(p + sizeof(uint32_t) + sizeof(uint32_t))) = hash;
 	char *kvptr = p + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint8_t);
 	memcpy(kvptr, key.data(), ksize);   // copy key into buffer
 	kvptr += ksize + 1;		    // advance ptr past key
 	memcpy(kvptr, value.data(), vsize); // copy value into buffer
+	kv = buf.raw();
+}
+
+// ===============================================================================================
+// INNER NODE METHODS
+// ===============================================================================================
+
+// Returns the first 8 bytes of the key as a big-endian integer, padded with zeros,
+// so that comparing prefixes of two keys orders them as comparing the keys would,
+// unless the prefixes are equal
+static uint64_t KeyPrefix(const char *data, const size_t size)
+{
+	uint64_t prefix = 0;
+	const size_t n = std::min(size, sizeof(prefix));
+	for (size_t i = 0; i < sizeof(prefix); i++)
+		prefix = (prefix << 8) | (i < n ? (uint8_t)data[i] : 0u);
+	return prefix;
+}
+
+void internal::tree3::KVInnerNode::set_key(size_t idx, std::string key)
+{
+	prefixes[idx] = KeyPrefix(key.data(), key.size());
+	keys[idx] = move(key);
+}
+
+void internal::tree3::KVInnerNode::move_key(size_t to, KVInnerNode &from, size_t idx)
+{
+	prefixes[to] = from.prefixes[idx];
+	keys[to] = move(from.keys[idx]);
+}
+
+size_t internal::tree3::KVInnerNode::lower_bound(string_view key) const
+{
+	return bound(key, false);
+}
+
+size_t internal::tree3::KVInnerNode::upper_bound(string_view key) const
+{
+	return bound(key, true);
+}
+
+size_t internal::tree3::KVInnerNode::bound(string_view key, bool upper) const
+{
+	const uint64_t prefix = KeyPrefix(key.data(), key.size());
+	size_t idx = (size_t)(std::lower_bound(prefixes, prefixes + keycount, prefix) -
+			      prefixes);
+	for (; idx < keycount && prefixes[idx] == prefix; idx++) {
+		int cmp = keys[idx].compare(0, std::string::npos, key.data(), key.size());
+		if (cmp > 0 || (cmp == 0 && !upper))
+			break;
+	}
+	return idx;
+}
+
+size_t internal::tree3::KVLeafNode::size() const
+{
+	if (ordered >= 0)
+		return (size_t)ordered;
+	return LEAF_KEYS - (size_t)__builtin_popcountll(LeafProbeHashes(hashes, 0));
+}
+
+size_t internal::tree3::KVLeafNode::sort()
+{
+	if (ordered < 0) {
+		size_t count = 0;
+		for (uint8_t slot = 0; slot < LEAF_KEYS; slot++)
+			if (hashes[slot] != 0)
+				order[count++] = slot;
+		std::sort(order, order + count, [&](uint8_t lhs, uint8_t rhs) {
+			return CompareKeys(keys[lhs], keys[rhs]) < 0;
+		});
+		ordered = (int)count;
+	}
+	return (size_t)ordered;
+}
+
+// ===============================================================================================
+// ITERATOR METHODS
+// ===============================================================================================
+
+internal::tree3::iterator::iterator(const unique_ptr<KVNode> &top)
+    : top(top), pos(END_POSITION)
+{
+}
+
+status internal::tree3::iterator::seek(string_view key)
+{
+	auto p = Bound(top.get(), key, false);
+	if (p.leaf && CompareKeys(KeyAt(p), key) != 0)
+		p = END_POSITION;
+
+	return position(p);
+}
+
+status internal::tree3::iterator::seek_lower(string_view key)
+{
+	return position(Before(top.get(), Bound(top.get(), key, false)));
+}
+
+status internal::tree3::iterator::seek_lower_eq(string_view key)
+{
+	return position(Before(top.get(), Bound(top.get(), key, true)));
+}
+
+status internal::tree3::iterator::seek_higher(string_view key)
+{
+	return position(Bound(top.get(), key, true));
+}
+
+status internal::tree3::iterator::seek_higher_eq(string_view key)
+{
+	return position(Bound(top.get(), key, false));
+}
+
+status internal::tree3::iterator::seek_to_first()
+{
+	return position(First(top.get()));
+}
+
+status internal::tree3::iterator::seek_to_last()
+{
+	return position(Last(top.get()));
+}
+
+status internal::tree3::iterator::is_next()
+{
+	if (!pos.leaf || !Next(pos).leaf)
+		return status::NOT_FOUND;
+
+	return status::OK;
+}
+
+status internal::tree3::iterator::next()
+{
+	if (!pos.leaf)
+		return status::NOT_FOUND;
+
+	return position(Next(pos));
+}
+
+status internal::tree3::iterator::prev()
+{
+	if (!pos.leaf)
+		return status::NOT_FOUND;
+
+	return position(Backward(pos.leaf, pos.idx));
+}
+
+status internal::tree3::iterator::key(string_view &key)
+{
+	if (!pos.leaf)
+		return status::NOT_FOUND;
+
+	key = KeyAt(pos);
+
+	return status::OK;
+}
+
+status internal::tree3::iterator::value(string_view &value)
+{
+	if (!pos.leaf)
+		return status::NOT_FOUND;
+
+	value = ValueAt(pos);
+
+	return status::OK;
+}
+
+status internal::tree3::iterator::position(KVPosition p)
+{
+	pos = p;
+
+	return pos.leaf ? status::OK : status::NOT_FOUND;
 }
 
 // ===============================================================================================
@@ -606,13 +1684,15 @@ void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
 
 void internal::tree3::KVInnerNode::assert_invariants()
 {
-	assert(keycount <= INNER_KEYS);
+	assert(keycount <= INNER_KEYS_MAX);
 	for (auto i = 0; i < keycount; ++i) {
 		assert(keys[i].size() > 0);
+		assert(prefixes[i] == KeyPrefix(keys[i].data(), keys[i].size()));
+		assert(i == 0 || !(keys[i] < keys[i - 1]));
 		assert(children[i] != nullptr);
 	}
 	assert(children[keycount] != nullptr);
-	for (auto i = keycount + 1; i < INNER_KEYS + 1; ++i)
+	for (auto i = keycount + 1; i < INNER_KEYS_MAX + 2; ++i)
 		assert(children[i] == nullptr);
 }
 
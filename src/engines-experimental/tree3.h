@@ -32,6 +32,7 @@
 
 #pragma once
 
+#include "../iterator.h"
 #include "../pmemobj_engine.h"
 
 #include <libpmemobj++/make_persistent.hpp>
@@ -61,113 +62,102 @@ namespace internal
 namespace tree3
 {
 
-#define INNER_KEYS 4				// maximum keys for inner nodes
-#define INNER_KEYS_MIDPOINT (INNER_KEYS / 2)	// halfway point within the node
-#define INNER_KEYS_UPPER ((INNER_KEYS / 2) + 1) // index where upper half of keys begins
+#define INNER_KEYS 32				// default maximum keys for inner nodes
+#define INNER_KEYS_MAX 64			// capacity of inner nodes
 #define LEAF_KEYS 48				// maximum keys in tree nodes
 #define LEAF_KEYS_MIDPOINT (LEAF_KEYS / 2)	// halfway point within the node
+#define LEAF_KEYS_BULK_LOAD (LEAF_KEYS * 3 / 4) // keys in leaves filled by bulk load
+#define LEAF_KEYS_COALESCE (LEAF_KEYS / 4)	// keys in leaves coalesced by remove
 
+/*
+ * Slot of a persistent leaf, holding a key, its value and Pearson hash of the
+ * key. If the key and the value take at most INLINE_CAPACITY bytes together,
+ * they are stored in the slot itself:
+ *	hash (1 byte), value size (1), key & value (13), key size | INLINE (1)
+ * otherwise the slot holds PMEMoid of a separate buffer:
+ *	key size (4 bytes), value size (4), hash (1), key, '\0', value, '\0'
+ * The last byte of PMEMoid is the highest byte of the offset, which is 0 in
+ * every pool, so it tells which is the case. An empty slot is all zeros.
+ */
 class KVSlot {
 public:
+	static const size_t INLINE_CAPACITY = sizeof(PMEMoid) - 3;
+
 	uint8_t hash() const
 	{
 		return get_ph();
 	}
-	static uint8_t hash_direct(char *p)
-	{
-		return *((uint8_t *)(p + sizeof(uint32_t) + sizeof(uint32_t)));
-	}
 	const char *key() const
 	{
-		return ((char *)(kv.get()) + sizeof(uint8_t) + sizeof(uint32_t) +
-			sizeof(uint32_t));
+		if (is_inline())
+			return bytes() + 2;
+		return buffer() + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t);
 	}
-	static const char *key_direct(char *p)
-	{
-		return (p + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t));
-	}
-	const uint32_t keysize() const
+	uint32_t keysize() const
 	{
 		return get_ks();
 	}
-	static const uint32_t keysize_direct(char *p)
-	{
-		return *((uint32_t *)(p));
-	}
 	const char *val() const
 	{
-		return ((char *)(kv.get()) + sizeof(uint8_t) + sizeof(uint32_t) +
-			sizeof(uint32_t) + get_ks() + 1);
+		if (is_inline())
+			return bytes() + 2 + get_ks();
+		return buffer() + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t) +
+			get_ks() + 1;
 	}
-	static const char *val_direct(char *p)
-	{
-		return (p + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t) +
-			*((uint32_t *)(p)) + 1);
-	}
-	const uint32_t valsize() const
+	uint32_t valsize() const
 	{
 		return get_vs();
 	}
-	static const uint32_t valsize_direct(char *p)
-	{
-		return *((uint32_t *)(p + sizeof(uint32_t)));
-	}
 	void clear();
-	void set(const uint8_t hash, const std::string &key, const std::string &value);
-	void set_ph(uint8_t v)
-	{
-		*((uint8_t *)((char *)(kv.get()) + sizeof(uint32_t) + sizeof(uint32_t))) =
-			v;
-	}
-	static void set_ph_direct(char *p, uint8_t v)
-	{
-		*((uint8_t *)(p + sizeof(uint32_t) + sizeof(uint32_t))) = v;
-	}
-	void set_ks(uint32_t v)
-	{
-		*((uint32_t *)(kv.get())) = v;
-	}
-	static void set_ks_direct(char *p, uint32_t v)
-	{
-		*((uint32_t *)(p)) = v;
-	}
-	void set_vs(uint32_t v)
+	void set(const uint8_t hash, string_view key, string_view value);
+	uint8_t get_ph() const
 	{
-		*((uint32_t *)((char *)(kv.get()) + sizeof(uint32_t))) = v;
+		if (is_inline())
+			return static_cast<uint8_t>(bytes()[0]);
+		return *((uint8_t *)(buffer() + sizeof(uint32_t) + sizeof(uint32_t)));
 	}
-	static void set_vs_direct(char *p, uint32_t v)
+	uint32_t get_ks() const
 	{
-		*((uint32_t *)((char *)(p) + sizeof(uint32_t))) = v;
+		if (is_inline())
+			return static_cast<uint32_t>(
+				static_cast<uint8_t>(bytes()[sizeof(PMEMoid) - 1]) &
+				(INLINE - 1));
+		return *((uint32_t *)(buffer()));
 	}
-	uint8_t get_ph() const
+	uint32_t get_vs() const
 	{
-		return *((uint8_t *)((char *)(kv.get()) + sizeof(uint32_t) +
-				     sizeof(uint32_t)));
+		if (is_inline())
+			return static_cast<uint8_t>(bytes()[1]);
+		return *((uint32_t *)(buffer() + sizeof(uint32_t)));
 	}
-	static uint8_t get_ph_direct(char *p)
+	bool empty() const
 	{
-		return *((uint8_t *)((char *)(p) + sizeof(uint32_t) + sizeof(uint32_t)));
+		return OID_IS_NULL(kv);
 	}
-	uint32_t get_ks() const
+	bool is_inline() const
 	{
-		return *((uint32_t *)(kv.get()));
+		return bytes()[sizeof(PMEMoid) - 1] != 0;
 	}
-	static uint32_t get_ks_direct(char *p)
+	// pointer updated by defrag when the buffer is relocated, null if there is none
+	PMEMoid *kv_oid()
 	{
-		return *((uint32_t *)(p));
+		return empty() || is_inline() ? nullptr : &kv;
 	}
-	uint32_t get_vs() const
+
+private:
+	static const uint8_t INLINE = 0x80;
+
+	const char *bytes() const
 	{
-		return *((uint32_t *)((char *)(kv.get()) + sizeof(uint32_t)));
+		return reinterpret_cast<const char *>(&kv);
 	}
-	static uint32_t get_vs_direct(char *p)
+	char *buffer() const
 	{
-		return *((uint32_t *)((char *)(p) + sizeof(uint32_t)));
+		return static_cast<char *>(pmemobj_direct(kv));
 	}
-	bool empty();
+	void free_buffer();
 
-private:
-	persistent_ptr<char[]> kv; // buffer for key & value
+	PMEMoid kv; // buffer for key & value, or key & value themselves
 };
 
 struct KVLeaf {
@@ -183,22 +173,114 @@ struct KVNode {		      // volatile nodes of the tree
 	virtual ~KVNode() = default;
 };
 
-struct KVInnerNode final : KVNode {		     // volatile inner nodes of the tree
-	uint8_t keycount;			     // count of keys in this node
-	std::string keys[INNER_KEYS + 1];	     // child keys plus one overflow slot
-	unique_ptr<KVNode> children[INNER_KEYS + 2]; // child nodes plus one overflow slot
+/*
+ * Keys of inner nodes are searched by their first 8 bytes, kept in a contiguous
+ * array as big-endian integers, so that a search touches a few cache lines instead
+ * of every key string. Full keys are compared only when the prefixes are equal.
+ */
+struct KVInnerNode final : KVNode {			 // volatile inner nodes
+	uint8_t keycount;				 // count of keys in this node
+	uint64_t prefixes[INNER_KEYS_MAX + 1];		 // prefixes of keys
+	unique_ptr<KVNode> children[INNER_KEYS_MAX + 2]; // child nodes plus overflow slot
+	std::string keys[INNER_KEYS_MAX + 1];		 // child keys plus overflow slot
+
+	void set_key(size_t idx, std::string key);
+	void move_key(size_t to, KVInnerNode &from, size_t idx);
+	size_t lower_bound(string_view key) const; // first key not less than key
+	size_t upper_bound(string_view key) const; // first key greater than key
 	void assert_invariants();
+
+private:
+	size_t bound(string_view key, bool upper) const;
 };
 
+/*
+ * Slots of a leaf are not kept in key order. Ordered reads sort them lazily:
+ * the order is computed on the first such read and kept until the keys of the
+ * leaf change.
+ */
 struct KVLeafNode final : KVNode {   // volatile leaf nodes of the tree
 	uint8_t hashes[LEAF_KEYS];   // Pearson hashes of keys
 	std::string keys[LEAF_KEYS]; // keys stored in this leaf
 	persistent_ptr<KVLeaf> leaf; // pointer to persistent leaf
+	KVLeafNode *prev = nullptr;  // previous leaf in key order
+	KVLeafNode *next = nullptr;  // next leaf in key order
+	uint8_t order[LEAF_KEYS];    // occupied slots in key order
+	int ordered = -1;	     // count of slots in order, -1 if not sorted
+
+	size_t size() const; // count of occupied slots
+	size_t sort();	     // sorts occupied slots if needed, returns their count
+	void unsort()
+	{
+		ordered = -1;
+	}
 };
 
-struct KVRecoveredLeaf {		 // temporary wrapper used for recovery
-	unique_ptr<KVLeafNode> leafnode; // leaf node being recovered
-	std::string max_key;		 // highest sorting key present
+/*
+ * Position of a record in key order: index of the record in the sorted slots
+ * of a leaf. A null leaf is the position past either end.
+ */
+struct KVPosition {
+	KVLeafNode *leaf;
+	size_t idx;
+
+	bool operator==(const KVPosition &other) const
+	{
+		return leaf == other.leaf && idx == other.idx;
+	}
+	bool operator!=(const KVPosition &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+/*
+ * Cursor over the tree. It keeps a position, so next() and prev() follow the
+ * sibling links of leaves instead of searching the tree from the top.
+ */
+class iterator : public internal::iterator_base {
+public:
+	iterator(const unique_ptr<KVNode> &top);
+
+	status seek(string_view key) final;
+	status seek_lower(string_view key) final;
+	status seek_lower_eq(string_view key) final;
+	status seek_higher(string_view key) final;
+	status seek_higher_eq(string_view key) final;
+
+	status seek_to_first() final;
+	status seek_to_last() final;
+
+	status is_next() final;
+	status next() final;
+	status prev() final;
+
+	status key(string_view &key) final;
+	status value(string_view &value) final;
+
+private:
+	status position(KVPosition p);
+
+	const unique_ptr<KVNode> &top;
+	KVPosition pos;
+};
+
+/*
+ * Returns a bitmask of leaf slots whose hash is equal to the given one (bit n is
+ * set for slot n). Uses SSE2 or AVX2 kernel when supported by the CPU (checked
+ * at runtime) and a scalar loop otherwise.
+ */
+uint64_t LeafProbeHashes(const uint8_t (&hashes)[LEAF_KEYS], uint8_t hash);
+
+/*
+ * Returns Pearson hash of the key, stored in KVLeafNode::hashes and in leaf
+ * slots. It is never 0, which marks an empty slot.
+ */
+uint8_t PearsonHash(const char *data, size_t size);
+
+struct KVRecoveredNode {	 // temporary wrapper used for recovery
+	unique_ptr<KVNode> node; // leaf or inner node being recovered
+	std::string max_key;	 // highest sorting key present
 };
 
 } /* namespace tree3 */
@@ -213,33 +295,70 @@ public:
 	std::string name() final;
 
 	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+	std::pair<string_view, string_view> upper_bound(string_view key) final;
+	std::pair<string_view, string_view> lower_bound(string_view key) final;
+	std::pair<string_view, string_view> get_begin() final;
+	std::pair<string_view, string_view> get_next(string_view key) final;
+	std::pair<string_view, string_view> get_prev(string_view key) final;
+	int get_size_new() final;
+	internal::iterator_base *new_iterator() final;
 
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_ref(string_view key, internal::value_ref &ref) final;
 
 	status put(string_view key, string_view value) final;
 
+	status update(string_view key, update_callback *callback, void *arg) final;
+
 	status remove(string_view key) final;
 
+	status write(internal::write_batch &batch) final;
+
+	status bulk_load(bulk_load_callback *callback, void *arg) final;
+
+	status defrag(double start_percent, double amount_percent) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
 protected:
-	internal::tree3::KVLeafNode *LeafSearch(const std::string &key);
+	void DoPut(string_view key, string_view value);
+	status DoRemove(string_view key);
+	internal::tree3::KVLeafNode *LeafSearch(string_view key);
 	void LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
-			       const std::string &key, const std::string &value);
+			       string_view key, string_view value);
 	bool LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
-				const std::string &key, const std::string &value);
+				string_view key, string_view value);
 	void LeafFillSpecificSlot(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
-				  const std::string &key, const std::string &value,
-				  int slot);
+				  string_view key, string_view value, int slot);
 	void LeafSplitFull(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
-			   const std::string &key, const std::string &value);
+			   string_view key, string_view value);
+	void LeafCoalesce(internal::tree3::KVLeafNode *leafnode);
 	void InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 				   unique_ptr<internal::tree3::KVNode> newnode,
-				   std::string *split_key);
-	uint8_t PearsonHash(const char *data, size_t size);
+				   string_view split_key);
 	void Recover();
+	bool LoadImage(vector<persistent_ptr<internal::tree3::KVLeaf>> &leaves);
+	void SaveImage();
+	void FreeImage();
+	void RecoverInnerNodes(vector<internal::tree3::KVRecoveredNode> &level);
 
 private:
 	tree3(const tree3 &);	       // prevent copying
@@ -247,6 +366,13 @@ private:
 	vector<persistent_ptr<internal::tree3::KVLeaf>>
 		leaves_prealloc;		      // persisted but unused leaves
 	unique_ptr<internal::tree3::KVNode> tree_top; // pointer to uppermost inner node
+	size_t recovery_threads = 1;	// threads used to rebuild volatile nodes
+	size_t inner_keys = INNER_KEYS; // maximum keys in inner nodes
+	bool save_image = false;	// save leaves in key order on close
+	bool image_recovered = false;	// leaves were taken from a saved image
+	uint64_t leaf_splits = 0;	// leaves split since the pool was opened
+	uint64_t inner_splits = 0;	// inner nodes split since the pool was opened
+	uint64_t leaf_merges = 0;	// leaves coalesced since the pool was opened
 };
 
 } /* namespace kv */
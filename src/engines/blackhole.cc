@@ -30,7 +30,11 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #include "blackhole.h"
+#include "../exceptions.h"
+
+#include <algorithm>
 #include <iostream>
 
 namespace pmem
@@ -38,8 +42,42 @@ namespace pmem
 namespace kv
 {
 
+/* keys of up to 19 digits, so that 10^key_size fits in uint64_t */
+static const size_t KEY_SIZE_MAX = 19;
+
+static uint64_t power_of_ten(size_t exponent)
+{
+	uint64_t result = 1;
+	while (exponent--)
+		result *= 10;
+	return result;
+}
+
+/* replaces the decimal number in key with the next one, which must fit */
+static void increment_key(std::string &key)
+{
+	size_t pos = key.size();
+	while (key[--pos] == '9')
+		key[pos] = '0';
+	key[pos]++;
+}
+
 blackhole::blackhole(std::unique_ptr<internal::config> cfg)
 {
+	uint64_t size;
+	if (cfg && cfg->get_uint64("key_size", &size)) {
+		if (size == 0 || size > KEY_SIZE_MAX)
+			throw internal::invalid_argument(
+				"Config item \"key_size\" has to be between 1 and " +
+				std::to_string(KEY_SIZE_MAX));
+		key_size = size;
+	}
+	if (cfg && cfg->get_uint64("records", &records) &&
+	    records > power_of_ten(key_size))
+		throw internal::invalid_argument(
+			"Config item \"records\" has to fit in keys of \"key_size\" digits");
+	value.assign(cfg && cfg->get_uint64("value_size", &size) ? size : 64, 'v');
+
 	LOG("Started ok");
 }
 
@@ -57,7 +95,7 @@ status blackhole::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 
-	cnt = 0;
+	cnt = records;
 
 	return status::OK;
 }
@@ -66,7 +104,7 @@ status blackhole::count_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_above for key=" << std::string(key.data(), key.size()));
 
-	cnt = 0;
+	cnt = records - upper_index(key);
 
 	return status::OK;
 }
@@ -75,7 +113,7 @@ status blackhole::count_equal_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
 
-	cnt = 0;
+	cnt = records - lower_index(key);
 
 	return status::OK;
 }
@@ -84,7 +122,7 @@ status blackhole::count_equal_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
 
-	cnt = 0;
+	cnt = upper_index(key);
 
 	return status::OK;
 }
@@ -93,7 +131,7 @@ status blackhole::count_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_below for key=" << std::string(key.data(), key.size()));
 
-	cnt = 0;
+	cnt = lower_index(key);
 
 	return status::OK;
 }
@@ -102,7 +140,20 @@ status blackhole::count_between(string_view key1, string_view key2, std::size_t
 {
 	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
 
-	cnt = 0;
+	const auto begin = upper_index(key1);
+	const auto end = lower_index(key2);
+	cnt = end > begin ? end - begin : 0;
+
+	return status::OK;
+}
+
+status blackhole::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	LOG("count_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+
+	uint64_t begin, end;
+	prefix_range(prefix, begin, end);
+	cnt = end - begin;
 
 	return status::OK;
 }
@@ -111,35 +162,35 @@ status blackhole::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 
-	return status::NOT_FOUND;
+	return get_range(0, records, callback, arg);
 }
 
 status blackhole::get_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_above for key=" << std::string(key.data(), key.size()));
 
-	return status::NOT_FOUND;
+	return get_range(upper_index(key), records, callback, arg);
 }
 
 status blackhole::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
 
-	return status::NOT_FOUND;
+	return get_range(lower_index(key), records, callback, arg);
 }
 
 status blackhole::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
 
-	return status::NOT_FOUND;
+	return get_range(0, upper_index(key), callback, arg);
 }
 
 status blackhole::get_below(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_below for key=" << std::string(key.data(), key.size()));
 
-	return status::NOT_FOUND;
+	return get_range(0, lower_index(key), callback, arg);
 }
 
 status blackhole::get_between(string_view key1, string_view key2,
@@ -147,21 +198,68 @@ status blackhole::get_between(string_view key1, string_view key2,
 {
 	LOG("get_between for key1=" << key1.data() << ", key2=" << key2.data());
 
-	return status::NOT_FOUND;
+	return get_range(upper_index(key1), lower_index(key2), callback, arg);
+}
+
+status blackhole::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+
+	uint64_t begin, end;
+	prefix_range(prefix, begin, end);
+	return get_range(begin, end, callback, arg);
+}
+
+std::pair<string_view, string_view> blackhole::upper_bound(string_view key)
+{
+	LOG("upper_bound for key=" << std::string(key.data(), key.size()));
+
+	return record_at(upper_index(key));
+}
+
+std::pair<string_view, string_view> blackhole::lower_bound(string_view key)
+{
+	LOG("lower_bound for key=" << std::string(key.data(), key.size()));
+
+	return record_at(lower_index(key));
+}
+
+std::pair<string_view, string_view> blackhole::get_begin()
+{
+	LOG("get_begin");
+
+	return record_at(0);
+}
+
+std::pair<string_view, string_view> blackhole::get_next(string_view key)
+{
+	LOG("get_next for key=" << std::string(key.data(), key.size()));
+
+	uint64_t index;
+	if (!find(key, index))
+		return record_at(records);
+
+	return record_at(index + 1);
 }
 
 status blackhole::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 
-	return status::NOT_FOUND;
+	uint64_t index;
+	return find(key, index) ? status::OK : status::NOT_FOUND;
 }
 
 status blackhole::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
 
-	return status::NOT_FOUND;
+	uint64_t index;
+	if (!find(key, index))
+		return status::NOT_FOUND;
+
+	callback(value.data(), value.size(), arg);
+	return status::OK;
 }
 
 status blackhole::put(string_view key, string_view value)
@@ -179,5 +277,107 @@ status blackhole::remove(string_view key)
 	return status::OK;
 }
 
+/* number of records with keys less than given key */
+uint64_t blackhole::lower_index(string_view key)
+{
+	uint64_t number = 0;
+	for (size_t i = 0; i < key_size; i++) {
+		/* a shorter key precedes all keys starting with it */
+		if (i == key.size())
+			return std::min(records, number * power_of_ten(key_size - i));
+
+		const auto c = static_cast<unsigned char>(key.data()[i]);
+		if (c < '0' || c > '9') {
+			if (c > '9')
+				number++;
+			return std::min(records, number * power_of_ten(key_size - i));
+		}
+		number = number * 10 + static_cast<uint64_t>(c - '0');
+	}
+
+	/* a longer key follows the key it starts with */
+	if (key.size() > key_size)
+		number++;
+	return std::min(records, number);
+}
+
+/* number of records with keys not greater than given key */
+uint64_t blackhole::upper_index(string_view key)
+{
+	uint64_t index;
+	return find(key, index) ? index + 1 : lower_index(key);
+}
+
+bool blackhole::find(string_view key, uint64_t &index)
+{
+	if (key.size() != key_size)
+		return false;
+
+	uint64_t number = 0;
+	for (size_t i = 0; i < key_size; i++) {
+		const char c = key.data()[i];
+		if (c < '0' || c > '9')
+			return false;
+		number = number * 10 + static_cast<uint64_t>(c - '0');
+	}
+	index = number;
+	return number < records;
+}
+
+/* range of records with keys starting with given prefix */
+void blackhole::prefix_range(string_view prefix, uint64_t &begin, uint64_t &end)
+{
+	begin = end = 0;
+	if (prefix.size() > key_size)
+		return;
+
+	uint64_t number = 0;
+	for (size_t i = 0; i < prefix.size(); i++) {
+		const char c = prefix.data()[i];
+		if (c < '0' || c > '9')
+			return;
+		number = number * 10 + static_cast<uint64_t>(c - '0');
+	}
+	const auto keys = power_of_ten(key_size - prefix.size());
+	begin = std::min(records, number * keys);
+	end = std::min(records, (number + 1) * keys);
+}
+
+void blackhole::format_key(uint64_t index, std::string &key)
+{
+	key.resize(key_size);
+	for (size_t pos = key_size; pos--; index /= 10)
+		key[pos] = static_cast<char>('0' + index % 10);
+}
+
+/* calls the callback for records [begin, end), generating their keys in place */
+status blackhole::get_range(uint64_t begin, uint64_t end, get_kv_callback *callback,
+			    void *arg)
+{
+	if (begin >= end)
+		return status::NOT_FOUND;
+
+	std::string key;
+	format_key(begin, key);
+	for (uint64_t index = begin;; increment_key(key)) {
+		auto ret = callback(key.data(), key.size(), value.data(), value.size(),
+				    arg);
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+		if (++index == end)
+			return status::OK;
+	}
+}
+
+/* the record is valid until the next call of a bound or get_begin/get_next */
+std::pair<string_view, string_view> blackhole::record_at(uint64_t index)
+{
+	if (index >= records)
+		return std::make_pair("", "");
+
+	format_key(index, position);
+	return std::make_pair(string_view(position), string_view(value));
+}
+
 } // namespace kv
 } // namespace pmem
@@ -39,6 +39,11 @@ namespace pmem
 namespace kv
 {
 
+/*
+ * Engine which stores nothing. If configured with "records", it serves a fixed set
+ * of synthetic records, generated on the fly: record i is keyed by i in decimal,
+ * zero-padded to key_size digits, so keys sort in the order of their numbers.
+ */
 class blackhole : public engine_base {
 public:
 	blackhole(std::unique_ptr<internal::config> cfg);
@@ -52,6 +57,7 @@ public:
 	status count_equal_below(string_view key, std::size_t &cnt) final;
 	status count_below(string_view key, std::size_t &cnt) final;
 	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
 	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
@@ -62,6 +68,12 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
+
+	std::pair<string_view, string_view> upper_bound(string_view key) final;
+	std::pair<string_view, string_view> lower_bound(string_view key) final;
+	std::pair<string_view, string_view> get_begin() final;
+	std::pair<string_view, string_view> get_next(string_view key) final;
 
 	status exists(string_view key) final;
 
@@ -70,6 +82,21 @@ public:
 	status put(string_view key, string_view value) final;
 
 	status remove(string_view key) final;
+
+private:
+	uint64_t lower_index(string_view key);
+	uint64_t upper_index(string_view key);
+	bool find(string_view key, uint64_t &index);
+	void prefix_range(string_view prefix, uint64_t &begin, uint64_t &end);
+	void format_key(uint64_t index, std::string &key);
+	status get_range(uint64_t begin, uint64_t end, get_kv_callback *callback,
+			 void *arg);
+	std::pair<string_view, string_view> record_at(uint64_t index);
+
+	uint64_t records = 0;  /* number of synthetic records */
+	size_t key_size = 16;  /* digits of every key */
+	std::string value;     /* value of every record */
+	std::string position;  /* key returned by the last bound or get_begin/next */
 };
 
 } /* namespace kv */
@@ -32,13 +32,41 @@
 
 #include "cmap.h"
 #include "../out.h"
+#include "../probes.h"
 
+#include <cstring>
+#include <new>
 #include <unistd.h>
+#include <vector>
 
 namespace pmem
 {
 namespace kv
 {
+namespace internal
+{
+namespace cmap
+{
+
+/* keeps the record read-locked while its value is referenced */
+template <typename Map>
+class value_pin : public value_ref::pin {
+public:
+	void release() final
+	{
+		accessor.release();
+	}
+
+	typename Map::const_accessor accessor;
+	/* the referenced value, if it is stored compressed */
+	std::string buffer;
+};
+
+} /* namespace cmap */
+} /* namespace internal */
+
+/* engine whose key locks of a batch are held by this thread, see cmap::write() */
+static thread_local const cmap *batch_owner = nullptr;
 
 cmap::cmap(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg)
 {
@@ -46,12 +74,97 @@ cmap::cmap(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg)
 		sizeof(internal::cmap::string_t) == 40,
 		"Wrong size of cmap value and key. This probably means that std::string has size > 32");
 
+	/* the hash map initializes its locks in the pool on each open */
+	reject_read_only();
+
+	const char *hash = nullptr;
+	if (!cfg->get_string("hash", &hash))
+		hash = "fast";
+	else if (strcmp(hash, "fast") != 0 && strcmp(hash, "fibonacci") != 0)
+		throw internal::invalid_argument(
+			"Config item \"hash\" has to be \"fast\" or \"fibonacci\"");
+
+	const char *layout = nullptr;
+	if (!cfg->get_string("layout", &layout))
+		layout = "strings";
+	else if (strcmp(layout, "strings") != 0 && strcmp(layout, "contiguous") != 0)
+		throw internal::invalid_argument(
+			"Config item \"layout\" has to be \"strings\" or \"contiguous\"");
+	bool contiguous = strcmp(layout, "contiguous") == 0;
+	if (contiguous && strcmp(hash, "fast") != 0)
+		throw internal::invalid_argument(
+			"Contiguous layout of cmap supports only \"fast\" hash");
+
+	uint64_t group_commit = 0;
+	cfg->get_uint64("group_commit", &group_commit);
+	if (group_commit)
+		combiner.reset(new internal::cmap::write_combiner());
+
+	init_compression(internal::value_codec::from_config(*cfg),
+			 OID_IS_NULL(*root_oid));
+	uint64_t ttl = 0;
+	cfg->get_uint64("ttl", &ttl);
+	ttl_enabled = init_ttl(ttl != 0, OID_IS_NULL(*root_oid));
+	cfg->get_object("ttl_clock", (void **)&clock);
+	/* records differ in size, so only the hinted classes are registered */
+	init_allocator(*cfg, {});
+	Recover(strcmp(hash, "fast") == 0, contiguous);
+
+	/* once created, the change log is kept by the pool */
+	uint64_t change_log_size = 0;
+	cfg->get_uint64("change_log_size", &change_log_size);
+	if (change_log_size != 0 && !change_log_oid)
+		throw internal::invalid_argument(
+			"Change log can be created only in a pool given by path");
+	if (change_log_size != 0 || internal::change_log::exists(change_log_oid))
+		changes.reset(new internal::change_log(pmpool, change_log_oid,
+						       change_log_size));
+
+	if (changes && !previous_shutdown_clean) {
+		if (kv_container)
+			replay_changes(kv_container);
+		else
+			fast_container ? replay_changes(fast_container)
+				       : replay_changes(container);
+	}
+
+	if (ttl_enabled || changes || batch_log_oid)
+		key_locks.reset(new std::mutex[internal::cmap::KEY_LOCKS]);
+
+	/* a batch interrupted by a crash is completed before the engine is used */
+	if (batch_log_oid) {
+		batches.reset(new internal::batch_log(pmpool, batch_log_oid));
+		batches->recover(*this);
+	}
+
+	if (ttl_enabled) {
+		if (kv_container)
+			fill_expiries(kv_container);
+		else
+			fast_container ? fill_expiries(fast_container)
+				       : fill_expiries(container);
+
+		uint64_t interval = internal::cmap::DEFAULT_REAP_INTERVAL_MS;
+		cfg->get_uint64("ttl_reap_interval", &interval);
+		if (interval != 0)
+			start_reaper(interval);
+	}
+
+	mark_opened();
 	LOG("Started ok");
-	Recover();
 }
 
 cmap::~cmap()
 {
+	if (reaper.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(reaper_mtx);
+			reaper_stop = true;
+		}
+		reaper_cv.notify_one();
+		reaper.join();
+	}
+
 	LOG("Stopped ok");
 }
 
@@ -64,18 +177,57 @@ status cmap::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
-	cnt = container->size();
+	if (ttl_enabled) {
+		/* expired records, which are not removed yet, are not counted */
+		if (kv_container)
+			cnt = count_live(kv_container);
+		else
+			cnt = fast_container ? count_live(fast_container)
+					     : count_live(container);
+	} else if (kv_container) {
+		cnt = kv_container->size();
+	} else {
+		cnt = fast_container ? fast_container->size() : container->size();
+	}
 
 	return status::OK;
 }
 
+template <typename Map>
+std::size_t cmap::count_live(Map *map)
+{
+	std::size_t cnt = 0;
+	for (auto it = map->begin(); it != map->end(); ++it) {
+		if (!expired(internal::cmap::value_of(*it)))
+			cnt++;
+	}
+
+	return cnt;
+}
+
 status cmap::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
-	for (auto it = container->begin(); it != container->end(); ++it) {
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.c_str(), it->second.size(), arg);
+	if (kv_container)
+		return get_all(kv_container, callback, arg);
+	return fast_container ? get_all(fast_container, callback, arg)
+			      : get_all(container, callback, arg);
+}
+
+template <typename Map>
+status cmap::get_all(Map *map, get_kv_callback *callback, void *arg)
+{
+	std::string buffer;
+	for (auto it = map->begin(); it != map->end(); ++it) {
+		auto stored = internal::cmap::value_of(*it);
+		if (expired(stored))
+			continue;
+
+		auto key = internal::cmap::key_of(*it);
+		auto value = decode_value(stored, buffer);
+		auto ret = callback(key.data(), key.size(), value.data(), value.size(),
+				    arg);
 
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
@@ -84,25 +236,194 @@ status cmap::get_all(get_kv_callback *callback, void *arg)
 	return status::OK;
 }
 
+status cmap::scan(string_view prefix, size_t limit, size_t batch_size,
+		  scan_callback *callback, void *arg)
+{
+	LOG("scan prefix=" << std::string(prefix.data(), prefix.size()));
+	check_outside_tx();
+	/* records are passed in place, as by get_all(), unless they are decompressed */
+	internal::scan_batch batch(prefix, limit, batch_size, callback, arg,
+				   codec.enabled());
+	if (kv_container)
+		return batch.finish(scan(kv_container, batch));
+	return batch.finish(fast_container ? scan(fast_container, batch)
+					   : scan(container, batch));
+}
+
+template <typename Map>
+status cmap::scan(Map *map, internal::scan_batch &batch)
+{
+	std::string buffer;
+	for (auto it = map->begin(); it != map->end(); ++it) {
+		auto key = internal::cmap::key_of(*it);
+		auto stored = internal::cmap::value_of(*it);
+		if (!batch.matches(key.data(), key.size()) || expired(stored))
+			continue;
+
+		if (!batch.push(key, decode_value(stored, buffer)))
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+status cmap::get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+			      void *arg)
+{
+	LOG("get_all_parallel nthreads=" << nthreads);
+	check_outside_tx();
+	if (kv_container)
+		return get_all_parallel(kv_container, nthreads, callback, arg);
+	return fast_container
+		? get_all_parallel(fast_container, nthreads, callback, arg)
+		: get_all_parallel(container, nthreads, callback, arg);
+}
+
+/*
+ * Records are visited as by get_all(), the iteration is handed out to the
+ * workers in chunks of PARALLEL_CHUNK records, so the workers only meet when
+ * they take the next chunk.
+ */
+template <typename Map>
+status cmap::get_all_parallel(Map *map, size_t nthreads,
+			      get_kv_parallel_callback *callback, void *arg)
+{
+	using iterator = typename Map::iterator;
+
+	std::vector<std::string> buffers(nthreads);
+	return internal::parallel_for_each(
+		nthreads, map->begin(), map->end(), internal::cmap::PARALLEL_CHUNK,
+		[&](size_t worker, iterator it) {
+			auto stored = internal::cmap::value_of(*it);
+			if (expired(stored))
+				return true;
+
+			auto key = internal::cmap::key_of(*it);
+			auto value = decode_value(stored, buffers[worker]);
+			return callback(worker, key.data(), key.size(), value.data(),
+					value.size(), arg) == 0;
+		});
+}
+
 status cmap::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	return container->count(key) == 1 ? status::OK : status::NOT_FOUND;
+	bool found;
+	if (ttl_enabled && kv_container)
+		found = contains(kv_container, key);
+	else if (ttl_enabled)
+		found = fast_container ? contains(fast_container, key)
+				       : contains(container, key);
+	else if (kv_container)
+		found = kv_container->count(key) == 1;
+	else
+		found = (fast_container ? fast_container->count(key)
+					: container->count(key)) == 1;
+	return found ? status::OK : status::NOT_FOUND;
+}
+
+/* whether there is a record with the key, which has not expired */
+template <typename Map>
+bool cmap::contains(Map *map, string_view key)
+{
+	typename Map::const_accessor acc;
+	return map->find(acc, key) && !expired(internal::cmap::value_of(*acc));
 }
 
 status cmap::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	internal::cmap::map_t::const_accessor result;
-	bool found = container->find(result, key);
-	if (!found) {
+	status s;
+	if (kv_container)
+		s = get(kv_container, key, callback, arg);
+	else
+		s = fast_container ? get(fast_container, key, callback, arg)
+				   : get(container, key, callback, arg);
+	if (s == status::NOT_FOUND)
 		LOG("  key not found");
+
+	return s;
+}
+
+template <typename Map>
+status cmap::get(Map *map, string_view key, get_v_callback *callback, void *arg)
+{
+	typename Map::const_accessor result;
+	bool found = map->find(result, key);
+	if (!found || expired(internal::cmap::value_of(*result)))
 		return status::NOT_FOUND;
+
+	std::string buffer;
+	auto value = decode_value(internal::cmap::value_of(*result), buffer);
+	callback(value.data(), value.size(), arg);
+	return status::OK;
+}
+
+status cmap::get_many(size_t count, const string_view *keys,
+		       get_many_v_callback *callback, void *arg)
+{
+	LOG("get_many count=" << count);
+	check_outside_tx();
+	if (kv_container)
+		return get_many(kv_container, count, keys, callback, arg);
+	return fast_container ? get_many(fast_container, count, keys, callback, arg)
+			      : get_many(container, count, keys, callback, arg);
+}
+
+template <typename Map>
+status cmap::get_many(Map *map, size_t count, const string_view *keys,
+		       get_many_v_callback *callback, void *arg)
+{
+	status result = status::OK;
+	/* one accessor is reused for the whole batch */
+	typename Map::const_accessor acc;
+	std::string buffer;
+	for (size_t i = 0; i < count; ++i) {
+		if (map->find(acc, keys[i]) && !expired(internal::cmap::value_of(*acc))) {
+			auto value = decode_value(internal::cmap::value_of(*acc), buffer);
+			callback(i, static_cast<int>(status::OK), value.data(),
+				 value.size(), arg);
+			acc.release();
+		} else {
+			acc.release();
+			callback(i, static_cast<int>(status::NOT_FOUND), nullptr, 0,
+				 arg);
+			result = status::NOT_FOUND;
+		}
 	}
 
-	callback(result->second.c_str(), result->second.size(), arg);
+	return result;
+}
+
+status cmap::get_ref(string_view key, internal::value_ref &ref)
+{
+	LOG("get_ref key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	status s;
+	if (kv_container)
+		s = get_ref(kv_container, key, ref);
+	else
+		s = fast_container ? get_ref(fast_container, key, ref)
+				   : get_ref(container, key, ref);
+	if (s == status::NOT_FOUND)
+		LOG("  key not found");
+
+	return s;
+}
+
+template <typename Map>
+status cmap::get_ref(Map *map, string_view key, internal::value_ref &ref)
+{
+	auto &pin = ref.reset_pin<internal::cmap::value_pin<Map>>();
+	if (!map->find(pin.accessor, key) ||
+	    expired(internal::cmap::value_of(*pin.accessor))) {
+		ref.release();
+		return status::NOT_FOUND;
+	}
+
+	ref.set(decode_value(internal::cmap::value_of(*pin.accessor), pin.buffer));
 	return status::OK;
 }
 
@@ -112,18 +433,430 @@ status cmap::put(string_view key, string_view value)
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
 
-	container->insert_or_assign(key, value);
+	return put_value(key, value, 0);
+}
+
+status cmap::put_with_ttl(string_view key, string_view value, uint64_t ttl_ms)
+{
+	LOG("put_with_ttl key=" << std::string(key.data(), key.size())
+				<< ", value.size=" << std::to_string(value.size())
+				<< ", ttl_ms=" << ttl_ms);
+	check_outside_tx();
+	if (!ttl_enabled)
+		return status::NOT_SUPPORTED;
+
+	uint64_t expires = 0;
+	if (ttl_ms != 0) {
+		auto current = now();
+		expires = ttl_ms > UINT64_MAX - current ? UINT64_MAX : current + ttl_ms;
+	}
+
+	auto s = put_value(key, value, expires);
+	if (expires != 0)
+		expiries.push(expires, key);
+	return s;
+}
+
+/* put of the value, which expires at the given time, 0 meaning never */
+status cmap::put_value(string_view key, string_view value, uint64_t expires)
+{
+	auto key_lock = lock_key(key);
+	std::string buffer;
+	value = encode_value(value, expires, buffer);
+
+	if (combiner) {
+		internal::cmap::pending_put req(key, value);
+		combiner->put(req, [&](internal::cmap::pending_put *const *group,
+				       size_t n) {
+			if (kv_container)
+				put_group(kv_container, group, n);
+			else if (fast_container)
+				put_group(fast_container, group, n);
+			else
+				put_group(container, group, n);
+		});
+	} else {
+		if (kv_container)
+			apply_put(kv_container, key, value);
+		else if (fast_container)
+			apply_put(fast_container, key, value);
+		else
+			apply_put(container, key, value);
+	}
 
 	return status::OK;
 }
 
+template <typename Map>
+void cmap::put_record(Map *map, string_view key, string_view value)
+{
+	map->insert_or_assign(key, value);
+}
+
+/*
+ * A new record is allocated by the map in its own transaction; the new buffer
+ * of an existing one is assigned in another, with the record still locked.
+ */
+void cmap::put_record(internal::cmap::kv_map_t *map, string_view key,
+		      string_view value)
+{
+	internal::cmap::kv_map_t::accessor acc;
+	if (!map->insert(acc, internal::cmap::kv_pair{key, value}))
+		pmem::obj::transaction::run(pmpool,
+					    [&] { acc->first.assign(key, value); });
+}
+
+status cmap::get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			   void *arg, bool &inserted)
+{
+	LOG("get_or_insert key=" << std::string(key.data(), key.size())
+				 << ", value.size=" << std::to_string(value.size()));
+	check_outside_tx();
+
+	auto key_lock = lock_key(key);
+	if (kv_container)
+		inserted = get_or_insert(kv_container, key, value, callback, arg);
+	else
+		inserted = fast_container
+			? get_or_insert(fast_container, key, value, callback, arg)
+			: get_or_insert(container, key, value, callback, arg);
+	return status::OK;
+}
+
+/*
+ * A single insert, which locks the existing record if there is one already. An
+ * expired record is replaced, as if it was not there.
+ */
+template <typename Map>
+bool cmap::get_or_insert(Map *map, string_view key, string_view value,
+			 get_v_callback *callback, void *arg)
+{
+	typename Map::accessor acc;
+	std::string buffer;
+	auto stored = encode_value(value, 0, buffer);
+	if (update_record(map, acc, false, key, stored) ||
+	    (expired(internal::cmap::value_of(*acc)) &&
+	     update_record(map, acc, true, key, stored))) {
+		if (callback)
+			callback(value.data(), value.size(), arg);
+		return true;
+	}
+
+	if (callback) {
+		std::string current;
+		auto existing = decode_value(internal::cmap::value_of(*acc), current);
+		callback(existing.data(), existing.size(), arg);
+	}
+	return false;
+}
+
+status cmap::update(string_view key, update_callback *callback, void *arg)
+{
+	LOG("update key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+
+	auto key_lock = lock_key(key);
+	if (kv_container)
+		return update(kv_container, key, callback, arg);
+	return fast_container ? update(fast_container, key, callback, arg)
+			      : update(container, key, callback, arg);
+}
+
+/*
+ * The record is kept locked by the accessor from reading the value until the new
+ * one is stored, so no put or other update can come in between. If the record
+ * is missing and a concurrent put inserts it before this update does, the insert
+ * locks the existing record instead and the new value is computed once more.
+ * The new value keeps the expiry time of the record, an expired record is
+ * updated as a missing one.
+ */
+template <typename Map>
+status cmap::update(Map *map, string_view key, update_callback *callback, void *arg)
+{
+	typename Map::accessor acc;
+	std::string current, encoded;
+	bool found = map->find(acc, key);
+	while (true) {
+		string_view value;
+		bool live = found && !expired(internal::cmap::value_of(*acc));
+		uint64_t expires = live ? expiry(internal::cmap::value_of(*acc)) : 0;
+		if (live)
+			value = decode_value(internal::cmap::value_of(*acc), current);
+
+		const char *new_value;
+		size_t new_valuebytes;
+		if (callback(live ? value.data() : nullptr, value.size(), &new_value,
+			     &new_valuebytes, arg) != 0)
+			return status::STOPPED_BY_CB;
+
+		auto stored = encode_value(string_view(new_value, new_valuebytes),
+					   expires, encoded);
+		if (update_record(map, acc, found, key, stored))
+			return status::OK;
+		found = true;
+	}
+}
+
+/*
+ * Stores the value in the record locked by acc or, if it was not found, in a new
+ * one. Returns false, with acc locking the record, if there is one already (e.g.
+ * inserted concurrently since update() did not find it). A new record is inserted
+ * with its value by the map, in its own transaction; the value of an existing one
+ * is assigned in another. With the change log, the key is locked and the change
+ * is logged first, see apply_put().
+ */
+template <typename Map>
+bool cmap::update_record(Map *map, typename Map::accessor &acc, bool found,
+			 string_view key, string_view value)
+{
+	if (!found && changes && map->find(acc, key))
+		return false;
+	if (changes)
+		log_change(PMEMKV_CHANGE_PUT, key, value);
+
+	try {
+		if (!found)
+			return map->insert(acc, typename Map::value_type(key, value));
+		pmem::obj::transaction::run(pmpool, [&] { acc->second = value; });
+	} catch (...) {
+		if (changes)
+			log_current(map, acc, key);
+		throw;
+	}
+	return true;
+}
+
+bool cmap::update_record(internal::cmap::kv_map_t *map,
+			 internal::cmap::kv_map_t::accessor &acc, bool found,
+			 string_view key, string_view value)
+{
+	if (!found && changes && map->find(acc, key))
+		return false;
+	if (changes)
+		log_change(PMEMKV_CHANGE_PUT, key, value);
+
+	try {
+		if (!found)
+			return map->insert(acc, internal::cmap::kv_pair{key, value});
+		pmem::obj::transaction::run(pmpool,
+					    [&] { acc->first.assign(key, value); });
+	} catch (...) {
+		if (changes)
+			log_current(map, acc, key);
+		throw;
+	}
+	return true;
+}
+
+/* buffers of kv_map_t records are freed in the transaction which deletes the node */
+template <typename Map>
+bool cmap::erase_record(Map *map, string_view key)
+{
+	return map->erase(key);
+}
+
+/*
+ * Without a change log these are put_record() and erase_record(). Otherwise, the
+ * change is logged in its own transaction before the map applies it in its own
+ * one: the map's updates cannot be nested in an outer transaction. Callers hold
+ * the lock of the key, so changes of a key are logged in the order they are
+ * applied. If the map fails, the state it kept the key in is logged as a newer
+ * change; if the engine crashes in between, replay_changes() applies the logged
+ * change on the next open.
+ */
+template <typename Map>
+void cmap::apply_put(Map *map, string_view key, string_view value)
+{
+	if (!changes) {
+		put_record(map, key, value);
+		return;
+	}
+
+	log_change(PMEMKV_CHANGE_PUT, key, value);
+	try {
+		put_record(map, key, value);
+	} catch (...) {
+		log_current(map, key);
+		throw;
+	}
+}
+
+template <typename Map>
+bool cmap::apply_erase(Map *map, string_view key)
+{
+	if (!changes)
+		return erase_record(map, key);
+
+	{
+		typename Map::const_accessor acc;
+		if (!map->find(acc, key))
+			return false;
+	}
+
+	log_change(PMEMKV_CHANGE_REMOVE, key, string_view());
+	try {
+		return erase_record(map, key);
+	} catch (...) {
+		log_current(map, key);
+		throw;
+	}
+}
+
+/* appends a change to the log, the lock of the log is held only meanwhile */
+void cmap::log_change(int op, string_view key, string_view value)
+{
+	std::lock_guard<std::mutex> guard(changes->lock());
+	pmem::obj::transaction::run(pmpool, [&] { changes->append(op, key, value); });
+}
+
+/* logs the state of the key, after the map failed to apply its logged change */
+template <typename Map>
+void cmap::log_current(Map *map, string_view key)
+{
+	typename Map::const_accessor acc;
+	if (map->find(acc, key))
+		log_change(PMEMKV_CHANGE_PUT, key, internal::cmap::value_of(*acc));
+	else
+		log_change(PMEMKV_CHANGE_REMOVE, key, string_view());
+}
+
+template <typename Map>
+void cmap::log_current(Map *map, typename Map::accessor &acc, string_view key)
+{
+	if (acc.empty())
+		log_current(map, key);
+	else
+		log_change(PMEMKV_CHANGE_PUT, key, internal::cmap::value_of(*acc));
+}
+
+/*
+ * Applies the changes kept by the log once more, when the engine was not closed
+ * cleanly: the last changes may have been logged, but not applied. The log holds
+ * the latest changes of every key in the order they were applied, so replaying
+ * them leaves every key in the state of its last logged change.
+ */
+template <typename Map>
+void cmap::replay_changes(Map *map)
+{
+	struct replay {
+		cmap *engine;
+		Map *map;
+	} r{this, map};
+	changes->changes_since(
+		changes->first_seq() - 1,
+		[](uint64_t seq, int op, const char *k, size_t kb, const char *v,
+		   size_t vb, void *arg) {
+			auto r = static_cast<replay *>(arg);
+			if (op == PMEMKV_CHANGE_PUT)
+				r->engine->put_record(r->map, string_view(k, kb),
+						      string_view(v, vb));
+			else
+				r->engine->erase_record(r->map, string_view(k, kb));
+			return 0;
+		},
+		&r);
+}
+
+/*
+ * Applies a group of puts, queued by concurrent writers. The container does its
+ * own failure-atomic updates, which cannot be nested in an outer transaction
+ * (its locks are released and its metadata is updated before an outer commit),
+ * so the puts are applied one by one and only the failing ones return an error.
+ * With the change log, the puts of the group are logged in a single transaction
+ * first, see apply_put(); the writers hold the locks of their keys meanwhile.
+ */
+template <typename Map>
+void cmap::put_group(Map *map, internal::cmap::pending_put *const *group, size_t n)
+{
+	PMEMKV_PROBE1(group__commit__entry, n);
+	if (changes) {
+		try {
+			std::lock_guard<std::mutex> guard(changes->lock());
+			pmem::obj::transaction::run(pmpool, [&] {
+				for (size_t i = 0; i < n; ++i)
+					changes->append(PMEMKV_CHANGE_PUT, group[i]->key,
+							group[i]->value);
+			});
+		} catch (...) {
+			for (size_t i = 0; i < n; ++i)
+				group[i]->error = std::current_exception();
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		try {
+			put_record(map, group[i]->key, group[i]->value);
+		} catch (...) {
+			group[i]->error = std::current_exception();
+			try {
+				if (changes)
+					log_current(map, group[i]->key);
+			} catch (...) {
+				/* the log keeps the put, a replay applies it */
+			}
+		}
+	}
+	PMEMKV_PROBE1(group__commit__return, n);
+}
+
 status cmap::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	bool erased = container->erase(key);
-	return erased ? status::OK : status::NOT_FOUND;
+	/* an expired record is removed, but reported as missing */
+	auto key_lock = lock_key(key);
+	bool live = !ttl_enabled || exists(key) == status::OK;
+	bool erased;
+	if (kv_container)
+		erased = apply_erase(kv_container, key);
+	else
+		erased = fast_container ? apply_erase(fast_container, key)
+					: apply_erase(container, key);
+	return erased && live ? status::OK : status::NOT_FOUND;
+}
+
+/*
+ * The map updates its records in its own transactions, so a batch is made
+ * atomic by the batch log, if the pool is given by path.
+ */
+status cmap::write(internal::write_batch &batch)
+{
+	LOG("write batch of " << batch.size() << " operations");
+	check_outside_tx();
+
+	if (!batches)
+		return engine_base::write(batch);
+
+	/*
+	 * The log makes the batch atomic, not faster: it costs reads of previous
+	 * values and transactions of its own. Keys of the batch stay locked until
+	 * it is applied or restored, so restoring does not overwrite concurrent
+	 * writes and puts and removes of the batch do not lock them again.
+	 * Locks are taken in order, so concurrent batches do not deadlock.
+	 */
+	std::vector<size_t> stripes;
+	for (auto &op : batch.operations())
+		stripes.push_back(internal::cmap::fast_string_hasher::hash(
+					  op.key.data(), op.key.size()) %
+				  internal::cmap::KEY_LOCKS);
+	std::sort(stripes.begin(), stripes.end());
+	stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+
+	std::vector<std::unique_lock<std::mutex>> locks;
+	for (auto stripe : stripes)
+		locks.emplace_back(key_locks[stripe]);
+
+	batch_owner = this;
+	try {
+		auto s = batches->write(*this, batch);
+		batch_owner = nullptr;
+		return s;
+	} catch (...) {
+		batch_owner = nullptr;
+		throw;
+	}
 }
 
 status cmap::defrag(double start_percent, double amount_percent)
@@ -132,8 +865,17 @@ status cmap::defrag(double start_percent, double amount_percent)
 				       << " amount_percent = " << amount_percent);
 	check_outside_tx();
 
+	if (kv_container)
+		return defrag(kv_container, start_percent, amount_percent);
+	return fast_container ? defrag(fast_container, start_percent, amount_percent)
+			      : defrag(container, start_percent, amount_percent);
+}
+
+template <typename Map>
+status cmap::defrag(Map *map, double start_percent, double amount_percent)
+{
 	try {
-		container->defragment(start_percent, amount_percent);
+		map->defragment(start_percent, amount_percent);
 	} catch (std::range_error &e) {
 		out_err_stream("defrag") << e.what();
 		return status::INVALID_ARGUMENT;
@@ -145,11 +887,306 @@ status cmap::defrag(double start_percent, double amount_percent)
 	return status::OK;
 }
 
-void cmap::Recover()
+/*
+ * Buffers of records are relocated after the records themselves, for the same
+ * range of records. As the map does not lock them meanwhile, it must not be
+ * used by other threads.
+ */
+status cmap::defrag(internal::cmap::kv_map_t *map, double start_percent,
+		    double amount_percent)
+{
+	auto s = defrag<internal::cmap::kv_map_t>(map, start_percent, amount_percent);
+	if (s != status::OK)
+		return s;
+
+	auto count = static_cast<double>(map->size());
+	auto first = static_cast<size_t>(count * start_percent / 100);
+	auto last = static_cast<size_t>(count * (start_percent + amount_percent) / 100);
+
+	std::vector<PMEMoid *> oids;
+	size_t i = 0;
+	for (auto it = map->begin(); it != map->end() && i < last; ++it, ++i) {
+		if (i >= first)
+			oids.push_back(it->first.block_oid());
+	}
+	if (oids.empty())
+		return status::OK;
+
+	pobj_defrag_result result;
+	if (pmemobj_defrag(pmpool.handle(), oids.data(), oids.size(), &result) != 0) {
+		out_err_stream("defrag") << "Defragmentation of cmap records failed";
+		return status::DEFRAG_ERROR;
+	}
+
+	return status::OK;
+}
+
+status cmap::changes_since(uint64_t seq, change_callback *callback, void *arg)
 {
+	LOG("changes_since seq=" << seq);
+	check_outside_tx();
+	if (!changes)
+		return status::NOT_SUPPORTED;
+	if (!codec.enabled() && !ttl_enabled)
+		return changes->changes_since(seq, callback, arg);
+
+	/* values are recorded as they are stored */
+	struct decoding {
+		const cmap &engine;
+		change_callback *callback;
+		void *arg;
+		std::string buffer;
+	} d{*this, callback, arg, std::string()};
+	return changes->changes_since(
+		seq,
+		[](uint64_t seq, int op, const char *k, size_t kb, const char *v,
+		   size_t vb, void *arg) {
+			auto d = static_cast<decoding *>(arg);
+			/* removals are recorded without a value */
+			auto value = op == PMEMKV_CHANGE_PUT
+				? d->engine.decode_value(string_view(v, vb), d->buffer)
+				: string_view(v, vb);
+			return d->callback(seq, op, k, kb, value.data(), value.size(),
+					   d->arg);
+		},
+		&d);
+}
+
+void cmap::metrics(internal::engine_metrics &metrics)
+{
+	if (kv_container)
+		this->metrics(kv_container, metrics);
+	else
+		fast_container ? this->metrics(fast_container, metrics)
+			       : this->metrics(container, metrics);
+}
+
+template <typename Map>
+void cmap::metrics(Map *map, internal::engine_metrics &metrics)
+{
+	auto size = static_cast<uint64_t>(map->size());
+	auto buckets = static_cast<uint64_t>(map->bucket_count());
+
+	metrics.add("buckets", buckets);
+	metrics.add("load_factor",
+		    buckets ? static_cast<double>(size) / static_cast<double>(buckets)
+			    : 0.0);
+	metrics.add("clean_open", static_cast<uint64_t>(previous_shutdown_clean));
+
+	if (combiner) {
+		uint64_t groups, puts;
+		combiner->stats(groups, puts);
+		metrics.add("group_commits", groups);
+		metrics.add("group_commit_puts", puts);
+	}
+
+	if (changes)
+		metrics.add("change_log_last_seq", changes->last_seq());
+
+	if (codec.enabled()) {
+		metrics.add("compressed_values", codec.compressed_values());
+		metrics.add("compression_saved_bytes", codec.saved_bytes());
+	}
+
+	if (ttl_enabled) {
+		metrics.add("ttl_reaped", reaped.load());
+		metrics.add("ttl_queued", static_cast<uint64_t>(expiries.size()));
+	}
+}
+
+/*
+ * Bytes stored for the value: its encoding by the codec, preceded by the expiry
+ * time if TTL is enabled. The result may be kept in buf.
+ */
+string_view cmap::encode_value(string_view value, uint64_t expires, std::string &buf)
+{
+	if (!ttl_enabled)
+		return codec.encode(value, buf);
+
+	std::string encoded;
+	value = codec.encode(value, encoded);
+	buf.resize(sizeof(expires));
+	memcpy(&buf[0], &expires, sizeof(expires));
+	buf.append(value.data(), value.size());
+	return string_view(buf.data(), buf.size());
+}
+
+/* returns the value of bytes returned by encode_value() */
+string_view cmap::decode_value(string_view stored, std::string &buf) const
+{
+	if (ttl_enabled)
+		stored = string_view(stored.data() + sizeof(uint64_t),
+				     stored.size() - sizeof(uint64_t));
+	return codec.decode(stored, buf);
+}
+
+uint64_t cmap::expiry(string_view stored) const
+{
+	return ttl_enabled ? internal::cmap::expiry_of(stored) : 0;
+}
+
+/* the clock is read only for records which expire */
+bool cmap::expired(string_view stored) const
+{
+	auto expires = expiry(stored);
+	return expires != 0 && expires <= now();
+}
+
+uint64_t cmap::now() const
+{
+	if (clock)
+		return __atomic_load_n(clock, __ATOMIC_ACQUIRE);
+	return internal::cmap::now_ms();
+}
+
+/*
+ * Returns the lock of the key, if TTL is enabled. Writers hold it while they
+ * store the record, so the reaper does not remove a record put meanwhile.
+ */
+std::unique_lock<std::mutex> cmap::lock_key(string_view key)
+{
+	if (!key_locks || batch_owner == this)
+		return std::unique_lock<std::mutex>();
+
+	auto hash = internal::cmap::fast_string_hasher::hash(key.data(), key.size());
+	return std::unique_lock<std::mutex>(key_locks[hash % internal::cmap::KEY_LOCKS]);
+}
+
+/* queues expiry times of all records which expire, when the engine is opened */
+template <typename Map>
+void cmap::fill_expiries(Map *map)
+{
+	for (auto it = map->begin(); it != map->end(); ++it) {
+		auto expires = expiry(internal::cmap::value_of(*it));
+		if (expires != 0)
+			expiries.push(expires, internal::cmap::key_of(*it));
+	}
+}
+
+void cmap::start_reaper(uint64_t interval_ms)
+{
+	reaper = std::thread([this, interval_ms] {
+		std::unique_lock<std::mutex> lock(reaper_mtx);
+		while (!reaper_stop) {
+			reaper_cv.wait_for(lock, std::chrono::milliseconds(interval_ms));
+			if (reaper_stop)
+				break;
+
+			lock.unlock();
+			try {
+				reap();
+			} catch (std::exception &e) {
+				out_err_stream("ttl reaper") << e.what();
+			}
+			lock.lock();
+		}
+	});
+}
+
+/*
+ * Removes expired records, REAP_BATCH of them at a time, until there are no
+ * more or the engine is being closed. Each record is removed in its own
+ * transaction, holding the lock of its key only.
+ */
+void cmap::reap()
+{
+	std::vector<internal::cmap::expiry_queue::entry> batch;
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(reaper_mtx);
+			if (reaper_stop)
+				return;
+		}
+
+		batch.clear();
+		expiries.pop_expired(now(), internal::cmap::REAP_BATCH, batch);
+		if (batch.empty())
+			return;
+
+		for (auto &e : batch) {
+			bool erased;
+			if (kv_container)
+				erased = reap_record(kv_container, e.second, e.first);
+			else
+				erased = fast_container
+					? reap_record(fast_container, e.second, e.first)
+					: reap_record(container, e.second, e.first);
+			if (erased)
+				reaped++;
+		}
+	}
+}
+
+/* removes the record, if it still expires at the time it was queued with */
+template <typename Map>
+bool cmap::reap_record(Map *map, string_view key, uint64_t expires)
+{
+	auto key_lock = lock_key(key);
+	{
+		typename Map::const_accessor acc;
+		if (!map->find(acc, key))
+			return false;
+		if (expiry(internal::cmap::value_of(*acc)) != expires)
+			return false;
+	}
+
+	return apply_erase(map, key);
+}
+
+/*
+ * Allocates the container with the given type number, which tells which hash
+ * function and layout the pool uses, when it is opened again.
+ */
+template <typename Map>
+Map *cmap::create_container(uint64_t type_num)
+{
+	Map *map = nullptr;
+	pmem::obj::transaction::run(pmpool, [&] {
+		pmem::obj::transaction::snapshot(root_oid);
+		PMEMoid oid = pmemobj_tx_alloc(sizeof(Map), type_num);
+		if (OID_IS_NULL(oid))
+			throw pmem::transaction_alloc_error(
+				"Failed to allocate cmap container");
+
+		map = new (pmemobj_direct(oid)) Map();
+		*root_oid = oid;
+		map->runtime_initialize();
+	});
+
+	return map;
+}
+
+void cmap::Recover(bool fast_hash, bool contiguous)
+{
+	using internal::cmap::FAST_MAP_TYPE_NUM;
+	using internal::cmap::KV_MAP_TYPE_NUM;
+
+	/*
+	 * Buckets are rehashed lazily, when they are first accessed. Only the size
+	 * has to be recounted at open, by visiting all records, if the engine was
+	 * not closed cleanly (or the pool is given by oid).
+	 */
 	if (!OID_IS_NULL(*root_oid)) {
-		container = (pmem::kv::internal::cmap::map_t *)pmemobj_direct(*root_oid);
-		container->runtime_initialize();
+		/* hash function and layout are chosen once, when the pool is created */
+		if (pmemobj_type_num(*root_oid) == KV_MAP_TYPE_NUM) {
+			kv_container = (pmem::kv::internal::cmap::kv_map_t *)
+				pmemobj_direct(*root_oid);
+			kv_container->runtime_initialize(previous_shutdown_clean);
+		} else if (pmemobj_type_num(*root_oid) == FAST_MAP_TYPE_NUM) {
+			fast_container = (pmem::kv::internal::cmap::fast_map_t *)
+				pmemobj_direct(*root_oid);
+			fast_container->runtime_initialize(previous_shutdown_clean);
+		} else {
+			container = (pmem::kv::internal::cmap::map_t *)pmemobj_direct(
+				*root_oid);
+			container->runtime_initialize(previous_shutdown_clean);
+		}
+	} else if (contiguous) {
+		kv_container =
+			create_container<internal::cmap::kv_map_t>(KV_MAP_TYPE_NUM);
+	} else if (fast_hash) {
+		fast_container = create_container<internal::cmap::fast_map_t>(
+			FAST_MAP_TYPE_NUM);
 	} else {
 		pmem::obj::transaction::run(pmpool, [&] {
 			pmem::obj::transaction::snapshot(root_oid);
@@ -32,12 +32,27 @@
 
 #pragma once
 
+#include "../batch_log.h"
+#include "../change_log.h"
+#include "../parallel_scan.h"
 #include "../pmemobj_engine.h"
 #include "../polymorphic_string.h"
+#include "../scan_batch.h"
 
 #include <libpmemobj++/container/concurrent_hash_map.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
 namespace pmem
 {
 namespace kv
@@ -56,6 +71,10 @@ public:
 	}
 };
 
+/*
+ * Hash of the pools created before the hash function became selectable.
+ * It must never change, as it determines placement of the existing elements.
+ */
 class string_hasher {
 	/* hash multiplier used by fibonacci hashing */
 	static const size_t hash_multiplier = 11400714819323198485ULL;
@@ -73,8 +92,7 @@ public:
 		return hash(str.data(), str.size());
 	}
 
-private:
-	size_t hash(const char *str, size_t size) const
+	static size_t hash(const char *str, size_t size)
 	{
 		size_t h = 0;
 		for (size_t i = 0; i < size; ++i) {
@@ -84,8 +102,411 @@ private:
 	}
 };
 
+/*
+ * Hash which consumes the key 8 or 16 bytes at a time, with wyhash-style
+ * multiply-fold mixing. Three independent lanes are used for long keys, so
+ * multiplications do not form a single dependency chain. Like string_hasher
+ * it is part of the pool layout and must never change.
+ */
+class fast_string_hasher {
+	static const uint64_t p0 = 0xa0761d6478bd642fULL;
+	static const uint64_t p1 = 0xe7037ed1a0b428dbULL;
+	static const uint64_t p2 = 0x8ebc6af09c88c6e3ULL;
+	static const uint64_t p3 = 0x589965cc75374cc3ULL;
+
+public:
+	using transparent_key_equal = key_equal;
+
+	size_t operator()(const pmem::kv::polymorphic_string &str) const
+	{
+		return hash(str.c_str(), str.size());
+	}
+
+	size_t operator()(string_view str) const
+	{
+		return hash(str.data(), str.size());
+	}
+
+	static size_t hash(const char *str, size_t size)
+	{
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(str);
+		uint64_t seed = p0;
+		uint64_t a, b;
+
+		if (size <= 16) {
+			if (size >= 4) {
+				size_t shift = (size >> 3) << 2;
+				a = (read32(p) << 32) | read32(p + shift);
+				b = (read32(p + size - 4) << 32) | read32(p + size - 4 - shift);
+			} else if (size > 0) {
+				a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) |
+					p[size - 1];
+				b = 0;
+			} else {
+				a = b = 0;
+			}
+		} else {
+			size_t i = size;
+			if (i > 48) {
+				uint64_t see1 = seed, see2 = seed;
+				do {
+					seed = mix(read64(p) ^ p1, read64(p + 8) ^ seed);
+					see1 = mix(read64(p + 16) ^ p2, read64(p + 24) ^ see1);
+					see2 = mix(read64(p + 32) ^ p3, read64(p + 40) ^ see2);
+					p += 48;
+					i -= 48;
+				} while (i > 48);
+				seed ^= see1 ^ see2;
+			}
+			while (i > 16) {
+				seed = mix(read64(p) ^ p1, read64(p + 8) ^ seed);
+				p += 16;
+				i -= 16;
+			}
+			a = read64(p + i - 16);
+			b = read64(p + i - 8);
+		}
+
+		return static_cast<size_t>(mix(p1 ^ size, mix(a ^ p1, b ^ seed)));
+	}
+
+private:
+	/* folds 128-bit product of the arguments */
+	static uint64_t mix(uint64_t lhs, uint64_t rhs)
+	{
+		__extension__ typedef unsigned __int128 uint128_t;
+		uint128_t r = static_cast<uint128_t>(lhs) * rhs;
+		return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+	}
+
+	/* keys are read in little-endian order, as on all supported platforms */
+	static uint64_t read64(const unsigned char *p)
+	{
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static uint64_t read32(const unsigned char *p)
+	{
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+};
+
+/* key and value of a put, looked up in kv_map_t as a key */
+struct kv_pair {
+	string_view key;
+	string_view value;
+};
+
+/*
+ * Key and value of a record of kv_map_t, stored in a single persistent buffer:
+ * sizes of the key and of the value, followed by the key and the value. It takes
+ * one allocation per record, instead of one for each string longer than SSO,
+ * and a lookup reads the key right after its size.
+ *
+ * The buffer is replaced when the value is assigned, which is why it is mutable:
+ * the map keeps its keys const. Constructor, assign() and destructor have to be
+ * called within a transaction; the map runs constructor and destructor in the
+ * transactions which allocate and free its nodes. Buffers are taken from the
+ * allocation classes of the pool, if one fits their size.
+ */
+class kv_entry {
+public:
+	kv_entry(const kv_pair &kv) : block(OID_NULL)
+	{
+		assign(kv.key, kv.value);
+	}
+
+	~kv_entry()
+	{
+		if (!OID_IS_NULL(block))
+			pmemobj_tx_free(block);
+	}
+
+	kv_entry(const kv_entry &) = delete;
+	kv_entry &operator=(const kv_entry &) = delete;
+
+	string_view key() const
+	{
+		auto h = head();
+		return string_view(reinterpret_cast<const char *>(h + 1), h->key_size);
+	}
+
+	string_view value() const
+	{
+		auto h = head();
+		return string_view(reinterpret_cast<const char *>(h + 1) + h->key_size,
+				   h->value_size);
+	}
+
+	/* replaces the buffer with a new one, holding the given key and value */
+	void assign(string_view key, string_view value) const
+	{
+		const size_t size = sizeof(header) + key.size() + value.size();
+		PMEMoid oid = pmemobj_tx_xalloc(
+			size, 0, alloc_classes::flags(pmemobj_pool_by_ptr(this), size));
+		if (OID_IS_NULL(oid))
+			throw pmem::transaction_alloc_error(
+				"Failed to allocate cmap record");
+
+		auto h = static_cast<header *>(pmemobj_direct(oid));
+		h->key_size = key.size();
+		h->value_size = value.size();
+		char *data = reinterpret_cast<char *>(h + 1);
+		memcpy(data, key.data(), key.size());
+		memcpy(data + key.size(), value.data(), value.size());
+
+		pmem::obj::transaction::snapshot(&block);
+		if (!OID_IS_NULL(block))
+			pmemobj_tx_free(block);
+		block = oid;
+	}
+
+	/* pointer to the buffer, updated by defragmentation when it is relocated */
+	PMEMoid *block_oid() const
+	{
+		return &block;
+	}
+
+	bool operator==(const kv_entry &rhs) const
+	{
+		return *this == rhs.key();
+	}
+
+	bool operator==(string_view rhs) const
+	{
+		auto k = key();
+		return k.size() == rhs.size() &&
+			memcmp(k.data(), rhs.data(), k.size()) == 0;
+	}
+
+	bool operator==(const kv_pair &rhs) const
+	{
+		return *this == rhs.key;
+	}
+
+private:
+	struct header {
+		uint64_t key_size;
+		uint64_t value_size;
+	};
+
+	const header *head() const
+	{
+		return static_cast<const header *>(pmemobj_direct(block));
+	}
+
+	mutable PMEMoid block;
+};
+
+/* kv_map_t keeps everything in its keys */
+struct empty_value {
+};
+
+/* fast_string_hasher applied to keys of kv_entry */
+class kv_hasher {
+public:
+	using transparent_key_equal = key_equal;
+
+	size_t operator()(const kv_entry &e) const
+	{
+		return (*this)(e.key());
+	}
+
+	size_t operator()(const kv_pair &kv) const
+	{
+		return (*this)(kv.key);
+	}
+
+	size_t operator()(string_view str) const
+	{
+		return fast_string_hasher::hash(str.data(), str.size());
+	}
+};
+
 using string_t = pmem::kv::polymorphic_string;
 using map_t = pmem::obj::concurrent_hash_map<string_t, string_t, string_hasher>;
+using fast_map_t =
+	pmem::obj::concurrent_hash_map<string_t, string_t, fast_string_hasher>;
+using kv_map_t = pmem::obj::concurrent_hash_map<kv_entry, empty_value, kv_hasher>;
+
+/*
+ * Type numbers of fast_map_t and kv_map_t allocations. They mark pools which use
+ * fast_string_hasher and kv_entry, map_t is allocated with the default type
+ * number.
+ */
+const uint64_t FAST_MAP_TYPE_NUM = 0x636d61705f763201ULL;
+const uint64_t KV_MAP_TYPE_NUM = 0x636d61705f763301ULL;
+
+inline string_view key_of(const map_t::value_type &r)
+{
+	return string_view(r.first.c_str(), r.first.size());
+}
+
+inline string_view value_of(const map_t::value_type &r)
+{
+	return string_view(r.second.c_str(), r.second.size());
+}
+
+inline string_view key_of(const kv_map_t::value_type &r)
+{
+	return r.first.key();
+}
+
+inline string_view value_of(const kv_map_t::value_type &r)
+{
+	return r.first.value();
+}
+
+/* number of records get_all_parallel() hands out to a worker at once */
+const size_t PARALLEL_CHUNK = 1024;
+
+/* maximal number of puts applied by a group commit at once */
+const size_t GROUP_COMMIT_MAX = 256;
+
+/* put waiting in write_combiner, until a leader applies it */
+struct pending_put {
+	pending_put(string_view key, string_view value) : key(key), value(value)
+	{
+	}
+
+	string_view key;
+	string_view value;
+	std::exception_ptr error;
+	bool done = false;
+};
+
+/*
+ * Combining queue of concurrent puts. A thread, which finds no leader, becomes
+ * one and applies all the puts queued at that time (its own included) as
+ * a group, while the other threads wait; the puts queued meanwhile are applied
+ * by the next leader. Every put() returns only after its group is applied.
+ */
+class write_combiner {
+public:
+	/*
+	 * Queues the put and waits until it is applied. Function apply(group, n)
+	 * is called by the leader without the lock held; it must not throw, errors
+	 * of single puts are stored in their error member and rethrown here.
+	 */
+	template <typename Apply>
+	void put(pending_put &req, Apply apply)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		queue.push_back(&req);
+		while (!req.done) {
+			if (leader) {
+				cv.wait(lock);
+				continue;
+			}
+
+			/* puts are applied in the order they were queued */
+			leader = true;
+			size_t n = (std::min)(queue.size(), GROUP_COMMIT_MAX);
+			group.assign(queue.begin(), queue.begin() + static_cast<long>(n));
+			queue.erase(queue.begin(), queue.begin() + static_cast<long>(n));
+			lock.unlock();
+
+			apply(group.data(), group.size());
+
+			lock.lock();
+			for (auto p : group)
+				p->done = true;
+			groups++;
+			grouped += group.size();
+			leader = false;
+			cv.notify_all();
+		}
+		lock.unlock();
+
+		if (req.error)
+			std::rethrow_exception(req.error);
+	}
+
+	/* returns number of groups and of puts applied by them so far */
+	void stats(uint64_t &groups_applied, uint64_t &puts_applied)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		groups_applied = groups;
+		puts_applied = grouped;
+	}
+
+private:
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::vector<pending_put *> queue;
+	/* puts applied by the current leader, kept to reuse its memory */
+	std::vector<pending_put *> group;
+	bool leader = false;
+	uint64_t groups = 0;
+	uint64_t grouped = 0;
+};
+
+/* default period of the reaper of expired records, see "ttl_reap_interval" */
+const uint64_t DEFAULT_REAP_INTERVAL_MS = 1000;
+
+/* maximal number of expired records removed by the reaper at once */
+const size_t REAP_BATCH = 64;
+
+/* number of locks of keys, see cmap::lock_key() */
+const size_t KEY_LOCKS = 64;
+
+/* milliseconds since the epoch, the clock of expiry times stored in the pool */
+inline uint64_t now_ms()
+{
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch())
+			.count());
+}
+
+/* expiry time stored in front of a value, 0 if the record never expires */
+inline uint64_t expiry_of(string_view stored)
+{
+	uint64_t expires;
+	memcpy(&expires, stored.data(), sizeof(expires));
+	return expires;
+}
+
+/*
+ * Expiry times of records put with TTL, kept in DRAM in order of time, so the
+ * reaper finds expired records without walking the map. Entries are not removed
+ * when their records are replaced or removed; the reaper compares them with the
+ * expiry time of the record before it removes it.
+ */
+class expiry_queue {
+public:
+	typedef std::pair<uint64_t, std::string> entry;
+
+	void push(uint64_t expires, string_view key)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		heap.emplace(expires, std::string(key.data(), key.size()));
+	}
+
+	/* moves up to max entries, which expired at now, to out */
+	void pop_expired(uint64_t now, size_t max, std::vector<entry> &out)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		while (!heap.empty() && heap.top().first <= now && out.size() < max) {
+			out.push_back(heap.top());
+			heap.pop();
+		}
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return heap.size();
+	}
+
+private:
+	std::mutex mtx;
+	std::priority_queue<entry, std::vector<entry>, std::greater<entry>> heap;
+};
 
 } /* namespace cmap */
 } /* namespace internal */
@@ -104,19 +525,147 @@ public:
 
 	status get_all(get_kv_callback *callback, void *arg) final;
 
+	status scan(string_view prefix, size_t limit, size_t batch_size,
+		    scan_callback *callback, void *arg) final;
+
+	status get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				void *arg) final;
+
 	status exists(string_view key) final;
 
 	status get(string_view key, get_v_callback *callback, void *arg) final;
 
+	status get_many(size_t count, const string_view *keys,
+			get_many_v_callback *callback, void *arg) final;
+
+	status get_ref(string_view key, internal::value_ref &ref) final;
+
 	status put(string_view key, string_view value) final;
 
+	status put_with_ttl(string_view key, string_view value, uint64_t ttl_ms) final;
+
+	status get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			     void *arg, bool &inserted) final;
+
+	status update(string_view key, update_callback *callback, void *arg) final;
+
 	status remove(string_view key) final;
 
+	status write(internal::write_batch &batch) final;
+
 	status defrag(double start_percent, double amount_percent) final;
 
+	status changes_since(uint64_t seq, change_callback *callback, void *arg) final;
+
+	void metrics(internal::engine_metrics &metrics) final;
+
 private:
-	void Recover();
-	internal::cmap::map_t *container;
+	template <typename Map>
+	std::size_t count_live(Map *map);
+	template <typename Map>
+	status get_all(Map *map, get_kv_callback *callback, void *arg);
+	template <typename Map>
+	status scan(Map *map, internal::scan_batch &batch);
+	template <typename Map>
+	status get_all_parallel(Map *map, size_t nthreads,
+				get_kv_parallel_callback *callback, void *arg);
+	template <typename Map>
+	bool contains(Map *map, string_view key);
+	template <typename Map>
+	status get(Map *map, string_view key, get_v_callback *callback, void *arg);
+	template <typename Map>
+	status get_many(Map *map, size_t count, const string_view *keys,
+			get_many_v_callback *callback, void *arg);
+	template <typename Map>
+	status get_ref(Map *map, string_view key, internal::value_ref &ref);
+	template <typename Map>
+	status defrag(Map *map, double start_percent, double amount_percent);
+	template <typename Map>
+	void metrics(Map *map, internal::engine_metrics &metrics);
+	status defrag(internal::cmap::kv_map_t *map, double start_percent,
+		      double amount_percent);
+	template <typename Map>
+	void put_group(Map *map, internal::cmap::pending_put *const *group, size_t n);
+	template <typename Map>
+	void put_record(Map *map, string_view key, string_view value);
+	void put_record(internal::cmap::kv_map_t *map, string_view key,
+			string_view value);
+	template <typename Map>
+	bool get_or_insert(Map *map, string_view key, string_view value,
+			   get_v_callback *callback, void *arg);
+	template <typename Map>
+	status update(Map *map, string_view key, update_callback *callback, void *arg);
+	template <typename Map>
+	bool update_record(Map *map, typename Map::accessor &acc, bool found,
+			   string_view key, string_view value);
+	bool update_record(internal::cmap::kv_map_t *map,
+			   internal::cmap::kv_map_t::accessor &acc, bool found,
+			   string_view key, string_view value);
+	template <typename Map>
+	bool erase_record(Map *map, string_view key);
+	template <typename Map>
+	void apply_put(Map *map, string_view key, string_view value);
+	template <typename Map>
+	bool apply_erase(Map *map, string_view key);
+	void log_change(int op, string_view key, string_view value);
+	template <typename Map>
+	void log_current(Map *map, string_view key);
+	template <typename Map>
+	void log_current(Map *map, typename Map::accessor &acc, string_view key);
+	template <typename Map>
+	void replay_changes(Map *map);
+	status put_value(string_view key, string_view value, uint64_t expires);
+
+	string_view encode_value(string_view value, uint64_t expires, std::string &buf);
+	string_view decode_value(string_view stored, std::string &buf) const;
+	uint64_t expiry(string_view stored) const;
+	bool expired(string_view stored) const;
+	uint64_t now() const;
+	std::unique_lock<std::mutex> lock_key(string_view key);
+
+	template <typename Map>
+	void fill_expiries(Map *map);
+	void start_reaper(uint64_t interval_ms);
+	void reap();
+	template <typename Map>
+	bool reap_record(Map *map, string_view key, uint64_t expires);
+
+	template <typename Map>
+	Map *create_container(uint64_t type_num);
+
+	void Recover(bool fast_hash, bool contiguous);
+
+	/* exactly one of them is set, depending on hash and layout of the pool */
+	internal::cmap::map_t *container = nullptr;
+	internal::cmap::fast_map_t *fast_container = nullptr;
+	internal::cmap::kv_map_t *kv_container = nullptr;
+
+	/* set if puts are applied in groups, see "group_commit" config item */
+	std::unique_ptr<internal::cmap::write_combiner> combiner;
+
+	/* set if changes are recorded, see "change_log_size" config item */
+	std::unique_ptr<internal::change_log> changes;
+
+	/* log of write batches, not set if the pool is given by oid */
+	std::unique_ptr<internal::batch_log> batches;
+
+	/* set if values carry their expiry time, see "ttl" config item */
+	bool ttl_enabled = false;
+	/* time in milliseconds, if set by "ttl_clock" config item */
+	const uint64_t *clock = nullptr;
+	/*
+	 * locks of keys, taken by writers if TTL, the change log or the batch log
+	 * is enabled
+	 */
+	std::unique_ptr<std::mutex[]> key_locks;
+	internal::cmap::expiry_queue expiries;
+
+	/* removes expired records in background, see "ttl_reap_interval" */
+	std::thread reaper;
+	std::mutex reaper_mtx;
+	std::condition_variable reaper_cv;
+	bool reaper_stop = false;
+	std::atomic<uint64_t> reaped{0};
 };
 
 } /* namespace kv */
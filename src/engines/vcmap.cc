@@ -91,7 +91,7 @@ status vcmap::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	for (auto &iterator : pmem_kv_container) {
-		auto ret = callback(iterator.first.c_str(), iterator.first.size(),
+		auto ret = callback(iterator.first.data(), iterator.first.size(),
 				    iterator.second.c_str(), iterator.second.size(), arg);
 
 		if (ret != 0)
@@ -105,9 +105,8 @@ status vcmap::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	map_t::const_accessor result;
-	// XXX - do not create temporary string
-	const bool result_found = pmem_kv_container.find(
-		result, pmem_string(key.data(), key.size(), ch_allocator));
+	const bool result_found =
+		pmem_kv_container.find(result, key_type(key, ch_allocator));
 	return (result_found ? status::OK : status::NOT_FOUND);
 }
 
@@ -115,9 +114,8 @@ status vcmap::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
 	map_t::const_accessor result;
-	// XXX - do not create temporary string
-	const bool result_found = pmem_kv_container.find(
-		result, pmem_string(key.data(), key.size(), ch_allocator));
+	const bool result_found =
+		pmem_kv_container.find(result, key_type(key, ch_allocator));
 	if (!result_found) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
@@ -132,9 +130,10 @@ status vcmap::put(string_view key, string_view value)
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 
-	map_t::value_type kv_pair{// XXX - do not create temporary string
-				  pmem_string(key.data(), key.size(), ch_allocator),
-				  pmem_string(value.data(), value.size(), ch_allocator)};
+	/* the key refers to the data, it is copied only by the insert */
+	map_t::value_type kv_pair(
+		std::piecewise_construct, std::forward_as_tuple(key, ch_allocator),
+		std::forward_as_tuple(value.data(), value.size(), ch_allocator));
 	bool result = pmem_kv_container.insert(kv_pair);
 	if (!result) {
 		map_t::accessor result_found;
@@ -148,9 +147,7 @@ status vcmap::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 
-	// XXX - do not create temporary string
-	size_t erased = pmem_kv_container.erase(
-		pmem_string(key.data(), key.size(), ch_allocator));
+	size_t erased = pmem_kv_container.erase(key_type(key, ch_allocator));
 	return (erased == 1) ? status::OK : status::NOT_FOUND;
 }
 
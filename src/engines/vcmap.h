@@ -34,6 +34,7 @@
 
 #include "../engine.h"
 #include "pmem_allocator.h"
+#include <cstring>
 #include <scoped_allocator>
 #include <string>
 #include <tbb/concurrent_hash_map.h>
@@ -48,6 +49,74 @@ namespace pmem
 {
 namespace kv
 {
+namespace internal
+{
+namespace vcmap
+{
+
+typedef memkind_ns::allocator<char> ch_allocator_t;
+typedef std::basic_string<char, std::char_traits<char>, ch_allocator_t> pmem_string;
+
+/*
+ * Key of a record. A key stored in the map owns a copy of the data, allocated by
+ * memkind. A key constructed from a string_view only refers to the data, so that
+ * looking a record up allocates nothing; the copy made when a record is inserted
+ * owns the data.
+ */
+class key {
+public:
+	key(string_view lookup, const ch_allocator_t &allocator)
+	    : str(allocator), lookup(lookup), owning(false)
+	{
+	}
+
+	key(const key &other)
+	    : str(other.data(), other.size(), other.str.get_allocator()), owning(true)
+	{
+	}
+
+	key &operator=(const key &) = delete;
+
+	const char *data() const
+	{
+		return owning ? str.data() : lookup.data();
+	}
+
+	size_t size() const
+	{
+		return owning ? str.size() : lookup.size();
+	}
+
+private:
+	pmem_string str;
+	string_view lookup;
+	bool owning;
+};
+
+/* the same hash, as of tbb_hash_compare for strings */
+class key_hash_compare {
+	/* hash multiplier used by fibonacci hashing */
+	static const size_t hash_multiplier = 11400714819323198485ULL;
+
+public:
+	size_t hash(const key &k) const
+	{
+		size_t h = 0;
+		const char *str = k.data();
+		for (size_t i = 0; i < k.size(); ++i)
+			h = static_cast<size_t>(str[i]) ^ (h * hash_multiplier);
+		return h;
+	}
+
+	bool equal(const key &lhs, const key &rhs) const
+	{
+		return lhs.size() == rhs.size() &&
+			memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+	}
+};
+
+} /* namespace vcmap */
+} /* namespace internal */
 
 class vcmap : public engine_base {
 public:
@@ -69,12 +138,13 @@ public:
 	status remove(string_view key) final;
 
 private:
-	typedef memkind_ns::allocator<char> ch_allocator_t;
-	typedef std::basic_string<char, std::char_traits<char>, ch_allocator_t>
-		pmem_string;
-	typedef memkind_ns::allocator<std::pair<pmem_string, pmem_string>> kv_allocator_t;
-	typedef tbb::concurrent_hash_map<pmem_string, pmem_string,
-					 tbb::tbb_hash_compare<pmem_string>,
+	typedef internal::vcmap::ch_allocator_t ch_allocator_t;
+	typedef internal::vcmap::pmem_string pmem_string;
+	typedef internal::vcmap::key key_type;
+	typedef memkind_ns::allocator<std::pair<const key_type, pmem_string>>
+		kv_allocator_t;
+	typedef tbb::concurrent_hash_map<key_type, pmem_string,
+					 internal::vcmap::key_hash_compare,
 					 std::scoped_allocator_adaptor<kv_allocator_t>>
 		map_t;
 	kv_allocator_t kv_allocator;
@@ -0,0 +1,681 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "vskiplist.h"
+#include "../out.h"
+
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+namespace pmem
+{
+namespace kv
+{
+
+/* number of retired blocks after which freeing them is attempted */
+static const std::size_t RECLAIM_THRESHOLD = 128;
+
+static std::string get_path(internal::config &cfg)
+{
+	const char *path;
+	if (!cfg.get_string("path", &path))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"path\"");
+
+	return std::string(path);
+}
+
+static uint64_t get_size(internal::config &cfg)
+{
+	std::size_t size;
+	if (!cfg.get_uint64("size", &size))
+		throw internal::invalid_argument(
+			"Config does not contain item with key: \"size\"");
+
+	return size;
+}
+
+static internal::vskiplist::node *ptr(uintptr_t next)
+{
+	return reinterpret_cast<internal::vskiplist::node *>(next & ~uintptr_t(1));
+}
+
+static bool marked(uintptr_t next)
+{
+	return (next & 1) != 0;
+}
+
+static void mark(std::atomic<uintptr_t> &next)
+{
+	uintptr_t current = next.load();
+	while (!marked(current) && !next.compare_exchange_weak(current, current | 1))
+		;
+}
+
+/* each level above the first one is used with probability 1/4 */
+static uint32_t random_height(uint32_t max_height)
+{
+	static thread_local uint64_t state = 0;
+	if (state == 0)
+		state = reinterpret_cast<uintptr_t>(&state) | 1;
+
+	/* xorshift64 */
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+
+	uint64_t bits = state;
+	uint32_t height = 1;
+	while (height < max_height && (bits & 3) == 0) {
+		height++;
+		bits >>= 2;
+	}
+
+	return height;
+}
+
+vskiplist::epoch_guard::epoch_guard(vskiplist &list) : list(list)
+{
+	/* the phase may be flipped concurrently, register in the current one */
+	for (;;) {
+		phase = list.phase.load();
+		list.active[phase].fetch_add(1);
+		if (list.phase.load() == phase)
+			break;
+		list.active[phase].fetch_sub(1);
+	}
+}
+
+vskiplist::epoch_guard::~epoch_guard()
+{
+	list.active[phase].fetch_sub(1);
+}
+
+vskiplist::vskiplist(std::unique_ptr<internal::config> cfg)
+    : ch_allocator(get_path(*cfg), get_size(*cfg)),
+      head(nullptr),
+      size(0),
+      phase(0),
+      retired(nullptr),
+      retired_count(0),
+      pending(nullptr),
+      pending_phase(0)
+{
+	active[0].store(0);
+	active[1].store(0);
+	head = new_node(string_view(), MAX_HEIGHT);
+	LOG("Started ok");
+}
+
+vskiplist::~vskiplist()
+{
+	free_list(pending);
+	free_list(retired.load());
+
+	node *n = head;
+	while (n) {
+		node *next = ptr(n->next()[0].load());
+		free_node(n);
+		n = next;
+	}
+
+	LOG("Stopped ok");
+}
+
+std::string vskiplist::name()
+{
+	return "vskiplist";
+}
+
+vskiplist::node *vskiplist::new_node(string_view key, uint32_t height)
+{
+	auto bytes = sizeof(node) + height * sizeof(std::atomic<uintptr_t>) + key.size();
+	node *n = new (ch_allocator.allocate(bytes)) node;
+	n->next_retired = nullptr;
+	n->is_node = true;
+	n->value.store(nullptr);
+	n->first_done.store(false);
+	n->height = height;
+	n->key_size = key.size();
+	for (uint32_t i = 0; i < height; i++)
+		new (&n->next()[i]) std::atomic<uintptr_t>(0);
+	memcpy(const_cast<char *>(n->key().data()), key.data(), key.size());
+
+	return n;
+}
+
+vskiplist::value_entry *vskiplist::new_value(string_view value)
+{
+	auto bytes = sizeof(value_entry) + value.size();
+	value_entry *v = new (ch_allocator.allocate(bytes)) value_entry;
+	v->next_retired = nullptr;
+	v->is_node = false;
+	v->size = value.size();
+	memcpy(const_cast<char *>(v->data()), value.data(), value.size());
+
+	return v;
+}
+
+void vskiplist::free_node(node *n)
+{
+	auto bytes =
+		sizeof(node) + n->height * sizeof(std::atomic<uintptr_t>) + n->key_size;
+	auto v = n->value.load();
+	if (v)
+		free_value(v);
+	n->~node();
+	ch_allocator.deallocate(reinterpret_cast<char *>(n), bytes);
+}
+
+void vskiplist::free_value(value_entry *v)
+{
+	auto bytes = sizeof(value_entry) + v->size;
+	v->~value_entry();
+	ch_allocator.deallocate(reinterpret_cast<char *>(v), bytes);
+}
+
+void vskiplist::free_list(reclaimable *r)
+{
+	while (r) {
+		auto next = r->next_retired;
+		if (r->is_node)
+			free_node(static_cast<node *>(r));
+		else
+			free_value(static_cast<value_entry *>(r));
+		r = next;
+	}
+}
+
+/*
+ * Queues memory which was made unreachable by the calling thread. It is freed
+ * by try_reclaim() once all operations which could have reached it are done.
+ */
+void vskiplist::retire(reclaimable *r)
+{
+	auto top = retired.load();
+	do {
+		r->next_retired = top;
+	} while (!retired.compare_exchange_weak(top, r));
+
+	retired_count.fetch_add(1);
+}
+
+/*
+ * Frees memory retired before the last phase flip if no operation registered
+ * in that phase is still running and flips the phase for the memory retired
+ * since then. Never waits, so it is safe to call from inside an operation.
+ */
+void vskiplist::try_reclaim()
+{
+	std::unique_lock<std::mutex> lock(reclaim_mtx, std::try_to_lock);
+	if (!lock.owns_lock())
+		return;
+
+	if (pending) {
+		if (active[pending_phase].load() != 0)
+			return;
+
+		free_list(pending);
+	}
+
+	retired_count.store(0);
+	pending = retired.exchange(nullptr);
+	if (pending) {
+		pending_phase = phase.load();
+		phase.store(pending_phase ^ 1);
+	}
+}
+
+/*
+ * Finds predecessors and successors of the key on all levels, unlinking
+ * removed nodes on the way. Returns true if succs[0] holds the key.
+ */
+bool vskiplist::find(string_view key, node **preds, node **succs)
+{
+	for (;;) {
+		bool restart = false;
+		node *pred = head;
+		for (uint32_t level = MAX_HEIGHT; level-- > 0 && !restart;) {
+			node *curr = ptr(pred->next()[level].load());
+			while (curr) {
+				uintptr_t succ = curr->next()[level].load();
+				if (marked(succ)) {
+					auto expected = reinterpret_cast<uintptr_t>(curr);
+					if (!pred->next()[level].compare_exchange_strong(
+						    expected, succ & ~uintptr_t(1))) {
+						restart = true;
+						break;
+					}
+					curr = ptr(succ);
+				} else if (curr->key().compare(key) < 0) {
+					pred = curr;
+					curr = ptr(succ);
+				} else {
+					break;
+				}
+			}
+			preds[level] = pred;
+			succs[level] = curr;
+		}
+
+		if (!restart)
+			return succs[0] && succs[0]->key().compare(key) == 0;
+	}
+}
+
+/*
+ * Links already inserted node on the given level. Returns false if the node
+ * was removed in the meantime and its tower should not be built further.
+ */
+bool vskiplist::link_level(node *n, uint32_t level, node **preds, node **succs)
+{
+	for (;;) {
+		auto succ = reinterpret_cast<uintptr_t>(succs[level]);
+		auto next = n->next()[level].load();
+		/* the only concurrent change of the node's pointers is marking */
+		if (marked(next))
+			return false;
+		if (next != succ &&
+		    !n->next()[level].compare_exchange_strong(next, succ))
+			return false;
+
+		auto expected = succ;
+		if (preds[level]->next()[level].compare_exchange_strong(
+			    expected, reinterpret_cast<uintptr_t>(n)))
+			return true;
+
+		if (!find(n->key(), preds, succs) || succs[0] != n)
+			return false;
+	}
+}
+
+void vskiplist::link_tower(node *n, node **preds, node **succs)
+{
+	for (uint32_t level = 1; level < n->height; level++)
+		if (!link_level(n, level, preds, succs))
+			break;
+
+	/* a remover may have finished before some levels were linked */
+	if (marked(n->next()[0].load()))
+		find(n->key(), preds, succs);
+
+	if (n->first_done.exchange(true))
+		retire(n);
+}
+
+/*
+ * Returns the first not removed node with a key greater than (or equal to,
+ * if inclusive) the given one. Never modifies the list.
+ */
+vskiplist::node *vskiplist::first_not_less(string_view key, bool inclusive)
+{
+	node *pred = head;
+	node *curr = nullptr;
+	for (uint32_t level = MAX_HEIGHT; level-- > 0;) {
+		curr = ptr(pred->next()[level].load());
+		while (curr) {
+			int cmp = curr->key().compare(key);
+			if (cmp > 0 || (inclusive && cmp == 0))
+				break;
+			pred = curr;
+			curr = ptr(curr->next()[level].load());
+		}
+	}
+
+	/* nodes following a removed one are still in order */
+	while (curr && marked(curr->next()[0].load()))
+		curr = ptr(curr->next()[0].load());
+
+	return curr;
+}
+
+/* returns the first not removed node after n */
+vskiplist::node *vskiplist::next_live(node *n)
+{
+	n = ptr(n->next()[0].load());
+	while (n && marked(n->next()[0].load()))
+		n = ptr(n->next()[0].load());
+
+	return n;
+}
+
+template <typename End>
+std::size_t vskiplist::count_range(node *first, End end)
+{
+	std::size_t result = 0;
+	for (node *n = first; n && !end(n); n = next_live(n))
+		result++;
+
+	return result;
+}
+
+template <typename End>
+status vskiplist::get_range(node *first, End end, get_kv_callback *callback, void *arg)
+{
+	for (node *n = first; n && !end(n); n = next_live(n)) {
+		auto key = n->key();
+		auto value = n->value.load();
+		auto ret = callback(key.data(), key.size(), value->data(), value->size,
+				    arg);
+
+		if (ret != 0)
+			return status::STOPPED_BY_CB;
+	}
+
+	return status::OK;
+}
+
+status vskiplist::count_all(std::size_t &cnt)
+{
+	cnt = size.load();
+
+	return status::OK;
+}
+
+status vskiplist::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	cnt = count_range(first_not_less(key, false), [](node *) { return false; });
+
+	return status::OK;
+}
+
+status vskiplist::count_equal_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	cnt = count_range(first_not_less(key, true), [](node *) { return false; });
+
+	return status::OK;
+}
+
+status vskiplist::count_equal_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	cnt = count_range(next_live(head),
+			  [&](node *n) { return n->key().compare(key) > 0; });
+
+	return status::OK;
+}
+
+status vskiplist::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	cnt = count_range(next_live(head),
+			  [&](node *n) { return n->key().compare(key) >= 0; });
+
+	return status::OK;
+}
+
+status vskiplist::count_between(string_view key1, string_view key2, std::size_t &cnt)
+{
+	LOG("count_between for key1=" << std::string(key1.data(), key1.size())
+				       << ", key2="
+				       << std::string(key2.data(), key2.size()));
+	cnt = 0;
+	if (key1.compare(key2) < 0) {
+		epoch_guard guard(*this);
+		cnt = count_range(first_not_less(key1, false),
+				  [&](node *n) { return n->key().compare(key2) >= 0; });
+	}
+
+	return status::OK;
+}
+
+status vskiplist::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	epoch_guard guard(*this);
+	return get_range(next_live(head), [](node *) { return false; }, callback, arg);
+}
+
+status vskiplist::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	return get_range(first_not_less(key, false), [](node *) { return false; },
+			 callback, arg);
+}
+
+status vskiplist::get_equal_above(string_view key, get_kv_callback *callback,
+				  void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	return get_range(first_not_less(key, true), [](node *) { return false; },
+			 callback, arg);
+}
+
+status vskiplist::get_equal_below(string_view key, get_kv_callback *callback,
+				  void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	return get_range(next_live(head),
+			 [&](node *n) { return n->key().compare(key) > 0; }, callback,
+			 arg);
+}
+
+status vskiplist::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	return get_range(next_live(head),
+			 [&](node *n) { return n->key().compare(key) >= 0; }, callback,
+			 arg);
+}
+
+status vskiplist::get_between(string_view key1, string_view key2,
+			      get_kv_callback *callback, void *arg)
+{
+	LOG("get_between for key1=" << std::string(key1.data(), key1.size()) << ", key2="
+				     << std::string(key2.data(), key2.size()));
+	if (key1.compare(key2) < 0) {
+		epoch_guard guard(*this);
+		return get_range(first_not_less(key1, false),
+				 [&](node *n) { return n->key().compare(key2) >= 0; },
+				 callback, arg);
+	}
+
+	return status::OK;
+}
+
+/*
+ * The node and its value may be freed as soon as the calling operation is
+ * done, so the record is copied into buffers of the calling thread, which are
+ * valid until its next call.
+ */
+std::pair<string_view, string_view> vskiplist::record_of(node *n)
+{
+	static thread_local std::string key_buffer;
+	static thread_local std::string value_buffer;
+	if (!n)
+		return std::make_pair("", "");
+
+	auto value = n->value.load();
+	key_buffer.assign(n->key().data(), n->key().size());
+	value_buffer.assign(value->data(), value->size);
+	return std::make_pair(string_view(key_buffer.data(), key_buffer.size()),
+			      string_view(value_buffer.data(), value_buffer.size()));
+}
+
+std::pair<string_view, string_view> vskiplist::upper_bound(string_view key)
+{
+	LOG("upper_bound");
+	epoch_guard guard(*this);
+	return record_of(first_not_less(key, false));
+}
+
+std::pair<string_view, string_view> vskiplist::lower_bound(string_view key)
+{
+	LOG("lower_bound");
+	epoch_guard guard(*this);
+	return record_of(first_not_less(key, true));
+}
+
+status vskiplist::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	node *n = first_not_less(key, true);
+	return (n && n->key().compare(key) == 0) ? status::OK : status::NOT_FOUND;
+}
+
+status vskiplist::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	epoch_guard guard(*this);
+	node *n = first_not_less(key, true);
+	if (!n || n->key().compare(key) != 0) {
+		LOG("  key not found");
+		return status::NOT_FOUND;
+	}
+
+	auto value = n->value.load();
+	callback(value->data(), value->size, arg);
+	return status::OK;
+}
+
+status vskiplist::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	{
+		epoch_guard guard(*this);
+		node *preds[MAX_HEIGHT];
+		node *succs[MAX_HEIGHT];
+		value_entry *v = new_value(value);
+		node *n = nullptr;
+
+		for (;;) {
+			while (!find(key, preds, succs)) {
+				if (!n) {
+					try {
+						n = new_node(key,
+							     random_height(MAX_HEIGHT));
+					} catch (...) {
+						free_value(v);
+						throw;
+					}
+				}
+
+				for (uint32_t i = 0; i < n->height; i++)
+					n->next()[i].store(
+						reinterpret_cast<uintptr_t>(succs[i]));
+				n->value.store(v);
+
+				auto expected = reinterpret_cast<uintptr_t>(succs[0]);
+				if (preds[0]->next()[0].compare_exchange_strong(
+					    expected, reinterpret_cast<uintptr_t>(n))) {
+					size.fetch_add(1);
+					link_tower(n, preds, succs);
+					return status::OK;
+				}
+			}
+
+			retire(succs[0]->value.exchange(v));
+
+			/*
+			 * A concurrent remove may have unlinked the node before the
+			 * value was stored in it. The value is then freed with the
+			 * node and the record is inserted again.
+			 */
+			if (!marked(succs[0]->next()[0].load()))
+				break;
+
+			try {
+				v = new_value(value);
+			} catch (...) {
+				if (n) {
+					n->value.store(nullptr);
+					free_node(n);
+				}
+				throw;
+			}
+		}
+
+		/* the key exists, n (if any) was never published */
+		if (n) {
+			n->value.store(nullptr);
+			free_node(n);
+		}
+	}
+
+	if (retired_count.load() > RECLAIM_THRESHOLD)
+		try_reclaim();
+
+	return status::OK;
+}
+
+status vskiplist::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	bool removed = false;
+	{
+		epoch_guard guard(*this);
+		node *preds[MAX_HEIGHT];
+		node *succs[MAX_HEIGHT];
+
+		if (find(key, preds, succs)) {
+			node *n = succs[0];
+			for (uint32_t level = n->height - 1; level > 0; level--)
+				mark(n->next()[level]);
+
+			/* marking the lowest level removes the key */
+			auto next = n->next()[0].load();
+			while (!marked(next) && !removed)
+				removed = n->next()[0].compare_exchange_weak(next,
+									     next | 1);
+
+			if (removed) {
+				size.fetch_sub(1);
+				find(key, preds, succs);
+				if (n->first_done.exchange(true))
+					retire(n);
+			}
+		}
+	}
+
+	if (retired_count.load() > RECLAIM_THRESHOLD)
+		try_reclaim();
+
+	return removed ? status::OK : status::NOT_FOUND;
+}
+
+} // namespace kv
+} // namespace pmem
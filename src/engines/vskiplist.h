@@ -0,0 +1,207 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "../engine.h"
+#include "pmem_allocator.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#ifdef USE_LIBMEMKIND_NAMESPACE
+namespace memkind_ns = libmemkind::pmem;
+#else
+namespace memkind_ns = pmem;
+#endif
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace vskiplist
+{
+
+/* header of memory blocks which are freed only once no thread can read them */
+struct reclaimable {
+	reclaimable *next_retired;
+	bool is_node;
+};
+
+/* value of a record; replaced as a whole on every update of the record */
+struct value_entry : reclaimable {
+	std::size_t size;
+
+	const char *data() const
+	{
+		return reinterpret_cast<const char *>(this + 1);
+	}
+};
+
+/*
+ * Skiplist node. The node is followed in memory by its 'height' next pointers
+ * and then by the key. The lowest bit of a next pointer marks the node as
+ * removed on that level.
+ */
+struct node : reclaimable {
+	std::atomic<value_entry *> value;
+	/* set by the first of the inserting and removing threads which is done */
+	std::atomic<bool> first_done;
+	uint32_t height;
+	std::size_t key_size;
+
+	std::atomic<uintptr_t> *next()
+	{
+		return reinterpret_cast<std::atomic<uintptr_t> *>(this + 1);
+	}
+
+	string_view key()
+	{
+		return string_view(reinterpret_cast<const char *>(next() + height),
+				   key_size);
+	}
+};
+
+} /* namespace vskiplist */
+} /* namespace internal */
+
+/*
+ * Lock-free ordered engine. Writers link new nodes level by level with CAS
+ * and remove them by marking their next pointers, readers never block. Memory
+ * of removed nodes and replaced values is reclaimed once all operations that
+ * could still see it are finished (see epoch_guard).
+ */
+class vskiplist : public engine_base {
+public:
+	vskiplist(std::unique_ptr<internal::config> cfg);
+	~vskiplist();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+
+	std::pair<string_view, string_view> upper_bound(string_view key) final;
+	std::pair<string_view, string_view> lower_bound(string_view key) final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+
+	status put(string_view key, string_view value) final;
+
+	status remove(string_view key) final;
+
+private:
+	using node = internal::vskiplist::node;
+	using value_entry = internal::vskiplist::value_entry;
+	using reclaimable = internal::vskiplist::reclaimable;
+
+	static const uint32_t MAX_HEIGHT = 24;
+
+	/*
+	 * Registers an operation in the current phase for its lifetime. Memory
+	 * retired before a phase flip is freed only when no operation is
+	 * registered in the previous phase anymore.
+	 */
+	class epoch_guard {
+	public:
+		epoch_guard(vskiplist &list);
+		~epoch_guard();
+
+		epoch_guard(const epoch_guard &) = delete;
+		epoch_guard &operator=(const epoch_guard &) = delete;
+
+	private:
+		vskiplist &list;
+		unsigned phase;
+	};
+
+	node *new_node(string_view key, uint32_t height);
+	value_entry *new_value(string_view value);
+	void free_node(node *n);
+	void free_value(value_entry *v);
+	void free_list(reclaimable *r);
+
+	void retire(reclaimable *r);
+	void try_reclaim();
+
+	bool find(string_view key, node **preds, node **succs);
+	bool link_level(node *n, uint32_t level, node **preds, node **succs);
+	void link_tower(node *n, node **preds, node **succs);
+	node *first_not_less(string_view key, bool inclusive);
+	node *next_live(node *n);
+	static std::pair<string_view, string_view> record_of(node *n);
+
+	template <typename End>
+	std::size_t count_range(node *first, End end);
+	template <typename End>
+	status get_range(node *first, End end, get_kv_callback *callback, void *arg);
+
+	memkind_ns::allocator<char> ch_allocator;
+
+	/* sentinel of MAX_HEIGHT, its key is never compared */
+	node *head;
+	std::atomic<std::size_t> size;
+
+	std::atomic<unsigned> phase;
+	std::atomic<std::size_t> active[2];
+
+	std::atomic<reclaimable *> retired;
+	std::atomic<std::size_t> retired_count;
+
+	/* guards pending and pending_phase */
+	std::mutex reclaim_mtx;
+	reclaimable *pending;
+	unsigned pending_phase;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
@@ -34,7 +34,12 @@
 #include "../out.h"
 #include <libpmemobj++/transaction.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace pmem
 {
@@ -61,9 +66,49 @@ static uint64_t get_size(internal::config &cfg)
 	return size;
 }
 
+static uint64_t get_shards(internal::config &cfg)
+{
+	std::size_t shards;
+	if (!cfg.get_uint64("shards", &shards))
+		return 1;
+
+	if (shards == 0)
+		throw internal::invalid_argument("Config item \"shards\" cannot be 0");
+
+	return shards;
+}
+
+/* mixes the key 8 bytes at a time, only used to pick a shard */
+static uint64_t shard_hash(string_view key)
+{
+	const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+	const char *p = key.data();
+	size_t size = key.size();
+	uint64_t h = size;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		h = (h ^ word) * multiplier;
+		h ^= h >> 29;
+	}
+	if (size > 0) {
+		uint64_t word = 0;
+		memcpy(&word, p, size);
+		h = (h ^ word) * multiplier;
+	}
+
+	return h ^ (h >> 32);
+}
+
 vsmap::vsmap(std::unique_ptr<internal::config> cfg)
-    : kv_allocator(get_path(*cfg), get_size(*cfg)), pmem_kv_container(kv_allocator)
+    : kv_allocator(get_path(*cfg), get_size(*cfg))
 {
+	auto shards_number = get_shards(*cfg);
+	shards.reserve(shards_number);
+	for (uint64_t i = 0; i < shards_number; i++)
+		shards.emplace_back(new shard(kv_allocator));
+
 	LOG("Started ok");
 }
 
@@ -77,9 +122,125 @@ std::string vsmap::name()
 	return "vsmap";
 }
 
+vsmap::shared_lock_all::shared_lock_all(std::vector<std::unique_ptr<shard>> &shards)
+    : shards(shards)
+{
+	for (auto &s : shards)
+		s->mtx.lock_shared();
+}
+
+vsmap::shared_lock_all::~shared_lock_all()
+{
+	for (auto &s : shards)
+		s->mtx.unlock_shared();
+}
+
+vsmap::shard &vsmap::shard_for(string_view key)
+{
+	if (shards.size() == 1)
+		return *shards[0];
+
+	return *shards[shard_hash(key) % shards.size()];
+}
+
+/*
+ * Counts elements in ranges returned by range() for every shard.
+ */
+template <typename Range>
+std::size_t vsmap::count_range(Range range)
+{
+	shared_lock_all lock(shards);
+	std::size_t result = 0;
+	for (auto &s : shards) {
+		auto r = range(s->container);
+		result += static_cast<std::size_t>(std::distance(r.first, r.second));
+	}
+
+	return result;
+}
+
+/* number of elements copied out of the shards between callbacks */
+static const std::size_t RANGE_BATCH = 64;
+
+/*
+ * Calls callback for elements in ranges returned by range() for every shard,
+ * in the order of keys.
+ *
+ * Elements are copied out in batches and callbacks are called with no shard
+ * locked, so they can access the database. Every batch locks all shards again
+ * and continues after the last key of the previous one.
+ */
+template <typename Range>
+status vsmap::get_range(Range range, get_kv_callback *callback, void *arg)
+{
+	typedef std::pair<map_type::iterator, map_type::iterator> range_type;
+
+	std::vector<std::pair<std::string, std::string>> batch;
+	batch.reserve(RANGE_BATCH);
+	key_type last(kv_allocator);
+	bool more = true;
+	while (more) {
+		{
+			shared_lock_all lock(shards);
+			std::vector<range_type> ranges;
+			ranges.reserve(shards.size());
+			for (auto &s : shards) {
+				auto r = range(s->container);
+				/* skips elements visited in previous batches */
+				if (!batch.empty() && r.first != r.second &&
+				    !(last < r.first->first)) {
+					if (r.second != s->container.end() &&
+					    !(last < r.second->first))
+						r.first = r.second;
+					else
+						r.first = s->container.upper_bound(last);
+				}
+				if (r.first != r.second)
+					ranges.push_back(r);
+			}
+
+			/* min-heap of ranges, ordered by their first keys */
+			auto greater = [](const range_type &lhs, const range_type &rhs) {
+				return rhs.first->first < lhs.first->first;
+			};
+			std::make_heap(ranges.begin(), ranges.end(), greater);
+			batch.clear();
+			while (!ranges.empty() && batch.size() < RANGE_BATCH) {
+				std::pop_heap(ranges.begin(), ranges.end(), greater);
+				auto &it = ranges.back().first;
+				auto &k = it->first;
+				auto &v = it->second;
+				batch.emplace_back(std::string(k.c_str(), k.size()),
+						   std::string(v.c_str(), v.size()));
+
+				if (++it == ranges.back().second)
+					ranges.pop_back();
+				else
+					std::push_heap(ranges.begin(), ranges.end(),
+						       greater);
+			}
+
+			more = !ranges.empty();
+			if (more)
+				last.assign(batch.back().first.c_str(),
+					    batch.back().first.size());
+		}
+
+		for (auto &e : batch) {
+			auto ret = callback(e.first.c_str(), e.first.size(),
+					    e.second.c_str(), e.second.size(), arg);
+
+			if (ret != 0)
+				return status::STOPPED_BY_CB;
+		}
+	}
+
+	return status::OK;
+}
+
 status vsmap::count_all(std::size_t &cnt)
 {
-	cnt = pmem_kv_container.size();
+	cnt = count_range([](map_type &m) { return std::make_pair(m.begin(), m.end()); });
 
 	return status::OK;
 }
@@ -87,15 +248,10 @@ status vsmap::count_all(std::size_t &cnt)
 status vsmap::count_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_above for key=" << std::string(key.data(), key.size()));
-	std::size_t result = 0;
 	// XXX - do not create temporary string
-	auto it = pmem_kv_container.upper_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	auto end = pmem_kv_container.end();
-	for (; it != end; it++)
-		result++;
-
-	cnt = result;
+	key_type k(key.data(), key.size(), kv_allocator);
+	cnt = count_range(
+		[&](map_type &m) { return std::make_pair(m.upper_bound(k), m.end()); });
 
 	return status::OK;
 }
@@ -103,15 +259,10 @@ status vsmap::count_above(string_view key, std::size_t &cnt)
 status vsmap::count_equal_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
-	std::size_t result = 0;
 	// XXX - do not create temporary string
-	auto it = pmem_kv_container.lower_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	auto end = pmem_kv_container.end();
-	for (; it != end; it++)
-		result++;
-
-	cnt = result;
+	key_type k(key.data(), key.size(), kv_allocator);
+	cnt = count_range(
+		[&](map_type &m) { return std::make_pair(m.lower_bound(k), m.end()); });
 
 	return status::OK;
 }
@@ -119,15 +270,10 @@ status vsmap::count_equal_above(string_view key, std::size_t &cnt)
 status vsmap::count_equal_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
-	std::size_t result = 0;
-	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
-	auto end = pmem_kv_container.upper_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	for (; it != end; it++)
-		result++;
-
-	cnt = result;
+	key_type k(key.data(), key.size(), kv_allocator);
+	cnt = count_range(
+		[&](map_type &m) { return std::make_pair(m.begin(), m.upper_bound(k)); });
 
 	return status::OK;
 }
@@ -135,15 +281,10 @@ status vsmap::count_equal_below(string_view key, std::size_t &cnt)
 status vsmap::count_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_below for key=" << std::string(key.data(), key.size()));
-	std::size_t result = 0;
-	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
-	auto end = pmem_kv_container.lower_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	for (; it != end; it++)
-		result++;
-
-	cnt = result;
+	key_type k(key.data(), key.size(), kv_allocator);
+	cnt = count_range(
+		[&](map_type &m) { return std::make_pair(m.begin(), m.lower_bound(k)); });
 
 	return status::OK;
 }
@@ -151,106 +292,98 @@ status vsmap::count_below(string_view key, std::size_t &cnt)
 status vsmap::count_between(string_view key1, string_view key2, std::size_t &cnt)
 {
 	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
-	std::size_t result = 0;
+	cnt = 0;
 	if (key1.compare(key2) < 0) {
 		// XXX - do not create temporary string
-		auto it = pmem_kv_container.upper_bound(
-			key_type(key1.data(), key1.size(), kv_allocator));
-		auto end = pmem_kv_container.lower_bound(
-			key_type(key2.data(), key2.size(), kv_allocator));
-		for (; it != end; it++)
-			result++;
+		key_type k1(key1.data(), key1.size(), kv_allocator);
+		key_type k2(key2.data(), key2.size(), kv_allocator);
+		cnt = count_range([&](map_type &m) {
+			return std::make_pair(m.upper_bound(k1), m.lower_bound(k2));
+		});
 	}
 
-	cnt = result;
-
 	return status::OK;
 }
 
-status vsmap::get_all(get_kv_callback *callback, void *arg)
+/*
+ * Sets 'successor' to the lowest key greater than all keys starting with the
+ * prefix. Returns false if there is no such key (the prefix is empty or
+ * consists of 0xff bytes only).
+ */
+static bool prefix_successor(string_view prefix, std::string &successor)
 {
-	LOG("get_all");
-	for (auto &it : pmem_kv_container) {
-		auto ret = callback(it.first.c_str(), it.first.size(), it.second.c_str(),
-				    it.second.size(), arg);
+	successor.assign(prefix.data(), prefix.size());
+	while (!successor.empty() && static_cast<unsigned char>(successor.back()) == 0xff)
+		successor.pop_back();
+	if (successor.empty())
+		return false;
+
+	successor.back() =
+		static_cast<char>(static_cast<unsigned char>(successor.back()) + 1);
+	return true;
+}
 
-		if (ret != 0)
-			return status::STOPPED_BY_CB;
-	}
+status vsmap::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	LOG("count_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	std::string successor;
+	bool bounded = prefix_successor(prefix, successor);
+	// XXX - do not create temporary string
+	key_type k1(prefix.data(), prefix.size(), kv_allocator);
+	key_type k2(successor.data(), successor.size(), kv_allocator);
+	cnt = count_range([&](map_type &m) {
+		return std::make_pair(m.lower_bound(k1),
+				      bounded ? m.lower_bound(k2) : m.end());
+	});
 
 	return status::OK;
 }
 
+status vsmap::get_all(get_kv_callback *callback, void *arg)
+{
+	LOG("get_all");
+	return get_range([](map_type &m) { return std::make_pair(m.begin(), m.end()); },
+			 callback, arg);
+}
+
 status vsmap::get_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_above for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
-	auto it = pmem_kv_container.upper_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	auto end = pmem_kv_container.end();
-	for (; it != end; it++) {
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.c_str(), it->second.size(), arg);
-
-		if (ret != 0)
-			return status::STOPPED_BY_CB;
-	}
-
-	return status::OK;
+	key_type k(key.data(), key.size(), kv_allocator);
+	return get_range(
+		[&](map_type &m) { return std::make_pair(m.upper_bound(k), m.end()); },
+		callback, arg);
 }
 
 status vsmap::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
-	auto it = pmem_kv_container.lower_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	auto end = pmem_kv_container.end();
-	for (; it != end; it++) {
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.c_str(), it->second.size(), arg);
-
-		if (ret != 0)
-			return status::STOPPED_BY_CB;
-	}
-
-	return status::OK;
+	key_type k(key.data(), key.size(), kv_allocator);
+	return get_range(
+		[&](map_type &m) { return std::make_pair(m.lower_bound(k), m.end()); },
+		callback, arg);
 }
 
 status vsmap::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
 {
-	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
-	auto it = pmem_kv_container.begin();
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
 	// XXX - do not create temporary string
-	auto end = pmem_kv_container.upper_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	for (; it != end; it++) {
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.c_str(), it->second.size(), arg);
-
-		if (ret != 0)
-			return status::STOPPED_BY_CB;
-	}
-
-	return status::OK;
+	key_type k(key.data(), key.size(), kv_allocator);
+	return get_range(
+		[&](map_type &m) { return std::make_pair(m.begin(), m.upper_bound(k)); },
+		callback, arg);
 }
 
 status vsmap::get_below(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_below for key=" << std::string(key.data(), key.size()));
-	auto it = pmem_kv_container.begin();
 	// XXX - do not create temporary string
-	auto end = pmem_kv_container.lower_bound(
-		key_type(key.data(), key.size(), kv_allocator));
-	for (; it != end; it++) {
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.c_str(), it->second.size(), arg);
-
-		if (ret != 0)
-			return status::STOPPED_BY_CB;
-	}
-
-	return status::OK;
+	key_type k(key.data(), key.size(), kv_allocator);
+	return get_range(
+		[&](map_type &m) { return std::make_pair(m.begin(), m.lower_bound(k)); },
+		callback, arg);
 }
 
 status vsmap::get_between(string_view key1, string_view key2, get_kv_callback *callback,
@@ -259,38 +392,54 @@ status vsmap::get_between(string_view key1, string_view key2, get_kv_callback *c
 	LOG("get_between for key1=" << key1.data() << ", key2=" << key2.data());
 	if (key1.compare(key2) < 0) {
 		// XXX - do not create temporary string
-		auto it = pmem_kv_container.upper_bound(
-			key_type(key1.data(), key1.size(), kv_allocator));
-		auto end = pmem_kv_container.lower_bound(
-			key_type(key2.data(), key2.size(), kv_allocator));
-		for (; it != end; it++) {
-			auto ret = callback(it->first.c_str(), it->first.size(),
-					    it->second.c_str(), it->second.size(), arg);
-
-			if (ret != 0)
-				return status::STOPPED_BY_CB;
-		}
+		key_type k1(key1.data(), key1.size(), kv_allocator);
+		key_type k2(key2.data(), key2.size(), kv_allocator);
+		return get_range(
+			[&](map_type &m) {
+				return std::make_pair(m.upper_bound(k1),
+						      m.lower_bound(k2));
+			},
+			callback, arg);
 	}
 
 	return status::OK;
 }
 
+status vsmap::get_prefix(string_view prefix, get_kv_callback *callback, void *arg)
+{
+	LOG("get_prefix for prefix=" << std::string(prefix.data(), prefix.size()));
+	std::string successor;
+	bool bounded = prefix_successor(prefix, successor);
+	// XXX - do not create temporary string
+	key_type k1(prefix.data(), prefix.size(), kv_allocator);
+	key_type k2(successor.data(), successor.size(), kv_allocator);
+	return get_range(
+		[&](map_type &m) {
+			return std::make_pair(m.lower_bound(k1),
+					      bounded ? m.lower_bound(k2) : m.end());
+		},
+		callback, arg);
+}
+
 status vsmap::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
+	auto &s = shard_for(key);
+	internal::vsmap::shared_lock lock(s.mtx);
 	// XXX - do not create temporary string
-	bool r = pmem_kv_container.find(key_type(key.data(), key.size(), kv_allocator)) !=
-		pmem_kv_container.end();
+	bool r = s.container.find(key_type(key.data(), key.size(), kv_allocator)) !=
+		s.container.end();
 	return (r ? status::OK : status::NOT_FOUND);
 }
 
 status vsmap::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
+	auto &s = shard_for(key);
+	internal::vsmap::shared_lock lock(s.mtx);
 	// XXX - do not create temporary string
-	const auto pos =
-		pmem_kv_container.find(key_type(key.data(), key.size(), kv_allocator));
-	if (pos == pmem_kv_container.end()) {
+	const auto pos = s.container.find(key_type(key.data(), key.size(), kv_allocator));
+	if (pos == s.container.end()) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
 	}
@@ -303,21 +452,44 @@ status vsmap::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
+	auto &s = shard_for(key);
 	// XXX - do not create temporary string
-	pmem_kv_container[key_type(key.data(), key.size(), kv_allocator)] =
-		mapped_type(value.data(), value.size(), kv_allocator);
+	key_type k(key.data(), key.size(), kv_allocator);
+	mapped_type v(value.data(), value.size(), kv_allocator);
+	std::lock_guard<internal::vsmap::shared_mutex> lock(s.mtx);
+	s.container[std::move(k)] = std::move(v);
 	return status::OK;
 }
 
 status vsmap::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
-
+	auto &s = shard_for(key);
 	// XXX - do not create temporary string
-	size_t erased =
-		pmem_kv_container.erase(key_type(key.data(), key.size(), kv_allocator));
+	key_type k(key.data(), key.size(), kv_allocator);
+	std::lock_guard<internal::vsmap::shared_mutex> lock(s.mtx);
+	size_t erased = s.container.erase(k);
 	return (erased == 1) ? status::OK : status::NOT_FOUND;
 }
 
+/* shards are locked one at a time, each erases its part of the range at once */
+status vsmap::remove_range(string_view key1, string_view key2)
+{
+	LOG("remove_range for key1=" << key1.data() << ", key2=" << key2.data());
+	if (key1.compare(key2) >= 0)
+		return status::OK;
+
+	// XXX - do not create temporary string
+	key_type k1(key1.data(), key1.size(), kv_allocator);
+	key_type k2(key2.data(), key2.size(), kv_allocator);
+	for (auto &s : shards) {
+		std::lock_guard<internal::vsmap::shared_mutex> lock(s->mtx);
+		s->container.erase(s->container.lower_bound(k1),
+				   s->container.lower_bound(k2));
+	}
+
+	return status::OK;
+}
+
 } // namespace kv
 } // namespace pmem
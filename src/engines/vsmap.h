@@ -35,8 +35,11 @@
 #include "../engine.h"
 #include "pmem_allocator.h"
 #include <map>
+#include <memory>
+#include <pthread.h>
 #include <scoped_allocator>
 #include <string>
+#include <vector>
 
 #ifdef USE_LIBMEMKIND_NAMESPACE
 namespace memkind_ns = libmemkind::pmem;
@@ -48,6 +51,75 @@ namespace pmem
 {
 namespace kv
 {
+namespace internal
+{
+namespace vsmap
+{
+
+/*
+ * Reader-writer lock, usable with std::lock_guard (exclusive mode) and
+ * shared_lock (shared mode). std::shared_mutex requires C++17.
+ */
+class shared_mutex {
+public:
+	shared_mutex()
+	{
+		pthread_rwlock_init(&rwlock, nullptr);
+	}
+
+	~shared_mutex()
+	{
+		pthread_rwlock_destroy(&rwlock);
+	}
+
+	shared_mutex(const shared_mutex &) = delete;
+	shared_mutex &operator=(const shared_mutex &) = delete;
+
+	void lock()
+	{
+		pthread_rwlock_wrlock(&rwlock);
+	}
+
+	void unlock()
+	{
+		pthread_rwlock_unlock(&rwlock);
+	}
+
+	void lock_shared()
+	{
+		pthread_rwlock_rdlock(&rwlock);
+	}
+
+	void unlock_shared()
+	{
+		pthread_rwlock_unlock(&rwlock);
+	}
+
+private:
+	pthread_rwlock_t rwlock;
+};
+
+class shared_lock {
+public:
+	explicit shared_lock(shared_mutex &m) : mtx(m)
+	{
+		mtx.lock_shared();
+	}
+
+	~shared_lock()
+	{
+		mtx.unlock_shared();
+	}
+
+	shared_lock(const shared_lock &) = delete;
+	shared_lock &operator=(const shared_lock &) = delete;
+
+private:
+	shared_mutex &mtx;
+};
+
+} /* namespace vsmap */
+} /* namespace internal */
 
 class vsmap : public engine_base {
 public:
@@ -62,6 +134,7 @@ public:
 	status count_equal_below(string_view key, std::size_t &cnt) final;
 	status count_below(string_view key, std::size_t &cnt) final;
 	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
 	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
@@ -72,6 +145,7 @@ public:
 	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
 	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
 			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
 
 	status exists(string_view key) final;
 
@@ -80,6 +154,7 @@ public:
 	status put(string_view key, string_view value) final;
 
 	status remove(string_view key) final;
+	status remove_range(string_view key1, string_view key2) final;
 
 private:
 	using storage_type = std::basic_string<char, std::char_traits<char>,
@@ -92,8 +167,39 @@ private:
 	using map_type = std::map<key_type, mapped_type, std::less<key_type>,
 				  std::scoped_allocator_adaptor<map_allocator_type>>;
 
+	/*
+	 * Keys are spread among shards by their hash. Each shard is guarded by its
+	 * own lock, so point operations on different shards do not contend. Range
+	 * operations lock all shards in shared mode and merge their ordered ranges.
+	 */
+	struct shard {
+		shard(const map_allocator_type &alloc) : container(alloc)
+		{
+		}
+
+		internal::vsmap::shared_mutex mtx;
+		map_type container;
+	};
+
+	/* holds locks of all shards in shared mode */
+	class shared_lock_all {
+	public:
+		shared_lock_all(std::vector<std::unique_ptr<shard>> &shards);
+		~shared_lock_all();
+
+	private:
+		std::vector<std::unique_ptr<shard>> &shards;
+	};
+
+	shard &shard_for(string_view key);
+
+	template <typename Range>
+	std::size_t count_range(Range range);
+	template <typename Range>
+	status get_range(Range range, get_kv_callback *callback, void *arg);
+
 	map_allocator_type kv_allocator;
-	map_type pmem_kv_container;
+	std::vector<std::unique_ptr<shard>> shards;
 };
 
 } /* namespace kv */
@@ -0,0 +1,365 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "export.h"
+#include "engine.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+static const char MAGIC[8] = {'P', 'M', 'E', 'M', 'K', 'V', 'X', '1'};
+
+/* a multiple of the block size, so that full buffers can be written with O_DIRECT */
+static const size_t BUFFER_SIZE = 1 << 20;
+static const size_t BUFFER_ALIGNMENT = 4096;
+
+/* records of a worker are passed to the shared writer in batches of this size */
+static const size_t BATCH_SIZE = 64 * 1024;
+
+static char *allocate_buffer()
+{
+	void *buffer;
+	if (posix_memalign(&buffer, BUFFER_ALIGNMENT, BUFFER_SIZE) != 0)
+		throw std::bad_alloc();
+
+	return static_cast<char *>(buffer);
+}
+
+static void append_varint(std::string &out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<char>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+class stream_writer {
+public:
+	explicit stream_writer(int fd) : fd(fd), buffer(allocate_buffer())
+	{
+	}
+
+	~stream_writer()
+	{
+		free(buffer);
+	}
+
+	stream_writer(const stream_writer &) = delete;
+	stream_writer &operator=(const stream_writer &) = delete;
+
+	void append(const char *data, size_t size)
+	{
+		while (size > 0) {
+			size_t n = std::min(size, BUFFER_SIZE - used);
+			memcpy(buffer + used, data, n);
+			used += n;
+			data += n;
+			size -= n;
+			if (used == BUFFER_SIZE) {
+				write_buffer();
+			}
+		}
+	}
+
+	/* the last buffer is not aligned, so O_DIRECT is turned off to write it */
+	void finish()
+	{
+		int flags = fcntl(fd, F_GETFL);
+#ifdef O_DIRECT
+		bool direct = flags != -1 && (flags & O_DIRECT) != 0;
+		if (direct && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == -1)
+			fail();
+#endif
+		write_buffer();
+#ifdef O_DIRECT
+		if (direct)
+			fcntl(fd, F_SETFL, flags);
+#endif
+	}
+
+private:
+	void write_buffer()
+	{
+		size_t written = 0;
+		while (written < used) {
+			ssize_t ret = write(fd, buffer + written, used - written);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				fail();
+			written += static_cast<size_t>(ret);
+		}
+		used = 0;
+	}
+
+	static void fail()
+	{
+		throw error(std::string("Cannot write records: ") + strerror(errno));
+	}
+
+	int fd;
+	char *buffer;
+	size_t used = 0;
+};
+
+class stream_reader {
+public:
+	explicit stream_reader(int fd) : fd(fd), buffer(allocate_buffer())
+	{
+	}
+
+	~stream_reader()
+	{
+		free(buffer);
+	}
+
+	stream_reader(const stream_reader &) = delete;
+	stream_reader &operator=(const stream_reader &) = delete;
+
+	void read(char *data, size_t size)
+	{
+		while (size > 0) {
+			if (pos == end)
+				fill();
+			size_t n = std::min(size, end - pos);
+			memcpy(data, buffer + pos, n);
+			pos += n;
+			data += n;
+			size -= n;
+		}
+	}
+
+	uint64_t read_varint()
+	{
+		uint64_t value = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			if (pos == end)
+				fill();
+			uint8_t byte = static_cast<uint8_t>(buffer[pos++]);
+			value |= uint64_t(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+
+		throw invalid_argument("Records to import are corrupted");
+	}
+
+	void read_string(std::string &s, size_t size)
+	{
+		s.resize(size);
+		if (size > 0)
+			read(&s[0], size);
+	}
+
+private:
+	void fill()
+	{
+		ssize_t ret;
+		do
+			ret = ::read(fd, buffer, BUFFER_SIZE);
+		while (ret < 0 && errno == EINTR);
+
+		if (ret < 0)
+			throw error(std::string("Cannot read records: ") +
+				    strerror(errno));
+		if (ret == 0)
+			throw invalid_argument("Records to import are truncated");
+
+		pos = 0;
+		end = static_cast<size_t>(ret);
+	}
+
+	int fd;
+	char *buffer;
+	size_t pos = 0;
+	size_t end = 0;
+};
+
+struct export_context {
+	struct batch {
+		std::string data;
+		uint64_t count = 0;
+	};
+
+	export_context(int fd, size_t nthreads) : writer(fd), batches(nthreads)
+	{
+	}
+
+	void flush(batch &b)
+	{
+		std::lock_guard<std::mutex> guard(mtx);
+		writer.append(b.data.data(), b.data.size());
+		b.data.clear();
+	}
+
+	stream_writer writer;
+	std::mutex mtx;
+	std::vector<batch> batches;
+};
+
+struct import_context {
+	explicit import_context(int fd) : reader(fd)
+	{
+	}
+
+	/* reads the next record into key and value, returns false at the end */
+	bool next()
+	{
+		if (ended)
+			return false;
+
+		uint64_t kb = reader.read_varint();
+		if (kb == 0) {
+			if (reader.read_varint() != count)
+				throw invalid_argument("Records to import are corrupted");
+			ended = true;
+			return false;
+		}
+
+		uint64_t vb = reader.read_varint();
+		reader.read_string(key, kb - 1);
+		reader.read_string(value, vb);
+		count++;
+		return true;
+	}
+
+	stream_reader reader;
+	std::string key, value, previous;
+	uint64_t count = 0;
+	bool ended = false;
+	/* set if the current record is out of order and has not been loaded yet */
+	bool pending = false;
+};
+
+static int export_record(size_t worker, const char *k, size_t kb, const char *v,
+			 size_t vb, void *arg)
+{
+	auto c = static_cast<export_context *>(arg);
+	auto &b = c->batches[worker];
+	append_varint(b.data, kb + 1);
+	append_varint(b.data, vb);
+	b.data.append(k, kb);
+	b.data.append(v, vb);
+	b.count++;
+	if (b.data.size() >= BATCH_SIZE)
+		c->flush(b);
+
+	return 0;
+}
+
+/* passes records to bulk load as long as they are in order of keys */
+static int import_record(const char **k, size_t *kb, const char **v, size_t *vb,
+			 void *arg)
+{
+	auto c = static_cast<import_context *>(arg);
+	bool first = c->count == 0;
+	c->previous.swap(c->key);
+	if (!c->next())
+		return 1;
+
+	if (!first && c->previous.compare(c->key) >= 0) {
+		c->pending = true;
+		return 1;
+	}
+
+	*k = c->key.data();
+	*kb = c->key.size();
+	*v = c->value.data();
+	*vb = c->value.size();
+	return 0;
+}
+
+status export_records(engine_base &engine, int fd, size_t nthreads)
+{
+	if (nthreads == 0)
+		throw invalid_argument("Number of threads has to be greater than 0");
+
+	export_context ctx(fd, nthreads);
+	ctx.writer.append(MAGIC, sizeof(MAGIC));
+
+	auto s = engine.get_all_parallel(nthreads, export_record, &ctx);
+	if (s != status::OK)
+		return s;
+
+	std::string trailer;
+	uint64_t count = 0;
+	for (auto &b : ctx.batches) {
+		ctx.flush(b);
+		count += b.count;
+	}
+	append_varint(trailer, 0);
+	append_varint(trailer, count);
+	ctx.writer.append(trailer.data(), trailer.size());
+	ctx.writer.finish();
+
+	return status::OK;
+}
+
+status import_records(engine_base &engine, int fd)
+{
+	import_context ctx(fd);
+	char magic[sizeof(MAGIC)];
+	ctx.reader.read(magic, sizeof(magic));
+	if (memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+		throw invalid_argument("Records to import were not written by export");
+
+	auto s = engine.bulk_load(import_record, &ctx);
+	if (s != status::OK || !ctx.pending)
+		return s;
+
+	do
+		s = engine.put(ctx.key, ctx.value);
+	while (s == status::OK && ctx.next());
+
+	return s;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_EXPORT_H
+#define LIBPMEMKV_EXPORT_H
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+
+class engine_base;
+
+namespace internal
+{
+
+/*
+ * Stream of records exported from a database: an 8-byte magic, then for every
+ * record varints of key size + 1 and of value size followed by the key and
+ * the value, terminated by a varint 0 and varint of the number of records.
+ *
+ * Streams are written and read in large buffers, aligned for file descriptors
+ * opened with O_DIRECT.
+ */
+
+/*
+ * Writes all records of the engine to fd, read by nthreads workers of
+ * engine_base::get_all_parallel(). Records are written in order of keys only
+ * by a single worker of an ordered engine.
+ */
+status export_records(engine_base &engine, int fd, size_t nthreads);
+
+/*
+ * Reads records written by export_records() from fd and loads them into
+ * the engine. The records in order of keys are passed to
+ * engine_base::bulk_load(), the ones which follow the first record out of
+ * order are put.
+ */
+status import_records(engine_base &engine, int fd);
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_EXPORT_H */
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_ITERATOR_H
+#define LIBPMEMKV_ITERATOR_H
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Engine-side cursor over an ordered engine. An iterator keeps its position
+ * between calls, so stepping to a neighbouring record does not require a new
+ * lookup. Any modification of the engine invalidates all its iterators.
+ */
+class iterator_base {
+public:
+	virtual ~iterator_base() = default;
+
+	/*
+	 * seek() positions the iterator on the record with exactly the given key,
+	 * seek_lower*() on the greatest key below (or equal to) the given one and
+	 * seek_higher*() on the least key above (or equal to) the given one.
+	 * NOT_FOUND is returned and the iterator is invalidated if there is no
+	 * such record.
+	 */
+	virtual status seek(string_view key) = 0;
+	virtual status seek_lower(string_view key) = 0;
+	virtual status seek_lower_eq(string_view key) = 0;
+	virtual status seek_higher(string_view key) = 0;
+	virtual status seek_higher_eq(string_view key) = 0;
+
+	virtual status seek_to_first() = 0;
+	virtual status seek_to_last() = 0;
+
+	/*
+	 * next() and prev() step to the neighbouring record; NOT_FOUND is returned
+	 * (and the iterator is invalidated) when stepping past either end.
+	 */
+	virtual status is_next() = 0;
+	virtual status next() = 0;
+	virtual status prev() = 0;
+
+	/* both return NOT_FOUND if the iterator is not positioned on a record */
+	virtual status key(string_view &key) = 0;
+	virtual status value(string_view &value) = 0;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_ITERATOR_H */
@@ -30,17 +30,26 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstring>
 #include <memory>
 
 #include <sys/stat.h>
 
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "async_queue.h"
 #include "config.h"
 #include "engine.h"
 #include "exceptions.h"
+#include "export.h"
 #include "libpmemkv.h"
 #include "libpmemkv.hpp"
 #include "libpmemobj++/pexceptions.hpp"
 #include "out.h"
+#include "probes.h"
+#include "stats.h"
+#include "write_behind.h"
 
 #include <iostream>
 #include <memory>
@@ -68,11 +77,119 @@ static inline pmemkv_db *db_from_internal(pmem::kv::engine_base *db)
 	return reinterpret_cast<pmemkv_db *>(db);
 }
 
-template <typename Function>
-static inline int catch_and_return_status(const char *func_name, Function &&f)
+static inline pmem::kv::internal::iterator_base *
+iterator_to_internal(pmemkv_iterator *it)
+{
+	return reinterpret_cast<pmem::kv::internal::iterator_base *>(it);
+}
+
+static inline pmemkv_iterator *
+iterator_from_internal(pmem::kv::internal::iterator_base *it)
+{
+	return reinterpret_cast<pmemkv_iterator *>(it);
+}
+
+static inline pmem::kv::internal::snapshot_base *
+snapshot_to_internal(pmemkv_snapshot *snap)
+{
+	return reinterpret_cast<pmem::kv::internal::snapshot_base *>(snap);
+}
+
+static inline pmemkv_snapshot *
+snapshot_from_internal(pmem::kv::internal::snapshot_base *snap)
+{
+	return reinterpret_cast<pmemkv_snapshot *>(snap);
+}
+
+static inline pmem::kv::internal::write_batch *
+write_batch_to_internal(pmemkv_write_batch *batch)
+{
+	return reinterpret_cast<pmem::kv::internal::write_batch *>(batch);
+}
+
+static inline pmemkv_write_batch *
+write_batch_from_internal(pmem::kv::internal::write_batch *batch)
+{
+	return reinterpret_cast<pmemkv_write_batch *>(batch);
+}
+
+static inline pmem::kv::internal::value_ref *
+value_ref_to_internal(pmemkv_value_ref *ref)
+{
+	return reinterpret_cast<pmem::kv::internal::value_ref *>(ref);
+}
+
+static inline pmemkv_value_ref *
+value_ref_from_internal(pmem::kv::internal::value_ref *ref)
+{
+	return reinterpret_cast<pmemkv_value_ref *>(ref);
+}
+
+/*
+ * Records latency of a database operation, measured from its construction
+ * until it goes out of scope, and fires the entry and return probes of the
+ * operation (see probes.h). The key is only passed to the entry probe.
+ */
+class op_timer : public pmem::kv::internal::stats::timer {
+public:
+	op_timer(pmemkv_db *db, pmem::kv::internal::stats::op o, const char *k = nullptr,
+		 size_t kb = 0)
+	    : timer(db_to_internal(db)->op_stats(), o), db(db), o(o)
+	{
+		switch (o) {
+			case pmem::kv::internal::stats::op::GET:
+				PMEMKV_PROBE3(get__entry, db, k, kb);
+				break;
+			case pmem::kv::internal::stats::op::PUT:
+				PMEMKV_PROBE3(put__entry, db, k, kb);
+				break;
+			case pmem::kv::internal::stats::op::REMOVE:
+				PMEMKV_PROBE3(remove__entry, db, k, kb);
+				break;
+			case pmem::kv::internal::stats::op::RANGE:
+				PMEMKV_PROBE3(range__entry, db, k, kb);
+				break;
+			case pmem::kv::internal::stats::op::WRITE:
+				PMEMKV_PROBE3(write__entry, db, k, kb);
+				break;
+		}
+	}
+
+	~op_timer()
+	{
+		switch (o) {
+			case pmem::kv::internal::stats::op::GET:
+				PMEMKV_PROBE1(get__return, db);
+				break;
+			case pmem::kv::internal::stats::op::PUT:
+				PMEMKV_PROBE1(put__return, db);
+				break;
+			case pmem::kv::internal::stats::op::REMOVE:
+				PMEMKV_PROBE1(remove__return, db);
+				break;
+			case pmem::kv::internal::stats::op::RANGE:
+				PMEMKV_PROBE1(range__return, db);
+				break;
+			case pmem::kv::internal::stats::op::WRITE:
+				PMEMKV_PROBE1(write__return, db);
+				break;
+		}
+	}
+
+private:
+	pmemkv_db *db;
+	pmem::kv::internal::stats::op o;
+};
+
+/*
+ * Maps the exception in flight to a status code and sets the error message. Kept
+ * out of line, so that the hot paths of the API inline only a call to it in their
+ * landing pads.
+ */
+__attribute__((noinline, cold)) static int status_of_exception(const char *func_name)
 {
 	try {
-		return static_cast<int>(f());
+		throw;
 	} catch (pmem::kv::internal::error &e) {
 		out_err_stream(func_name) << e.what();
 		return e.status_code;
@@ -91,6 +208,16 @@ static inline int catch_and_return_status(const char *func_name, Function &&f)
 	}
 }
 
+template <typename Function>
+static inline int catch_and_return_status(const char *func_name, Function &&f)
+{
+	try {
+		return static_cast<int>(f());
+	} catch (...) {
+		return status_of_exception(func_name);
+	}
+}
+
 extern "C" {
 
 pmemkv_config *pmemkv_config_new(void)
@@ -174,6 +301,24 @@ int pmemkv_config_put_string(pmemkv_config *config, const char *key, const char
 	});
 }
 
+int pmemkv_config_put_index_extractor(pmemkv_config *config,
+				      pmemkv_index_extractor *extractor, void *arg)
+{
+	if (!config || !extractor)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	typedef pmem::kv::internal::index_extractor index_extractor;
+
+	return catch_and_return_status(__func__, [&] {
+		std::unique_ptr<index_extractor> e(new index_extractor{extractor, arg});
+		config_to_internal(config)->put_object(
+			"index_extractor", e.get(),
+			[](void *e) { delete static_cast<index_extractor *>(e); });
+		e.release();
+		return PMEMKV_STATUS_OK;
+	});
+}
+
 int pmemkv_config_get_data(pmemkv_config *config, const char *key, const void **value,
 			   size_t *value_size)
 {
@@ -244,8 +389,34 @@ int pmemkv_open(const char *engine_c_str, pmemkv_config *config, pmemkv_db **db)
 		std::unique_ptr<pmem::kv::internal::config> cfg(
 			config_to_internal(config));
 
+		uint64_t async_threads = 1;
+		if (cfg && cfg->get_uint64("async_threads", &async_threads) &&
+		    async_threads == 0)
+			throw pmem::kv::internal::invalid_argument(
+				"Config item \"async_threads\" has to be greater than 0");
+
+		const char *durability = "strict";
+		uint64_t flush_interval_ms =
+			pmem::kv::internal::write_behind::DEFAULT_FLUSH_INTERVAL_MS;
+		uint64_t max_buffered_bytes =
+			pmem::kv::internal::write_behind::DEFAULT_MAX_BYTES;
+		if (cfg) {
+			cfg->get_string("durability", &durability);
+			cfg->get_uint64("flush_interval_ms", &flush_interval_ms);
+			cfg->get_uint64("max_buffered_bytes", &max_buffered_bytes);
+		}
+		bool relaxed = strcmp(durability, "relaxed") == 0;
+		if (!relaxed && strcmp(durability, "strict") != 0)
+			throw pmem::kv::internal::invalid_argument(
+				"Config item \"durability\" has to be \"strict\" or \"relaxed\"");
+
 		auto engine = pmem::kv::engine_base::create_engine(engine_c_str,
 								   std::move(cfg));
+		if (relaxed)
+			engine.reset(new pmem::kv::internal::write_behind(
+				std::move(engine), flush_interval_ms,
+				max_buffered_bytes));
+		engine->set_async_threads(static_cast<size_t>(async_threads));
 
 		*db = db_from_internal(engine.release());
 
@@ -255,7 +426,12 @@ int pmemkv_open(const char *engine_c_str, pmemkv_config *config, pmemkv_db **db)
 
 void pmemkv_close(pmemkv_db *db)
 {
+	if (!db)
+		return;
+
 	try {
+		/* asynchronous requests still need the engine */
+		db_to_internal(db)->stop_async();
 		delete db_to_internal(db);
 	} catch (const std::exception &exc) {
 		ERR() << exc.what();
@@ -269,8 +445,10 @@ int pmemkv_count_all(pmemkv_db *db, size_t *cnt)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(
-		__func__, [&] { return db_to_internal(db)->count_all(*cnt); });
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->count_all(*cnt);
+	});
 }
 
 int pmemkv_count_above(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
@@ -279,6 +457,7 @@ int pmemkv_count_above(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->count_above(pmem::kv::string_view(k, kb),
 						       *cnt);
 	});
@@ -290,6 +469,7 @@ int pmemkv_count_equal_above(pmemkv_db *db, const char *k, size_t kb, size_t *cn
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->count_equal_above(pmem::kv::string_view(k, kb),
 							     *cnt);
 	});
@@ -301,6 +481,7 @@ int pmemkv_count_equal_below(pmemkv_db *db, const char *k, size_t kb, size_t *cn
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->count_equal_below(pmem::kv::string_view(k, kb),
 							     *cnt);
 	});
@@ -312,6 +493,7 @@ int pmemkv_count_below(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->count_below(pmem::kv::string_view(k, kb),
 						       *cnt);
 	});
@@ -324,19 +506,35 @@ int pmemkv_count_between(pmemkv_db *db, const char *k1, size_t kb1, const char *
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->count_between(pmem::kv::string_view(k1, kb1),
 							 pmem::kv::string_view(k2, kb2),
 							 *cnt);
 	});
 }
 
+int pmemkv_count_prefix(pmemkv_db *db, const char *prefix, size_t prefixbytes,
+			size_t *cnt)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->count_prefix(
+			pmem::kv::string_view(prefix, prefixbytes), *cnt);
+	});
+}
+
 int pmemkv_get_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(
-		__func__, [&] { return db_to_internal(db)->get_all(c, arg); });
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->get_all(c, arg);
+	});
 }
 
 int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
@@ -346,6 +544,7 @@ int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->get_above(pmem::kv::string_view(k, kb), c,
 						     arg);
 	});
@@ -358,6 +557,7 @@ int pmemkv_get_equal_above(pmemkv_db *db, const char *k, size_t kb,
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->get_equal_above(pmem::kv::string_view(k, kb),
 							   c, arg);
 	});
@@ -370,6 +570,7 @@ int pmemkv_get_equal_below(pmemkv_db *db, const char *k, size_t kb,
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->get_equal_below(pmem::kv::string_view(k, kb),
 							   c, arg);
 	});
@@ -382,6 +583,7 @@ int pmemkv_get_below(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->get_below(pmem::kv::string_view(k, kb), c,
 						     arg);
 	});
@@ -394,18 +596,87 @@ int pmemkv_get_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
 		return db_to_internal(db)->get_between(pmem::kv::string_view(k1, kb1),
 						       pmem::kv::string_view(k2, kb2), c,
 						       arg);
 	});
 }
 
+int pmemkv_get_prefix(pmemkv_db *db, const char *prefix, size_t prefixbytes,
+		      pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->get_prefix(
+			pmem::kv::string_view(prefix, prefixbytes), c, arg);
+	});
+}
+
+int pmemkv_scan(pmemkv_db *db, const char *prefix, size_t prefixbytes, size_t limit,
+		size_t batch_size, pmemkv_scan_callback *c, void *arg)
+{
+	if (!db || !c || batch_size == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->scan(
+			pmem::kv::string_view(prefix, prefixbytes), limit, batch_size, c,
+			arg);
+	});
+}
+
+int pmemkv_get_by_index(pmemkv_db *db, const char *ik, size_t ikb,
+			pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->get_by_index(pmem::kv::string_view(ik, ikb),
+							c, arg);
+	});
+}
+
+int pmemkv_get_all_parallel(pmemkv_db *db, size_t nthreads,
+			    pmemkv_get_kv_parallel_callback *c, void *arg)
+{
+	if (!db || !c || nthreads == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->get_all_parallel(nthreads, c, arg);
+	});
+}
+
+int pmemkv_get_between_parallel(pmemkv_db *db, const char *k1, size_t kb1,
+				const char *k2, size_t kb2, size_t nthreads,
+				pmemkv_get_kv_parallel_callback *c, void *arg)
+{
+	if (!db || !c || nthreads == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->get_between_parallel(
+			pmem::kv::string_view(k1, kb1), pmem::kv::string_view(k2, kb2),
+			nthreads, c, arg);
+	});
+}
+
 int pmemkv_exists(pmemkv_db *db, const char *k, size_t kb)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::GET, k, kb);
 		return db_to_internal(db)->exists(pmem::kv::string_view(k, kb));
 	});
 }
@@ -417,10 +688,48 @@ int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::GET, k, kb);
 		return db_to_internal(db)->get(pmem::kv::string_view(k, kb), c, arg);
 	});
 }
 
+int pmemkv_get_many(pmemkv_db *db, size_t count, const char *const *keys,
+		    const size_t *keybytes, pmemkv_get_many_v_callback *c, void *arg)
+{
+	if (!db || (count > 0 && (!keys || !keybytes)))
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::GET);
+		std::vector<pmem::kv::string_view> keys_sv;
+		keys_sv.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+			keys_sv.emplace_back(keys[i], keybytes[i]);
+
+		return db_to_internal(db)->get_many(count, keys_sv.data(), c, arg);
+	});
+}
+
+int pmemkv_get_ref(pmemkv_db *db, const char *k, size_t kb, pmemkv_value_ref *ref,
+		   const char **v, size_t *vb)
+{
+	if (!db || !ref || !v || !vb)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::GET, k, kb);
+		auto internal_ref = value_ref_to_internal(ref);
+		auto s = db_to_internal(db)->get_ref(pmem::kv::string_view(k, kb),
+						     *internal_ref);
+		if (s == pmem::kv::status::OK) {
+			*v = internal_ref->value().data();
+			*vb = internal_ref->value().size();
+		}
+
+		return s;
+	});
+}
+
 struct GetCopyCallbackContext {
 	int result;
 
@@ -439,8 +748,12 @@ static void get_copy_callback(const char *v, size_t vb, void *arg)
 
 	if (vb <= c->buffer_size) {
 		c->result = PMEMKV_STATUS_OK;
-		if (c->buffer != nullptr)
+		if (c->buffer != nullptr) {
 			memcpy(c->buffer, v, vb);
+			/* terminate the value, if there is room for it */
+			if (vb < c->buffer_size)
+				c->buffer[vb] = '\0';
+		}
 	} else {
 		c->result = PMEMKV_STATUS_OUT_OF_MEMORY;
 	}
@@ -455,10 +768,11 @@ int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 	GetCopyCallbackContext ctx = {PMEMKV_STATUS_NOT_FOUND, buffer_size, buffer,
 				      value_size};
 
-	if (buffer != nullptr)
-		memset(buffer, 0, buffer_size);
+	if (buffer != nullptr && buffer_size > 0)
+		buffer[0] = '\0';
 
 	auto ret = catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::GET, k, kb);
 		return db_to_internal(db)->get(pmem::kv::string_view(k, kb),
 					       &get_copy_callback, &ctx);
 	});
@@ -475,21 +789,99 @@ int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::PUT, k, kb);
 		return db_to_internal(db)->put(pmem::kv::string_view(k, kb),
 					       pmem::kv::string_view(v, vb));
 	});
 }
 
+int pmemkv_put_with_ttl(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			size_t vb, uint64_t ttl_ms)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::PUT, k, kb);
+		return db_to_internal(db)->put_with_ttl(pmem::kv::string_view(k, kb),
+							pmem::kv::string_view(v, vb),
+							ttl_ms);
+	});
+}
+
+int pmemkv_put_if_absent(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			 size_t vb, int *inserted)
+{
+	return pmemkv_get_or_insert(db, k, kb, v, vb, nullptr, nullptr, inserted);
+}
+
+int pmemkv_get_or_insert(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			 size_t vb, pmemkv_get_v_callback *c, void *arg, int *inserted)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::PUT, k, kb);
+		bool ins = false;
+		auto s = db_to_internal(db)->get_or_insert(pmem::kv::string_view(k, kb),
+							   pmem::kv::string_view(v, vb),
+							   c, arg, ins);
+		if (inserted)
+			*inserted = ins;
+		return s;
+	});
+}
+
+int pmemkv_update(pmemkv_db *db, const char *k, size_t kb, pmemkv_update_callback *c,
+		  void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::PUT, k, kb);
+		return db_to_internal(db)->update(pmem::kv::string_view(k, kb), c, arg);
+	});
+}
+
+int pmemkv_merge(pmemkv_db *db, const char *k, size_t kb, int op, const char *v,
+		 size_t vb)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::PUT, k, kb);
+		return db_to_internal(db)->merge(pmem::kv::string_view(k, kb), op,
+						 pmem::kv::string_view(v, vb));
+	});
+}
+
 int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::REMOVE, k, kb);
 		return db_to_internal(db)->remove(pmem::kv::string_view(k, kb));
 	});
 }
 
+int pmemkv_remove_range(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			size_t kb2)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->remove_range(pmem::kv::string_view(k1, kb1),
+							pmem::kv::string_view(k2, kb2));
+	});
+}
+
 int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent)
 {
 	if (!db)
@@ -500,6 +892,71 @@ int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent)
 	});
 }
 
+int pmemkv_flush(pmemkv_db *db)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::WRITE);
+		return db_to_internal(db)->flush();
+	});
+}
+
+int pmemkv_changes_since(pmemkv_db *db, uint64_t seq, pmemkv_change_callback *c,
+			 void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return db_to_internal(db)->changes_since(seq, c, arg);
+	});
+}
+
+int pmemkv_stats(pmemkv_db *db, pmemkv_get_v_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto engine = db_to_internal(db);
+		pmem::kv::internal::engine_metrics metrics;
+		engine->metrics(metrics);
+
+		auto name = engine->name();
+		auto operations = engine->op_stats().to_json();
+		auto internals = metrics.to_json();
+
+		rapidjson::StringBuffer sb;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+		writer.StartObject();
+		writer.Key("engine");
+		writer.String(name.data(), static_cast<rapidjson::SizeType>(name.size()));
+		writer.Key("operations");
+		writer.RawValue(operations.data(), operations.size(),
+				rapidjson::kObjectType);
+		writer.Key("internals");
+		writer.RawValue(internals.data(), internals.size(),
+				rapidjson::kObjectType);
+		writer.EndObject();
+		c(sb.GetString(), sb.GetSize(), arg);
+
+		return pmem::kv::status::OK;
+	});
+}
+
+int pmemkv_stats_reset(pmemkv_db *db)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	db_to_internal(db)->op_stats().reset();
+
+	return PMEMKV_STATUS_OK;
+}
+
 std::pair<pmem::kv::string_view, pmem::kv::string_view> pmemkv_upper_bound(pmemkv_db *db, pmem::kv::string_view k)
 {
 	return db_to_internal(db)->upper_bound(k);
@@ -529,6 +986,384 @@ int pmemkv_get_size_new(pmemkv_db *db)
 {
 	return db_to_internal(db)->get_size_new();
 }
+
+int pmemkv_write_batch_new(pmemkv_write_batch **batch)
+{
+	if (!batch)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		*batch = write_batch_from_internal(new pmem::kv::internal::write_batch());
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+void pmemkv_write_batch_delete(pmemkv_write_batch *batch)
+{
+	try {
+		delete write_batch_to_internal(batch);
+	} catch (const std::exception &exc) {
+		ERR() << exc.what();
+	} catch (...) {
+		ERR() << "Unspecified failure";
+	}
+}
+
+int pmemkv_write_batch_put(pmemkv_write_batch *batch, const char *k, size_t kb,
+			   const char *v, size_t vb)
+{
+	if (!batch)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		write_batch_to_internal(batch)->put(pmem::kv::string_view(k, kb),
+						    pmem::kv::string_view(v, vb));
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_write_batch_remove(pmemkv_write_batch *batch, const char *k, size_t kb)
+{
+	if (!batch)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		write_batch_to_internal(batch)->remove(pmem::kv::string_view(k, kb));
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_write_batch_clear(pmemkv_write_batch *batch)
+{
+	if (!batch)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	write_batch_to_internal(batch)->clear();
+
+	return PMEMKV_STATUS_OK;
+}
+
+int pmemkv_value_ref_new(pmemkv_value_ref **ref)
+{
+	if (!ref)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		*ref = value_ref_from_internal(new pmem::kv::internal::value_ref());
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+void pmemkv_value_ref_delete(pmemkv_value_ref *ref)
+{
+	try {
+		delete value_ref_to_internal(ref);
+	} catch (const std::exception &exc) {
+		ERR() << exc.what();
+	} catch (...) {
+		ERR() << "Unspecified failure";
+	}
+}
+
+int pmemkv_value_ref_release(pmemkv_value_ref *ref)
+{
+	if (!ref)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	value_ref_to_internal(ref)->release();
+
+	return PMEMKV_STATUS_OK;
+}
+
+int pmemkv_write(pmemkv_db *db, pmemkv_write_batch *batch)
+{
+	if (!db || !batch)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::WRITE);
+		return db_to_internal(db)->write(*write_batch_to_internal(batch));
+	});
+}
+
+int pmemkv_bulk_load(pmemkv_db *db, pmemkv_bulk_load_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::WRITE);
+		return db_to_internal(db)->bulk_load(c, arg);
+	});
+}
+
+int pmemkv_export(pmemkv_db *db, int fd, size_t nthreads)
+{
+	if (!db || fd < 0 || nthreads == 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::RANGE);
+		return pmem::kv::internal::export_records(*db_to_internal(db), fd,
+							  nthreads);
+	});
+}
+
+int pmemkv_import(pmemkv_db *db, int fd)
+{
+	if (!db || fd < 0)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		op_timer timer(db, pmem::kv::internal::stats::op::WRITE);
+		return pmem::kv::internal::import_records(*db_to_internal(db), fd);
+	});
+}
+
+int pmemkv_put_async(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb,
+		     pmemkv_put_async_callback *c, void *arg)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		db_to_internal(db)->async_requests().put(pmem::kv::string_view(k, kb),
+							 pmem::kv::string_view(v, vb), c,
+							 arg);
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_get_async(pmemkv_db *db, const char *k, size_t kb,
+		     pmemkv_get_async_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		db_to_internal(db)->async_requests().get(pmem::kv::string_view(k, kb), c,
+							 arg);
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_iterator_new(pmemkv_db *db, pmemkv_iterator **it)
+{
+	if (!db || !it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		*it = iterator_from_internal(db_to_internal(db)->new_iterator());
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+void pmemkv_iterator_delete(pmemkv_iterator *it)
+{
+	try {
+		delete iterator_to_internal(it);
+	} catch (const std::exception &exc) {
+		ERR() << exc.what();
+	} catch (...) {
+		ERR() << "Unspecified failure";
+	}
+}
+
+int pmemkv_iterator_seek(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return iterator_to_internal(it)->seek(pmem::kv::string_view(k, kb));
+	});
+}
+
+int pmemkv_iterator_seek_lower(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return iterator_to_internal(it)->seek_lower(pmem::kv::string_view(k, kb));
+	});
+}
+
+int pmemkv_iterator_seek_lower_eq(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return iterator_to_internal(it)->seek_lower_eq(
+			pmem::kv::string_view(k, kb));
+	});
+}
+
+int pmemkv_iterator_seek_higher(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return iterator_to_internal(it)->seek_higher(
+			pmem::kv::string_view(k, kb));
+	});
+}
+
+int pmemkv_iterator_seek_higher_eq(pmemkv_iterator *it, const char *k, size_t kb)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return iterator_to_internal(it)->seek_higher_eq(
+			pmem::kv::string_view(k, kb));
+	});
+}
+
+int pmemkv_iterator_seek_to_first(pmemkv_iterator *it)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(
+		__func__, [&] { return iterator_to_internal(it)->seek_to_first(); });
+}
+
+int pmemkv_iterator_seek_to_last(pmemkv_iterator *it)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(
+		__func__, [&] { return iterator_to_internal(it)->seek_to_last(); });
+}
+
+int pmemkv_iterator_is_next(pmemkv_iterator *it)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(
+		__func__, [&] { return iterator_to_internal(it)->is_next(); });
+}
+
+int pmemkv_iterator_next(pmemkv_iterator *it)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__,
+				       [&] { return iterator_to_internal(it)->next(); });
+}
+
+int pmemkv_iterator_prev(pmemkv_iterator *it)
+{
+	if (!it)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__,
+				       [&] { return iterator_to_internal(it)->prev(); });
+}
+
+int pmemkv_iterator_key(pmemkv_iterator *it, const char **k, size_t *kb)
+{
+	if (!it || !k || !kb)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		pmem::kv::string_view key;
+		auto s = iterator_to_internal(it)->key(key);
+		if (s == pmem::kv::status::OK) {
+			*k = key.data();
+			*kb = key.size();
+		}
+
+		return s;
+	});
+}
+
+int pmemkv_iterator_value(pmemkv_iterator *it, const char **v, size_t *vb)
+{
+	if (!it || !v || !vb)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		pmem::kv::string_view value;
+		auto s = iterator_to_internal(it)->value(value);
+		if (s == pmem::kv::status::OK) {
+			*v = value.data();
+			*vb = value.size();
+		}
+
+		return s;
+	});
+}
+
+int pmemkv_snapshot_new(pmemkv_db *db, pmemkv_snapshot **snap)
+{
+	if (!db || !snap)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		*snap = snapshot_from_internal(db_to_internal(db)->new_snapshot());
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+void pmemkv_snapshot_delete(pmemkv_snapshot *snap)
+{
+	try {
+		delete snapshot_to_internal(snap);
+	} catch (const std::exception &exc) {
+		ERR() << exc.what();
+	} catch (...) {
+		ERR() << "Unspecified failure";
+	}
+}
+
+int pmemkv_snapshot_get(pmemkv_snapshot *snap, const char *k, size_t kb,
+			pmemkv_get_v_callback *c, void *arg)
+{
+	if (!snap)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return snapshot_to_internal(snap)->get(pmem::kv::string_view(k, kb), c,
+						       arg);
+	});
+}
+
+int pmemkv_snapshot_get_all(pmemkv_snapshot *snap, pmemkv_get_kv_callback *c, void *arg)
+{
+	if (!snap)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(
+		__func__, [&] { return snapshot_to_internal(snap)->get_all(c, arg); });
+}
+
+int pmemkv_snapshot_get_between(pmemkv_snapshot *snap, const char *k1, size_t kb1,
+				const char *k2, size_t kb2, pmemkv_get_kv_callback *c,
+				void *arg)
+{
+	if (!snap)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return snapshot_to_internal(snap)->get_between(
+			pmem::kv::string_view(k1, kb1), pmem::kv::string_view(k2, kb2), c,
+			arg);
+	});
+}
+
 const char *pmemkv_errormsg(void)
 {
 	return out_get_errormsg();
@@ -178,12 +178,43 @@ extern "C" {
 #define PMEMKV_STATUS_TRANSACTION_SCOPE_ERROR 10
 #define PMEMKV_STATUS_DEFRAG_ERROR 11
 
+#define PMEMKV_CHANGE_PUT 1
+#define PMEMKV_CHANGE_REMOVE 2
+
+#define PMEMKV_MERGE_APPEND 1
+#define PMEMKV_MERGE_INCREMENT 2
+
 typedef struct pmemkv_db pmemkv_db;
 typedef struct pmemkv_config pmemkv_config;
+typedef struct pmemkv_iterator pmemkv_iterator;
+typedef struct pmemkv_snapshot pmemkv_snapshot;
+typedef struct pmemkv_write_batch pmemkv_write_batch;
+typedef struct pmemkv_value_ref pmemkv_value_ref;
 
 typedef int pmemkv_get_kv_callback(const char *key, size_t keybytes, const char *value,
 				   size_t valuebytes, void *arg);
 typedef void pmemkv_get_v_callback(const char *value, size_t valuebytes, void *arg);
+typedef void pmemkv_get_many_v_callback(size_t index, int status, const char *value,
+					size_t valuebytes, void *arg);
+typedef int pmemkv_scan_callback(size_t count, const char *const *keys,
+				 const size_t *keybytes, const char *const *values,
+				 const size_t *valuebytes, void *arg);
+typedef int pmemkv_get_kv_parallel_callback(size_t worker, const char *key,
+					    size_t keybytes, const char *value,
+					    size_t valuebytes, void *arg);
+typedef int pmemkv_bulk_load_callback(const char **key, size_t *keybytes,
+				      const char **value, size_t *valuebytes, void *arg);
+typedef void pmemkv_put_async_callback(int status, void *arg);
+typedef void pmemkv_get_async_callback(int status, const char *value, size_t valuebytes,
+				       void *arg);
+typedef int pmemkv_change_callback(uint64_t seq, int op, const char *key, size_t keybytes,
+				   const char *value, size_t valuebytes, void *arg);
+typedef int pmemkv_update_callback(const char *value, size_t valuebytes,
+				   const char **new_value, size_t *new_valuebytes,
+				   void *arg);
+typedef int pmemkv_index_extractor(const char *value, size_t valuebytes,
+				   const char **index_key, size_t *index_keybytes,
+				   void *arg);
 
 pmemkv_config *pmemkv_config_new(void);
 void pmemkv_config_delete(pmemkv_config *config);
@@ -194,6 +225,8 @@ int pmemkv_config_put_object(pmemkv_config *config, const char *key, void *value
 int pmemkv_config_put_uint64(pmemkv_config *config, const char *key, uint64_t value);
 int pmemkv_config_put_int64(pmemkv_config *config, const char *key, int64_t value);
 int pmemkv_config_put_string(pmemkv_config *config, const char *key, const char *value);
+int pmemkv_config_put_index_extractor(pmemkv_config *config,
+				      pmemkv_index_extractor *extractor, void *arg);
 int pmemkv_config_get_data(pmemkv_config *config, const char *key, const void **value,
 			   size_t *value_size);
 int pmemkv_config_get_object(pmemkv_config *config, const char *key, void **value);
@@ -211,6 +244,8 @@ int pmemkv_count_equal_below(pmemkv_db *db, const char *k, size_t kb, size_t *cn
 int pmemkv_count_below(pmemkv_db *db, const char *k, size_t kb, size_t *cnt);
 int pmemkv_count_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
 			 size_t kb2, size_t *cnt);
+int pmemkv_count_prefix(pmemkv_db *db, const char *prefix, size_t prefixbytes,
+			size_t *cnt);
 
 int pmemkv_get_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg);
 int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
@@ -223,6 +258,17 @@ int pmemkv_get_below(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 		     void *arg);
 int pmemkv_get_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
 		       size_t kb2, pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_prefix(pmemkv_db *db, const char *prefix, size_t prefixbytes,
+		      pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_scan(pmemkv_db *db, const char *prefix, size_t prefixbytes, size_t limit,
+		size_t batch_size, pmemkv_scan_callback *c, void *arg);
+int pmemkv_get_by_index(pmemkv_db *db, const char *ik, size_t ikb,
+			pmemkv_get_kv_callback *c, void *arg);
+int pmemkv_get_all_parallel(pmemkv_db *db, size_t nthreads,
+			    pmemkv_get_kv_parallel_callback *c, void *arg);
+int pmemkv_get_between_parallel(pmemkv_db *db, const char *k1, size_t kb1,
+				const char *k2, size_t kb2, size_t nthreads,
+				pmemkv_get_kv_parallel_callback *c, void *arg);
 
 int pmemkv_exists(pmemkv_db *db, const char *k, size_t kb);
 
@@ -233,15 +279,88 @@ std::pair<pmem::kv::string_view, pmem::kv::string_view> pmemkv_get_next(struct p
 std::pair<pmem::kv::string_view, pmem::kv::string_view> pmemkv_get_prev(struct pmemkv_db *db, pmem::kv::string_view k);
 int pmemkv_get_size_new(struct pmemkv_db *db);
 
+int pmemkv_iterator_new(pmemkv_db *db, pmemkv_iterator **it);
+void pmemkv_iterator_delete(pmemkv_iterator *it);
+
+int pmemkv_iterator_seek(pmemkv_iterator *it, const char *k, size_t kb);
+int pmemkv_iterator_seek_lower(pmemkv_iterator *it, const char *k, size_t kb);
+int pmemkv_iterator_seek_lower_eq(pmemkv_iterator *it, const char *k, size_t kb);
+int pmemkv_iterator_seek_higher(pmemkv_iterator *it, const char *k, size_t kb);
+int pmemkv_iterator_seek_higher_eq(pmemkv_iterator *it, const char *k, size_t kb);
+int pmemkv_iterator_seek_to_first(pmemkv_iterator *it);
+int pmemkv_iterator_seek_to_last(pmemkv_iterator *it);
+
+int pmemkv_iterator_is_next(pmemkv_iterator *it);
+int pmemkv_iterator_next(pmemkv_iterator *it);
+int pmemkv_iterator_prev(pmemkv_iterator *it);
+
+int pmemkv_iterator_key(pmemkv_iterator *it, const char **k, size_t *kb);
+int pmemkv_iterator_value(pmemkv_iterator *it, const char **v, size_t *vb);
+
+int pmemkv_snapshot_new(pmemkv_db *db, pmemkv_snapshot **snap);
+void pmemkv_snapshot_delete(pmemkv_snapshot *snap);
+
+int pmemkv_snapshot_get(pmemkv_snapshot *snap, const char *k, size_t kb,
+			pmemkv_get_v_callback *c, void *arg);
+int pmemkv_snapshot_get_all(pmemkv_snapshot *snap, pmemkv_get_kv_callback *c,
+			    void *arg);
+int pmemkv_snapshot_get_between(pmemkv_snapshot *snap, const char *k1, size_t kb1,
+				const char *k2, size_t kb2, pmemkv_get_kv_callback *c,
+				void *arg);
+
 int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c,
 	       void *arg);
 int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 		    size_t buffer_size, size_t *value_size);
+int pmemkv_get_many(pmemkv_db *db, size_t count, const char *const *keys,
+		    const size_t *keybytes, pmemkv_get_many_v_callback *c, void *arg);
+int pmemkv_get_ref(pmemkv_db *db, const char *k, size_t kb, pmemkv_value_ref *ref,
+		   const char **v, size_t *vb);
 int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb);
+int pmemkv_put_with_ttl(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			size_t vb, uint64_t ttl_ms);
+int pmemkv_put_if_absent(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			 size_t vb, int *inserted);
+int pmemkv_get_or_insert(pmemkv_db *db, const char *k, size_t kb, const char *v,
+			 size_t vb, pmemkv_get_v_callback *c, void *arg, int *inserted);
+int pmemkv_update(pmemkv_db *db, const char *k, size_t kb, pmemkv_update_callback *c,
+		  void *arg);
+int pmemkv_merge(pmemkv_db *db, const char *k, size_t kb, int op, const char *v,
+		 size_t vb);
 
 int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb);
+int pmemkv_remove_range(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
+			size_t kb2);
+
+int pmemkv_write_batch_new(pmemkv_write_batch **batch);
+void pmemkv_write_batch_delete(pmemkv_write_batch *batch);
+int pmemkv_write_batch_put(pmemkv_write_batch *batch, const char *k, size_t kb,
+			   const char *v, size_t vb);
+int pmemkv_write_batch_remove(pmemkv_write_batch *batch, const char *k, size_t kb);
+int pmemkv_write_batch_clear(pmemkv_write_batch *batch);
+int pmemkv_write(pmemkv_db *db, pmemkv_write_batch *batch);
+
+int pmemkv_bulk_load(pmemkv_db *db, pmemkv_bulk_load_callback *c, void *arg);
+
+int pmemkv_export(pmemkv_db *db, int fd, size_t nthreads);
+int pmemkv_import(pmemkv_db *db, int fd);
+
+int pmemkv_put_async(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb,
+		     pmemkv_put_async_callback *c, void *arg);
+int pmemkv_get_async(pmemkv_db *db, const char *k, size_t kb,
+		     pmemkv_get_async_callback *c, void *arg);
+
+int pmemkv_value_ref_new(pmemkv_value_ref **ref);
+void pmemkv_value_ref_delete(pmemkv_value_ref *ref);
+int pmemkv_value_ref_release(pmemkv_value_ref *ref);
 
 int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent);
+int pmemkv_flush(pmemkv_db *db);
+int pmemkv_changes_since(pmemkv_db *db, uint64_t seq, pmemkv_change_callback *c,
+			 void *arg);
+
+int pmemkv_stats(pmemkv_db *db, pmemkv_get_v_callback *c, void *arg);
+int pmemkv_stats_reset(pmemkv_db *db);
 
 const char *pmemkv_errormsg(void);
 
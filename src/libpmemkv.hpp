@@ -34,9 +34,12 @@
 #define LIBPMEMKV_HPP
 
 #include <functional>
+#include <future>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #if __cpp_lib_string_view
 #include <string_view>
@@ -91,6 +94,42 @@ using get_kv_callback = pmemkv_get_kv_callback;
  * Value-only callback, C-style.
  */
 using get_v_callback = pmemkv_get_v_callback;
+/**
+ * Batched lookup callback, C-style.
+ */
+using get_many_v_callback = pmemkv_get_many_v_callback;
+/**
+ * Batched scan callback, C-style.
+ */
+using scan_callback = pmemkv_scan_callback;
+/**
+ * Parallel key-value pair callback, C-style.
+ */
+using get_kv_parallel_callback = pmemkv_get_kv_parallel_callback;
+/**
+ * Bulk load producer callback, C-style.
+ */
+using bulk_load_callback = pmemkv_bulk_load_callback;
+/**
+ * Completion callback of an asynchronous put, C-style.
+ */
+using put_async_callback = pmemkv_put_async_callback;
+/**
+ * Completion callback of an asynchronous get, C-style.
+ */
+using get_async_callback = pmemkv_get_async_callback;
+/**
+ * Change log callback, C-style.
+ */
+using change_callback = pmemkv_change_callback;
+/**
+ * Read-modify-write callback of update(), C-style.
+ */
+using update_callback = pmemkv_update_callback;
+/**
+ * Extractor of index keys from values of the indexed engine, C-style.
+ */
+using index_extractor = pmemkv_index_extractor;
 
 /*! \enum status
 	\brief Status returned by pmemkv functions.
@@ -126,6 +165,86 @@ enum class status {
 						      (possibly in the middle of a run) */
 };
 
+/**
+ * The C++ idiomatic function type to use for callback of get_many().
+ *
+ * @param[in] index position of the key in the array passed to get_many()
+ * @param[in] s status of the lookup (status::OK or status::NOT_FOUND)
+ * @param[in] value returned by callback item's data (empty if not found)
+ */
+typedef void get_many_v_function(size_t index, status s, string_view value);
+
+/**
+ * The C++ idiomatic function type to use for callback of scan().
+ *
+ * @param[in] count number of records in the batch
+ * @param[in] keys keys of the records
+ * @param[in] values values of the records
+ *
+ * @return 0 to continue the scan, non-zero to stop it
+ */
+typedef int scan_function(size_t count, const string_view *keys,
+			  const string_view *values);
+
+/**
+ * The C++ idiomatic function type to use for callback of get_all_parallel().
+ * It is called concurrently, by all the workers.
+ *
+ * @param[in] worker index of the calling worker, lower than the number of threads
+ * @param[in] key returned by callback item's key
+ * @param[in] value returned by callback item's data
+ *
+ * @return 0 to continue, non-zero to stop all the workers
+ */
+typedef int get_kv_parallel_function(size_t worker, string_view key, string_view value);
+
+/**
+ * The C++ idiomatic function type to use for producer of bulk_load().
+ *
+ * @param[out] key key of the next record
+ * @param[out] value value of the next record
+ *
+ * @return true if the record was set, false if there are no more records
+ */
+typedef bool bulk_load_function(string_view &key, string_view &value);
+
+/**
+ * The C++ idiomatic function type to use for completion of put_async().
+ *
+ * @param[in] s status of the put
+ */
+typedef void put_async_function(status s);
+
+/**
+ * The C++ idiomatic function type to use for completion of get_async().
+ *
+ * @param[in] s status of the get (e.g. status::OK or status::NOT_FOUND)
+ * @param[in] value value of the record (empty if not found)
+ */
+typedef void get_async_function(status s, string_view value);
+
+/**
+ * The C++ idiomatic function type to use for changes_since().
+ *
+ * @param[in] seq sequence number of the change
+ * @param[in] op PMEMKV_CHANGE_PUT or PMEMKV_CHANGE_REMOVE
+ * @param[in] key key of the changed record
+ * @param[in] value value which was put (empty for removes)
+ *
+ * @return 0 to continue, non-zero value to stop
+ */
+typedef int change_function(uint64_t seq, int op, string_view key, string_view value);
+
+/**
+ * The C++ idiomatic function type to use for update().
+ *
+ * @param[in] value current value of the record, nullptr if there is no such record
+ * @param[out] new_value value to be stored
+ *
+ * @return true to store new_value, false to leave the record unchanged
+ */
+typedef bool update_function(const string_view *value, std::string &new_value);
+
 /*! \class config
 	\brief Holds configuration parameters for engines.
 
@@ -168,6 +287,7 @@ public:
 	status put_uint64(const std::string &key, std::uint64_t value) noexcept;
 	status put_int64(const std::string &key, std::int64_t value) noexcept;
 	status put_string(const std::string &key, const std::string &value) noexcept;
+	status put_index_extractor(index_extractor *extractor, void *arg) noexcept;
 
 	template <typename T>
 	status get_data(const std::string &key, T *&value, std::size_t &number) const
@@ -187,6 +307,73 @@ private:
 	pmemkv_config *_config;
 };
 
+/*! \class write_batch
+	\brief Holds a list of puts and removes to be applied to pmem::kv::db at once.
+
+	Keys and values are copied into the batch, so the caller's buffers can be
+	reused right after put() or remove() returns. The batch is applied with
+	db::write() and can be reused (or cleared) afterwards. Engines built on a
+	single libpmemobj transaction (tree3) apply a batch atomically.
+*/
+class write_batch {
+public:
+	write_batch() noexcept;
+	~write_batch();
+
+	write_batch(const write_batch &other) = delete;
+	write_batch(write_batch &&other) noexcept;
+
+	write_batch &operator=(const write_batch &other) = delete;
+	write_batch &operator=(write_batch &&other) noexcept;
+
+	status put(string_view key, string_view value) noexcept;
+	status remove(string_view key) noexcept;
+	status clear() noexcept;
+
+private:
+	friend class db;
+
+	int init() noexcept;
+
+	pmemkv_write_batch *_batch;
+};
+
+/*! \class value_ref
+	\brief Value of a record, returned by db::get_ref() without copying it.
+
+	The value points directly to the data stored by the engine. Engines which
+	allow concurrent updates keep the record pinned (e.g. cmap holds a read lock
+	of the record and stree a lock of the tree's leaf) until the reference is
+	released, reused by another db::get_ref() call or destroyed. The reference
+	should be held only briefly: writers of the pinned data wait for it, and
+	the thread holding it must not modify the database. Engines which do not
+	support concurrent updates (tree3) do not pin anything, there the value is
+	valid until the database is modified. Other engines return a copy.
+	A value_ref must not outlive the database it was filled by.
+*/
+class value_ref {
+public:
+	value_ref() noexcept;
+	~value_ref();
+
+	value_ref(const value_ref &other) = delete;
+	value_ref(value_ref &&other) noexcept;
+
+	value_ref &operator=(const value_ref &other) = delete;
+	value_ref &operator=(value_ref &&other) noexcept;
+
+	string_view value() const noexcept;
+	void release() noexcept;
+
+private:
+	friend class db;
+
+	int init() noexcept;
+
+	pmemkv_value_ref *_ref;
+	string_view _value;
+};
+
 /*! \class db
 	\brief Main pmemkv class, it provides functions to operate on data in database.
 
@@ -196,6 +383,9 @@ private:
 */
 class db {
 public:
+	class iterator;
+	class snapshot;
+
 	db() noexcept;
 	~db();
 
@@ -217,6 +407,7 @@ public:
 	status count_below(string_view key, std::size_t &cnt) noexcept;
 	status count_between(string_view key1, string_view key2,
 			     std::size_t &cnt) noexcept;
+	status count_prefix(string_view prefix, std::size_t &cnt) noexcept;
 
 	status get_all(get_kv_callback *callback, void *arg) noexcept;
 	status get_all(std::function<get_kv_function> f) noexcept;
@@ -242,6 +433,30 @@ public:
 	status get_between(string_view key1, string_view key2,
 			   std::function<get_kv_function> f) noexcept;
 
+	status get_prefix(string_view prefix, get_kv_callback *callback,
+			  void *arg) noexcept;
+	status get_prefix(string_view prefix, std::function<get_kv_function> f) noexcept;
+
+	status get_by_index(string_view index_key, get_kv_callback *callback,
+			    void *arg) noexcept;
+	status get_by_index(string_view index_key,
+			    std::function<get_kv_function> f) noexcept;
+
+	status scan(string_view prefix, size_t limit, size_t batch_size,
+		    scan_callback *callback, void *arg) noexcept;
+	status scan(string_view prefix, size_t limit, size_t batch_size,
+		    std::function<scan_function> f) noexcept;
+
+	status get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				void *arg) noexcept;
+	status get_all_parallel(size_t nthreads,
+				std::function<get_kv_parallel_function> f) noexcept;
+	status get_between_parallel(string_view key1, string_view key2, size_t nthreads,
+				    get_kv_parallel_callback *callback,
+				    void *arg) noexcept;
+	status get_between_parallel(string_view key1, string_view key2, size_t nthreads,
+				    std::function<get_kv_parallel_function> f) noexcept;
+
 	std::pair<string_view, string_view> upper_bound(string_view key) noexcept;
 	std::pair<string_view, string_view> lower_bound(string_view key) noexcept;
 	std::pair<string_view, string_view> get_begin() noexcept;
@@ -249,20 +464,148 @@ public:
 	std::pair<string_view, string_view> get_prev(string_view key) noexcept;
 	int get_size_new() noexcept;
 
+	status new_iterator(iterator &it) noexcept;
+	status new_snapshot(snapshot &snap) noexcept;
+
 	status exists(string_view key) noexcept;
 
 	status get(string_view key, get_v_callback *callback, void *arg) noexcept;
 	status get(string_view key, std::function<get_v_function> f) noexcept;
 	status get(string_view key, std::string *value) noexcept;
 
+	status get_many(const std::vector<string_view> &keys,
+			get_many_v_callback *callback, void *arg) noexcept;
+	status get_many(const std::vector<string_view> &keys,
+			std::function<get_many_v_function> f) noexcept;
+
+	status get_ref(string_view key, value_ref &ref) noexcept;
+
 	status put(string_view key, string_view value) noexcept;
+	status put_with_ttl(string_view key, string_view value, uint64_t ttl_ms) noexcept;
+	status put_if_absent(string_view key, string_view value,
+			     bool *inserted = nullptr) noexcept;
+	status get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			     void *arg, bool *inserted = nullptr) noexcept;
+	status get_or_insert(string_view key, string_view value,
+			     std::function<get_v_function> f,
+			     bool *inserted = nullptr) noexcept;
+	status get_or_insert(string_view key, string_view value, std::string *result,
+			     bool *inserted = nullptr) noexcept;
+	status update(string_view key, update_callback *callback, void *arg) noexcept;
+	status update(string_view key, std::function<update_function> f) noexcept;
+	status merge(string_view key, int op, string_view operand) noexcept;
 	status remove(string_view key) noexcept;
+	status remove_range(string_view key1, string_view key2) noexcept;
+	status write(write_batch &batch) noexcept;
+
+	status bulk_load(bulk_load_callback *callback, void *arg) noexcept;
+	status bulk_load(std::function<bulk_load_function> f) noexcept;
+	template <typename InputIt>
+	status bulk_load(InputIt first, InputIt last) noexcept;
+
+	status export_records(int fd, size_t nthreads = 1) noexcept;
+	status import_records(int fd) noexcept;
+
+	status put_async(string_view key, string_view value,
+			 put_async_callback *callback, void *arg) noexcept;
+	status put_async(string_view key, string_view value,
+			 std::function<put_async_function> f) noexcept;
+	std::future<status> put_async(string_view key, string_view value);
+	status get_async(string_view key, get_async_callback *callback,
+			 void *arg) noexcept;
+	status get_async(string_view key, std::function<get_async_function> f) noexcept;
+	std::future<status> get_async(string_view key, std::string *value);
+
 	status defrag(double start_percent = 0, double amount_percent = 100);
+	status flush() noexcept;
+
+	status changes_since(uint64_t seq, change_callback *callback, void *arg) noexcept;
+	status changes_since(uint64_t seq, std::function<change_function> f) noexcept;
+
+	status stats(std::string *json) noexcept;
+	status stats_reset() noexcept;
 
 private:
 	pmemkv_db *_db;
 };
 
+/*! \class db::iterator
+	\brief Cursor over records of an ordered engine.
+
+	An iterator is created by db::new_iterator(). It keeps its position between
+	calls, so moving to the next or previous record does not look the key up
+	again. The iterator must not outlive the database it was created for and is
+	invalidated by every modification of that database (put, remove...).
+*/
+class db::iterator {
+public:
+	iterator() noexcept;
+	~iterator();
+
+	iterator(const iterator &other) = delete;
+	iterator(iterator &&other) noexcept;
+
+	iterator &operator=(const iterator &other) = delete;
+	iterator &operator=(iterator &&other) noexcept;
+
+	status seek(string_view key) noexcept;
+	status seek_lower(string_view key) noexcept;
+	status seek_lower_eq(string_view key) noexcept;
+	status seek_higher(string_view key) noexcept;
+	status seek_higher_eq(string_view key) noexcept;
+
+	status seek_to_first() noexcept;
+	status seek_to_last() noexcept;
+
+	status is_next() noexcept;
+	status next() noexcept;
+	status prev() noexcept;
+
+	status key(string_view &key) noexcept;
+	status value(string_view &value) noexcept;
+
+private:
+	friend class db;
+
+	pmemkv_iterator *_it;
+};
+
+/*! \class db::snapshot
+	\brief Read view of a database at the time it was created.
+
+	A snapshot is created by db::new_snapshot(). Reads of the snapshot return
+	records as they were when it was taken, while the database is modified
+	concurrently. The snapshot must not outlive the database it was created for.
+*/
+class db::snapshot {
+public:
+	snapshot() noexcept;
+	~snapshot();
+
+	snapshot(const snapshot &other) = delete;
+	snapshot(snapshot &&other) noexcept;
+
+	snapshot &operator=(const snapshot &other) = delete;
+	snapshot &operator=(snapshot &&other) noexcept;
+
+	status get(string_view key, get_v_callback *callback, void *arg) noexcept;
+	status get(string_view key, std::function<get_v_function> f) noexcept;
+	status get(string_view key, std::string *value) noexcept;
+
+	status get_all(get_kv_callback *callback, void *arg) noexcept;
+	status get_all(std::function<get_kv_function> f) noexcept;
+
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) noexcept;
+	status get_between(string_view key1, string_view key2,
+			   std::function<get_kv_function> f) noexcept;
+
+private:
+	friend class db;
+
+	pmemkv_snapshot *_snap;
+};
+
 /**
  * Default constructor with uninitialized config.
  */
@@ -426,6 +769,27 @@ inline status config::put_string(const std::string &key,
 		pmemkv_config_put_string(this->_config, key.data(), value.data()));
 }
 
+/**
+ * Puts the extractor of index keys from values, used by the indexed engine, to
+ * the "index_extractor" config item. It is called with a value, pointers to be
+ * set to the index key and its size, and *arg*. It returns 0 if the value has an
+ * index key or non-zero if the record is not indexed. The index key has to stay
+ * valid until the next call of the extractor.
+ *
+ * @param[in] extractor function extracting an index key from a value
+ * @param[in] arg additional argument passed to the extractor
+ *
+ * @return pmem::kv::status
+ */
+inline status config::put_index_extractor(index_extractor *extractor, void *arg) noexcept
+{
+	if (init() != 0)
+		return status::UNKNOWN_ERROR;
+
+	return static_cast<status>(
+		pmemkv_config_put_index_extractor(this->_config, extractor, arg));
+}
+
 /**
  * Gets object from a config item with key name and copies it
  * into T object value.
@@ -552,167 +916,451 @@ inline pmemkv_config *config::release() noexcept
 	return c;
 }
 
-/*
- * All functions which will be called by C code must be declared as extern "C"
- * to ensure they have C linkage. It is needed because it is possible that
- * C and C++ functions use different calling conventions.
+/**
+ * Default constructor with empty write batch. The batch is lazily initialized
+ * on first use.
  */
-//extern "C" {
-static inline int call_get_kv_function(const char *key, size_t keybytes,
-				       const char *value, size_t valuebytes, void *arg)
+inline write_batch::write_batch() noexcept
 {
-	return (*reinterpret_cast<std::function<get_kv_function> *>(arg))(
-		string_view(key, keybytes), string_view(value, valuebytes));
+	this->_batch = nullptr;
 }
 
-static inline void call_get_v_function(const char *value, size_t valuebytes, void *arg)
+/**
+ * Move constructor. Ownership of the operations is transferred to a write_batch
+ * that move constructor was called on.
+ */
+inline write_batch::write_batch(write_batch &&other) noexcept
 {
-	(*reinterpret_cast<std::function<get_v_function> *>(arg))(
-		string_view(value, valuebytes));
+	this->_batch = other._batch;
+	other._batch = nullptr;
 }
 
-static inline void call_get_copy(const char *v, size_t vb, void *arg)
+/**
+ * Move assignment operator. Deletes previous batch and replaces it with another
+ * one. Ownership of the operations is transferred to this write_batch.
+ */
+inline write_batch &write_batch::operator=(write_batch &&other) noexcept
 {
-	auto c = reinterpret_cast<std::string *>(arg);
-	c->assign(v, vb);
+	if (this->_batch)
+		pmemkv_write_batch_delete(this->_batch);
+
+	this->_batch = other._batch;
+	other._batch = nullptr;
+
+	return *this;
 }
-//}
 
 /**
- * Default constructor with uninitialized database.
+ * Default destructor. Deletes write batch if initialized.
  */
-inline db::db() noexcept
+inline write_batch::~write_batch()
 {
-	this->_db = nullptr;
+	if (this->_batch)
+		pmemkv_write_batch_delete(this->_batch);
 }
 
 /**
- * Move constructor. Initializes database with another database.
- * Ownership is being transferred to a class that move constructor was called on.
+ * Initialization function for write_batch.
+ * It's lazy initialized and called within all functions using the batch.
  *
- * @param[in] other another database, to be moved from
+ * @return int initialization result; 0 on success
  */
-inline db::db(db &&other) noexcept
+inline int write_batch::init() noexcept
 {
-	this->_db = other._db;
-	other._db = nullptr;
+	if (this->_batch == nullptr) {
+		if (pmemkv_write_batch_new(&this->_batch) != PMEMKV_STATUS_OK)
+			return 1;
+	}
+
+	return 0;
 }
 
 /**
- * Move assignment operator. Deletes previous database and replaces
- * it with another database. Ownership is being transferred to a class that
- * assign operator was called on.
+ * Appends insertion of a key-value pair to the batch.
  *
- * @param[in] other another database, to be assigned from
+ * @param[in] key record's key
+ * @param[in] value data to be inserted for this record
+ *
+ * @return pmem::kv::status
  */
-inline db &db::operator=(db &&other) noexcept
+inline status write_batch::put(string_view key, string_view value) noexcept
 {
-	close();
-
-	std::swap(this->_db, other._db);
+	if (init() != 0)
+		return status::OUT_OF_MEMORY;
 
-	return *this;
+	return static_cast<status>(pmemkv_write_batch_put(
+		this->_batch, key.data(), key.size(), value.data(), value.size()));
 }
 
 /**
- * Opens the pmemkv database without any configuration parameters.
+ * Appends removal of a record with given *key* to the batch.
  *
- * @param[in] engine_name name of the engine to work with
+ * @param[in] key record's key to be removed
  *
  * @return pmem::kv::status
  */
-inline status db::open(const std::string &engine_name) noexcept
+inline status write_batch::remove(string_view key) noexcept
 {
+	if (init() != 0)
+		return status::OUT_OF_MEMORY;
+
 	return static_cast<status>(
-		pmemkv_open(engine_name.c_str(), nullptr, &(this->_db)));
+		pmemkv_write_batch_remove(this->_batch, key.data(), key.size()));
 }
 
 /**
- * Opens the pmemkv database with specified config.
- *
- * @param[in] engine_name name of the engine to work with
- * @param[in] cfg pmem::kv::config with parameters specified for the engine
+ * Removes all operations from the batch.
  *
  * @return pmem::kv::status
  */
-inline status db::open(const std::string &engine_name, config &&cfg) noexcept
+inline status write_batch::clear() noexcept
 {
-	return static_cast<status>(
-		pmemkv_open(engine_name.c_str(), cfg.release(), &(this->_db)));
+	if (this->_batch == nullptr)
+		return status::OK;
+
+	return static_cast<status>(pmemkv_write_batch_clear(this->_batch));
 }
 
 /**
- * Closes pmemkv database.
+ * Default constructor with empty reference. It is lazily initialized on first
+ * use.
  */
-inline void db::close() noexcept
+inline value_ref::value_ref() noexcept
 {
-	if (this->_db != nullptr)
-		pmemkv_close(this->_db);
-
-	this->_db = nullptr;
+	this->_ref = nullptr;
 }
 
 /**
- * Default destructor. Closes pmemkv database.
+ * Move constructor. The pinned value is transferred to a value_ref that move
+ * constructor was called on.
  */
-inline db::~db()
+inline value_ref::value_ref(value_ref &&other) noexcept
 {
-	close();
+	this->_ref = other._ref;
+	this->_value = other._value;
+	other._ref = nullptr;
+	other._value = string_view();
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db.
- *
- * @param[out] cnt number of records stored in pmem::kv::db.
- *
- * @return pmem::kv::status
+ * Move assignment operator. Releases previous value and replaces it with
+ * another one.
  */
-inline status db::count_all(std::size_t &cnt) noexcept
+inline value_ref &value_ref::operator=(value_ref &&other) noexcept
 {
-	return static_cast<status>(pmemkv_count_all(this->_db, &cnt));
+	if (this->_ref)
+		pmemkv_value_ref_delete(this->_ref);
+
+	this->_ref = other._ref;
+	this->_value = other._value;
+	other._ref = nullptr;
+	other._value = string_view();
+
+	return *this;
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db, whose keys
- * are greater than the given *key*.
- * Keys are sorted in lexicographical order (see std::lexicographical_compare).
- *
- * @param[in] key sets the lower bound of counting
- * @param[out] cnt number of records in pmem::kv::db matching query
- *
- * @return pmem::kv::status
+ * Default destructor. Releases the value, if there is one.
  */
-inline status db::count_above(string_view key, std::size_t &cnt) noexcept
+inline value_ref::~value_ref()
 {
-	return static_cast<status>(
-		pmemkv_count_above(this->_db, key.data(), key.size(), &cnt));
+	if (this->_ref)
+		pmemkv_value_ref_delete(this->_ref);
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db, whose keys
- * are greater than or equal to the given *key*.
- * Keys are sorted in lexicographical order (see std::lexicographical_compare).
- *
- * @param[in] key sets the lower bound of counting
- * @param[out] cnt number of records in pmem::kv::db matching query
+ * Initialization function for value_ref.
+ * It's lazy initialized and called by db::get_ref().
  *
- * @return pmem::kv::status
+ * @return int initialization result; 0 on success
  */
-inline status db::count_equal_above(string_view key, std::size_t &cnt) noexcept
+inline int value_ref::init() noexcept
 {
-	return static_cast<status>(
-		pmemkv_count_equal_above(this->_db, key.data(), key.size(), &cnt));
+	if (this->_ref == nullptr) {
+		if (pmemkv_value_ref_new(&this->_ref) != PMEMKV_STATUS_OK)
+			return 1;
+	}
+
+	return 0;
 }
 
 /**
- * It returns number of currently stored elements in pmem::kv::db, whose keys
- * are lower than or equal to the given *key*.
- * Keys are sorted in lexicographical order (see std::lexicographical_compare).
+ * Returns the value found by the last successful db::get_ref() call (or empty
+ * string_view after release()).
  *
- * @param[in] key sets the lower bound of counting
- * @param[out] cnt number of records in pmem::kv::db matching query
- *
- * @return pmem::kv::status
+ * @return value of the record, pointing to the engine's data
+ */
+inline string_view value_ref::value() const noexcept
+{
+	return this->_value;
+}
+
+/**
+ * Releases the value, so that the record can be modified again. The reference
+ * can be reused by the next db::get_ref() call.
+ */
+inline void value_ref::release() noexcept
+{
+	if (this->_ref)
+		pmemkv_value_ref_release(this->_ref);
+
+	this->_value = string_view();
+}
+
+/*
+ * All functions which will be called by C code must be declared as extern "C"
+ * to ensure they have C linkage. It is needed because it is possible that
+ * C and C++ functions use different calling conventions.
+ */
+//extern "C" {
+static inline int call_get_kv_function(const char *key, size_t keybytes,
+				       const char *value, size_t valuebytes, void *arg)
+{
+	return (*reinterpret_cast<std::function<get_kv_function> *>(arg))(
+		string_view(key, keybytes), string_view(value, valuebytes));
+}
+
+static inline void call_get_v_function(const char *value, size_t valuebytes, void *arg)
+{
+	(*reinterpret_cast<std::function<get_v_function> *>(arg))(
+		string_view(value, valuebytes));
+}
+
+static inline void call_get_copy(const char *v, size_t vb, void *arg)
+{
+	auto c = reinterpret_cast<std::string *>(arg);
+	c->assign(v, vb);
+}
+
+static inline void call_get_many_v_function(size_t index, int s, const char *value,
+					    size_t valuebytes, void *arg)
+{
+	(*reinterpret_cast<std::function<get_many_v_function> *>(arg))(
+		index, static_cast<status>(s), string_view(value, valuebytes));
+}
+
+static inline int call_scan_function(size_t count, const char *const *keys,
+				     const size_t *keybytes, const char *const *values,
+				     const size_t *valuebytes, void *arg)
+{
+	std::vector<string_view> k, v;
+	k.reserve(count);
+	v.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		k.emplace_back(keys[i], keybytes[i]);
+		v.emplace_back(values[i], valuebytes[i]);
+	}
+
+	return (*reinterpret_cast<std::function<scan_function> *>(arg))(count, k.data(),
+									v.data());
+}
+
+static inline int call_get_kv_parallel_function(size_t worker, const char *key,
+						size_t keybytes, const char *value,
+						size_t valuebytes, void *arg)
+{
+	return (*reinterpret_cast<std::function<get_kv_parallel_function> *>(arg))(
+		worker, string_view(key, keybytes), string_view(value, valuebytes));
+}
+
+static inline int call_bulk_load_function(const char **key, size_t *keybytes,
+					  const char **value, size_t *valuebytes,
+					  void *arg)
+{
+	string_view k, v;
+	if (!(*reinterpret_cast<std::function<bulk_load_function> *>(arg))(k, v))
+		return 1;
+
+	*key = k.data();
+	*keybytes = k.size();
+	*value = v.data();
+	*valuebytes = v.size();
+	return 0;
+}
+
+static inline int call_change_function(uint64_t seq, int op, const char *key,
+				       size_t keybytes, const char *value,
+				       size_t valuebytes, void *arg)
+{
+	return (*reinterpret_cast<std::function<change_function> *>(arg))(
+		seq, op, string_view(key, keybytes), string_view(value, valuebytes));
+}
+
+/* keeps the value computed by the function until pmemkv_update() returns */
+struct update_function_arg {
+	std::function<update_function> *f;
+	std::string new_value;
+};
+
+static inline int call_update_function(const char *value, size_t valuebytes,
+				       const char **new_value, size_t *new_valuebytes,
+				       void *arg)
+{
+	auto a = reinterpret_cast<update_function_arg *>(arg);
+	string_view v(value, valuebytes);
+
+	a->new_value.clear();
+	if (!(*a->f)(value ? &v : nullptr, a->new_value))
+		return 1;
+
+	*new_value = a->new_value.data();
+	*new_valuebytes = a->new_value.size();
+	return 0;
+}
+
+/* the function is allocated by put_async() and called only once */
+static inline void call_put_async_function(int s, void *arg)
+{
+	std::unique_ptr<std::function<put_async_function>> f(
+		reinterpret_cast<std::function<put_async_function> *>(arg));
+	(*f)(static_cast<status>(s));
+}
+
+/* the function is allocated by get_async() and called only once */
+static inline void call_get_async_function(int s, const char *value,
+					   size_t valuebytes, void *arg)
+{
+	std::unique_ptr<std::function<get_async_function>> f(
+		reinterpret_cast<std::function<get_async_function> *>(arg));
+	(*f)(static_cast<status>(s), string_view(value, valuebytes));
+}
+//}
+
+/**
+ * Default constructor with uninitialized database.
+ */
+inline db::db() noexcept
+{
+	this->_db = nullptr;
+}
+
+/**
+ * Move constructor. Initializes database with another database.
+ * Ownership is being transferred to a class that move constructor was called on.
+ *
+ * @param[in] other another database, to be moved from
+ */
+inline db::db(db &&other) noexcept
+{
+	this->_db = other._db;
+	other._db = nullptr;
+}
+
+/**
+ * Move assignment operator. Deletes previous database and replaces
+ * it with another database. Ownership is being transferred to a class that
+ * assign operator was called on.
+ *
+ * @param[in] other another database, to be assigned from
+ */
+inline db &db::operator=(db &&other) noexcept
+{
+	close();
+
+	std::swap(this->_db, other._db);
+
+	return *this;
+}
+
+/**
+ * Opens the pmemkv database without any configuration parameters.
+ *
+ * @param[in] engine_name name of the engine to work with
+ *
+ * @return pmem::kv::status
+ */
+inline status db::open(const std::string &engine_name) noexcept
+{
+	return static_cast<status>(
+		pmemkv_open(engine_name.c_str(), nullptr, &(this->_db)));
+}
+
+/**
+ * Opens the pmemkv database with specified config.
+ *
+ * @param[in] engine_name name of the engine to work with
+ * @param[in] cfg pmem::kv::config with parameters specified for the engine
+ *
+ * @return pmem::kv::status
+ */
+inline status db::open(const std::string &engine_name, config &&cfg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_open(engine_name.c_str(), cfg.release(), &(this->_db)));
+}
+
+/**
+ * Closes pmemkv database.
+ */
+inline void db::close() noexcept
+{
+	if (this->_db != nullptr)
+		pmemkv_close(this->_db);
+
+	this->_db = nullptr;
+}
+
+/**
+ * Default destructor. Closes pmemkv database.
+ */
+inline db::~db()
+{
+	close();
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db.
+ *
+ * @param[out] cnt number of records stored in pmem::kv::db.
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_all(std::size_t &cnt) noexcept
+{
+	return static_cast<status>(pmemkv_count_all(this->_db, &cnt));
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * are greater than the given *key*.
+ * Keys are sorted in lexicographical order (see std::lexicographical_compare).
+ *
+ * @param[in] key sets the lower bound of counting
+ * @param[out] cnt number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_above(string_view key, std::size_t &cnt) noexcept
+{
+	return static_cast<status>(
+		pmemkv_count_above(this->_db, key.data(), key.size(), &cnt));
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * are greater than or equal to the given *key*.
+ * Keys are sorted in lexicographical order (see std::lexicographical_compare).
+ *
+ * @param[in] key sets the lower bound of counting
+ * @param[out] cnt number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_equal_above(string_view key, std::size_t &cnt) noexcept
+{
+	return static_cast<status>(
+		pmemkv_count_equal_above(this->_db, key.data(), key.size(), &cnt));
+}
+
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * are lower than or equal to the given *key*.
+ * Keys are sorted in lexicographical order (see std::lexicographical_compare).
+ *
+ * @param[in] key sets the lower bound of counting
+ * @param[out] cnt number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
  */
 inline status db::count_equal_below(string_view key, std::size_t &cnt) noexcept
 {
@@ -754,6 +1402,22 @@ inline status db::count_between(string_view key1, string_view key2,
 		this->_db, key1.data(), key1.size(), key2.data(), key2.size(), &cnt));
 }
 
+/**
+ * It returns number of currently stored elements in pmem::kv::db, whose keys
+ * start with the *prefix*. It is supported only by ordered engines, stree
+ * counts the records without visiting them.
+ *
+ * @param[in] prefix prefix of keys of counted records
+ * @param[out] cnt number of records in pmem::kv::db matching query
+ *
+ * @return pmem::kv::status
+ */
+inline status db::count_prefix(string_view prefix, std::size_t &cnt) noexcept
+{
+	return static_cast<status>(
+		pmemkv_count_prefix(this->_db, prefix.data(), prefix.size(), &cnt));
+}
+
 /**
  * Executes (C-like) *callback* function for every record stored in pmem::kv::db.
  * Arguments passed to the callback function are: pointer to a key, size of the
@@ -1012,52 +1676,292 @@ inline status db::get_between(string_view key1, string_view key2,
 }
 
 /**
- * Checks existence of record with given *key*. If record is present
- * pmem::kv::status::OK is returned, otherwise pmem::kv::status::NOT_FOUND
- * is returned. Other possible return values are described in pmem::kv::status.
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose key starts with the *prefix*. It is supported only by ordered engines,
+ * which seek to the prefix once and stop at the first key not matching it.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case *get_prefix()*
+ * returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues iteration.
  *
- * @param[in] key record's key to query for in database
+ * Keys are sorted in lexicographical order (see std::lexicographical_compare).
+ *
+ * @param[in] prefix prefix of keys of returned records
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
  *
  * @return pmem::kv::status
  */
-inline status db::exists(string_view key) noexcept
+inline status db::get_prefix(string_view prefix, get_kv_callback *callback,
+			     void *arg) noexcept
 {
-	return static_cast<status>(pmemkv_exists(this->_db, key.data(), key.size()));
+	return static_cast<status>(pmemkv_get_prefix(this->_db, prefix.data(),
+						     prefix.size(), callback, arg));
 }
 
 /**
- * Executes (C-like) *callback* function for record with given *key*. If
- * record is present and no error occurred, the function returns
- * pmem::kv::status::OK. If record does not exist pmem::kv::status::NOT_FOUND
- * is returned. Other possible return values are described in pmem::kv::status.
- * *Callback* is called with the following parameters:
- * pointer to a value, size of the value and *arg* specified by the user.
- * This function is guaranteed to be implemented by all engines.
+ * Executes function for every record stored in pmem::kv::db, whose key starts
+ * with the *prefix*. See db::get_prefix(string_view, get_kv_callback *, void *)
+ * for details.
  *
- * @param[in] key record's key to query for
- * @param[in] callback function to be called for returned element
- * @param[in] arg additional arguments to be passed to callback
+ * @param[in] prefix prefix of keys of returned records
+ * @param[in] f function called for each returned element, it is called with params:
+ *				key and value
  *
  * @return pmem::kv::status
  */
-inline status db::get(string_view key, get_v_callback *callback, void *arg) noexcept
+inline status db::get_prefix(string_view prefix, std::function<get_kv_function> f) noexcept
 {
-	return static_cast<status>(
-		pmemkv_get(this->_db, key.data(), key.size(), callback, arg));
+	return static_cast<status>(pmemkv_get_prefix(this->_db, prefix.data(),
+						     prefix.size(), call_get_kv_function,
+						     &f));
 }
 
 /**
- * Executes function for record with given *key*. If record is present and
- * no error occurred the function returns pmem::kv::status::OK. If record does
- * not exist pmem::kv::status::NOT_FOUND is returned.
+ * Executes (C-like) callback function for every record stored in pmem::kv::db,
+ * whose value has the *index_key*, as found by the extractor given in the
+ * "index_extractor" config item. It is supported only by the indexed engine.
+ * Arguments passed to the callback function are: pointer to a key, size of the
+ * key, pointer to a value, size of the value and *arg* specified by the user.
+ * Callback can stop iteration by returning non-zero value. In that case
+ * *get_by_index()* returns pmem::kv::status::STOPPED_BY_CB. Returning 0 continues
+ * iteration. Records are passed in the order of their keys.
  *
- * @param[in] key record's key to query for
- * @param[in] f function called for returned element, it is called with only
- *				one param - value (key is known)
+ * @param[in] index_key index key of returned records
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
  *
  * @return pmem::kv::status
  */
-inline status db::get(string_view key, std::function<get_v_function> f) noexcept
+inline status db::get_by_index(string_view index_key, get_kv_callback *callback,
+			       void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_get_by_index(
+		this->_db, index_key.data(), index_key.size(), callback, arg));
+}
+
+/**
+ * Executes function for every record stored in pmem::kv::db, whose value has the
+ * *index_key*. See db::get_by_index(string_view, get_kv_callback *, void *) for
+ * details.
+ *
+ * @param[in] index_key index key of returned records
+ * @param[in] f function called for each returned element, it is called with params:
+ *				key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_by_index(string_view index_key,
+			       std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_by_index(this->_db, index_key.data(),
+						       index_key.size(),
+						       call_get_kv_function, &f));
+}
+
+/**
+ * Executes (C-like) callback function for batches of records stored in
+ * pmem::kv::db, whose keys start with the *prefix*. Records are filtered and
+ * counted by the engine, so callback is called once per *batch_size* records
+ * (the last batch may be smaller), instead of once per record. Ordered engines
+ * seek to the prefix and pass records in lexicographical order of keys, others
+ * have to check every record. Keys and values passed to the callback are valid
+ * only during its call.
+ *
+ * Arguments passed to the callback function are: number of records in the
+ * batch, arrays of pointers to keys and of their sizes, arrays of pointers to
+ * values and of their sizes and *arg* specified by the user. Callback can stop
+ * the scan by returning non-zero value. In that case *scan()* returns
+ * pmem::kv::status::STOPPED_BY_CB. Returning 0 continues the scan.
+ *
+ * @param[in] prefix records with keys starting with it are scanned, all
+ *				records if it is empty
+ * @param[in] limit maximal number of scanned records, 0 means no limit
+ * @param[in] batch_size maximal number of records passed to a single call of
+ *				the callback, has to be greater than 0
+ * @param[in] callback function to be called for each batch of records
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::scan(string_view prefix, size_t limit, size_t batch_size,
+		       scan_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_scan(this->_db, prefix.data(), prefix.size(),
+					       limit, batch_size, callback, arg));
+}
+
+/**
+ * Executes function for batches of records stored in pmem::kv::db, whose keys
+ * start with the *prefix*. See db::scan(string_view, size_t, size_t,
+ * scan_callback *, void *) for details.
+ *
+ * @param[in] prefix records with keys starting with it are scanned, all
+ *				records if it is empty
+ * @param[in] limit maximal number of scanned records, 0 means no limit
+ * @param[in] batch_size maximal number of records passed to a single call of
+ *				the function, has to be greater than 0
+ * @param[in] f function called for each batch of records, it is called with
+ *				params: number of records, keys and values
+ *
+ * @return pmem::kv::status
+ */
+inline status db::scan(string_view prefix, size_t limit, size_t batch_size,
+		       std::function<scan_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_scan(this->_db, prefix.data(), prefix.size(),
+					       limit, batch_size, call_scan_function,
+					       &f));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record stored in
+ * pmem::kv::db, from *nthreads* workers at once: the calling thread is one of
+ * them, the others are started for the duration of the call. Engines which
+ * can split their records do it, so that each record is passed to exactly one
+ * worker, in no particular order. Others pass all the records to worker 0
+ * from the calling thread, as get_all() does.
+ *
+ * Callback has to be safe to call concurrently. Arguments passed to it are:
+ * index of the worker (lower than *nthreads*, so it may select per-thread
+ * state), pointer to a key, size of the key, pointer to a value, size of the
+ * value and *arg* specified by the user. Callback can stop all the workers by
+ * returning non-zero value. In that case *get_all_parallel()* returns
+ * pmem::kv::status::STOPPED_BY_CB (other workers may still pass a few
+ * records before they notice). Returning 0 continues iteration.
+ *
+ * @param[in] nthreads number of workers, has to be greater than 0
+ * @param[in] callback function to be called for every element stored in db
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				   void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_all_parallel(this->_db, nthreads, callback, arg));
+}
+
+/**
+ * Executes function for every record stored in pmem::kv::db, from *nthreads*
+ * workers at once. See db::get_all_parallel(size_t, get_kv_parallel_callback *,
+ * void *) for details.
+ *
+ * @param[in] nthreads number of workers, has to be greater than 0
+ * @param[in] f function called for each returned element, it is called with
+ *				params: worker index, key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_all_parallel(size_t nthreads,
+				   std::function<get_kv_parallel_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_all_parallel(
+		this->_db, nthreads, call_get_kv_parallel_function, &f));
+}
+
+/**
+ * Executes (C-like) *callback* function for records stored in pmem::kv::db,
+ * whose keys are greater than *key1* and less than *key2*, from *nthreads*
+ * workers at once, as db::get_all_parallel() does. Ordered engines which can
+ * split the range (currently stree) do it at keys of their inner nodes, into
+ * parts of similar sizes; keys within each part are passed to a single worker
+ * in order, but parts are processed concurrently. Others pass all the records
+ * to worker 0, as get_between() does.
+ *
+ * Callback can stop all the workers by returning non-zero value. In that case
+ * *get_between_parallel()* returns pmem::kv::status::STOPPED_BY_CB.
+ *
+ * @param[in] key1 sets the lower bound of the range, exclusive
+ * @param[in] key2 sets the upper bound of the range, exclusive
+ * @param[in] nthreads number of workers, has to be greater than 0
+ * @param[in] callback function to be called for each returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_between_parallel(string_view key1, string_view key2,
+				       size_t nthreads,
+				       get_kv_parallel_callback *callback,
+				       void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_between_parallel(this->_db, key1.data(), key1.size(),
+					    key2.data(), key2.size(), nthreads,
+					    callback, arg));
+}
+
+/**
+ * Executes function for records stored in pmem::kv::db, whose keys are greater
+ * than *key1* and less than *key2*, from *nthreads* workers at once. See
+ * db::get_between_parallel(string_view, string_view, size_t,
+ * get_kv_parallel_callback *, void *) for details.
+ *
+ * @param[in] key1 sets the lower bound of the range, exclusive
+ * @param[in] key2 sets the upper bound of the range, exclusive
+ * @param[in] nthreads number of workers, has to be greater than 0
+ * @param[in] f function called for each returned element, it is called with
+ *				params: worker index, key and value
+ *
+ * @return pmem::kv::status
+ */
+inline status
+db::get_between_parallel(string_view key1, string_view key2, size_t nthreads,
+			 std::function<get_kv_parallel_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_get_between_parallel(
+		this->_db, key1.data(), key1.size(), key2.data(), key2.size(), nthreads,
+		call_get_kv_parallel_function, &f));
+}
+
+/**
+ * Checks existence of record with given *key*. If record is present
+ * pmem::kv::status::OK is returned, otherwise pmem::kv::status::NOT_FOUND
+ * is returned. Other possible return values are described in pmem::kv::status.
+ *
+ * @param[in] key record's key to query for in database
+ *
+ * @return pmem::kv::status
+ */
+inline status db::exists(string_view key) noexcept
+{
+	return static_cast<status>(pmemkv_exists(this->_db, key.data(), key.size()));
+}
+
+/**
+ * Executes (C-like) *callback* function for record with given *key*. If
+ * record is present and no error occurred, the function returns
+ * pmem::kv::status::OK. If record does not exist pmem::kv::status::NOT_FOUND
+ * is returned. Other possible return values are described in pmem::kv::status.
+ * *Callback* is called with the following parameters:
+ * pointer to a value, size of the value and *arg* specified by the user.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] callback function to be called for returned element
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(string_view key, get_v_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get(this->_db, key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Executes function for record with given *key*. If record is present and
+ * no error occurred the function returns pmem::kv::status::OK. If record does
+ * not exist pmem::kv::status::NOT_FOUND is returned.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] f function called for returned element, it is called with only
+ *				one param - value (key is known)
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get(string_view key, std::function<get_v_function> f) noexcept
 {
 	return static_cast<status>(
 		pmemkv_get(this->_db, key.data(), key.size(), call_get_v_function, &f));
@@ -1079,6 +1983,88 @@ inline status db::get(string_view key, std::string *value) noexcept
 		pmemkv_get(this->_db, key.data(), key.size(), call_get_copy, value));
 }
 
+/**
+ * Looks up record with given *key* and stores its value in *ref*, without copying
+ * it (see value_ref for how long the value stays valid). The value previously
+ * held by *ref* is released first. In absence of any errors,
+ * pmem::kv::status::OK is returned.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for
+ * @param[out] ref reference to the value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_ref(string_view key, value_ref &ref) noexcept
+{
+	if (ref.init() != 0)
+		return status::OUT_OF_MEMORY;
+
+	const char *v;
+	size_t vb;
+	ref._value = string_view();
+	auto s = static_cast<status>(pmemkv_get_ref(this->_db, key.data(), key.size(),
+						    ref._ref, &v, &vb));
+	if (s == status::OK)
+		ref._value = string_view(v, vb);
+
+	return s;
+}
+
+/**
+ * Executes (C-like) *callback* function for every key from *keys*, looking all of
+ * them up in a single call. Engines may reorder the lookups (e.g. stree resolves
+ * keys in sorted order), so the callback gets the index of the key it reports.
+ * *Callback* is called exactly once per key with the following parameters:
+ * index of the key, status of the lookup, pointer to a value (nullptr if not
+ * found), size of the value and *arg* specified by the user.
+ * If all records are present and no error occurred, the function returns
+ * pmem::kv::status::OK. If at least one record does not exist
+ * pmem::kv::status::NOT_FOUND is returned.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] keys records' keys to query for
+ * @param[in] callback function to be called for every key
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_many(const std::vector<string_view> &keys,
+			   get_many_v_callback *callback, void *arg) noexcept
+{
+	try {
+		std::vector<const char *> keys_data(keys.size());
+		std::vector<size_t> keys_size(keys.size());
+		for (size_t i = 0; i < keys.size(); ++i) {
+			keys_data[i] = keys[i].data();
+			keys_size[i] = keys[i].size();
+		}
+
+		return static_cast<status>(pmemkv_get_many(this->_db, keys.size(),
+							   keys_data.data(),
+							   keys_size.data(), callback, arg));
+	} catch (std::bad_alloc &) {
+		return status::OUT_OF_MEMORY;
+	}
+}
+
+/**
+ * Executes function for every key from *keys*, looking all of them up in a single
+ * call. See db::get_many(const std::vector<string_view> &, get_many_v_callback *,
+ * void *) for details.
+ *
+ * @param[in] keys records' keys to query for
+ * @param[in] f function called for every key with its index, status of the lookup
+ *				and the value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_many(const std::vector<string_view> &keys,
+			   std::function<get_many_v_function> f) noexcept
+{
+	return get_many(keys, call_get_many_v_function, &f);
+}
+
 inline std::pair<string_view, string_view> db::upper_bound(string_view key) noexcept
 {
 	return pmemkv_upper_bound(this->_db, key);
@@ -1110,47 +2096,1001 @@ inline int db::get_size_new() noexcept
 }
 
 /**
- * Inserts a key-value pair into pmemkv database.
- * This function is guaranteed to be implemented by all engines.
+ * Creates a new iterator over records in pmem::kv::db. It is not positioned on
+ * any record until one of the seek functions is called.
  *
- * @param[in] key record's key; record will be put into database under its name
- * @param[in] value data to be inserted into this new database record
+ * @param[out] it iterator to be initialized; a previously held one is deleted
  *
  * @return pmem::kv::status
  */
-inline status db::put(string_view key, string_view value) noexcept
+inline status db::new_iterator(iterator &it) noexcept
 {
-	return static_cast<status>(pmemkv_put(this->_db, key.data(), key.size(),
-					      value.data(), value.size()));
+	pmemkv_iterator *tmp;
+	auto s = static_cast<status>(pmemkv_iterator_new(this->_db, &tmp));
+	if (s != status::OK)
+		return s;
+
+	if (it._it != nullptr)
+		pmemkv_iterator_delete(it._it);
+
+	it._it = tmp;
+
+	return status::OK;
 }
 
 /**
- * Removes from database record with given *key*.
- * This function is guaranteed to be implemented by all engines.
+ * Creates a new snapshot of pmem::kv::db. Modifications made after this call
+ * are not visible through the snapshot.
  *
- * @param[in] key record's key to query for, to be removed
+ * @param[out] snap snapshot to be initialized; a previously held one is deleted
  *
- * @return pmem::kv::status
+ * @return pmem::kv::status; NOT_SUPPORTED if the engine has no snapshots
  */
-inline status db::remove(string_view key) noexcept
+inline status db::new_snapshot(snapshot &snap) noexcept
 {
-	return static_cast<status>(pmemkv_remove(this->_db, key.data(), key.size()));
+	pmemkv_snapshot *tmp;
+	auto s = static_cast<status>(pmemkv_snapshot_new(this->_db, &tmp));
+	if (s != status::OK)
+		return s;
+
+	if (snap._snap != nullptr)
+		pmemkv_snapshot_delete(snap._snap);
+
+	snap._snap = tmp;
+
+	return status::OK;
 }
 
 /**
- * Defragments approximately 'amount_percent' percent of elements
- * in the database starting from 'start_percent' percent of elements.
+ * Default constructor with uninitialized iterator.
+ */
+inline db::iterator::iterator() noexcept
+{
+	this->_it = nullptr;
+}
+
+/**
+ * Default destructor. Deletes iterator if initialized.
+ */
+inline db::iterator::~iterator()
+{
+	if (this->_it != nullptr)
+		pmemkv_iterator_delete(this->_it);
+}
+
+/**
+ * Move constructor. Ownership is being transferred to a class that move
+ * constructor was called on.
  *
- * @param[in] start_percent starting percent of elements to defragment from
- * @param[in] amount_percent amount percent of elements to defragment
+ * @param[in] other another iterator, to be moved from
+ */
+inline db::iterator::iterator(iterator &&other) noexcept
+{
+	this->_it = other._it;
+	other._it = nullptr;
+}
+
+/**
+ * Move assignment operator. Deletes previous iterator and replaces it with
+ * another iterator.
  *
- * @return pmem::kv::status
+ * @param[in] other another iterator, to be assigned from
  */
-inline status db::defrag(double start_percent, double amount_percent)
+inline db::iterator &db::iterator::operator=(iterator &&other) noexcept
+{
+	std::swap(this->_it, other._it);
+
+	return *this;
+}
 
+/**
+ * Positions the iterator on the record with exactly the given *key*.
+ *
+ * @param[in] key key to look for
+ *
+ * @return pmem::kv::status; NOT_FOUND if there is no such record
+ */
+inline status db::iterator::seek(string_view key) noexcept
 {
 	return static_cast<status>(
-		pmemkv_defrag(this->_db, start_percent, amount_percent));
+		pmemkv_iterator_seek(this->_it, key.data(), key.size()));
+}
+
+/**
+ * Positions the iterator on the record with the greatest key less than the
+ * given *key*.
+ *
+ * @param[in] key sets the upper bound (exclusive)
+ *
+ * @return pmem::kv::status; NOT_FOUND if there is no such record
+ */
+inline status db::iterator::seek_lower(string_view key) noexcept
+{
+	return static_cast<status>(
+		pmemkv_iterator_seek_lower(this->_it, key.data(), key.size()));
+}
+
+/**
+ * Positions the iterator on the record with the greatest key less than or
+ * equal to the given *key*.
+ *
+ * @param[in] key sets the upper bound (inclusive)
+ *
+ * @return pmem::kv::status; NOT_FOUND if there is no such record
+ */
+inline status db::iterator::seek_lower_eq(string_view key) noexcept
+{
+	return static_cast<status>(
+		pmemkv_iterator_seek_lower_eq(this->_it, key.data(), key.size()));
+}
+
+/**
+ * Positions the iterator on the record with the least key greater than the
+ * given *key*.
+ *
+ * @param[in] key sets the lower bound (exclusive)
+ *
+ * @return pmem::kv::status; NOT_FOUND if there is no such record
+ */
+inline status db::iterator::seek_higher(string_view key) noexcept
+{
+	return static_cast<status>(
+		pmemkv_iterator_seek_higher(this->_it, key.data(), key.size()));
+}
+
+/**
+ * Positions the iterator on the record with the least key greater than or
+ * equal to the given *key*.
+ *
+ * @param[in] key sets the lower bound (inclusive)
+ *
+ * @return pmem::kv::status; NOT_FOUND if there is no such record
+ */
+inline status db::iterator::seek_higher_eq(string_view key) noexcept
+{
+	return static_cast<status>(
+		pmemkv_iterator_seek_higher_eq(this->_it, key.data(), key.size()));
+}
+
+/**
+ * Positions the iterator on the record with the least key in the database.
+ *
+ * @return pmem::kv::status; NOT_FOUND if the database is empty
+ */
+inline status db::iterator::seek_to_first() noexcept
+{
+	return static_cast<status>(pmemkv_iterator_seek_to_first(this->_it));
+}
+
+/**
+ * Positions the iterator on the record with the greatest key in the database.
+ *
+ * @return pmem::kv::status; NOT_FOUND if the database is empty
+ */
+inline status db::iterator::seek_to_last() noexcept
+{
+	return static_cast<status>(pmemkv_iterator_seek_to_last(this->_it));
+}
+
+/**
+ * Checks if there is a record after the current one.
+ *
+ * @return pmem::kv::status; OK if next() would succeed, NOT_FOUND otherwise
+ */
+inline status db::iterator::is_next() noexcept
+{
+	return static_cast<status>(pmemkv_iterator_is_next(this->_it));
+}
+
+/**
+ * Moves the iterator to the next record.
+ *
+ * @return pmem::kv::status; NOT_FOUND if moved past the last record
+ */
+inline status db::iterator::next() noexcept
+{
+	return static_cast<status>(pmemkv_iterator_next(this->_it));
+}
+
+/**
+ * Moves the iterator to the previous record.
+ *
+ * @return pmem::kv::status; NOT_FOUND if moved before the first record
+ */
+inline status db::iterator::prev() noexcept
+{
+	return static_cast<status>(pmemkv_iterator_prev(this->_it));
+}
+
+/**
+ * Returns the key of the current record. The key is valid until the iterator
+ * is moved or the database is modified.
+ *
+ * @param[out] key key of the current record
+ *
+ * @return pmem::kv::status; NOT_FOUND if the iterator is not positioned on a record
+ */
+inline status db::iterator::key(string_view &key) noexcept
+{
+	const char *k;
+	size_t kb;
+	auto s = static_cast<status>(pmemkv_iterator_key(this->_it, &k, &kb));
+	if (s == status::OK)
+		key = string_view(k, kb);
+
+	return s;
+}
+
+/**
+ * Returns the value of the current record. The value is valid until the
+ * iterator is moved or the database is modified.
+ *
+ * @param[out] value value of the current record
+ *
+ * @return pmem::kv::status; NOT_FOUND if the iterator is not positioned on a record
+ */
+inline status db::iterator::value(string_view &value) noexcept
+{
+	const char *v;
+	size_t vb;
+	auto s = static_cast<status>(pmemkv_iterator_value(this->_it, &v, &vb));
+	if (s == status::OK)
+		value = string_view(v, vb);
+
+	return s;
+}
+
+/**
+ * Default constructor with uninitialized snapshot.
+ */
+inline db::snapshot::snapshot() noexcept
+{
+	this->_snap = nullptr;
+}
+
+/**
+ * Default destructor. Deletes snapshot if initialized.
+ */
+inline db::snapshot::~snapshot()
+{
+	if (this->_snap != nullptr)
+		pmemkv_snapshot_delete(this->_snap);
+}
+
+/**
+ * Move constructor. Ownership is being transferred to a class that move
+ * constructor was called on.
+ *
+ * @param[in] other another snapshot, to be moved from
+ */
+inline db::snapshot::snapshot(snapshot &&other) noexcept
+{
+	this->_snap = other._snap;
+	other._snap = nullptr;
+}
+
+/**
+ * Move assignment operator. Deletes previous snapshot and replaces it with
+ * another snapshot.
+ *
+ * @param[in] other another snapshot, to be assigned from
+ */
+inline db::snapshot &db::snapshot::operator=(snapshot &&other) noexcept
+{
+	std::swap(this->_snap, other._snap);
+
+	return *this;
+}
+
+/**
+ * Executes (C-like) *callback* function for the value of record with given
+ * *key*, as it was when the snapshot was taken.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] callback function to be called for the value
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status; NOT_FOUND if there was no such record
+ */
+inline status db::snapshot::get(string_view key, get_v_callback *callback,
+				void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_snapshot_get(this->_snap, key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Executes function for the value of record with given *key*, as it was when
+ * the snapshot was taken.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] f function called with the value
+ *
+ * @return pmem::kv::status; NOT_FOUND if there was no such record
+ */
+inline status db::snapshot::get(string_view key, std::function<get_v_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_snapshot_get(
+		this->_snap, key.data(), key.size(), call_get_v_function, &f));
+}
+
+/**
+ * Gets copy of the value of record with given *key*, as it was when the snapshot
+ * was taken.
+ *
+ * @param[in] key record's key to query for
+ * @param[out] value stores returned copy of the data
+ *
+ * @return pmem::kv::status; NOT_FOUND if there was no such record
+ */
+inline status db::snapshot::get(string_view key, std::string *value) noexcept
+{
+	return static_cast<status>(pmemkv_snapshot_get(this->_snap, key.data(),
+						       key.size(), call_get_copy, value));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record of the snapshot, in
+ * order of keys. Callback can stop iteration by returning non-zero value, in
+ * that case pmem::kv::status::STOPPED_BY_CB is returned.
+ *
+ * @param[in] callback function to be called for every record
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot::get_all(get_kv_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_snapshot_get_all(this->_snap, callback, arg));
+}
+
+/**
+ * Executes function for every record of the snapshot, in order of keys.
+ *
+ * @param[in] f function called for every record
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot::get_all(std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(
+		pmemkv_snapshot_get_all(this->_snap, call_get_kv_function, &f));
+}
+
+/**
+ * Executes (C-like) *callback* function for every record of the snapshot, whose
+ * key is greater than *key1* and less than *key2*, in order of keys.
+ *
+ * @param[in] key1 lower bound for comparison
+ * @param[in] key2 upper bound for comparison
+ * @param[in] callback function to be called for every matching record
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot::get_between(string_view key1, string_view key2,
+					get_kv_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_snapshot_get_between(this->_snap, key1.data(), key1.size(),
+					    key2.data(), key2.size(), callback, arg));
+}
+
+/**
+ * Executes function for every record of the snapshot, whose key is greater than
+ * *key1* and less than *key2*, in order of keys.
+ *
+ * @param[in] key1 lower bound for comparison
+ * @param[in] key2 upper bound for comparison
+ * @param[in] f function called for every matching record
+ *
+ * @return pmem::kv::status
+ */
+inline status db::snapshot::get_between(string_view key1, string_view key2,
+					std::function<get_kv_function> f) noexcept
+{
+	return static_cast<status>(pmemkv_snapshot_get_between(
+		this->_snap, key1.data(), key1.size(), key2.data(), key2.size(),
+		call_get_kv_function, &f));
+}
+
+/**
+ * Inserts a key-value pair into pmemkv database.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key; record will be put into database under its name
+ * @param[in] value data to be inserted into this new database record
+ *
+ * @return pmem::kv::status
+ */
+inline status db::put(string_view key, string_view value) noexcept
+{
+	return static_cast<status>(pmemkv_put(this->_db, key.data(), key.size(),
+					      value.data(), value.size()));
+}
+
+/**
+ * Inserts a key-value pair into pmemkv database, which expires after *ttl_ms*
+ * milliseconds. An expired record is not returned by reads and is removed in
+ * background. A later put() of the key makes the record permanent again.
+ * It is supported by cmap, if TTL is enabled in its config.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted into the record
+ * @param[in] ttl_ms time to live of the record, 0 means the record never expires
+ *
+ * @return pmem::kv::status
+ */
+inline status db::put_with_ttl(string_view key, string_view value,
+			       uint64_t ttl_ms) noexcept
+{
+	return static_cast<status>(pmemkv_put_with_ttl(this->_db, key.data(), key.size(),
+						       value.data(), value.size(),
+						       ttl_ms));
+}
+
+/**
+ * Inserts a key-value pair into pmemkv database, if there is no record with given
+ * *key*. Otherwise the existing record is left unchanged. Unlike exists() followed
+ * by put(), it is a single operation, so no concurrent put can come in between.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted into the new record
+ * @param[out] inserted set to true if the record was inserted, may be nullptr
+ *
+ * @return pmem::kv::status::OK whether the record was inserted or not,
+ *	otherwise pmem::kv::status
+ */
+inline status db::put_if_absent(string_view key, string_view value,
+				bool *inserted) noexcept
+{
+	return get_or_insert(key, value, nullptr, nullptr, inserted);
+}
+
+/**
+ * Inserts a key-value pair into pmemkv database, if there is no record with given
+ * *key*, and calls *callback* with the value of the record: the existing one or
+ * *value*, if it was inserted. The existing value is only valid during the call.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted into the new record
+ * @param[in] callback function called with the value of the record, may be nullptr
+ * @param[in] arg additional arguments for callback
+ * @param[out] inserted set to true if the record was inserted, may be nullptr
+ *
+ * @return pmem::kv::status::OK whether the record was inserted or not,
+ *	otherwise pmem::kv::status
+ */
+inline status db::get_or_insert(string_view key, string_view value,
+				get_v_callback *callback, void *arg,
+				bool *inserted) noexcept
+{
+	int ins = 0;
+	auto s = static_cast<status>(pmemkv_get_or_insert(
+		this->_db, key.data(), key.size(), value.data(), value.size(), callback,
+		arg, &ins));
+	if (inserted)
+		*inserted = ins != 0;
+	return s;
+}
+
+/**
+ * Inserts a key-value pair, if there is no record with given *key*, and calls *f*
+ * with the value of the record. See db::get_or_insert(string_view, string_view,
+ * get_v_callback *, void *, bool *) for details.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted into the new record
+ * @param[in] f function called with the value of the record
+ * @param[out] inserted set to true if the record was inserted, may be nullptr
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_or_insert(string_view key, string_view value,
+				std::function<get_v_function> f, bool *inserted) noexcept
+{
+	return get_or_insert(key, value, call_get_v_function, &f, inserted);
+}
+
+/**
+ * Inserts a key-value pair, if there is no record with given *key*, and stores
+ * a copy of the value of the record in *result*. See
+ * db::get_or_insert(string_view, string_view, get_v_callback *, void *, bool *)
+ * for details.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be inserted into the new record
+ * @param[out] result copy of the existing value or of *value*, if it was inserted
+ * @param[out] inserted set to true if the record was inserted, may be nullptr
+ *
+ * @return pmem::kv::status
+ */
+inline status db::get_or_insert(string_view key, string_view value, std::string *result,
+				bool *inserted) noexcept
+{
+	return get_or_insert(key, value, call_get_copy, result, inserted);
+}
+
+/**
+ * Atomically replaces the value of the record with given *key* by the one computed
+ * by *callback* from the current value. The callback gets nullptr as the value if
+ * there is no such record, a new one is then inserted. If the callback returns
+ * non-zero, the record is left unchanged and status::STOPPED_BY_CB is returned,
+ * so that a compare-and-swap is an update which stops if the value differs from
+ * the expected one.
+ *
+ * The callback may be called more than once, if a concurrent put inserts the
+ * record in the meantime, only the value computed by the last call is stored.
+ * The new value has to remain valid until update() returns.
+ *
+ * @param[in] key record's key
+ * @param[in] callback function computing the new value
+ * @param[in] arg additional arguments for callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::update(string_view key, update_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_update(this->_db, key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Atomically replaces the value of the record with given *key* by the one computed
+ * by *f*. See db::update(string_view, update_callback *, void *) for details.
+ *
+ * @param[in] key record's key
+ * @param[in] f function computing the new value, returning false to leave the
+ *	record unchanged
+ *
+ * @return pmem::kv::status
+ */
+inline status db::update(string_view key, std::function<update_function> f) noexcept
+{
+	update_function_arg arg{&f, std::string()};
+	return static_cast<status>(pmemkv_update(this->_db, key.data(), key.size(),
+						 call_update_function, &arg));
+}
+
+/**
+ * Atomically combines the value of the record with given *key* and the *operand*,
+ * using one of the built-in merge operators:
+ *	* PMEMKV_MERGE_APPEND - appends the operand to the value,
+ *	* PMEMKV_MERGE_INCREMENT - adds the operand to the value, both being 8-byte
+ *	  integers (int64_t) in native byte order.
+ *
+ * A missing record is treated as an empty value or zero, respectively. It is
+ * implemented by update(), so it is supported by the same engines.
+ *
+ * @param[in] key record's key
+ * @param[in] op merge operator
+ * @param[in] operand value to be combined with the current one
+ *
+ * @return pmem::kv::status::INVALID_ARGUMENT for an unknown operator or if
+ *	the sizes do not match the increment, otherwise pmem::kv::status
+ */
+inline status db::merge(string_view key, int op, string_view operand) noexcept
+{
+	return static_cast<status>(pmemkv_merge(this->_db, key.data(), key.size(), op,
+						operand.data(), operand.size()));
+}
+
+/**
+ * Removes from database record with given *key*.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for, to be removed
+ *
+ * @return pmem::kv::status
+ */
+inline status db::remove(string_view key) noexcept
+{
+	return static_cast<status>(pmemkv_remove(this->_db, key.data(), key.size()));
+}
+
+/**
+ * Removes from database all records with keys greater than or equal to *key1*
+ * and less than *key2*. Unlike get_between() and count_between() the range
+ * includes *key1*. It is not an error if no record is removed.
+ *
+ * Keys are compared lexicographically. stree frees leaves covered by the range
+ * and updates its inner nodes in a single transaction, vsmap erases the range
+ * of its map at once; other ordered engines remove records one by one.
+ * Unordered engines return status::NOT_SUPPORTED.
+ *
+ * @param[in] key1 first key of the range, included
+ * @param[in] key2 key ending the range, not included
+ *
+ * @return pmem::kv::status
+ */
+inline status db::remove_range(string_view key1, string_view key2) noexcept
+{
+	return static_cast<status>(pmemkv_remove_range(
+		this->_db, key1.data(), key1.size(), key2.data(), key2.size()));
+}
+
+/**
+ * Applies all operations from *batch* to the database, in the order they were
+ * added. Removing a record which does not exist is not an error. The tree3
+ * engine applies the whole batch in a single transaction, so either all
+ * operations are applied or none of them. Other engines apply operations one
+ * by one. The batch is not modified by this call.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] batch operations to be applied
+ *
+ * @return pmem::kv::status
+ */
+inline status db::write(write_batch &batch) noexcept
+{
+	if (batch.init() != 0)
+		return status::OUT_OF_MEMORY;
+
+	return static_cast<status>(pmemkv_write(this->_db, batch._batch));
+}
+
+/**
+ * Stores records produced by (C-like) *callback* function, which is called with
+ * pointers to the key, its size, the value, its size and *arg* specified by the
+ * user. It returns 0 after setting them to the next record or a non-zero value if
+ * there are no more records. The record has to stay valid until the next call.
+ * Records have to be produced in ascending order of keys, without duplicates,
+ * otherwise pmem::kv::status::INVALID_ARGUMENT is returned.
+ *
+ * stree and tree3 engines build the tree directly from the records if the
+ * database is empty, which is much faster than inserting them one by one.
+ * Loading is not atomic: after a failure or a crash some of the records may be
+ * stored, but only if all preceding ones are stored as well.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] callback function producing records
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::bulk_load(bulk_load_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_bulk_load(this->_db, callback, arg));
+}
+
+/**
+ * Stores records produced by function *f*, until it returns false. See
+ * db::bulk_load(bulk_load_callback *, void *) for details.
+ *
+ * @param[in] f function setting its arguments to the key and the value of the
+ *				next record
+ *
+ * @return pmem::kv::status
+ */
+inline status db::bulk_load(std::function<bulk_load_function> f) noexcept
+{
+	return bulk_load(call_bulk_load_function, &f);
+}
+
+/**
+ * Stores records from the range [*first*, *last*), e.g. of std::map<std::string,
+ * std::string>. Dereferenced iterator has to refer to a pair, whose members are
+ * convertible to string_view. See db::bulk_load(bulk_load_callback *, void *) for
+ * details.
+ *
+ * @param[in] first beginning of the range of sorted records
+ * @param[in] last end of the range of sorted records
+ *
+ * @return pmem::kv::status
+ */
+template <typename InputIt>
+inline status db::bulk_load(InputIt first, InputIt last) noexcept
+{
+	try {
+		return bulk_load([&](string_view &key, string_view &value) {
+			if (first == last)
+				return false;
+
+			key = first->first;
+			value = first->second;
+			++first;
+			return true;
+		});
+	} catch (std::bad_alloc &) {
+		return status::OUT_OF_MEMORY;
+	}
+}
+
+/**
+ * Writes all records of pmem::kv::db to file descriptor *fd*, in a binary
+ * format read by db::import_records(). Records are read by *nthreads* workers,
+ * as by db::get_all_parallel(); they are in order of keys only if an ordered
+ * engine is exported by a single worker. *fd* may be opened with O_DIRECT.
+ *
+ * @param[in] fd file descriptor opened for writing
+ * @param[in] nthreads number of workers, greater than 0
+ *
+ * @return pmem::kv::status
+ */
+inline status db::export_records(int fd, size_t nthreads) noexcept
+{
+	return static_cast<status>(pmemkv_export(this->_db, fd, nthreads));
+}
+
+/**
+ * Stores records read from file descriptor *fd*, written by db::export_records().
+ * Records in order of keys are bulk loaded, the ones following the first record
+ * out of order are put one by one.
+ *
+ * @param[in] fd file descriptor opened for reading
+ *
+ * @return pmem::kv::status; INVALID_ARGUMENT if the stream is not valid
+ */
+inline status db::import_records(int fd) noexcept
+{
+	return static_cast<status>(pmemkv_import(this->_db, fd));
+}
+
+/**
+ * Queues a put of *value* under *key*, to be executed by one of the workers of
+ * the database, and returns without waiting for it. Key and value are copied.
+ * When the put completes, (C-like) *callback* is called from the worker with its
+ * status and *arg*; *callback* may be nullptr if the status is not needed.
+ *
+ * Requests for the same key complete in the order they were queued. A worker
+ * applies consecutive puts queued to it with a single db::write(), so concurrent
+ * small writes are coalesced. The number of workers is set by the
+ * "async_threads" config item when the database is opened (1 by default); they
+ * are started by the first asynchronous request. db::close() completes all
+ * queued requests. Callbacks must not throw and should not block for long, as
+ * they hold up the following requests of the worker.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be stored under the key
+ * @param[in] callback function called with the status of the put, or nullptr
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status::OK if the put was queued, otherwise an error status,
+ * in which case callback is not called
+ */
+inline status db::put_async(string_view key, string_view value,
+			    put_async_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_put_async(this->_db, key.data(), key.size(),
+						    value.data(), value.size(),
+						    callback, arg));
+}
+
+/**
+ * Queues a put, as db::put_async(string_view, string_view, put_async_callback *,
+ * void *) does, and calls function *f* with its status when it completes.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be stored under the key
+ * @param[in] f function called with the status of the put
+ *
+ * @return pmem::kv::status::OK if the put was queued, otherwise an error status
+ */
+inline status db::put_async(string_view key, string_view value,
+			    std::function<put_async_function> f) noexcept
+{
+	std::function<put_async_function> *fp;
+	try {
+		fp = new std::function<put_async_function>(std::move(f));
+	} catch (std::bad_alloc &) {
+		return status::OUT_OF_MEMORY;
+	}
+
+	auto s = put_async(key, value, call_put_async_function, fp);
+	if (s != status::OK)
+		delete fp;
+
+	return s;
+}
+
+/**
+ * Queues a put, as db::put_async(string_view, string_view, put_async_callback *,
+ * void *) does, and returns a future of its status.
+ *
+ * @param[in] key record's key
+ * @param[in] value data to be stored under the key
+ *
+ * @throw std::bad_alloc if the promise cannot be allocated
+ *
+ * @return future status of the put, or of queueing it if that failed
+ */
+inline std::future<status> db::put_async(string_view key, string_view value)
+{
+	auto p = std::make_shared<std::promise<status>>();
+	auto s = put_async(key, value, [p](status s) { p->set_value(s); });
+	if (s != status::OK)
+		p->set_value(s);
+
+	return p->get_future();
+}
+
+/**
+ * Queues a get of the record with given *key*, as db::put_async() does for puts,
+ * and returns without waiting for it. (C-like) *callback* is called from the
+ * worker with status of the get, the value and *arg*. The value is valid only
+ * until the callback returns.
+ * This function is guaranteed to be implemented by all engines.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] callback function called with the status and the value
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status::OK if the get was queued, otherwise an error status,
+ * in which case callback is not called
+ */
+inline status db::get_async(string_view key, get_async_callback *callback,
+			    void *arg) noexcept
+{
+	return static_cast<status>(
+		pmemkv_get_async(this->_db, key.data(), key.size(), callback, arg));
+}
+
+/**
+ * Queues a get, as db::get_async(string_view, get_async_callback *, void *) does,
+ * and calls function *f* with its status and the value when it completes.
+ *
+ * @param[in] key record's key to query for
+ * @param[in] f function called with the status and the value
+ *
+ * @return pmem::kv::status::OK if the get was queued, otherwise an error status
+ */
+inline status db::get_async(string_view key,
+			    std::function<get_async_function> f) noexcept
+{
+	std::function<get_async_function> *fp;
+	try {
+		fp = new std::function<get_async_function>(std::move(f));
+	} catch (std::bad_alloc &) {
+		return status::OUT_OF_MEMORY;
+	}
+
+	auto s = get_async(key, call_get_async_function, fp);
+	if (s != status::OK)
+		delete fp;
+
+	return s;
+}
+
+/**
+ * Queues a get, as db::get_async(string_view, get_async_callback *, void *) does,
+ * and returns a future of its status. The value is copied to *value* before the
+ * future becomes ready.
+ *
+ * @param[in] key record's key to query for
+ * @param[out] value buffer for the value, has to stay valid until the future
+ *				is ready
+ *
+ * @throw std::bad_alloc if the promise cannot be allocated
+ *
+ * @return future status of the get, or of queueing it if that failed
+ */
+inline std::future<status> db::get_async(string_view key, std::string *value)
+{
+	auto p = std::make_shared<std::promise<status>>();
+	auto s = get_async(key, [p, value](status s, string_view v) {
+		if (s == status::OK)
+			value->assign(v.data(), v.size());
+		p->set_value(s);
+	});
+	if (s != status::OK)
+		p->set_value(s);
+
+	return p->get_future();
+}
+
+/**
+ * Defragments approximately 'amount_percent' percent of elements
+ * in the database starting from 'start_percent' percent of elements.
+ *
+ * @param[in] start_percent starting percent of elements to defragment from
+ * @param[in] amount_percent amount percent of elements to defragment
+ *
+ * @return pmem::kv::status
+ */
+inline status db::defrag(double start_percent, double amount_percent)
+
+{
+	return static_cast<status>(
+		pmemkv_defrag(this->_db, start_percent, amount_percent));
+}
+
+/**
+ * Makes all the changes made so far persistent. It is needed only for
+ * a database opened with "durability" config item set to "relaxed", where
+ * puts and removes are buffered in DRAM and written in the background every
+ * "flush_interval_ms" milliseconds; otherwise every write is persistent when
+ * it returns and this function does nothing. Changes not flushed before
+ * a crash are lost.
+ *
+ * @return pmem::kv::status
+ */
+inline status db::flush() noexcept
+{
+	return static_cast<status>(pmemkv_flush(this->_db));
+}
+
+/**
+ * Executes (C-like) *callback* for every change (put or remove) of pmem::kv::db
+ * with sequence number greater than *seq*, in order of sequence numbers. Changes
+ * are recorded only by engines with a change log, e.g. cmap with the
+ * "change_log_size" config item. Arguments passed to the callback are: sequence
+ * number, PMEMKV_CHANGE_PUT or PMEMKV_CHANGE_REMOVE, pointer to a key, size of
+ * the key, pointer to a value, size of the value and *arg*. Callback can stop
+ * iteration by returning non-zero value.
+ *
+ * @param[in] seq sequence number of the last change already seen, 0 for all
+ * @param[in] callback function to be called for every change
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status; NOT_FOUND if some of the changes are no longer in the log
+ */
+inline status db::changes_since(uint64_t seq, change_callback *callback,
+				void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_changes_since(this->_db, seq, callback, arg));
+}
+
+/**
+ * Executes function *f* for every change of pmem::kv::db with sequence number
+ * greater than *seq*. See db::changes_since(uint64_t, change_callback *, void *)
+ * for details.
+ *
+ * @param[in] seq sequence number of the last change already seen, 0 for all
+ * @param[in] f function called for every change
+ *
+ * @return pmem::kv::status
+ */
+inline status db::changes_since(uint64_t seq, std::function<change_function> f) noexcept
+{
+	return static_cast<status>(
+		pmemkv_changes_since(this->_db, seq, call_change_function, &f));
+}
+
+/**
+ * Returns statistics of operations called on this database, as a JSON object:
+ *
+ *	{"engine": "<name>", "operations": {"get": {...}, "put": {...},
+ *	 "remove": {...}, "range": {...}, "write": {...}}, "internals": {...}}
+ *
+ * Each operation has "count", "total_ns", "mean_ns", "max_ns", latency
+ * percentiles "p50_ns", "p90_ns", "p99_ns" and "p999_ns", and "histogram",
+ * the list of non-empty latency buckets, each with its upper bound "le_ns"
+ * and "count". Buckets grow exponentially and every power of two is split
+ * into 8 of them, so percentiles are accurate to within 12.5%.
+ *
+ * "get" covers exists, get, get_many and get_ref, "range" covers all count_*,
+ * get_* range queries and remove_range, "write" covers write and bulk_load.
+ * Iterators and defrag are not measured. Statistics are kept in memory only,
+ * they start from zero when the database is opened.
+ *
+ * "internals" holds structural metrics of the engine: numbers of "buckets" and
+ * "load_factor" of cmap, for stree numbers of "leaf_splits" and
+ * "inner_node_splits" since the database was opened, "depth", numbers of
+ * "leaves" and "inner_nodes" and "leaf_fill_factor", for tree3 numbers of
+ * "leaf_splits" and "inner_node_splits", "inner_depth" and number of
+ * "preallocated_leaves". It is empty for other engines. stree visits all its
+ * nodes to compute them, blocking writers meanwhile.
+ *
+ * @param[out] json statistics of the database
+ *
+ * @return pmem::kv::status
+ */
+inline status db::stats(std::string *json) noexcept
+{
+	return static_cast<status>(pmemkv_stats(this->_db, call_get_copy, json));
+}
+
+/**
+ * Sets all statistics returned by stats() back to zero, e.g. after warm-up
+ * phase of a benchmark. Operations running concurrently may or may not be
+ * counted.
+ *
+ * @return pmem::kv::status
+ */
+inline status db::stats_reset() noexcept
+{
+	return static_cast<status>(pmemkv_stats_reset(this->_db));
 }
 
 /**
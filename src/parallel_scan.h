@@ -0,0 +1,128 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_PARALLEL_SCAN_H
+#define LIBPMEMKV_PARALLEL_SCAN_H
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Calls f(worker, it) for every element of [first, last) from 'nthreads'
+ * workers, the calling thread being worker 0. The range is handed out in
+ * chunks of 'chunk_size' elements by a shared cursor, so it is walked only
+ * once and workers which got cheap elements simply take more chunks.
+ * Advancing a forward iterator is enough, which is all the persistent
+ * containers offer.
+ *
+ * f returns false to stop all the workers, STOPPED_BY_CB is returned then.
+ * An exception thrown by f is rethrown in the calling thread, once all
+ * the workers are joined. If no more threads can be started, the scan goes
+ * on with the ones already running.
+ */
+template <typename Iterator, typename Function>
+status parallel_for_each(size_t nthreads, Iterator first, Iterator last,
+			 size_t chunk_size, Function f)
+{
+	std::mutex cursor_lock;
+	std::atomic<bool> stopped(false);
+	std::exception_ptr error;
+	std::mutex error_lock;
+
+	auto worker = [&](size_t id) {
+		try {
+			while (!stopped.load(std::memory_order_relaxed)) {
+				Iterator begin, end;
+				{
+					std::lock_guard<std::mutex> guard(cursor_lock);
+					if (first == last)
+						return;
+
+					begin = first;
+					size_t n = 0;
+					do
+						++first;
+					while (++n < chunk_size && first != last);
+					end = first;
+				}
+
+				for (auto it = begin; it != end; ++it) {
+					if (!f(id, it)) {
+						stopped.store(true);
+						return;
+					}
+				}
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> guard(error_lock);
+			if (!error)
+				error = std::current_exception();
+			stopped.store(true);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(nthreads - 1);
+	try {
+		for (size_t id = 1; id < nthreads; ++id)
+			threads.emplace_back(worker, id);
+	} catch (std::system_error &) {
+	}
+
+	worker(0);
+	for (auto &t : threads)
+		t.join();
+
+	if (error)
+		std::rethrow_exception(error);
+
+	return stopped.load() ? status::STOPPED_BY_CB : status::OK;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PARALLEL_SCAN_H */
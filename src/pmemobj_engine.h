@@ -33,11 +33,17 @@
 #ifndef LIBPMEMKV_PMEMOBJ_ENGINE_H
 #define LIBPMEMKV_PMEMOBJ_ENGINE_H
 
+#include <initializer_list>
 #include <iostream>
+#include <memory>
 #include <unistd.h>
 
+#include "alloc_classes.h"
+#include "compression.h"
 #include "engine.h"
 #include "libpmemkv.h"
+#include "prefault.h"
+#include <libpmemobj++/p.hpp>
 #include <libpmemobj++/pool.hpp>
 
 namespace pmem
@@ -54,18 +60,81 @@ static inline void check_outside_tx()
 namespace kv
 {
 
+/* pool opened by pmemobj_engine_base::open_pool() and the engine's root object */
+struct pmemobj_pool_ref {
+	pmem::obj::pool_base pop;
+	PMEMoid *oid;
+	bool by_path;
+	/* set when the engine is closed, nullptr if the pool is given by oid */
+	pmem::obj::p<uint64_t> *clean_shutdown = nullptr;
+	/* root of the change log, nullptr if the pool is given by oid */
+	PMEMoid *change_log = nullptr;
+	/* compression of values, nullptr if the pool is given by oid */
+	pmem::obj::p<uint64_t> *compression = nullptr;
+	/* whether values carry their expiry time, nullptr if the pool is given by oid */
+	pmem::obj::p<uint64_t> *ttl = nullptr;
+	/* saved image of volatile structures, nullptr if the pool is given by oid */
+	PMEMoid *image = nullptr;
+	/* log of the write batch being applied, nullptr if the pool is given by oid */
+	PMEMoid *batch_log = nullptr;
+	/* set by the "read_only" config item */
+	bool read_only = false;
+};
+
 template <typename EngineData>
 class pmemobj_engine_base : public engine_base {
 public:
 	pmemobj_engine_base(std::unique_ptr<internal::config> &cfg)
+	    : pmemobj_engine_base(open_pool(cfg))
+	{
+	}
+
+	pmemobj_engine_base(const pmemobj_pool_ref &ref)
+	    : pmpool(ref.pop),
+	      root_oid(ref.oid),
+	      cfg_by_path(ref.by_path),
+	      change_log_oid(ref.change_log),
+	      image_oid(ref.image),
+	      batch_log_oid(ref.batch_log),
+	      read_only(ref.read_only),
+	      clean_shutdown(ref.clean_shutdown),
+	      compression(ref.compression),
+	      ttl(ref.ttl)
+	{
+		previous_shutdown_clean =
+			clean_shutdown && clean_shutdown->get_ro() != 0;
+	}
+
+	~pmemobj_engine_base()
+	{
+		if (clean_shutdown && opened) {
+			clean_shutdown->get_rw() = 1;
+			pmpool.persist(*clean_shutdown);
+		}
+		if (cfg_by_path)
+			pmpool.close();
+	}
+
+	/**
+	 * Opens (or creates) the pool given in the config. Engines which have to look
+	 * at their root object before they are constructed, may call it directly.
+	 * The pool has to be closed by the caller, if it is opened by path and
+	 * the engine is not constructed.
+	 */
+	static pmemobj_pool_ref open_pool(std::unique_ptr<internal::config> &cfg)
 	{
 		const char *path = nullptr;
 		std::size_t size;
 		PMEMoid *oid;
+		pmemobj_pool_ref ref;
 
 		auto is_path = cfg->get_string("path", &path);
 		auto is_oid = cfg->get_object("oid", (void **)&oid);
 
+		uint64_t read_only;
+		if (cfg->get_uint64("read_only", &read_only))
+			ref.read_only = read_only != 0;
+
 		if (is_path && is_oid) {
 			throw internal::invalid_argument(
 				"Config contains both: \"path\" and \"oid\"");
@@ -74,14 +143,18 @@ public:
 				"Config does not contain item with key: \"path\" or \"oid\"");
 		} else if (is_path) {
 			uint64_t force_create;
-			cfg_by_path = true;
+			ref.by_path = true;
 
 			if (!cfg->get_uint64("force_create", &force_create)) {
 				force_create = 0;
 			}
 
 			pmem::obj::pool<Root> pop;
-			if (force_create) {
+			internal::pool_prefault prefault(*cfg, path);
+			if (force_create && ref.read_only) {
+				throw internal::invalid_argument(
+					"Config items \"force_create\" and \"read_only\" cannot be both set");
+			} else if (force_create) {
 				if (!cfg->get_uint64("size", &size))
 					throw internal::invalid_argument(
 						"Config does not contain item with key: \"size\"");
@@ -91,32 +164,214 @@ public:
 			} else {
 				pop = pmem::obj::pool<Root>::open(path, LAYOUT);
 			}
+			prefault.touch(pop.handle());
 
-			root_oid = pop.root()->ptr.raw_ptr();
-			pmpool = pop;
+			set_growth_granularity(cfg, pop);
 
-		} else if (is_oid) {
-			pmpool = pmem::obj::pool_base(pmemobj_pool_by_ptr(oid));
-			root_oid = oid;
+			ref.oid = pop.root()->ptr.raw_ptr();
+			ref.clean_shutdown = &pop.root()->clean_shutdown;
+			ref.change_log = &pop.root()->change_log;
+			ref.compression = &pop.root()->compression;
+			ref.ttl = &pop.root()->ttl;
+			ref.image = &pop.root()->image;
+			ref.batch_log = &pop.root()->batch_log;
+			ref.pop = pop;
+		} else {
+			ref.pop = pmem::obj::pool_base(pmemobj_pool_by_ptr(oid));
+			ref.oid = oid;
+			ref.by_path = false;
 		}
+
+		return ref;
 	}
 
-	~pmemobj_engine_base()
+protected:
+	/*
+	 * Pools defined by a poolset with directories grow by a new file of
+	 * "growth_granularity" bytes, whenever they run out of space.
+	 */
+	static void set_growth_granularity(std::unique_ptr<internal::config> &cfg,
+					   pmem::obj::pool_base &pop)
 	{
-		if (cfg_by_path)
-			pmpool.close();
+		uint64_t granularity;
+		if (!cfg->get_uint64("growth_granularity", &granularity))
+			return;
+
+		if (pmemobj_ctl_set(pop.handle(), "heap.size.granularity",
+				    &granularity) != 0) {
+			pop.close();
+			throw internal::invalid_argument(
+				"Config item \"growth_granularity\" cannot be set: " +
+				std::string(pmemobj_errormsg()));
+		}
 	}
 
-protected:
 	struct Root {
 		pmem::obj::persistent_ptr<EngineData>
 			ptr; /* used when path is specified */
+		/*
+		 * Non-zero if the engine was closed, zero while it is open or after
+		 * a crash. Pools created by older versions have a smaller root object,
+		 * which libpmemobj extends with zeros.
+		 */
+		pmem::obj::p<uint64_t> clean_shutdown;
+		/* see change_log.h, null if the engine records no changes */
+		PMEMoid change_log;
+		/* kind of value_codec, used by engines supporting compression */
+		pmem::obj::p<uint64_t> compression;
+		/* non-zero if stored values start with their expiry time (cmap) */
+		pmem::obj::p<uint64_t> ttl;
+		/* saved on close by engines rebuilding volatile structures (tree3) */
+		PMEMoid image;
+		/* see batch_log.h, null unless a write batch is being applied */
+		PMEMoid batch_log;
 	};
 
 	pmem::obj::pool_base pmpool;
 	PMEMoid *root_oid;
 
 	bool cfg_by_path = false;
+	PMEMoid *change_log_oid;
+	/* true if the engine was closed cleanly, last time the pool was used */
+	bool previous_shutdown_clean = false;
+	/* see Root::image, nullptr if the pool is given by oid */
+	PMEMoid *image_oid;
+	/* see Root::batch_log, nullptr if the pool is given by oid */
+	PMEMoid *batch_log_oid;
+	/*
+	 * Set by the "read_only" config item: the engine must not write to the pool.
+	 * libpmemobj still locks the pool file and rolls back transactions at open,
+	 * so the pool is not shared with other processes.
+	 */
+	bool read_only;
+
+	/* Throws for operations which write to the pool, if it is opened read-only */
+	void check_writable()
+	{
+		if (read_only)
+			throw internal::not_supported(
+				"Operation is not supported in read-only mode");
+	}
+
+	/* Called by engines which cannot be opened without writing to the pool */
+	void reject_read_only()
+	{
+		if (read_only)
+			throw internal::not_supported(
+				"Read-only mode is not supported by the " + name() +
+				" engine");
+	}
+
+	/**
+	 * Marks the pool as in use, until the engine is closed. Engines which rely
+	 * on previous_shutdown_clean call it at the end of their constructor, so
+	 * a failed open does not change the flag.
+	 */
+	void mark_opened()
+	{
+		if (!clean_shutdown || read_only)
+			return;
+
+		clean_shutdown->get_rw() = 0;
+		pmpool.persist(*clean_shutdown);
+		opened = true;
+	}
+
+	/**
+	 * Sets up the codec of values for engines supporting compression. The
+	 * configured kind (see value_codec::from_config()) is used if the engine
+	 * data is being created, existing data always keeps the compression it was
+	 * created with.
+	 */
+	void init_compression(uint64_t kind, bool created)
+	{
+		if (created) {
+			if (kind != internal::value_codec::NONE && !compression)
+				throw internal::invalid_argument(
+					"Compression can be enabled only in a pool given by path");
+			if (compression && !read_only) {
+				compression->get_rw() = kind;
+				pmpool.persist(*compression);
+			}
+		}
+
+		if (compression)
+			codec.set_kind(compression->get_ro());
+	}
+
+	/**
+	 * Tells whether stored values start with their expiry time, for engines
+	 * supporting TTL. As with compression, it is chosen when the engine data is
+	 * created and kept by the pool.
+	 */
+	bool init_ttl(bool enable, bool created)
+	{
+		if (created) {
+			if (enable && !ttl)
+				throw internal::invalid_argument(
+					"TTL can be enabled only in a pool given by path");
+			if (ttl) {
+				ttl->get_rw() = enable ? 1 : 0;
+				pmpool.persist(*ttl);
+			}
+		}
+
+		return ttl && ttl->get_ro() != 0;
+	}
+
+	/**
+	 * Sets up the allocation classes of the engine: one for each of the given
+	 * sizes of objects of its layout and for the sizes hinted by the
+	 * "alloc_class_sizes" config item (see alloc_classes). Also creates the
+	 * arenas of the "arenas" config item, which libpmemobj assigns to threads
+	 * along with its automatic ones, so fewer threads share an arena.
+	 */
+	void init_allocator(internal::config &cfg, std::initializer_list<size_t> sizes)
+	{
+		alloc = internal::alloc_classes::of(pmpool.handle());
+
+		/* classes of the layout only save space, the defaults are still fine */
+		for (size_t size : sizes)
+			alloc->add(size);
+
+		for (size_t size : internal::alloc_classes::from_config(cfg)) {
+			if (!alloc->add(size))
+				throw internal::invalid_argument(
+					"Allocation class for objects of " +
+					std::to_string(size) +
+					" bytes cannot be registered: " +
+					std::string(pmemobj_errormsg()));
+		}
+
+		uint64_t arenas;
+		if (!cfg.get_uint64("arenas", &arenas))
+			return;
+
+		PMEMobjpool *pop = pmpool.handle();
+		for (uint64_t i = 0; i < arenas; i++) {
+			unsigned id;
+			int automatic = 1;
+			if (pmemobj_ctl_exec(pop, "heap.arena.create", &id) != 0)
+				throw internal::invalid_argument(
+					"Config item \"arenas\" cannot be set: " +
+					std::string(pmemobj_errormsg()));
+
+			std::string name =
+				"heap.arena." + std::to_string(id) + ".automatic";
+			pmemobj_ctl_set(pop, name.c_str(), &automatic);
+		}
+	}
+
+	internal::value_codec codec;
+
+	/* allocation classes of the pool, set up by init_allocator() */
+	std::shared_ptr<internal::alloc_classes> alloc;
+
+private:
+	pmem::obj::p<uint64_t> *clean_shutdown;
+	pmem::obj::p<uint64_t> *compression;
+	pmem::obj::p<uint64_t> *ttl;
+	bool opened = false;
 };
 
 } /* namespace kv */
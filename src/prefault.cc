@@ -0,0 +1,151 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "prefault.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* part of the pool touched by a thread at a time */
+static const size_t CHUNK_SIZE = 2 * 1024 * 1024;
+
+static const char POOLSET_SIGNATURE[] = "PMEMPOOLSET";
+
+/* prefault ctls of libpmemobj are global, so concurrent opens take turns */
+static std::mutex ctl_mtx;
+
+static bool is_poolset(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	char signature[sizeof(POOLSET_SIGNATURE) - 1];
+	bool result = read(fd, signature, sizeof(signature)) ==
+			static_cast<ssize_t>(sizeof(signature)) &&
+		memcmp(signature, POOLSET_SIGNATURE, sizeof(signature)) == 0;
+	close(fd);
+	return result;
+}
+
+pool_prefault::pool_prefault(config &cfg, const char *path) : path(path)
+{
+	uint64_t enabled = 0;
+	cfg.get_uint64("prefault", &enabled);
+	if (!enabled)
+		return;
+
+	uint64_t configured;
+	if (cfg.get_uint64("prefault_threads", &configured)) {
+		if (configured == 0)
+			throw internal::invalid_argument(
+				"Config item \"prefault_threads\" has to be greater than 0");
+		threads = static_cast<size_t>(configured);
+	} else {
+		threads = std::max(1U, std::thread::hardware_concurrency());
+	}
+
+	/* a file which does not exist yet is created as a single file */
+	struct stat st;
+	if (stat(path, &st) != 0 || (S_ISREG(st.st_mode) && !is_poolset(path)))
+		return;
+
+	threads = 0;
+	ctl_lock = std::unique_lock<std::mutex>(ctl_mtx);
+	pmemobj_ctl_get(nullptr, "prefault.at_open", &previous_at_open);
+	pmemobj_ctl_get(nullptr, "prefault.at_create", &previous_at_create);
+	set_ctl(1, 1);
+}
+
+pool_prefault::~pool_prefault()
+{
+	if (ctl_set)
+		set_ctl(previous_at_open, previous_at_create);
+}
+
+void pool_prefault::set_ctl(int at_open, int at_create)
+{
+	if (pmemobj_ctl_set(nullptr, "prefault.at_open", &at_open) != 0 ||
+	    pmemobj_ctl_set(nullptr, "prefault.at_create", &at_create) != 0)
+		throw internal::invalid_argument(
+			"Config item \"prefault\" cannot be set: " +
+			std::string(pmemobj_errormsg()));
+	ctl_set = true;
+}
+
+void pool_prefault::touch(PMEMobjpool *pop)
+{
+	struct stat st;
+	if (threads == 0 || stat(path, &st) != 0 || st.st_size <= 0)
+		return;
+
+	/* a pool in a single file is mapped as a whole, starting at its handle */
+	auto base = reinterpret_cast<volatile char *>(pop);
+	const size_t size = static_cast<size_t>(st.st_size);
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	std::atomic<size_t> next(0);
+	auto worker = [&] {
+		for (size_t c = next++; c < chunks; c = next++) {
+			size_t end = std::min(size, (c + 1) * CHUNK_SIZE);
+			for (size_t off = c * CHUNK_SIZE; off < end; off += page)
+				base[off] = base[off];
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < std::min(threads, chunks); i++)
+		workers.emplace_back(worker);
+	worker();
+	for (auto &t : workers)
+		t.join();
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
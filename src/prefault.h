@@ -0,0 +1,89 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_PREFAULT_H
+#define LIBPMEMKV_PREFAULT_H
+
+#include <cstddef>
+#include <mutex>
+
+#include "config.h"
+#include <libpmemobj.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Prefaulting of a pool opened by path, selected by the "prefault" config item.
+ * Every page of the pool is touched when it is opened, so the first accesses
+ * after a restart do not take a page fault each. A pool in a single file is
+ * touched by "prefault_threads" threads in parallel, one byte per page, which is
+ * read and written back. Pools defined by a poolset and device DAX are
+ * prefaulted by libpmemobj instead ("prefault.at_open" ctl), as their mappings
+ * are not known here.
+ *
+ * libpmemobj maps pools at addresses aligned to 2MB, so on a filesystem
+ * supporting it and on device DAX, pages are mapped by huge pages and fewer
+ * faults are taken.
+ */
+class pool_prefault {
+public:
+	/* has to be constructed before the pool is opened or created */
+	pool_prefault(config &cfg, const char *path);
+	~pool_prefault();
+
+	pool_prefault(const pool_prefault &) = delete;
+	pool_prefault &operator=(const pool_prefault &) = delete;
+
+	/* touches the pages of the just opened pool, unless libpmemobj did it */
+	void touch(PMEMobjpool *pop);
+
+private:
+	void set_ctl(int at_open, int at_create);
+
+	const char *path;
+	std::size_t threads = 0; /* 0 if the pool is not touched */
+	bool ctl_set = false;
+	int previous_at_open = 0;
+	int previous_at_create = 0;
+	std::unique_lock<std::mutex> ctl_lock;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PREFAULT_H */
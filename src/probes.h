@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_PROBES_H
+#define LIBPMEMKV_PROBES_H
+
+/*
+ * USDT (SystemTap) static probes of provider "pmemkv", built in with the USDT
+ * CMake option. Until a tracer (e.g. bpftrace or SystemTap) attaches to it,
+ * a probe is a single nop, so they may be enabled in production builds:
+ *
+ *	bpftrace -e 'usdt:/usr/lib64/libpmemkv.so:pmemkv:get__entry
+ *		{ printf("%s\n", str(arg1, arg2)); }'
+ *
+ * Probes of operations of the C API (and so of the C++ API too):
+ *	{get,put,remove,range,write}__entry(db, key, key_size), where key is null
+ *		for operations which are not given a single key
+ *	{get,put,remove,range,write}__return(db)
+ * and of engine internals:
+ *	group__commit__entry(puts), group__commit__return(puts) (cmap)
+ *	leaf__split__entry(), leaf__split__return() (stree and tree3)
+ *	remote__fetch__entry(key, key_size), remote__fetch__return(found) (caching)
+ *
+ * Without the USDT option the macros expand to nothing but a cast of their
+ * arguments to void.
+ */
+#ifdef USDT
+
+#include <sys/sdt.h>
+
+#define PMEMKV_PROBE(name) DTRACE_PROBE(pmemkv, name)
+#define PMEMKV_PROBE1(name, a) DTRACE_PROBE1(pmemkv, name, a)
+#define PMEMKV_PROBE2(name, a, b) DTRACE_PROBE2(pmemkv, name, a, b)
+#define PMEMKV_PROBE3(name, a, b, c) DTRACE_PROBE3(pmemkv, name, a, b, c)
+
+#else
+
+#define PMEMKV_PROBE(name)                                                               \
+	do {                                                                             \
+	} while (0)
+#define PMEMKV_PROBE1(name, a)                                                           \
+	do {                                                                             \
+		(void)(a);                                                               \
+	} while (0)
+#define PMEMKV_PROBE2(name, a, b)                                                        \
+	do {                                                                             \
+		(void)(a);                                                               \
+		(void)(b);                                                               \
+	} while (0)
+#define PMEMKV_PROBE3(name, a, b, c)                                                     \
+	do {                                                                             \
+		(void)(a);                                                               \
+		(void)(b);                                                               \
+		(void)(c);                                                               \
+	} while (0)
+
+#endif /* USDT */
+
+#endif /* LIBPMEMKV_PROBES_H */
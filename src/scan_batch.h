@@ -0,0 +1,175 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_SCAN_BATCH_H
+#define LIBPMEMKV_SCAN_BATCH_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Records of engine_base::scan(), which are passed to the user callback in
+ * batches. Engines feed candidate records with push(): the key prefix and
+ * the limit are checked here, so a scan stops as soon as push() returns false.
+ *
+ * Records are only pointed to, unless the batch is created with 'copy' set:
+ * engines which hand out temporary data in their callbacks (as they are
+ * allowed to, e.g. in get_all()) have to use that.
+ */
+class scan_batch {
+public:
+	scan_batch(string_view prefix, size_t limit, size_t batch_size,
+		   scan_callback *callback, void *arg, bool copy)
+	    : prefix(prefix),
+	      limit(limit),
+	      batch_size(batch_size),
+	      callback(callback),
+	      arg(arg),
+	      copy(copy)
+	{
+		keys.reserve(batch_size);
+		keybytes.reserve(batch_size);
+		values.reserve(batch_size);
+		valuebytes.reserve(batch_size);
+	}
+
+	bool matches(const char *key, size_t keybytes) const
+	{
+		return keybytes >= prefix.size() &&
+			memcmp(key, prefix.data(), prefix.size()) == 0;
+	}
+
+	bool matches(string_view key) const
+	{
+		return matches(key.data(), key.size());
+	}
+
+	/*
+	 * Adds the record to the batch, if its key matches the prefix. Returns
+	 * false when the scan is over: the limit is reached or the callback
+	 * asked to stop.
+	 */
+	bool push(string_view key, string_view value)
+	{
+		if (!matches(key))
+			return true;
+
+		if (copy) {
+			/* pointers are set in flush(), the buffer may grow until then */
+			keys.push_back(nullptr);
+			values.push_back(nullptr);
+			buffer.append(key.data(), key.size());
+			buffer.append(value.data(), value.size());
+		} else {
+			keys.push_back(key.data());
+			values.push_back(value.data());
+		}
+		keybytes.push_back(key.size());
+		valuebytes.push_back(value.size());
+
+		if (keys.size() == batch_size && !flush())
+			return false;
+
+		return limit == 0 || ++count < limit;
+	}
+
+	/*
+	 * Passes the remaining records to the callback and returns status of
+	 * the scan, given status of the engine's iteration, which was stopped
+	 * by push() returning false.
+	 */
+	status finish(status s)
+	{
+		if (s != status::OK && s != status::STOPPED_BY_CB)
+			return s;
+		if (!stopped && !keys.empty())
+			flush();
+
+		return stopped ? status::STOPPED_BY_CB : status::OK;
+	}
+
+private:
+	bool flush()
+	{
+		if (copy) {
+			const char *p = buffer.data();
+			for (size_t i = 0; i < keys.size(); i++) {
+				keys[i] = p;
+				values[i] = p + keybytes[i];
+				p += keybytes[i] + valuebytes[i];
+			}
+		}
+
+		stopped = callback(keys.size(), keys.data(), keybytes.data(),
+				   values.data(), valuebytes.data(), arg) != 0;
+
+		keys.clear();
+		keybytes.clear();
+		values.clear();
+		valuebytes.clear();
+		buffer.clear();
+
+		return !stopped;
+	}
+
+	string_view prefix;
+	/* maximal number of records, 0 if there is no limit */
+	size_t limit;
+	size_t count = 0;
+	size_t batch_size;
+	scan_callback *callback;
+	void *arg;
+	bool copy;
+	bool stopped = false;
+
+	std::vector<const char *> keys;
+	std::vector<size_t> keybytes;
+	std::vector<const char *> values;
+	std::vector<size_t> valuebytes;
+	std::string buffer;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_SCAN_BATCH_H */
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+static const char *op_names[stats::OPS] = {"get", "put", "remove", "range", "write"};
+
+/* percentiles reported for every operation, in per mille */
+static const uint64_t percentiles[] = {500, 900, 990, 999};
+static const char *percentile_names[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+
+constexpr size_t stats::OPS;
+constexpr size_t stats::SHARDS;
+constexpr size_t stats::SUB_BUCKETS;
+constexpr size_t stats::BUCKETS;
+
+stats::stats() : shards(new shard[SHARDS]())
+{
+}
+
+void stats::record(op o, uint64_t latency_ns)
+{
+	auto &h = local_shard().ops[static_cast<size_t>(o)];
+
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.total_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+	h.buckets[bucket_index(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+
+	auto max = h.max_ns.load(std::memory_order_relaxed);
+	while (latency_ns > max &&
+	       !h.max_ns.compare_exchange_weak(max, latency_ns,
+					       std::memory_order_relaxed))
+		;
+}
+
+std::string stats::to_json() const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+	writer.StartObject();
+	for (size_t i = 0; i < OPS; i++) {
+		uint64_t count = 0, total_ns = 0, max_ns = 0;
+		uint64_t buckets[BUCKETS] = {0};
+
+		for (size_t s = 0; s < SHARDS; s++) {
+			auto &h = shards[s].ops[i];
+			count += h.count.load(std::memory_order_relaxed);
+			total_ns += h.total_ns.load(std::memory_order_relaxed);
+			max_ns = std::max(max_ns,
+					  h.max_ns.load(std::memory_order_relaxed));
+			for (size_t b = 0; b < BUCKETS; b++)
+				buckets[b] += h.buckets[b].load(
+					std::memory_order_relaxed);
+		}
+
+		writer.Key(op_names[i]);
+		writer.StartObject();
+		writer.Key("count");
+		writer.Uint64(count);
+		writer.Key("total_ns");
+		writer.Uint64(total_ns);
+		writer.Key("mean_ns");
+		writer.Uint64(count ? total_ns / count : 0);
+		writer.Key("max_ns");
+		writer.Uint64(max_ns);
+
+		/* a percentile is reported as the upper bound of its bucket */
+		size_t cursor = 0;
+		uint64_t seen = 0;
+		for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]);
+		     p++) {
+			uint64_t rank = std::max<uint64_t>(
+				(count * percentiles[p] + 999) / 1000, 1);
+			while (cursor < BUCKETS - 1 && seen + buckets[cursor] < rank)
+				seen += buckets[cursor++];
+			writer.Key(percentile_names[p]);
+			writer.Uint64(count ? std::min(bucket_upper_bound(cursor), max_ns)
+					    : 0);
+		}
+
+		/* only non-empty buckets are listed */
+		writer.Key("histogram");
+		writer.StartArray();
+		for (size_t b = 0; b < BUCKETS; b++) {
+			if (!buckets[b])
+				continue;
+			writer.StartObject();
+			writer.Key("le_ns");
+			writer.Uint64(std::min(bucket_upper_bound(b), max_ns));
+			writer.Key("count");
+			writer.Uint64(buckets[b]);
+			writer.EndObject();
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndObject();
+
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void stats::reset()
+{
+	for (size_t s = 0; s < SHARDS; s++) {
+		for (auto &h : shards[s].ops) {
+			h.count.store(0, std::memory_order_relaxed);
+			h.total_ns.store(0, std::memory_order_relaxed);
+			h.max_ns.store(0, std::memory_order_relaxed);
+			for (auto &b : h.buckets)
+				b.store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+size_t stats::bucket_index(uint64_t latency_ns)
+{
+	if (latency_ns < SUB_BUCKETS)
+		return static_cast<size_t>(latency_ns);
+
+	/* position of the highest set bit selects the power of two */
+	auto exponent = static_cast<unsigned>(63 - __builtin_clzll(latency_ns));
+	if (exponent >= MAX_EXPONENT)
+		return BUCKETS - 1;
+
+	auto sub_bucket =
+		(latency_ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+		static_cast<size_t>(sub_bucket);
+}
+
+uint64_t stats::bucket_upper_bound(size_t index)
+{
+	if (index < SUB_BUCKETS)
+		return index;
+	if (index >= BUCKETS - 1)
+		return UINT64_MAX;
+
+	auto shift = index / SUB_BUCKETS - 1;
+	uint64_t lower = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+
+	return lower + (uint64_t(1) << shift) - 1;
+}
+
+stats::shard &stats::local_shard()
+{
+	static std::atomic<size_t> threads(0);
+	static thread_local size_t id =
+		threads.fetch_add(1, std::memory_order_relaxed);
+
+	return shards[id % SHARDS];
+}
+
+void engine_metrics::add(const std::string &name, uint64_t value)
+{
+	values.push_back(metric{name, false, value, 0});
+}
+
+void engine_metrics::add(const std::string &name, double value)
+{
+	values.push_back(metric{name, true, 0, value});
+}
+
+void engine_metrics::add(const std::string &prefix, const engine_metrics &other)
+{
+	for (auto &v : other.values)
+		values.push_back(metric{prefix + v.name, v.is_double, v.integer, v.real});
+}
+
+std::string engine_metrics::to_json() const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+	writer.StartObject();
+	for (auto &v : values) {
+		writer.Key(v.name.c_str(),
+			   static_cast<rapidjson::SizeType>(v.name.size()));
+		if (!v.is_double)
+			writer.Uint64(v.integer);
+		/* JSON has no representation of NaN and infinities */
+		else if (std::isfinite(v.real))
+			writer.Double(v.real);
+		else
+			writer.Null();
+	}
+	writer.EndObject();
+
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
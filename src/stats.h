@@ -0,0 +1,166 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_STATS_H
+#define LIBPMEMKV_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Per-operation counters and latency histograms of a single database.
+ *
+ * Every thread records into one of SHARDS shards, with relaxed atomic
+ * increments only, so recording never takes a lock and threads rarely write to
+ * the same cache lines. Shards are summed up when statistics are read.
+ *
+ * Latencies are kept in log-linear (HDR-style) buckets: values below
+ * SUB_BUCKETS nanoseconds have a bucket each, and every power of two above
+ * is split into SUB_BUCKETS equal buckets, which bounds the relative error
+ * of reported percentiles to 1/SUB_BUCKETS.
+ */
+class stats {
+public:
+	enum class op { GET, PUT, REMOVE, RANGE, WRITE };
+
+	static constexpr size_t OPS = 5;
+
+	/*
+	 * Measures time from its construction to its destruction and records it
+	 * as latency of a single operation.
+	 */
+	class timer {
+	public:
+		timer(stats &s, op o)
+		    : s(s), o(o), start(std::chrono::steady_clock::now())
+		{
+		}
+
+		~timer()
+		{
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			s.record(o,
+				 static_cast<uint64_t>(
+					 std::chrono::duration_cast<
+						 std::chrono::nanoseconds>(elapsed)
+						 .count()));
+		}
+
+		timer(const timer &) = delete;
+		timer &operator=(const timer &) = delete;
+
+	private:
+		stats &s;
+		op o;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	stats();
+
+	void record(op o, uint64_t latency_ns);
+
+	/* returns all counters and histograms as a JSON object */
+	std::string to_json() const;
+
+	void reset();
+
+private:
+	static constexpr size_t SHARDS = 8;
+	static constexpr unsigned SUB_BUCKET_BITS = 3;
+	static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+	/* latencies of 2^MAX_EXPONENT ns (about 18 minutes) or more share a bucket */
+	static constexpr unsigned MAX_EXPONENT = 40;
+	static constexpr size_t BUCKETS =
+		(MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	struct histogram {
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> total_ns;
+		std::atomic<uint64_t> max_ns;
+		std::atomic<uint64_t> buckets[BUCKETS];
+	};
+
+	struct shard {
+		histogram ops[OPS];
+	};
+
+	static size_t bucket_index(uint64_t latency_ns);
+	static uint64_t bucket_upper_bound(size_t index);
+
+	shard &local_shard();
+
+	std::unique_ptr<shard[]> shards;
+};
+
+/*
+ * Structural metrics of an engine (e.g. numbers of node splits, fill factor of
+ * nodes), reported by pmemkv_stats() next to statistics of operations.
+ */
+class engine_metrics {
+public:
+	void add(const std::string &name, uint64_t value);
+	void add(const std::string &name, double value);
+	/* adds all metrics of other, with names prefixed by prefix */
+	void add(const std::string &prefix, const engine_metrics &other);
+
+	/* returns all metrics, in the order they were added, as a JSON object */
+	std::string to_json() const;
+
+private:
+	struct metric {
+		std::string name;
+		bool is_double;
+		uint64_t integer;
+		double real;
+	};
+
+	std::vector<metric> values;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_STATS_H */
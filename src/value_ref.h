@@ -0,0 +1,119 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_VALUE_REF_H
+#define LIBPMEMKV_VALUE_REF_H
+
+#include <memory>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Value returned by engine_base::get_ref(), which points directly to the
+ * engine's data. The engine may attach a pin (e.g. a held lock), which keeps
+ * the value in place until the reference is released. Pins are kept after
+ * release, so that an engine can reuse them for the next lookup.
+ */
+class value_ref {
+public:
+	class pin {
+	public:
+		virtual ~pin() = default;
+
+		/* lets the pinned value be modified again */
+		virtual void release() = 0;
+	};
+
+	value_ref() = default;
+
+	value_ref(const value_ref &) = delete;
+	value_ref &operator=(const value_ref &) = delete;
+
+	~value_ref()
+	{
+		release();
+	}
+
+	/*
+	 * Releases the current value and returns a pin of type T, which can be
+	 * used for the next one: either the previous pin, if it was also of type
+	 * T, or a new one.
+	 */
+	template <typename T>
+	T &reset_pin()
+	{
+		release();
+		T *p = dynamic_cast<T *>(_pin.get());
+		if (p == nullptr) {
+			p = new T();
+			_pin.reset(p);
+		}
+		pinned = true;
+		return *p;
+	}
+
+	void set(string_view v)
+	{
+		_value = v;
+	}
+
+	string_view value() const
+	{
+		return _value;
+	}
+
+	void release()
+	{
+		if (pinned)
+			_pin->release();
+		pinned = false;
+		_value = string_view();
+	}
+
+private:
+	std::unique_ptr<pin> _pin;
+	bool pinned = false;
+	string_view _value;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_VALUE_REF_H */
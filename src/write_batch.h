@@ -0,0 +1,97 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_WRITE_BATCH_H
+#define LIBPMEMKV_WRITE_BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * List of puts and removes which are applied to an engine by a single call to
+ * engine_base::write(). Keys and values are copied when added to the batch.
+ */
+class write_batch {
+public:
+	enum class op_type { PUT, REMOVE };
+
+	struct operation {
+		op_type type;
+		std::string key;
+		std::string value;
+	};
+
+	void put(string_view key, string_view value)
+	{
+		ops.push_back({op_type::PUT, std::string(key.data(), key.size()),
+			       std::string(value.data(), value.size())});
+	}
+
+	void remove(string_view key)
+	{
+		ops.push_back(
+			{op_type::REMOVE, std::string(key.data(), key.size()), ""});
+	}
+
+	void clear()
+	{
+		ops.clear();
+	}
+
+	size_t size() const
+	{
+		return ops.size();
+	}
+
+	const std::vector<operation> &operations() const
+	{
+		return ops;
+	}
+
+private:
+	std::vector<operation> ops;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_WRITE_BATCH_H */
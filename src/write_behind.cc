@@ -0,0 +1,509 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "write_behind.h"
+#include "exceptions.h"
+#include "out.h"
+
+#include <iostream>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+write_behind::write_behind(std::unique_ptr<engine_base> engine,
+			   uint64_t flush_interval_ms, uint64_t max_bytes)
+    : engine(std::move(engine)),
+      max_bytes(static_cast<std::size_t>(max_bytes)),
+      pending_bytes(0),
+      flushes(0),
+      stopped(false)
+{
+	if (flush_interval_ms)
+		flusher = std::thread([this, flush_interval_ms] {
+			background_flush(std::chrono::milliseconds(flush_interval_ms));
+		});
+
+	LOG("Started ok");
+}
+
+write_behind::~write_behind()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopped = true;
+	}
+	cv.notify_one();
+	if (flusher.joinable())
+		flusher.join();
+
+	try {
+		auto s = flush();
+		if (s != status::OK)
+			ERR() << "Flushing buffered changes failed";
+	} catch (const std::exception &exc) {
+		ERR() << exc.what();
+	} catch (...) {
+		ERR() << "Unspecified failure";
+	}
+
+	LOG("Stopped ok");
+}
+
+std::string write_behind::name()
+{
+	return engine->name();
+}
+
+void write_behind::background_flush(std::chrono::milliseconds interval)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!stopped) {
+		cv.wait_for(lock, interval);
+		if (stopped || pending.empty())
+			continue;
+
+		lock.unlock();
+		try {
+			/* changes which failed to be written stay buffered */
+			flush();
+		} catch (...) {
+		}
+		lock.lock();
+	}
+}
+
+status write_behind::flush()
+{
+	std::lock_guard<std::mutex> flush_lock(flush_mtx);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (pending.empty())
+			return status::OK;
+
+		flushing.swap(pending);
+		pending_bytes = 0;
+	}
+
+	write_batch batch;
+	for (auto &c : flushing) {
+		if (c.second.removed)
+			batch.remove(c.first);
+		else
+			batch.put(c.first, c.second.value);
+	}
+
+	/* on failure changes are buffered again, unless changed meanwhile */
+	auto restore = [&] {
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto &c : flushing) {
+			if (pending.count(c.first))
+				continue;
+			pending_bytes += c.first.size() + c.second.value.size();
+			pending.emplace(c.first, std::move(c.second));
+		}
+		flushing.clear();
+	};
+
+	status s;
+	try {
+		s = engine->write(batch);
+	} catch (...) {
+		restore();
+		throw;
+	}
+
+	if (s != status::OK) {
+		restore();
+		return s;
+	}
+
+	std::lock_guard<std::mutex> lock(mtx);
+	flushing.clear();
+	flushes++;
+
+	return status::OK;
+}
+
+bool write_behind::find(const std::string &key, const change *&found)
+{
+	auto it = pending.find(key);
+	if (it == pending.end()) {
+		it = flushing.find(key);
+		if (it == flushing.end())
+			return false;
+	}
+
+	found = &it->second;
+	return true;
+}
+
+status write_behind::buffer(string_view key, bool removed, string_view value)
+{
+	bool full;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto ret = pending.emplace(std::string(key.data(), key.size()), change());
+		auto &c = ret.first->second;
+		if (ret.second)
+			pending_bytes += key.size();
+		pending_bytes -= c.value.size();
+		pending_bytes += value.size();
+
+		c.removed = removed;
+		c.value.assign(value.data(), value.size());
+		full = pending_bytes > max_bytes;
+	}
+
+	/* writers, which fill the buffer, wait for it to be written */
+	return full ? flush() : status::OK;
+}
+
+status write_behind::count_all(std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_all(cnt) : s;
+}
+
+status write_behind::count_above(string_view key, std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_above(key, cnt) : s;
+}
+
+status write_behind::count_equal_above(string_view key, std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_equal_above(key, cnt) : s;
+}
+
+status write_behind::count_equal_below(string_view key, std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_equal_below(key, cnt) : s;
+}
+
+status write_behind::count_below(string_view key, std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_below(key, cnt) : s;
+}
+
+status write_behind::count_between(string_view key1, string_view key2,
+				   std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_between(key1, key2, cnt) : s;
+}
+
+status write_behind::count_prefix(string_view prefix, std::size_t &cnt)
+{
+	auto s = flush();
+	return s == status::OK ? engine->count_prefix(prefix, cnt) : s;
+}
+
+status write_behind::get_all(get_kv_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_all(callback, arg) : s;
+}
+
+status write_behind::get_above(string_view key, get_kv_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_above(key, callback, arg) : s;
+}
+
+status write_behind::get_equal_above(string_view key, get_kv_callback *callback,
+				     void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_equal_above(key, callback, arg) : s;
+}
+
+status write_behind::get_equal_below(string_view key, get_kv_callback *callback,
+				     void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_equal_below(key, callback, arg) : s;
+}
+
+status write_behind::get_below(string_view key, get_kv_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_below(key, callback, arg) : s;
+}
+
+status write_behind::get_between(string_view key1, string_view key2,
+				 get_kv_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_between(key1, key2, callback, arg) : s;
+}
+
+status write_behind::get_prefix(string_view prefix, get_kv_callback *callback,
+				void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_prefix(prefix, callback, arg) : s;
+}
+
+status write_behind::scan(string_view prefix, size_t limit, size_t batch_size,
+			  scan_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->scan(prefix, limit, batch_size, callback, arg)
+			       : s;
+}
+
+status write_behind::get_by_index(string_view index_key, get_kv_callback *callback,
+				  void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_by_index(index_key, callback, arg) : s;
+}
+
+status write_behind::get_all_parallel(size_t nthreads,
+				      get_kv_parallel_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_all_parallel(nthreads, callback, arg) : s;
+}
+
+status write_behind::get_between_parallel(string_view key1, string_view key2,
+					  size_t nthreads,
+					  get_kv_parallel_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_between_parallel(key1, key2, nthreads,
+							      callback, arg)
+			       : s;
+}
+
+/* bound and iterator methods have no status, errors of flush are thrown */
+static void check_flushed(status s)
+{
+	if (s != status::OK)
+		throw error("Flushing buffered changes failed", static_cast<int>(s));
+}
+
+std::pair<string_view, string_view> write_behind::upper_bound(string_view key)
+{
+	check_flushed(flush());
+	return engine->upper_bound(key);
+}
+
+std::pair<string_view, string_view> write_behind::lower_bound(string_view key)
+{
+	check_flushed(flush());
+	return engine->lower_bound(key);
+}
+
+std::pair<string_view, string_view> write_behind::get_begin()
+{
+	check_flushed(flush());
+	return engine->get_begin();
+}
+
+std::pair<string_view, string_view> write_behind::get_next(string_view key)
+{
+	check_flushed(flush());
+	return engine->get_next(key);
+}
+
+std::pair<string_view, string_view> write_behind::get_prev(string_view key)
+{
+	check_flushed(flush());
+	return engine->get_prev(key);
+}
+
+int write_behind::get_size_new()
+{
+	check_flushed(flush());
+	return engine->get_size_new();
+}
+
+iterator_base *write_behind::new_iterator()
+{
+	check_flushed(flush());
+	return engine->new_iterator();
+}
+
+/* the snapshot includes all writes buffered before it is taken */
+snapshot_base *write_behind::new_snapshot()
+{
+	check_flushed(flush());
+	return engine->new_snapshot();
+}
+
+status write_behind::exists(string_view key)
+{
+	LOG("exists for key=" << std::string(key.data(), key.size()));
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		const change *c;
+		if (find(std::string(key.data(), key.size()), c))
+			return c->removed ? status::NOT_FOUND : status::OK;
+	}
+
+	return engine->exists(key);
+}
+
+status write_behind::get(string_view key, get_v_callback *callback, void *arg)
+{
+	LOG("get key=" << std::string(key.data(), key.size()));
+	std::string value;
+	bool buffered;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		const change *c;
+		buffered = find(std::string(key.data(), key.size()), c);
+		if (buffered) {
+			if (c->removed)
+				return status::NOT_FOUND;
+			value = c->value;
+		}
+	}
+
+	/*
+	 * The callback is called without the lock, it may use the db. Changes
+	 * leave the buffer only after they are written to the engine, so a key
+	 * which is not buffered is read from the engine, also without the lock.
+	 */
+	if (!buffered)
+		return engine->get(key, callback, arg);
+
+	callback(value.data(), value.size(), arg);
+	return status::OK;
+}
+
+status write_behind::get_many(size_t count, const string_view *keys,
+			      get_many_v_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_many(count, keys, callback, arg) : s;
+}
+
+status write_behind::get_ref(string_view key, value_ref &ref)
+{
+	auto s = flush();
+	return s == status::OK ? engine->get_ref(key, ref) : s;
+}
+
+status write_behind::put(string_view key, string_view value)
+{
+	LOG("put key=" << std::string(key.data(), key.size())
+		       << ", value.size=" << std::to_string(value.size()));
+	return buffer(key, false, value);
+}
+
+/* the record expires in the engine, so puts with TTL are not buffered */
+status write_behind::put_with_ttl(string_view key, string_view value, uint64_t ttl_ms)
+{
+	auto s = flush();
+	return s == status::OK ? engine->put_with_ttl(key, value, ttl_ms) : s;
+}
+
+status write_behind::get_or_insert(string_view key, string_view value,
+				   get_v_callback *callback, void *arg, bool &inserted)
+{
+	auto s = flush();
+	if (s != status::OK)
+		return s;
+
+	return engine->get_or_insert(key, value, callback, arg, inserted);
+}
+
+/* the engine applies the update to the record, once the buffered puts are in it */
+status write_behind::update(string_view key, update_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->update(key, callback, arg) : s;
+}
+
+status write_behind::remove(string_view key)
+{
+	LOG("remove key=" << std::string(key.data(), key.size()));
+	auto s = exists(key);
+	if (s != status::OK)
+		return s;
+
+	return buffer(key, true, string_view());
+}
+
+status write_behind::remove_range(string_view key1, string_view key2)
+{
+	auto s = flush();
+	return s == status::OK ? engine->remove_range(key1, key2) : s;
+}
+
+status write_behind::write(write_batch &batch)
+{
+	auto s = flush();
+	return s == status::OK ? engine->write(batch) : s;
+}
+
+status write_behind::bulk_load(bulk_load_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->bulk_load(callback, arg) : s;
+}
+
+status write_behind::defrag(double start_percent, double amount_percent)
+{
+	auto s = flush();
+	return s == status::OK ? engine->defrag(start_percent, amount_percent) : s;
+}
+
+/* buffered writes are recorded by the engine once they are flushed */
+status write_behind::changes_since(uint64_t seq, change_callback *callback, void *arg)
+{
+	auto s = flush();
+	return s == status::OK ? engine->changes_since(seq, callback, arg) : s;
+}
+
+void write_behind::metrics(engine_metrics &metrics)
+{
+	engine->metrics(metrics);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	metrics.add("buffered_changes", static_cast<uint64_t>(pending.size()));
+	metrics.add("buffered_bytes", static_cast<uint64_t>(pending_bytes));
+	metrics.add("flushes", flushes);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPMEMKV_WRITE_BEHIND_H
+#define LIBPMEMKV_WRITE_BEHIND_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "engine.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Engine wrapper implementing the relaxed durability: puts and removes are
+ * buffered in DRAM and return without waiting for persistent memory. Buffered
+ * changes of a key are merged, so only its last change is written. They are
+ * written to the wrapped engine, with a single engine_base::write(), by
+ * flush(), which is called by a background thread every flush interval (unless
+ * it is 0), when the buffer exceeds max_bytes, on close and before all the
+ * operations other than get, exists, put and remove.
+ *
+ * Changes which were not flushed are lost after a crash. A flush failing in the
+ * background keeps the changes buffered, the error is returned by the next
+ * explicit flush(). As the background thread calls the wrapped engine
+ * concurrently with the user, it requires an engine which is thread-safe.
+ */
+class write_behind : public engine_base {
+public:
+	static const uint64_t DEFAULT_FLUSH_INTERVAL_MS = 10;
+	static const uint64_t DEFAULT_MAX_BYTES = 64ull << 20;
+
+	write_behind(std::unique_ptr<engine_base> engine, uint64_t flush_interval_ms,
+		     uint64_t max_bytes);
+	~write_behind();
+
+	std::string name() final;
+
+	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
+	status count_prefix(string_view prefix, std::size_t &cnt) final;
+
+	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
+	status get_prefix(string_view prefix, get_kv_callback *callback, void *arg) final;
+
+	status scan(string_view prefix, size_t limit, size_t batch_size,
+		    scan_callback *callback, void *arg) final;
+	status get_by_index(string_view index_key, get_kv_callback *callback,
+			    void *arg) final;
+	status get_all_parallel(size_t nthreads, get_kv_parallel_callback *callback,
+				void *arg) final;
+	status get_between_parallel(string_view key1, string_view key2, size_t nthreads,
+				    get_kv_parallel_callback *callback, void *arg) final;
+
+	std::pair<string_view, string_view> upper_bound(string_view key) final;
+	std::pair<string_view, string_view> lower_bound(string_view key) final;
+	std::pair<string_view, string_view> get_begin() final;
+	std::pair<string_view, string_view> get_next(string_view key) final;
+	std::pair<string_view, string_view> get_prev(string_view key) final;
+	int get_size_new() final;
+	iterator_base *new_iterator() final;
+	snapshot_base *new_snapshot() final;
+
+	status exists(string_view key) final;
+
+	status get(string_view key, get_v_callback *callback, void *arg) final;
+	status get_many(size_t count, const string_view *keys,
+			get_many_v_callback *callback, void *arg) final;
+	status get_ref(string_view key, value_ref &ref) final;
+
+	status put(string_view key, string_view value) final;
+	status put_with_ttl(string_view key, string_view value, uint64_t ttl_ms) final;
+	status get_or_insert(string_view key, string_view value, get_v_callback *callback,
+			     void *arg, bool &inserted) final;
+	status update(string_view key, update_callback *callback, void *arg) final;
+	status remove(string_view key) final;
+	status remove_range(string_view key1, string_view key2) final;
+	status write(write_batch &batch) final;
+	status bulk_load(bulk_load_callback *callback, void *arg) final;
+	status defrag(double start_percent, double amount_percent) final;
+	status flush() final;
+	status changes_since(uint64_t seq, change_callback *callback, void *arg) final;
+
+	void metrics(engine_metrics &metrics) final;
+
+private:
+	/* the last buffered change of a key */
+	struct change {
+		bool removed;
+		std::string value;
+	};
+
+	typedef std::unordered_map<std::string, change> changes;
+
+	/*
+	 * Looks the key up in the buffered changes, returns false if there is
+	 * none. Has to be called with mtx held.
+	 */
+	bool find(const std::string &key, const change *&found);
+	status buffer(string_view key, bool removed, string_view value);
+	void background_flush(std::chrono::milliseconds interval);
+
+	std::unique_ptr<engine_base> engine;
+	std::size_t max_bytes;
+
+	std::mutex mtx;
+	/* changes buffered since the last flush */
+	changes pending;
+	std::size_t pending_bytes;
+	/* changes being written by the flush in progress */
+	changes flushing;
+	uint64_t flushes;
+
+	/* serializes flushes */
+	std::mutex flush_mtx;
+
+	std::condition_variable cv;
+	bool stopped;
+	std::thread flusher;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_WRITE_BEHIND_H */
@@ -77,6 +77,20 @@ static Basic basic_tests[] = {
 		.use_file = false,
 	},
 #endif // ENGINE_VSMAP
+#ifdef ENGINE_VSKIPLIST
+	{
+		.path = &test_path,
+		.size = (uint64_t)(1024 * 1024 * 1024),
+		.force_create = 1,
+		.engine = "vskiplist",
+		.key_length = 100,
+		.value_length = 100,
+		.test_value_length = 20,
+		.name = "VSkiplistTest100bKey100bValue",
+		.tracers = "MP",
+		.use_file = false,
+	},
+#endif // ENGINE_VSKIPLIST
 #ifdef ENGINE_VCMAP
 	{
 		.path = &test_path,
@@ -119,5 +133,33 @@ static Basic basic_tests[] = {
 		.use_file = true,
 	},
 #endif // ENGINE_STREE
+#ifdef ENGINE_RADIX
+	{
+		.path = &test_path,
+		.size = (uint64_t)(1024 * 1024 * 1024),
+		.force_create = 1,
+		.engine = "radix",
+		.key_length = 100,
+		.value_length = 100,
+		.test_value_length = 20,
+		.name = "RadixTest100bKey100bValue",
+		.tracers = "",
+		.use_file = true,
+	},
+#endif // ENGINE_RADIX
+#ifdef ENGINE_DASH
+	{
+		.path = &test_path,
+		.size = (uint64_t)(1024 * 1024 * 1024),
+		.force_create = 1,
+		.engine = "dash",
+		.key_length = 20,
+		.value_length = 200,
+		.test_value_length = 20,
+		.name = "DashTest20bKey200bValue",
+		.tracers = "",
+		.use_file = true,
+	},
+#endif // ENGINE_DASH
 };
 #endif // BASIC_TESTS_H_
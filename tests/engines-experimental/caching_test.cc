@@ -901,3 +901,63 @@ TEST_F(CachingTest, LargeTTL)
 	ASSERT_TRUE(cnt == 1);
 	ASSERT_TRUE(kv->exists("key1") == status::OK);
 }
+
+TEST_F(CachingTest, RefreshAheadNotSmallerThanTTL)
+{
+	ASSERT_THROW(
+		start("caching",
+		      "{\"host\":\"127.0.0.1\",\"port\":6379,\"attempts\":5,\"ttl\":1,\"refresh_ahead\":1,\"path\":\"/dev/shm/pmemkv\",\"remote_type\":\"Redis\",\"remote_user\":\"xxx\", \"remote_pwd\":\"yyy\", \"remote_url\":\"...\", \"subengine\":\"" +
+			      ENGINE + "\",\"subengine_config\":{\"path\":\"" + PATH +
+			      "\", \"size\": 1073741824, \"force_create\": 1}}"),
+		std::runtime_error);
+}
+
+TEST_F(CachingTest, RefreshAheadKeepsKey)
+{
+	ASSERT_TRUE(start(
+		"caching",
+		"{\"host\":\"127.0.0.1\",\"port\":6379,\"attempts\":5,\"ttl\":2,\"refresh_ahead\":1,\"path\":\"/dev/shm/pmemkv\",\"remote_type\":\"Redis\",\"remote_user\":\"xxx\", \"remote_pwd\":\"yyy\", \"remote_url\":\"...\", \"subengine\":\"" +
+			ENGINE + "\",\"subengine_config\":{\"path\":\"" + PATH +
+			"\", \"size\": 1073741824, \"force_create\": 1}}"));
+	std::string value;
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	sleep(1);
+	// key1 is read within refresh_ahead before its expiry, so its refresh is
+	// scheduled, but the cached value is returned right away
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	sleep(1);
+	ASSERT_TRUE(kv->exists("key1") == status::OK);
+}
+
+TEST_F(CachingTest, MaxSizeEvictsKeys)
+{
+	ASSERT_TRUE(start(
+		"caching",
+		"{\"host\":\"127.0.0.1\",\"port\":6379,\"attempts\":5,\"ttl\":0,\"max_size\":2,\"path\":\"/dev/shm/pmemkv\",\"remote_type\":\"Redis\",\"remote_user\":\"xxx\", \"remote_pwd\":\"yyy\", \"remote_url\":\"...\", \"subengine\":\"" +
+			ENGINE + "\",\"subengine_config\":{\"path\":\"" + PATH +
+			"\", \"size\": 1073741824, \"force_create\": 1}}"));
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key3", "value3") == status::OK) << errormsg();
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+	ASSERT_TRUE(kv->exists("key3") == status::OK);
+}
+
+TEST_F(CachingTest, MaxBytesEvictsKeys)
+{
+	ASSERT_TRUE(start(
+		"caching",
+		"{\"host\":\"127.0.0.1\",\"port\":6379,\"attempts\":5,\"ttl\":0,\"max_bytes\":25,\"path\":\"/dev/shm/pmemkv\",\"remote_type\":\"Redis\",\"remote_user\":\"xxx\", \"remote_pwd\":\"yyy\", \"remote_url\":\"...\", \"subengine\":\"" +
+			ENGINE + "\",\"subengine_config\":{\"path\":\"" + PATH +
+			"\", \"size\": 1073741824, \"force_create\": 1}}"));
+	// each record takes 10 bytes
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key3", "value3") == status::OK) << errormsg();
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+	ASSERT_TRUE(kv->exists("key3") == status::OK);
+}
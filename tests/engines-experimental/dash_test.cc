@@ -0,0 +1,271 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../src/libpmemkv.hpp"
+#include "gtest/gtest.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv;
+
+extern std::string test_path;
+static const size_t SIZE = ((size_t)(1024 * 1024 * 1104));
+
+static config getConfig(const std::string &path, size_t size, bool create = true)
+{
+	config cfg;
+
+	auto cfg_s = cfg.put_string("path", path);
+
+	if (cfg_s != status::OK)
+		throw std::runtime_error("putting 'path' to config failed");
+
+	if (create) {
+		cfg_s = cfg.put_uint64("force_create", 1);
+		if (cfg_s != status::OK)
+			throw std::runtime_error(
+				"putting 'force_create' to config failed");
+
+		cfg_s = cfg.put_uint64("size", size);
+
+		if (cfg_s != status::OK)
+			throw std::runtime_error("putting 'size' to config failed");
+	}
+
+	return cfg;
+}
+
+class DashTest : public testing::Test {
+public:
+	std::string PATH = test_path + "/dash_test";
+
+	db *kv;
+
+	DashTest()
+	{
+		std::remove(PATH.c_str());
+		Start(true);
+	}
+
+	~DashTest()
+	{
+		kv->close();
+		delete kv;
+		std::remove(PATH.c_str());
+	}
+	void Restart()
+	{
+		kv->close();
+		delete kv;
+		Start(false);
+	}
+
+protected:
+	void Start(bool create)
+	{
+		kv = new db;
+		auto s = kv->open("dash", getConfig(PATH, SIZE, create));
+		if (s != status::OK)
+			throw std::runtime_error(errormsg());
+	}
+};
+
+typedef std::map<std::string, std::string> records_map;
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+/* checks count_all, get of every record and that get_all returns them all */
+static void verify(db &kv, const records_map &expected)
+{
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv.count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, expected.size());
+	std::string value;
+	for (auto &record : expected) {
+		ASSERT_TRUE(kv.get(record.first, &value) == status::OK) << record.first;
+		ASSERT_EQ(value, record.second);
+	}
+
+	records_map all;
+	auto s = kv.get_all([&](string_view k, string_view v) {
+		all.emplace(std::string(k.data(), k.size()),
+			    std::string(v.data(), v.size()));
+		return 0;
+	});
+	ASSERT_TRUE(s == status::OK);
+	ASSERT_TRUE(all == expected);
+}
+
+TEST_F(DashTest, SimpleTest)
+{
+	std::string binary("\0\1", 2);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("key1") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_FOUND);
+
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK);
+	ASSERT_TRUE(kv->put("", "empty") == status::OK);
+	ASSERT_TRUE(kv->put(binary, std::string("\0", 1)) == status::OK);
+	ASSERT_TRUE(kv->exists("key1") == status::OK);
+	ASSERT_TRUE(kv->put("key1", "value2") == status::OK);
+	verify(*kv, {{"key1", "value2"}, {"", "empty"}, {binary, std::string("\0", 1)}});
+
+	Restart();
+
+	verify(*kv, {{"key1", "value2"}, {"", "empty"}, {binary, std::string("\0", 1)}});
+	ASSERT_TRUE(kv->remove("key1") == status::OK);
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->remove("") == status::OK);
+	verify(*kv, {{binary, std::string("\0", 1)}});
+}
+
+TEST_F(DashTest, SplitTest)
+{
+	const size_t N = 30000;
+	records_map expected;
+	for (size_t i = 0; i < N; i++) {
+		auto key = "key" + std::to_string(i);
+		ASSERT_TRUE(kv->put(key, std::to_string(i)) == status::OK);
+		expected[key] = std::to_string(i);
+	}
+	verify(*kv, expected);
+
+	auto segments = metric(*kv, "segments");
+	ASSERT_GT(segments, 1);
+	ASSERT_EQ(metric(*kv, "segment_splits"), segments - 1);
+	ASSERT_GT(metric(*kv, "directory_doublings"), 0);
+	ASSERT_GE(metric(*kv, "global_depth"), 1);
+	ASSERT_GT(metric(*kv, "load_factor"), 0.3);
+	ASSERT_LE(metric(*kv, "load_factor"), 1);
+
+	Restart();
+
+	/* the directory is read back from the pool */
+	ASSERT_EQ(metric(*kv, "segments"), segments);
+	verify(*kv, expected);
+	for (size_t i = 0; i < N; i += 2) {
+		auto key = "key" + std::to_string(i);
+		ASSERT_TRUE(kv->remove(key) == status::OK);
+		expected.erase(key);
+	}
+	for (size_t i = 1; i < N; i += 4) {
+		auto key = "key" + std::to_string(i);
+		ASSERT_TRUE(kv->put(key, "updated") == status::OK);
+		expected[key] = "updated";
+	}
+	verify(*kv, expected);
+}
+
+TEST_F(DashTest, ConcurrentTest)
+{
+	const size_t THREADS = 4;
+	const size_t N = 5000;
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < THREADS; t++) {
+		threads.emplace_back([&, t] {
+			for (size_t i = 0; i < N; i++) {
+				auto key = std::to_string(t) + "_" + std::to_string(i);
+				ASSERT_TRUE(kv->put(key, key) == status::OK);
+				std::string value;
+				ASSERT_TRUE(kv->get(key, &value) == status::OK);
+				ASSERT_EQ(value, key);
+				if (i % 3 == 0) {
+					ASSERT_TRUE(kv->remove(key) == status::OK);
+				}
+			}
+		});
+	}
+	for (auto &th : threads)
+		th.join();
+
+	records_map expected;
+	for (size_t t = 0; t < THREADS; t++) {
+		for (size_t i = 0; i < N; i++) {
+			auto key = std::to_string(t) + "_" + std::to_string(i);
+			if (i % 3 != 0)
+				expected[key] = key;
+		}
+	}
+	verify(*kv, expected);
+}
+
+TEST_F(DashTest, GetAllParallelTest)
+{
+	const size_t N = 10000;
+	for (size_t i = 0; i < N; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), std::to_string(i)) == status::OK);
+
+	std::mutex mtx;
+	std::vector<size_t> seen(N);
+	std::vector<size_t> workers;
+	auto check = [&](size_t worker, string_view k, string_view v) {
+		std::string key(k.data(), k.size());
+		std::lock_guard<std::mutex> lock(mtx);
+		seen[std::stoul(key)]++;
+		workers.push_back(worker);
+		return key == std::string(v.data(), v.size()) ? 0 : 1;
+	};
+	ASSERT_TRUE(kv->get_all_parallel(4, check) == status::OK);
+	for (auto count : seen)
+		ASSERT_EQ(count, 1U);
+	for (auto worker : workers)
+		ASSERT_LT(worker, 4U);
+}
+
+TEST_F(DashTest, StoppedByCallbackTest)
+{
+	for (size_t i = 0; i < 100; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), "value") == status::OK);
+
+	size_t calls = 0;
+	auto s = kv->get_all([&](string_view, string_view) {
+		calls++;
+		return calls == 10 ? 1 : 0;
+	});
+	ASSERT_TRUE(s == status::STOPPED_BY_CB);
+	ASSERT_EQ(calls, 10U);
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../src/libpmemkv.hpp"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+extern std::string test_path;
+static const size_t SIZE = 1024ull * 1024ull * 512ull;
+
+/* index key of a value is its part before '|', values without it are not indexed */
+static int field_extractor(const char *v, size_t vb, const char **ik, size_t *ikb,
+			   void *arg)
+{
+	auto sep = static_cast<const char *>(memchr(v, '|', vb));
+	if (sep == nullptr)
+		return 1;
+
+	*ik = v;
+	*ikb = static_cast<size_t>(sep - v);
+	return 0;
+}
+
+class IndexedTest : public testing::Test {
+public:
+	std::string PATH = test_path + "/indexed_test";
+	std::unique_ptr<db> kv;
+
+	IndexedTest()
+	{
+		std::remove(PATH.c_str());
+	}
+
+	~IndexedTest()
+	{
+		if (kv)
+			kv->close();
+		std::remove(PATH.c_str());
+	}
+
+	status Start(bool create = true, bool extractor = true)
+	{
+		config sub_cfg;
+		sub_cfg.put_string("path", PATH);
+		if (create) {
+			sub_cfg.put_uint64("force_create", 1);
+			sub_cfg.put_uint64("size", SIZE);
+		}
+
+		config cfg;
+		cfg.put_string("subengine", "radix");
+		cfg.put_object("subengine_config", sub_cfg.release(), [](void *c) {
+			pmemkv_config_delete(static_cast<pmemkv_config *>(c));
+		});
+		if (extractor)
+			cfg.put_index_extractor(field_extractor, nullptr);
+
+		kv.reset(new db);
+		return kv->open("indexed", std::move(cfg));
+	}
+
+	void Restart()
+	{
+		kv->close();
+		ASSERT_TRUE(Start(false) == status::OK) << errormsg();
+	}
+
+	/* keys of records with the index key, in the order they are passed */
+	std::vector<std::string> ByIndex(string_view index_key)
+	{
+		std::vector<std::string> keys;
+		auto s = kv->get_by_index(index_key, [&](string_view k, string_view) {
+			keys.emplace_back(k.data(), k.size());
+			return 0;
+		});
+		EXPECT_TRUE(s == status::OK) << errormsg();
+		return keys;
+	}
+
+	std::vector<std::string> All()
+	{
+		std::vector<std::string> keys;
+		kv->get_all([&](string_view k, string_view) {
+			keys.emplace_back(k.data(), k.size());
+			return 0;
+		});
+		return keys;
+	}
+};
+
+TEST_F(IndexedTest, SimpleTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("alice", "paris|1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("bob", "rome|2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("carol", "paris|3") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("dave", "unindexed") == status::OK) << errormsg();
+
+	ASSERT_EQ(ByIndex("paris"), std::vector<std::string>({"alice", "carol"}));
+	ASSERT_EQ(ByIndex("rome"), std::vector<std::string>({"bob"}));
+	ASSERT_TRUE(ByIndex("par").empty());
+	ASSERT_TRUE(ByIndex("").empty());
+
+	std::string value;
+	ASSERT_TRUE(kv->get("carol", &value) == status::OK && value == "paris|3");
+	ASSERT_TRUE(kv->exists("dave") == status::OK);
+
+	/* index entries are not records */
+	std::size_t cnt;
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK && cnt == 4);
+	ASSERT_EQ(All(), std::vector<std::string>({"alice", "bob", "carol", "dave"}));
+
+	/* values are passed along with the keys, the callback may stop */
+	ASSERT_TRUE(kv->get_by_index("paris",
+				     [&](string_view k, string_view v) {
+					     value = std::string(v.data(), v.size());
+					     return 1;
+				     }) == status::STOPPED_BY_CB);
+	ASSERT_EQ(value, "paris|1");
+}
+
+TEST_F(IndexedTest, OverwriteAndRemoveTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("alice", "paris|1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("alice", "paris|2") == status::OK) << errormsg();
+	ASSERT_EQ(ByIndex("paris"), std::vector<std::string>({"alice"}));
+
+	ASSERT_TRUE(kv->put("alice", "rome|3") == status::OK) << errormsg();
+	ASSERT_TRUE(ByIndex("paris").empty());
+	ASSERT_EQ(ByIndex("rome"), std::vector<std::string>({"alice"}));
+
+	ASSERT_TRUE(kv->put("alice", "none") == status::OK) << errormsg();
+	ASSERT_TRUE(ByIndex("rome").empty());
+	ASSERT_TRUE(kv->put("alice", "rome|4") == status::OK) << errormsg();
+	ASSERT_EQ(ByIndex("rome"), std::vector<std::string>({"alice"}));
+
+	ASSERT_TRUE(kv->remove("alice") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove("alice") == status::NOT_FOUND);
+	ASSERT_TRUE(ByIndex("rome").empty());
+	ASSERT_TRUE(All().empty());
+}
+
+TEST_F(IndexedTest, BinaryIndexKeysTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("k1", std::string("a|1")) == status::OK);
+	ASSERT_TRUE(kv->put("k2", std::string("a\0b|2", 5)) == status::OK);
+	ASSERT_TRUE(kv->put("k3", std::string("a\0|3", 4)) == status::OK);
+	ASSERT_TRUE(kv->put("k4", std::string("ab|4")) == status::OK);
+
+	/* no index key is a prefix of another one */
+	ASSERT_EQ(ByIndex("a"), std::vector<std::string>({"k1"}));
+	ASSERT_EQ(ByIndex(string_view("a\0b", 3)), std::vector<std::string>({"k2"}));
+	ASSERT_EQ(ByIndex(string_view("a\0", 2)), std::vector<std::string>({"k3"}));
+	ASSERT_EQ(ByIndex("ab"), std::vector<std::string>({"k4"}));
+}
+
+TEST_F(IndexedTest, RangeTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	for (auto k : {"a", "b", "c", "d"})
+		ASSERT_TRUE(kv->put(k, std::string(k) + "|v") == status::OK);
+	ASSERT_TRUE(kv->put("", "empty") == status::OK);
+
+	std::size_t cnt;
+	ASSERT_TRUE(kv->count_above("b", cnt) == status::OK && cnt == 2);
+	ASSERT_TRUE(kv->count_equal_above("b", cnt) == status::OK && cnt == 3);
+	ASSERT_TRUE(kv->count_equal_above("bb", cnt) == status::OK && cnt == 2);
+	ASSERT_TRUE(kv->count_below("b", cnt) == status::OK && cnt == 2);
+	ASSERT_TRUE(kv->count_equal_below("b", cnt) == status::OK && cnt == 3);
+	ASSERT_TRUE(kv->count_between("a", "d", cnt) == status::OK && cnt == 2);
+	ASSERT_TRUE(kv->count_prefix("c", cnt) == status::OK && cnt == 1);
+
+	std::vector<std::string> keys;
+	auto collect = [&](string_view k, string_view) {
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	};
+	ASSERT_TRUE(kv->get_above("b", collect) == status::OK);
+	ASSERT_EQ(keys, std::vector<std::string>({"c", "d"}));
+	keys.clear();
+	ASSERT_TRUE(kv->get_equal_above("c", collect) == status::OK);
+	ASSERT_EQ(keys, std::vector<std::string>({"c", "d"}));
+	keys.clear();
+	ASSERT_TRUE(kv->get_below("b", collect) == status::OK);
+	ASSERT_EQ(keys, std::vector<std::string>({"", "a"}));
+	keys.clear();
+	ASSERT_TRUE(kv->get_equal_below("b", collect) == status::OK);
+	ASSERT_EQ(keys, std::vector<std::string>({"", "a", "b"}));
+	keys.clear();
+	ASSERT_TRUE(kv->get_between("", "c", collect) == status::OK);
+	ASSERT_EQ(keys, std::vector<std::string>({"a", "b"}));
+}
+
+TEST_F(IndexedTest, WriteBatchTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("alice", "paris|1") == status::OK);
+	ASSERT_TRUE(kv->put("bob", "rome|2") == status::OK);
+
+	write_batch batch;
+	batch.put("carol", "paris|3");
+	batch.put("carol", "oslo|4");
+	batch.remove("bob");
+	batch.put("alice", "oslo|5");
+	batch.remove("nobody");
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+
+	ASSERT_TRUE(ByIndex("paris").empty());
+	ASSERT_TRUE(ByIndex("rome").empty());
+	ASSERT_EQ(ByIndex("oslo"), std::vector<std::string>({"alice", "carol"}));
+	ASSERT_EQ(All(), std::vector<std::string>({"alice", "carol"}));
+}
+
+TEST_F(IndexedTest, PersistentTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("alice", "paris|1") == status::OK);
+	ASSERT_TRUE(kv->put("bob", "paris|2") == status::OK);
+	ASSERT_TRUE(kv->remove("alice") == status::OK);
+	Restart();
+
+	ASSERT_EQ(ByIndex("paris"), std::vector<std::string>({"bob"}));
+	ASSERT_EQ(All(), std::vector<std::string>({"bob"}));
+}
+
+TEST_F(IndexedTest, NoExtractorTest)
+{
+	ASSERT_TRUE(Start(true, false) == status::INVALID_ARGUMENT);
+	kv.reset();
+}
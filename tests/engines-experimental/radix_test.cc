@@ -0,0 +1,425 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "../../src/libpmemkv.hpp"
+#include "gtest/gtest.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace pmem::kv;
+
+extern std::string test_path;
+static const size_t SIZE = ((size_t)(1024 * 1024 * 1104));
+
+static config getConfig(const std::string &path, size_t size, bool create = true)
+{
+	config cfg;
+
+	auto cfg_s = cfg.put_string("path", path);
+
+	if (cfg_s != status::OK)
+		throw std::runtime_error("putting 'path' to config failed");
+
+	if (create) {
+		cfg_s = cfg.put_uint64("force_create", 1);
+		if (cfg_s != status::OK)
+			throw std::runtime_error(
+				"putting 'force_create' to config failed");
+
+		cfg_s = cfg.put_uint64("size", size);
+
+		if (cfg_s != status::OK)
+			throw std::runtime_error("putting 'size' to config failed");
+	}
+
+	return cfg;
+}
+
+class RadixTest : public testing::Test {
+public:
+	std::string PATH = test_path + "/radix_test";
+
+	db *kv;
+
+	RadixTest()
+	{
+		std::remove(PATH.c_str());
+		Start(true);
+	}
+
+	~RadixTest()
+	{
+		kv->close();
+		delete kv;
+		std::remove(PATH.c_str());
+	}
+	void Restart()
+	{
+		kv->close();
+		delete kv;
+		Start(false);
+	}
+
+protected:
+	void Start(bool create)
+	{
+		kv = new db;
+		auto s = kv->open("radix", getConfig(PATH, SIZE, create));
+		if (s != status::OK)
+			throw std::runtime_error(errormsg());
+	}
+};
+
+typedef std::map<std::string, std::string> records_map;
+typedef std::vector<std::pair<std::string, std::string>> records;
+
+static std::function<int(string_view, string_view)> collect(records &r)
+{
+	return [&r](string_view k, string_view v) {
+		r.emplace_back(std::string(k.data(), k.size()),
+			       std::string(v.data(), v.size()));
+		return 0;
+	};
+}
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+/* checks all records and every range function bounded by the given keys */
+static void verify(db &kv, const records_map &expected,
+		   const std::vector<std::string> &bounds)
+{
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv.count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, expected.size());
+	std::string value;
+	for (auto &record : expected) {
+		ASSERT_TRUE(kv.get(record.first, &value) == status::OK) << record.first;
+		ASSERT_EQ(value, record.second);
+	}
+	records all;
+	ASSERT_TRUE(kv.get_all(collect(all)) == status::OK);
+	ASSERT_TRUE(all == records(expected.begin(), expected.end()));
+
+	for (auto &k1 : bounds) {
+		records above, equal_above, below, equal_below, prefix;
+		ASSERT_TRUE(kv.get_above(k1, collect(above)) == status::OK);
+		ASSERT_TRUE(kv.get_equal_above(k1, collect(equal_above)) == status::OK);
+		ASSERT_TRUE(kv.get_below(k1, collect(below)) == status::OK);
+		ASSERT_TRUE(kv.get_equal_below(k1, collect(equal_below)) == status::OK);
+		ASSERT_TRUE(kv.get_prefix(k1, collect(prefix)) == status::OK);
+		ASSERT_TRUE(above == records(expected.upper_bound(k1), expected.end()))
+			<< k1;
+		ASSERT_TRUE(equal_above ==
+			    records(expected.lower_bound(k1), expected.end()))
+			<< k1;
+		ASSERT_TRUE(below == records(expected.begin(), expected.lower_bound(k1)))
+			<< k1;
+		ASSERT_TRUE(equal_below ==
+			    records(expected.begin(), expected.upper_bound(k1)))
+			<< k1;
+		records exp_prefix;
+		for (auto it = expected.lower_bound(k1);
+		     it != expected.end() && it->first.compare(0, k1.size(), k1) == 0;
+		     ++it)
+			exp_prefix.push_back(*it);
+		ASSERT_TRUE(prefix == exp_prefix) << k1;
+
+		ASSERT_TRUE(kv.count_above(k1, cnt) == status::OK);
+		ASSERT_EQ(cnt, above.size());
+		ASSERT_TRUE(kv.count_equal_above(k1, cnt) == status::OK);
+		ASSERT_EQ(cnt, equal_above.size());
+		ASSERT_TRUE(kv.count_below(k1, cnt) == status::OK);
+		ASSERT_EQ(cnt, below.size());
+		ASSERT_TRUE(kv.count_equal_below(k1, cnt) == status::OK);
+		ASSERT_EQ(cnt, equal_below.size());
+		ASSERT_TRUE(kv.count_prefix(k1, cnt) == status::OK);
+		ASSERT_EQ(cnt, prefix.size());
+
+		for (auto &k2 : bounds) {
+			records between, exp;
+			ASSERT_TRUE(kv.get_between(k1, k2, collect(between)) ==
+				    status::OK);
+			if (k1 < k2)
+				exp = records(expected.upper_bound(k1),
+					      expected.lower_bound(k2));
+			ASSERT_TRUE(between == exp) << k1 << " " << k2;
+			ASSERT_TRUE(kv.count_between(k1, k2, cnt) == status::OK);
+			ASSERT_EQ(cnt, exp.size());
+		}
+	}
+}
+
+TEST_F(RadixTest, SimpleTest)
+{
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->exists("key1") == status::OK);
+	ASSERT_TRUE(kv->exists("key") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("key12") == status::NOT_FOUND);
+
+	ASSERT_TRUE(kv->put("key1", "VALUE1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "VALUE1");
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 1U);
+
+	ASSERT_TRUE(kv->remove("key") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->remove("key1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 0U);
+}
+
+TEST_F(RadixTest, BinaryKeysTest)
+{
+	/* empty key, keys with zero bytes and keys which are prefixes of others */
+	records_map expected;
+	const std::string keys[] = {"",
+				    std::string(1, '\0'),
+				    std::string(2, '\0'),
+				    std::string("a\0b", 3),
+				    "a",
+				    "ab",
+				    "abc",
+				    std::string(3, '\xff'),
+				    std::string("\xff\x01", 2)};
+	for (auto &key : keys) {
+		ASSERT_TRUE(kv->put(key, "v" + key) == status::OK) << errormsg();
+		expected[key] = "v" + key;
+	}
+	std::vector<std::string> bounds(std::begin(keys), std::end(keys));
+	bounds.push_back("aa");
+	verify(*kv, expected, bounds);
+
+	for (auto &key : {std::string("a"), std::string(""), std::string(1, '\0')}) {
+		ASSERT_TRUE(kv->remove(key) == status::OK) << errormsg();
+		expected.erase(key);
+		verify(*kv, expected, bounds);
+	}
+	Restart();
+	verify(*kv, expected, bounds);
+}
+
+TEST_F(RadixTest, LongPrefixTest)
+{
+	/* compressed paths longer than the bytes stored in nodes are split */
+	records_map expected;
+	const std::string base(100, 'p');
+	std::vector<std::string> bounds = {base, base.substr(0, 50), base + "a"};
+	for (size_t len : {100U, 20U, 60U, 9U, 8U, 7U, 99U, 150U}) {
+		std::string key = base.substr(0, std::min<size_t>(len, 100)) +
+			std::string(len > 100 ? len - 100 : 0, 'q');
+		for (auto suffix : {"", "x", "y/1", "y/2"}) {
+			ASSERT_TRUE(kv->put(key + suffix, key) == status::OK)
+				<< errormsg();
+			expected[key + suffix] = key;
+		}
+		bounds.push_back(key);
+		bounds.push_back(key + "y/");
+		verify(*kv, expected, bounds);
+	}
+
+	/* lookups of keys diverging past the stored part of a path fail */
+	std::string value;
+	ASSERT_TRUE(kv->get(base.substr(0, 30) + "z" + base.substr(0, 29), &value) ==
+		    status::NOT_FOUND);
+
+	for (auto it = expected.begin(); it != expected.end();) {
+		ASSERT_TRUE(kv->remove(it->first) == status::OK) << errormsg();
+		it = expected.erase(it);
+		if (it != expected.end())
+			++it;
+	}
+	verify(*kv, expected, bounds);
+	Restart();
+	verify(*kv, expected, bounds);
+}
+
+TEST_F(RadixTest, NodeGrowthTest)
+{
+	/* every byte below a common prefix grows the node up to node256 */
+	records_map expected;
+	for (int b = 0; b < 256; b++) {
+		std::string key = "prefix" + std::string(1, static_cast<char>(b));
+		ASSERT_TRUE(kv->put(key, key) == status::OK) << errormsg();
+		expected[key] = key;
+		if (b == 3) {
+			ASSERT_EQ(metric(*kv, "node4"), 1);
+		} else if (b == 15) {
+			ASSERT_EQ(metric(*kv, "node16"), 1);
+		} else if (b == 47) {
+			ASSERT_EQ(metric(*kv, "node48"), 1);
+		}
+	}
+	ASSERT_EQ(metric(*kv, "node256"), 1);
+	ASSERT_EQ(metric(*kv, "depth"), 1);
+	verify(*kv, expected, {"prefix", "prefiy", std::string("prefix\x80", 7)});
+	Restart();
+	verify(*kv, expected, {"prefix"});
+
+	/* and removes shrink it back */
+	for (int b = 255; b >= 2; b--) {
+		std::string key = "prefix" + std::string(1, static_cast<char>(b));
+		ASSERT_TRUE(kv->remove(key) == status::OK) << errormsg();
+		expected.erase(key);
+	}
+	ASSERT_EQ(metric(*kv, "node256"), 0);
+	ASSERT_EQ(metric(*kv, "node48"), 0);
+	ASSERT_EQ(metric(*kv, "node16"), 0);
+	ASSERT_EQ(metric(*kv, "node4"), 1);
+	verify(*kv, expected, {"prefix", std::string("prefix\x01", 7)});
+
+	/* a single key is a leaf without nodes */
+	ASSERT_TRUE(kv->remove(std::string("prefix\x01", 7)) == status::OK);
+	expected.erase(std::string("prefix\x01", 7));
+	ASSERT_EQ(metric(*kv, "node4"), 0);
+	ASSERT_EQ(metric(*kv, "depth"), 0);
+	verify(*kv, expected, {"prefix", ""});
+}
+
+TEST_F(RadixTest, RandomTest)
+{
+	/* short keys from a small alphabet share prefixes and are prefixes of others */
+	std::mt19937_64 gen(1);
+	auto random_key = [&] {
+		std::string key(gen() % 12, 'a');
+		for (auto &c : key)
+			c = static_cast<char>('a' + gen() % 3);
+		return key;
+	};
+
+	records_map expected;
+	for (int i = 0; i < 20000; i++) {
+		std::string key = random_key();
+		if (gen() % 3 == 0) {
+			auto s = kv->remove(key);
+			auto erased = expected.erase(key);
+			ASSERT_TRUE(s == (erased ? status::OK : status::NOT_FOUND));
+		} else {
+			std::string value = std::to_string(i);
+			ASSERT_TRUE(kv->put(key, value) == status::OK) << errormsg();
+			expected[key] = value;
+		}
+	}
+
+	std::vector<std::string> bounds;
+	for (int i = 0; i < 12; i++)
+		bounds.push_back(random_key());
+	verify(*kv, expected, bounds);
+	Restart();
+	verify(*kv, expected, bounds);
+}
+
+TEST_F(RadixTest, StoppedByCallbackTest)
+{
+	for (int i = 0; i < 100; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), "v") == status::OK) << errormsg();
+
+	std::size_t calls = 0;
+	auto s = kv->get_all([&](string_view, string_view) { return ++calls == 10; });
+	ASSERT_TRUE(s == status::STOPPED_BY_CB);
+	ASSERT_EQ(calls, 10U);
+	calls = 0;
+	s = kv->get_prefix("1", [&](string_view, string_view) { return ++calls == 2; });
+	ASSERT_TRUE(s == status::STOPPED_BY_CB);
+	ASSERT_EQ(calls, 2U);
+}
+
+TEST_F(RadixTest, RemoveRangeTest)
+{
+	records_map expected;
+	for (int i = 0; i < 1000; i++) {
+		std::string key = "key" + std::to_string(i);
+		ASSERT_TRUE(kv->put(key, key) == status::OK) << errormsg();
+		expected[key] = key;
+	}
+
+	/* the lower bound is removed, the upper one is not */
+	ASSERT_TRUE(kv->remove_range("key2", "key5") == status::OK) << errormsg();
+	expected.erase(expected.lower_bound("key2"), expected.lower_bound("key5"));
+	ASSERT_TRUE(kv->remove_range("key9", "key2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove_range("a", "b") == status::OK) << errormsg();
+	verify(*kv, expected, {"key", "key1", "key2", "key5", "key50"});
+	Restart();
+	verify(*kv, expected, {"key2", "key5"});
+}
+
+TEST_F(RadixTest, WriteBatchTest)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+
+	write_batch batch;
+	ASSERT_TRUE(batch.put("key3", "value3") == status::OK);
+	ASSERT_TRUE(batch.put("key1", "VALUE1") == status::OK);
+	ASSERT_TRUE(batch.remove("key2") == status::OK);
+	ASSERT_TRUE(batch.remove("nada") == status::OK);
+	ASSERT_TRUE(batch.put("key2", "VALUE2") == status::OK);
+	ASSERT_TRUE(batch.remove("key3") == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 2U);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "VALUE1");
+	ASSERT_TRUE(kv->get("key2", &value) == status::OK && value == "VALUE2");
+	ASSERT_TRUE(kv->exists("key3") == status::NOT_FOUND);
+}
+
+TEST_F(RadixTest, LargeValuesTest)
+{
+	records_map expected;
+	for (int i = 0; i < 200; i++) {
+		std::string key = std::to_string(i * 7919);
+		std::string value(static_cast<size_t>(i) * 97, static_cast<char>(i));
+		ASSERT_TRUE(kv->put(key, value) == status::OK) << errormsg();
+		expected[key] = value;
+	}
+	Restart();
+	verify(*kv, expected, {"1", "5", "9999"});
+}
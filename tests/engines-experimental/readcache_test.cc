@@ -0,0 +1,287 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../src/libpmemkv.hpp"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pmem::kv;
+
+extern std::string test_path;
+const size_t SIZE = 1024ull * 1024ull * 512ull;
+
+class ReadCacheTest : public testing::Test {
+public:
+	std::string PATH = test_path + "/readcache_test";
+	std::unique_ptr<db> kv;
+
+	ReadCacheTest()
+	{
+		std::remove(PATH.c_str());
+	}
+
+	~ReadCacheTest()
+	{
+		if (kv)
+			kv->close();
+		std::remove(PATH.c_str());
+	}
+
+	status Start(uint64_t max_bytes = 0, uint64_t shards = 0)
+	{
+		config sub_cfg;
+		sub_cfg.put_string("path", PATH);
+		sub_cfg.put_uint64("force_create", 1);
+		sub_cfg.put_uint64("size", SIZE);
+
+		config cfg;
+		cfg.put_string("subengine", "cmap");
+		cfg.put_object("subengine_config", sub_cfg.release(), [](void *c) {
+			pmemkv_config_delete(static_cast<pmemkv_config *>(c));
+		});
+		if (max_bytes)
+			cfg.put_uint64("max_bytes", max_bytes);
+		if (shards)
+			cfg.put_uint64("shards", shards);
+
+		kv.reset(new db);
+		return kv->open("readcache", std::move(cfg));
+	}
+};
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+TEST_F(ReadCacheTest, SimpleTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get("key1", [](string_view) {}) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_EQ(metric(*kv, "cache_entries"), 1);
+	ASSERT_EQ(metric(*kv, "cache_hits"), 0);
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->exists("key1") == status::OK);
+	ASSERT_EQ(metric(*kv, "cache_hits"), 2);
+	ASSERT_EQ(metric(*kv, "cache_bytes"), 10);
+
+	/* cached values are invalidated by writes */
+	ASSERT_TRUE(kv->put("key1", "value2") == status::OK) << errormsg();
+	ASSERT_EQ(metric(*kv, "cache_entries"), 0);
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value2");
+	ASSERT_TRUE(kv->remove("key1") == status::OK);
+	ASSERT_TRUE(kv->get("key1", &value) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("key1") == status::NOT_FOUND);
+
+	/* other operations are passed to the sub engine */
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 0);
+	ASSERT_NE(metric(*kv, "buckets"), -1);
+}
+
+TEST_F(ReadCacheTest, EvictionTest)
+{
+	/* a single shard with room for 10 records */
+	const size_t N = 100;
+	ASSERT_TRUE(Start(10 * 104, 1) == status::OK) << errormsg();
+	auto key = [](size_t i) { return std::to_string(1000 + i); };
+	for (size_t i = 0; i < N; i++)
+		ASSERT_TRUE(kv->put(key(i), std::string(100, 'a' + i % 26)) ==
+			    status::OK)
+			<< errormsg();
+
+	for (size_t round = 0; round < 2; round++) {
+		for (size_t i = 0; i < N; i++) {
+			std::string value;
+			ASSERT_TRUE(kv->get(key(i), &value) == status::OK);
+			ASSERT_EQ(value, std::string(100, 'a' + i % 26));
+		}
+		ASSERT_EQ(metric(*kv, "cache_entries"), 10);
+		ASSERT_EQ(metric(*kv, "cache_bytes"), 10 * 104);
+	}
+
+	/* recently used keys survive evictions */
+	for (size_t i = 0; i < 20; i++) {
+		std::string value;
+		ASSERT_TRUE(kv->get(key(N - 1), &value) == status::OK);
+		ASSERT_TRUE(kv->get(key(i), &value) == status::OK);
+	}
+	auto hits = metric(*kv, "cache_hits");
+	ASSERT_TRUE(kv->exists(key(N - 1)) == status::OK);
+	ASSERT_EQ(metric(*kv, "cache_hits"), hits + 1);
+
+	/* records bigger than the cache are not cached */
+	ASSERT_TRUE(kv->put("big", std::string(2000, 'b')) == status::OK);
+	std::string value;
+	ASSERT_TRUE(kv->get("big", &value) == status::OK &&
+		    value == std::string(2000, 'b'));
+	ASSERT_LE(metric(*kv, "cache_bytes"), 10 * 104);
+}
+
+TEST_F(ReadCacheTest, GetManyTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	for (size_t i = 0; i < 10; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), std::to_string(i) + "!") ==
+			    status::OK);
+
+	std::string value;
+	ASSERT_TRUE(kv->get("3", &value) == status::OK);
+	ASSERT_TRUE(kv->get("5", &value) == status::OK);
+
+	std::vector<string_view> keys{"5", "x", "3", "7", "1"};
+	std::vector<std::string> values(keys.size());
+	std::vector<status> statuses(keys.size(), status::UNKNOWN_ERROR);
+	auto s = kv->get_many(keys, [&](size_t i, status st, string_view v) {
+		statuses[i] = st;
+		values[i] = std::string(v.data(), v.size());
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (i == 1) {
+			ASSERT_TRUE(statuses[i] == status::NOT_FOUND);
+			continue;
+		}
+		ASSERT_TRUE(statuses[i] == status::OK);
+		ASSERT_EQ(values[i], std::string(keys[i].data(), keys[i].size()) + "!");
+	}
+	ASSERT_EQ(metric(*kv, "cache_entries"), 4);
+
+	/* values referenced from the cache stay valid after invalidation */
+	value_ref ref;
+	ASSERT_TRUE(kv->get_ref("7", ref) == status::OK);
+	ASSERT_TRUE(kv->put("7", "changed") == status::OK);
+	ASSERT_EQ(ref.value().compare("7!"), 0);
+	ref.release();
+	ASSERT_TRUE(kv->get_ref("7", ref) == status::OK);
+	ASSERT_EQ(ref.value().compare("changed"), 0);
+	ref.release();
+
+	write_batch batch;
+	batch.put("3", "batched");
+	batch.remove("5");
+	ASSERT_TRUE(kv->write(batch) == status::OK);
+	ASSERT_TRUE(kv->get("3", &value) == status::OK && value == "batched");
+	ASSERT_TRUE(kv->exists("5") == status::NOT_FOUND);
+}
+
+TEST_F(ReadCacheTest, MultithreadedTest)
+{
+	ASSERT_TRUE(Start(1 << 16, 8) == status::OK) << errormsg();
+	const size_t threads_number = 8;
+	const size_t keys_number = 100;
+	const size_t rounds = 50;
+	for (size_t i = 0; i < keys_number; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), "0") == status::OK);
+
+	/* every key is updated by one thread and read by all of them */
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < threads_number; t++) {
+		threads.emplace_back([&, t] {
+			for (size_t r = 1; r <= rounds; r++) {
+				for (size_t i = t; i < keys_number; i += threads_number) {
+					std::string istr = std::to_string(i);
+					ASSERT_TRUE(kv->put(istr, std::to_string(r)) ==
+						    status::OK);
+					std::string value;
+					ASSERT_TRUE(kv->get(istr, &value) == status::OK);
+					ASSERT_EQ(value, std::to_string(r));
+				}
+				for (size_t i = 0; i < keys_number; i++) {
+					std::string value;
+					ASSERT_TRUE(kv->get(std::to_string(i), &value) ==
+						    status::OK);
+				}
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+
+	for (size_t i = 0; i < keys_number; i++) {
+		std::string value;
+		ASSERT_TRUE(kv->get(std::to_string(i), &value) == status::OK);
+		ASSERT_EQ(value, std::to_string(rounds));
+	}
+}
+
+TEST_F(ReadCacheTest, RemoveRangeTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	for (size_t i = 0; i < 10; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), std::to_string(i)) == status::OK);
+	for (size_t i = 0; i < 10; i++)
+		ASSERT_TRUE(kv->exists(std::to_string(i)) == status::OK);
+
+	auto s = kv->remove_range("2", "5");
+	if (s == status::NOT_SUPPORTED)
+		return;
+	ASSERT_TRUE(s == status::OK) << errormsg();
+	for (size_t i = 0; i < 10; i++) {
+		std::string value;
+		auto expected = (i >= 2 && i < 5) ? status::NOT_FOUND : status::OK;
+		ASSERT_TRUE(kv->get(std::to_string(i), &value) == expected) << i;
+	}
+}
+
+TEST_F(ReadCacheTest, WrongConfigTest)
+{
+	config cfg;
+	cfg.put_string("subengine", "cmap");
+	kv.reset(new db);
+	ASSERT_TRUE(kv->open("readcache", std::move(cfg)) == status::INVALID_ARGUMENT);
+	kv.reset();
+
+	config cfg2;
+	cfg2.put_string("subengine", "cmap");
+	cfg2.put_uint64("shards", 0);
+	kv.reset(new db);
+	ASSERT_TRUE(kv->open("readcache", std::move(cfg2)) == status::INVALID_ARGUMENT);
+	kv.reset();
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2020, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../src/libpmemkv.hpp"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace pmem::kv;
+
+extern std::string test_path;
+const size_t SIZE = 1024ull * 1024ull * 64ull;
+const size_t SHARDS = 4;
+
+using kv_callback = std::function<get_kv_function>;
+
+class ShardedTest : public testing::Test {
+public:
+	std::vector<std::string> paths;
+	std::unique_ptr<db> kv;
+
+	ShardedTest()
+	{
+		for (size_t i = 0; i < SHARDS; i++) {
+			paths.push_back(test_path + "/sharded_test" + std::to_string(i));
+			std::remove(paths.back().c_str());
+		}
+	}
+
+	~ShardedTest()
+	{
+		if (kv)
+			kv->close();
+		for (auto &p : paths)
+			std::remove(p.c_str());
+	}
+
+	std::string PathList()
+	{
+		std::string list;
+		for (auto &p : paths)
+			list += (list.empty() ? "" : ",") + p;
+		return list;
+	}
+
+	status Start(const std::string &numa_nodes = "",
+		     const std::string &boundaries = "",
+		     const std::string &subengine = "cmap")
+	{
+		config cfg;
+		cfg.put_string("subengine", subengine);
+		cfg.put_string("paths", PathList());
+		cfg.put_uint64("force_create", 1);
+		cfg.put_uint64("size", SIZE);
+		if (!numa_nodes.empty())
+			cfg.put_string("numa_nodes", numa_nodes);
+		if (!boundaries.empty())
+			cfg.put_string("boundaries", boundaries);
+
+		kv.reset(new db);
+		return kv->open("sharded", std::move(cfg));
+	}
+
+	status Restart(const std::string &numa_nodes = "")
+	{
+		kv.reset();
+		config cfg;
+		cfg.put_string("subengine", "cmap");
+		cfg.put_string("paths", PathList());
+		if (!numa_nodes.empty())
+			cfg.put_string("numa_nodes", numa_nodes);
+
+		kv.reset(new db);
+		return kv->open("sharded", std::move(cfg));
+	}
+
+	void Check(const std::map<std::string, std::string> &expected)
+	{
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, expected.size());
+
+		std::map<std::string, std::string> all;
+		ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+			all.emplace(std::string(k.data(), k.size()),
+				    std::string(v.data(), v.size()));
+			return 0;
+		}) == status::OK);
+		ASSERT_TRUE(all == expected);
+
+		for (auto &e : expected) {
+			std::string value;
+			ASSERT_TRUE(kv->get(e.first, &value) == status::OK);
+			ASSERT_EQ(value, e.second);
+		}
+	}
+};
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+TEST_F(ShardedTest, SimpleTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get("key1", [](string_view) {}) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->exists("key1") == status::OK);
+
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->remove("key1") == status::OK);
+	ASSERT_TRUE(kv->exists("key1") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_FOUND);
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 0);
+	ASSERT_EQ(metric(*kv, "shards"), SHARDS);
+	ASSERT_NE(metric(*kv, "shard0_buckets"), -1);
+	ASSERT_NE(metric(*kv, "shard3_buckets"), -1);
+}
+
+TEST_F(ShardedTest, SpreadAndRecoveryTest)
+{
+	const size_t N = 1000;
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < N; i++) {
+		auto key = "key" + std::to_string(i);
+		ASSERT_TRUE(kv->put(key, std::to_string(i)) == status::OK) << errormsg();
+		expected[key] = std::to_string(i);
+	}
+	Check(expected);
+
+	/* every pool holds a part of the records */
+	kv.reset();
+	for (auto &p : paths) {
+		config cfg;
+		cfg.put_string("path", p);
+		db shard;
+		ASSERT_TRUE(shard.open("cmap", std::move(cfg)) == status::OK)
+			<< errormsg();
+		std::size_t cnt = 0;
+		ASSERT_TRUE(shard.count_all(cnt) == status::OK);
+		ASSERT_GT(cnt, N / SHARDS / 2);
+		ASSERT_LT(cnt, N / SHARDS * 2);
+		shard.close();
+	}
+
+	ASSERT_TRUE(Restart() == status::OK) << errormsg();
+	Check(expected);
+}
+
+TEST_F(ShardedTest, WriteBatchTest)
+{
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < 10; i++) {
+		ASSERT_TRUE(kv->put(std::to_string(i), "old") == status::OK);
+		expected[std::to_string(i)] = "old";
+	}
+
+	write_batch batch;
+	for (size_t i = 0; i < 100; i += 2) {
+		batch.put(std::to_string(i), "new");
+		expected[std::to_string(i)] = "new";
+	}
+	batch.remove("1");
+	batch.remove("3");
+	expected.erase("1");
+	expected.erase("3");
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+	Check(expected);
+}
+
+TEST_F(ShardedTest, NumaNodesTest)
+{
+	/* workers are bound to the first NUMA node, which always exists */
+	ASSERT_TRUE(Start("0,0,0,0") == status::OK) << errormsg();
+	std::map<std::string, std::string> expected;
+	write_batch batch;
+	for (size_t i = 0; i < 100; i++) {
+		ASSERT_TRUE(kv->put("a" + std::to_string(i), "1") == status::OK);
+		batch.put("b" + std::to_string(i), "2");
+		expected["a" + std::to_string(i)] = "1";
+		expected["b" + std::to_string(i)] = "2";
+	}
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+	Check(expected);
+	ASSERT_TRUE(kv->flush() == status::OK);
+
+	/* shards may be opened without workers or with other nodes */
+	ASSERT_TRUE(Restart() == status::OK) << errormsg();
+	Check(expected);
+	ASSERT_TRUE(Restart("0,0,0,0") == status::OK) << errormsg();
+	Check(expected);
+}
+
+TEST_F(ShardedTest, WrongConfigTest)
+{
+	config cfg;
+	cfg.put_string("subengine", "cmap");
+	kv.reset(new db);
+	ASSERT_TRUE(kv->open("sharded", std::move(cfg)) == status::INVALID_ARGUMENT);
+
+	config cfg2;
+	cfg2.put_string("subengine", "cmap");
+	cfg2.put_string("paths", ",");
+	kv.reset(new db);
+	ASSERT_TRUE(kv->open("sharded", std::move(cfg2)) == status::INVALID_ARGUMENT);
+
+	config cfg3;
+	cfg3.put_string("paths", PathList());
+	kv.reset(new db);
+	ASSERT_TRUE(kv->open("sharded", std::move(cfg3)) == status::INVALID_ARGUMENT);
+
+	/* one key less than paths, in order, is required */
+	ASSERT_TRUE(Start("", "b,c") == status::INVALID_ARGUMENT);
+	ASSERT_TRUE(Start("", "b,d,c") == status::INVALID_ARGUMENT);
+
+	/* one node per path is required */
+	ASSERT_TRUE(Start("0,0") == status::INVALID_ARGUMENT);
+	ASSERT_TRUE(Start("0,0,0,x") == status::INVALID_ARGUMENT);
+	ASSERT_TRUE(Start("0,0,0,100000") == status::INVALID_ARGUMENT);
+	kv.reset();
+}
+
+TEST_F(ShardedTest, RangePartitionTest)
+{
+	ASSERT_TRUE(Start("", "b,c,d") == status::OK) << errormsg();
+	std::map<std::string, std::string> expected;
+	for (auto key : {"", "a", "azz", "b", "b1", "c", "cc", "d", "zzz"}) {
+		ASSERT_TRUE(kv->put(key, "v") == status::OK) << errormsg();
+		expected[key] = "v";
+	}
+	Check(expected);
+
+	/* every pool holds the keys from its boundary up to the next one */
+	const std::vector<size_t> counts{3, 2, 2, 2};
+	kv.reset();
+	for (size_t i = 0; i < SHARDS; i++) {
+		config cfg;
+		cfg.put_string("path", paths[i]);
+		db shard;
+		ASSERT_TRUE(shard.open("cmap", std::move(cfg)) == status::OK)
+			<< errormsg();
+		std::size_t cnt = 0;
+		ASSERT_TRUE(shard.count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, counts[i]);
+		std::string boundary = std::string(1, static_cast<char>('a' + i));
+		ASSERT_TRUE(shard.get_all([&](string_view k, string_view) {
+			std::string key(k.data(), k.size());
+			EXPECT_TRUE(i == 0 || key >= boundary) << key;
+			EXPECT_TRUE(i == SHARDS - 1 ||
+				    key < std::string(1, static_cast<char>('b' + i)))
+				<< key;
+			return 0;
+		}) == status::OK);
+		shard.close();
+	}
+}
+
+#ifdef ENGINE_STREE
+TEST_F(ShardedTest, SortedRangeGetsTest)
+{
+	ASSERT_TRUE(Start("", "b,c,d", "stree") == status::OK) << errormsg();
+	const std::vector<std::string> keys{"a", "azz", "b", "b1", "c", "cc", "d", "zzz"};
+	for (auto &key : keys)
+		ASSERT_TRUE(kv->put(key, key + "!") == status::OK) << errormsg();
+
+	auto collect = [&](std::function<status(db &, kv_callback)> f) {
+		std::vector<std::string> result;
+		auto s = f(*kv, [&](string_view k, string_view v) {
+			EXPECT_EQ(std::string(k.data(), k.size()) + "!",
+				  std::string(v.data(), v.size()));
+			result.emplace_back(k.data(), k.size());
+			return 0;
+		});
+		EXPECT_TRUE(s == status::OK) << errormsg();
+		return result;
+	};
+
+	ASSERT_TRUE(collect([](db &d, kv_callback cb) { return d.get_all(cb); }) ==
+		    keys);
+	ASSERT_TRUE(collect([](db &d, kv_callback cb) {
+			    return d.get_above("b", cb);
+		    }) == std::vector<std::string>(keys.begin() + 3, keys.end()));
+	ASSERT_TRUE(collect([](db &d, kv_callback cb) {
+			    return d.get_equal_above("b", cb);
+		    }) == std::vector<std::string>(keys.begin() + 2, keys.end()));
+	ASSERT_TRUE(collect([](db &d, kv_callback cb) {
+			    return d.get_below("c", cb);
+		    }) == std::vector<std::string>(keys.begin(), keys.begin() + 4));
+	ASSERT_TRUE(collect([](db &d, kv_callback cb) {
+			    return d.get_equal_below("c", cb);
+		    }) == std::vector<std::string>(keys.begin(), keys.begin() + 5));
+	ASSERT_TRUE(collect([](db &d, kv_callback cb) {
+			    return d.get_between("a", "cd", cb);
+		    }) == std::vector<std::string>(keys.begin() + 1, keys.begin() + 6));
+
+	std::size_t cnt = 0;
+	ASSERT_TRUE(kv->count_between("a", "cd", cnt) == status::OK);
+	ASSERT_EQ(cnt, 5);
+
+	/* a callback stops the scan over all following shards */
+	size_t visited = 0;
+	auto s = kv->get_all([&](string_view, string_view) { return ++visited == 3; });
+	ASSERT_TRUE(s == status::STOPPED_BY_CB);
+	ASSERT_EQ(visited, 3);
+}
+#endif
+
+TEST_F(ShardedTest, HashPartitionRangeGetsTest)
+{
+	/* keys are hashed, so they cannot be returned in order */
+	ASSERT_TRUE(Start() == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get_above("a", [](string_view, string_view) { return 0; }) ==
+		    status::NOT_SUPPORTED);
+}
@@ -112,7 +112,7 @@ TEST_F(STreePmemobjTest, SimpleTest)
 	ASSERT_TRUE(cnt == 1);
 	ASSERT_TRUE(status::OK == kv->exists("key1"));
 	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
-	ASSERT_TRUE(kv->defrag() == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->defrag() == status::OK);
 }
 
 TEST_F(STreePmemobjTest, BinaryKeyTest)
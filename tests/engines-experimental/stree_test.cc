@@ -34,12 +34,33 @@
 #include "../../src/libpmemkv.hpp"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
 using namespace pmem::kv;
 
 extern std::string test_path;
 const size_t SIZE = 1024ull * 1024ull * 512ull;
 const size_t LARGE_SIZE = 1024ull * 1024ull * 1024ull * 2ull;
 
+template <typename Function>
+void parallel_exec(size_t threads_number, Function f)
+{
+	std::vector<std::thread> threads;
+	threads.reserve(threads_number);
+
+	for (size_t i = 0; i < threads_number; ++i) {
+		threads.emplace_back(f, i);
+	}
+
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
 template <size_t POOL_SIZE>
 class STreeBaseTest : public testing::Test {
 public:
@@ -112,7 +133,8 @@ TEST_F(STreeTest, SimpleTest)
 	ASSERT_TRUE(cnt == 1);
 	ASSERT_TRUE(status::OK == kv->exists("key1"));
 	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
-	ASSERT_TRUE(kv->defrag() == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->defrag() == status::OK);
+	ASSERT_TRUE(kv->defrag(50, 100) == status::INVALID_ARGUMENT);
 }
 
 TEST_F(STreeTest, BinaryKeyTest)
@@ -399,6 +421,166 @@ TEST_F(STreeTest, PutValuesOfDifferentSizesTest)
 		    value5 == "123456789ABCDEFGHI");
 }
 
+TEST_F(STreeTest, PutLongKeysAndValuesTest)
+{
+	const size_t N = 4 * internal::stree::DEGREE;
+	auto long_key = [](size_t i) { return std::string(100, 'k') + std::to_string(i); };
+	auto long_value = [](size_t i) { return std::to_string(i) + std::string(5000, 'v'); };
+
+	/* enough entries to split leaves with out-of-line keys */
+	for (size_t i = 0; i < N; i++)
+		ASSERT_TRUE(kv->put(long_key(i), long_value(i)) == status::OK)
+			<< errormsg();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == N);
+	for (size_t i = 0; i < N; i++) {
+		std::string value;
+		ASSERT_TRUE(kv->get(long_key(i), &value) == status::OK &&
+			    value == long_value(i));
+	}
+
+	/* out-of-line -> inline -> out-of-line */
+	ASSERT_TRUE(kv->put(long_key(1), "short") == status::OK) << errormsg();
+	std::string value;
+	ASSERT_TRUE(kv->get(long_key(1), &value) == status::OK && value == "short");
+	ASSERT_TRUE(kv->put(long_key(1), long_value(N)) == status::OK) << errormsg();
+	value.clear();
+	ASSERT_TRUE(kv->get(long_key(1), &value) == status::OK &&
+		    value == long_value(N));
+
+	for (size_t i = 0; i < N; i += 2)
+		ASSERT_TRUE(kv->remove(long_key(i)) == status::OK) << errormsg();
+	cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == N / 2);
+
+	Restart();
+
+	for (size_t i = 0; i < N; i++) {
+		value.clear();
+		auto s = kv->get(long_key(i), &value);
+		if (i % 2 == 0) {
+			ASSERT_TRUE(s == status::NOT_FOUND);
+		} else {
+			ASSERT_TRUE(s == status::OK &&
+				    value == (i == 1 ? long_value(N) : long_value(i)));
+		}
+	}
+
+	/* removed keys may still be used as separators */
+	for (size_t i = 0; i < N; i += 2)
+		ASSERT_TRUE(kv->put(long_key(i), "again") == status::OK) << errormsg();
+	for (size_t i = 0; i < N; i += 2) {
+		value.clear();
+		ASSERT_TRUE(kv->get(long_key(i), &value) == status::OK && value == "again");
+	}
+	cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == N);
+}
+
+TEST_F(STreeTest, GetManyLongKeysTest)
+{
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < 3 * internal::stree::DEGREE; i++) {
+		keys.push_back(std::string(64, 'a') + std::to_string(i));
+		ASSERT_TRUE(kv->put(keys.back(), keys.back()) == status::OK)
+			<< errormsg();
+	}
+	keys.push_back(std::string(64, 'b'));
+
+	std::vector<string_view> views(keys.begin(), keys.end());
+	size_t found = 0;
+	auto s = kv->get_many(views, [&](size_t pos, status st, string_view value) {
+		if (st == status::OK) {
+			ASSERT_TRUE(value.compare(views[pos]) == 0);
+			found++;
+		} else {
+			ASSERT_TRUE(pos == keys.size() - 1);
+		}
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	ASSERT_TRUE(found == keys.size() - 1);
+}
+
+TEST_F(STreeTest, LongKeysWithCommonPrefixTest)
+{
+	const size_t N = 4 * internal::stree::DEGREE;
+	/* keys differ early, so separators of leaves can be truncated */
+	auto key = [](size_t i) {
+		return std::to_string(i % 7) + "/table/" + std::string(64, 'r') +
+			std::to_string(i);
+	};
+
+	for (size_t i = 0; i < N; i++)
+		ASSERT_TRUE(kv->put(key(i), std::to_string(i)) == status::OK)
+			<< errormsg();
+	for (size_t i = 0; i < N; i += 2)
+		ASSERT_TRUE(kv->remove(key(i)) == status::OK) << errormsg();
+
+	Restart();
+
+	for (size_t i = 0; i < N; i++) {
+		std::string value;
+		auto s = kv->get(key(i), &value);
+		if (i % 2 == 0) {
+			ASSERT_TRUE(s == status::NOT_FOUND);
+		} else {
+			ASSERT_TRUE(s == status::OK && value == std::to_string(i));
+		}
+	}
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_between("1", "2", cnt) == status::OK);
+	size_t expected = 0;
+	for (size_t i = 1; i < N; i += 2)
+		expected += (i % 7 == 1);
+	ASSERT_TRUE(cnt == expected);
+}
+
+TEST_F(STreeTest, LayoutTest)
+{
+	auto open = [&](bool create, uint64_t degree) {
+		config cfg;
+		cfg.put_string("path", PATH);
+		if (create) {
+			std::remove(PATH.c_str());
+			cfg.put_uint64("force_create", 1);
+			cfg.put_int64("size", SIZE);
+			cfg.put_uint64("inline_key_size", 55);
+			cfg.put_uint64("inline_value_size", 119);
+		}
+		if (degree)
+			cfg.put_uint64("degree", degree);
+		return kv->open("stree", std::move(cfg));
+	};
+
+	kv->close();
+	ASSERT_TRUE(open(true, 32) == status::OK) << errormsg();
+	const size_t N = 4 * 32;
+	for (size_t i = 0; i < N; i++)
+		ASSERT_TRUE(kv->put(std::string(50, 'k') + std::to_string(i),
+				    std::to_string(i)) == status::OK)
+			<< errormsg();
+	kv->close();
+
+	/* the layout is recorded in the pool */
+	ASSERT_TRUE(open(false, 64) == status::INVALID_ARGUMENT);
+	ASSERT_TRUE(open(false, 0) == status::OK) << errormsg();
+	for (size_t i = 0; i < N; i++) {
+		std::string value;
+		ASSERT_TRUE(kv->get(std::string(50, 'k') + std::to_string(i), &value) ==
+				    status::OK &&
+			    value == std::to_string(i));
+	}
+	kv->close();
+
+	ASSERT_TRUE(open(true, 100) == status::INVALID_ARGUMENT);
+	ASSERT_TRUE(open(false, 32) == status::OK) << errormsg();
+}
+
 TEST_F(STreeTest, RemoveAllTest)
 {
 	std::size_t cnt = std::numeric_limits<std::size_t>::max();
@@ -1194,6 +1376,400 @@ TEST_F(STreeTest, UsesGetBetweenTest)
 	ASSERT_TRUE(result.empty());
 }
 
+TEST_F(STreeTest, GetManyTest)
+{
+	std::vector<string_view> keys{"b", "waldo", "a", "c"};
+	std::vector<status> statuses(keys.size(), status::UNKNOWN_ERROR);
+	auto s = kv->get_many(keys, [&](size_t idx, status st, string_view value) {
+		statuses[idx] = st;
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	ASSERT_TRUE(std::all_of(statuses.begin(), statuses.end(),
+				[](status st) { return st == status::NOT_FOUND; }));
+
+	ASSERT_TRUE(kv->put("a", "1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("b", "2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("c", "3") == status::OK) << errormsg();
+
+	std::vector<std::string> values(keys.size());
+	s = kv->get_many(keys, [&](size_t idx, status st, string_view value) {
+		statuses[idx] = st;
+		values[idx].assign(value.data(), value.size());
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	ASSERT_TRUE(statuses ==
+		    std::vector<status>({status::OK, status::NOT_FOUND, status::OK,
+					 status::OK}));
+	ASSERT_TRUE(values == std::vector<std::string>({"2", "", "1", "3"}));
+}
+
+TEST_F(STreeTest, GetRefTest)
+{
+	const std::string long_value(10000, 'x');
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", long_value) == status::OK) << errormsg();
+
+	value_ref ref;
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	ASSERT_TRUE(ref.value().compare("value1") == 0);
+	/* the reference is reused, previous value is released */
+	ASSERT_TRUE(kv->get_ref("key2", ref) == status::OK) << errormsg();
+	ASSERT_TRUE(ref.value().compare(long_value) == 0);
+	ASSERT_TRUE(kv->get_ref("nada", ref) == status::NOT_FOUND);
+	ASSERT_TRUE(ref.value().size() == 0);
+
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	value_ref moved(std::move(ref));
+	ASSERT_TRUE(moved.value().compare("value1") == 0);
+	moved.release();
+
+	ASSERT_TRUE(kv->put("key1", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get_ref("key1", moved) == status::OK) << errormsg();
+	ASSERT_TRUE(moved.value().compare("value2") == 0);
+}
+
+TEST_F(STreeTest, GetRefPinsValueTest)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+
+	value_ref ref;
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	std::atomic<bool> updated(false);
+	std::thread writer([&] {
+		ASSERT_TRUE(kv->put("key1", "VALUE1") == status::OK) << errormsg();
+		updated = true;
+	});
+
+	/* the writer waits until the reference is released */
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	ASSERT_TRUE(ref.value().compare("value1") == 0);
+	ASSERT_FALSE(updated);
+	ref.release();
+	writer.join();
+
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "VALUE1");
+}
+
+TEST_F(STreeTest, SimpleMultithreadedTest)
+{
+	size_t threads_number = 8;
+	size_t thread_items = 1000;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		/* interleave keys of threads, so that they share leaves */
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string istr = std::to_string(i * threads_number + thread_id);
+			ASSERT_TRUE(kv->put(istr, (istr + "!")) == status::OK)
+				<< errormsg();
+			std::string value;
+			ASSERT_TRUE(kv->get(istr, &value) == status::OK &&
+				    value == (istr + "!"));
+		}
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string istr = std::to_string(i * threads_number + thread_id);
+			std::string value;
+			ASSERT_TRUE(kv->get(istr, &value) == status::OK &&
+				    value == (istr + "!"));
+		}
+	});
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == threads_number * thread_items);
+
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i += 2) {
+			std::string istr = std::to_string(i * threads_number + thread_id);
+			ASSERT_TRUE(kv->remove(istr) == status::OK);
+			ASSERT_TRUE(kv->exists(istr) == status::NOT_FOUND);
+		}
+	});
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == threads_number * thread_items / 2);
+	ASSERT_TRUE(kv->count_below("9", cnt) == status::OK);
+	size_t below = 0;
+	for (size_t i = 1; i < thread_items; i += 2) {
+		for (size_t thread_id = 0; thread_id < threads_number; thread_id++) {
+			if (std::to_string(i * threads_number + thread_id) < "9")
+				below++;
+		}
+	}
+	ASSERT_TRUE(cnt == below);
+}
+
+TEST_F(STreeTest, MultithreadedReadWhileUpdateTest)
+{
+	const size_t keys_number = 500;
+	for (size_t i = 0; i < keys_number; i++)
+		ASSERT_TRUE(kv->put(std::to_string(i), std::string(10, 'A')) == status::OK);
+
+	size_t threads_number = 8;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		if (thread_id % 2) {
+			/* writers update values and insert new keys, splitting leaves */
+			for (size_t round = 0; round < 20; round++) {
+				const char c = static_cast<char>('B' + round % 20);
+				for (size_t i = thread_id; i < keys_number; i += threads_number)
+					ASSERT_TRUE(kv->put(std::to_string(i),
+							    std::string(10, c)) == status::OK);
+				ASSERT_TRUE(kv->put(std::to_string(thread_id) + "_" +
+							    std::to_string(round),
+						    "x") == status::OK);
+			}
+		} else {
+			/* readers always see one of the complete values */
+			for (size_t round = 0; round < 20; round++) {
+				for (size_t i = 0; i < keys_number; i++) {
+					std::string value;
+					ASSERT_TRUE(kv->get(std::to_string(i), &value) ==
+						    status::OK);
+					ASSERT_TRUE(value.size() == 10 &&
+						    value == std::string(10, value[0]));
+				}
+			}
+		}
+	});
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == keys_number + threads_number / 2 * 20);
+}
+
+TEST_F(STreeTest, WriteBatchTest)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+
+	write_batch batch;
+	ASSERT_TRUE(batch.put("key3", "value3") == status::OK);
+	ASSERT_TRUE(batch.put("key1", "VALUE1") == status::OK);
+	ASSERT_TRUE(batch.remove("key2") == status::OK);
+	ASSERT_TRUE(batch.remove("nada") == status::OK);
+	ASSERT_TRUE(batch.put("key2", "VALUE2") == status::OK);
+	ASSERT_TRUE(batch.remove("key3") == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+
+	/* the batch is persistent once write() returns */
+	Restart();
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "VALUE1");
+	ASSERT_TRUE(kv->get("key2", &value) == status::OK && value == "VALUE2");
+	ASSERT_TRUE(kv->exists("key3") == status::NOT_FOUND);
+
+	ASSERT_TRUE(batch.clear() == status::OK);
+	ASSERT_TRUE(batch.put("key4", "value4") == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 3);
+}
+
+TEST_F(STreeTest, UpdateTest)
+{
+	auto counter = [](int64_t v) {
+		return std::string(reinterpret_cast<const char *>(&v), sizeof(v));
+	};
+
+	/* concurrent increments, of keys inserted by them and splitting leaves */
+	size_t threads_number = 8;
+	size_t keys_number = 500;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < keys_number; i++) {
+			auto key = std::to_string((i * 7 + thread_id) % keys_number);
+			ASSERT_TRUE(kv->merge(key, PMEMKV_MERGE_INCREMENT, counter(3)) ==
+				    status::OK)
+				<< errormsg();
+		}
+	});
+	auto verify = [&] {
+		for (size_t i = 0; i < keys_number; i++) {
+			std::string value;
+			ASSERT_TRUE(kv->get(std::to_string(i), &value) == status::OK);
+			ASSERT_EQ(value,
+				  counter(static_cast<int64_t>(3 * threads_number)));
+		}
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, keys_number);
+	};
+	verify();
+
+	/* compare-and-swap, also of a value stored out of the leaf */
+	auto cas = [&](string_view expected, string_view desired) {
+		auto swap = [&](const string_view *v, std::string &nv) {
+			bool matches = v ? string_view(*v).compare(expected) == 0
+					 : expected.size() == 0;
+			if (!matches)
+				return false;
+			nv.assign(desired.data(), desired.size());
+			return true;
+		};
+		return kv->update("cas", swap);
+	};
+	ASSERT_TRUE(cas("a", "b") == status::STOPPED_BY_CB);
+	ASSERT_TRUE(kv->exists("cas") == status::NOT_FOUND);
+	ASSERT_TRUE(cas("", "a") == status::OK) << errormsg();
+	ASSERT_TRUE(cas("b", "c") == status::STOPPED_BY_CB);
+	ASSERT_TRUE(cas("a", std::string(1000, 'b')) == status::OK) << errormsg();
+	ASSERT_TRUE(cas(std::string(1000, 'b'), "c") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->merge("cas", PMEMKV_MERGE_APPEND, "d") == status::OK);
+	ASSERT_TRUE(kv->merge("cas", PMEMKV_MERGE_INCREMENT, counter(1)) ==
+		    status::INVALID_ARGUMENT);
+
+	Restart();
+	std::string value;
+	ASSERT_TRUE(kv->get("cas", &value) == status::OK && value == "cd");
+	ASSERT_TRUE(kv->remove("cas") == status::OK);
+	verify();
+}
+
+TEST_F(STreeTest, PutIfAbsentTest)
+{
+	/* every key is inserted by exactly one of the threads, splitting leaves */
+	size_t threads_number = 8;
+	size_t keys_number = 1000;
+	std::atomic<size_t> inserts(0);
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < keys_number; i++) {
+			auto key = std::to_string((i * 7 + thread_id) % keys_number);
+			bool inserted = false;
+			std::string value;
+			auto s = kv->get_or_insert(key, std::to_string(thread_id), &value,
+						   &inserted);
+			ASSERT_TRUE(s == status::OK) << errormsg();
+			if (inserted)
+				inserts++;
+			std::string stored;
+			ASSERT_TRUE(kv->get(key, &stored) == status::OK);
+			ASSERT_EQ(stored, value);
+		}
+	});
+	ASSERT_EQ(inserts.load(), keys_number);
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, keys_number);
+
+	bool inserted = true;
+	ASSERT_TRUE(kv->put_if_absent("0", std::string(1000, 'x'), &inserted) ==
+		    status::OK);
+	ASSERT_FALSE(inserted);
+	ASSERT_TRUE(kv->put_if_absent("long", std::string(1000, 'x'), &inserted) ==
+		    status::OK);
+	ASSERT_TRUE(inserted);
+
+	Restart();
+	std::string value;
+	ASSERT_TRUE(kv->get("long", &value) == status::OK);
+	ASSERT_EQ(value, std::string(1000, 'x'));
+	ASSERT_TRUE(kv->get("0", &value) == status::OK);
+	ASSERT_EQ(value.size(), 1U);
+}
+
+TEST_F(STreeTest, IteratorEmptyTest)
+{
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key;
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+	ASSERT_TRUE(it.next() == status::NOT_FOUND);
+	ASSERT_TRUE(it.prev() == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_to_first() == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_to_last() == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek("a") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_lower("a") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_higher_eq("a") == status::NOT_FOUND);
+}
+
+TEST_F(STreeTest, IteratorSeekTest)
+{
+	ASSERT_TRUE(kv->put("b", "1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("d", "2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("f", "3") == status::OK) << errormsg();
+
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key, value;
+
+	ASSERT_TRUE(it.seek("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.value(value) == status::OK);
+	ASSERT_EQ(std::string(value.data(), value.size()), "2");
+	ASSERT_TRUE(it.seek("c") == status::NOT_FOUND);
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_lower("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "b");
+	ASSERT_TRUE(it.seek_lower("b") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_lower("z") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+
+	ASSERT_TRUE(it.seek_lower_eq("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_lower_eq("e") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_lower_eq("a") == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_higher("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+	ASSERT_TRUE(it.seek_higher("f") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_higher("") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "b");
+
+	ASSERT_TRUE(it.seek_higher_eq("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_higher_eq("e") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+	ASSERT_TRUE(it.seek_higher_eq("g") == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_to_first() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "b");
+	ASSERT_TRUE(it.seek_to_last() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+}
+
+TEST_F(STreeTest, IteratorNextPrevTest)
+{
+	ASSERT_TRUE(kv->put("b", "1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("d", "2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("f", "3") == status::OK) << errormsg();
+
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key;
+
+	ASSERT_TRUE(it.seek_to_first() == status::OK);
+	ASSERT_TRUE(it.is_next() == status::OK);
+	ASSERT_TRUE(it.next() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.next() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+	ASSERT_TRUE(it.is_next() == status::NOT_FOUND);
+	ASSERT_TRUE(it.prev() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_to_last() == status::OK);
+	ASSERT_TRUE(it.next() == status::NOT_FOUND);
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+	ASSERT_TRUE(it.next() == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_to_first() == status::OK);
+	ASSERT_TRUE(it.prev() == status::NOT_FOUND);
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+}
+
 // =============================================================================================
 // TEST RECOVERY OF SINGLE-LEAF TREE
 // =============================================================================================
@@ -1398,6 +1974,1017 @@ TEST_F(STreeTest, SingleInnerNodeDescendingTest2)
 	ASSERT_TRUE(cnt == SINGLE_INNER_LIMIT);
 }
 
+TEST_F(STreeTest, SingleInnerNodeIteratorTest)
+{
+	for (std::size_t i = 10000; i < (10000 + SINGLE_INNER_LIMIT); i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	/* leave some of the leaves empty, they are not merged */
+	for (std::size_t i = 10000 + LEAF_ENTRIES; i < 10000 + 4 * LEAF_ENTRIES; i++)
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK) << errormsg();
+
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key;
+
+	std::size_t visited = 0;
+	std::string prev_key;
+	for (auto s = it.seek_to_first(); s == status::OK; s = it.next()) {
+		ASSERT_TRUE(it.key(key) == status::OK);
+		std::string k(key.data(), key.size());
+		ASSERT_TRUE(prev_key < k);
+		prev_key = k;
+		visited++;
+	}
+	ASSERT_EQ(visited, SINGLE_INNER_LIMIT - 3 * LEAF_ENTRIES);
+
+	visited = 0;
+	for (auto s = it.seek_to_last(); s == status::OK; s = it.prev())
+		visited++;
+	ASSERT_EQ(visited, SINGLE_INNER_LIMIT - 3 * LEAF_ENTRIES);
+
+	ASSERT_TRUE(it.seek_higher_eq(std::to_string(10000 + 2 * LEAF_ENTRIES)) ==
+		    status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()),
+		  std::to_string(10000 + 4 * LEAF_ENTRIES));
+	ASSERT_TRUE(it.prev() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()),
+		  std::to_string(10000 + LEAF_ENTRIES - 1));
+}
+
+TEST_F(STreeTest, MultipleInnerNodesCountTest)
+{
+	const size_t limit = 4 * SINGLE_INNER_LIMIT;
+	for (std::size_t i = 10000; i < (10000 + limit); i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	/* overwriting existing keys does not change counts */
+	for (std::size_t i = 10000; i < (10000 + LEAF_ENTRIES); i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+	for (std::size_t i = 10000 + limit / 4; i < 10000 + limit / 2; i++)
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove(std::to_string(10000 + limit / 3)) == status::NOT_FOUND);
+
+	const size_t expected = limit - limit / 4;
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, expected);
+
+	std::string k1 = std::to_string(10000 + limit / 8);
+	std::string k2 = std::to_string(10000 + 3 * limit / 4);
+	ASSERT_TRUE(kv->count_below(k1, cnt) == status::OK);
+	ASSERT_EQ(cnt, limit / 8);
+	ASSERT_TRUE(kv->count_equal_below(k1, cnt) == status::OK);
+	ASSERT_EQ(cnt, limit / 8 + 1);
+	ASSERT_TRUE(kv->count_above(k1, cnt) == status::OK);
+	ASSERT_EQ(cnt, expected - limit / 8 - 1);
+	ASSERT_TRUE(kv->count_equal_above(k1, cnt) == status::OK);
+	ASSERT_EQ(cnt, expected - limit / 8);
+	ASSERT_TRUE(kv->count_between(k1, k2, cnt) == status::OK);
+	ASSERT_EQ(cnt, limit / 8 - 1 + limit / 4);
+	ASSERT_TRUE(kv->count_between(k2, k1, cnt) == status::OK);
+	ASSERT_EQ(cnt, 0);
+
+	/* key from the removed range */
+	std::string k3 = std::to_string(10000 + limit / 3);
+	ASSERT_TRUE(kv->count_below(k3, cnt) == status::OK);
+	ASSERT_EQ(cnt, limit / 4);
+	ASSERT_TRUE(kv->count_equal_above(k3, cnt) == status::OK);
+	ASSERT_EQ(cnt, limit / 2);
+
+	Restart();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, expected);
+	ASSERT_TRUE(kv->count_between(k1, k2, cnt) == status::OK);
+	ASSERT_EQ(cnt, limit / 8 - 1 + limit / 4);
+}
+
+TEST_F(STreeTest, BulkLoadTest)
+{
+	/* every third value is stored out of line */
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < (10000 + 4 * SINGLE_INNER_LIMIT); i++) {
+		std::string istr = std::to_string(i);
+		records[istr] = (i % 3 == 0) ? std::string(100, 'v') + istr : istr;
+	}
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) == status::OK)
+		<< errormsg();
+
+	auto verify = [&] {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+		auto first = records.begin();
+		ASSERT_TRUE(kv->count_below(std::next(first, 1000)->first, cnt) ==
+			    status::OK);
+		ASSERT_EQ(cnt, 1000);
+
+		auto it = records.begin();
+		kv->get_all([&](string_view k, string_view v) {
+			EXPECT_EQ(k.compare(it->first), 0);
+			EXPECT_EQ(v.compare(it->second), 0);
+			++it;
+			return 0;
+		});
+		ASSERT_TRUE(it == records.end());
+
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+	};
+	verify();
+
+	/* loaded tree takes further puts and removes */
+	for (std::size_t i = 10000; i < (10000 + 4 * SINGLE_INNER_LIMIT); i += 7) {
+		std::string istr = std::to_string(i) + "!";
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+		ASSERT_TRUE(kv->remove(std::to_string(i + 1)) == status::OK)
+			<< errormsg();
+		records.erase(std::to_string(i + 1));
+	}
+	verify();
+
+	Restart();
+	verify();
+}
+
+TEST_F(STreeTest, BulkLoadNotEmptyTest)
+{
+	ASSERT_TRUE(kv->put("b", "1") == status::OK) << errormsg();
+
+	std::map<std::string, std::string> records{{"a", "2"}, {"c", "3"}};
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) == status::OK)
+		<< errormsg();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 3);
+	std::string value;
+	ASSERT_TRUE(kv->get("a", &value) == status::OK && value == "2");
+	ASSERT_TRUE(kv->get("c", &value) == status::OK && value == "3");
+}
+
+TEST_F(STreeTest, BulkLoadUnsortedTest)
+{
+	std::vector<std::pair<std::string, std::string>> records;
+	for (std::size_t i = 10000; i < (10000 + 2 * LEAF_ENTRIES); i++)
+		records.emplace_back(std::to_string(i), std::to_string(i));
+	records.emplace_back("1", "1");
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) ==
+		    status::INVALID_ARGUMENT);
+
+	/* some of the preceding records are loaded, in order */
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt < records.size());
+	for (std::size_t i = 0; i < cnt; i++)
+		ASSERT_TRUE(kv->exists(records[i].first) == status::OK);
+	ASSERT_TRUE(kv->put("1", "1") == status::OK) << errormsg();
+
+	Restart();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(kv->exists("1") == status::OK);
+}
+
+TEST_F(STreeTest, RemoveRangeTest)
+{
+	/* long keys with a common prefix are used as separators of leaves */
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < (10000 + 4 * SINGLE_INNER_LIMIT); i++) {
+		std::string istr = std::to_string(i);
+		std::string key = (i % 2 == 0) ? std::string(100, 'k') + istr : istr;
+		records[key] = (i % 3 == 0) ? std::string(100, 'v') + istr : istr;
+		ASSERT_TRUE(kv->put(key, records[key]) == status::OK) << errormsg();
+	}
+
+	auto remove_range = [&](const std::string &k1, const std::string &k2) {
+		ASSERT_TRUE(kv->remove_range(k1, k2) == status::OK) << errormsg();
+		if (k1 < k2)
+			records.erase(records.lower_bound(k1), records.lower_bound(k2));
+	};
+	auto verify = [&] {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+
+		auto it = records.begin();
+		kv->get_all([&](string_view k, string_view v) {
+			EXPECT_EQ(k.compare(it->first), 0);
+			EXPECT_EQ(v.compare(it->second), 0);
+			++it;
+			return 0;
+		});
+		ASSERT_TRUE(it == records.end());
+
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+	};
+
+	/* within a leaf, across many leaves and with missing bounds */
+	remove_range("10010", "10013");
+	remove_range("10100", "12000");
+	remove_range(std::string(100, 'k') + "10500",
+		     std::string(100, 'k') + "13001");
+	remove_range("12500", "12500");
+	remove_range("13000", "12000");
+	verify();
+
+	/* removed ranges take new records */
+	for (std::size_t i = 10100; i < 12000; i += 3) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+		records[istr] = istr + "!";
+	}
+	verify();
+
+	Restart();
+	verify();
+	remove_range("", std::string(101, 'k'));
+	verify();
+	ASSERT_TRUE(kv->put("a", "1") == status::OK) << errormsg();
+	records["a"] = "1";
+	verify();
+}
+
+TEST_F(STreeTest, RemoveRangeBulkLoadedTest)
+{
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < (10000 + 4 * SINGLE_INNER_LIMIT); i++) {
+		std::string istr = std::to_string(i);
+		records[istr] = (i % 3 == 0) ? std::string(100, 'v') + istr : istr;
+	}
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) == status::OK)
+		<< errormsg();
+
+	std::string k1 = std::to_string(10000 + SINGLE_INNER_LIMIT / 2);
+	std::string k2 = std::to_string(10000 + 3 * SINGLE_INNER_LIMIT);
+	ASSERT_TRUE(kv->remove_range(k1, k2) == status::OK) << errormsg();
+	records.erase(records.lower_bound(k1), records.lower_bound(k2));
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, records.size());
+	ASSERT_TRUE(kv->count_below(k2, cnt) == status::OK);
+	ASSERT_EQ(cnt, SINGLE_INNER_LIMIT / 2);
+	ASSERT_TRUE(kv->exists(k1) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists(k2) == status::OK);
+
+	/* iteration goes from the last leaf before the range to the one after it */
+	std::size_t visited = 0;
+	kv->get_above(std::to_string(10000 + SINGLE_INNER_LIMIT / 2 - 2),
+		      [&](string_view k, string_view) {
+			      if (visited++ == 1) {
+				      EXPECT_EQ(k.compare(k2), 0);
+			      }
+			      return visited == 2 ? 1 : 0;
+		      });
+	ASSERT_EQ(visited, 2);
+
+	Restart();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, records.size());
+	std::string value;
+	for (auto &record : records) {
+		ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+		ASSERT_EQ(value, record.second);
+	}
+}
+
+TEST_F(STreeTest, RemoveRangeOfRemovedSeparatorsTest)
+{
+	/* out-of-line keys removed one by one may still be separators of leaves */
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < (10000 + 4 * SINGLE_INNER_LIMIT); i++) {
+		std::string key = std::string(100, 'k') + std::to_string(i);
+		records[key] = key + "!";
+		ASSERT_TRUE(kv->put(key, records[key]) == status::OK) << errormsg();
+	}
+	for (auto it = records.begin(); it != records.end();) {
+		if (std::stoul(it->first.substr(100)) % 4 != 0) {
+			++it;
+			continue;
+		}
+		ASSERT_TRUE(kv->remove(it->first) == status::OK) << errormsg();
+		it = records.erase(it);
+	}
+
+	std::string k1 =
+		std::string(100, 'k') + std::to_string(10000 + SINGLE_INNER_LIMIT);
+	std::string k2 =
+		std::string(100, 'k') + std::to_string(10000 + 3 * SINGLE_INNER_LIMIT);
+	ASSERT_TRUE(kv->remove_range(k1, k2) == status::OK) << errormsg();
+	records.erase(records.lower_bound(k1), records.lower_bound(k2));
+
+	/* the same keys are inserted again, with new out-of-line buffers */
+	for (std::size_t i = 10000; i < (10000 + 4 * SINGLE_INNER_LIMIT); i += 2) {
+		std::string key = std::string(100, 'k') + std::to_string(i);
+		records[key] = key + "?";
+		ASSERT_TRUE(kv->put(key, records[key]) == status::OK) << errormsg();
+	}
+
+	for (int restart = 0; restart < 2; restart++) {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+		auto it = records.begin();
+		kv->get_all([&](string_view k, string_view v) {
+			EXPECT_EQ(k.compare(it->first), 0);
+			EXPECT_EQ(v.compare(it->second), 0);
+			++it;
+			return 0;
+		});
+		ASSERT_TRUE(it == records.end());
+
+		Restart();
+	}
+
+	ASSERT_TRUE(kv->remove_range("", std::string(101, 'k')) == status::OK)
+		<< errormsg();
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 0);
+}
+
+TEST_F(STreeTest, DefragTest)
+{
+	/* churn leaves some leaves empty, every third value is stored out of line */
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i++) {
+		std::string istr = std::to_string(i);
+		std::string key = (i % 2 == 0) ? std::string(60, 'k') + istr : istr;
+		std::string value = (i % 3 == 0) ? std::string(200, 'v') + istr : istr;
+		ASSERT_TRUE(kv->put(key, value) == status::OK) << errormsg();
+		records[key] = value;
+	}
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT / 2; i++) {
+		std::string istr = std::to_string(i);
+		std::string key = (i % 2 == 0) ? std::string(60, 'k') + istr : istr;
+		ASSERT_TRUE(kv->remove(key) == status::OK) << errormsg();
+		records.erase(key);
+	}
+
+	auto verify = [&] {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+	};
+
+	/* the whole pool, in slices */
+	for (int start = 0; start < 100; start += 10) {
+		ASSERT_TRUE(kv->defrag(start, 10) == status::OK) << errormsg();
+		verify();
+	}
+	ASSERT_TRUE(kv->defrag() == status::OK) << errormsg();
+	verify();
+
+	/* relocated leaves take further puts and removes */
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i += 5) {
+		std::string istr = std::to_string(i) + "!";
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+	}
+	for (auto it = records.begin(); it != records.end();) {
+		ASSERT_TRUE(kv->remove(it->first) == status::OK) << errormsg();
+		it = records.erase(it);
+		for (int n = 0; n < 6 && it != records.end(); n++)
+			++it;
+	}
+	verify();
+
+	Restart();
+	verify();
+}
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+TEST_F(STreeTest, MetricsTest)
+{
+	ASSERT_EQ(metric(*kv, "depth"), 0);
+	ASSERT_EQ(metric(*kv, "leaf_splits"), 0);
+
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	auto leaves = metric(*kv, "leaves");
+	ASSERT_GT(leaves, 1);
+	ASSERT_EQ(metric(*kv, "leaf_splits"), leaves - 1);
+	ASSERT_GT(metric(*kv, "inner_node_splits"), 0);
+	ASSERT_EQ(metric(*kv, "depth"), 3);
+	ASSERT_GT(metric(*kv, "inner_nodes"), 1);
+	auto fill = metric(*kv, "leaf_fill_factor");
+	ASSERT_NEAR(fill, 2.0 * SINGLE_INNER_LIMIT / (leaves * LEAF_ENTRIES), 1e-5);
+
+	/* splits are counted since the pool was opened, the shape is kept */
+	Restart();
+	ASSERT_EQ(metric(*kv, "leaf_splits"), 0);
+	ASSERT_EQ(metric(*kv, "leaves"), leaves);
+	ASSERT_EQ(metric(*kv, "leaf_fill_factor"), fill);
+}
+
+TEST_F(STreeTest, DramIndexTest)
+{
+	auto open = [&] {
+		config cfg;
+		cfg.put_string("path", PATH);
+		cfg.put_uint64("dram_index", 1);
+		return kv->open("stree", std::move(cfg));
+	};
+	/* the index is built in background, after the engine is opened */
+	auto wait_for_index = [&] {
+		while (metric(*kv, "dram_index_ready") != 1)
+			std::this_thread::yield();
+	};
+
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i += 2) {
+		std::string istr = std::to_string(i);
+		records[istr] = istr + "!";
+	}
+	kv->close();
+	ASSERT_TRUE(open() == status::OK) << errormsg();
+	wait_for_index();
+	ASSERT_EQ(metric(*kv, "dram_index_leaves"), 0);
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) == status::OK)
+		<< errormsg();
+
+	/* fill the gaps concurrently, long keys are stored out of line */
+	const size_t threads_number = 8;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (std::size_t i = 10001 + 2 * thread_id;
+		     i < 10000 + 2 * SINGLE_INNER_LIMIT; i += 2 * threads_number) {
+			std::string istr = std::to_string(i);
+			if (i % 3 == 0)
+				istr = std::string(100, 'k') + istr;
+			ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK)
+				<< errormsg();
+		}
+	});
+	for (std::size_t i = 10001; i < 10000 + 2 * SINGLE_INNER_LIMIT; i += 2) {
+		std::string istr = std::to_string(i);
+		if (i % 3 == 0)
+			istr = std::string(100, 'k') + istr;
+		records[istr] = istr + "!";
+	}
+
+	auto verify = [&] {
+		ASSERT_EQ(metric(*kv, "dram_index_leaves"), metric(*kv, "leaves"));
+		for (auto &r : records) {
+			std::string value;
+			ASSERT_TRUE(kv->get(r.first, &value) == status::OK) << r.first;
+			ASSERT_EQ(value, r.second);
+		}
+		ASSERT_TRUE(kv->exists("1") == status::NOT_FOUND);
+		ASSERT_TRUE(kv->exists("99999") == status::NOT_FOUND);
+		ASSERT_TRUE(kv->exists(std::string(100, 'k')) == status::NOT_FOUND);
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+	};
+	verify();
+
+	ASSERT_TRUE(kv->remove_range("10100", "12000") == status::OK) << errormsg();
+	records.erase(records.lower_bound("10100"), records.lower_bound("12000"));
+	verify();
+	ASSERT_TRUE(kv->defrag() == status::OK) << errormsg();
+	verify();
+
+	kv->close();
+	ASSERT_TRUE(open() == status::OK) << errormsg();
+	for (auto &r : records) {
+		std::string value;
+		ASSERT_TRUE(kv->get(r.first, &value) == status::OK) << r.first;
+	}
+	wait_for_index();
+	verify();
+
+	/* writes racing with the build of the index are indexed as well */
+	kv->close();
+	ASSERT_TRUE(open() == status::OK) << errormsg();
+	for (std::size_t i = 0; i < 100; i++) {
+		std::string istr = "race" + std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+		records[istr] = istr + "!";
+	}
+	wait_for_index();
+	verify();
+}
+
+TEST_F(STreeTest, BloomFilterTest)
+{
+	auto open = [&] {
+		config cfg;
+		cfg.put_string("path", PATH);
+		cfg.put_uint64("bloom_bits_per_key", 10);
+		return kv->open("stree", std::move(cfg));
+	};
+	auto wait_for_filter = [&] {
+		while (metric(*kv, "bloom_filter_ready") != 1)
+			std::this_thread::yield();
+	};
+
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i += 2) {
+		std::string istr = std::to_string(i);
+		records[istr] = istr + "!";
+	}
+	kv->close();
+	ASSERT_TRUE(open() == status::OK) << errormsg();
+	wait_for_filter();
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) == status::OK)
+		<< errormsg();
+	ASSERT_EQ(metric(*kv, "bloom_filter_keys"), records.size());
+
+	/* keys put concurrently are added, the filter grows when it is overfull */
+	auto bits = metric(*kv, "bloom_filter_bits");
+	const size_t threads_number = 8;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (std::size_t i = 10001 + 2 * thread_id;
+		     i < 10000 + 6 * SINGLE_INNER_LIMIT; i += 2 * threads_number) {
+			std::string istr = std::to_string(i);
+			ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK)
+				<< errormsg();
+		}
+	});
+	for (std::size_t i = 10001; i < 10000 + 6 * SINGLE_INNER_LIMIT; i += 2) {
+		std::string istr = std::to_string(i);
+		records[istr] = istr + "!";
+	}
+	ASSERT_GT(metric(*kv, "bloom_filter_bits"), bits);
+
+	auto verify = [&] {
+		for (auto &r : records) {
+			std::string value;
+			ASSERT_TRUE(kv->get(r.first, &value) == status::OK) << r.first;
+			ASSERT_EQ(value, r.second);
+			ASSERT_TRUE(kv->exists(r.first) == status::OK) << r.first;
+		}
+		for (std::size_t i = 0; i < 1000; i++) {
+			std::string istr = "missing" + std::to_string(i);
+			ASSERT_TRUE(kv->exists(istr) == status::NOT_FOUND);
+			std::string value;
+			ASSERT_TRUE(kv->get(istr, &value) == status::NOT_FOUND);
+		}
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+	};
+	verify();
+
+	/* removed keys stay in the filter, but are not found */
+	ASSERT_TRUE(kv->remove("10000") == status::OK);
+	ASSERT_TRUE(kv->remove("10000") == status::NOT_FOUND);
+	records.erase("10000");
+	ASSERT_TRUE(kv->remove_range("10100", "12000") == status::OK) << errormsg();
+	records.erase(records.lower_bound("10100"), records.lower_bound("12000"));
+	verify();
+
+	/* writes racing with the build of the filter are added as well */
+	kv->close();
+	ASSERT_TRUE(open() == status::OK) << errormsg();
+	for (std::size_t i = 0; i < 100; i++) {
+		std::string istr = "race" + std::to_string(i);
+		bool inserted = false;
+		ASSERT_TRUE(kv->put_if_absent(istr, istr + "!", &inserted) == status::OK)
+			<< errormsg();
+		ASSERT_TRUE(inserted);
+		records[istr] = istr + "!";
+	}
+	wait_for_filter();
+	verify();
+	/* a key put while the filter is built may be added twice */
+	ASSERT_GE(metric(*kv, "bloom_filter_keys"), records.size());
+
+	kv->close();
+	config cfg;
+	cfg.put_string("path", PATH);
+	cfg.put_uint64("bloom_bits_per_key", 65);
+	ASSERT_TRUE(kv->open("stree", std::move(cfg)) == status::INVALID_ARGUMENT);
+	ASSERT_TRUE(open() == status::OK) << errormsg();
+}
+
+TEST_F(STreeTest, MergeLeavesTest)
+{
+	kv->close();
+	config cfg;
+	cfg.put_string("path", PATH);
+	cfg.put_uint64("dram_index", 1);
+	ASSERT_TRUE(kv->open("stree", std::move(cfg)) == status::OK) << errormsg();
+	while (metric(*kv, "dram_index_ready") != 1)
+		std::this_thread::yield();
+
+	const size_t count = 4 * SINGLE_INNER_LIMIT;
+	for (std::size_t i = 0; i < count; i++) {
+		std::string istr = std::to_string(10000 + i);
+		if (i % 3 == 0)
+			istr = std::string(100, 'k') + istr;
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+	auto leaves = metric(*kv, "leaves");
+	auto depth = metric(*kv, "depth");
+
+	/* leave every tenth record, concurrent removes merge leaves */
+	const size_t threads_number = 8;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (std::size_t i = thread_id; i < count; i += threads_number) {
+			if (i % 10 == 0)
+				continue;
+			std::string istr = std::to_string(10000 + i);
+			if (i % 3 == 0)
+				istr = std::string(100, 'k') + istr;
+			ASSERT_TRUE(kv->remove(istr) == status::OK) << istr;
+		}
+	});
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 0; i < count; i += 10) {
+		std::string istr = std::to_string(10000 + i);
+		if (i % 3 == 0)
+			istr = std::string(100, 'k') + istr;
+		records[istr] = istr + "!";
+	}
+
+	ASSERT_GT(metric(*kv, "leaf_merges"), 0);
+	ASSERT_LT(metric(*kv, "leaves"), leaves / 2);
+	ASSERT_LE(metric(*kv, "depth"), depth);
+	auto verify = [&] {
+		ASSERT_EQ(metric(*kv, "dram_index_leaves"), metric(*kv, "leaves"));
+		auto it = records.begin();
+		ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+			EXPECT_TRUE(it != records.end());
+			EXPECT_EQ(k.compare(it->first), 0);
+			EXPECT_EQ(v.compare(it->second), 0);
+			++it;
+			return 0;
+		}) == status::OK);
+		ASSERT_TRUE(it == records.end());
+		for (auto &r : records) {
+			std::string value;
+			ASSERT_TRUE(kv->get(r.first, &value) == status::OK) << r.first;
+			ASSERT_EQ(value, r.second);
+		}
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		const std::string middle = std::to_string(10000 + count / 2);
+		ASSERT_TRUE(kv->count_below(middle, cnt) == status::OK);
+		ASSERT_EQ(cnt,
+			  std::distance(records.begin(), records.lower_bound(middle)));
+	};
+	verify();
+
+	/* leaves around a removed range are merged as well */
+	ASSERT_TRUE(kv->remove_range("10100", "11000") == status::OK) << errormsg();
+	records.erase(records.lower_bound("10100"), records.lower_bound("11000"));
+	verify();
+
+	Restart();
+	ASSERT_EQ(metric(*kv, "leaf_merges"), 0);
+	for (auto &r : records) {
+		std::string value;
+		ASSERT_TRUE(kv->get(r.first, &value) == status::OK) << r.first;
+		ASSERT_EQ(value, r.second);
+	}
+
+	/* records put into merged leaves split them again */
+	for (std::size_t i = 1; i < count; i += 10) {
+		std::string istr = std::to_string(10000 + i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+		records[istr] = istr + "!";
+	}
+	for (auto &r : records)
+		ASSERT_TRUE(kv->remove(r.first) == status::OK) << r.first;
+	ASSERT_EQ(metric(*kv, "leaves"), 1);
+	ASSERT_EQ(metric(*kv, "depth"), 1);
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 0);
+}
+
+TEST_F(STreeTest, RelaxedDurabilityTest)
+{
+	kv->close();
+	config cfg;
+	cfg.put_string("path", PATH);
+	cfg.put_string("durability", "relaxed");
+	cfg.put_uint64("flush_interval_ms", 1);
+	ASSERT_TRUE(kv->open("stree", std::move(cfg)) == status::OK) << errormsg();
+
+	for (std::size_t i = 0; i < 2 * SINGLE_INNER_LIMIT; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, "first") == status::OK) << errormsg();
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+		if (i % 2) {
+			ASSERT_TRUE(kv->remove(istr) == status::OK) << errormsg();
+		}
+	}
+
+	/* the background thread writes the buffered changes */
+	for (int i = 0; i < 1000 && metric(*kv, "flushes") == 0; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	ASSERT_GT(metric(*kv, "flushes"), 0);
+
+	ASSERT_TRUE(kv->flush() == status::OK) << errormsg();
+	ASSERT_EQ(metric(*kv, "buffered_changes"), 0);
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, SINGLE_INNER_LIMIT);
+
+	/* flushed changes are persistent */
+	Restart();
+	for (std::size_t i = 0; i < 2 * SINGLE_INNER_LIMIT; i++) {
+		std::string istr = std::to_string(i);
+		std::string value;
+		if (i % 2) {
+			ASSERT_TRUE(kv->get(istr, &value) == status::NOT_FOUND);
+		} else {
+			ASSERT_TRUE(kv->get(istr, &value) == status::OK);
+			ASSERT_EQ(value, istr + "!");
+		}
+	}
+}
+
+TEST_F(STreeTest, ScanAcrossLeavesTest)
+{
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+
+	/* keys from 12000 to 12999 span several leaves */
+	std::vector<std::string> keys;
+	size_t batches = 0;
+	auto s = kv->scan("12", 0, 100,
+			  [&](size_t count, const string_view *k, const string_view *v) {
+				  batches++;
+				  for (size_t i = 0; i < count; i++) {
+					  std::string value(v[i].data(), v[i].size());
+					  keys.emplace_back(k[i].data(), k[i].size());
+					  EXPECT_EQ(keys.back() + "!", value);
+				  }
+				  return 0;
+			  });
+	ASSERT_TRUE(s == status::OK) << errormsg();
+	ASSERT_EQ(batches, 10U);
+	ASSERT_EQ(keys.size(), 1000U);
+	ASSERT_EQ(keys.front(), "12000");
+	ASSERT_EQ(keys.back(), "12999");
+	ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+
+	keys.clear();
+	s = kv->scan("12", 150, 100,
+		     [&](size_t count, const string_view *k, const string_view *) {
+			     for (size_t i = 0; i < count; i++)
+				     keys.emplace_back(k[i].data(), k[i].size());
+			     return 0;
+		     });
+	ASSERT_TRUE(s == status::OK) << errormsg();
+	ASSERT_EQ(keys.size(), 150U);
+	ASSERT_EQ(keys.back(), "12149");
+}
+
+TEST_F(STreeTest, SnapshotTest)
+{
+	std::map<std::string, std::string> expected;
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i += 2) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+		expected[istr] = istr + "!";
+	}
+
+	db::snapshot snap;
+	ASSERT_TRUE(kv->new_snapshot(snap) == status::OK) << errormsg();
+
+	/* updates, inserts, removes and a removed range across several leaves */
+	ASSERT_TRUE(kv->put("10000", "updated") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("10000", "updated again") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("10001", "inserted") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("0", "inserted") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->merge("10004", PMEMKV_MERGE_APPEND, "?") == status::OK)
+		<< errormsg();
+	ASSERT_TRUE(kv->remove("10002") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove_range("10100", "11000") == status::OK) << errormsg();
+	for (std::size_t i = 10101; i < 11000; i += 2) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, "inserted") == status::OK) << errormsg();
+	}
+
+	std::map<std::string, std::string> records;
+	auto s = snap.get_all([&](string_view k, string_view v) {
+		records.emplace(std::string(k.data(), k.size()),
+				std::string(v.data(), v.size()));
+		return 0;
+	});
+	ASSERT_TRUE(s == status::OK) << errormsg();
+	ASSERT_TRUE(records == expected);
+
+	std::string value;
+	ASSERT_TRUE(snap.get("10000", &value) == status::OK) << errormsg();
+	ASSERT_EQ(value, "10000!");
+	ASSERT_TRUE(snap.get("10002", &value) == status::OK) << errormsg();
+	ASSERT_EQ(value, "10002!");
+	ASSERT_TRUE(snap.get("10001", &value) == status::NOT_FOUND);
+	ASSERT_TRUE(snap.get("10102", &value) == status::OK) << errormsg();
+	ASSERT_EQ(value, "10102!");
+
+	std::vector<std::string> keys;
+	s = snap.get_between("10099", "10200", [&](string_view k, string_view) {
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	});
+	ASSERT_TRUE(s == status::OK) << errormsg();
+	ASSERT_EQ(keys.size(), 50U);
+	ASSERT_EQ(keys.front(), "10100");
+	ASSERT_EQ(keys.back(), "10198");
+
+	s = snap.get_all([&](string_view, string_view) { return 1; });
+	ASSERT_TRUE(s == status::STOPPED_BY_CB);
+
+	/* the database itself is modified */
+	ASSERT_TRUE(kv->get("10000", &value) == status::OK) << errormsg();
+	ASSERT_EQ(value, "updated again");
+	ASSERT_TRUE(kv->get("10102", &value) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->get("10101", &value) == status::OK) << errormsg();
+
+	/* a new snapshot sees the current state */
+	db::snapshot current;
+	ASSERT_TRUE(kv->new_snapshot(current) == status::OK) << errormsg();
+	ASSERT_TRUE(current.get("10001", &value) == status::OK) << errormsg();
+	ASSERT_EQ(value, "inserted");
+}
+
+TEST_F(STreeTest, SnapshotConcurrentWritesTest)
+{
+	const size_t n = 2 * SINGLE_INNER_LIMIT;
+	for (std::size_t i = 0; i < n; i++) {
+		std::string istr = std::to_string(10000 + i);
+		ASSERT_TRUE(kv->put(istr, "before") == status::OK) << errormsg();
+	}
+
+	db::snapshot snap;
+	ASSERT_TRUE(kv->new_snapshot(snap) == status::OK) << errormsg();
+
+	/* writers modify every key while the snapshot is read */
+	std::atomic<bool> done{false};
+	std::thread writer([&] {
+		for (std::size_t i = 0; i < n; i++) {
+			std::string istr = std::to_string(10000 + i);
+			if (i % 3 == 0)
+				kv->remove(istr);
+			else
+				kv->put(istr, "after");
+			kv->put(istr + "x", "after");
+		}
+		done = true;
+	});
+
+	std::size_t reads = 0;
+	do {
+		std::size_t count = 0;
+		auto s = snap.get_all([&](string_view, string_view v) {
+			EXPECT_EQ(std::string(v.data(), v.size()), "before");
+			count++;
+			return 0;
+		});
+		ASSERT_TRUE(s == status::OK) << errormsg();
+		ASSERT_EQ(count, n);
+		reads++;
+	} while (!done || reads < 2);
+	writer.join();
+
+	std::size_t cnt;
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 2 * n - (n + 2) / 3);
+}
+
+TEST_F(STreeTest, CompressionTest)
+{
+	kv->close();
+	delete kv;
+	std::remove(PATH.c_str());
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", PATH) == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("force_create", 1) == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("size", SIZE) == status::OK);
+	ASSERT_TRUE(cfg.put_string("compression", "lz4") == status::OK);
+	kv = new db;
+	ASSERT_TRUE(kv->open("stree", std::move(cfg)) == status::OK) << errormsg();
+
+	/* values are loaded from leaves up, then put */
+	std::map<std::string, std::string> expected;
+	for (std::size_t i = 10000; i < 10000 + 2 * SINGLE_INNER_LIMIT; i++) {
+		std::string istr = std::to_string(i);
+		expected[istr] = (i % 2 == 0) ? std::string(1000, 'v') + istr : istr;
+	}
+	ASSERT_TRUE(kv->bulk_load(expected.begin(), expected.end()) == status::OK)
+		<< errormsg();
+	ASSERT_TRUE(kv->put("10000", std::string(2000, 'u')) == status::OK)
+		<< errormsg();
+	expected["10000"] = std::string(2000, 'u');
+	ASSERT_EQ(metric(*kv, "compressed_values"), SINGLE_INNER_LIMIT + 1);
+	ASSERT_GT(metric(*kv, "compression_saved_bytes"), SINGLE_INNER_LIMIT * 900);
+
+	auto snap = new db::snapshot;
+	ASSERT_TRUE(kv->new_snapshot(*snap) == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("10002", "updated") == status::OK) << errormsg();
+
+	auto verify = [&](bool snapshot) {
+		auto it = expected.begin();
+		auto check = [&](string_view k, string_view v) {
+			EXPECT_EQ(k.compare(it->first), 0);
+			EXPECT_EQ(v.compare(it->second), 0);
+			++it;
+			return 0;
+		};
+		auto s = snapshot ? snap->get_all(check) : kv->get_all(check);
+		ASSERT_TRUE(s == status::OK);
+		ASSERT_TRUE(it == expected.end());
+
+		std::string value;
+		ASSERT_TRUE(kv->get("10004", &value) == status::OK);
+		ASSERT_TRUE(value == expected["10004"]);
+		value_ref ref;
+		ASSERT_TRUE(kv->get_ref("10006", ref) == status::OK) << errormsg();
+		ASSERT_TRUE(ref.value().compare(expected["10006"]) == 0);
+	};
+	verify(true);
+	std::string value;
+	ASSERT_TRUE(snap->get("10002", &value) == status::OK);
+	ASSERT_TRUE(value == expected["10002"]);
+	delete snap;
+	expected["10002"] = "updated";
+	verify(false);
+
+	{
+		db::iterator cursor;
+		ASSERT_TRUE(kv->new_iterator(cursor) == status::OK) << errormsg();
+		string_view v;
+		ASSERT_TRUE(cursor.seek("10008") == status::OK);
+		ASSERT_TRUE(cursor.value(v) == status::OK);
+		ASSERT_TRUE(v.compare(expected["10008"]) == 0);
+		ASSERT_TRUE(cursor.next() == status::OK);
+		ASSERT_TRUE(cursor.value(v) == status::OK);
+		ASSERT_TRUE(v.compare(expected["10009"]) == 0);
+	}
+
+	/* the pool keeps the compression it was created with */
+	Restart();
+	verify(false);
+}
+
+TEST_F(STreeTest, SingleInnerNodeGetManyTest)
+{
+	for (std::size_t i = 10000; i < (10000 + SINGLE_INNER_LIMIT); i += 2) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+
+	/* keys in descending order, every other one is missing */
+	std::vector<std::string> keys_str;
+	for (std::size_t i = 10000 + SINGLE_INNER_LIMIT; i > 10000; i--)
+		keys_str.push_back(std::to_string(i - 1));
+	std::vector<string_view> keys(keys_str.begin(), keys_str.end());
+
+	std::size_t found = 0;
+	auto s = kv->get_many(keys, [&](size_t idx, status st, string_view value) {
+		size_t i = std::stoul(keys_str[idx]);
+		if (i % 2 == 0) {
+			ASSERT_TRUE(st == status::OK);
+			ASSERT_EQ(std::string(value.data(), value.size()),
+				  keys_str[idx] + "!");
+			found++;
+		} else {
+			ASSERT_TRUE(st == status::NOT_FOUND);
+		}
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	ASSERT_EQ(found, SINGLE_INNER_LIMIT / 2);
+}
+
 // =============================================================================================
 // TEST RECOVERY OF TREE WITH SINGLE INNER NODE
 // =============================================================================================
@@ -1470,6 +3057,31 @@ TEST_F(STreeTest, SingleInnerNodeDescendingAfterRecoveryTest2)
 	ASSERT_TRUE(cnt == SINGLE_INNER_LIMIT);
 }
 
+TEST_F(STreeTest, ReadOnlyTest)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	kv->close();
+	delete kv;
+
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", PATH) == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("read_only", 1) == status::OK);
+	kv = new db;
+	ASSERT_TRUE(kv->open("stree", std::move(cfg)) == status::OK) << errormsg();
+
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->put("key2", "value2") == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->remove_range("a", "z") == status::NOT_SUPPORTED);
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 1U);
+
+	Restart();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+}
+
 // =============================================================================================
 // TEST LARGE TREE
 // =============================================================================================
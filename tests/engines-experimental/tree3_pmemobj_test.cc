@@ -120,7 +120,7 @@ TEST_F(TreePmemobjTest, SimpleTest)
 	value = "";
 	kv->get("key1", [&](string_view v) { value.append(v.data(), v.size()); });
 	ASSERT_TRUE(value == "value1");
-	ASSERT_TRUE(kv->defrag() == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->defrag() == status::OK);
 }
 
 TEST_F(TreePmemobjTest, BinaryKeyTest)
@@ -32,9 +32,13 @@
 
 #include "../../src/engines-experimental/tree3.h"
 #include "../../src/libpmemkv.hpp"
+#include "../mock_heap_alloc.h"
 #include "../mock_tx_alloc.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <map>
+
 using namespace pmem::kv;
 
 extern std::string test_path;
@@ -199,7 +203,8 @@ TEST_F(TreeTest, SimpleTest)
 	value = "";
 	kv->get("key1", [&](string_view v) { value.append(v.data(), v.size()); });
 	ASSERT_TRUE(value == "value1");
-	ASSERT_TRUE(kv->defrag() == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->defrag() == status::OK);
+	ASSERT_TRUE(kv->defrag(50, 100) == status::INVALID_ARGUMENT);
 }
 
 TEST_F(TreeTest, BinaryKeyTest)
@@ -363,6 +368,31 @@ TEST_F(TreeTest, GetMultiple2Test)
 	ASSERT_TRUE(kv->get("key3", &value3) == status::OK && value3 == "VALUE3");
 }
 
+TEST_F(TreeTest, GetRefTest)
+{
+	const std::string long_value(10000, 'x');
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", long_value) == status::OK) << errormsg();
+
+	value_ref ref;
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	ASSERT_TRUE(ref.value().compare("value1") == 0);
+	/* the reference is reused, previous value is released */
+	ASSERT_TRUE(kv->get_ref("key2", ref) == status::OK) << errormsg();
+	ASSERT_TRUE(ref.value().compare(long_value) == 0);
+	ASSERT_TRUE(kv->get_ref("nada", ref) == status::NOT_FOUND);
+	ASSERT_TRUE(ref.value().size() == 0);
+
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	value_ref moved(std::move(ref));
+	ASSERT_TRUE(moved.value().compare("value1") == 0);
+	moved.release();
+
+	ASSERT_TRUE(kv->put("key1", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get_ref("key1", moved) == status::OK) << errormsg();
+	ASSERT_TRUE(moved.value().compare("value2") == 0);
+}
+
 TEST_F(TreeTest, GetNonexistentTest)
 {
 	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
@@ -597,6 +627,221 @@ TEST_F(TreeTest, UsesGetAllTest)
 	ASSERT_TRUE(result == "<1>,<2>|<RR>,<记!>|");
 }
 
+TEST_F(TreeTest, FullLeafSlotsReuseTest)
+{
+	for (int i = 0; i < LEAF_KEYS; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	for (int i = 0; i < LEAF_KEYS; i += 3)
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK);
+	for (int i = 0; i < LEAF_KEYS; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->exists(istr) == (i % 3 ? status::OK : status::NOT_FOUND));
+	}
+	/* freed slots are reused and existing keys updated in place */
+	for (int i = 0; i < LEAF_KEYS; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+	for (int i = 0; i < LEAF_KEYS; i++) {
+		std::string istr = std::to_string(i);
+		std::string value;
+		ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr + "!");
+	}
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == LEAF_KEYS);
+}
+
+TEST_F(TreeTest, InlineSlotsTest)
+{
+	/* records up to 13 bytes are stored in slots, longer ones in buffers */
+	auto record = [](size_t i) {
+		auto key = std::to_string(i);
+		return std::make_pair(key, std::string(i % 16, '\0'));
+	};
+	for (size_t i = 0; i < 3 * LEAF_KEYS; i++) {
+		auto r = record(i);
+		ASSERT_TRUE(kv->put(r.first, std::string(20, 'x')) == status::OK);
+		ASSERT_TRUE(kv->put(r.first, r.second) == status::OK) << errormsg();
+	}
+	/* a slot changes from buffer to in place storage and back */
+	ASSERT_TRUE(kv->put("1", "abcdefghijklm") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("2", "abcdefghijkl") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("3", std::string(100, 'y')) == status::OK) << errormsg();
+
+	auto verify = [&] {
+		std::string value;
+		ASSERT_TRUE(kv->get("1", &value) == status::OK);
+		ASSERT_EQ(value, "abcdefghijklm");
+		ASSERT_TRUE(kv->get("2", &value) == status::OK);
+		ASSERT_EQ(value, "abcdefghijkl");
+		ASSERT_TRUE(kv->get("3", &value) == status::OK);
+		ASSERT_EQ(value, std::string(100, 'y'));
+		for (size_t i = 4; i < 3 * LEAF_KEYS; i++) {
+			auto r = record(i);
+			ASSERT_TRUE(kv->get(r.first, &value) == status::OK) << r.first;
+			ASSERT_EQ(value, r.second);
+		}
+
+		/* referenced values stay valid after the lookup */
+		value_ref ref;
+		ASSERT_TRUE(kv->get_ref("2", ref) == status::OK) << errormsg();
+		ASSERT_TRUE(ref.value().compare("abcdefghijkl") == 0);
+
+		size_t records = 0;
+		ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+			auto r = record(std::stoul(std::string(k.data(), k.size())));
+			if (r.first.size() > 1 || r.first[0] > '3') {
+				EXPECT_EQ(r.second, std::string(v.data(), v.size()));
+			}
+			records++;
+			return 0;
+		}) == status::OK);
+		ASSERT_EQ(records, 3U * LEAF_KEYS);
+	};
+	verify();
+	ASSERT_TRUE(kv->defrag() == status::OK) << errormsg();
+	verify();
+	Restart();
+	verify();
+
+	for (size_t i = 0; i < 3 * LEAF_KEYS; i++)
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK) << errormsg();
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 0U);
+}
+
+static void count_value_bytes(const char *v, size_t vb, void *arg)
+{
+	*static_cast<size_t *>(arg) += vb;
+}
+
+TEST_F(TreeTest, LookupsDoNotAllocateTest)
+{
+	const int count = LEAF_KEYS * 64;
+	std::vector<std::string> keys;
+	for (int i = 0; i < count; i++) {
+		keys.push_back(std::to_string(i));
+		ASSERT_TRUE(kv->put(keys.back(), keys.back()) == status::OK) << errormsg();
+	}
+	const std::string missing = "not_there";
+
+	size_t bytes = 0;
+	heap_alloc_count = 0;
+	heap_alloc_count_enabled = true;
+	for (auto &k : keys) {
+		kv->get(k, count_value_bytes, &bytes);
+		kv->exists(k);
+	}
+	kv->get(missing, count_value_bytes, &bytes);
+	kv->exists(missing);
+	heap_alloc_count_enabled = false;
+
+	ASSERT_EQ(heap_alloc_count, 0U);
+	size_t expected = 0;
+	for (auto &k : keys)
+		expected += k.size();
+	ASSERT_EQ(bytes, expected);
+}
+
+TEST_F(TreeTest, WriteBatchTest)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+
+	write_batch batch;
+	ASSERT_TRUE(batch.put("key3", "value3") == status::OK);
+	ASSERT_TRUE(batch.put("key1", "VALUE1") == status::OK);
+	ASSERT_TRUE(batch.remove("key2") == status::OK);
+	ASSERT_TRUE(batch.remove("nada") == status::OK);
+	ASSERT_TRUE(batch.put("key2", "VALUE2") == status::OK);
+	ASSERT_TRUE(batch.remove("key3") == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "VALUE1");
+	ASSERT_TRUE(kv->get("key2", &value) == status::OK && value == "VALUE2");
+	ASSERT_TRUE(kv->exists("key3") == status::NOT_FOUND);
+
+	ASSERT_TRUE(batch.clear() == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+}
+
+TEST_F(TreeTest, UpdateTest)
+{
+	int64_t one = 1;
+	std::string increment(reinterpret_cast<const char *>(&one), sizeof(one));
+	for (int i = 0; i < 10; i++) {
+		ASSERT_TRUE(kv->merge("counter", PMEMKV_MERGE_INCREMENT, increment) ==
+			    status::OK)
+			<< errormsg();
+		ASSERT_TRUE(kv->merge("log", PMEMKV_MERGE_APPEND, std::to_string(i)) ==
+			    status::OK)
+			<< errormsg();
+	}
+
+	auto stop = [](const string_view *, std::string &) { return false; };
+	ASSERT_TRUE(kv->update("log", stop) == status::STOPPED_BY_CB);
+	ASSERT_TRUE(kv->update("nada", stop) == status::STOPPED_BY_CB);
+	ASSERT_TRUE(kv->exists("nada") == status::NOT_FOUND);
+
+	Restart();
+	std::string value;
+	ASSERT_TRUE(kv->get("log", &value) == status::OK && value == "0123456789");
+	int64_t ten = 10;
+	ASSERT_TRUE(kv->get("counter", &value) == status::OK);
+	ASSERT_EQ(value, std::string(reinterpret_cast<const char *>(&ten), sizeof(ten)));
+}
+
+TEST_F(TreeTest, BulkLoadTest)
+{
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 20000; i++)
+		records[std::to_string(i)] = std::to_string(i) + "!";
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) == status::OK)
+		<< errormsg();
+	ASSERT_TRUE(kv->put("15000", "changed") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove("15001") == status::OK) << errormsg();
+	records["15000"] = "changed";
+	records.erase("15001");
+
+	auto verify = [&] {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+	};
+	verify();
+	Restart();
+	verify();
+}
+
+TEST_F(TreeTest, BulkLoadUnsortedTest)
+{
+	std::vector<std::pair<std::string, std::string>> records{
+		{"abc", "1"}, {"def", "2"}, {"abc", "3"}};
+	ASSERT_TRUE(kv->bulk_load(records.begin(), records.end()) ==
+		    status::INVALID_ARGUMENT);
+	ASSERT_TRUE(kv->put("ghi", "4") == status::OK) << errormsg();
+
+	Restart();
+	ASSERT_TRUE(kv->exists("ghi") == status::OK);
+	std::string value;
+	ASSERT_TRUE(kv->get("abc", &value) == status::NOT_FOUND || value == "1");
+}
+
 // =============================================================================================
 // TEST RECOVERY OF SINGLE-LEAF TREE
 // =============================================================================================
@@ -608,6 +853,489 @@ TEST_F(TreeTest, GetHeadlessAfterRecoveryTest)
 	ASSERT_TRUE(kv->get("waldo", &value) == status::NOT_FOUND);
 }
 
+TEST_F(TreeTest, DefragTest)
+{
+	/* churn leaves some leaves empty, every third value is stored out of line */
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 10000 + 4000; i++) {
+		std::string istr = std::to_string(i);
+		std::string key = (i % 2 == 0) ? std::string(60, 'k') + istr : istr;
+		std::string value = (i % 3 == 0) ? std::string(200, 'v') + istr : istr;
+		ASSERT_TRUE(kv->put(key, value) == status::OK) << errormsg();
+		records[key] = value;
+	}
+	for (std::size_t i = 10000; i < 10000 + 4000 / 2; i++) {
+		std::string istr = std::to_string(i);
+		std::string key = (i % 2 == 0) ? std::string(60, 'k') + istr : istr;
+		ASSERT_TRUE(kv->remove(key) == status::OK) << errormsg();
+		records.erase(key);
+	}
+
+	auto verify = [&] {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+	};
+
+	/* empty leaves are preallocated after recovery */
+	Restart();
+	verify();
+	/* the whole pool, in slices */
+	for (int start = 0; start < 100; start += 10) {
+		ASSERT_TRUE(kv->defrag(start, 10) == status::OK) << errormsg();
+		verify();
+	}
+	ASSERT_TRUE(kv->defrag() == status::OK) << errormsg();
+	verify();
+
+	/* relocated leaves take further puts and removes */
+	for (std::size_t i = 10000; i < 10000 + 4000; i += 5) {
+		std::string istr = std::to_string(i) + "!";
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+	}
+	for (auto it = records.begin(); it != records.end();) {
+		ASSERT_TRUE(kv->remove(it->first) == status::OK) << errormsg();
+		it = records.erase(it);
+		for (int n = 0; n < 6 && it != records.end(); n++)
+			++it;
+	}
+	verify();
+
+	Restart();
+	verify();
+}
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+TEST_F(TreeTest, MetricsTest)
+{
+	ASSERT_EQ(metric(*kv, "inner_depth"), 0);
+
+	for (std::size_t i = 10000; i < 10000 + 4000; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	ASSERT_GT(metric(*kv, "leaf_splits"), 0);
+	ASSERT_GT(metric(*kv, "inner_node_splits"), 0);
+	ASSERT_GE(metric(*kv, "inner_depth"), 2);
+	ASSERT_EQ(metric(*kv, "preallocated_leaves"), 0);
+
+	/* leaves emptied by removes are preallocated after recovery */
+	for (std::size_t i = 10000; i < 10000 + 4000; i++)
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK) << errormsg();
+	Restart();
+	ASSERT_EQ(metric(*kv, "leaf_splits"), 0);
+	ASSERT_EQ(metric(*kv, "inner_depth"), 0);
+	ASSERT_GT(metric(*kv, "preallocated_leaves"), 0);
+}
+
+TEST_F(TreeTest, CoalesceLeavesTest)
+{
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 10000 + 4000; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+	}
+	auto depth = metric(*kv, "inner_depth");
+
+	/* sparse leaves are coalesced with their siblings and preallocated */
+	for (auto it = records.begin(); it != records.end();) {
+		if (std::stoi(it->first) % 10 == 0) {
+			++it;
+			continue;
+		}
+		ASSERT_TRUE(kv->remove(it->first) == status::OK) << errormsg();
+		it = records.erase(it);
+	}
+	ASSERT_GT(metric(*kv, "leaf_merges"), 0);
+	ASSERT_GT(metric(*kv, "preallocated_leaves"), 0);
+	ASSERT_LE(metric(*kv, "inner_depth"), depth);
+
+	auto verify = [&] {
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, records.size());
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+		/* ordered reads follow the relinked leaves */
+		std::vector<std::string> keys;
+		ASSERT_TRUE(kv->get_equal_below("A", [&](string_view k, string_view) {
+			keys.emplace_back(k.data(), k.size());
+			return 0;
+		}) == status::OK);
+		ASSERT_EQ(keys.size(), records.size());
+		ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+	};
+	verify();
+
+	/* preallocated leaves take further puts */
+	auto preallocated = metric(*kv, "preallocated_leaves");
+	for (std::size_t i = 10000; i < 10000 + 4000; i += 3) {
+		std::string istr = std::to_string(i) + "!";
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+	}
+	ASSERT_LT(metric(*kv, "preallocated_leaves"), preallocated);
+	verify();
+
+	Restart();
+	verify();
+	for (auto &record : records)
+		ASSERT_TRUE(kv->remove(record.first) == status::OK) << errormsg();
+	records.clear();
+	verify();
+	Restart();
+	verify();
+}
+
+TEST_F(TreeTest, RecoveryImageTest)
+{
+	auto reopen = [&](bool image) {
+		kv->close();
+		delete kv;
+		kv = new db;
+		auto cfg = getConfig(PATH, SIZE, false);
+		ASSERT_TRUE(cfg.put_uint64("recovery_image", image) == status::OK);
+		ASSERT_TRUE(kv->open("tree3", std::move(cfg)) == status::OK)
+			<< errormsg();
+	};
+
+	std::map<std::string, std::string> records;
+	for (std::size_t i = 10000; i < 10000 + 4000; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+	}
+	for (std::size_t i = 10000; i < 10000 + 2000; i++) {
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK) << errormsg();
+		records.erase(std::to_string(i));
+	}
+	auto verify = [&] {
+		std::vector<std::string> keys;
+		ASSERT_TRUE(kv->get_equal_below("A", [&](string_view k, string_view) {
+			keys.emplace_back(k.data(), k.size());
+			return 0;
+		}) == status::OK);
+		ASSERT_EQ(keys.size(), records.size());
+		ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+		std::string value;
+		for (auto &record : records) {
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_EQ(value, record.second);
+		}
+	};
+
+	/* image is saved on close and used by the next open only */
+	reopen(true);
+	ASSERT_EQ(metric(*kv, "image_recovered"), 0);
+	reopen(true);
+	ASSERT_EQ(metric(*kv, "image_recovered"), 1);
+	ASSERT_GT(metric(*kv, "preallocated_leaves"), 0);
+	verify();
+
+	/* changes made after the open are not lost by a later image */
+	for (std::size_t i = 10000; i < 10000 + 2000; i += 2) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+		records[istr] = istr;
+	}
+	reopen(false);
+	ASSERT_EQ(metric(*kv, "image_recovered"), 1);
+	verify();
+	reopen(false);
+	ASSERT_EQ(metric(*kv, "image_recovered"), 0);
+	verify();
+}
+
+TEST_F(TreeTest, ReadOnlyTest)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	kv->close();
+	delete kv;
+
+	auto cfg = getConfig(PATH, SIZE, false);
+	ASSERT_TRUE(cfg.put_uint64("read_only", 1) == status::OK);
+	kv = new db;
+	ASSERT_TRUE(kv->open("tree3", std::move(cfg)) == status::OK) << errormsg();
+
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->put("key2", "value2") == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_SUPPORTED);
+	ASSERT_TRUE(kv->exists("key2") == status::NOT_FOUND);
+
+	Restart();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+}
+
+TEST_F(TreeEmptyTest, FailsToCreateInstanceReadOnly)
+{
+	auto cfg = getConfig(PATH, SIZE);
+	ASSERT_TRUE(cfg.put_uint64("read_only", 1) == status::OK);
+	db kv;
+	ASSERT_TRUE(kv.open("tree3", std::move(cfg)) == status::INVALID_ARGUMENT);
+}
+
+TEST_F(TreeTest, IteratorEmptyTest)
+{
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key;
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+	ASSERT_TRUE(it.next() == status::NOT_FOUND);
+	ASSERT_TRUE(it.prev() == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_to_first() == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_to_last() == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek("a") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_lower("a") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_higher_eq("a") == status::NOT_FOUND);
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_above("", cnt) == status::OK);
+	ASSERT_EQ(cnt, 0);
+	ASSERT_TRUE(kv->get_begin().first.size() == 0);
+}
+
+TEST_F(TreeTest, IteratorSeekTest)
+{
+	ASSERT_TRUE(kv->put("b", "1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("d", "2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("f", "3") == status::OK) << errormsg();
+
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key, value;
+
+	ASSERT_TRUE(it.seek("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.value(value) == status::OK);
+	ASSERT_EQ(std::string(value.data(), value.size()), "2");
+	ASSERT_TRUE(it.seek("c") == status::NOT_FOUND);
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_lower("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "b");
+	ASSERT_TRUE(it.seek_lower("b") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_lower("z") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+
+	ASSERT_TRUE(it.seek_lower_eq("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_lower_eq("e") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_lower_eq("a") == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_higher("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+	ASSERT_TRUE(it.seek_higher("f") == status::NOT_FOUND);
+	ASSERT_TRUE(it.seek_higher("") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "b");
+
+	ASSERT_TRUE(it.seek_higher_eq("d") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_higher_eq("e") == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+	ASSERT_TRUE(it.seek_higher_eq("g") == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_to_first() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "b");
+	ASSERT_TRUE(it.seek_to_last() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+
+	auto r = kv->lower_bound("d");
+	ASSERT_EQ(std::string(r.first.data(), r.first.size()), "d");
+	ASSERT_EQ(std::string(r.second.data(), r.second.size()), "2");
+	r = kv->upper_bound("d");
+	ASSERT_EQ(std::string(r.first.data(), r.first.size()), "f");
+	r = kv->upper_bound("f");
+	ASSERT_TRUE(r.first.size() == 0);
+	r = kv->get_next("b");
+	ASSERT_EQ(std::string(r.first.data(), r.first.size()), "d");
+	r = kv->get_prev("d");
+	ASSERT_EQ(std::string(r.first.data(), r.first.size()), "b");
+	ASSERT_TRUE(kv->get_prev("b").first.size() == 0);
+	ASSERT_TRUE(kv->get_next("c").first.size() == 0);
+}
+
+TEST_F(TreeTest, IteratorNextPrevTest)
+{
+	ASSERT_TRUE(kv->put("b", "1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("d", "2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("f", "3") == status::OK) << errormsg();
+
+	db::iterator it;
+	ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+	string_view key;
+
+	ASSERT_TRUE(it.seek_to_first() == status::OK);
+	ASSERT_TRUE(it.is_next() == status::OK);
+	ASSERT_TRUE(it.next() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.next() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "f");
+	ASSERT_TRUE(it.is_next() == status::NOT_FOUND);
+	ASSERT_TRUE(it.prev() == status::OK);
+	ASSERT_TRUE(it.key(key) == status::OK);
+	ASSERT_EQ(std::string(key.data(), key.size()), "d");
+	ASSERT_TRUE(it.seek_to_last() == status::OK);
+	ASSERT_TRUE(it.next() == status::NOT_FOUND);
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+	ASSERT_TRUE(it.next() == status::NOT_FOUND);
+
+	ASSERT_TRUE(it.seek_to_first() == status::OK);
+	ASSERT_TRUE(it.prev() == status::NOT_FOUND);
+	ASSERT_TRUE(it.key(key) == status::NOT_FOUND);
+}
+
+TEST_F(TreeTest, OrderedRangeTest)
+{
+	/* keys put in scrambled order split many leaves, a removed range leaves
+	 * some of them empty */
+	const int count = LEAF_KEYS * 40;
+	std::map<std::string, std::string> expected;
+	for (int i = 0; i < count; i++) {
+		std::string istr = std::to_string(10000 + (i * 7919) % count);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+		expected[istr] = istr + "!";
+	}
+	for (int i = 10000 + count / 4; i < 10000 + count / 2; i++) {
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK) << errormsg();
+		expected.erase(std::to_string(i));
+	}
+	for (int i = 10000; i < 10000 + count; i += 3) {
+		ASSERT_TRUE(kv->put(std::to_string(i), "updated") == status::OK);
+		if (expected.count(std::to_string(i)))
+			expected[std::to_string(i)] = "updated";
+		else
+			ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK);
+	}
+
+	typedef std::vector<std::pair<std::string, std::string>> records;
+	auto collect = [](records &r) {
+		return [&r](string_view k, string_view v) {
+			r.emplace_back(std::string(k.data(), k.size()),
+				       std::string(v.data(), v.size()));
+			return 0;
+		};
+	};
+	auto check = [&] {
+		const std::string keys[] = {"",
+					    "0",
+					    std::to_string(10000 + count / 8),
+					    std::to_string(10000 + count / 3),
+					    std::to_string(10000 + count - 1),
+					    "~"};
+		for (auto &k1 : keys) {
+			records above, equal_above, below, equal_below;
+			ASSERT_TRUE(kv->get_above(k1, collect(above)) == status::OK);
+			ASSERT_TRUE(kv->get_equal_above(k1, collect(equal_above)) ==
+				    status::OK);
+			ASSERT_TRUE(kv->get_below(k1, collect(below)) == status::OK);
+			ASSERT_TRUE(kv->get_equal_below(k1, collect(equal_below)) ==
+				    status::OK);
+			ASSERT_TRUE(above == records(expected.upper_bound(k1),
+						     expected.end()));
+			ASSERT_TRUE(equal_above == records(expected.lower_bound(k1),
+							   expected.end()));
+			ASSERT_TRUE(below == records(expected.begin(),
+						     expected.lower_bound(k1)));
+			ASSERT_TRUE(equal_below == records(expected.begin(),
+							   expected.upper_bound(k1)));
+
+			std::size_t cnt;
+			ASSERT_TRUE(kv->count_above(k1, cnt) == status::OK);
+			ASSERT_EQ(cnt, above.size());
+			ASSERT_TRUE(kv->count_equal_above(k1, cnt) == status::OK);
+			ASSERT_EQ(cnt, equal_above.size());
+			ASSERT_TRUE(kv->count_below(k1, cnt) == status::OK);
+			ASSERT_EQ(cnt, below.size());
+			ASSERT_TRUE(kv->count_equal_below(k1, cnt) == status::OK);
+			ASSERT_EQ(cnt, equal_below.size());
+
+			for (auto &k2 : keys) {
+				records between;
+				ASSERT_TRUE(kv->get_between(k1, k2, collect(between)) ==
+					    status::OK);
+				records exp;
+				if (k1 < k2)
+					exp = records(expected.upper_bound(k1),
+						      expected.lower_bound(k2));
+				ASSERT_TRUE(between == exp);
+				ASSERT_TRUE(kv->count_between(k1, k2, cnt) == status::OK);
+				ASSERT_EQ(cnt, exp.size());
+			}
+		}
+
+		db::iterator it;
+		ASSERT_TRUE(kv->new_iterator(it) == status::OK) << errormsg();
+		string_view key;
+		auto e = expected.begin();
+		for (auto s = it.seek_to_first(); s == status::OK; s = it.next(), ++e) {
+			ASSERT_TRUE(e != expected.end());
+			ASSERT_TRUE(it.key(key) == status::OK);
+			ASSERT_EQ(std::string(key.data(), key.size()), e->first);
+		}
+		ASSERT_TRUE(e == expected.end());
+		auto r = expected.rbegin();
+		for (auto s = it.seek_to_last(); s == status::OK; s = it.prev(), ++r) {
+			ASSERT_TRUE(r != expected.rend());
+			ASSERT_TRUE(it.key(key) == status::OK);
+			ASSERT_EQ(std::string(key.data(), key.size()), r->first);
+		}
+		ASSERT_TRUE(r == expected.rend());
+
+		/* empty leaves of the removed range are skipped */
+		ASSERT_TRUE(it.seek_higher_eq(std::to_string(10000 + count / 4)) ==
+			    status::OK);
+		ASSERT_TRUE(it.key(key) == status::OK);
+		ASSERT_EQ(std::string(key.data(), key.size()),
+			  expected.lower_bound(std::to_string(10000 + count / 2))->first);
+		ASSERT_TRUE(it.prev() == status::OK);
+		ASSERT_TRUE(it.key(key) == status::OK);
+		ASSERT_EQ(std::string(key.data(), key.size()),
+			  std::prev(expected.lower_bound(
+					    std::to_string(10000 + count / 4)))
+				  ->first);
+		ASSERT_EQ(kv->get_size_new(), (int)expected.size());
+	};
+	check();
+	Restart();
+	check();
+}
+
 TEST_F(TreeTest, GetMultipleAfterRecoveryTest)
 {
 	ASSERT_TRUE(kv->put("abc", "A1") == status::OK) << errormsg();
@@ -871,6 +1599,30 @@ TEST_F(TreeTest, SingleInnerNodeDescendingAfterRecoveryTest2)
 	ASSERT_TRUE(cnt == SINGLE_INNER_LIMIT);
 }
 
+TEST_F(TreeTest, SingleInnerNodeWriteBatchAfterRecoveryTest)
+{
+	write_batch batch;
+	for (int i = 10000; i < (10000 + SINGLE_INNER_LIMIT); i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(batch.put(istr, istr) == status::OK);
+	}
+	for (int i = 10000; i < (10000 + SINGLE_INNER_LIMIT); i += 2)
+		ASSERT_TRUE(batch.remove(std::to_string(i)) == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+	Restart();
+	for (int i = 10000; i < (10000 + SINGLE_INNER_LIMIT); i++) {
+		std::string istr = std::to_string(i);
+		std::string value;
+		if (i % 2 == 0)
+			ASSERT_TRUE(kv->get(istr, &value) == status::NOT_FOUND);
+		else
+			ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr);
+	}
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == SINGLE_INNER_LIMIT / 2);
+}
+
 // =============================================================================================
 // TEST LARGE TREE
 // =============================================================================================
@@ -954,6 +1706,117 @@ TEST_F(TreeTest, LargeDescendingAfterRecoveryTest)
 	ASSERT_TRUE(cnt == LARGE_LIMIT);
 }
 
+TEST_F(TreeTest, ParallelRecoveryTest)
+{
+	const int count = LEAF_KEYS * 100;
+	for (int i = 0; i < count; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+	for (int i = 0; i < count; i += 2)
+		ASSERT_TRUE(kv->remove(std::to_string(i)) == status::OK);
+
+	for (uint64_t threads : {4u, 3u, 1u, 1000u}) {
+		kv->close();
+		delete kv;
+		kv = new db;
+		auto cfg = getConfig(PATH, SIZE, false);
+		ASSERT_TRUE(cfg.put_uint64("recovery_threads", threads) == status::OK);
+		ASSERT_TRUE(kv->open("tree3", std::move(cfg)) == status::OK)
+			<< errormsg();
+
+		for (int i = 0; i < count; i++) {
+			std::string istr = std::to_string(i);
+			std::string value;
+			if (i % 2) {
+				ASSERT_TRUE(kv->get(istr, &value) == status::OK &&
+					    value == istr + "!");
+			} else {
+				ASSERT_TRUE(kv->exists(istr) == status::NOT_FOUND);
+			}
+		}
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_TRUE(cnt == count / 2);
+	}
+
+	/* recovered tree accepts new keys, reusing the leaves freed before */
+	for (int i = 0; i < count; i += 2) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr + "!") == status::OK) << errormsg();
+	}
+	for (int i = 0; i < count; i++) {
+		std::string istr = std::to_string(i);
+		std::string value;
+		ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr + "!");
+	}
+}
+
+TEST_F(TreeTest, InnerKeysTest)
+{
+	/* keys sharing the first 8 bytes, mixed with shorter ones and with keys
+	 * differing only by trailing zero bytes */
+	const int count = LEAF_KEYS * 50;
+	auto key = [](int i) {
+		return (i % 3 ? "shared_prefix_" : "") + std::to_string(i);
+	};
+	const std::string zeros[] = {"ab", std::string("ab\0", 3),
+				     std::string("ab\0\0", 4)};
+	for (auto &k : zeros)
+		ASSERT_TRUE(kv->put(k, std::to_string(k.size())) == status::OK);
+
+	double depth[3];
+	const uint64_t fanouts[] = {2, 3, INNER_KEYS_MAX};
+	for (int f = 0; f < 3; f++) {
+		kv->close();
+		delete kv;
+		kv = new db;
+		auto cfg = getConfig(PATH, SIZE, false);
+		ASSERT_TRUE(cfg.put_uint64("inner_keys", fanouts[f]) == status::OK);
+		ASSERT_TRUE(kv->open("tree3", std::move(cfg)) == status::OK)
+			<< errormsg();
+
+		for (int i = f * count; i < (f + 1) * count; i++)
+			ASSERT_TRUE(kv->put(key(i), key(i)) == status::OK) << errormsg();
+		for (int i = 0; i < (f + 1) * count; i++) {
+			std::string value;
+			ASSERT_TRUE(kv->get(key(i), &value) == status::OK &&
+				    value == key(i));
+		}
+		for (auto &k : zeros) {
+			std::string value;
+			ASSERT_TRUE(kv->get(k, &value) == status::OK &&
+				    value == std::to_string(k.size()));
+		}
+		ASSERT_TRUE(kv->exists("shared_prefix_") == status::NOT_FOUND);
+		depth[f] = metric(*kv, "inner_depth");
+	}
+	ASSERT_GT(depth[0], depth[2]);
+	ASSERT_GE(depth[1], depth[2]);
+}
+
+TEST_F(TreeEmptyTest, ZeroRecoveryThreadsTest)
+{
+	db *kv = new db;
+	auto cfg = getConfig(PATH, PMEMOBJ_MIN_POOL);
+	ASSERT_TRUE(cfg.put_uint64("recovery_threads", 0) == status::OK);
+	ASSERT_TRUE(kv->open("tree3", std::move(cfg)) == status::INVALID_ARGUMENT);
+	delete kv;
+}
+
+TEST_F(TreeEmptyTest, InvalidInnerKeysTest)
+{
+	for (uint64_t keys : {0u, 1u, INNER_KEYS_MAX + 1u}) {
+		std::remove(PATH.c_str());
+		db *kv = new db;
+		auto cfg = getConfig(PATH, PMEMOBJ_MIN_POOL);
+		ASSERT_TRUE(cfg.put_uint64("inner_keys", keys) == status::OK);
+		ASSERT_TRUE(kv->open("tree3", std::move(cfg)) ==
+			    status::INVALID_ARGUMENT);
+		delete kv;
+	}
+}
+
 // =============================================================================================
 // TEST RUNNING OUT OF SPACE
 // =============================================================================================
@@ -33,6 +33,9 @@
 #include "../../src/libpmemkv.hpp"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <functional>
+
 using namespace pmem::kv;
 
 class BlackholeTest : public testing::Test {
@@ -155,6 +158,26 @@ TEST_F(BlackholeTest, GetRangeTest_TRACERS_MP)
 	ASSERT_TRUE(result.empty());
 }
 
+TEST_F(BlackholeTest, GetManyTest)
+{
+	ASSERT_TRUE(kv.put("key1", "value1") == status::OK);
+
+	std::vector<string_view> keys{"key1", "key2"};
+	std::vector<size_t> not_found;
+	auto s = kv.get_many(keys, [&](size_t idx, status st, string_view value) {
+		ASSERT_TRUE(st == status::NOT_FOUND);
+		not_found.push_back(idx);
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	ASSERT_TRUE(not_found == std::vector<size_t>({0, 1}));
+}
+
+TEST_F(BlackholeTest, IteratorNotSupportedTest)
+{
+	db::iterator it;
+	ASSERT_TRUE(kv.new_iterator(it) == status::NOT_SUPPORTED);
+}
+
 /* XXX port it to other engines */
 TEST_F(BlackholeTest, ErrormsgTest)
 {
@@ -172,3 +195,149 @@ TEST_F(BlackholeTest, ErrormsgTest)
 	/* Test whether errormsg is cleared correctly after each error */
 	ASSERT_TRUE(pmem::kv::errormsg() == err);
 }
+
+class BlackholeRecordsTest : public testing::Test {
+public:
+	db kv;
+
+	BlackholeRecordsTest()
+	{
+		config cfg;
+		if (cfg.put_uint64("records", 1000) != status::OK ||
+		    cfg.put_uint64("key_size", 4) != status::OK ||
+		    cfg.put_uint64("value_size", 8) != status::OK)
+			throw std::runtime_error("putting items to config failed");
+		auto s = kv.open("blackhole", std::move(cfg));
+		if (s != status::OK)
+			throw std::runtime_error(errormsg());
+	}
+
+	~BlackholeRecordsTest()
+	{
+		kv.close();
+	}
+};
+
+using kv_function = std::function<get_kv_function>;
+using get_range_function = std::function<status(kv_function)>;
+
+static std::vector<std::string> keys_of(get_range_function get,
+					status expected = status::OK)
+{
+	std::vector<std::string> keys;
+	auto s = get([&](string_view k, string_view v) {
+		EXPECT_EQ(v.compare("vvvvvvvv"), 0);
+		keys.emplace_back(k.data(), k.size());
+		return 0;
+	});
+	EXPECT_TRUE(s == expected);
+	return keys;
+}
+
+TEST_F(BlackholeRecordsTest, CountTest)
+{
+	std::size_t cnt;
+	ASSERT_TRUE(kv.count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 1000U);
+	ASSERT_TRUE(kv.count_above("0099", cnt) == status::OK);
+	ASSERT_EQ(cnt, 900U);
+	ASSERT_TRUE(kv.count_equal_above("0099", cnt) == status::OK);
+	ASSERT_EQ(cnt, 901U);
+	ASSERT_TRUE(kv.count_above("00995", cnt) == status::OK);
+	ASSERT_EQ(cnt, 900U);
+	ASSERT_TRUE(kv.count_below("0100", cnt) == status::OK);
+	ASSERT_EQ(cnt, 100U);
+	ASSERT_TRUE(kv.count_equal_below("0100", cnt) == status::OK);
+	ASSERT_EQ(cnt, 101U);
+	ASSERT_TRUE(kv.count_below("009:", cnt) == status::OK);
+	ASSERT_EQ(cnt, 100U);
+	ASSERT_TRUE(kv.count_below("00/", cnt) == status::OK);
+	ASSERT_EQ(cnt, 0U);
+	ASSERT_TRUE(kv.count_between("0010", "0020", cnt) == status::OK);
+	ASSERT_EQ(cnt, 9U);
+	ASSERT_TRUE(kv.count_between("0020", "0010", cnt) == status::OK);
+	ASSERT_EQ(cnt, 0U);
+	ASSERT_TRUE(kv.count_prefix("01", cnt) == status::OK);
+	ASSERT_EQ(cnt, 100U);
+	ASSERT_TRUE(kv.count_prefix("", cnt) == status::OK);
+	ASSERT_EQ(cnt, 1000U);
+	ASSERT_TRUE(kv.count_prefix("1", cnt) == status::OK);
+	ASSERT_EQ(cnt, 0U);
+}
+
+TEST_F(BlackholeRecordsTest, GetTest)
+{
+	std::string value;
+	ASSERT_TRUE(kv.get("0042", &value) == status::OK);
+	ASSERT_EQ(value, "vvvvvvvv");
+	ASSERT_TRUE(kv.exists("0999") == status::OK);
+	ASSERT_TRUE(kv.exists("1000") == status::NOT_FOUND);
+	ASSERT_TRUE(kv.exists("42") == status::NOT_FOUND);
+	ASSERT_TRUE(kv.exists("004a") == status::NOT_FOUND);
+
+	/* records cannot be changed */
+	ASSERT_TRUE(kv.remove("0042") == status::OK);
+	ASSERT_TRUE(kv.put("key", "value") == status::OK);
+	ASSERT_TRUE(kv.exists("0042") == status::OK);
+	ASSERT_TRUE(kv.exists("key") == status::NOT_FOUND);
+}
+
+TEST_F(BlackholeRecordsTest, GetRangeTest)
+{
+	auto all = keys_of([&](kv_function f) { return kv.get_all(f); });
+	ASSERT_EQ(all.size(), 1000U);
+	ASSERT_EQ(all.front(), "0000");
+	ASSERT_EQ(all.back(), "0999");
+	ASSERT_TRUE(std::is_sorted(all.begin(), all.end()));
+
+	auto between =
+		keys_of([&](kv_function f) { return kv.get_between("0010", "0020", f); });
+	ASSERT_EQ(between.size(), 9U);
+	ASSERT_EQ(between.front(), "0011");
+	ASSERT_EQ(between.back(), "0019");
+
+	auto prefix = keys_of([&](kv_function f) { return kv.get_prefix("09", f); });
+	ASSERT_EQ(prefix.size(), 100U);
+	ASSERT_EQ(prefix.front(), "0900");
+
+	auto above = keys_of([&](kv_function f) { return kv.get_above("0998", f); });
+	ASSERT_TRUE(above == std::vector<std::string>({"0999"}));
+	keys_of([&](kv_function f) { return kv.get_above("0999", f); },
+		status::NOT_FOUND);
+
+	std::size_t calls = 0;
+	auto s = kv.get_all([&](string_view, string_view) { return ++calls == 5; });
+	ASSERT_TRUE(s == status::STOPPED_BY_CB);
+	ASSERT_EQ(calls, 5U);
+}
+
+TEST_F(BlackholeRecordsTest, GetNextTest)
+{
+	std::vector<std::string> keys;
+	for (auto record = kv.get_begin(); record.first.size() > 0;
+	     record = kv.get_next(record.first)) {
+		ASSERT_EQ(record.second.compare("vvvvvvvv"), 0);
+		keys.emplace_back(record.first.data(), record.first.size());
+	}
+	ASSERT_EQ(keys.size(), 1000U);
+	ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+
+	ASSERT_TRUE(kv.get_next("00").first.size() == 0);
+	ASSERT_EQ(kv.lower_bound("0005a").first.compare("0006"), 0);
+	ASSERT_EQ(kv.lower_bound("0006").first.compare("0006"), 0);
+	ASSERT_EQ(kv.upper_bound("0006").first.compare("0007"), 0);
+	ASSERT_TRUE(kv.upper_bound("0999").first.size() == 0);
+}
+
+TEST(BlackholeConfigTest, InvalidConfigTest)
+{
+	db kv;
+	config cfg;
+	ASSERT_TRUE(cfg.put_uint64("key_size", 0) == status::OK);
+	ASSERT_TRUE(kv.open("blackhole", std::move(cfg)) == status::INVALID_ARGUMENT);
+
+	config cfg2;
+	ASSERT_TRUE(cfg2.put_uint64("key_size", 4) == status::OK);
+	ASSERT_TRUE(cfg2.put_uint64("records", 10001) == status::OK);
+	ASSERT_TRUE(kv.open("blackhole", std::move(cfg2)) == status::INVALID_ARGUMENT);
+}
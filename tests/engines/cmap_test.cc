@@ -32,7 +32,12 @@
 
 #include "../../src/libpmemkv.hpp"
 #include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <map>
 #include <memory>
 #include <string>
 #include <thread>
@@ -78,21 +83,42 @@ public:
 		kv->close();
 		std::remove(PATH.c_str());
 	}
-	void Restart()
+	void Restart(const char *hash = nullptr)
 	{
 		kv->close();
 		kv.reset(nullptr);
-		Start(false);
+		Start(false, hash);
+	}
+
+	void Recreate(const char *hash, const char *layout = nullptr)
+	{
+		kv->close();
+		kv.reset(nullptr);
+		std::remove(PATH.c_str());
+		Start(true, hash, layout);
 	}
 
 protected:
-	void Start(bool create)
+	void Start(bool create, const char *hash = nullptr, const char *layout = nullptr)
 	{
 		config cfg;
 		auto cfg_s = cfg.put_string("path", PATH);
 		if (cfg_s != status::OK)
 			throw std::runtime_error("putting 'path' to config failed");
 
+		if (hash) {
+			cfg_s = cfg.put_string("hash", hash);
+			if (cfg_s != status::OK)
+				throw std::runtime_error("putting 'hash' to config failed");
+		}
+
+		if (layout) {
+			cfg_s = cfg.put_string("layout", layout);
+			if (cfg_s != status::OK)
+				throw std::runtime_error(
+					"putting 'layout' to config failed");
+		}
+
 		if (create) {
 			cfg_s = cfg.put_uint64("force_create", 1);
 			if (cfg_s != status::OK)
@@ -310,6 +336,233 @@ TEST_F(CMapTest, GetMultiple2Test_TRACERS_MPHD)
 	ASSERT_TRUE(kv->defrag() == status::OK);
 }
 
+TEST_F(CMapTest, GetManyTest_TRACERS_MPHD)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key3", "value3") == status::OK) << errormsg();
+
+	std::vector<string_view> keys{"key3", "key1", "key3"};
+	std::vector<std::string> values(keys.size());
+	auto s = kv->get_many(keys, [&](size_t idx, status st, string_view value) {
+		ASSERT_TRUE(st == status::OK);
+		values[idx].assign(value.data(), value.size());
+	});
+	ASSERT_TRUE(s == status::OK);
+	ASSERT_TRUE(values == std::vector<std::string>({"value3", "value1", "value3"}));
+
+	keys = {"key2", "waldo"};
+	std::vector<status> statuses(keys.size(), status::UNKNOWN_ERROR);
+	s = kv->get_many(keys, [&](size_t idx, status st, string_view value) {
+		statuses[idx] = st;
+	});
+	ASSERT_TRUE(s == status::NOT_FOUND);
+	ASSERT_TRUE(statuses[0] == status::OK);
+	ASSERT_TRUE(statuses[1] == status::NOT_FOUND);
+
+	ASSERT_TRUE(kv->get_many({}, [&](size_t, status, string_view) { FAIL(); }) ==
+		    status::OK);
+}
+
+TEST_F(CMapTest, AsyncTest)
+{
+	const size_t threads_number = 4;
+	const size_t thread_items = 200;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		std::vector<std::future<status>> puts;
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string istr = std::to_string(i * threads_number + thread_id);
+			puts.push_back(kv->put_async(istr, istr + "!"));
+		}
+		for (auto &f : puts)
+			ASSERT_TRUE(f.get() == status::OK);
+
+		std::vector<std::string> values(thread_items);
+		std::vector<std::future<status>> gets;
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string istr = std::to_string(i * threads_number + thread_id);
+			gets.push_back(kv->get_async(istr, &values[i]));
+		}
+		for (size_t i = 0; i < thread_items; i++) {
+			ASSERT_TRUE(gets[i].get() == status::OK);
+			ASSERT_EQ(values[i],
+				  std::to_string(i * threads_number + thread_id) + "!");
+		}
+	});
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, threads_number * thread_items);
+
+	std::promise<status> found;
+	ASSERT_TRUE(kv->get_async("waldo", [&](status s, string_view v) {
+		found.set_value(v.size() == 0 ? s : status::UNKNOWN_ERROR);
+	}) == status::OK);
+	ASSERT_TRUE(found.get_future().get() == status::NOT_FOUND);
+}
+
+TEST_F(CMapTest, WriteBatchTest_TRACERS_MPHD)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+
+	write_batch batch;
+	ASSERT_TRUE(batch.put("key3", "value3") == status::OK);
+	ASSERT_TRUE(batch.put("key1", "VALUE1") == status::OK);
+	ASSERT_TRUE(batch.remove("key2") == status::OK);
+	ASSERT_TRUE(batch.remove("nada") == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "VALUE1");
+	ASSERT_TRUE(kv->get("key3", &value) == status::OK && value == "value3");
+	ASSERT_TRUE(kv->exists("key2") == status::NOT_FOUND);
+}
+
+TEST_F(CMapTest, GetRefTest_TRACERS_MPHD)
+{
+	const std::string long_value(10000, 'x');
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", long_value) == status::OK) << errormsg();
+
+	value_ref ref;
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	ASSERT_TRUE(ref.value().compare("value1") == 0);
+	/* the reference is reused, previous value is released */
+	ASSERT_TRUE(kv->get_ref("key2", ref) == status::OK) << errormsg();
+	ASSERT_TRUE(ref.value().compare(long_value) == 0);
+	ASSERT_TRUE(kv->get_ref("nada", ref) == status::NOT_FOUND);
+	ASSERT_TRUE(ref.value().size() == 0);
+
+	ASSERT_TRUE(kv->get_ref("key1", ref) == status::OK) << errormsg();
+	value_ref moved(std::move(ref));
+	ASSERT_TRUE(moved.value().compare("value1") == 0);
+	moved.release();
+
+	ASSERT_TRUE(kv->put("key1", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->get_ref("key1", moved) == status::OK) << errormsg();
+	ASSERT_TRUE(moved.value().compare("value2") == 0);
+}
+
+/* returns value of the engine metric reported by db::stats(), or -1 if absent */
+static double metric(db &kv, const std::string &name)
+{
+	std::string json;
+	if (kv.stats(&json) != status::OK)
+		return -1;
+	auto pos = json.find("\"" + name + "\":", json.find("\"internals\":"));
+	if (pos == std::string::npos)
+		return -1;
+	return std::stod(json.substr(pos + name.size() + 3));
+}
+
+TEST_F(CMapTest, MetricsTest_TRACERS_MPHD)
+{
+	for (int i = 0; i < 1000; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	auto buckets = metric(*kv, "buckets");
+	ASSERT_GT(buckets, 0);
+	ASSERT_NEAR(metric(*kv, "load_factor"), 1000 / buckets, 1e-3);
+}
+
+TEST_F(CMapTest, CleanOpenTest_TRACERS_MPHD)
+{
+	/* the size is recounted at open only after a crash */
+	ASSERT_EQ(metric(*kv, "clean_open"), 0);
+	for (int i = 0; i < 100; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	Restart();
+	ASSERT_EQ(metric(*kv, "clean_open"), 1);
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 100);
+
+	/* failed open does not mark the pool as used */
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_string("layout", "rows") == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::INVALID_ARGUMENT);
+	Restart();
+	ASSERT_EQ(metric(*kv, "clean_open"), 1);
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 100);
+}
+
+TEST_F(CMapTest, WriteBatchRollbackTest_TRACERS_MPHD)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("change_log_size", 1024) == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::OK) << errormsg();
+
+	/* the last put does not fit in the change log, so it fails */
+	write_batch batch;
+	ASSERT_TRUE(batch.put("key1", "VALUE1") == status::OK);
+	ASSERT_TRUE(batch.remove("key2") == status::OK);
+	ASSERT_TRUE(batch.put("key3", "value3") == status::OK);
+	ASSERT_TRUE(batch.put("key4", std::string(2048, 'x')) == status::OK);
+	ASSERT_TRUE(kv->write(batch) != status::OK);
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 2);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->get("key2", &value) == status::OK && value == "value2");
+	ASSERT_TRUE(kv->exists("key3") == status::NOT_FOUND);
+
+	/* the log of the failed batch is dropped, the next one is applied */
+	Restart();
+	ASSERT_TRUE(batch.clear() == status::OK);
+	ASSERT_TRUE(batch.put("key3", "value3") == status::OK);
+	ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 3);
+}
+
+TEST_F(CMapTest, ConcurrentWriteBatchTest_TRACERS_MPHD)
+{
+	const size_t threads_number = 8;
+	const size_t keys_number = 16;
+	const size_t iterations = 200;
+
+	/* batches lock their keys, in any order, while puts and removes run */
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		std::string value = std::to_string(thread_id);
+		for (size_t i = 0; i < iterations; i++) {
+			if (thread_id % 2 == 0) {
+				write_batch batch;
+				for (size_t k = 0; k < keys_number; k++) {
+					auto key = std::to_string(
+						i % 2 ? k : keys_number - 1 - k);
+					ASSERT_TRUE(batch.put(key, value) == status::OK);
+				}
+				ASSERT_TRUE(kv->write(batch) == status::OK) << errormsg();
+			} else {
+				std::string key = std::to_string(i % keys_number);
+				auto s = kv->remove(key);
+				ASSERT_TRUE(s == status::OK || s == status::NOT_FOUND);
+				ASSERT_TRUE(kv->put(key, value) == status::OK)
+					<< errormsg();
+			}
+		}
+	});
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, keys_number);
+}
+
 TEST_F(CMapTest, GetNonexistentTest_TRACERS_MPHD)
 {
 	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
@@ -586,6 +839,543 @@ TEST_F(CMapTest, SimpleMultithreadedTest_TRACERS_MPHD)
 	ASSERT_TRUE(kv->defrag() == status::OK);
 }
 
+TEST_F(CMapTest, GroupCommitTest_TRACERS_MPHD)
+{
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("group_commit", 1) == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::OK) << errormsg();
+
+	size_t threads_number = 8;
+	size_t thread_items = 200;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string istr = std::to_string(thread_id * thread_items + i);
+			ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+			/* every thread also overwrites the same key */
+			ASSERT_TRUE(kv->put("shared", istr) == status::OK) << errormsg();
+			std::string value;
+			ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr);
+		}
+	});
+	auto puts = static_cast<double>(2 * threads_number * thread_items);
+	ASSERT_EQ(metric(*kv, "group_commit_puts"), puts);
+	ASSERT_GT(metric(*kv, "group_commits"), 0);
+	ASSERT_LE(metric(*kv, "group_commits"), puts);
+
+	/* grouped puts are persistent, as the others */
+	Restart();
+	ASSERT_EQ(metric(*kv, "group_commits"), -1);
+	for (size_t i = 0; i < threads_number * thread_items; i++) {
+		std::string istr = std::to_string(i);
+		std::string value;
+		ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr);
+	}
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == threads_number * thread_items + 1);
+}
+
+TEST_F(CMapTest, UpdateTest_TRACERS_MPHD)
+{
+	auto counter = [](int64_t v) {
+		return std::string(reinterpret_cast<const char *>(&v), sizeof(v));
+	};
+	const char *hashes[] = {"fibonacci", "fast", "fast"};
+	const char *layouts[] = {nullptr, nullptr, "contiguous"};
+	for (int l = 0; l < 3; l++) {
+		Recreate(hashes[l], layouts[l]);
+
+		/* concurrent increments of the same keys are not lost */
+		size_t threads_number = 8;
+		size_t thread_items = 100;
+		parallel_exec(threads_number, [&](size_t thread_id) {
+			for (size_t i = 0; i < thread_items; i++) {
+				auto key = "counter" + std::to_string(i % 4);
+				ASSERT_TRUE(kv->merge(key, PMEMKV_MERGE_INCREMENT,
+						      counter(2)) == status::OK)
+					<< errormsg();
+				ASSERT_TRUE(kv->merge("log", PMEMKV_MERGE_APPEND,
+						      std::to_string(thread_id)) ==
+					    status::OK)
+					<< errormsg();
+			}
+		});
+		for (int i = 0; i < 4; i++) {
+			std::string value;
+			ASSERT_TRUE(kv->get("counter" + std::to_string(i), &value) ==
+				    status::OK);
+			ASSERT_EQ(value, counter(
+						 static_cast<int64_t>(threads_number *
+								      thread_items / 2)));
+		}
+		std::string value;
+		ASSERT_TRUE(kv->get("log", &value) == status::OK);
+		ASSERT_EQ(value.size(), threads_number * thread_items);
+
+		/* compare-and-swap stops if the value is not the expected one */
+		auto cas = [&](string_view expected, string_view desired) {
+			auto swap = [&](const string_view *v, std::string &nv) {
+				if (!v || string_view(*v).compare(expected) != 0)
+					return false;
+				nv.assign(desired.data(), desired.size());
+				return true;
+			};
+			return kv->update("cas", swap);
+		};
+		ASSERT_TRUE(cas("a", "b") == status::STOPPED_BY_CB);
+		ASSERT_TRUE(kv->exists("cas") == status::NOT_FOUND);
+		ASSERT_TRUE(kv->put("cas", "a") == status::OK) << errormsg();
+		ASSERT_TRUE(cas("b", "c") == status::STOPPED_BY_CB);
+		ASSERT_TRUE(cas("a", std::string(1000, 'b')) == status::OK) << errormsg();
+		ASSERT_TRUE(kv->get("cas", &value) == status::OK);
+		ASSERT_EQ(value, std::string(1000, 'b'));
+
+		ASSERT_TRUE(kv->merge("cas", PMEMKV_MERGE_INCREMENT, counter(1)) ==
+			    status::INVALID_ARGUMENT);
+		ASSERT_TRUE(kv->merge("counter0", PMEMKV_MERGE_INCREMENT, "1") ==
+			    status::INVALID_ARGUMENT);
+		ASSERT_TRUE(kv->merge("counter0", 0, "1") == status::INVALID_ARGUMENT);
+
+		Restart();
+		ASSERT_TRUE(kv->get("counter3", &value) == status::OK);
+		ASSERT_EQ(value, counter(static_cast<int64_t>(threads_number *
+							      thread_items / 2)));
+		ASSERT_TRUE(kv->get("cas", &value) == status::OK);
+		ASSERT_EQ(value, std::string(1000, 'b'));
+	}
+}
+
+TEST_F(CMapTest, PutIfAbsentTest_TRACERS_MPHD)
+{
+	const char *hashes[] = {"fibonacci", "fast", "fast"};
+	const char *layouts[] = {nullptr, nullptr, "contiguous"};
+	for (int l = 0; l < 3; l++) {
+		Recreate(hashes[l], layouts[l]);
+
+		/* every key is inserted by exactly one of the threads */
+		size_t threads_number = 8;
+		size_t keys_number = 100;
+		std::atomic<size_t> inserts(0);
+		parallel_exec(threads_number, [&](size_t thread_id) {
+			for (size_t i = 0; i < keys_number; i++) {
+				bool inserted = false;
+				std::string value;
+				ASSERT_TRUE(kv->get_or_insert(std::to_string(i),
+							      std::to_string(thread_id),
+							      &value,
+							      &inserted) == status::OK)
+					<< errormsg();
+				if (inserted) {
+					inserts++;
+					ASSERT_EQ(value, std::to_string(thread_id));
+				}
+				std::string stored;
+				ASSERT_TRUE(kv->get(std::to_string(i), &stored) ==
+					    status::OK);
+				ASSERT_EQ(value, stored);
+			}
+		});
+		ASSERT_EQ(inserts.load(), keys_number);
+
+		bool inserted = true;
+		ASSERT_TRUE(kv->put_if_absent("0", "other", &inserted) == status::OK);
+		ASSERT_FALSE(inserted);
+		auto s = kv->put_if_absent("long", std::string(1000, 'x'), &inserted);
+		ASSERT_TRUE(s == status::OK) << errormsg();
+		ASSERT_TRUE(inserted);
+
+		Restart();
+		std::string value;
+		ASSERT_TRUE(kv->get("long", &value) == status::OK);
+		ASSERT_EQ(value, std::string(1000, 'x'));
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, keys_number + 1);
+	}
+}
+
+TEST_F(CMapTest, ChangeLogTest_TRACERS_MPHD)
+{
+	struct change {
+		uint64_t seq;
+		int op;
+		std::string key, value;
+	};
+	std::vector<change> changes;
+	auto collect = [&](uint64_t seq, int op, string_view key, string_view value) {
+		changes.push_back({seq, op, std::string(key.data(), key.size()),
+				   std::string(value.data(), value.size())});
+		return 0;
+	};
+	ASSERT_TRUE(kv->changes_since(0, collect) == status::NOT_SUPPORTED);
+
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("change_log_size", 1024) == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::OK) << errormsg();
+
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove("key1") == status::OK) << errormsg();
+	/* removing a missing key is not a change */
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_FOUND) << errormsg();
+	ASSERT_EQ(metric(*kv, "change_log_last_seq"), 3);
+
+	ASSERT_TRUE(kv->changes_since(0, collect) == status::OK);
+	ASSERT_EQ(changes.size(), 3);
+	ASSERT_TRUE(changes[0].seq == 1 && changes[0].op == PMEMKV_CHANGE_PUT &&
+		    changes[0].key == "key1" && changes[0].value == "value1");
+	ASSERT_TRUE(changes[1].seq == 2 && changes[1].op == PMEMKV_CHANGE_PUT &&
+		    changes[1].key == "key2" && changes[1].value == "value2");
+	ASSERT_TRUE(changes[2].seq == 3 && changes[2].op == PMEMKV_CHANGE_REMOVE &&
+		    changes[2].key == "key1" && changes[2].value.empty());
+
+	changes.clear();
+	ASSERT_TRUE(kv->changes_since(2, collect) == status::OK);
+	ASSERT_TRUE(changes.size() == 1 && changes[0].seq == 3);
+	changes.clear();
+	ASSERT_TRUE(kv->changes_since(3, collect) == status::OK);
+	ASSERT_TRUE(changes.empty());
+	ASSERT_TRUE(kv->changes_since(0, [](uint64_t, int, string_view, string_view) {
+		return 1;
+	}) == status::STOPPED_BY_CB);
+
+	/* a change which does not fit in the ring fails, leaving the data intact */
+	ASSERT_TRUE(kv->put("key3", std::string(2048, 'x')) != status::OK);
+	ASSERT_TRUE(kv->exists("key3") == status::NOT_FOUND);
+
+	/* the oldest changes are dropped when the ring is full */
+	for (int i = 0; i < 100; i++) {
+		std::string istr = std::to_string(i);
+		ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+	}
+	ASSERT_TRUE(kv->changes_since(0, collect) == status::NOT_FOUND);
+	changes.clear();
+	ASSERT_TRUE(kv->changes_since(99, collect) == status::OK);
+	ASSERT_TRUE(changes.size() == 4 && changes[0].seq == 100);
+	ASSERT_TRUE(changes[3].key == "99" && changes[3].value == "99");
+
+	/* the log is kept by the pool */
+	Restart();
+	ASSERT_EQ(metric(*kv, "change_log_last_seq"), 103);
+	changes.clear();
+	ASSERT_TRUE(kv->changes_since(102, collect) == status::OK);
+	ASSERT_TRUE(changes.size() == 1 && changes[0].key == "99");
+
+	/* updates are recorded as puts */
+	ASSERT_TRUE(kv->merge("99", PMEMKV_MERGE_APPEND, "!") == status::OK)
+		<< errormsg();
+	changes.clear();
+	ASSERT_TRUE(kv->changes_since(103, collect) == status::OK);
+	ASSERT_TRUE(changes.size() == 1 && changes[0].op == PMEMKV_CHANGE_PUT &&
+		    changes[0].value == "99!");
+
+	kv->close();
+	config cfg2;
+	ASSERT_TRUE(cfg2.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg2.put_uint64("change_log_size", 2048) == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg2)) == status::INVALID_ARGUMENT);
+	Restart();
+}
+
+TEST_F(CMapTest, CompressionTest_TRACERS_MPHD)
+{
+	kv->close();
+	config bad;
+	ASSERT_TRUE(bad.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(bad.put_string("compression", "zstd") == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(bad)) == status::INVALID_ARGUMENT);
+
+	std::remove((test_path + "/cmap_test").c_str());
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("force_create", 1) == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("size", SIZE) == status::OK);
+	ASSERT_TRUE(cfg.put_string("compression", "lz4") == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::OK) << errormsg();
+
+	/* compressible, short and incompressible values */
+	std::map<std::string, std::string> expected;
+	for (int i = 0; i < 100; i++) {
+		std::string istr = std::to_string(i);
+		std::string json;
+		while (json.size() < 4096)
+			json += "{\"id\": " + istr +
+				", \"name\": \"record\", \"tags\": []},";
+		expected["json" + istr] = json;
+		expected["short" + istr] = istr;
+		std::string noise(1024, '\0');
+		for (auto &c : noise)
+			c = static_cast<char>(rand());
+		expected["noise" + istr] = noise;
+	}
+	expected["empty"] = "";
+	for (auto &record : expected) {
+		ASSERT_TRUE(kv->put(record.first, record.second) == status::OK)
+			<< errormsg();
+	}
+	ASSERT_EQ(metric(*kv, "compressed_values"), 100);
+	ASSERT_GT(metric(*kv, "compression_saved_bytes"), 100 * 3 * 4096 / 4);
+
+	auto verify = [&] {
+		for (auto &record : expected) {
+			std::string value;
+			ASSERT_TRUE(kv->get(record.first, &value) == status::OK);
+			ASSERT_TRUE(value == record.second);
+		}
+		std::size_t cnt = 0;
+		ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+			auto it = expected.find(std::string(k.data(), k.size()));
+			EXPECT_TRUE(it != expected.end() && v.compare(it->second) == 0);
+			cnt++;
+			return 0;
+		}) == status::OK);
+		ASSERT_EQ(cnt, expected.size());
+
+		value_ref ref;
+		ASSERT_TRUE(kv->get_ref("json7", ref) == status::OK) << errormsg();
+		ASSERT_TRUE(ref.value().compare(expected["json7"]) == 0);
+	};
+	/* updates see and store the values as they were put */
+	ASSERT_TRUE(kv->merge("json7", PMEMKV_MERGE_APPEND, "]") == status::OK)
+		<< errormsg();
+	expected["json7"] += "]";
+	std::string existing;
+	ASSERT_TRUE(kv->get_or_insert("json8", "", &existing) == status::OK);
+	ASSERT_TRUE(existing == expected["json8"]);
+	verify();
+
+	/* the pool keeps the compression it was created with */
+	Restart();
+	ASSERT_EQ(metric(*kv, "compressed_values"), 0);
+	verify();
+	ASSERT_TRUE(kv->put("json0", expected["json1"]) == status::OK) << errormsg();
+	ASSERT_EQ(metric(*kv, "compressed_values"), 1);
+	std::string value;
+	ASSERT_TRUE(kv->get("json0", &value) == status::OK && value == expected["json1"]);
+}
+
+TEST_F(CMapTest, TTLTest_TRACERS_MPHD)
+{
+	ASSERT_TRUE(kv->put_with_ttl("key1", "value1", 10000) == status::NOT_SUPPORTED);
+
+	/*
+	 * Records expire only when the test moves its clock forward. The clock
+	 * outlives the engine, which is closed by the fixture.
+	 */
+	static uint64_t clock;
+	clock = 1000000;
+	auto advance = [](uint64_t ms) {
+		__atomic_add_fetch(&clock, ms, __ATOMIC_RELEASE);
+	};
+	auto open = [&](bool create) {
+		config cfg;
+		EXPECT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+		if (create) {
+			EXPECT_TRUE(cfg.put_uint64("force_create", 1) == status::OK);
+			EXPECT_TRUE(cfg.put_uint64("size", SIZE) == status::OK);
+			EXPECT_TRUE(cfg.put_uint64("ttl", 1) == status::OK);
+		}
+		EXPECT_TRUE(cfg.put_uint64("ttl_reap_interval", 10) == status::OK);
+		EXPECT_TRUE(cfg.put_object("ttl_clock", &clock, [](void *) {}) ==
+			    status::OK);
+		return kv->open("cmap", std::move(cfg));
+	};
+
+	kv->close();
+	std::remove((test_path + "/cmap_test").c_str());
+	ASSERT_TRUE(open(true) == status::OK) << errormsg();
+
+	ASSERT_TRUE(kv->put_with_ttl("short", "value1", 10000) == status::OK)
+		<< errormsg();
+	ASSERT_TRUE(kv->put_with_ttl("long", "value2", 3600000) == status::OK);
+	ASSERT_TRUE(kv->put_with_ttl("never", "value3", 0) == status::OK);
+	ASSERT_TRUE(kv->put("plain", "value4") == status::OK);
+	ASSERT_TRUE(kv->put_with_ttl("renewed", "value5", 10000) == status::OK);
+	ASSERT_TRUE(kv->put("renewed", "value6") == status::OK);
+	ASSERT_TRUE(kv->put_with_ttl("merged", "a", 10000) == status::OK);
+	ASSERT_TRUE(kv->merge("merged", PMEMKV_MERGE_APPEND, "b") == status::OK);
+
+	advance(9999);
+	std::string value;
+	ASSERT_TRUE(kv->get("short", &value) == status::OK && value == "value1");
+	ASSERT_TRUE(kv->get("merged", &value) == status::OK && value == "ab");
+	std::size_t cnt = 0;
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 6U);
+
+	advance(1);
+	/* expired records are not visible, whether the reaper got to them or not */
+	ASSERT_TRUE(kv->get("short", &value) == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("short") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("merged") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->get("renewed", &value) == status::OK && value == "value6");
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 4U);
+	std::map<std::string, std::string> all;
+	ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+		all[std::string(k.data(), k.size())] = std::string(v.data(), v.size());
+		return 0;
+	}) == status::OK);
+	std::map<std::string, std::string> expected = {{"long", "value2"},
+						       {"never", "value3"},
+						       {"plain", "value4"},
+						       {"renewed", "value6"}};
+	ASSERT_TRUE(all == expected);
+
+	/* the reaper runs in background, its progress is waited for */
+	for (int i = 0; i < 1000 && metric(*kv, "ttl_reaped") < 2; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	ASSERT_EQ(metric(*kv, "ttl_reaped"), 2);
+	ASSERT_EQ(metric(*kv, "ttl_queued"), 1);
+
+	/* expired records are missing for the writers as well */
+	ASSERT_TRUE(kv->put_with_ttl("stale", "old", 1000) == status::OK);
+	ASSERT_TRUE(kv->put_with_ttl("gone", "old", 1000) == status::OK);
+	advance(1000);
+	bool inserted = false;
+	ASSERT_TRUE(kv->get_or_insert("stale", "new", &value, &inserted) == status::OK);
+	ASSERT_TRUE(inserted && value == "new");
+	ASSERT_TRUE(kv->remove("gone") == status::NOT_FOUND);
+
+	/* the pool keeps TTL enabled, pending expiries are found again on open */
+	ASSERT_TRUE(kv->put_with_ttl("short", "value1", 10000) == status::OK);
+	kv->close();
+	ASSERT_TRUE(open(false) == status::OK) << errormsg();
+	ASSERT_EQ(metric(*kv, "ttl_queued"), 2);
+	ASSERT_TRUE(kv->put_with_ttl("other", "value7", 10000) == status::OK)
+		<< errormsg();
+	advance(10000);
+	ASSERT_TRUE(kv->exists("short") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("other") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->get("long", &value) == status::OK && value == "value2");
+	ASSERT_TRUE(kv->get("stale", &value) == status::OK && value == "new");
+}
+
+TEST_F(CMapTest, AllocClassesTest_TRACERS_MPHD)
+{
+	auto open = [&](const char *sizes, uint64_t arenas) {
+		kv->close();
+		std::remove((test_path + "/cmap_test").c_str());
+		config cfg;
+		EXPECT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+		EXPECT_TRUE(cfg.put_uint64("force_create", 1) == status::OK);
+		EXPECT_TRUE(cfg.put_uint64("size", SIZE) == status::OK);
+		EXPECT_TRUE(cfg.put_string("layout", "contiguous") == status::OK);
+		EXPECT_TRUE(cfg.put_string("alloc_class_sizes", sizes) == status::OK);
+		EXPECT_TRUE(cfg.put_uint64("arenas", arenas) == status::OK);
+		return kv->open("cmap", std::move(cfg));
+	};
+
+	for (auto sizes : {"", "abc", "0", "64,", ",64", "64,,128", "-64", "64 ", "1000000"})
+		ASSERT_TRUE(open(sizes, 0) == status::INVALID_ARGUMENT) << sizes;
+
+	/* records of two sizes, as hinted, and of others */
+	ASSERT_TRUE(open("48,1040", 2) == status::OK) << errormsg();
+	auto record = [](size_t i) {
+		std::string istr = std::to_string(i);
+		size_t size = i % 3 == 0 ? 1024 : (i % 3 == 1 ? 32 : i);
+		return std::make_pair("key" + istr, std::string(size, 'v') + istr);
+	};
+	auto verify = [&] {
+		std::string value;
+		for (size_t i = 0; i < 300; i++) {
+			auto r = record(i);
+			ASSERT_TRUE(kv->get(r.first, &value) == status::OK);
+			ASSERT_EQ(value, r.second);
+		}
+	};
+	for (size_t i = 0; i < 300; i++) {
+		auto r = record(i);
+		ASSERT_TRUE(kv->put(r.first, r.second) == status::OK) << errormsg();
+	}
+	verify();
+
+	/* classes are registered again when the pool is opened */
+	Restart();
+	verify();
+	for (size_t i = 0; i < 300; i += 2)
+		ASSERT_TRUE(kv->remove(record(i).first) == status::OK);
+	std::size_t cnt = 0;
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_EQ(cnt, 150U);
+}
+
+TEST_F(CMapTest, PrefaultTest_TRACERS_MPHD)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	kv->close();
+
+	config bad;
+	ASSERT_TRUE(bad.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(bad.put_uint64("prefault", 1) == status::OK);
+	ASSERT_TRUE(bad.put_uint64("prefault_threads", 0) == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(bad)) == status::INVALID_ARGUMENT);
+
+	for (uint64_t threads : {1U, 4U}) {
+		config cfg;
+		ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") ==
+			    status::OK);
+		ASSERT_TRUE(cfg.put_uint64("prefault", 1) == status::OK);
+		ASSERT_TRUE(cfg.put_uint64("prefault_threads", threads) == status::OK);
+		ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::OK) << errormsg();
+
+		std::string value;
+		ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+		kv->close();
+	}
+
+	Recreate(nullptr);
+	ASSERT_TRUE(kv->exists("key1") == status::NOT_FOUND);
+}
+
+TEST_F(CMapTest, RelaxedDurabilityTest_TRACERS_MPHD)
+{
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_string("durability", "relaxed") == status::OK);
+	/* writers flush the buffer themselves, when it gets full */
+	ASSERT_TRUE(cfg.put_uint64("max_buffered_bytes", 1024) == status::OK);
+	ASSERT_TRUE(kv->open("cmap", std::move(cfg)) == status::OK) << errormsg();
+
+	size_t threads_number = 8;
+	size_t thread_items = 200;
+	parallel_exec(threads_number, [&](size_t thread_id) {
+		for (size_t i = 0; i < thread_items; i++) {
+			std::string istr = std::to_string(thread_id * thread_items + i);
+			ASSERT_TRUE(kv->put(istr, istr) == status::OK) << errormsg();
+			std::string value;
+			ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr);
+		}
+	});
+	ASSERT_GT(metric(*kv, "flushes"), 0);
+	ASSERT_LE(metric(*kv, "buffered_bytes"), 1024);
+
+	/* callbacks of reads, buffered or not, may write to the db */
+	ASSERT_TRUE(kv->flush() == status::OK);
+	ASSERT_TRUE(kv->put("buffered", "value") == status::OK);
+	for (auto key : {"0", "buffered"}) {
+		auto s = kv->get(key, [&](string_view v) {
+			ASSERT_TRUE(kv->put("written", "value") == status::OK);
+		});
+		ASSERT_TRUE(s == status::OK);
+	}
+	ASSERT_TRUE(kv->exists("written") == status::OK);
+
+	/* close flushes the rest */
+	Restart();
+	for (size_t i = 0; i < threads_number * thread_items; i++) {
+		std::string istr = std::to_string(i);
+		std::string value;
+		ASSERT_TRUE(kv->get(istr, &value) == status::OK && value == istr);
+	}
+	ASSERT_TRUE(kv->flush() == status::OK);
+}
+
 // =============================================================================================
 // TEST RECOVERY
 // =============================================================================================
@@ -816,3 +1606,139 @@ TEST_F(CMapTest, NullConfigTest)
 	auto s = kv->open("cmap", std::move(empty_c_cfg));
 	ASSERT_TRUE(s == status::INVALID_ARGUMENT) << errormsg();
 }
+
+TEST_F(CMapTest, HashIsKeptAfterRecoveryTest_TRACERS_MPHD)
+{
+	const std::string hashes[] = {"fast", "fibonacci"};
+	for (const auto &hash : hashes) {
+		Recreate(hash.c_str());
+		/* cover all the key lengths handled separately by the fast hash */
+		for (size_t i = 0; i < 200; i++)
+			ASSERT_TRUE(kv->put(std::string(i, 'k') + std::to_string(i),
+					    std::to_string(i)) == status::OK)
+				<< errormsg();
+
+		/* the hash, which the pool was created with, is used */
+		Restart(hash == "fast" ? "fibonacci" : "fast");
+		for (size_t i = 0; i < 200; i++) {
+			std::string value;
+			ASSERT_TRUE(kv->get(std::string(i, 'k') + std::to_string(i),
+					    &value) == status::OK &&
+				    value == std::to_string(i));
+		}
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_TRUE(cnt == 200);
+	}
+}
+
+TEST_F(CMapTest, ContiguousLayoutTest_TRACERS_MPHD)
+{
+	Recreate(nullptr, "contiguous");
+	auto record = [](size_t i) {
+		/* cover empty and binary keys and values, short and long ones */
+		return std::make_pair(std::string(i % 50, 'k') + std::to_string(i),
+				      std::string(i % 300, '\0') + std::to_string(i));
+	};
+	ASSERT_TRUE(kv->put("", "") == status::OK) << errormsg();
+	for (size_t i = 0; i < 500; i++) {
+		auto r = record(i);
+		ASSERT_TRUE(kv->put(r.first, "first") == status::OK) << errormsg();
+		ASSERT_TRUE(kv->put(r.first, r.second) == status::OK) << errormsg();
+	}
+	for (size_t i = 0; i < 500; i += 5)
+		ASSERT_TRUE(kv->remove(record(i).first) == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove(record(0).first) == status::NOT_FOUND);
+
+	auto verify = [&] {
+		std::string value;
+		ASSERT_TRUE(kv->get("", &value) == status::OK && value.empty());
+		for (size_t i = 0; i < 500; i++) {
+			auto r = record(i);
+			if (i % 5 == 0) {
+				ASSERT_TRUE(kv->exists(r.first) == status::NOT_FOUND);
+				continue;
+			}
+			ASSERT_TRUE(kv->get(r.first, &value) == status::OK);
+			ASSERT_EQ(value, r.second);
+		}
+
+		size_t records = 0;
+		ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+			records++;
+			return k.size() == 0 ? 0 : v.size() > 0 ? 0 : 1;
+		}) == status::OK);
+		ASSERT_EQ(records, 401U);
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+		ASSERT_EQ(cnt, 401U);
+	};
+	verify();
+	ASSERT_TRUE(kv->defrag() == status::OK) << errormsg();
+	verify();
+
+	/* the layout is kept by the pool */
+	Restart();
+	verify();
+	ASSERT_TRUE(metric(*kv, "buckets") > 0);
+}
+
+TEST_F(CMapTest, UnknownLayoutTest_TRACERS_MPHD)
+{
+	const char *layouts[] = {"compact", "contiguous"};
+	for (auto layout : layouts) {
+		kv->close();
+		config cfg;
+		ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") ==
+			    status::OK);
+		ASSERT_TRUE(cfg.put_string("layout", layout) == status::OK);
+		/* contiguous layout is only supported with fast hash */
+		ASSERT_TRUE(cfg.put_string("hash", "fibonacci") == status::OK);
+		auto s = kv->open("cmap", std::move(cfg));
+		ASSERT_TRUE(s == status::INVALID_ARGUMENT) << errormsg();
+	}
+
+	Restart();
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+}
+
+TEST_F(CMapTest, UnknownHashTest_TRACERS_MPHD)
+{
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_string("hash", "crc32") == status::OK);
+	auto s = kv->open("cmap", std::move(cfg));
+	ASSERT_TRUE(s == status::INVALID_ARGUMENT) << errormsg();
+
+	Restart();
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+}
+
+TEST_F(CMapTest, GrowthGranularityTest_TRACERS_MPHD)
+{
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	for (uint64_t granularity : {uint64_t(0), uint64_t(8) << 20}) {
+		kv->close();
+		config cfg;
+		ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") ==
+			    status::OK);
+		ASSERT_TRUE(cfg.put_uint64("growth_granularity", granularity) ==
+			    status::OK);
+		auto s = kv->open("cmap", std::move(cfg));
+		ASSERT_TRUE(s == status::OK) << errormsg();
+		std::string value;
+		ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value1");
+	}
+
+	/* the pool is closed again, if the granularity is rejected */
+	kv->close();
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/cmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("growth_granularity", 1) == status::OK);
+	auto s = kv->open("cmap", std::move(cfg));
+	ASSERT_TRUE(s == status::INVALID_ARGUMENT) << errormsg();
+
+	Restart();
+	ASSERT_TRUE(kv->put("key2", "value2") == status::OK) << errormsg();
+}
@@ -36,6 +36,8 @@
 
 #include <cstdio>
 #include <memory>
+#include <thread>
+#include <vector>
 
 using namespace pmem::kv;
 
@@ -43,7 +45,7 @@ extern std::string test_path;
 const size_t SIZE = 1024ull * 1024ull * 512ull;
 const size_t LARGE_SIZE = 1024ull * 1024ull * 1024ull * 2ull;
 
-template <size_t POOL_SIZE>
+template <size_t POOL_SIZE, size_t SHARDS = 1>
 class VSMapBaseTest : public testing::Test {
 private:
 	std::string PATH = test_path + "/vsmap_test";
@@ -66,6 +68,14 @@ public:
 		if (cfg_s != status::OK)
 			throw std::runtime_error("putting 'size' to config failed");
 
+		if (SHARDS != 1) {
+			cfg_s = cfg.put_uint64("shards", SHARDS);
+
+			if (cfg_s != status::OK)
+				throw std::runtime_error(
+					"putting 'shards' to config failed");
+		}
+
 		kv.reset(new db);
 		auto s = kv->open("vsmap", std::move(cfg));
 		if (s != status::OK)
@@ -81,6 +91,7 @@ public:
 
 using VSMapTest = VSMapBaseTest<SIZE>;
 using VSMapLargeTest = VSMapBaseTest<LARGE_SIZE>;
+using VSMapShardedTest = VSMapBaseTest<SIZE, 8>;
 
 // =============================================================================================
 // TEST SMALL COLLECTIONS
@@ -993,6 +1004,184 @@ TEST_F(VSMapTest, UsesGetAllBetweenTest_TRACERS_M)
 	ASSERT_TRUE(x == "BB,5|BC,6|记!,RR|");
 }
 
+TEST_F(VSMapTest, ZeroShardsTest)
+{
+	config cfg;
+	ASSERT_TRUE(cfg.put_string("path", test_path + "/vsmap_test") == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("size", SIZE) == status::OK);
+	ASSERT_TRUE(cfg.put_uint64("shards", 0) == status::OK);
+
+	db kv2;
+	ASSERT_TRUE(kv2.open("vsmap", std::move(cfg)) == status::INVALID_ARGUMENT);
+}
+
+// =============================================================================================
+// TEST SHARDED COLLECTIONS
+// =============================================================================================
+
+TEST_F(VSMapShardedTest, SimpleTest_TRACERS_M)
+{
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 0);
+	ASSERT_TRUE(kv->put("key1", "value1") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->put("key1", "value2") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 1);
+	std::string value;
+	ASSERT_TRUE(kv->get("key1", &value) == status::OK && value == "value2");
+	ASSERT_TRUE(kv->remove("key1") == status::OK);
+	ASSERT_TRUE(kv->remove("key1") == status::NOT_FOUND);
+	ASSERT_TRUE(status::NOT_FOUND == kv->exists("key1"));
+}
+
+TEST_F(VSMapShardedTest, OrderedRangesTest_TRACERS_M)
+{
+	const int n = 1000;
+	for (int i = n - 1; i >= 0; i--) {
+		char key[8];
+		snprintf(key, sizeof(key), "%04d", i);
+		ASSERT_TRUE(kv->put(key, std::to_string(i)) == status::OK) << errormsg();
+	}
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == n);
+	ASSERT_TRUE(kv->count_above("0499", cnt) == status::OK);
+	ASSERT_TRUE(cnt == 500);
+	ASSERT_TRUE(kv->count_equal_above("0499", cnt) == status::OK);
+	ASSERT_TRUE(cnt == 501);
+	ASSERT_TRUE(kv->count_below("0100", cnt) == status::OK);
+	ASSERT_TRUE(cnt == 100);
+	ASSERT_TRUE(kv->count_equal_below("0100", cnt) == status::OK);
+	ASSERT_TRUE(cnt == 101);
+	ASSERT_TRUE(kv->count_between("0100", "0200", cnt) == status::OK);
+	ASSERT_TRUE(cnt == 99);
+
+	int expected = 0;
+	ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+		char key[8];
+		snprintf(key, sizeof(key), "%04d", expected);
+		EXPECT_EQ(std::string(k.data(), k.size()), key);
+		EXPECT_EQ(std::string(v.data(), v.size()), std::to_string(expected));
+		expected++;
+		return 0;
+	}) == status::OK);
+	ASSERT_TRUE(expected == n);
+
+	expected = 101;
+	ASSERT_TRUE(kv->get_between("0100", "0200", [&](string_view k, string_view v) {
+		EXPECT_EQ(std::string(v.data(), v.size()), std::to_string(expected));
+		expected++;
+		return 0;
+	}) == status::OK);
+	ASSERT_TRUE(expected == 200);
+
+	expected = 900;
+	ASSERT_TRUE(kv->get_equal_above("0900", [&](string_view k, string_view v) {
+		EXPECT_EQ(std::string(v.data(), v.size()), std::to_string(expected));
+		expected++;
+		return 0;
+	}) == status::OK);
+	ASSERT_TRUE(expected == n);
+
+	expected = 0;
+	ASSERT_TRUE(kv->get_below("0500", [&](string_view k, string_view v) {
+		expected++;
+		return expected == 10 ? 1 : 0;
+	}) == status::STOPPED_BY_CB);
+	ASSERT_TRUE(expected == 10);
+}
+
+TEST_F(VSMapShardedTest, ModifyInRangeCallbackTest_TRACERS_M)
+{
+	const int n = 1000;
+	for (int i = 0; i < n; i++) {
+		char key[8];
+		snprintf(key, sizeof(key), "%04d", i);
+		ASSERT_TRUE(kv->put(key, std::to_string(i)) == status::OK) << errormsg();
+	}
+
+	/* callbacks are called with no shard locked, so they can write */
+	int visited = 0;
+	ASSERT_TRUE(kv->get_all([&](string_view k, string_view v) {
+		EXPECT_EQ(std::string(v.data(), v.size()), std::to_string(visited));
+		EXPECT_TRUE(kv->put(k, "updated") == status::OK);
+		visited++;
+		return 0;
+	}) == status::OK);
+	ASSERT_TRUE(visited == n);
+
+	visited = 0;
+	ASSERT_TRUE(kv->get_above("0499", [&](string_view k, string_view v) {
+		EXPECT_EQ(std::string(v.data(), v.size()), "updated");
+		EXPECT_TRUE(kv->remove(k) == status::OK);
+		visited++;
+		return 0;
+	}) == status::OK);
+	ASSERT_TRUE(visited == 500);
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == 500);
+}
+
+TEST_F(VSMapShardedTest, RemoveRangeTest_TRACERS_M)
+{
+	const int n = 1000;
+	for (int i = 0; i < n; i++) {
+		char key[8];
+		snprintf(key, sizeof(key), "%04d", i);
+		ASSERT_TRUE(kv->put(key, std::to_string(i)) == status::OK) << errormsg();
+	}
+
+	/* the first key of the range is removed, the last one is not */
+	ASSERT_TRUE(kv->remove_range("0100", "0200") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove_range("0300", "0300") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove_range("0900", "0800") == status::OK) << errormsg();
+	ASSERT_TRUE(kv->remove_range("0950", "1") == status::OK) << errormsg();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == n - 150);
+	ASSERT_TRUE(kv->exists("0099") == status::OK);
+	ASSERT_TRUE(kv->exists("0100") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("0199") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->exists("0200") == status::OK);
+	ASSERT_TRUE(kv->exists("0300") == status::OK);
+	ASSERT_TRUE(kv->exists("0949") == status::OK);
+	ASSERT_TRUE(kv->exists("0950") == status::NOT_FOUND);
+	ASSERT_TRUE(kv->count_between("0099", "0200", cnt) == status::OK);
+	ASSERT_TRUE(cnt == 0);
+}
+
+TEST_F(VSMapShardedTest, MultithreadedPutGetTest_TRACERS_M)
+{
+	const int threads_number = 8;
+	const int n = 1000;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threads_number; t++) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < n; i++) {
+				std::string key =
+					std::to_string(t) + "_" + std::to_string(i);
+				ASSERT_TRUE(kv->put(key, key + "!") == status::OK);
+				std::string value;
+				ASSERT_TRUE(kv->get(key, &value) == status::OK &&
+					    value == key + "!");
+				std::size_t cnt;
+				ASSERT_TRUE(kv->count_above(key, cnt) == status::OK);
+			}
+		});
+	}
+	for (auto &th : threads)
+		th.join();
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_TRUE(kv->count_all(cnt) == status::OK);
+	ASSERT_TRUE(cnt == threads_number * n);
+}
+
 // =============================================================================================
 // TEST LARGE COLLECTIONS
 // =============================================================================================
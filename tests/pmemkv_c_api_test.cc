@@ -32,10 +32,16 @@
 
 #include "../src/libpmemkv.h"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <condition_variable>
 #include <cstdio>
+#include <fcntl.h>
 #include <map>
+#include <mutex>
 #include <string>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 // Tests and params' list
 #include "basic_tests.h"
@@ -171,14 +177,709 @@ TEST_P(PmemkvCApiTest, CheckNullDB)
 	s = pmemkv_get_copy(NULL, key1, strlen(key1), val, 10, &cnt);
 	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
 
+	const char *keys[] = {key1};
+	size_t keys_size[] = {strlen(key1)};
+	s = pmemkv_get_many(NULL, 1, keys, keys_size, NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
 	s = pmemkv_put(NULL, key1, strlen(key1), value1, strlen(value1));
 	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
 
 	s = pmemkv_remove(NULL, key1, strlen(key1));
 	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
 
+	s = pmemkv_remove_range(NULL, key1, strlen(key1), key1, strlen(key1));
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	pmemkv_write_batch *batch = NULL;
+	s = pmemkv_write_batch_new(&batch);
+	ASSERT_TRUE(s == PMEMKV_STATUS_OK) << pmemkv_errormsg();
+	s = pmemkv_write(NULL, batch);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+	pmemkv_write_batch_delete(batch);
+
+	s = pmemkv_write_batch_put(NULL, key1, strlen(key1), value1, strlen(value1));
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_bulk_load(NULL, NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	pmemkv_value_ref *ref = NULL;
+	s = pmemkv_value_ref_new(&ref);
+	ASSERT_TRUE(s == PMEMKV_STATUS_OK) << pmemkv_errormsg();
+	const char *v;
+	size_t vb;
+	s = pmemkv_get_ref(NULL, key1, strlen(key1), ref, &v, &vb);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+	pmemkv_value_ref_delete(ref);
+
+	s = pmemkv_value_ref_release(NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
 	s = pmemkv_defrag(NULL, 0, 100);
 	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_flush(NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_stats(NULL, NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_stats_reset(NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_scan(NULL, key1, strlen(key1), 0, 1, NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_get_all_parallel(NULL, 1, NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_get_between_parallel(NULL, key1, strlen(key1), key2, strlen(key2), 1,
+					NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_put_async(NULL, key1, strlen(key1), value1, strlen(value1), NULL,
+			     NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_get_async(NULL, key1, strlen(key1), NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_count_prefix(NULL, key1, strlen(key1), &cnt);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_get_prefix(NULL, key1, strlen(key1), NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_update(NULL, key1, strlen(key1), NULL, NULL);
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+
+	s = pmemkv_merge(NULL, key1, strlen(key1), PMEMKV_MERGE_APPEND, value1,
+			 strlen(value1));
+	ASSERT_TRUE(s == PMEMKV_STATUS_INVALID_ARGUMENT) << pmemkv_errormsg();
+}
+
+TEST_P(PmemkvCApiTest, GetRef)
+{
+	const char *key1 = "key1";
+	const char *value1 = "value1";
+	int s = pmemkv_put(db, key1, strlen(key1), value1, strlen(value1));
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+
+	pmemkv_value_ref *ref = NULL;
+	s = pmemkv_value_ref_new(&ref);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+
+	const char *v = NULL;
+	size_t vb = 0;
+	s = pmemkv_get_ref(db, key1, strlen(key1), ref, &v, &vb);
+	/* engines which do not store data (blackhole) never find a record */
+	if (params.test_value_length > 0) {
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+		ASSERT_EQ(std::string(value1), std::string(v, vb));
+	} else {
+		ASSERT_EQ(PMEMKV_STATUS_NOT_FOUND, s) << pmemkv_errormsg();
+	}
+	ASSERT_EQ(PMEMKV_STATUS_OK, pmemkv_value_ref_release(ref));
+
+	s = pmemkv_get_ref(db, "nada", strlen("nada"), ref, &v, &vb);
+	ASSERT_EQ(PMEMKV_STATUS_NOT_FOUND, s) << pmemkv_errormsg();
+
+	pmemkv_value_ref_delete(ref);
+}
+
+/* doubles the value, or stores "1" for a missing record */
+static int double_value(const char *v, size_t vb, const char **nv, size_t *nvb,
+			void *arg)
+{
+	auto buffer = static_cast<std::string *>(arg);
+	*buffer = v ? std::string(v, vb) + std::string(v, vb) : "1";
+	*nv = buffer->data();
+	*nvb = buffer->size();
+	return 0;
+}
+
+TEST_P(PmemkvCApiTest, Update)
+{
+	std::string buffer;
+	int s = pmemkv_update(db, "key1", strlen("key1"), double_value, &buffer);
+	if (s == PMEMKV_STATUS_NOT_SUPPORTED)
+		return;
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	s = pmemkv_update(db, "key1", strlen("key1"), double_value, &buffer);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	s = pmemkv_merge(db, "key1", strlen("key1"), PMEMKV_MERGE_APPEND, "2", 1);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+
+	char val[10];
+	size_t vb = 0;
+	s = pmemkv_get_copy(db, "key1", strlen("key1"), val, sizeof(val), &vb);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(std::string("112"), std::string(val, vb));
+
+	int64_t increment = -5;
+	s = pmemkv_merge(db, "key2", strlen("key2"), PMEMKV_MERGE_INCREMENT,
+			 reinterpret_cast<const char *>(&increment), sizeof(increment));
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	s = pmemkv_merge(db, "key1", strlen("key1"), PMEMKV_MERGE_INCREMENT,
+			 reinterpret_cast<const char *>(&increment), sizeof(increment));
+	ASSERT_EQ(PMEMKV_STATUS_INVALID_ARGUMENT, s) << pmemkv_errormsg();
+	s = pmemkv_get_copy(db, "key2", strlen("key2"), val, sizeof(val), &vb);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(std::string(reinterpret_cast<const char *>(&increment),
+			      sizeof(increment)),
+		  std::string(val, vb));
+}
+
+static void copy_value(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+TEST_P(PmemkvCApiTest, PutIfAbsent)
+{
+	int inserted = 0;
+	int s = pmemkv_put_if_absent(db, "key1", strlen("key1"), "value1",
+				     strlen("value1"), &inserted);
+	if (s == PMEMKV_STATUS_NOT_SUPPORTED)
+		return;
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(inserted, 1);
+
+	std::string value;
+	s = pmemkv_get_or_insert(db, "key1", strlen("key1"), "value2", strlen("value2"),
+				 copy_value, &value, &inserted);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(inserted, 0);
+	ASSERT_EQ(std::string("value1"), value);
+
+	s = pmemkv_get_or_insert(db, "key2", strlen("key2"), "value2", strlen("value2"),
+				 copy_value, &value, NULL);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(std::string("value2"), value);
+	s = pmemkv_exists(db, "key2", strlen("key2"));
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+}
+
+static void get_stats(const char *v, size_t vb, void *arg)
+{
+	static_cast<std::string *>(arg)->assign(v, vb);
+}
+
+TEST_P(PmemkvCApiTest, Stats)
+{
+	const char *key1 = "key1";
+	const char *value1 = "value1";
+	size_t cnt;
+	for (int i = 0; i < 3; i++) {
+		int s = pmemkv_put(db, key1, strlen(key1), value1, strlen(value1));
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+	std::string json;
+	pmemkv_exists(db, key1, strlen(key1));
+	pmemkv_get(db, key1, strlen(key1), get_stats, &json);
+	pmemkv_count_all(db, &cnt);
+	pmemkv_remove(db, key1, strlen(key1));
+
+	int s = pmemkv_stats(db, get_stats, &json);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(json.find("{\"engine\":\"" + std::string(params.engine) + "\""), 0U)
+		<< json;
+	ASSERT_NE(json.find("\"put\":{\"count\":3,"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"get\":{\"count\":2,"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"remove\":{\"count\":1,"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"range\":{\"count\":1,"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"write\":{\"count\":0,"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"p99_ns\":"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"histogram\":[{\"le_ns\":"), std::string::npos) << json;
+	ASSERT_NE(json.find(",\"internals\":{"), std::string::npos) << json;
+
+	ASSERT_EQ(PMEMKV_STATUS_OK, pmemkv_stats_reset(db)) << pmemkv_errormsg();
+	s = pmemkv_stats(db, get_stats, &json);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_NE(json.find("\"put\":{\"count\":0,"), std::string::npos) << json;
+	ASSERT_NE(json.find("\"histogram\":[]"), std::string::npos) << json;
+}
+
+struct scan_result {
+	std::vector<size_t> batches;
+	std::map<std::string, std::string> records;
+	size_t stop_after = 0;
+};
+
+static int get_scan_batch(size_t count, const char *const *keys, const size_t *keybytes,
+			  const char *const *values, const size_t *valuebytes,
+			  void *arg)
+{
+	auto result = static_cast<scan_result *>(arg);
+	result->batches.push_back(count);
+	for (size_t i = 0; i < count; i++)
+		result->records[std::string(keys[i], keybytes[i])] =
+			std::string(values[i], valuebytes[i]);
+
+	return result->batches.size() == result->stop_after;
+}
+
+TEST_P(PmemkvCApiTest, Scan)
+{
+	const char *keys[] = {"a", "ab1", "ab2", "ab3", "ab4", "ab5", "abc", "b", "ba"};
+	for (auto key : keys) {
+		int s = pmemkv_put(db, key, strlen(key), key, strlen(key));
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+
+	/* engines which do not store data (blackhole) never find a record */
+	int ok = params.test_value_length > 0 ? PMEMKV_STATUS_OK
+					      : PMEMKV_STATUS_NOT_FOUND;
+
+	scan_result all;
+	int s = pmemkv_scan(db, "", 0, 0, 4, get_scan_batch, &all);
+	ASSERT_EQ(ok, s) << pmemkv_errormsg();
+	if (ok != PMEMKV_STATUS_OK)
+		return;
+	ASSERT_EQ(all.batches, std::vector<size_t>({4, 4, 1}));
+	ASSERT_EQ(all.records.size(), 9U);
+
+	scan_result prefixed;
+	s = pmemkv_scan(db, "ab", 2, 0, 4, get_scan_batch, &prefixed);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(prefixed.batches, std::vector<size_t>({4, 2}));
+	ASSERT_EQ(prefixed.records.size(), 6U);
+	ASSERT_EQ(prefixed.records.begin()->first, "ab1");
+	ASSERT_EQ(prefixed.records.rbegin()->first, "abc");
+	ASSERT_EQ(prefixed.records["ab2"], "ab2");
+
+	scan_result limited;
+	s = pmemkv_scan(db, "ab", 2, 5, 2, get_scan_batch, &limited);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(limited.batches, std::vector<size_t>({2, 2, 1}));
+
+	scan_result stopped;
+	stopped.stop_after = 1;
+	s = pmemkv_scan(db, "ab", 2, 0, 2, get_scan_batch, &stopped);
+	ASSERT_EQ(PMEMKV_STATUS_STOPPED_BY_CB, s) << pmemkv_errormsg();
+	ASSERT_EQ(stopped.batches, std::vector<size_t>({2}));
+
+	scan_result none;
+	s = pmemkv_scan(db, "c", 1, 0, 2, get_scan_batch, &none);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_TRUE(none.batches.empty());
+
+	s = pmemkv_scan(db, "ab", 2, 0, 0, get_scan_batch, &none);
+	ASSERT_EQ(PMEMKV_STATUS_INVALID_ARGUMENT, s) << pmemkv_errormsg();
+}
+
+static int get_prefix_keys(const char *k, size_t kb, const char *, size_t, void *arg)
+{
+	static_cast<std::vector<std::string> *>(arg)->emplace_back(k, kb);
+	return 0;
+}
+
+TEST_P(PmemkvCApiTest, Prefix)
+{
+	/* keys around the bounds of prefixes, in either order of chars */
+	const std::string keys[] = {"a",	   "ab",	  "ab\x7f",	 "ab\x7f\x01",
+				    "ab\xff",	   "ab\xff\x01", "ab\xff\xff", "ac",
+				    "\xff\xff", "\xff\xff\x01"};
+	for (auto &key : keys) {
+		int s = pmemkv_put(db, key.data(), key.size(), "v", 1);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+
+	size_t cnt;
+	int s = pmemkv_count_prefix(db, "ab", 2, &cnt);
+	if (s == PMEMKV_STATUS_NOT_SUPPORTED)
+		return; /* unordered engine */
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	if (params.test_value_length == 0) {
+		/* engines which do not store data (blackhole) never find a record */
+		ASSERT_EQ(cnt, 0U);
+		return;
+	}
+
+	const std::pair<std::string, size_t> expected[] = {
+		{"", 10}, {"a", 8}, {"ab", 6}, {"ab\x7f", 2}, {"ab\xff", 3},
+		{"ab\xff\xff", 1}, {"ac", 1}, {"b", 0}, {"\xff\xff", 2}};
+	for (auto &e : expected) {
+		s = pmemkv_count_prefix(db, e.first.data(), e.first.size(), &cnt);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+		ASSERT_EQ(cnt, e.second) << e.first;
+
+		std::vector<std::string> found;
+		s = pmemkv_get_prefix(db, e.first.data(), e.first.size(), get_prefix_keys,
+				      &found);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+		ASSERT_EQ(found.size(), e.second) << e.first;
+		for (auto &key : found)
+			ASSERT_EQ(key.compare(0, e.first.size(), e.first), 0);
+	}
+
+	s = pmemkv_get_prefix(
+		db, "ab", 2, [](const char *, size_t, const char *, size_t, void *) { return 1; },
+		nullptr);
+	ASSERT_EQ(PMEMKV_STATUS_STOPPED_BY_CB, s) << pmemkv_errormsg();
+}
+
+static const size_t PARALLEL_WORKERS = 4;
+
+/* every worker appends to its own vector, so no locking is needed */
+static int get_parallel_keys(size_t worker, const char *k, size_t kb, const char *,
+			     size_t, void *arg)
+{
+	if (worker >= PARALLEL_WORKERS)
+		return 1;
+
+	static_cast<std::vector<std::string> *>(arg)[worker].emplace_back(k, kb);
+	return 0;
+}
+
+TEST_P(PmemkvCApiTest, GetAllParallel)
+{
+	/* more records than a single worker takes at once */
+	const size_t count = 3000;
+	for (size_t i = 0; i < count; i++) {
+		std::string key = std::to_string(i);
+		int s = pmemkv_put(db, key.data(), key.size(), "v", 1);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+
+	std::vector<std::string> serial;
+	int s = pmemkv_get_all(db, get_prefix_keys, &serial);
+	std::vector<std::string> found[PARALLEL_WORKERS];
+	ASSERT_EQ(s, pmemkv_get_all_parallel(db, PARALLEL_WORKERS, get_parallel_keys,
+					     found))
+		<< pmemkv_errormsg();
+	if (s != PMEMKV_STATUS_OK)
+		return;
+
+	std::vector<std::string> merged;
+	for (auto &keys : found)
+		merged.insert(merged.end(), keys.begin(), keys.end());
+	std::sort(merged.begin(), merged.end());
+	std::sort(serial.begin(), serial.end());
+	ASSERT_EQ(merged, serial);
+	ASSERT_EQ(merged.size(), params.test_value_length > 0 ? count : 0);
+
+	auto stop = [](size_t, const char *, size_t, const char *, size_t, void *) {
+		return 1;
+	};
+	s = pmemkv_get_all_parallel(db, PARALLEL_WORKERS, stop, nullptr);
+	if (params.test_value_length > 0) {
+		ASSERT_EQ(PMEMKV_STATUS_STOPPED_BY_CB, s) << pmemkv_errormsg();
+	}
+
+	s = pmemkv_get_all_parallel(db, 0, get_parallel_keys, found);
+	ASSERT_EQ(PMEMKV_STATUS_INVALID_ARGUMENT, s) << pmemkv_errormsg();
+}
+
+TEST_P(PmemkvCApiTest, GetBetweenParallel)
+{
+	const size_t count = 3000;
+	for (size_t i = 0; i < count; i++) {
+		std::string key = std::to_string(i);
+		int s = pmemkv_put(db, key.data(), key.size(), "v", 1);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+
+	/* ranges within the tree, beyond both its ends and an empty one */
+	const std::pair<std::string, std::string> ranges[] = {
+		{"1", "5"}, {"", "\x7f"}, {"2500", "2501"}, {"3", "3"}};
+	for (auto &range : ranges) {
+		std::vector<std::string> serial;
+		int s = pmemkv_get_between(db, range.first.data(), range.first.size(),
+					   range.second.data(), range.second.size(),
+					   get_prefix_keys, &serial);
+		std::vector<std::string> found[PARALLEL_WORKERS];
+		ASSERT_EQ(s, pmemkv_get_between_parallel(
+				     db, range.first.data(), range.first.size(),
+				     range.second.data(), range.second.size(),
+				     PARALLEL_WORKERS, get_parallel_keys, found))
+			<< pmemkv_errormsg();
+		if (s != PMEMKV_STATUS_OK)
+			return;
+
+		/* each worker gets whole parts, in order of keys */
+		std::vector<std::string> merged;
+		for (auto &keys : found) {
+			ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+			merged.insert(merged.end(), keys.begin(), keys.end());
+		}
+		std::sort(merged.begin(), merged.end());
+		std::sort(serial.begin(), serial.end());
+		ASSERT_EQ(merged, serial) << range.first << " " << range.second;
+	}
+
+	int s = pmemkv_get_between_parallel(db, "", 0, "2", 1, 0, get_parallel_keys,
+					    nullptr);
+	ASSERT_EQ(PMEMKV_STATUS_INVALID_ARGUMENT, s) << pmemkv_errormsg();
+}
+
+/* completions of asynchronous requests, recorded by the workers */
+struct async_results {
+	std::mutex mtx;
+	std::condition_variable cv;
+	size_t completed = 0;
+	std::map<std::string, int> statuses;
+	std::map<std::string, std::string> values;
+
+	void wait(size_t count)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&] { return completed == count; });
+	}
+};
+
+struct async_request {
+	async_results *results;
+	std::string key;
+};
+
+static void put_async_done(int s, void *arg)
+{
+	auto r = static_cast<async_request *>(arg);
+	std::lock_guard<std::mutex> lock(r->results->mtx);
+	r->results->statuses[r->key] = s;
+	r->results->completed++;
+	r->results->cv.notify_all();
+}
+
+static void get_async_done(int s, const char *v, size_t vb, void *arg)
+{
+	auto r = static_cast<async_request *>(arg);
+	std::lock_guard<std::mutex> lock(r->results->mtx);
+	r->results->statuses[r->key] = s;
+	if (s == PMEMKV_STATUS_OK)
+		r->results->values[r->key] = std::string(v, vb);
+	r->results->completed++;
+	r->results->cv.notify_all();
+}
+
+TEST_P(PmemkvCApiTest, PutGetAsync)
+{
+	const size_t count = 500;
+	std::vector<async_request> puts, gets;
+	async_results results;
+	for (size_t i = 0; i < count; i++) {
+		puts.push_back({&results, std::to_string(i)});
+		gets.push_back({&results, std::to_string(i)});
+	}
+
+	/* the second value of every key is queued after the first one */
+	for (size_t i = 0; i < count; i++) {
+		auto &key = puts[i].key;
+		int s = pmemkv_put_async(db, key.data(), key.size(), "first", 5, nullptr,
+					 nullptr);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+		s = pmemkv_put_async(db, key.data(), key.size(), key.data(), key.size(),
+				     put_async_done, &puts[i]);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+	results.wait(count);
+	for (auto &r : results.statuses)
+		ASSERT_EQ(PMEMKV_STATUS_OK, r.second) << r.first;
+
+	results.completed = 0;
+	results.statuses.clear();
+	for (size_t i = 0; i < count; i++) {
+		auto &key = gets[i].key;
+		int s = pmemkv_get_async(db, key.data(), key.size(), get_async_done,
+					 &gets[i]);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+	results.wait(count);
+
+	/* blackhole stores nothing */
+	auto expected = params.test_value_length > 0 ? PMEMKV_STATUS_OK
+						     : PMEMKV_STATUS_NOT_FOUND;
+	for (size_t i = 0; i < count; i++) {
+		auto &key = gets[i].key;
+		ASSERT_EQ(expected, results.statuses[key]) << key;
+		if (expected == PMEMKV_STATUS_OK) {
+			ASSERT_EQ(key, results.values[key]);
+		}
+	}
+
+	int s = pmemkv_get_async(db, "0", 1, nullptr, nullptr);
+	ASSERT_EQ(PMEMKV_STATUS_INVALID_ARGUMENT, s) << pmemkv_errormsg();
+
+	/* requests still queued are completed by close */
+	results.completed = 0;
+	for (size_t i = 0; i < count; i++) {
+		auto &key = puts[i].key;
+		s = pmemkv_put_async(db, key.data(), key.size(), "v", 1, put_async_done,
+				     &puts[i]);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	}
+	pmemkv_close(db);
+	db = NULL;
+	ASSERT_EQ(results.completed, count);
+}
+
+TEST_P(PmemkvCApiTest, RelaxedDurability)
+{
+	ASSERT_EQ(pmemkv_flush(db), PMEMKV_STATUS_OK) << pmemkv_errormsg();
+	pmemkv_close(db);
+	db = NULL;
+
+	const char *durabilities[] = {"unsafe", "relaxed"};
+	for (auto durability : durabilities) {
+		pmemkv_config *cfg = pmemkv_config_new();
+		ASSERT_NE(cfg, nullptr) << pmemkv_errormsg();
+		ASSERT_EQ(pmemkv_config_put_string(cfg, "path", path.c_str()),
+			  PMEMKV_STATUS_OK);
+		ASSERT_EQ(pmemkv_config_put_uint64(cfg, "size", params.size),
+			  PMEMKV_STATUS_OK);
+		ASSERT_EQ(pmemkv_config_put_string(cfg, "durability", durability),
+			  PMEMKV_STATUS_OK);
+		/* only explicit flushes, as not all the engines are concurrent */
+		ASSERT_EQ(pmemkv_config_put_uint64(cfg, "flush_interval_ms", 0),
+			  PMEMKV_STATUS_OK);
+		int s = pmemkv_open(params.engine, cfg, &db);
+		if (durability == std::string("unsafe")) {
+			ASSERT_EQ(s, PMEMKV_STATUS_INVALID_ARGUMENT);
+		} else {
+			ASSERT_EQ(s, PMEMKV_STATUS_OK) << pmemkv_errormsg();
+		}
+	}
+
+	/* buffered changes are visible before they are flushed */
+	ASSERT_EQ(pmemkv_put(db, "key1", 4, "value1", 6), PMEMKV_STATUS_OK);
+	ASSERT_EQ(pmemkv_put(db, "key2", 4, "value2", 6), PMEMKV_STATUS_OK);
+	ASSERT_EQ(pmemkv_remove(db, "key2", 4), PMEMKV_STATUS_OK);
+	ASSERT_EQ(pmemkv_remove(db, "key2", 4), PMEMKV_STATUS_NOT_FOUND);
+	ASSERT_EQ(pmemkv_exists(db, "key1", 4), PMEMKV_STATUS_OK);
+	ASSERT_EQ(pmemkv_exists(db, "key2", 4), PMEMKV_STATUS_NOT_FOUND);
+	char buffer[16];
+	ASSERT_EQ(pmemkv_get_copy(db, "key1", 4, buffer, sizeof(buffer), NULL),
+		  PMEMKV_STATUS_OK);
+	ASSERT_EQ(std::string(buffer), "value1");
+
+	ASSERT_EQ(pmemkv_flush(db), PMEMKV_STATUS_OK) << pmemkv_errormsg();
+
+	/* blackhole stores nothing */
+	int expected = params.test_value_length > 0 ? PMEMKV_STATUS_OK
+						    : PMEMKV_STATUS_NOT_FOUND;
+	ASSERT_EQ(pmemkv_exists(db, "key1", 4), expected);
+	ASSERT_EQ(pmemkv_exists(db, "key2", 4), PMEMKV_STATUS_NOT_FOUND);
+}
+
+static int get_records(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+{
+	(*static_cast<std::map<std::string, std::string> *>(arg))[std::string(k, kb)] =
+		std::string(v, vb);
+	return 0;
+}
+
+TEST_P(PmemkvCApiTest, ExportImport)
+{
+	/* blackhole stores nothing */
+	if (params.test_value_length == 0)
+		return;
+
+	/* more records than fit in a single buffer of the stream */
+	const size_t count = 3000;
+	std::map<std::string, std::string> expected;
+	for (size_t i = 0; i < count; i++) {
+		std::string key = std::to_string(i);
+		std::string value = key + std::string(500, 'v');
+		int s = pmemkv_put(db, key.data(), key.size(), value.data(),
+				   value.size());
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+		expected[key] = value;
+	}
+
+	std::string file = path + ".export";
+	int fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	ASSERT_GE(fd, 0);
+
+	/* a single worker of an ordered engine writes records in order of keys */
+	for (size_t nthreads : {size_t(1), PARALLEL_WORKERS}) {
+		ASSERT_EQ(ftruncate(fd, 0), 0);
+		ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+		int s = pmemkv_export(db, fd, nthreads);
+		if (s == PMEMKV_STATUS_NOT_SUPPORTED)
+			break;
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+
+		for (size_t i = 0; i < count; i++) {
+			std::string key = std::to_string(i);
+			pmemkv_remove(db, key.data(), key.size());
+		}
+		size_t cnt;
+		ASSERT_EQ(pmemkv_count_all(db, &cnt), PMEMKV_STATUS_OK);
+		ASSERT_EQ(cnt, 0U);
+
+		ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+		s = pmemkv_import(db, fd);
+		ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+
+		std::map<std::string, std::string> records;
+		ASSERT_EQ(pmemkv_get_all(db, get_records, &records), PMEMKV_STATUS_OK);
+		ASSERT_TRUE(records == expected) << nthreads;
+	}
+
+	/* O_DIRECT is not supported by all file systems */
+	int direct = open(file.c_str(), O_WRONLY | O_TRUNC | O_DIRECT);
+	if (direct >= 0) {
+		ASSERT_EQ(pmemkv_export(db, direct, 1), PMEMKV_STATUS_OK)
+			<< pmemkv_errormsg();
+		close(direct);
+		ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+		ASSERT_EQ(pmemkv_import(db, fd), PMEMKV_STATUS_OK) << pmemkv_errormsg();
+	}
+
+	/* a truncated stream is rejected */
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (size > 0) {
+		ASSERT_EQ(ftruncate(fd, size - 1), 0);
+		ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+		ASSERT_EQ(pmemkv_import(db, fd), PMEMKV_STATUS_INVALID_ARGUMENT);
+	}
+
+	ASSERT_EQ(pmemkv_export(db, fd, 0), PMEMKV_STATUS_INVALID_ARGUMENT);
+	close(fd);
+	std::remove(file.c_str());
+}
+
+TEST_P(PmemkvCApiTest, Snapshot)
+{
+	ASSERT_EQ(pmemkv_put(db, "key1", 4, "value1", 6), PMEMKV_STATUS_OK);
+
+	pmemkv_snapshot *snap = NULL;
+	int s = pmemkv_snapshot_new(db, &snap);
+	if (s == PMEMKV_STATUS_NOT_SUPPORTED)
+		return;
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+
+	ASSERT_EQ(pmemkv_put(db, "key1", 4, "value2", 6), PMEMKV_STATUS_OK);
+	ASSERT_EQ(pmemkv_put(db, "key2", 4, "value2", 6), PMEMKV_STATUS_OK);
+
+	std::string value;
+	s = pmemkv_snapshot_get(
+		snap, "key1", 4,
+		[](const char *v, size_t vb, void *arg) {
+			static_cast<std::string *>(arg)->assign(v, vb);
+		},
+		&value);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(value, "value1");
+
+	std::vector<std::string> keys;
+	s = pmemkv_snapshot_get_all(snap, get_prefix_keys, &keys);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(keys, std::vector<std::string>{"key1"});
+
+	keys.clear();
+	s = pmemkv_snapshot_get_between(snap, "key0", 4, "key3", 4, get_prefix_keys,
+					&keys);
+	ASSERT_EQ(PMEMKV_STATUS_OK, s) << pmemkv_errormsg();
+	ASSERT_EQ(keys, std::vector<std::string>{"key1"});
+
+	ASSERT_EQ(pmemkv_snapshot_get(snap, "key2", 4, nullptr, nullptr),
+		  PMEMKV_STATUS_NOT_FOUND);
+	ASSERT_EQ(pmemkv_snapshot_get_all(NULL, get_prefix_keys, &keys),
+		  PMEMKV_STATUS_INVALID_ARGUMENT);
+	pmemkv_snapshot_delete(snap);
 }
 
 TEST_P(PmemkvCApiTest, NullConfig)
@@ -51,6 +51,10 @@ int main()
 	assert(test_wrong_engine_name("vsmap"));
 #endif
 
+#ifndef ENGINE_VSKIPLIST
+	assert(test_wrong_engine_name("vskiplist"));
+#endif
+
 #ifndef ENGINE_VCMAP
 	assert(test_wrong_engine_name("vcmap"));
 #endif
@@ -63,9 +67,29 @@ int main()
 	assert(test_wrong_engine_name("stree"));
 #endif
 
+#ifndef ENGINE_RADIX
+	assert(test_wrong_engine_name("radix"));
+#endif
+
+#ifndef ENGINE_DASH
+	assert(test_wrong_engine_name("dash"));
+#endif
+
 #ifndef ENGINE_CACHING
 	assert(test_wrong_engine_name("caching"));
 #endif
 
+#ifndef ENGINE_READCACHE
+	assert(test_wrong_engine_name("readcache"));
+#endif
+
+#ifndef ENGINE_SHARDED
+	assert(test_wrong_engine_name("sharded"));
+#endif
+
+#ifndef ENGINE_INDEXED
+	assert(test_wrong_engine_name("indexed"));
+#endif
+
 	return 0;
 }
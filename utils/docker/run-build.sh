@@ -125,6 +125,7 @@ cmake .. -DCMAKE_BUILD_TYPE=Debug \
 	-DCOVERAGE=$COVERAGE \
 	-DENGINE_STREE=1 \
 	-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
+	-DBUILD_BENCHMARKS=1 \
 	-DCHECK_CPP_STYLE=${CHECK_CPP_STYLE} \
 	-DDEVELOPER_MODE=1
 
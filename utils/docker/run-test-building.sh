@@ -222,6 +222,7 @@ echo "### Verifying if each engine is building properly"
 echo "##############################################################"
 engines_flags=(
 	ENGINE_VSMAP
+	ENGINE_VSKIPLIST
 	ENGINE_VCMAP
 	ENGINE_CMAP
 	# XXX: caching engine requires libacl and memcached installed in docker images
@@ -229,6 +230,11 @@ engines_flags=(
 	# ENGINE_CACHING
 	ENGINE_STREE
 	ENGINE_TREE3
+	ENGINE_READCACHE
+	ENGINE_SHARDED
+	ENGINE_RADIX
+	ENGINE_DASH
+	ENGINE_INDEXED
 	# the last item is to test all engines disabled
 	BLACKHOLE_TEST
 )
@@ -243,6 +249,7 @@ do
 	echo "### Verifying building of the '$engine_flag' engine"
 	echo "##############################################################"
 	cmake .. -DENGINE_VSMAP=OFF \
+		-DENGINE_VSKIPLIST=OFF \
 		-DENGINE_VCMAP=OFF \
 		-DENGINE_CMAP=OFF \
 		-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG} \
@@ -268,10 +275,16 @@ mkdir $WORKDIR/build
 cd $WORKDIR/build
 
 cmake .. -DENGINE_VSMAP=ON \
+	-DENGINE_VSKIPLIST=ON \
 	-DENGINE_VCMAP=ON \
 	-DENGINE_CMAP=ON \
 	-DENGINE_STREE=ON \
 	-DENGINE_TREE3=ON \
+	-DENGINE_READCACHE=ON \
+	-DENGINE_SHARDED=ON \
+	-DENGINE_RADIX=ON \
+	-DENGINE_DASH=ON \
+	-DENGINE_INDEXED=ON \
 	-DBUILD_JSON_CONFIG=${BUILD_JSON_CONFIG}
 make -j$(nproc)
 # list all tests in this build